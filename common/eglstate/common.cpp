@@ -1,6 +1,7 @@
 #include "common.hpp"
 
-#include <map>
+#include <algorithm>
+#include <vector>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
@@ -19,18 +20,45 @@
 namespace
 {
 
-std::map<int, const char*> sEnumMap;
-std::map<int, const char*> sDrawEnumMap;
-std::map<int, const char*> sEglEnumMap;
+struct EnumName
+{
+    int value;
+    const char *name;
+
+    bool operator<(const EnumName &other) const { return value < other.value; }
+};
+
+/// Sorted by value, looked up with a binary search
+typedef std::vector<EnumName> EnumTable;
 
-bool sInitedEnumMap = false;
+EnumTable sEnumTable;
+EnumTable sDrawEnumTable;
+EnumTable sEglEnumTable;
 
 #define InsertEnumString(e) \
-    sEnumMap.insert(std::pair<int, const char*>((e), (#e)))
+    sEnumTable.push_back(EnumName{ static_cast<int>(e), (#e) })
 #define InsertDrawEnumString(e) \
-    sDrawEnumMap.insert(std::pair<int, const char*>((e), (#e)))
+    sDrawEnumTable.push_back(EnumName{ static_cast<int>(e), (#e) })
 #define InsertEglEnumString(e) \
-    sEglEnumMap.insert(std::pair<int, const char*>((e), (#e)))
+    sEglEnumTable.push_back(EnumName{ static_cast<int>(e), (#e) })
+
+// Several names may have the same value; the first one inserted wins
+void SortEnumTable(EnumTable &table)
+{
+    std::stable_sort(table.begin(), table.end());
+    table.erase(std::unique(table.begin(), table.end(), [](const EnumName &a, const EnumName &b) { return a.value == b.value; }), table.end());
+    table.shrink_to_fit();
+}
+
+const char *FindEnumString(const EnumTable &table, int value)
+{
+    const auto it = std::lower_bound(table.begin(), table.end(), EnumName{ value, NULL });
+    if (it != table.end() && it->value == value)
+    {
+        return it->name;
+    }
+    return NULL;
+}
 
 // TODO: this really should be autogenerated from gl.xml
 void InitEnumMap()
@@ -1755,25 +1783,54 @@ void InitEnumMap()
     InsertEnumString(GL_PROGRAM_PIPELINE);
     InsertEnumString(GL_SAMPLER);
 
-    sInitedEnumMap = true;
+    SortEnumTable(sEnumTable);
+    SortEnumTable(sDrawEnumTable);
+    SortEnumTable(sEglEnumTable);
 }
 
 }
 
-const char * EnumString(unsigned int enumToFind, const std::string &funName)
+unsigned int EnumFunctionFlags(const std::string &funName)
 {
-    if ( !sInitedEnumMap ) InitEnumMap();
-
+    unsigned int flags = 0;
     if (funName.compare(0, 3, "egl") == 0)
     {
-        const auto& citer = sEglEnumMap.find(enumToFind);
-        if (citer != sEglEnumMap.end())
+        flags |= ENUM_FUNCTION_EGL;
+    }
+    if (funName.find("glBlend") != std::string::npos)
+    {
+        flags |= ENUM_FUNCTION_BLEND;
+    }
+    if (funName.find("glTexParameter") != std::string::npos)
+    {
+        flags |= ENUM_FUNCTION_TEXPARAMETER;
+    }
+    if (funName.find("glDraw") != std::string::npos)
+    {
+        flags |= ENUM_FUNCTION_DRAW;
+    }
+    if (funName == "glGetError")
+    {
+        flags |= ENUM_FUNCTION_GETERROR;
+    }
+    return flags;
+}
+
+const char * EnumString(unsigned int enumToFind, unsigned int funFlags)
+{
+    static const bool inited = (InitEnumMap(), true); // thread safe, once
+    (void)inited;
+
+    if (funFlags & ENUM_FUNCTION_EGL)
+    {
+        const char *str = FindEnumString(sEglEnumTable, enumToFind);
+        if (str)
         {
-            return citer->second;
+            return str;
         }
     }
 
-    if (funName.find("glBlend") != std::string::npos) // needs special handling
+    if (funFlags & ENUM_FUNCTION_BLEND) // needs special handling
     {
         if (enumToFind == GL_ZERO)
         {
@@ -1785,7 +1842,7 @@ const char * EnumString(unsigned int enumToFind, const std::string &funName)
         }
     }
 
-    if (funName.find("glTexParameter") != std::string::npos) // texturing, needs special handling
+    if (funFlags & ENUM_FUNCTION_TEXPARAMETER) // texturing, needs special handling
     {
         if (enumToFind == GL_NONE)
         {
@@ -1793,27 +1850,26 @@ const char * EnumString(unsigned int enumToFind, const std::string &funName)
         }
     }
 
-    if (funName.find("glDraw") != std::string::npos)
+    if (funFlags & ENUM_FUNCTION_DRAW)
     {
-        const auto& citer = sDrawEnumMap.find(enumToFind);
-        if (citer != sDrawEnumMap.end())
+        const char *str = FindEnumString(sDrawEnumTable, enumToFind);
+        if (str)
         {
-            return citer->second;
+            return str;
         }
     }
 
-    if (funName == "glGetError")
+    if (funFlags & ENUM_FUNCTION_GETERROR)
     {
         return "GL_NO_ERROR";
     }
 
-    const auto& citer = sEnumMap.find(enumToFind);
-    if (citer != sEnumMap.end())
-    {
-        return citer->second;
-    }
+    return FindEnumString(sEnumTable, enumToFind);
+}
 
-    return NULL;
+const char * EnumString(unsigned int enumToFind, const std::string &funName)
+{
+    return EnumString(enumToFind, EnumFunctionFlags(funName));
 }
 
 const std::string Cube2D::asString() const
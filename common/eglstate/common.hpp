@@ -27,6 +27,19 @@
 // it means GL_NONE.
 const char * EnumString(unsigned int e, const std::string &funName = std::string());
 
+// The function specific meanings EnumString() knows about. Work these out once
+// per function with EnumFunctionFlags() when converting many enums.
+enum EnumFunctionFlag
+{
+    ENUM_FUNCTION_EGL = 1 << 0,
+    ENUM_FUNCTION_BLEND = 1 << 1,
+    ENUM_FUNCTION_TEXPARAMETER = 1 << 2,
+    ENUM_FUNCTION_DRAW = 1 << 3,
+    ENUM_FUNCTION_GETERROR = 1 << 4,
+};
+unsigned int EnumFunctionFlags(const std::string &funName);
+const char * EnumString(unsigned int e, unsigned int funFlags);
+
 struct Cube2D
 {
     Cube2D()
@@ -36,23 +36,23 @@ TraceLooper::TraceLooper(int argc, char* argv[]) {
 
 
 TraceLooper::~TraceLooper() {
-    for (auto call_ptr : calls) {
-        if (call_ptr) {
-            delete call_ptr;
-        }
-    }
 }
 
 
+// First pass: only record frame boundaries and what the state extraction needs per funcId,
+// the calls themselves are streamed from the trace again by write_loop_trace().
 void TraceLooper::load() {
     ILOG("Loading trace: " + str_args["trace_file"]);
-    common::TraceFileTM trace_file(str_args["trace_file"].c_str(), false);
+    common::InFile trace_file;
 
-    frame_ranges.push_back(std::pair<int, int>(0, 0));
+    if (!trace_file.Open(str_args["trace_file"].c_str())) {
+        ELOG("Failed to open trace file: " + str_args["trace_file"]);
+        exit(1);
+    }
 
-    header = trace_file.mpInFileRA->getJSONHeaderAsString();
+    frame_ranges.push_back(std::pair<int, int>(0, 0));
 
-    Json::Value json_header = trace_file.mpInFileRA->getJSONHeader();
+    json_header = trace_file.getJSONHeader();
 
     main_thread_ID = json_header.get("defaultTid", -1).asInt();
 
@@ -63,34 +63,75 @@ void TraceLooper::load() {
 
     ILOG("Main thread ID set to: " + std::to_string(main_thread_ID));
 
-    common::CallTM* current_call = trace_file.NextCall();
+    sigbook = trace_file.getFuncNames();
+    func_flags.assign(sigbook.size(), 0);
+
+    for (size_t id = 1; id < sigbook.size(); ++id) {
+        if (call_is_draw(sigbook[id])) {
+            func_flags[id] |= CALL_FLAG_DRAW;
+        }
+
+        if (call_is_state_changer(sigbook[id])) {
+            func_flags[id] |= CALL_FLAG_STATE_CHANGER;
+        }
+
+        if (call_is_swap(sigbook[id])) {
+            func_flags[id] |= CALL_FLAG_SWAP;
+        }
+    }
+
+    const int target_frame = int_args["target_frame"];
+    seen_before_target_frame.assign(sigbook.size(), false);
+
+    void* fptr = nullptr;
+    common::BCall_vlen call;
+    char* src = nullptr;
     int call_index = 0;
 
-    while (current_call) {
-        add_call(current_call);
+    while (trace_file.GetNextCall(fptr, call, src)) {
+        const int frame_index = frame_ranges.size() - 1;
 
-        if (call_is_swap(current_call) && ((long)current_call->mTid == main_thread_ID)) {
+        if (frame_index < target_frame) {
+            if (call_index > 0) {
+                seen_before_target_frame[call.funcId] = true;
+            }
+        } else if (frame_index == target_frame) {
+            target_frame_funcs.push_back(call.funcId);
+        }
+
+        if ((func_flags[call.funcId] & CALL_FLAG_SWAP) && ((long)call.tid == main_thread_ID)) {
             frame_ranges[frame_ranges.size() - 1].second = call_index;
             frame_ranges.push_back(std::pair<int, int>(call_index + 1, 0));
         }
 
-        current_call = trace_file.NextCall();
         call_index += 1;
     }
 
-    frame_ranges[frame_ranges.size() - 1].second = call_index;
+    // The last frame ends at the last call of the trace
+    frame_ranges[frame_ranges.size() - 1].second = call_index - 1;
+    num_calls = call_index;
 
     trace_file.Close();
 
     ILOG("Num frames in trace: " + std::to_string(frame_ranges.size()));
 
-    ILOG("Num calls in trace: " + std::to_string(calls.size()));
+    ILOG("Num calls in trace: " + std::to_string(num_calls));
 }
 
 
 void TraceLooper::process() {
     ILOG("Processing trace: " + str_args["trace_file"]);
 
+    if (bool_args["loop_frame_selected"] && int_args["target_frame"] >= (int)frame_ranges.size()) {
+        ELOG("Target frame " + std::to_string(int_args["target_frame"]) + " is not in the trace");
+        exit(1);
+    }
+
+    if (bool_args["loop_range_selected"] && int_args["end_call_index"] >= num_calls) {
+        ELOG("--range-loop-end " + std::to_string(int_args["end_call_index"]) + " is not in the trace");
+        exit(1);
+    }
+
     if (bool_args["reset_loop_state"]) {
         extract_pre_frame_state_calls();
     }
@@ -113,15 +154,14 @@ void TraceLooper::process() {
 }
 
 
-void TraceLooper::get_frame_loop_header(std::string& out_string, const std::string& md5_string) {
-    common::TraceFileTM trace_file(str_args["trace_file"].c_str(), false);
-    Json::Value json_header = trace_file.mpInFileRA->getJSONHeader();
+void TraceLooper::get_frame_loop_header(std::string& out_string, const std::string& md5_string, unsigned int call_count) {
+    Json::Value out_header = json_header;
 
-    json_header["callCnt"] = static_cast<unsigned int>(frame_loop_call_writelist.size());
-    json_header["frameCnt"] = int_args["num_loops"];
+    out_header["callCnt"] = call_count;
+    out_header["frameCnt"] = int_args["num_loops"];
 
-    if (!(json_header.isMember("conversions") && json_header["conversions"].isArray())) {
-        json_header["conversions"] = Json::Value(Json::arrayValue);
+    if (!(out_header.isMember("conversions") && out_header["conversions"].isArray())) {
+        out_header["conversions"] = Json::Value(Json::arrayValue);
     }
 
     Json::Value new_conversion;
@@ -132,7 +172,7 @@ void TraceLooper::get_frame_loop_header(std::string& out_string, const std::stri
     new_conversion["info"]["originalFrame"] = int_args["target_frame"];
     new_conversion["info"]["versions"] = Json::Value();
     new_conversion["info"]["versions"]["trace_looper"] = TRACE_LOOPER_VERSION;
-    new_conversion["info"]["versions"]["retracer"] = json_header["tracer"];
+    new_conversion["info"]["versions"]["retracer"] = out_header["tracer"];
 
     new_conversion["input"] = Json::Value();
     new_conversion["input"]["file"] = str_args["trace_file"];
@@ -142,22 +182,21 @@ void TraceLooper::get_frame_loop_header(std::string& out_string, const std::stri
     new_conversion["type"] = "frame_loop_trace";
     new_conversion["tool"] = "trace_looper";
 
-    json_header["conversions"].append(new_conversion);
+    out_header["conversions"].append(new_conversion);
 
     Json::FastWriter writer;
-    out_string = writer.write(json_header);
+    out_string = writer.write(out_header);
 }
 
 
-void TraceLooper::get_range_loop_header(std::string& out_string, const std::string& md5_string) {
-    common::TraceFileTM trace_file(str_args["trace_file"].c_str(), false);
-    Json::Value json_header = trace_file.mpInFileRA->getJSONHeader();
+void TraceLooper::get_range_loop_header(std::string& out_string, const std::string& md5_string, unsigned int call_count) {
+    Json::Value out_header = json_header;
 
-    json_header["callCnt"] = static_cast<unsigned int>(range_loop_call_writelist.size());
-    json_header["frameCnt"] = 0;
+    out_header["callCnt"] = call_count;
+    out_header["frameCnt"] = 0;
 
-    if (!(json_header.isMember("conversions") && json_header["conversions"].isArray())) {
-        json_header["conversions"] = Json::Value(Json::arrayValue);
+    if (!(out_header.isMember("conversions") && out_header["conversions"].isArray())) {
+        out_header["conversions"] = Json::Value(Json::arrayValue);
     }
 
     Json::Value new_conversion;
@@ -169,7 +208,7 @@ void TraceLooper::get_range_loop_header(std::string& out_string, const std::stri
     new_conversion["info"]["callRangeEnd"] = int_args["end_call_index"];
     new_conversion["info"]["versions"] = Json::Value();
     new_conversion["info"]["versions"]["trace_looper"] = TRACE_LOOPER_VERSION;
-    new_conversion["info"]["versions"]["retracer"] = json_header["tracer"];
+    new_conversion["info"]["versions"]["retracer"] = out_header["tracer"];
 
     new_conversion["input"] = Json::Value();
     new_conversion["input"]["file"] = str_args["trace_file"];
@@ -179,78 +218,194 @@ void TraceLooper::get_range_loop_header(std::string& out_string, const std::stri
     new_conversion["type"] = "range_loop_trace";
     new_conversion["tool"] = "trace_looper";
 
-    json_header["conversions"].append(new_conversion);
-
-    trace_file.Close();
+    out_header["conversions"].append(new_conversion);
 
     Json::FastWriter writer;
-    out_string = writer.write(json_header);
+    out_string = writer.write(out_header);
 }
 
 
 std::string TraceLooper::calc_trace_md5() {
-    std::ifstream infile(str_args["trace_file"].c_str(), std::ios::binary | std::ios::ate);
-    std::streamsize size = infile.tellg();
-    infile.seekg(0, std::ios::beg);
-
-    std::vector<char> data(size);
-    if (infile.read(data.data(), size)) {
-        common::MD5Digest trace_mdh = common::MD5Digest(reinterpret_cast<void*>(data.data()), data.size());
-        return trace_mdh.text_lower();
+    std::ifstream infile(str_args["trace_file"].c_str(), std::ios::binary);
+
+    if (!infile) {
+        return "(failed to generate MD5)";
+    }
+
+    md5_state_t md5_context;
+    md5_init(&md5_context);
+
+    std::vector<char> data(16 * 1024 * 1024);
+
+    while (infile) {
+        infile.read(data.data(), data.size());
+        const std::streamsize bytes_read = infile.gcount();
+
+        if (bytes_read > 0) {
+            md5_append(&md5_context, reinterpret_cast<const unsigned char*>(data.data()), bytes_read);
+        }
     }
 
-    return "(failed to generate MD5)";
+    if (!infile.eof()) {
+        return "(failed to generate MD5)";
+    }
+
+    common::MD5Digest trace_mdh;
+    md5_finish(&md5_context, trace_mdh);
+    return trace_mdh.text_lower();
+}
+
+
+// Second pass: stream the source trace and copy the calls of the plan as raw bytes. Only
+// the looped range is buffered, so memory use is bounded by the size of that range.
+unsigned int TraceLooper::write_loop_trace(const LoopPlan& plan, common::OutFile& outfile) {
+    common::InFile trace_file;
+
+    if (!trace_file.Open(str_args["trace_file"].c_str())) {
+        ELOG("Failed to open trace file: " + str_args["trace_file"]);
+        exit(1);
+    }
+
+    std::vector<char> loop_data;
+    // offset into loop_data and size of each call in the looped range
+    std::vector<std::pair<size_t, unsigned int>> loop_spans;
+    loop_spans.reserve(std::max(0, plan.loop_end - plan.loop_start + 1));
+
+    unsigned int call_count = 0;
+
+    auto write_call = [&](const char* data, unsigned int size) {
+        outfile.Write(data, size);
+        call_count += 1;
+    };
+
+    auto write_loop_call = [&](int index) {
+        const std::pair<size_t, unsigned int>& span = loop_spans[index - plan.loop_start];
+        write_call(loop_data.data() + span.first, span.second);
+    };
+
+    bool loops_written = false;
+
+    auto write_loops = [&]() {
+        for (int i = 0; i < plan.num_loops; ++i) {
+            for (int index : plan.loop_prologue) {
+                write_loop_call(index);
+            }
+
+            for (int index : plan.loop_body) {
+                write_loop_call(index);
+            }
+        }
+
+        for (int index : plan.loop_prologue) {
+            write_loop_call(index);
+        }
+
+        for (int index = plan.loop_start; index <= plan.loop_end; ++index) {
+            write_loop_call(index);
+        }
+
+        loops_written = true;
+    };
+
+    common::RawCallReader reader(trace_file);
+    // Traces older than HEADER_VERSION_4 encode some texture calls differently from what
+    // OutFile writes, so their calls are re-encoded instead of copied
+    std::vector<char> reencoded;
+    int call_index = 0;
+
+    while (reader.next()) {
+        const char* data = reader.data();
+        unsigned int size = reader.size();
+
+        if (!reader.isCurrentFormat()) {
+            size = reader.reencode(reencoded);
+            data = reencoded.data();
+        }
+
+        if (call_index < plan.pre_end) {
+            if (!(func_flags[reader.funcId()] & CALL_FLAG_SWAP)) {
+                write_call(data, size);
+            }
+        } else if (call_index >= plan.loop_start && call_index <= plan.loop_end) {
+            loop_spans.push_back(std::pair<size_t, unsigned int>(loop_data.size(), size));
+            loop_data.insert(loop_data.end(), data, data + size);
+
+            if (call_index == plan.loop_end) {
+                write_loops();
+
+                if (!plan.include_tail) {
+                    break;
+                }
+
+                ILOG("Adding trace tail...");
+            }
+        } else if (call_index > plan.loop_end && plan.include_tail) {
+            write_call(data, size);
+        }
+
+        call_index += 1;
+    }
+
+    // The looped range is empty, e.g. when looping past the last swap of the trace
+    if (!loops_written) {
+        write_loops();
+    }
+
+    trace_file.Close();
+
+    return call_count;
 }
 
 
 void TraceLooper::save() {
     std::string trace_md5 = calc_trace_md5();
 
-    if (frame_loop_call_writelist.size() > 0) {
+    if (bool_args["loop_frame_selected"]) {
         build_output_file_path();
 
         ILOG("Saving output frame looping trace as: " + str_args["output_filepath"]);
 
-        common::OutFile outfile(str_args["output_filepath"].c_str());
+        // Calls are copied verbatim, so the output must keep the funcIds of the source trace
+        common::OutFile outfile;
+        if (!outfile.Open(str_args["output_filepath"].c_str(), true, &sigbook)) {
+            ELOG("Failed to open output file: " + str_args["output_filepath"]);
+            exit(1);
+        }
+
+        const unsigned int call_count = write_loop_trace(frame_loop_plan, outfile);
+
+        ILOG("Total number of calls in frame looping trace: " + std::to_string(call_count));
 
         std::string string_header;
-        get_frame_loop_header(string_header, trace_md5);
+        get_frame_loop_header(string_header, trace_md5, call_count);
 
         outfile.WriteHeader(string_header.c_str(), string_header.size());
 
-        for (auto call : frame_loop_call_writelist) {
-            const unsigned int WRITE_BUF_LEN = 100 * 1024 * 1024;
-            static char buffer[WRITE_BUF_LEN];
-            char *dest = buffer;
-            dest = call->Serialize(dest);
-            outfile.Write(buffer, dest - buffer);
-        }
-
         outfile.Close();
 
         OKLOG("Frame looping trace saved as: " + str_args["output_filepath"]);
     }
 
-    if (range_loop_call_writelist.size() > 0) {
+    if (bool_args["loop_range_selected"]) {
         build_output_file_path_range_trace();
 
         ILOG("Saving output range looping trace as: " + str_args["output_filepath_range_trace"]);
 
-        common::OutFile range_outfile(str_args["output_filepath_range_trace"].c_str());
+        common::OutFile range_outfile;
+        if (!range_outfile.Open(str_args["output_filepath_range_trace"].c_str(), true, &sigbook)) {
+            ELOG("Failed to open output file: " + str_args["output_filepath_range_trace"]);
+            exit(1);
+        }
+
+        const unsigned int call_count = write_loop_trace(range_loop_plan, range_outfile);
+
+        ILOG("Total number of calls in range looping trace: " + std::to_string(call_count));
 
         std::string string_header;
-        get_range_loop_header(string_header, trace_md5);
+        get_range_loop_header(string_header, trace_md5, call_count);
 
         range_outfile.WriteHeader(string_header.c_str(), string_header.size());
 
-        for (auto call : range_loop_call_writelist) {
-            const unsigned int WRITE_BUF_LEN = 100 * 1024 * 1024;
-            static char buffer[WRITE_BUF_LEN];
-            char *dest = buffer;
-            dest = call->Serialize(dest);
-            range_outfile.Write(buffer, dest - buffer);
-        }
-
         range_outfile.Close();
 
         OKLOG("Range looping trace saved as: " + str_args["output_filepath_range_trace"]);
@@ -283,28 +438,6 @@ void TraceLooper::print_trace_info() {
 }
 
 
-void TraceLooper::add_call(const common::CallTM* incall)
-{
-    common::CallTM* outcall = new common::CallTM(incall->mCallName.c_str());
-    outcall->mReadPos = incall->mReadPos;
-    outcall->mCallNo = incall->mCallNo;
-    outcall->mTid = incall->mTid;
-    outcall->mCallId = incall->mCallId;
-    outcall->mCallErrNo = incall->mCallErrNo;
-    outcall->mRet = incall->mRet;
-
-    int num_args = incall->mArgs.size();
-    outcall->mArgs.resize(num_args);
-
-    for (int i = 0; i < num_args; ++i) {
-        outcall->mArgs[i] = new common::ValueTM;
-        *(outcall->mArgs[i]) = *(incall->mArgs[i]);
-    }
-
-    calls.push_back(outcall);
-}
-
-
 void TraceLooper::build_output_file_path() {
     ILOG("Generating output path frame looping trace...");
 
@@ -363,13 +496,13 @@ void TraceLooper::build_output_file_path_range_trace() {
 }
 
 
-bool TraceLooper::call_is_state_changer(const common::CallTM* call) {
-    return EXCLUDED_PRE_FRAME_CALLS.count(call->Name()) > 0;
+bool TraceLooper::call_is_state_changer(const std::string& call_name) {
+    return EXCLUDED_PRE_FRAME_CALLS.count(call_name) > 0;
 }
 
 
-bool TraceLooper::call_is_swap(const common::CallTM* call) {
-    return SWAP_CALL_NAMES.count(call->Name()) > 0;
+bool TraceLooper::call_is_swap(const std::string& call_name) {
+    return SWAP_CALL_NAMES.count(call_name) > 0;
 }
 
 
@@ -379,10 +512,14 @@ void TraceLooper::extract_pre_frame_state_calls() {
     int frame_start_index = frame_ranges[int_args["target_frame"]].first;
     int frame_end_index = frame_ranges[int_args["target_frame"]].second;
 
+    auto func_id_at = [&](int index) {
+        return target_frame_funcs[index - frame_start_index];
+    };
+
     int curr_index = frame_start_index;
 
     for (int i = frame_start_index; i <= frame_end_index; ++i) {
-        if (call_is_draw(calls[i])) {
+        if (func_flags[func_id_at(i)] & CALL_FLAG_DRAW) {
             curr_index = i + 1;
             break;
         }
@@ -393,35 +530,34 @@ void TraceLooper::extract_pre_frame_state_calls() {
         return;
     }
 
-    bool found_pre_frame_call = false;
+    // A state call needs to be replayed before each loop if its last previous occurrence is
+    // before the target frame, i.e. the frame relies on state set up outside of itself.
+    std::vector<bool> seen_in_frame(sigbook.size(), false);
 
-    for (int i = curr_index; i <= frame_end_index; ++i) {
-        if (!call_is_state_changer(calls[i])) {
-            continue;
+    for (int i = frame_start_index; i < curr_index; ++i) {
+        if (i > 0) {
+            seen_in_frame[func_id_at(i)] = true;
         }
+    }
 
-        for (int y = i - 1; y > 0; --y) {
-            if (!call_is_state_changer(calls[i])) {
-                continue;
-            } else if (calls[i]->Name() == calls[y]->Name()) {
-                if (y >= frame_start_index) {
-                    found_pre_frame_call = true;
-                    break;
-                } else {
-                    prestate_calls.push_back(calls[i]);
-                    pre_state_calls.push_back(calls[i]->Name());
-                    found_pre_frame_call = true;
-                    break;
-                }
+    for (int i = curr_index; i <= frame_end_index; ++i) {
+        const unsigned short func_id = func_id_at(i);
+
+        if (func_flags[func_id] & CALL_FLAG_STATE_CHANGER) {
+            if (seen_in_frame[func_id]) {
+                // set up earlier in the frame itself
+            } else if (seen_before_target_frame[func_id]) {
+                prestate_calls.push_back(i);
+                pre_state_calls.push_back(sigbook[func_id]);
+            } else {
+                WLOG("Failed to find pre frame setup for state call: " + sigbook[func_id] \
+                    + ", trace possibly relies on default state." \
+                    + " Update the trace_looper to reflect this case!");
             }
         }
 
-        if (!found_pre_frame_call) {
-            WLOG("Failed to find pre frame setup for state call: " + calls[i]->Name() \
-                + ", trace possibly relies on default state." \
-                + " Update the trace_looper to reflect this case!");
-        } else {
-            found_pre_frame_call = false;
+        if (i > 0) {
+            seen_in_frame[func_id] = true;
         }
     }
 
@@ -437,83 +573,35 @@ void TraceLooper::add_frame_loop_calls(int target_frame, int num_loops, bool res
 
     ILOG("Looping call range: " + std::to_string(start_call_index) + "-" + std::to_string(end_call_index) + " (frame number " + std::to_string(target_frame) + ")");
 
-    std::vector<common::CallTM*> pre_frame_calls;
+    LoopPlan& plan = frame_loop_plan;
 
     if (target_frame > 0) {
-        pre_frame_calls.reserve(frame_ranges[target_frame - 1].second);
-
-        for (int i = 0; i < frame_ranges[target_frame - 1].second; ++i) {
-            if (!call_is_swap(calls[i])) {
-                pre_frame_calls.push_back(calls[i]);
-            }
-        }
+        plan.pre_end = frame_ranges[target_frame - 1].second;
     }
 
-    ILOG("Number of pre frame calls: " + std::to_string(pre_frame_calls.size()));
+    plan.loop_start = start_call_index;
+    plan.loop_end = end_call_index;
+    plan.num_loops = num_loops;
+    plan.include_tail = bool_args["include_tail"];
 
-    std::vector<common::CallTM*> frame_calls;
+    std::vector<int> frame_calls;
     frame_calls.reserve(end_call_index - start_call_index + 1);
 
     for (int i = start_call_index; i <= end_call_index; ++i) {
-        frame_calls.push_back(calls[i]);
+        frame_calls.push_back(i);
     }
 
     ILOG("Number of target frame calls: " + std::to_string(frame_calls.size()));
 
-    std::vector<common::CallTM*> cleaned_frame_calls;
-
     if (bool_args["clean_trace"]) {
-        clean_loop_frame_calls(&frame_calls, &cleaned_frame_calls);
+        clean_loop_frame_calls(frame_calls, &plan.loop_body);
     } else {
-        cleaned_frame_calls = frame_calls;
+        plan.loop_body = frame_calls;
     }
 
-    int total_calls = pre_frame_calls.size() + cleaned_frame_calls.size() * num_loops + frame_calls.size();
-
-    frame_loop_call_writelist.reserve(total_calls);
-
-    frame_loop_call_writelist.insert(
-        frame_loop_call_writelist.end(),
-        pre_frame_calls.begin(),
-        pre_frame_calls.end());
-
-    for (int i = 0; i < num_loops; ++i) {
-        if (bool_args["reset_loop_state"]) {
-            frame_loop_call_writelist.insert(
-                frame_loop_call_writelist.end(),
-                prestate_calls.begin(),
-                prestate_calls.end());
-        }
-
-        frame_loop_call_writelist.insert(
-            frame_loop_call_writelist.end(),
-            cleaned_frame_calls.begin(),
-            cleaned_frame_calls.end());
-    }
-
-    if (bool_args["reset_loop_state"]) {
-        frame_loop_call_writelist.insert(
-            frame_loop_call_writelist.end(),
-            prestate_calls.begin(),
-            prestate_calls.end());
-    }
-
-    frame_loop_call_writelist.insert(
-        frame_loop_call_writelist.end(),
-        frame_calls.begin(),
-        frame_calls.end());
-
-    if (bool_args["include_tail"]) {
-        ILOG("Adding trace tail...");
-
-        for (size_t i = end_call_index + 1; i < calls.size(); ++i) {
-            frame_loop_call_writelist.push_back(calls[i]);
-        }
-
-        ILOG("Tail calls added: " + std::to_string(frame_loop_call_writelist.size()));
+    if (reset_loop_state) {
+        plan.loop_prologue = prestate_calls;
     }
-
-    ILOG("Total number of calls in frame looping trace queued for writeout: " + std::to_string(frame_loop_call_writelist.size()));
 }
 
 
@@ -521,80 +609,45 @@ void TraceLooper::add_range_loop_calls(int start_call_index, int end_call_index,
     ILOG("Adding range loop calls...");
     ILOG("Looping call range: " + std::to_string(start_call_index) + "-" + std::to_string(end_call_index));
 
-    std::vector<common::CallTM*> pre_range_calls;
+    LoopPlan& plan = range_loop_plan;
 
     if (start_call_index > 0) {
-        pre_range_calls.reserve(start_call_index);
-
-        for (int i = 0; i < start_call_index - 1; ++i) {
-            if (!call_is_swap(calls[i])) {
-                pre_range_calls.push_back(calls[i]);
-            }
-        }
+        plan.pre_end = start_call_index - 1;
     }
 
-    ILOG("Number of pre range calls: " + std::to_string(pre_range_calls.size()));
-
-    std::vector<common::CallTM*> range_calls;
-    range_calls.reserve(end_call_index - start_call_index + 1);
+    plan.loop_start = start_call_index;
+    plan.loop_end = end_call_index;
+    plan.num_loops = num_loops;
+    plan.include_tail = bool_args["include_tail"];
 
     for (int i = start_call_index; i <= end_call_index; ++i) {
-        range_calls.push_back(calls[i]);
-    }
-
-    ILOG("Number of target range calls: " + std::to_string(range_calls.size()));
-
-    int total_calls = pre_range_calls.size() + range_calls.size() * num_loops + range_calls.size();
-
-    range_loop_call_writelist.reserve(total_calls);
-
-    range_loop_call_writelist.insert(
-        range_loop_call_writelist.end(),
-        pre_range_calls.begin(),
-        pre_range_calls.end());
-
-    for (int i = 0; i < num_loops; ++i) {
-        range_loop_call_writelist.insert(
-            range_loop_call_writelist.end(),
-            range_calls.begin(),
-            range_calls.end());
-    }
-
-    range_loop_call_writelist.insert(
-        range_loop_call_writelist.end(),
-        range_calls.begin(),
-        range_calls.end());
-
-    if (bool_args["include_tail"]) {
-        ILOG("Adding trace tail...");
-
-        for (size_t i = end_call_index + 1; i < calls.size(); ++i) {
-            range_loop_call_writelist.push_back(calls[i]);
-        }
-
-        ILOG("Tail calls added: " + std::to_string(range_loop_call_writelist.size()));
+        plan.loop_body.push_back(i);
     }
 
-    ILOG("Total number of calls in range looping trace queued for writeout: " + std::to_string(range_loop_call_writelist.size()));
+    ILOG("Number of target range calls: " + std::to_string(plan.loop_body.size()));
 }
 
 
-bool TraceLooper::call_is_draw(const common::CallTM* call) {
-    return GL_DRAW_CALL_NAMES.count(call->Name()) > 0;
+bool TraceLooper::call_is_draw(const std::string& call_name) {
+    return GL_DRAW_CALL_NAMES.count(call_name) > 0;
 }
 
 
 void TraceLooper::clean_loop_frame_calls(
-    std::vector<common::CallTM*>* raw_calls,
-    std::vector<common::CallTM*>* clean_calls
+    const std::vector<int>& raw_calls,
+    std::vector<int>* clean_calls
 ) {
     int last_draw_index = -1;
     int curr_index = 0;
 
-    ILOG("Num calls pre clean: " + std::to_string(raw_calls->size()));
+    if (raw_calls.empty()) {
+        return;
+    }
+
+    ILOG("Num calls pre clean: " + std::to_string(raw_calls.size()));
 
-    for (auto raw_call : *raw_calls) {
-        if (call_is_draw(raw_call)) {
+    for (int raw_call : raw_calls) {
+        if (func_flags[target_frame_funcs[raw_call - raw_calls.front()]] & CALL_FLAG_DRAW) {
             last_draw_index = curr_index;
         }
 
@@ -603,23 +656,23 @@ void TraceLooper::clean_loop_frame_calls(
 
     if (last_draw_index == -1) {
         ELOG("No draws in frame, not cleaning");
-        clean_calls = raw_calls;
+        *clean_calls = raw_calls;
         return;
     }
 
     clean_calls->reserve(last_draw_index + 1);
 
     for (int i = 0; i <= last_draw_index; ++i) {
-        clean_calls->push_back((*raw_calls)[i]);
+        clean_calls->push_back(raw_calls[i]);
     }
 
-    for (size_t i = last_draw_index + 1; i < raw_calls->size() - 1; ++i) {
-        cleaned_calls.push_back((*raw_calls)[i]->Name());
+    for (size_t i = last_draw_index + 1; i < raw_calls.size() - 1; ++i) {
+        cleaned_calls.push_back(sigbook[target_frame_funcs[raw_calls[i] - raw_calls.front()]]);
     }
 
     ILOG("Num calls after clean: " + std::to_string(clean_calls->size()));
 
-    clean_calls->push_back(raw_calls->back());
+    clean_calls->push_back(raw_calls.back());
 }
 
 
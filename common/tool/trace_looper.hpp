@@ -12,10 +12,11 @@
 
 #include <common/memory.hpp>
 #include <common/out_file.hpp>
-#include <common/trace_model.hpp>
+#include <common/in_file_mt.hpp>
+#include <common/raw_call_reader.hpp>
 #include <json/writer.h>
 
-#define TRACE_LOOPER_VERSION "r0p3"
+#define TRACE_LOOPER_VERSION "r0p4"
 
 void log_message(
     const char* filename,
@@ -51,15 +52,14 @@ class TraceLooper {
     void process();
     void save();
 
-    void add_call(const common::CallTM* incall);
     void add_frame_loop_calls(int target_frame, int num_loops, bool reset_loop_state);
     void add_range_loop_calls(int start_call, int end_call, int num_loops);
 
     void print_trace_info();
 
-    static bool call_is_state_changer(const common::CallTM* call);
-    static bool call_is_draw(const common::CallTM* call);
-    static bool call_is_swap(const common::CallTM* call);
+    static bool call_is_state_changer(const std::string& call_name);
+    static bool call_is_draw(const std::string& call_name);
+    static bool call_is_swap(const std::string& call_name);
     static const std::unordered_set<std::string> GL_DRAW_CALL_NAMES;
     static const std::unordered_set<std::string> EXCLUDED_PRE_FRAME_CALLS;
     static const std::unordered_set<std::string> SWAP_CALL_NAMES;
@@ -67,7 +67,26 @@ class TraceLooper {
  private:
     TraceLooper() = delete;
 
+    enum CallFlags {
+        CALL_FLAG_DRAW = 1 << 0,
+        CALL_FLAG_STATE_CHANGER = 1 << 1,
+        CALL_FLAG_SWAP = 1 << 2
+    };
+
+    // Describes an output trace as call indices into the source trace, so that it can
+    // be streamed out in a second pass without holding the source trace in memory.
+    struct LoopPlan {
+        int pre_end = 0;                  // calls [0, pre_end) except swaps go before the loop
+        int loop_start = 0;               // first call of the looped range
+        int loop_end = -1;                // last call of the looped range (inclusive)
+        int num_loops = 0;
+        bool include_tail = false;
+        std::vector<int> loop_prologue;   // calls replayed before each iteration and after the last one
+        std::vector<int> loop_body;       // calls replayed in each iteration
+    };
+
     int main_thread_ID;
+    int num_calls = 0;
 
     std::string full_cmd_line;
     std::string timestamp_string;
@@ -78,23 +97,31 @@ class TraceLooper {
     std::unordered_map<std::string, bool> bool_args;
 
     std::vector<std::pair<int, int>> frame_ranges;
-    std::vector<common::CallTM*> calls;
-    std::vector<common::CallTM*> prestate_calls;
-    std::vector<common::CallTM*> frame_loop_call_writelist;
-    std::vector<common::CallTM*> range_loop_call_writelist;
+
+    // Collected in the first pass, indexed by funcId of the source trace
+    std::vector<std::string> sigbook;
+    std::vector<unsigned char> func_flags;
+    std::vector<bool> seen_before_target_frame;
+    // funcIds of the calls in the target frame, in call order
+    std::vector<unsigned short> target_frame_funcs;
+
+    std::vector<int> prestate_calls;
+    LoopPlan frame_loop_plan;
+    LoopPlan range_loop_plan;
 
     std::vector<std::string> cleaned_calls;
     std::vector<std::string> pre_state_calls;
 
-    std::string header;
+    Json::Value json_header;
 
     void clean_loop_frame_calls(
-        std::vector<common::CallTM*>* calls,
-        std::vector<common::CallTM*>* clean_calls);
+        const std::vector<int>& calls,
+        std::vector<int>* clean_calls);
 
     void build_output_file_path();
     void build_output_file_path_range_trace();
     void extract_pre_frame_state_calls();
+    unsigned int write_loop_trace(const LoopPlan& plan, common::OutFile& outfile);
 
     static void print_args_info();
     void set_arg_defaults();
@@ -104,8 +131,8 @@ class TraceLooper {
     bool args_are_valid();
 
     std::string calc_trace_md5();
-    void get_range_loop_header(std::string& out_string, const std::string& md5_string);
-    void get_frame_loop_header(std::string& out_string, const std::string& md5_string);
+    void get_range_loop_header(std::string& out_string, const std::string& md5_string, unsigned int call_count);
+    void get_frame_loop_header(std::string& out_string, const std::string& md5_string, unsigned int call_count);
 };
 
 
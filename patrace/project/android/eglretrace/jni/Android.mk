@@ -256,6 +256,7 @@ LOCAL_SRC_FILES     := \
     dispatch/eglproc_retrace.cpp \
     dispatch/eglproc_auto.cpp \
     fastforwarder/fastforwarder.cpp \
+    fastforwarder/fill_scan.cpp \
     retracer/retracer.cpp \
     retracer/retrace_api.cpp \
     retracer/retrace_gles_auto.cpp \
@@ -283,8 +284,10 @@ LOCAL_SRC_FILES     := \
     common/trace_model_utility.cpp \
     common/call_parser.cpp \
     common/analysis_utility.cpp \
+    common/frame_times.cpp \
     ../../common/eglstate/common.cpp \
     tool/glsl_utils.cpp \
+    tool/glsl_cache.cpp \
     tool/glsl_parser.cpp \
     tool/glsl_lookup.cpp \
     specs/pa_func_to_version.cpp \
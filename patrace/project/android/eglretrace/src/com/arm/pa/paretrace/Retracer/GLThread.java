@@ -335,6 +335,8 @@ public class GLThread extends Thread {
                     js.put("loopSeconds", parentIntent.getIntExtra("loopSeconds", 0));
                 if (parentIntent.hasExtra("fpslimit"))
                     js.put("fpslimit", parentIntent.getIntExtra("fpslimit", 0));
+                if (parentIntent.hasExtra("pace"))
+                    js.put("pace", parentIntent.getBooleanExtra("pace", false));
                 if(parentIntent.hasExtra("step")){
                     js.put("step", parentIntent.getBooleanExtra("step", false));
                 }
@@ -177,6 +177,8 @@ LOCAL_SRC_FILES 	:= \
     tracer/egltrace.cpp \
     tracer/egltrace_auto.cpp \
     tracer/tracerparams.cpp \
+    tracer/dirty_pages.cpp \
+    tracer/call_recorder.cpp \
     tracer/interactivecmd.cpp \
     tracer/glstate_images.cpp \
     tracer/path.cpp \
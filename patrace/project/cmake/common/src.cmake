@@ -25,6 +25,7 @@ set(SRC_COMMON
     ${SRC_ROOT}/common/gl_extension_supported.cpp
     ${SRC_ROOT}/common/analysis_utility.cpp
     ${SRC_ROOT}/common/gl_utility.cpp
+    ${SRC_ROOT}/common/frame_times.cpp
 )
 
 if (${CMAKE_SYSTEM_NAME} MATCHES "Windows")
@@ -32,6 +32,7 @@ set(SRC_FASTFORWARD
     ${SRC_ROOT}/dispatch/eglproc_auto.cpp
     ${SRC_ROOT}/dispatch/eglproc_retrace.cpp
     ${SRC_ROOT}/fastforwarder/fastforwarder.cpp
+    ${SRC_ROOT}/fastforwarder/fill_scan.cpp
     ${SRC_ROOT}/retracer/retracer.cpp
     ${SRC_ROOT}/retracer/afrc_enum.cpp
     ${SRC_ROOT}/retracer/retrace_api.cpp
@@ -59,6 +60,7 @@ set(SRC_FASTFORWARD
     ${SRC_ROOT}/common/trace_model_utility.cpp
     ${SRC_ROOT}/common/call_parser.cpp
     ${SRC_ROOT}/tool/glsl_utils.cpp
+    ${SRC_ROOT}/tool/glsl_cache.cpp
     ${SRC_ROOT}/tool/glsl_parser.cpp
     ${SRC_ROOT}/tool/glsl_lookup.cpp
     ${SRC_ROOT}/specs/pa_func_to_version.cpp
@@ -35,6 +35,8 @@ set(SRC_GLES_LAYER
     ${SRC_ROOT}/tracer/egltrace.cpp
     ${SRC_ROOT}/tracer/egltrace_auto.cpp
     ${SRC_ROOT}/tracer/tracerparams.cpp
+    ${SRC_ROOT}/tracer/dirty_pages.cpp
+    ${SRC_ROOT}/tracer/call_recorder.cpp
     ${SRC_ROOT}/tracer/interactivecmd.cpp
     ${SRC_ROOT}/tracer/glstate_images.cpp
 )
@@ -3,9 +3,45 @@ set(SRC_UNITTEST_DIR ${SRC_ROOT}/unittest)
 set(SRC_UNITTEST
 	${SRC_UNITTEST_DIR}/testharness.cpp
     ${SRC_UNITTEST_DIR}/testhelper.cpp
+    ${SRC_UNITTEST_DIR}/synthetic_trace.cpp
 
     ${SRC_UNITTEST_DIR}/memory_test.cpp
     ${SRC_UNITTEST_DIR}/context_test.cpp
     ${SRC_UNITTEST_DIR}/system_test.cpp
     ${SRC_UNITTEST_DIR}/image_test.cpp
+    ${SRC_UNITTEST_DIR}/frame_times_test.cpp
+    ${SRC_UNITTEST_DIR}/yuv_convert_test.cpp
+    ${SRC_UNITTEST_DIR}/trace_merger_test.cpp
+    ${SRC_UNITTEST_DIR}/dirty_pages_test.cpp
+    ${SRC_UNITTEST_DIR}/call_recorder_test.cpp
+    ${SRC_UNITTEST_DIR}/glsl_cache_test.cpp
+    ${SRC_UNITTEST_DIR}/trace_command_emitter_test.cpp
+    ${SRC_UNITTEST_DIR}/fill_scan_test.cpp
+    ${SRC_UNITTEST_DIR}/thread_flattener_test.cpp
+    ${SRC_UNITTEST_DIR}/shader_cache_index_test.cpp
+    ${SRC_UNITTEST_DIR}/image_diff_test.cpp
+    ${SRC_UNITTEST_DIR}/image_png_test.cpp
+    ${SRC_UNITTEST_DIR}/timestamp_analysis_test.cpp
+    ${SRC_UNITTEST_DIR}/deduplication_test.cpp
+    ${SRC_UNITTEST_DIR}/converter_test.cpp
+    ${SRC_UNITTEST_DIR}/state_log_test.cpp
+
+    ${SRC_ROOT}/tool/yuv_convert.cpp
+    ${SRC_ROOT}/tool/image_diff.cpp
+    ${SRC_ROOT}/tool/trace_merger.cpp
+    ${SRC_ROOT}/tool/timestamp_analysis.cpp
+    ${SRC_ROOT}/tool/thread_flattener.cpp
+    ${SRC_ROOT}/tool/deduplication.cpp
+    ${SRC_ROOT}/tool/trace_converter.cpp
+    ${SRC_ROOT}/tool/parse_interface.cpp
+    ${SRC_ROOT}/common/analysis_utility.cpp
+    ${SRC_ROOT}/specs/pa_func_to_version.cpp
+    ${SRC_ROOT}/tool/utils.cpp
+    ${SRC_ROOT}/tracer/dirty_pages.cpp
+    ${SRC_ROOT}/tracer/call_recorder.cpp
+    ${SRC_ROOT}/tool/glsl_cache.cpp
+    ${SRC_ROOT}/tool/glsl_parser.cpp
+    ${SRC_ROOT}/tool/glsl_lookup.cpp
+    ${SRC_ROOT}/tool/glsl_utils.cpp
+    ${SRC_ROOT}/fastforwarder/fill_scan.cpp
 )
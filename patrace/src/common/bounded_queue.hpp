@@ -0,0 +1,48 @@
+#ifndef _COMMON_BOUNDED_QUEUE_HPP_
+#define _COMMON_BOUNDED_QUEUE_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+
+namespace common {
+
+/// Hands work from one thread to another. push() blocks while the queue is full, so that
+/// a fast producer (e.g. a thread decompressing a trace) cannot run arbitrarily far ahead
+/// of its consumer.
+template<typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : mCapacity(capacity) {}
+
+    void push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotFull.wait(lock, [this]{ return mItems.size() < mCapacity; });
+        mItems.push_back(std::move(item));
+        mNotEmpty.notify_one();
+    }
+
+    T pop()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [this]{ return !mItems.empty(); });
+        T item = std::move(mItems.front());
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return item;
+    }
+
+private:
+    const size_t mCapacity;
+    std::deque<T> mItems;
+    std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+};
+
+}
+
+#endif
@@ -233,6 +233,14 @@ class ParseVisitor(stdapi.Visitor):
     def visitPolymorphic(self, polymorphic, arg, name, func):
         print('    #error')
 
+def findHandle(type):
+    # Look through const, arrays, pointers and aliases for an object handle
+    while not isinstance(type, stdapi.Handle):
+        if not isinstance(type, (stdapi.Const, stdapi.Array, stdapi.Pointer, stdapi.Alias)):
+            return None
+        type = type.type
+    return type
+
 class CallParser(object):
     def parseParamRet(self, func):
         print('    ValueTM *pValueTM = NULL;')
@@ -278,6 +286,24 @@ class CallParser(object):
         print('};')
         print()
 
+    def handleArray(self, functions):
+        print('const std::unordered_map<std::string, std::vector<HandleArg>> handle_args = {')
+        for func in functions:
+            if func.name in notSupportedFuncs:
+                continue
+            handles = []
+            ret = findHandle(func.type)
+            if ret is not None:
+                handles.append('{ -1, "%s" }' % ret.name)
+            for index, arg in enumerate(func.args):
+                handle = findHandle(arg.type)
+                if handle is not None:
+                    handles.append('{ %d, "%s" }' % (index, handle.name))
+            if handles:
+                print('    {"%s", { %s } },' % (func.name, ', '.join(handles)))
+        print('};')
+        print()
+
 if __name__ == '__main__':
     api = gles12api.glesapi
     api.addApi(eglapi.eglapi)
@@ -302,6 +328,7 @@ if __name__ == '__main__':
         print()
         callParser.parseFunctions(api.functions)
         callParser.callbackArray(api.functions)
+        callParser.handleArray(api.functions)
         print()
         print('}')
         sys.stdout = orig_stdout
@@ -0,0 +1,111 @@
+#ifndef _COMMON_CONTENT_HASH_HPP_
+#define _COMMON_CONTENT_HASH_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace common
+{
+
+/// Fast non-cryptographic 64-bit hash (the XXH64 algorithm), for looking up data by its
+/// content. The result is the same on every run and platform (little-endian only, like
+/// the trace format), so it may be stored in files. Not for anything security related.
+class ContentHash
+{
+public:
+    static uint64_t hash(const void *data, size_t size, uint64_t seed = 0)
+    {
+        const unsigned char *p = static_cast<const unsigned char*>(data);
+        const unsigned char *const end = p + size;
+        uint64_t h;
+        if (size >= 32)
+        {
+            uint64_t v1 = seed + P1 + P2;
+            uint64_t v2 = seed + P2;
+            uint64_t v3 = seed;
+            uint64_t v4 = seed - P1;
+            const unsigned char *const limit = end - 32;
+            do
+            {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+                p += 32;
+            } while (p <= limit);
+            h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            h = mergeRound(h, v1);
+            h = mergeRound(h, v2);
+            h = mergeRound(h, v3);
+            h = mergeRound(h, v4);
+        }
+        else
+        {
+            h = seed + P5;
+        }
+        h += size;
+        for (; p + 8 <= end; p += 8)
+        {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * P1 + P4;
+        }
+        if (p + 4 <= end)
+        {
+            h ^= (uint64_t)read32(p) * P1;
+            h = rotl(h, 23) * P2 + P3;
+            p += 4;
+        }
+        for (; p < end; p++)
+        {
+            h ^= (*p) * P5;
+            h = rotl(h, 11) * P1;
+        }
+        h ^= h >> 33;
+        h *= P2;
+        h ^= h >> 29;
+        h *= P3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    static uint64_t hash(const std::string& s, uint64_t seed = 0)
+    {
+        return hash(s.data(), s.size(), seed);
+    }
+
+    /// Order dependent combination of two hashes, e.g. of the shaders of a program
+    static uint64_t combine(uint64_t h, uint64_t value)
+    {
+        return mergeRound(h ^ P5, value);
+    }
+
+private:
+    static const uint64_t P1 = 11400714785074694791ULL;
+    static const uint64_t P2 = 14029467366897019727ULL;
+    static const uint64_t P3 = 1609587929392839161ULL;
+    static const uint64_t P4 = 9650029242287828579ULL;
+    static const uint64_t P5 = 2870177450012600261ULL;
+
+    static inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static inline uint64_t read64(const unsigned char *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+    static inline uint32_t read32(const unsigned char *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+    static inline uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * P2;
+        acc = rotl(acc, 31);
+        return acc * P1;
+    }
+
+    static inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+    {
+        acc ^= round(0, value);
+        return acc * P1 + P4;
+    }
+};
+
+}
+
+#endif
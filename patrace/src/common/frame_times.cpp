@@ -0,0 +1,125 @@
+#include "common/frame_times.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+namespace common {
+
+// Upper bounds of the histogram buckets, in milliseconds. The last bucket has no upper bound.
+static const double histogramEdges[] = { 4.0, 8.0, 12.0, 16.7, 20.0, 25.0, 33.3, 50.0, 66.7, 100.0 };
+static const unsigned histogramBuckets = sizeof(histogramEdges) / sizeof(histogramEdges[0]) + 1;
+
+void FrameTimes::reserve(size_t frames)
+{
+    // Resizing touches the memory, so that recording does not page fault
+    mTimes.assign(frames, 0);
+    clear();
+}
+
+void FrameTimes::clear()
+{
+    mCount = 0;
+    mDropped = 0;
+    mBegin = 0;
+}
+
+// Nearest-rank percentile of a sorted array
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    rank = std::max<size_t>(rank, 1);
+    return sorted[std::min(rank, sorted.size()) - 1];
+}
+
+Json::Value FrameTimes::summary(int64_t frequency, int budgetUsec) const
+{
+    Json::Value result;
+    result["frames"] = (Json::UInt64)mCount;
+    result["dropped"] = (Json::UInt64)mDropped;
+    result["budget_ms"] = budgetUsec / 1000.0;
+    if (mCount == 0)
+    {
+        return result;
+    }
+
+    const double budget = budgetUsec / 1000.0;
+    std::vector<double> ms(mCount);
+    double sum = 0.0;
+    unsigned overBudget = 0;
+    unsigned stutters = 0;
+    unsigned run = 0;
+    unsigned longestRun = 0;
+    unsigned histogram[histogramBuckets] = {};
+    for (size_t i = 0; i < mCount; i++)
+    {
+        ms[i] = frameTime(i) * 1000.0 / frequency;
+        sum += ms[i];
+        if (ms[i] > budget)
+        {
+            overBudget++;
+            if (run++ == 0) stutters++;
+            longestRun = std::max(longestRun, run);
+        }
+        else
+        {
+            run = 0;
+        }
+        unsigned bucket = 0;
+        while (bucket < histogramBuckets - 1 && ms[i] > histogramEdges[bucket]) bucket++;
+        histogram[bucket]++;
+    }
+    const double mean = sum / mCount;
+    double variance = 0.0;
+    for (const double t : ms)
+    {
+        variance += (t - mean) * (t - mean);
+    }
+
+    std::vector<double> sorted(ms);
+    std::sort(sorted.begin(), sorted.end());
+    const double median = percentile(sorted, 50);
+    unsigned jank = 0;
+    for (const double t : ms)
+    {
+        if (t > 2.0 * median) jank++;
+    }
+
+    result["mean_ms"] = mean;
+    result["stddev_ms"] = sqrt(variance / mCount);
+    result["min_ms"] = sorted.front();
+    result["p50_ms"] = median;
+    result["p90_ms"] = percentile(sorted, 90);
+    result["p95_ms"] = percentile(sorted, 95);
+    result["p99_ms"] = percentile(sorted, 99);
+    result["max_ms"] = sorted.back();
+    result["over_budget"] = overBudget;
+    result["stutters"] = stutters;
+    result["longest_stutter"] = longestRun;
+    result["jank"] = jank;
+    Json::Value edges = Json::arrayValue;
+    Json::Value counts = Json::arrayValue;
+    for (unsigned i = 0; i < histogramBuckets; i++)
+    {
+        if (i < histogramBuckets - 1) edges.append(histogramEdges[i]);
+        counts.append(histogram[i]);
+    }
+    result["histogram"]["edges_ms"] = edges;
+    result["histogram"]["frames"] = counts;
+    return result;
+}
+
+std::string FrameTimes::csv(int64_t frequency, unsigned firstFrame, unsigned framesPerLoop) const
+{
+    std::string out = "frame,ms\n";
+    char line[64];
+    for (size_t i = 0; i < mCount; i++)
+    {
+        const unsigned frame = firstFrame + (framesPerLoop ? i % framesPerLoop : i);
+        snprintf(line, sizeof(line), "%u,%.3f\n", frame, frameTime(i) * 1000.0 / frequency);
+        out += line;
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef _COMMON_FRAME_TIMES_HPP_
+#define _COMMON_FRAME_TIMES_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "json/value.h"
+
+namespace common {
+
+/// Records a timestamp at the end of every measured frame, so that the frame
+/// time distribution can be reported, not just the average.
+///
+/// All storage is allocated up front by reserve(), outside the measured region.
+/// record() only stores one value, and drops the timestamp once the storage is
+/// full, so its cost is the same for every frame.
+class FrameTimes
+{
+public:
+    /// Allocate storage for the given number of frames and clear all recorded frames.
+    void reserve(size_t frames);
+
+    /// Forget all recorded frames, but keep the storage.
+    void clear();
+
+    /// Set the time the first measured frame started.
+    void begin(int64_t time)
+    {
+        mBegin = time;
+        mCount = 0;
+        mDropped = 0;
+    }
+
+    /// Record the time a frame ended.
+    inline void record(int64_t time)
+    {
+        if (mCount < mTimes.size())
+        {
+            mTimes[mCount++] = time;
+        }
+        else
+        {
+            mDropped++;
+        }
+    }
+
+    size_t capacity() const { return mTimes.size(); }
+    size_t count() const { return mCount; }
+    size_t dropped() const { return mDropped; }
+    const int64_t* data() const { return mTimes.data(); }
+
+    /// Duration of the given recorded frame, in ticks
+    int64_t frameTime(size_t frame) const
+    {
+        return mTimes[frame] - (frame == 0 ? mBegin : mTimes[frame - 1]);
+    }
+
+    /// Frame time statistics in milliseconds: percentiles, histogram, and frames over the
+    /// given budget (in microseconds). Consecutive frames over budget count as one stutter.
+    /// Frames taking more than twice the median frame time count as jank.
+    Json::Value summary(int64_t frequency, int budgetUsec) const;
+
+    /// One line per recorded frame, with frame number and frame time in milliseconds.
+    /// Frames are numbered from firstFrame, restarting every framesPerLoop frames when looping.
+    std::string csv(int64_t frequency, unsigned firstFrame, unsigned framesPerLoop) const;
+
+private:
+    std::vector<int64_t> mTimes;
+    size_t mCount = 0;
+    size_t mDropped = 0;
+    int64_t mBegin = 0;
+};
+
+}
+
+#endif
@@ -32,11 +32,32 @@
 
 
 #include <fstream>
+#include <string>
 
 
 namespace image {
 
 
+/// How PNG files are written. The defaults favour speed, as snapshots and texture dumps
+/// are mostly written while replaying.
+struct PngOptions
+{
+    int level = 1;      // zlib compression level, from 0 (stored uncompressed) to 9 (smallest)
+    int filters = -1;   // libpng filter mask (PNG_FILTER_NONE, PNG_ALL_FILTERS, ...), -1 for the libpng default
+    int strategy = -1;  // zlib strategy (Z_FILTERED, Z_RLE, ...), -1 for the libpng default
+    int threads = 1;    // threads that compress strips of large images in parallel, 0 for all cores
+};
+
+/// Options used by writePNG() and writePixelsToBuffer() when none are given
+const PngOptions& defaultPngOptions();
+void setDefaultPngOptions(const PngOptions& options);
+
+/// Parses a comma separated list of level=0-9, filter=none|sub|up|avg|paeth|all,
+/// strategy=default|filtered|huffman|rle|fixed, threads=N, and the presets "store"
+/// (no compression), "fast" and "small". Returns false on anything else.
+bool parsePngOptions(const std::string& text, PngOptions& options);
+
+
 class Image {
 public:
     unsigned width;
@@ -97,6 +118,7 @@ public:
     }
 
     bool writePNG(const char *filename) const;
+    bool writePNG(const char *filename, const PngOptions& options) const;
 
     /*
      * Writes the raw contents of an image (texture) to a file, byte-by-byte
@@ -110,7 +132,8 @@ bool writePixelsToBuffer(unsigned char *pixels,
                          unsigned w, unsigned h, unsigned numChannels,
                          bool flipped,
                          char **buffer,
-                         int *size);
+                         int *size,
+                         const PngOptions& options = defaultPngOptions());
 
 Image *
 readPNG(const char *filename);
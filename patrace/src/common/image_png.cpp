@@ -33,7 +33,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <algorithm>
 #include <fstream>
+#include <thread>
+#include <vector>
 
 #include "image.hpp"
 #include "os.hpp"
@@ -41,15 +44,412 @@
 namespace image {
 
 
-static const int png_compression_level = Z_BEST_SPEED;
+static PngOptions default_png_options;
+
+const PngOptions& defaultPngOptions()
+{
+    return default_png_options;
+}
+
+void setDefaultPngOptions(const PngOptions& options)
+{
+    default_png_options = options;
+}
+
+bool parsePngOptions(const std::string& text, PngOptions& options)
+{
+    static const struct { const char *name; int filters; } filters[] = {
+        { "none", PNG_FILTER_NONE }, { "sub", PNG_FILTER_SUB }, { "up", PNG_FILTER_UP },
+        { "avg", PNG_FILTER_AVG }, { "paeth", PNG_FILTER_PAETH }, { "all", PNG_ALL_FILTERS },
+    };
+    static const struct { const char *name; int strategy; } strategies[] = {
+        { "default", Z_DEFAULT_STRATEGY }, { "filtered", Z_FILTERED }, { "huffman", Z_HUFFMAN_ONLY },
+        { "rle", Z_RLE }, { "fixed", Z_FIXED },
+    };
+
+    size_t begin = 0;
+    while (begin <= text.size())
+    {
+        const size_t end = std::min(text.find(',', begin), text.size());
+        const std::string item = text.substr(begin, end - begin);
+        const size_t equals = item.find('=');
+        const std::string key = item.substr(0, equals);
+        const std::string value = (equals == std::string::npos) ? "" : item.substr(equals + 1);
+        bool ok = false;
+        if (item == "store")
+        {
+            options.level = 0;
+            options.filters = PNG_FILTER_NONE;
+            ok = true;
+        }
+        else if (item == "fast")
+        {
+            options.level = 1;
+            options.filters = PNG_FILTER_SUB;
+            options.strategy = Z_RLE;
+            ok = true;
+        }
+        else if (item == "small")
+        {
+            options.level = 9;
+            options.filters = PNG_ALL_FILTERS;
+            options.strategy = Z_FILTERED;
+            ok = true;
+        }
+        else if (key == "level" && value.size() == 1 && value[0] >= '0' && value[0] <= '9')
+        {
+            options.level = value[0] - '0';
+            ok = true;
+        }
+        else if (key == "threads" && !value.empty() && value.find_first_not_of("0123456789") == std::string::npos)
+        {
+            options.threads = atoi(value.c_str());
+            ok = true;
+        }
+        else if (key == "filter")
+        {
+            for (const auto& filter : filters)
+            {
+                if (value == filter.name)
+                {
+                    options.filters = filter.filters;
+                    ok = true;
+                }
+            }
+        }
+        else if (key == "strategy")
+        {
+            for (const auto& strategy : strategies)
+            {
+                if (value == strategy.name)
+                {
+                    options.strategy = strategy.strategy;
+                    ok = true;
+                }
+            }
+        }
+        if (!ok)
+        {
+            DBG_LOG("Invalid PNG option: %s\n", item.c_str());
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+static int pngColorType(unsigned channels)
+{
+    switch (channels) {
+    case 4:
+        return PNG_COLOR_TYPE_RGB_ALPHA;
+    case 3:
+        return PNG_COLOR_TYPE_RGB;
+    case 2:
+        return PNG_COLOR_TYPE_GRAY_ALPHA;
+    case 1:
+        return PNG_COLOR_TYPE_GRAY;
+    default:
+        return -1;
+    }
+}
+
+static void setPngOptions(png_structp png_ptr, const PngOptions& options)
+{
+    png_set_compression_level(png_ptr, options.level);
+    if (options.filters >= 0)
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, options.filters);
+    if (options.strategy >= 0)
+        png_set_compression_strategy(png_ptr, options.strategy);
+}
+
+/*
+ * Parallel encoding.
+ *
+ * Large images are split into strips of rows, which are filtered and deflated on their
+ * own threads, and joined into a single zlib stream, as pigz does. Every strip but the
+ * last ends with a sync flush, so that it ends on a byte boundary, and is deflated with
+ * the last 32 KB of filtered data before it as dictionary, so that the result is hardly
+ * larger than deflating the whole image at once.
+ */
+
+// Images with less than this number of pixels per strip are encoded by libpng on the calling thread
+static const unsigned MIN_PIXELS_PER_STRIP = 256 * 1024;
+
+static const size_t DEFLATE_WINDOW = 32 * 1024;
+
+static inline unsigned pngFilterCost(const unsigned char *row, size_t size)
+{
+    // The heuristic of libpng: the sum of the filtered bytes as signed values
+    unsigned cost = 0;
+    for (size_t i = 0; i < size; ++i)
+        cost += (row[i] < 128) ? row[i] : 256 - row[i];
+    return cost;
+}
+
+static inline unsigned char paethPredictor(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = abs(p - a);
+    const int pb = abs(p - b);
+    const int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return (pb <= pc) ? b : c;
+}
+
+// Filters one row with one filter type. prior is all zeros for the first row.
+static void applyFilter(int type, const unsigned char *row, const unsigned char *prior, size_t size, unsigned bpp, unsigned char *dest)
+{
+    const size_t first = std::min<size_t>(bpp, size);
+    switch (type) {
+    case PNG_FILTER_VALUE_NONE:
+        memcpy(dest, row, size);
+        break;
+    case PNG_FILTER_VALUE_SUB:
+        memcpy(dest, row, first);
+        for (size_t i = bpp; i < size; ++i)
+            dest[i] = row[i] - row[i - bpp];
+        break;
+    case PNG_FILTER_VALUE_UP:
+        for (size_t i = 0; i < size; ++i)
+            dest[i] = row[i] - prior[i];
+        break;
+    case PNG_FILTER_VALUE_AVG:
+        for (size_t i = 0; i < first; ++i)
+            dest[i] = row[i] - (prior[i] >> 1);
+        for (size_t i = bpp; i < size; ++i)
+            dest[i] = row[i] - ((row[i - bpp] + prior[i]) >> 1);
+        break;
+    case PNG_FILTER_VALUE_PAETH:
+        for (size_t i = 0; i < first; ++i)
+            dest[i] = row[i] - prior[i];
+        for (size_t i = bpp; i < size; ++i)
+            dest[i] = row[i] - paethPredictor(row[i - bpp], prior[i], prior[i - bpp]);
+        break;
+    }
+}
+
+// Writes the filter type and the filtered bytes of one row, choosing the filter as libpng
+// does when more than one is allowed
+static void filterRow(const unsigned char *row, const unsigned char *prior, size_t size, unsigned bpp, int filters, unsigned char *out, unsigned char *scratch)
+{
+    static const int masks[PNG_FILTER_VALUE_LAST] = { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH };
+    unsigned bestCost = UINT32_MAX;
+    for (int type = 0; type < PNG_FILTER_VALUE_LAST; ++type)
+    {
+        if (!(filters & masks[type]))
+            continue;
+        if (filters == masks[type])
+        {
+            out[0] = type;
+            applyFilter(type, row, prior, size, bpp, out + 1);
+            return;
+        }
+        applyFilter(type, row, prior, size, bpp, scratch);
+        const unsigned cost = pngFilterCost(scratch, size);
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            out[0] = type;
+            memcpy(out + 1, scratch, size);
+        }
+    }
+}
+
+static void filterRows(const unsigned char *pixels, unsigned width, unsigned height, unsigned channels, bool flipped, int filters, unsigned char *filtered, unsigned first, unsigned last)
+{
+    const size_t rowBytes = (size_t)width * channels;
+    std::vector<unsigned char> scratch(rowBytes);
+    const std::vector<unsigned char> zeros(rowBytes, 0);
+    for (unsigned y = first; y < last; ++y)
+    {
+        const unsigned char *row = pixels + (size_t)(flipped ? height - 1 - y : y) * rowBytes;
+        const unsigned char *prior = (y == 0) ? zeros.data() : pixels + (size_t)(flipped ? height - y : y - 1) * rowBytes;
+        filterRow(row, prior, rowBytes, channels, filters, filtered + (size_t)y * (rowBytes + 1), scratch.data());
+    }
+}
+
+struct PngStrip
+{
+    size_t begin;   // range of the filtered data
+    size_t end;
+    std::vector<unsigned char> deflated;
+    uLong adler;
+    bool ok;
+};
+
+static void deflateStrip(const unsigned char *filtered, const PngOptions& options, int strategy, bool last, PngStrip& strip)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    strip.ok = false;
+    if (deflateInit2(&stream, options.level, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+        return;
+    if (strip.begin > 0)
+    {
+        const size_t dictionary = std::min(strip.begin, DEFLATE_WINDOW);
+        deflateSetDictionary(&stream, filtered + strip.begin - dictionary, dictionary);
+    }
+    const size_t size = strip.end - strip.begin;
+    // Room for the zlib header before the first strip, and for the checksum after the last.
+    // A sync flush adds an empty stored block.
+    const size_t header = (strip.begin == 0) ? 2 : 0;
+    strip.deflated.resize(header + deflateBound(&stream, size) + 16);
+    stream.next_in = (Bytef *)(filtered + strip.begin);
+    stream.avail_in = size;
+    stream.next_out = strip.deflated.data() + header;
+    stream.avail_out = strip.deflated.size() - header - 4;
+    const int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    strip.ok = stream.avail_in == 0 && (last ? result == Z_STREAM_END : result == Z_OK);
+    strip.deflated.resize(header + stream.total_out);
+    deflateEnd(&stream);
+    strip.adler = adler32(adler32(0L, Z_NULL, 0), filtered + strip.begin, size);
+}
+
+static void appendUint32(std::vector<unsigned char>& png, uint32_t value)
+{
+    const unsigned char bytes[4] = { (unsigned char)(value >> 24), (unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value };
+    png.insert(png.end(), bytes, bytes + 4);
+}
+
+static void appendChunk(std::vector<unsigned char>& png, const char *type, const unsigned char *data1, size_t size1, const unsigned char *data2 = NULL, size_t size2 = 0)
+{
+    appendUint32(png, size1 + size2);
+    const size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data1, data1 + size1);
+    if (size2)
+        png.insert(png.end(), data2, data2 + size2);
+    appendUint32(png, crc32(crc32(0L, Z_NULL, 0), png.data() + start, png.size() - start));
+}
+
+// Number of strips a large image is encoded in, or 1 to encode it with libpng
+static unsigned pngStrips(unsigned width, unsigned height, const PngOptions& options)
+{
+    unsigned threads = options.threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned long long pixels = (unsigned long long)width * height;
+    return std::max(1u, std::min({ threads, height, (unsigned)std::min<unsigned long long>(pixels / MIN_PIXELS_PER_STRIP, UINT32_MAX) }));
+}
+
+static bool encodePNGStrips(const unsigned char *pixels, unsigned width, unsigned height, unsigned channels, bool flipped,
+                            const PngOptions& options, unsigned strips, std::vector<unsigned char>& png)
+{
+    const int colorType = pngColorType(channels);
+    if (colorType < 0)
+        return false;
+    // The same defaults as libpng for 8 bit images
+    const int filters = (options.filters >= 0) ? (options.filters & PNG_ALL_FILTERS) : PNG_ALL_FILTERS;
+    const int strategy = (options.strategy >= 0) ? options.strategy : (filters == PNG_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED);
+    const size_t filteredRow = (size_t)width * channels + 1;
+    std::vector<unsigned char> filtered(filteredRow * height);
+    std::vector<PngStrip> parts(strips);
+    const unsigned band = (height + strips - 1) / strips;
+    for (unsigned i = 0; i < strips; ++i)
+    {
+        parts[i].begin = std::min(i * band, height) * filteredRow;
+        parts[i].end = std::min((i + 1) * band, height) * filteredRow;
+    }
+
+    // The dictionary of a strip is the data of the strip before, so filter everything first
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < strips; ++i)
+        workers.emplace_back(filterRows, pixels, width, height, channels, flipped, filters, filtered.data(), std::min(i * band, height), std::min((i + 1) * band, height));
+    filterRows(pixels, width, height, channels, flipped, filters, filtered.data(), 0, std::min(band, height));
+    for (std::thread &t : workers)
+        t.join();
+    workers.clear();
+    for (unsigned i = 1; i < strips; ++i)
+        workers.emplace_back(deflateStrip, filtered.data(), std::cref(options), strategy, i == strips - 1, std::ref(parts[i]));
+    deflateStrip(filtered.data(), options, strategy, strips == 1, parts[0]);
+    for (std::thread &t : workers)
+        t.join();
+
+    uLong adler = adler32(0L, Z_NULL, 0);
+    size_t total = 0;
+    for (const PngStrip& part : parts)
+    {
+        if (!part.ok)
+            return false;
+        adler = adler32_combine(adler, part.adler, part.end - part.begin);
+        total += part.deflated.size();
+    }
+
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    png.clear();
+    png.reserve(total + 128 + 12 * strips);
+    png.insert(png.end(), signature, signature + 8);
+
+    std::vector<unsigned char> header;
+    appendUint32(header, width);
+    appendUint32(header, height);
+    const unsigned char format[5] = { 8, (unsigned char)colorType, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE, PNG_INTERLACE_NONE };
+    header.insert(header.end(), format, format + 5);
+    appendChunk(png, "IHDR", header.data(), header.size());
+
+    // zlib header: deflate with a 32 KB window, the level, and check bits
+    const unsigned char cmf = 0x78;
+    const unsigned char flevel = (options.level < 2) ? 0 : (options.level < 6) ? 1 : (options.level == 6) ? 2 : 3;
+    unsigned char zlibHeader[2] = { cmf, (unsigned char)(flevel << 6) };
+    zlibHeader[1] += (31 - (cmf * 256 + zlibHeader[1]) % 31) % 31;
+    std::vector<unsigned char> trailer;
+    appendUint32(trailer, adler);
+
+    // One IDAT chunk per strip, with the zlib header in the first and the checksum in the last
+    for (unsigned i = 0; i < strips; ++i)
+    {
+        std::vector<unsigned char>& data = parts[i].deflated;
+        if (i == 0)
+            std::copy(zlibHeader, zlibHeader + 2, data.begin());
+        if (i == strips - 1)
+            data.insert(data.end(), trailer.begin(), trailer.end());
+        appendChunk(png, "IDAT", data.data(), data.size());
+    }
+    appendChunk(png, "IEND", NULL, 0);
+    return true;
+}
 
 
 bool Image::writePNG(const char *filename) const
+{
+    return writePNG(filename, defaultPngOptions());
+}
+
+
+static bool writePNGStrips(const char *filename, const Image& image, const PngOptions& options, unsigned strips)
+{
+    std::vector<unsigned char> png;
+    if (!encodePNGStrips(image.pixels, image.width, image.height, image.channels, image.flipped, options, strips, png))
+    {
+        DBG_LOG("Failed to encode %s\n", filename);
+        return false;
+    }
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    const bool written = fwrite(png.data(), png.size(), 1, fp) == 1;
+    fclose(fp);
+    if (!written)
+        unlink(filename);
+    return written;
+}
+
+
+bool Image::writePNG(const char *filename, const PngOptions& options) const
 {
     FILE *fp;
     png_structp png_ptr;
     png_infop info_ptr;
 
+    const unsigned strips = pngStrips(width, height, options);
+    if (strips > 1)
+        return writePNGStrips(filename, *this, options, strips);
+
     fp = fopen(filename, "wb");
     if (!fp)
     {
@@ -96,7 +496,7 @@ bool Image::writePNG(const char *filename) const
     png_set_IHDR(png_ptr, info_ptr, width, height, 8, color_type,
         PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
-    png_set_compression_level(png_ptr, png_compression_level);
+    setPngOptions(png_ptr, options);
 
     png_write_info(png_ptr, info_ptr);
 
@@ -187,6 +587,11 @@ readPNG(const char *filename)
         png_set_tRNS_to_alpha(png_ptr);
     if (bit_depth == 16)
         png_set_strip_16(png_ptr);
+    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png_ptr);
+    if (!(color_type & PNG_COLOR_MASK_ALPHA) && !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+        png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+    png_read_update_info(png_ptr, info_ptr);
 
     for (unsigned y = 0; y < height; ++y) {
         png_bytep row = (png_bytep)(image->pixels + y*width*4);
@@ -232,11 +637,33 @@ pngWriteCallback(png_structp png_ptr, png_bytep data, png_size_t length)
     buf->size += length;
 }
 
+static bool writePixelsToBufferStrips(const unsigned char *pixels,
+                                      unsigned width, unsigned height, unsigned numChannels,
+                                      bool flipped,
+                                      char **buffer,
+                                      int *size,
+                                      const PngOptions& options,
+                                      unsigned strips)
+{
+    std::vector<unsigned char> png;
+    *buffer = NULL;
+    *size = 0;
+    if (!encodePNGStrips(pixels, width, height, numChannels, flipped, options, strips, png))
+        return false;
+    *buffer = (char*)malloc(png.size());
+    if (!*buffer)
+        return false;
+    memcpy(*buffer, png.data(), png.size());
+    *size = png.size();
+    return true;
+}
+
 bool writePixelsToBuffer(unsigned char *pixels,
                          unsigned width, unsigned height, unsigned numChannels,
                          bool flipped,
                          char **buffer,
-                         int *size)
+                         int *size,
+                         const PngOptions& options)
 {
     struct png_tmp_buffer png_mem;
     png_structp png_ptr;
@@ -246,6 +673,10 @@ bool writePixelsToBuffer(unsigned char *pixels,
     png_mem.buffer = NULL;
     png_mem.size = 0;
 
+    const unsigned strips = pngStrips(width, height, options);
+    if (strips > 1)
+        return writePixelsToBufferStrips(pixels, width, height, numChannels, flipped, buffer, size, options, strips);
+
     switch (numChannels) {
     case 4:
         type = PNG_COLOR_TYPE_RGB_ALPHA;
@@ -284,7 +715,7 @@ bool writePixelsToBuffer(unsigned char *pixels,
                  type, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
-    png_set_compression_level(png_ptr, png_compression_level);
+    setPngOptions(png_ptr, options);
 
     png_write_info(png_ptr, info_ptr);
 
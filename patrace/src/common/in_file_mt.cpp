@@ -4,6 +4,7 @@
 
 #include "json/writer.h"
 #include "json/reader.h"
+#include "md5/md5.h"
 
 #include <unistd.h>
 #include <errno.h>
@@ -14,6 +15,32 @@
 
 namespace common {
 
+namespace {
+
+const uint32_t PRELOAD_CACHE_MAGIC = 0x50524c44; // "PRLD"
+const uint32_t PRELOAD_CACHE_VERSION = 1;
+
+/// Header of a persisted preload arena. It is followed by the chunk sizes (uint64_t each),
+/// the known pbuffer surfaces (int32_t each), and then the arena itself at dataOffset.
+struct PreloadCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    unsigned char traceKey[16];
+    int32_t beginFrame;
+    int32_t endFrame;
+    int32_t tid;
+    uint32_t numChunks;
+    uint32_t numPbufferSurfaces;
+    uint32_t reserved;
+    uint64_t startOffset; // offset into the trace file where preloading started
+    uint64_t endOffset; // offset into the trace file after the last preloaded chunk
+    uint64_t dataOffset;
+    uint64_t dataSize;
+};
+
+}
+
 void InFile::rollback()
 {
     if (mCheckpointOffset == -1)
@@ -35,32 +62,45 @@ void InFile::rollback()
     mChunkEnd = mCurrentChunk->data() + mCurrentChunk->size();
 }
 
-// Read another uncompressed memory chunk from the memory mapped file
-bool InFile::readChunk(std::vector<char> *buf)
+// Get the uncompressed size of the next chunk in the memory mapped file without reading it
+bool InFile::nextChunkLength(size_t& uncompressedLength) const
 {
     if (mCompressedRemaining < 4) { return false; }
-    size_t compressedLength = *(unsigned*)mCompressedSource;
+    const size_t compressedLength = *(unsigned*)mCompressedSource;
+    if ((int64_t)compressedLength > mCompressedRemaining - 4) { return false; }
+    if (!snappy::GetUncompressedLength(mCompressedSource + 4, compressedLength, &uncompressedLength))
+    {
+        DBG_LOG("Failed to parse chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
+        abort();
+    }
+    return true;
+}
+
+// Read another uncompressed memory chunk from the memory mapped file into dest, which
+// must be large enough to hold what nextChunkLength() returned
+void InFile::readChunk(char* dest)
+{
+    const size_t compressedLength = *(unsigned*)mCompressedSource;
     mCompressedRemaining -= 4;
     mCompressedSource += 4;
-    if ((int64_t)compressedLength <= mCompressedRemaining)
+    if (!snappy::RawUncompress(mCompressedSource, compressedLength, dest))
     {
-        size_t uncompressedLength = 0;
-        if (!snappy::GetUncompressedLength(mCompressedSource, compressedLength, &uncompressedLength))
-        {
-            DBG_LOG("Failed to parse chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
-            abort();
-        }
-        buf->resize(uncompressedLength);
-        if (!snappy::RawUncompress(mCompressedSource, compressedLength, buf->data()))
-        {
-            DBG_LOG("Failed to decompress chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
-            abort();
-        }
-        mCompressedSource += compressedLength;
-        mCompressedRemaining -= compressedLength;
-        return true;
+        DBG_LOG("Failed to decompress chunk of size %u - file is corrupt - aborting!\n", (unsigned)compressedLength);
+        abort();
     }
-    return false;
+    mCompressedSource += compressedLength;
+    mCompressedRemaining -= compressedLength;
+}
+
+bool InFile::readChunk(Chunk *buf)
+{
+    size_t uncompressedLength = 0;
+    if (!nextChunkLength(uncompressedLength)) { return false; }
+    buf->storage.resize(uncompressedLength);
+    readChunk(buf->storage.data());
+    buf->ptr = buf->storage.data();
+    buf->len = uncompressedLength;
+    return true;
 }
 
 bool InFile::OpenPatchFile(const char* name)
@@ -173,6 +213,7 @@ bool InFile::Open(const char* name, bool readHeaderAndExit)
             return false;
         }
         mCompressedSource = mCompressedBuffer + hdr->jsonFileEnd;
+        mMultithread = mJsonHeader.get("multiThread", false).asBool();
     }
     else
     {
@@ -190,8 +231,8 @@ bool InFile::Open(const char* name, bool readHeaderAndExit)
     }
 
     // Read first chunk
-    mCurrentChunk = new std::vector<char>;
-    mPrevChunk = new std::vector<char>;
+    mCurrentChunk = new Chunk;
+    mPrevChunk = new Chunk;
     if (!readChunk(mCurrentChunk))
     {
         DBG_LOG("Failed to read first chunk!\n");
@@ -204,54 +245,366 @@ bool InFile::Open(const char* name, bool readHeaderAndExit)
     return true;
 }
 
-void InFile::PreloadFrames(int frames_to_read, int tid)
+// Count the number of frames in the chunk, and track pbuffer surfaces created in it
+int InFile::countFrames(const Chunk *chunk, int tid)
 {
-    int frames_read = 0;
-    std::vector<char> *newchunk = new std::vector<char>;
-    mCheckpointOffset = mPtr - mCurrentChunk->data();
-    while (readChunk(newchunk) && frames_read < frames_to_read)
+    int frames = 0;
+    char *ptr = chunk->data();
+    while (ptr < chunk->data() + chunk->size())
     {
-        mPreloadedChunks.push_back(newchunk);
-
-        // Count the number of frames in the chunk
-        char *ptr = newchunk->data();
-        while (ptr < newchunk->data() + newchunk->size())
+        const common::BCall& call = *(common::BCall*)ptr;
+        if (call.funcId == eglCreatePbufferSurface_id)
+        {
+            mPbufferSurfaces.insert(getCreatePbufferSurfaceRet(ptr + sizeof(common::BCall_vlen)));
+        }
+        if ((call.tid == tid || tid == -1) && (call.funcId == eglSwapBuffers_id || call.funcId == eglSwapBuffersWithDamageKHR_id || call.funcId == eglSwapBuffersWithDamageEXT_id))
         {
-            const common::BCall& call = *(common::BCall*)ptr;
-            if (call.funcId == eglCreatePbufferSurface_id)
+            char *src;
+            const unsigned callLen = mExIdToLen[call.funcId];
+            if (callLen == 0)
             {
-                mPbufferSurfaces.insert(getCreatePbufferSurfaceRet(ptr + sizeof(common::BCall_vlen)));
+                src = ptr + sizeof(common::BCall_vlen);
             }
-            if ((call.tid == tid || tid == -1) && (call.funcId == eglSwapBuffers_id || call.funcId == eglSwapBuffersWithDamageKHR_id || call.funcId == eglSwapBuffersWithDamageEXT_id))
+            else
             {
-                char *src;
-                const unsigned callLen = mExIdToLen[call.funcId];
-                if (callLen == 0)
-                {
-                    src = ptr + sizeof(common::BCall_vlen);
-                }
-                else
-                {
-                    src = ptr + sizeof(common::BCall);
-                }
-                if (mPbufferSurfaces.count(getDpySurface(src))==0)
-                {
-                    frames_read++;
-                }
+                src = ptr + sizeof(common::BCall);
             }
-            unsigned int callLen = mExIdToLen[call.funcId];
-            if (callLen == 0)
+            if (mPbufferSurfaces.count(getDpySurface(src))==0)
             {
-                ptr += reinterpret_cast<common::BCall_vlen*>(ptr)->toNext;
-            } else {
-                ptr += callLen;
+                frames++;
             }
-       }
+        }
+        unsigned int callLen = mExIdToLen[call.funcId];
+        if (callLen == 0)
+        {
+            ptr += reinterpret_cast<common::BCall_vlen*>(ptr)->toNext;
+        } else {
+            ptr += callLen;
+        }
+    }
+    return frames;
+}
+
+// Sum of the uncompressed sizes of all chunks not yet read. Only reads the chunk headers.
+size_t InFile::remainingUncompressedSize() const
+{
+    size_t total = 0;
+    const char *src = mCompressedSource;
+    int64_t remaining = mCompressedRemaining;
+    while (remaining >= 4)
+    {
+        const size_t compressedLength = *(unsigned*)src;
+        if ((int64_t)compressedLength > remaining - 4) break;
+        size_t uncompressedLength = 0;
+        if (!snappy::GetUncompressedLength(src + 4, compressedLength, &uncompressedLength)) break;
+        total += uncompressedLength;
+        src += 4 + compressedLength;
+        remaining -= 4 + compressedLength;
+    }
+    return total;
+}
+
+// Reserve address space for the preload arena. Pages are only backed by memory once written to.
+char* InFile::allocArena(size_t size, bool hugetlb)
+{
+    void *ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugetlb)
+    {
+        const size_t hugePageSize = 2 * 1024 * 1024;
+        size = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED)
+        {
+            DBG_LOG("No huge pages available for preloading (%s) - using transparent huge pages instead\n", strerror(errno));
+        }
+    }
+#endif
+    if (ptr == MAP_FAILED)
+    {
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED)
+        {
+            return nullptr;
+        }
+#ifdef MADV_HUGEPAGE
+        if (mPreloadHugePages)
+        {
+            madvise(ptr, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    mArena = (char*)ptr;
+    mArenaSize = size;
+    return mArena;
+}
 
-       newchunk = new std::vector<char>;
-   }
-   delete newchunk; // we always make one in excess
-   mPreload = false;
+void InFile::freeArena()
+{
+    if (mArena)
+    {
+        munmap(mArena, mArenaSize);
+    }
+    mArena = nullptr;
+    mArenaSize = 0;
+}
+
+void InFile::PreloadFrames(int frames_to_read, int tid)
+{
+    const int64_t startTime = os::getTime();
+    const int64_t startOffset = mCompressedSource - mCompressedBuffer;
+    mCheckpointOffset = mPtr - mCurrentChunk->data();
+    mPreload = false;
+
+    std::string cacheName;
+    if (mPreloadPersist)
+    {
+        cacheName = preloadCacheName();
+        if (loadPreloadCache(cacheName))
+        {
+            DBG_LOG("Preloaded %d chunks (%.1f MB) from %s in %.3f seconds\n", (int)mPreloadedChunks.size(), mArenaSize / (1024.0 * 1024.0),
+                    cacheName.c_str(), (os::getTime() - startTime) / (double)os::timeFrequency);
+            return;
+        }
+    }
+
+    // Reserve enough address space for the rest of the trace, then decompress into it back to back.
+    // The unused tail is returned once we know how much of it the frame range needed.
+    const size_t capacity = remainingUncompressedSize();
+    if (capacity == 0)
+    {
+        return; // everything is already loaded
+    }
+    if (!allocArena(capacity, false))
+    {
+        DBG_LOG("Failed to reserve %lu bytes for the preload arena - preloading into separate chunks\n", (unsigned long)capacity);
+        int frames_read = 0;
+        Chunk *newchunk = new Chunk;
+        while (frames_read < frames_to_read && readChunk(newchunk))
+        {
+            mPreloadedChunks.push_back(newchunk);
+            frames_read += countFrames(newchunk, tid);
+            newchunk = new Chunk;
+        }
+        delete newchunk;
+        return;
+    }
+
+    int frames_read = 0;
+    size_t used = 0;
+    size_t uncompressedLength = 0;
+    while (frames_read < frames_to_read && nextChunkLength(uncompressedLength))
+    {
+        Chunk *newchunk = new Chunk;
+        newchunk->ptr = mArena + used;
+        newchunk->len = uncompressedLength;
+        readChunk(newchunk->ptr);
+        used += uncompressedLength;
+        mPreloadedChunks.push_back(newchunk);
+        frames_read += countFrames(newchunk, tid);
+    }
+
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t usedPages = (used + pageSize - 1) & ~(pageSize - 1);
+    if (usedPages < mArenaSize)
+    {
+        munmap(mArena + usedPages, mArenaSize - usedPages);
+        mArenaSize = usedPages;
+    }
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages must be reserved up front, so we could not decompress straight into them
+    // without knowing the final size. Move the arena over now that we do.
+    if (mPreloadHugePages && used > 0)
+    {
+        char *oldArena = mArena;
+        const size_t oldSize = mArenaSize;
+        if (allocArena(used, true))
+        {
+            memcpy(mArena, oldArena, used);
+            for (Chunk *c : mPreloadedChunks) c->ptr = mArena + (c->ptr - oldArena);
+            munmap(oldArena, oldSize);
+        }
+        else
+        {
+            mArena = oldArena;
+            mArenaSize = oldSize;
+        }
+    }
+#endif
+
+    if (mPreloadLock && mlock(mArena, mArenaSize) != 0)
+    {
+        DBG_LOG("Failed to lock preloaded frames in memory: %s\n", strerror(errno));
+    }
+
+    DBG_LOG("Preloaded %d frames in %d chunks (%.1f MB) in %.3f seconds\n", frames_read, (int)mPreloadedChunks.size(), used / (1024.0 * 1024.0),
+            (os::getTime() - startTime) / (double)os::timeFrequency);
+
+    if (mPreloadPersist)
+    {
+        savePreloadCache(cacheName, startOffset);
+    }
+}
+
+std::string InFile::preloadCacheName() const
+{
+    return mFileName + ".preload_" + std::to_string(mBeginFrame) + "_" + std::to_string(mEndFrame)
+           + (mTraceTid == -1 ? std::string() : "_tid" + std::to_string(mTraceTid));
+}
+
+// Identifies the trace file cheaply: its size, modification time and the first 64kb of it,
+// which holds the JSON header and the sigbook.
+void InFile::fileKey(unsigned char key[16]) const
+{
+    struct stat64 sb;
+    memset(&sb, 0, sizeof(sb));
+    fstat64(mFd, &sb);
+    const int64_t keyData[3] = { (int64_t)sb.st_size, (int64_t)sb.st_mtim.tv_sec, (int64_t)sb.st_mtim.tv_nsec };
+    md5_state_t state;
+    md5_init(&state);
+    md5_append(&state, (const md5_byte_t*)keyData, sizeof(keyData));
+    md5_append(&state, (const md5_byte_t*)mCompressedBuffer, std::min<int64_t>(mCompressedSize, 64 * 1024));
+    md5_finish(&state, key);
+}
+
+bool InFile::loadPreloadCache(const std::string& name)
+{
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+    PreloadCacheHeader header;
+    unsigned char key[16];
+    fileKey(key);
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != PRELOAD_CACHE_MAGIC || header.version != PRELOAD_CACHE_VERSION
+        || memcmp(header.traceKey, key, sizeof(key)) != 0 || header.beginFrame != mBeginFrame || header.endFrame != mEndFrame || header.tid != mTraceTid
+        || (int64_t)header.startOffset != mCompressedSource - mCompressedBuffer || (int64_t)header.endOffset > mCompressedSize)
+    {
+        DBG_LOG("Preload cache %s does not match the trace file - ignoring it\n", name.c_str());
+        close(fd);
+        return false;
+    }
+
+    std::vector<uint64_t> chunkSizes(header.numChunks);
+    std::vector<int32_t> surfaces(header.numPbufferSurfaces);
+    const ssize_t chunkBytes = chunkSizes.size() * sizeof(uint64_t);
+    const ssize_t surfaceBytes = surfaces.size() * sizeof(int32_t);
+    if (pread(fd, chunkSizes.data(), chunkBytes, sizeof(header)) != chunkBytes
+        || pread(fd, surfaces.data(), surfaceBytes, sizeof(header) + chunkBytes) != surfaceBytes)
+    {
+        DBG_LOG("Preload cache %s is truncated - ignoring it\n", name.c_str());
+        close(fd);
+        return false;
+    }
+
+    if (mPreloadHugePages)
+    {
+        // File backed mappings cannot use huge pages, so read it into an anonymous arena instead
+        bool ok = allocArena(header.dataSize, true) != nullptr;
+        size_t done = 0;
+        while (ok && done < header.dataSize)
+        {
+            const ssize_t r = pread(fd, mArena + done, header.dataSize - done, header.dataOffset + done);
+            ok = r > 0;
+            done += ok ? r : 0;
+        }
+        if (!ok)
+        {
+            DBG_LOG("Failed to read preload cache %s - ignoring it\n", name.c_str());
+            freeArena();
+            close(fd);
+            return false;
+        }
+    }
+    else
+    {
+        // Private mapping, since the retracer may modify call data in place. Populate it now so
+        // that nothing is faulted in during the measured frames.
+        void *ptr = mmap(nullptr, header.dataSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, header.dataOffset);
+        if (ptr == MAP_FAILED)
+        {
+            DBG_LOG("Failed to mmap preload cache %s: %s\n", name.c_str(), strerror(errno));
+            close(fd);
+            return false;
+        }
+        mArena = (char*)ptr;
+        mArenaSize = header.dataSize;
+    }
+    close(fd);
+
+    size_t used = 0;
+    for (uint64_t size : chunkSizes)
+    {
+        Chunk *chunk = new Chunk;
+        chunk->ptr = mArena + used;
+        chunk->len = size;
+        used += size;
+        mPreloadedChunks.push_back(chunk);
+    }
+    mPbufferSurfaces.insert(surfaces.begin(), surfaces.end());
+    mCompressedSource = mCompressedBuffer + header.endOffset;
+    mCompressedRemaining = mCompressedSize - header.endOffset;
+
+    if (mPreloadLock && mlock(mArena, mArenaSize) != 0)
+    {
+        DBG_LOG("Failed to lock preloaded frames in memory: %s\n", strerror(errno));
+    }
+    return true;
+}
+
+void InFile::savePreloadCache(const std::string& name, int64_t startOffset)
+{
+    PreloadCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = PRELOAD_CACHE_MAGIC;
+    header.version = PRELOAD_CACHE_VERSION;
+    fileKey(header.traceKey);
+    header.beginFrame = mBeginFrame;
+    header.endFrame = mEndFrame;
+    header.tid = mTraceTid;
+    header.numChunks = mPreloadedChunks.size();
+    header.numPbufferSurfaces = mPbufferSurfaces.size();
+    header.startOffset = startOffset;
+    header.endOffset = mCompressedSource - mCompressedBuffer;
+
+    std::vector<uint64_t> chunkSizes;
+    for (const Chunk *c : mPreloadedChunks)
+    {
+        chunkSizes.push_back(c->size());
+        header.dataSize += c->size();
+    }
+    std::vector<int32_t> surfaces(mPbufferSurfaces.begin(), mPbufferSurfaces.end());
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t metaSize = sizeof(header) + chunkSizes.size() * sizeof(uint64_t) + surfaces.size() * sizeof(int32_t);
+    header.dataOffset = (metaSize + pageSize - 1) & ~(pageSize - 1);
+
+    // Write to a temporary file first, so that an interrupted run never leaves a broken cache behind
+    const std::string tmpName = name + ".tmp";
+    FILE *fp = fopen(tmpName.c_str(), "wb");
+    if (!fp)
+    {
+        DBG_LOG("Failed to create preload cache %s: %s\n", tmpName.c_str(), strerror(errno));
+        return;
+    }
+    const std::vector<char> padding(header.dataOffset - metaSize, 0);
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = ok && fwrite(chunkSizes.data(), sizeof(uint64_t), chunkSizes.size(), fp) == chunkSizes.size();
+    ok = ok && fwrite(surfaces.data(), sizeof(int32_t), surfaces.size(), fp) == surfaces.size();
+    ok = ok && fwrite(padding.data(), 1, padding.size(), fp) == padding.size();
+    for (const Chunk *c : mPreloadedChunks)
+    {
+        ok = ok && fwrite(c->data(), 1, c->size(), fp) == c->size();
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), name.c_str()) != 0)
+    {
+        DBG_LOG("Failed to write preload cache %s: %s\n", name.c_str(), strerror(errno));
+        unlink(tmpName.c_str());
+        return;
+    }
+    DBG_LOG("Saved preloaded frames to %s\n", name.c_str());
 }
 
 bool InFile::GetNextCall(void*& fptr, common::BCall_vlen& call, char*& src)
@@ -381,6 +734,7 @@ void InFile::Close()
     mFreeChunks.clear();
     delete mCurrentChunk; mCurrentChunk = nullptr;
     delete mPrevChunk; mPrevChunk = nullptr;
+    freeArena();
     mExIdToName.clear();
     mExIdToLen.clear();
     mExIdToFunc.clear();
@@ -9,6 +9,8 @@
 #include <snappy.h>
 #include <deque>
 #include <set>
+#include <string>
+#include <vector>
 
 namespace common {
 
@@ -24,6 +26,18 @@ public:
 
     void rollback();
 
+    /// How preloaded frames are stored. Set before preloading starts.
+    /// hugepages: back the preload arena by huge pages, if the system has any.
+    /// lock: mlock the preload arena so that it can never be paged out.
+    /// persist: save the decompressed arena next to the trace file, and map it
+    /// directly on later runs with the same trace file and frame range.
+    void setPreloadOptions(bool hugepages, bool lock, bool persist)
+    {
+        mPreloadHugePages = hugepages;
+        mPreloadLock = lock;
+        mPreloadPersist = persist;
+    }
+
     long memoryUsed()
     {
         long s = 0;
@@ -36,26 +50,58 @@ public:
 
     bool OpenPatchFile(const char* name);
 
+    /// Identifies the open trace file cheaply, for caches of results derived from it.
+    /// Changes when the file is rewritten, but reading the whole file is not needed.
+    void fileKey(unsigned char key[16]) const;
+
     int curCallNo = -1;
 
 private:
+    /// A decompressed chunk of the trace file. It either owns its memory, or points
+    /// into the preload arena.
+    struct Chunk
+    {
+        char* data() const { return ptr; }
+        size_t size() const { return len; }
+
+        std::vector<char> storage;
+        char* ptr = nullptr;
+        size_t len = 0;
+    };
+
     void ReadSigBook();
     void PreloadFrames(int frames_to_read, int tid);
-    bool readChunk(std::vector<char> *buf);
-
-    std::deque<std::vector<char>*> mPreloadedChunks;
+    bool nextChunkLength(size_t& uncompressedLength) const;
+    void readChunk(char* dest);
+    bool readChunk(Chunk *buf);
+    int countFrames(const Chunk *chunk, int tid);
+    size_t remainingUncompressedSize() const;
+    char* allocArena(size_t size, bool hugetlb);
+    void freeArena();
+    std::string preloadCacheName() const;
+    bool loadPreloadCache(const std::string& name);
+    void savePreloadCache(const std::string& name, int64_t startOffset);
+
+    std::deque<Chunk*> mPreloadedChunks;
     /// The free list is used for loop tracing.
-    std::deque<std::vector<char>*> mFreeChunks;
-    std::vector<char> *mCurrentChunk = nullptr;
+    std::deque<Chunk*> mFreeChunks;
+    Chunk *mCurrentChunk = nullptr;
     /// We cannot immediately free the previous chunk since pointers may still be pointing
     /// into its memory area which are consumed by calls in the next.
-    std::vector<char> *mPrevChunk = nullptr;
+    Chunk *mPrevChunk = nullptr;
     // record created pbuffer surfaces
     std::set<int> mPbufferSurfaces;
 
     /// Offset into first packet that we should start a rollback at
     intptr_t mCheckpointOffset = -1;
 
+    /// All preloaded chunks are decompressed into this single mapping
+    char *mArena = nullptr;
+    size_t mArenaSize = 0;
+    bool mPreloadHugePages = false;
+    bool mPreloadLock = false;
+    bool mPreloadPersist = false;
+
     char *mPtr = nullptr;
     void *mChunkEnd = nullptr;
     int64_t mCompressedRemaining = 0;
@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstring>
 #include <vector>
+#include <memory>
 #include <unordered_map>
 #include <map>
 #include <set>
@@ -154,13 +155,17 @@ struct CSBPatchList
 };
 
 // Represents a contiguous memory range
+//
+// Memory owned by the object is reference counted. Copying an object shares the memory
+// instead of duplicating it, and set_subdata() takes a private copy first if the memory is
+// shared (copy-on-write). This makes checkpoints of whole object sets cheap, see
+// Retracer::SaveBuffersMaps(). Owned memory must therefore only be modified through
+// set_data() and set_subdata().
 class ClientSideBufferObject
 {
 public:
     ~ClientSideBufferObject()
     {
-        if (_own_memory)
-            delete [] static_cast<const char*>(base_address);
         base_address = NULL;
     }
 
@@ -186,7 +191,18 @@ public:
         if (this == &other)
             return *this;
 
-        set_data(other.base_address, other.size, other._own_memory);
+        if (_destinationAddress && other._own_memory)
+        {
+            set_data(other.base_address, other.size, true);
+            return *this;
+        }
+
+        _storage = other._storage;
+        _own_memory = other._own_memory;
+        base_address = other.base_address;
+        size = other.size;
+        _dirty_md5_digest = other._dirty_md5_digest;
+        _md5_digest = other._md5_digest;
         return *this;
     }
 
@@ -197,12 +213,10 @@ public:
 
     void set_data(const void *p, ptrdiff_t s, bool copy = false)
     {
-        if (base_address && _own_memory)
-        {
-            delete [](static_cast<char *>(base_address));
-            base_address = NULL;
-            _own_memory = false;
-        }
+        // Keep the previous memory alive until we are done, p may point into it
+        std::shared_ptr<char> previous = std::move(_storage);
+        _storage.reset();
+        _own_memory = false;
 
         if (copy)
         {
@@ -211,7 +225,8 @@ public:
             // If _destinationAddress is 0, we allocate our own destionation.
             if (!buf)
             {
-                buf = new char[s];
+                _storage.reset(new char[s], std::default_delete<char[]>());
+                buf = _storage.get();
                 _own_memory = true;
             }
 
@@ -254,11 +269,15 @@ public:
 
         if (p)
         {
+            detach();
             memcpy(static_cast<char*>(base_address) + offset, p, s);
         }
         _dirty_md5_digest = true;
     }
 
+    // Whether the owned memory is currently shared with copies of this object
+    bool shared() const { return _storage.use_count() > 1; }
+
     // Whether these two contiguous memory regions overlap
     bool overlap(const void *p, ptrdiff_t s) const { return (PTR_DIFF(p, base_address) < size) && (PTR_DIFF(base_address, p) < s); }
 
@@ -307,8 +326,9 @@ public:
     ptrdiff_t size;
 
 private:
-    // If own its memory, should delete it in the destructor
+    // If own its memory, base_address points into _storage
     bool _own_memory;
+    std::shared_ptr<char> _storage;
 
     // Cached MD5 digest
     mutable bool _dirty_md5_digest = true;
@@ -324,6 +344,18 @@ private:
         _md5_digest = MD5Digest(base_address, size);
         _dirty_md5_digest = false;
     }
+
+    // Take a private copy of owned memory that is shared with other objects
+    void detach()
+    {
+        if (!shared())
+            return;
+
+        std::shared_ptr<char> copy(new char[size], std::default_delete<char[]>());
+        memcpy(copy.get(), base_address, size);
+        _storage = std::move(copy);
+        base_address = _storage.get();
+    }
 };
 
 // Try to merge memory range of multiple vertex attributes for one draw call into a contiguous memory region
@@ -376,6 +408,7 @@ public:
     {
         _objects.emplace(0, new ClientSideBufferObject);   // a sentinel for being compatible with old traces
     }
+    // Objects share their memory with the copies, so this is cheap even for large buffers
     ClientSideBufferObjectSetPerThread(const ClientSideBufferObjectSetPerThread &other)
     {
         for (const auto &iter : other._objects)
@@ -385,6 +418,15 @@ public:
             _objects[name] = tmp;
         }
     }
+    ClientSideBufferObjectSetPerThread & operator=(const ClientSideBufferObjectSetPerThread &other)
+    {
+        if (this == &other)
+            return *this;
+
+        ClientSideBufferObjectSetPerThread tmp(other);
+        _objects.swap(tmp._objects);
+        return *this;
+    }
     ~ClientSideBufferObjectSetPerThread()
     {
         for (auto &iter : _objects)
@@ -34,6 +34,7 @@ bool OutFile::Open(const char* name, bool writeSigBook, const std::vector<std::s
         name = autogenFileName;
     }
 
+    WaitForCompressor();
     if (mStream)
     {
         fclose(mStream);
@@ -79,15 +80,56 @@ bool OutFile::Open(const char* name, bool writeSigBook, const std::vector<std::s
 OutFile::~OutFile()
 {
     Close();
+    if (mCompressor.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mCompressorMutex);
+            mStopCompressor = true;
+        }
+        mCompressorCond.notify_all();
+        mCompressor.join();
+        munmap(mSpareCache, SNAPPY_MAX_SIZE);
+    }
     munmap(mCache, SNAPPY_MAX_SIZE);
     munmap(mCompressedCache, SNAPPY_MAX_SIZE);
 }
 
+void OutFile::CompressInBackground()
+{
+    if (mCompressor.joinable()) return;
+    mSpareCache = (char*)mmap(nullptr, SNAPPY_MAX_SIZE, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    mCompressor = std::thread(&OutFile::RunCompressor, this);
+}
+
+void OutFile::RunCompressor()
+{
+    std::unique_lock<std::mutex> lock(mCompressorMutex);
+    while (true)
+    {
+        mCompressorCond.wait(lock, [this]{ return mPending || mStopCompressor; });
+        if (!mPending) return;
+        lock.unlock();
+        WriteChunk(mPending, mPendingLen);
+        lock.lock();
+        mPending = nullptr;
+        mCompressorCond.notify_all();
+    }
+}
+
+// Returns once the compressor has written everything it was given, so that the file may be used directly
+void OutFile::WaitForCompressor()
+{
+    if (!mCompressor.joinable()) return;
+    std::unique_lock<std::mutex> lock(mCompressorMutex);
+    mCompressorCond.wait(lock, [this]{ return !mPending; });
+}
+
 void OutFile::Close()
 {
     if (!mIsOpen) return;
 
     Flush();
+    WaitForCompressor();
     fseek(mStream, 0, SEEK_SET);
     filewrite((char*)&mHeader, sizeof(BHeaderV3));
 
@@ -102,15 +144,32 @@ void OutFile::Flush()
 {
     size_t len = UsedSize();
     if (len == 0) return;
+    if (mCompressor.joinable())
+    {
+        // Hand the chunk over and continue in the other cache, once the previous chunk is done
+        std::unique_lock<std::mutex> lock(mCompressorMutex);
+        mCompressorCond.wait(lock, [this]{ return !mPending; });
+        mPending = mCache;
+        mPendingLen = len;
+        std::swap(mCache, mSpareCache);
+        mCacheP = mCache;
+        mCompressorCond.notify_all();
+        return;
+    }
+    WriteChunk(mCache, len);
+    mCacheP = mCache;
+}
+
+void OutFile::WriteChunk(char* data, size_t len)
+{
     size_t compressedLen = 0;
-    ::snappy::RawCompress(mCache, len, mCompressedCache, &compressedLen);
+    ::snappy::RawCompress(data, len, mCompressedCache, &compressedLen);
     WriteCompressedLength((unsigned int)compressedLen);
     filewrite(mCompressedCache, compressedLen);
     fflush(mStream);
-    mCacheP = mCache;
 
     // tell kernel that we no longer use any of this memory and the underlying pages can be freed as needed
-    madvise(mCache, len, MADV_FREE);
+    madvise(data, len, MADV_FREE);
     madvise(mCompressedCache, compressedLen, MADV_FREE);
 }
 
@@ -133,6 +192,7 @@ void OutFile::WriteHeader(const char* buf, unsigned int len, bool verbose)
 
     // write variable length header to beginning of file, then seek back to previous file put position
     Flush(); // flush last compressed part
+    WaitForCompressor();
     if (len > mHeader.jsonMaxLength)
     {
         DBG_LOG("Error: json file too long for header, %d > %d\n", len, mHeader.jsonMaxLength);
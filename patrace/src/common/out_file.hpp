@@ -3,7 +3,10 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include <common/file_format.hpp>
 #include <common/os_string.hpp>
@@ -29,12 +32,26 @@ public:
     void Flush();
     void WriteHeader(const char* buf, unsigned int len, bool verbose = true);
 
+    /// Compress and write out full chunks on a thread of our own, so that the caller can
+    /// fill the next chunk meanwhile. Costs a second cache. Call it before writing calls.
+    void CompressInBackground();
+
     /// Give us some scratch memory. You can call this before you have opened the output file.
     char* Scratch() const { return mCacheP; }
 
     /// Let us know how much memory we just used from our scratch memory.
     void Progress(ssize_t used) { mCacheP += used; if (UsedSize() > SNAPPY_CHUNK_SIZE) Flush(); }
 
+    /// Write cursor into the current chunk with room for at least len bytes. Write there and
+    /// hand the end of what you wrote to Commit(), which moves on to a new chunk when full.
+    char* Reserve(size_t len)
+    {
+        if (len > SNAPPY_MAX_SIZE) { DBG_LOG("Cannot reserve %zu bytes in a chunk\n", len); os::abort(); }
+        if (len > SNAPPY_MAX_SIZE - (size_t)UsedSize()) Flush();
+        return mCacheP;
+    }
+    void Commit(const char* end) { Progress(end - mCacheP); }
+
     /// Deprecated legacy function that does a totally unnecessary memcpy.
     inline void Write(const void* buf, unsigned int len) { memcpy(mCacheP, buf, len); Progress(len); }
 
@@ -73,6 +90,9 @@ private:
         filewrite((char*)buf, sizeof(buf));
     }
 
+    void WriteChunk(char* data, size_t len);
+    void WaitForCompressor();
+    void RunCompressor();
     void FlushHeader();
     void WriteSigBook(const std::vector<std::string> *sigbook, bool write_timestamp = false);
     os::String AutogenTraceFileName();
@@ -83,6 +103,15 @@ private:
     char*               mCacheP = nullptr;
     char*               mCompressedCache = nullptr;
     std::string         mFileName;
+
+    // Background compression. mCache and mSpareCache swap roles on each Flush().
+    char*               mSpareCache = nullptr;
+    char*               mPending = nullptr; // chunk handed to the compressor
+    size_t              mPendingLen = 0;
+    bool                mStopCompressor = false;
+    std::thread         mCompressor;
+    std::mutex          mCompressorMutex;
+    std::condition_variable mCompressorCond;
 };
 
 }
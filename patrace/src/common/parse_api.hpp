@@ -4,6 +4,10 @@
 #include <common/api_info.hpp>
 #include <common/trace_model.hpp>
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 namespace common {
 
 class InFileBase;
@@ -11,6 +15,18 @@ typedef void (*ParseFunc)(char*, CallTM& callTM, common::HeaderVersion headerVer
 
 extern const common::EntryMap parse_callbacks;
 
+// An argument (or the return value, if index is -1) that holds object handles,
+// either as a single value or as an array. The handle name is the one used in
+// the API specs, like "texture" or "uniformLocation".
+struct HandleArg
+{
+    int index;
+    const char *handle;
+};
+
+// Function name to handle arguments, for all functions that have any
+extern const std::unordered_map<std::string, std::vector<HandleArg>> handle_args;
+
 }
 
 #endif
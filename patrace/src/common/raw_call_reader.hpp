@@ -0,0 +1,98 @@
+#ifndef _COMMON_RAW_CALL_READER_HPP_
+#define _COMMON_RAW_CALL_READER_HPP_
+
+#include <string.h>
+#include <vector>
+
+#include "common/file_format.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/out_file.hpp"
+#include "common/trace_model.hpp"
+
+namespace common {
+
+/// Walks the calls of a trace without decoding them, for tools that pass most calls
+/// through unchanged. Each call is seen as the bytes it has in the decompressed chunk,
+/// header included, so that calls that survive can be copied into the output chunk
+/// as they are. The output file must be opened with the sigbook of the input, e.g.
+/// out.Open(name, true, &in.getFuncNames()), so that the function ids stay valid.
+class RawCallReader
+{
+public:
+    explicit RawCallReader(InFile& file) : mFile(file) {}
+
+    /// Moves to the next call. Returns false at the end of the trace.
+    bool next()
+    {
+        if (!mFile.GetNextCall(mFptr, mCall, mArgs)) return false;
+        mData = mArgs - (mFile.mExIdToLen[mCall.funcId] == 0 ? sizeof(BCall_vlen) : sizeof(BCall));
+        return true;
+    }
+
+    unsigned short funcId() const { return mCall.funcId; }
+    const char* name() const { return mFile.ExIdToName(mCall.funcId); }
+    unsigned tid() const { return mCall.tid; }
+    unsigned callNo() const { return mFile.curCallNo; }
+    const BCall_vlen& header() const { return mCall; }
+
+    /// The whole call, header included. Valid until the next call to next().
+    const char* data() const { return mData; }
+    size_t size() const { return mCall.toNext; }
+    /// The arguments and return value of the call
+    char* args() const { return mArgs; }
+
+    /// Traces older than HEADER_VERSION_4 encode some texture calls differently from
+    /// what OutFile writes, so their calls are re-encoded on copy instead.
+    bool isCurrentFormat() const { return mFile.getHeaderVersion() >= HEADER_VERSION_4; }
+
+    /// Decodes the current call, for the few calls a tool needs to look into or change.
+    /// Write it back with write().
+    CallTM* decode() const { return new CallTM(mFile, callNo(), mCall); }
+
+    /// Appends a decoded call to out, with its function id in the input sigbook
+    void write(OutFile& out, const CallTM& call) const
+    {
+        // Serialize leaves the error bits alone, and scratch memory is not cleared
+        char* dest = out.Scratch();
+        const char* end = call.Serialize(dest, mCall.funcId);
+        ((BCall*)dest)->errNo = call.mCallErrNo;
+        out.Progress(end - dest);
+    }
+
+    /// Serializes the current call into buffer as OutFile writes it, for calls that are
+    /// kept in memory instead of being copied right away, and returns its size.
+    size_t reencode(std::vector<char>& buffer) const
+    {
+        CallTM call(mFile, callNo(), mCall);
+        buffer.resize(call.SerializedSizeBound());
+        const char* end = call.Serialize(buffer.data(), mCall.funcId);
+        ((BCall*)buffer.data())->errNo = call.mCallErrNo;
+        return end - buffer.data();
+    }
+
+    /// Appends the current call to out unchanged
+    void copyTo(OutFile& out) const
+    {
+        if (isCurrentFormat())
+        {
+            memcpy(out.Scratch(), mData, size());
+            out.Progress(size());
+        }
+        else
+        {
+            CallTM call(mFile, callNo(), mCall);
+            write(out, call);
+        }
+    }
+
+private:
+    InFile& mFile;
+    void* mFptr = nullptr;
+    char* mArgs = nullptr;
+    const char* mData = nullptr;
+    BCall_vlen mCall;
+};
+
+}
+
+#endif
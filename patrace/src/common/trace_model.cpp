@@ -3,6 +3,7 @@
 #include <common/parse_api.hpp>
 #include <common/api_info.hpp>
 #include <common/file_format.hpp>
+#include <common/out_file.hpp>
 
 #include <eglstate/common.hpp>
 
@@ -14,6 +15,9 @@
 
 #include <GLES3/gl32.h>
 #include <cmath>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <vector>
 #include <list>
 #include <string>
@@ -563,202 +567,343 @@ void ValueTM::ResizeArray(unsigned int size)
     }
 }
 
-std::string ValueTM::ToStr(const CallTM *call, int maxLen)
+namespace {
+
+// How ToStr() and ToC() print the values of a function. Worked out once per function,
+// rather than comparing function names for every value.
+struct CallFormat
+{
+    unsigned int enumFlags = 0;    // for EnumString()
+    bool intParamEnums = false;    // int parameter of glTexParameteri and friends may be an enum
+    bool floatParamEnums = false;  // float parameter of glTexParameterf and friends may be an enum
+    bool clearMask = false;        // glClear, print the mask bits
+};
+
+CallFormat makeCallFormat(const std::string &funcName)
 {
-    std::stringstream sstream;
+    CallFormat f;
+    f.enumFlags = EnumFunctionFlags(funcName);
+    f.intParamEnums = (funcName == "glSamplerParameteri" || funcName == "glTexParameteri" ||
+                       funcName == "glTexEnvx" || funcName == "glTexParameterx");
+    f.floatParamEnums = (funcName == "glSamplerParameterf" || funcName == "glTexParameterf");
+    f.clearMask = (funcName == "glClear");
+    return f;
+}
+
+CallFormat callFormat(const CallTM *call)
+{
+    static const std::vector<CallFormat> byId = []
+    {
+        std::vector<CallFormat> formats(ApiInfo::MaxSigId + 1);
+        for (unsigned int id = 1; id <= ApiInfo::MaxSigId; ++id)
+        {
+            if (ApiInfo::IdToNameArr[id])
+            {
+                formats[id] = makeCallFormat(ApiInfo::IdToNameArr[id]);
+            }
+        }
+        return formats;
+    }();
 
-    if (mName.size())
-        sstream<<mName<<"=";
+    // mCallId is the id in the trace file for calls that were not parsed, so check the name
+    const unsigned int id = call->mCallId;
+    if (id < byId.size() && ApiInfo::IdToNameArr[id] && call->mCallName == ApiInfo::IdToNameArr[id])
+    {
+        return byId[id];
+    }
+    return makeCallFormat(call->mCallName);
+}
+
+void appendFormat(std::string &out, const char *format, ...)
+{
+    char buffer[64];
+    va_list args;
+    va_start(args, format);
+    va_list retry;
+    va_copy(retry, args);
+    const int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (len >= (int)sizeof(buffer))
+    {
+        // Does not fit on the stack, so format it again into a buffer that does
+        std::vector<char> large(len + 1);
+        vsnprintf(large.data(), large.size(), format, retry);
+        out.append(large.data(), len);
+    }
+    else if (len > 0)
+    {
+        out.append(buffer, len);
+    }
+    va_end(retry);
+}
 
-    sstream << ToC(call, false);
+void appendUInt(std::string &out, unsigned long long v)
+{
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    do
+    {
+        *--p = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    out.append(p, buffer + sizeof(buffer) - p);
+}
 
-    if (maxLen != 0 && int(sstream.str().length()) > maxLen)
-        return sstream.str().substr(0, maxLen)+"...";
+void appendInt(std::string &out, long long v)
+{
+    if (v < 0)
+    {
+        out += '-';
+        appendUInt(out, 0ULL - (unsigned long long)v);
+    }
     else
-        return sstream.str();
+    {
+        appendUInt(out, v);
+    }
 }
 
-std::string ValueTM::ToC(const CallTM *call, bool asSourceCode)
+void appendC(std::string &out, ValueTM &value, const CallTM *call, const CallFormat &format, bool asSourceCode);
+
+// 'maxLen == 0' means no limitation
+void appendStr(std::string &out, ValueTM &value, const CallTM *call, const CallFormat &format, int maxLen)
 {
-    const std::string &funcName = call->mCallName;
-    std::stringstream sstream;
+    const size_t start = out.size();
 
-    const char * enumTmp = NULL;
-    std::string strTmp;
+    if (value.mName.size())
+    {
+        out += value.mName;
+        out += '=';
+    }
 
-    switch (mType) {
+    appendC(out, value, call, format, false);
+
+    if (maxLen != 0 && out.size() - start > (size_t)maxLen)
+    {
+        out.resize(start + maxLen);
+        out += "...";
+    }
+}
+
+// Prints the same as streaming the values into a std::stringstream used to
+void appendC(std::string &out, ValueTM &value, const CallTM *call, const CallFormat &format, bool asSourceCode)
+{
+    switch (value.mType) {
     case Void_Type:
-        return "void";
+        out += "void";
+        break;
     case Int8_Type:
-        sstream<<(int)mInt8;
+        appendInt(out, (int)value.mInt8);
         break;
     case Int_Type:
-        if (funcName == "glSamplerParameteri" || funcName == "glTexParameteri" ||
-            funcName == "glTexEnvx" || funcName == "glTexParameterx") // special case this
+        if (format.intParamEnums) // special case this
         {
             GLenum pname = call->mArgs[1]->GetAsUInt();
             if (pname != GL_TEXTURE_MAX_LOD && pname != GL_TEXTURE_MIN_LOD && pname != GL_TEXTURE_BASE_LEVEL
                 && pname != GL_TEXTURE_MAX_LEVEL)
             {
-                const char *str = EnumString(mInt, funcName);
+                const char *str = EnumString(value.mInt, format.enumFlags);
                 if (str)
                 {
-                    sstream << str;
-                    return sstream.str();
+                    out += str;
+                    break;
                 }
             }
         }
-        sstream<<mInt;
+        appendInt(out, value.mInt);
         break;
     case Int64_Type:
-        sstream<<mInt64;
+        appendInt(out, value.mInt64);
         break;
     case Uint64_Type:
-        sstream<<mUint64;
+        appendUInt(out, value.mUint64);
         break;
     case Int16_Type:
-        sstream<<mInt16;
+        appendInt(out, value.mInt16);
         break;
     case Uint16_Type:
-        sstream<<mUint16;
+        appendUInt(out, value.mUint16);
         break;
     case Uint8_Type:
-        sstream<<(int)mUint8;
-        if (asSourceCode) sstream<<'u';
+        appendInt(out, (int)value.mUint8);
+        if (asSourceCode) out += 'u';
         break;
     case Uint_Type:
-        if (funcName == "glClear")          // special case
+        if (format.clearMask) // special case
         {
-            sstream << std::hex << "0x" << mUint << "=(";
+            unsigned int mask = value.mUint;
+            appendFormat(out, "0x%x=(", mask);
             bool firstEnum = true;
-            if (mUint & GL_COLOR_BUFFER_BIT)
+            if (mask & GL_COLOR_BUFFER_BIT)
             {
                 firstEnum = false;
-                sstream << "GL_COLOR_BUFFER_BIT";
-                mUint -= GL_COLOR_BUFFER_BIT;
+                out += "GL_COLOR_BUFFER_BIT";
+                mask -= GL_COLOR_BUFFER_BIT;
             }
-            if (mUint & GL_DEPTH_BUFFER_BIT)
+            if (mask & GL_DEPTH_BUFFER_BIT)
             {
                 if (!firstEnum)
-                    sstream << " | ";
+                    out += " | ";
                 firstEnum = false;
-                sstream << "GL_DEPTH_BUFFER_BIT";
-                mUint -= GL_DEPTH_BUFFER_BIT;
+                out += "GL_DEPTH_BUFFER_BIT";
+                mask -= GL_DEPTH_BUFFER_BIT;
             }
-            if (mUint & GL_STENCIL_BUFFER_BIT)
+            if (mask & GL_STENCIL_BUFFER_BIT)
             {
                 if (!firstEnum)
-                    sstream << " | ";
+                    out += " | ";
                 firstEnum = false;
-                sstream << "GL_STENCIL_BUFFER_BIT";
-                mUint -= GL_STENCIL_BUFFER_BIT;
+                out += "GL_STENCIL_BUFFER_BIT";
+                mask -= GL_STENCIL_BUFFER_BIT;
             }
-            if (mUint)      // still some other bits, problematic
+            if (mask)      // still some other bits, problematic
             {
                 if (!firstEnum)
-                    sstream << " | ";
+                    out += " | ";
                 firstEnum = false;
-                sstream << std::hex << "0x" << mUint;
+                appendFormat(out, "0x%x", mask);
             }
-            sstream << ")";
+            out += ')';
         }
         else
         {
-            sstream<<mUint;
-            if (asSourceCode) sstream<<'u';
+            appendUInt(out, value.mUint);
+            if (asSourceCode) out += 'u';
         }
         break;
     case Enum_Type:
-        enumTmp = EnumString(mEnum, funcName);
+    {
+        const char *enumTmp = EnumString(value.mEnum, format.enumFlags);
         if (enumTmp == NULL) {
-            sstream << "0x" << std::hex << std::uppercase << mEnum;
-            //DBG_LOG("enum %s in %s not found\n", sstream.str().c_str(), funcName.c_str());
+            appendFormat(out, "0x%X", value.mEnum);
         } else {
-            sstream<<enumTmp;
+            out += enumTmp;
         }
         break;
+    }
     case Float_Type:
-        if (funcName == "glSamplerParameterf" || funcName == "glTexParameterf") // special case this
+        if (format.floatParamEnums) // special case this
         {
             GLenum pname = call->mArgs[1]->GetAsUInt();
             if (pname != GL_TEXTURE_MAX_LOD && pname != GL_TEXTURE_MIN_LOD && pname != GL_TEXTURE_BASE_LEVEL
                 && pname != GL_TEXTURE_MAX_LEVEL)
             {
-                sstream << EnumString(mFloat, funcName);
-                return sstream.str();
+                const char *str = EnumString(static_cast<unsigned int>(value.mFloat), format.enumFlags);
+                if (str) // unknown values used to print nothing at all
+                {
+                    out += str;
+                }
+                break;
             }
         }
-        if (asSourceCode){
-            // check float is not NaN or inf
-            if( std::isfinite(mFloat)) {
-                sstream<<mFloat;
-            } else {
-                sstream<<-1; // could define a special "bad float" variable, but, just output -1 for now.
-            }
-        } else{
-            sstream<<mFloat;
+        // check float is not NaN or inf
+        if (asSourceCode && !std::isfinite(value.mFloat))
+        {
+            out += "-1"; // could define a special "bad float" variable, but, just output -1 for now.
+        }
+        else
+        {
+            appendFormat(out, "%g", value.mFloat);
         }
         break;
     case String_Type:
-        sstream << std::string(mStr);
+        out += value.mStr;
         break;
     case Array_Type:
-        if (mArrayLen) {
-            sstream << "{";
-            for (unsigned int i = 0; i < mArrayLen-1; ++i) {
-                sstream << mArray[i].ToC(call) << ", ";
+        if (value.mArrayLen) {
+            out += '{';
+            for (unsigned int i = 0; i < value.mArrayLen-1; ++i) {
+                appendC(out, value.mArray[i], call, format, false);
+                out += ", ";
             }
-            sstream << mArray[mArrayLen-1].ToC(call);
-            sstream << "}";
-        } else if (mArrayLen == 0) {
-            sstream<<"NULL";
+            appendC(out, value.mArray[value.mArrayLen-1], call, format, false);
+            out += '}';
         } else {
-            sstream<<"badptr";
+            out += "NULL";
         }
         break;
     case MemRef_Type:
-        sstream<<mClientSideBufferName<<" + "<<mClientSideBufferOffset;
+        appendUInt(out, value.mClientSideBufferName);
+        out += " + ";
+        appendUInt(out, value.mClientSideBufferOffset);
         break;
     case Opaque_Type:
         // output an enum, the struct containing Opaque variables must be declared before call is output as c-code
-        switch (mOpaqueType)
+        switch (value.mOpaqueType)
         {
             case BufferObjectReferenceType:
-                sstream << "common::BufferObjectReferenceType/*" << mOpaqueIns->mUint << "*/";
+                out += "common::BufferObjectReferenceType/*";
+                appendUInt(out, value.mOpaqueIns->mUint);
+                out += "*/";
                 break;
             case BlobType:
-                sstream << "common::BlobType/*BlobSize:" << mOpaqueIns->mBlobLen << "*/";
+                out += "common::BlobType/*BlobSize:";
+                appendUInt(out, value.mOpaqueIns->mBlobLen);
+                out += "*/";
                 break;
             case ClientSideBufferObjectReferenceType:
-                sstream << "common::ClientSideBufferObjectReferenceType(" << mOpaqueIns->mClientSideBufferName << ", " << mOpaqueIns->mClientSideBufferOffset << ")";
+                out += "common::ClientSideBufferObjectReferenceType(";
+                appendUInt(out, value.mOpaqueIns->mClientSideBufferName);
+                out += ", ";
+                appendUInt(out, value.mOpaqueIns->mClientSideBufferOffset);
+                out += ')';
                 break;
             case NoopType:
                 break;
         }
         break;
     case Pointer_Type:
-        if (mPointer)
-            sstream << mPointer->ToStr(call);
+        if (value.mPointer)
+            appendStr(out, *value.mPointer, call, format, 32);
         else
-            sstream<<"NULL";
+            out += "NULL";
         break;
     case Unused_Pointer_Type:
-        sstream << mUnusedPointer;
+        // like std::ostream, which leaves out the 0x for null
+        if (value.mUnusedPointer)
+            appendFormat(out, "0x%llx", (unsigned long long)(uintptr_t)value.mUnusedPointer);
+        else
+            out += '0';
         break;
     case Blob_Type:
-        if (mBlobLen) {
-            if (asSourceCode) {sstream << "(GLubyte*)";}
-            sstream << "_binary_blob_" << mId << "_bin_start";
-            sstream << "/*BlobSize" << mBlobLen << "*/";
+        if (value.mBlobLen) {
+            if (asSourceCode) out += "(GLubyte*)";
+            out += "_binary_blob_";
+            appendUInt(out, value.mId);
+            out += "_bin_start/*BlobSize";
+            appendUInt(out, value.mBlobLen);
+            out += "*/";
         } else {
-            sstream << "NULL";
+            out += "NULL";
         }
         break;
     };
+}
 
-    return sstream.str();
 }
 
+std::string ValueTM::ToStr(const CallTM *call, int maxLen)
+{
+    std::string str;
+    ToStr(str, call, maxLen);
+    return str;
+}
+
+void ValueTM::ToStr(std::string &out, const CallTM *call, int maxLen)
+{
+    appendStr(out, *this, call, callFormat(call), maxLen);
+}
+
+std::string ValueTM::ToC(const CallTM *call, bool asSourceCode)
+{
+    std::string str;
+    ToC(str, call, asSourceCode);
+    return str;
+}
+
+void ValueTM::ToC(std::string &out, const CallTM *call, bool asSourceCode)
+{
+    appendC(out, *this, call, callFormat(call), asSourceCode);
+}
 
 std::string ValueTM::TypeNameToStr()
 {
@@ -806,6 +951,60 @@ std::string ValueTM::TypeNameToStr()
     };
 }
 
+// Every padded write may need up to three bytes of padding, depending on where it starts
+size_t ValueTM::SerializedSizeBound(bool doPadding) const
+{
+    const size_t pad = 3;
+    size_t size = 0;
+    switch (mType) {
+    case Int8_Type:
+    case Int_Type:
+    case Uint8_Type:
+    case Uint_Type:
+    case Int16_Type:
+    case Uint16_Type:
+    case Int64_Type:
+    case Uint64_Type:
+    case Enum_Type:
+    case Float_Type:
+        size = gValueTypeSize[mType] + (doPadding ? pad : 0);
+        break;
+    case String_Type:
+        size = sizeof(unsigned int) + mStr.size() + 1 + pad;
+        break;
+    case Array_Type:
+        size = sizeof(unsigned int) + pad;
+        if (mEleType != String_Type) {
+            for (unsigned int i = 0; i < mArrayLen; ++i)
+                size += mArray[i].SerializedSizeBound(false);
+            size += pad;
+        } else if (mArrayLen > 0) {
+            size += mArrayLen * sizeof(unsigned int) + sizeof(unsigned int) + pad;
+            for (unsigned int i = 0; i < mArrayLen; ++i)
+                size += mArray[i].SerializedSizeBound(true);
+        }
+        break;
+    case Blob_Type:
+        size = sizeof(unsigned int) + pad + (mBlob ? mBlobLen : 0) + pad;
+        break;
+    case Opaque_Type:
+        size = sizeof(unsigned int) + pad + (mOpaqueIns ? mOpaqueIns->SerializedSizeBound(true) : 0);
+        break;
+    case Pointer_Type:
+        size = sizeof(unsigned int) + pad + (mPointer ? mPointer->SerializedSizeBound(true) : 0);
+        break;
+    case Unused_Pointer_Type:
+        size = sizeof(void*) + (doPadding ? pad : 0);
+        break;
+    case MemRef_Type:
+        size = 2 * (sizeof(unsigned int) + pad);
+        break;
+    default:
+        break;
+    };
+    return size;
+}
+
 char* ValueTM::Serialize(char* dest, bool doPadding) const
 {
     switch (mType) {
@@ -1029,6 +1228,18 @@ CallTM::CallTM(InFile &infile, unsigned callNo, const BCall_vlen &call)
     (*(ParseFunc)fptr)(src, *this, infile.getHeaderVersion());
 }
 
+CallTM::CallTM(const InFileBase &infile, unsigned callNo, const BCall_vlen &call, char *src)
+ : mCallNo(callNo), mTid(call.tid), mCallId(call.funcId)
+{
+    const std::string name = infile.ExIdToName(mCallId);
+    const void *fptr = parse_callbacks.at(name).first;
+    mRet.mName = "ret";
+    mCallErrNo = static_cast<CALL_ERROR_NO>(call.errNo);
+    mReadPos = 0;
+    mInjected = (call.source > 0);
+    (*(ParseFunc)fptr)(src, *this, infile.getHeaderVersion());
+}
+
 patchfile patchfile_open(const InFileBase& infile, const char* filename)
 {
     patchfile p;
@@ -1159,36 +1370,61 @@ bool CallTM::Load(InFileRA *infile)
 
 std::string CallTM::ToStr(bool isAbbreviate)
 {
-    std::string strArgs;
+    std::string str;
+    ToStr(str, isAbbreviate);
+    return str;
+}
+
+void CallTM::ToStr(std::string &out, bool isAbbreviate)
+{
+    const CallFormat format = callFormat(this);
+    const int maxLen = isAbbreviate ? 32 : 0;
+    appendStr(out, mRet, this, format, maxLen);
+    out += ' ';
+    out += mCallName;
+    out += '(';
     for (unsigned int i = 0; i < mArgs.size(); ++i) {
-        strArgs += mArgs[i]->ToStr(this, isAbbreviate ? 32 : 0);
+        appendStr(out, *mArgs[i], this, format, maxLen);
         if (i != mArgs.size()-1)
-            strArgs += ", ";
+            out += ", ";
     }
+    out += ')';
 
-    std::string strErr;
-    if (mCallErrNo != CALL_GL_NO_ERROR) {
-        switch (mCallErrNo) {
-        case CALL_GL_INVALID_ENUM:
-            strErr = " ERR: GL_INVALID_ENUM";
-            break;
-        case CALL_GL_INVALID_VALUE:
-            strErr = " ERR: GL_INVALID_VALUE";
-            break;
-        case CALL_GL_INVALID_OPERATION:
-            strErr = " ERR: GL_INVALID_OPERATION";
-            break;
-        case CALL_GL_INVALID_FRAMEBUFFER_OPERATION:
-            strErr = " ERR: GL_INVALID_FRAMEBUFFER_OPERATION";
-            break;
-        case CALL_GL_OUT_OF_MEMORY:
-            strErr = " ERR: GL_OUT_OF_MEMORY";
-            break;
-        default:
-            break;
-        }
+    switch (mCallErrNo) {
+    case CALL_GL_INVALID_ENUM:
+        out += " ERR: GL_INVALID_ENUM";
+        break;
+    case CALL_GL_INVALID_VALUE:
+        out += " ERR: GL_INVALID_VALUE";
+        break;
+    case CALL_GL_INVALID_OPERATION:
+        out += " ERR: GL_INVALID_OPERATION";
+        break;
+    case CALL_GL_INVALID_FRAMEBUFFER_OPERATION:
+        out += " ERR: GL_INVALID_FRAMEBUFFER_OPERATION";
+        break;
+    case CALL_GL_OUT_OF_MEMORY:
+        out += " ERR: GL_OUT_OF_MEMORY";
+        break;
+    default:
+        break;
     }
-    return mRet.ToStr(this, isAbbreviate ? 32 : 0) + " " + mCallName + "(" + strArgs + ")" + strErr;
+}
+
+size_t CallTM::SerializedSizeBound() const
+{
+    size_t size = sizeof(BCall_vlen);
+    for (unsigned int i = 0; i < mArgs.size(); ++i)
+        size += mArgs[i]->SerializedSizeBound(true);
+    if (mRet.mType != Void_Type)
+        size += mRet.SerializedSizeBound(true);
+    return size;
+}
+
+void CallTM::Serialize(OutFile &out, int overrideID, bool injected) const
+{
+    char *dest = out.Reserve(SerializedSizeBound());
+    out.Commit(Serialize(dest, overrideID, injected));
 }
 
 char* CallTM::Serialize(char* dest, int overrideID, bool injected) const
@@ -1208,6 +1444,7 @@ char* CallTM::Serialize(char* dest, int overrideID, bool injected) const
         else
             pCall->funcId = overrideID;
         pCall->tid = mTid;
+        pCall->errNo = 0;
         pCall->source = (injected || mInjected) ? 1 : 0;
         pCall->reserved = 0;
         dest += sizeof(BCall);
@@ -1217,6 +1454,7 @@ char* CallTM::Serialize(char* dest, int overrideID, bool injected) const
         else
             pCallVlen->funcId = overrideID;
         pCallVlen->tid = mTid;
+        pCallVlen->errNo = 0;
         pCallVlen->source = (injected || mInjected) ? 1 : 0;
         pCallVlen->reserved = 0;
         dest += sizeof(BCall_vlen);
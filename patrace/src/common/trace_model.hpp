@@ -25,6 +25,7 @@ namespace common {
 // Forwad declaration
 class TraceFileTM;
 class CallTM;
+class OutFile;
 
 struct OpaqueArg {
     union {
@@ -158,8 +159,13 @@ public:
     // 'maxLen == 0' means no limitation
     std::string ToStr(const CallTM *call, int maxLen=32);
     std::string ToC(const CallTM *call, bool asSourceCode=false);
+    // As above, appending to out
+    void ToStr(std::string &out, const CallTM *call, int maxLen=32);
+    void ToC(std::string &out, const CallTM *call, bool asSourceCode=false);
     std::string TypeNameToStr();
     char* Serialize(char* dest, bool doPadding) const;
+    // Upper bound of the bytes Serialize() writes
+    size_t SerializedSizeBound(bool doPadding) const;
 
     ValueTM(const ValueTM &other);
     ValueTM &operator =(const ValueTM &other);
@@ -239,6 +245,8 @@ public:
 
     CallTM(InFileRA &infile, unsigned callNo, const BCall_vlen &call);
     CallTM(InFile &infile, unsigned callNo, const BCall_vlen &call);
+    /// Decodes a call of infile whose arguments have been copied to src
+    CallTM(const InFileBase &infile, unsigned callNo, const BCall_vlen &call, char *src);
 
     ~CallTM() {
         ClearArguments();
@@ -266,7 +274,12 @@ public:
     bool mInjected = false;
 
     std::string ToStr(bool isAbbreviate = true);
+    void ToStr(std::string &out, bool isAbbreviate = true); // appends to out
     char* Serialize(char* dest, int overrideID = -1, bool injected = false) const;
+    /// Serializes straight into the current chunk of out, without an intermediate buffer
+    void Serialize(OutFile &out, int overrideID = -1, bool injected = false) const;
+    /// Upper bound of the bytes Serialize() writes
+    size_t SerializedSizeBound() const;
 
 private:
     CallTM(const CallTM &);
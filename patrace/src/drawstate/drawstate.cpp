@@ -1292,6 +1292,7 @@ static void usage(const char *argv0)
             "  --noscreen Write to pbuffers\n"
             "  --range START STOP Run specified frame range\n"
             "  --overrideEGL RED GREEN BLUE ALPHA DEPTH STENCIL Set speficified EGL configuration\n"
+            "  --png OPTIONS PNG encoding of the dumped images, see -snapshotpng of paretrace\n"
             "\n"
             , argv0);
 }
@@ -1335,6 +1336,16 @@ static bool ParseCommandLine(int argc, char** argv, retracer::RetraceOptions& mO
             mOptions.mBeginMeasureFrame = atoi(argv[++argIndex]);
             mOptions.mEndMeasureFrame = atoi(argv[++argIndex]);
         }
+        else if (arg == "--png")
+        {
+            image::PngOptions options;
+            if (!image::parsePngOptions(argv[++argIndex], options))
+            {
+                usage(argv[0]);
+                return false;
+            }
+            image::setDefaultPngOptions(options);
+        }
         else
         {
             DBG_LOG("Error: Unknown option %s\n", arg.c_str());
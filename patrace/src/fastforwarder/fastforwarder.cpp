@@ -14,6 +14,7 @@
 #include "helper/eglsize.hpp"
 #include "helper/shaderutility.hpp"
 #include "helper/depth_dumper.hpp"
+#include "fastforwarder/trace_command_emitter.hpp"
 
 #include "json/reader.h"
 #include "json/writer.h"
@@ -162,909 +163,16 @@ std::unordered_set<unsigned int> gUnusedMipgen; // call id of redundant glGenera
 
 namespace RetraceAndTrim
 {
-class ScratchBuffer
-{
-public:
-    ScratchBuffer(size_t initialCapacity = 0)
-        : mVector()
-    {
-        resizeToFit(initialCapacity);
-    }
-
-    // Only use the returned ptr after making sure the buffer is large enough
-    char* bufferPtr()
-    {
-        return mVector.data();
-    }
-
-    // Pointers returned from bufferPtr() previously
-    // are invalid after calling this!
-    void resizeToFit(size_t len)
-    {
-        mVector.reserve(len);
-    }
-
-private:
-    // Noncopyable
-    ScratchBuffer(const ScratchBuffer&);
-    ScratchBuffer& operator=(const ScratchBuffer&);
-    std::vector<char> mVector;
-};
-
-// NOTE: This emits commands in the _V4_ trace file format!
-class TraceCommandEmitter
-{
-public:
-    enum TexDimension{
-        Tex2D,
-        Tex3D
-    };
-    TraceCommandEmitter(common::OutFile& outFile, int threadId)
-        : mScratchBuff(0)
-        , mOutFile(outFile)
-        , mThreadId(threadId)
-        // NOTE: getId checks that the ids are valid, and aborts if not.
-        , mGlGenBuffersId(getId("glGenBuffers"))
-        , mGlDeleteBuffersId(getId("glDeleteBuffers"))
-        , mGlBufferDataId(getId("glBufferData"))
-        , mGlBufferSubDataId(getId("glBufferSubData"))
-        , mGlBindBufferId(getId("glBindBuffer"))
-        , mGlMapBufferRangeId(getId("glMapBufferRange"))
-        , mGlUnmapBufferId(getId("glUnmapBuffer"))
-        , mGlBindVertexArrayId(getId("glBindVertexArray"))
-        , mGlVertexAttribPointerId(getId("glVertexAttribPointer"))
-        , mGlVertexAttribIPointerId(getId("glVertexAttribIPointer"))
-        , mGlEnableVertexAttribArrayId(getId("glEnableVertexAttribArray"))
-        , mGlDisableVertexAttribArrayId(getId("glDisableVertexAttribArray"))
-        , mGlBindFramebufferId(getId("glBindFramebuffer"))
-        , mGlGenTexturesId(getId("glGenTextures"))
-        , mGlDeleteTexturesId(getId("glDeleteTextures"))
-        , mGlTexImage2DId(getId("glTexImage2D"))
-        , mGlTexSubImage2DId(getId("glTexSubImage2D"))
-        , mGlTexSubImage3DId(getId("glTexSubImage3D"))
-        , mGlActiveTextureId(getId("glActiveTexture"))
-        , mGlBindTextureId(getId("glBindTexture"))
-        , mGlTexParameteriId(getId("glTexParameteri"))
-        , mGlTexParameterfId(getId("glTexParameterf"))
-        , mGlPixelStoreiId(getId("glPixelStorei"))
-        , mGlCreateShaderId(getId("glCreateShader"))
-        , mGlShaderSourceId(getId("glShaderSource"))
-        , mGlCompileShaderId(getId("glCompileShader"))
-        , mGlCreateProgramId(getId("glCreateProgram"))
-        , mGlAttachSahderId(getId("glAttachShader"))
-        , mGlLinkProgramId(getId("glLinkProgram"))
-        , mGlUseProgramId(getId("glUseProgram"))
-        , mGlDeleteShaderId(getId("glDeleteShader"))
-        , mGlDeleteProgramId(getId("glDeleteProgram"))
-        , mGlBindSamplerId(getId("glBindSampler"))
-        , mGlEnable(getId("glEnable"))
-        , mGlDisable(getId("glDisable"))
-        , mGlClear(getId("glClear"))
-        , mGlClearColor(getId("glClearColor"))
-        , mGlViewportId(getId("glViewport"))
-        , mGlColorMaskId(getId("glColorMask"))
-        , mGlDrawElements(getId("glDrawElements"))
-        , mGlFrontFace(getId("glFrontFace"))
-        , mEglSwapBuffers(getId("eglSwapBuffers"))
-    {}
-
-    void emitDisable(GLenum cap)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int));
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlDisable);
-        dest = common::WriteFixed<int>(dest, cap); // enum
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitEnable(GLenum cap)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int));
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlEnable);
-        dest = common::WriteFixed<int>(dest, cap); // enum
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitClear(GLbitfield mask)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int));
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlClear);
-        dest = common::WriteFixed<int>(dest, mask);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLfloat) * 4);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlClearColor);
-        dest = common::WriteFixed<float>(dest, red);
-        dest = common::WriteFixed<float>(dest, green);
-        dest = common::WriteFixed<float>(dest, blue);
-        dest = common::WriteFixed<float>(dest, alpha);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitBufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 3 + size + 32);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* tmpBuf = bufStart;
-
-        // Make room for BCall_vlen at start of buffer
-        tmpBuf += sizeof(common::BCall_vlen);
-
-        tmpBuf = common::WriteFixed<int>(tmpBuf, target); // enum
-        tmpBuf = common::WriteFixed<int>(tmpBuf, size); // literal
-        tmpBuf = common::Write1DArray<char>(tmpBuf, (unsigned int)size, (const char*)data); // blob
-        tmpBuf = common::WriteFixed<int>(tmpBuf, usage); // enum
-
-        // Write BCall_vlen to bufStart
-        int toNext = tmpBuf - bufStart;
-        writeBCall_vlen(bufStart, mGlBufferDataId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 3 + size + 32);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* tmpBuf = bufStart;
-
-        // Make room for BCall_vlen at start of buffer
-        tmpBuf += sizeof(common::BCall_vlen);
-
-        tmpBuf = common::WriteFixed<int>(tmpBuf, target); // enum
-        tmpBuf = common::WriteFixed<int>(tmpBuf, offset); // literal
-        tmpBuf = common::WriteFixed<int>(tmpBuf, size); // literal
-        tmpBuf = common::Write1DArray<char>(tmpBuf, (unsigned int)size, (const char*)data); // blob
-
-        // Write BCall_vlen to bufStart
-        int toNext = tmpBuf - bufStart;
-        writeBCall_vlen(bufStart, mGlBufferSubDataId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitTexSubImage(TexDimension dimension, GLenum target, GLint level,
-                         GLint xoffset, GLint yoffset, GLint zoffset,
-                         GLsizei width, GLsizei height, GLsizei depth,
-                         GLenum format, GLenum type, unsigned int textureSize, const char* data)
-    {
-        if (dimension == Tex2D)
-            mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 9 + textureSize + 32);
-        else if (dimension == Tex3D)
-            mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 11 + textureSize + 32);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-
-        // Written last (need to know toNext)
-        dest += sizeof(common::BCall_vlen);
-
-        dest = common::WriteFixed<int>(dest, target); // enum target
-        dest = common::WriteFixed<int>(dest, level); // literal level
-        dest = common::WriteFixed<int>(dest, xoffset); // literal xoffset
-        dest = common::WriteFixed<int>(dest, yoffset); // literal yoffset
-        if (dimension == Tex3D)
-            dest = common::WriteFixed<int>(dest, zoffset); // literal zoffset
-        dest = common::WriteFixed<unsigned int>(dest, width); // literal width
-        dest = common::WriteFixed<unsigned int>(dest, height); // literal height
-        if (dimension == Tex3D)
-            dest = common::WriteFixed<unsigned int>(dest, depth); // literal depth
-        dest = common::WriteFixed<int>(dest, format); // enum format
-        dest = common::WriteFixed<int>(dest, type); // enum type
-        dest = common::WriteFixed<unsigned int>(dest, common::BlobType);
-        dest = common::Write1DArray<char>(dest, textureSize, data);
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        if (dimension == Tex2D)
-            writeBCall_vlen(bufStart, mGlTexSubImage2DId, toNext);
-        else if (dimension == Tex3D)
-            writeBCall_vlen(bufStart, mGlTexSubImage3DId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitPixelStorei(GLenum pname, GLint param)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlPixelStoreiId);
-        dest = common::WriteFixed<int>(dest, pname); // enum
-        dest = common::WriteFixed<unsigned int>(dest, param); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitTexParameteri(unsigned int target, GLenum pname, unsigned int param)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 3 + 32);
-
-        char* bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlTexParameteriId);
-        dest = common::WriteFixed<int>(dest, target); // enum
-        dest = common::WriteFixed<int>(dest, pname); // enum
-        dest = common::WriteFixed<int>(dest, param); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitTexParameterf(unsigned int target, GLenum pname, float param)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 3);
-
-        char* bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlTexParameterfId);
-        dest = common::WriteFixed<int>(dest, target); // enum
-        dest = common::WriteFixed<int>(dest, pname); // enum
-        dest = common::WriteFixed<float>(dest, param); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitBindTexture(GLenum target, GLuint tex)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlBindTextureId);
-        dest = common::WriteFixed<int>(dest, target); // enum
-        dest = common::WriteFixed<unsigned int>(dest, tex); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitBindFramebuffer(GLenum target, GLint id)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2 + 32);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlBindFramebufferId);
-        dest = common::WriteFixed<int>(dest, (int) target); // enum
-        dest = common::WriteFixed<unsigned int>(dest, id); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitBindBuffer(GLenum target, GLint id)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2 + 32);
-
-        char* const bufStart = mScratchBuff.bufferPtr();
-        char* dest = bufStart;
-        dest = writeBCall(dest, mGlBindBufferId);
-        dest = common::WriteFixed<int>(dest, (int) target); // enum
-        dest = common::WriteFixed<unsigned int>(dest, id); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitCreateShader(GLenum type, GLuint shader)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-        dest = writeBCall(dest, mGlCreateShaderId);
-        dest = common::WriteFixed(dest, (int)type);
-        dest = common::WriteFixed(dest, shader);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitShaderSource(GLuint shader, GLsizei count, const GLchar **string, const GLint *length)
-    {
-        GLsizei size;
-
-        size = sizeof(common::BCall_vlen) + sizeof(GLuint) + sizeof(GLsizei) + 32;
-        size += count * sizeof(GLuint) + sizeof(GLuint) + 4;
-
-        if (length != NULL)
-        {
-            for (int i = 0; i < count; ++i)
-            {
-                if (length[i])
-                {
-                    size += length[i] + 5;
-                }
-            }
-            size += sizeof(GLuint) + count * sizeof(GLint) + 4;
-        }
-        else
-        {
-            for (int i = 0; i < count; ++i)
-            {
-                if (string[i])
-                {
-                    size += strlen(string[i]) + 5;
-                }
-            }
-        }
-        mScratchBuff.resizeToFit(size);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<unsigned int>(dest, shader);        // literal
-        dest = common::WriteFixed<int>(dest, count);                  // literal
-        dest = common::WriteStringArray(dest, count, string);         // string array
-        dest = common::Write1DArray<int>(dest, count, (int *)length); // array
-
-        // Write BCall_vlen to bufStart
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlShaderSourceId, toNext);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitCompileShader(GLuint shader)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlCompileShaderId);
-        dest = common::WriteFixed<unsigned int>(dest, shader);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitCreateProgram(GLuint program)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlCreateProgramId);
-        dest = common::WriteFixed<unsigned int>(dest, program);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitAttachShader(GLuint program, GLuint shader)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) * 2 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlAttachSahderId);
-        dest = common::WriteFixed<unsigned int>(dest, program);
-        dest = common::WriteFixed<unsigned int>(dest, shader);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitLinkProgram(GLuint program)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlLinkProgramId);
-        dest = common::WriteFixed<unsigned int>(dest, program);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitUseProgram(GLuint program)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlUseProgramId);
-        dest = common::WriteFixed<unsigned int>(dest, program);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitDeleteShader(GLuint shader)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlDeleteShaderId);
-        dest = common::WriteFixed<unsigned int>(dest, shader);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitDeleteProgram(GLuint program)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlDeleteProgramId);
-        dest = common::WriteFixed<unsigned int>(dest, program);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitActiveTexture(GLenum target)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlActiveTextureId);
-        dest = common::WriteFixed<int>(dest, target);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitGenTextures(GLsizei n, GLuint *textures)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * n + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<int>(dest, n);                                      // literal
-        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)textures); // array
-
-        // Write BCall_vlen to bufStart
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlGenTexturesId, toNext);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitTexImage2D(GLenum target,
-                        GLint level,
-                        GLint internalformat,
-                        GLsizei width,
-                        GLsizei height,
-                        GLint border,
-                        GLenum format,
-                        GLenum type,
-                        const GLvoid *pixels,
-                        GLsizei size)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLint) * 10 + size + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        // Written last (need to know toNext)
-        dest += sizeof(common::BCall_vlen);
-
-        dest = common::WriteFixed<int>(dest, target);         // enum
-        dest = common::WriteFixed<int>(dest, level);          // literal
-        dest = common::WriteFixed<int>(dest, internalformat); // enum
-        dest = common::WriteFixed<int>(dest, width);          // literal
-        dest = common::WriteFixed<int>(dest, height);         // literal
-        dest = common::WriteFixed<int>(dest, border);         // literal
-        dest = common::WriteFixed<int>(dest, format);         // enum
-        dest = common::WriteFixed<int>(dest, type);           // enum
-        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BlobType);
-        dest = common::Write1DArray<char>(dest, size, (const char *)pixels);
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlTexImage2DId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitGenBuffers(GLsizei n, GLuint *buffer)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * (n + 2) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-
-        dest = common::WriteFixed<int>(dest, n);
-        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)buffer);
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlGenBuffersId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitBindVertexArray(GLuint array)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlBindVertexArrayId);
-        dest = common::WriteFixed<unsigned int>(dest, array);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitVertexAttibPointer(GLuint index,
-                                GLint size,
-                                GLenum type,
-                                GLboolean normalized,
-                                GLsizei stride,
-                                const GLvoid *pointer)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * 6 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<unsigned int>(dest, index);                                             // literal
-        dest = common::WriteFixed<int>(dest, size);                                                       // literal
-        dest = common::WriteFixed<int>(dest, type);                                                       // enum
-        dest = common::WriteFixed<unsigned char>(dest, normalized);                                       // literal
-        dest = common::WriteFixed<int>(dest, stride);                                                     // literal
-        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // IS Simple Memory Offset
-        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)pointer);                                // opaque -> ptr
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlVertexAttribPointerId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitEnableVertexAttribArray(GLuint index)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 4);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlEnableVertexAttribArrayId);
-        dest = common::WriteFixed<unsigned int>(dest, index);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitViewport(GLint x, GLint y, GLsizei width, GLsizei height)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLint) * 4 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlViewportId);
-        dest = common::WriteFixed<int>(dest, x);      // literal
-        dest = common::WriteFixed<int>(dest, y);      // literal
-        dest = common::WriteFixed<int>(dest, width);  // literal
-        dest = common::WriteFixed<int>(dest, height); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(unsigned char) * 4 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlColorMaskId);
-        dest = common::WriteFixed<unsigned char>(dest, red);   // literal
-        dest = common::WriteFixed<unsigned char>(dest, green); // literal
-        dest = common::WriteFixed<unsigned char>(dest, blue);  // literal
-        dest = common::WriteFixed<unsigned char>(dest, alpha); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 3 + sizeof(unsigned int) * 2 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<int>(dest, mode);                                                       // enum
-        dest = common::WriteFixed<int>(dest, count);                                                      // literal
-        dest = common::WriteFixed<int>(dest, type);                                                       // enum
-        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // ISN'T *BLOB*
-        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)indices);                                // opaque -> ptr
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlDrawElements, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitFrontFace(GLenum mode)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlFrontFace);
-        dest = common::WriteFixed<int>(dest, mode); // enum
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitDeleteTextures(GLsizei n, const GLuint *textures)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * (n + 2) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<int>(dest, n);                                      // literal
-        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)textures); // array
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlDeleteTexturesId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitVertexAttribIPointer(GLuint index,
-                                  GLint size,
-                                  GLenum type,
-                                  GLsizei stride,
-                                  const GLvoid *pointer)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 5 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<unsigned int>(dest, index);                                             // literal
-        dest = common::WriteFixed<int>(dest, size);                                                       // literal
-        dest = common::WriteFixed<int>(dest, type);                                                       // enum
-        dest = common::WriteFixed<int>(dest, stride);                                                     // literal
-        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // IS Simple Memory Offset
-        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)pointer);                                // opaque -> ptr
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlVertexAttribIPointerId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitGlDisableVertexAttribArray(GLuint index)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(unsigned int) + 4);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlDisableVertexAttribArrayId);
-        dest = common::WriteFixed<unsigned int>(dest, index); // literal
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitDeleteBuffers(GLsizei n, const GLuint *buffers)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * (n + 2) + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<int>(dest, n);                                     // literal
-        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)buffers); // array
-
-        // NOTE: written to bufStart, not dest
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlDeleteBuffersId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitBindSampler(GLuint unit, GLuint sampler)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) * 2 + 4);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlBindSamplerId);
-        dest = common::WriteFixed<unsigned int>(dest, unit);
-        dest = common::WriteFixed<unsigned int>(dest, sampler);
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitSwapBuffers(GLint dpy, GLint surface)
-    {
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLint) * 3 + 4);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mEglSwapBuffers);
-        dest = common::WriteFixed<GLint>(dest, dpy);  // dpy
-        dest = common::WriteFixed<GLint>(dest, surface);   // eglSurface
-        dest = common::WriteFixed<int>(dest, 1); //result
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-    void emitMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access, GLvoid *result)
-    {
-        DBG_LOG("emitMapBufferRange\n");
-        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int)*3 + sizeof(unsigned int)*3 + 32);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest += sizeof(common::BCall_vlen);
-        dest = common::WriteFixed<int>(dest, target); // enum
-        dest = common::WriteFixed<int>(dest, offset); // literal
-        dest = common::WriteFixed<int>(dest, length); // literal
-        dest = common::WriteFixed<unsigned int>(dest, access); // literal
-        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // IS Simple Memory Offset
-        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)result);
-
-        int toNext = dest - bufStart;
-        writeBCall_vlen(bufStart, mGlMapBufferRangeId, toNext);
-
-        mOutFile.Write(bufStart, toNext);
-    }
-
-    void emitUnmapBuffer(GLenum target)
-    {
-        DBG_LOG("emitUnmapBuffer\n");
-        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(unsigned int) + sizeof(unsigned char) + 4);
-
-        char *const bufStart = mScratchBuff.bufferPtr();
-        char *dest = bufStart;
-
-        dest = writeBCall(dest, mGlUnmapBufferId);
-        dest = common::WriteFixed<int>(dest, target); // enum
-        dest = common::WriteFixed<unsigned char>(dest, 1); // result
-
-        mOutFile.Write(bufStart, dest - bufStart);
-    }
-
-private:
-    ScratchBuffer mScratchBuff;
-    common::OutFile& mOutFile;
-    int mThreadId;
-    int mGlGenBuffersId;
-    int mGlDeleteBuffersId;
-    int mGlBufferDataId;
-    int mGlBufferSubDataId;
-    int mGlBindBufferId;
-    int mGlMapBufferRangeId;
-    int mGlUnmapBufferId;
-    int mGlBindVertexArrayId;
-    int mGlVertexAttribPointerId;
-    int mGlVertexAttribIPointerId;
-    int mGlEnableVertexAttribArrayId;
-    int mGlDisableVertexAttribArrayId;
-    int mGlBindFramebufferId;
-    int mGlGenTexturesId;
-    int mGlDeleteTexturesId;
-    int mGlTexImage2DId;
-    int mGlTexSubImage2DId;
-    int mGlTexSubImage3DId;
-    int mGlActiveTextureId;
-    int mGlBindTextureId;
-    int mGlTexParameteriId;
-    int mGlTexParameterfId;
-    int mGlPixelStoreiId;
-    int mGlCreateShaderId;
-    int mGlShaderSourceId;
-    int mGlCompileShaderId;
-    int mGlCreateProgramId;
-    int mGlAttachSahderId;
-    int mGlLinkProgramId;
-    int mGlUseProgramId;
-    int mGlDeleteShaderId;
-    int mGlDeleteProgramId;
-    int mGlBindSamplerId;
-    int mGlEnable;
-    int mGlDisable;
-    int mGlClear;
-    int mGlClearColor;
-    int mGlViewportId;
-    int mGlColorMaskId;
-    int mGlDrawElements;
-    int mGlFrontFace;
-    int mEglSwapBuffers;
-
-    int getId(const char* name)
-    {
-        int id = common::gApiInfo.NameToId(name);
-
-        if (id == 0)
-        {
-            DBG_LOG("Error: couldn't get sigbook-id for function %s", name);
-            os::abort();
-        }
-
-        return id;
-    }
-
-    char* writeBCall(char* dest, int funcId)
-    {
-        common::BCall bcall;
-        bcall.funcId = funcId;
-        bcall.tid = mThreadId;
-        bcall.reserved = 0;
-        bcall.errNo = 0;
-        bcall.source = 1;
-
-        unsigned int bcallSize = sizeof(bcall);
-        memcpy(dest, &bcall, bcallSize);
-
-        return dest + bcallSize;
-    }
-
-    char* writeBCall_vlen(char* dest, int funcId, int toNext)
-    {
-        common::BCall_vlen bcv;
-        bcv.funcId = funcId;
-        bcv.tid = mThreadId;
-        bcv.reserved = 0;
-        bcv.errNo = 0;
-        bcv.toNext = toNext;
-        bcv.source = 1;
-
-        unsigned int bcallSize = sizeof(bcv);
-        memcpy(dest, &bcv, bcallSize);
-
-        return dest + bcallSize;
-    }
-};
-
 class BufferSaver
 {
 public:
-    static void run(retracer::Context& retracerContext, common::OutFile& outFile, int threadId, unsigned int flags)
+    static void run(retracer::Context& retracerContext, common::OutFile& outFile, int threadId, unsigned int flags, PayloadPool& pool)
     {
         const auto buffers = retracerContext.getBufferMap().GetCopy();
         const auto revBuffers = retracerContext.getBufferRevMap().GetCopy();
 
         // Create helper which adds command to tracefile
-        TraceCommandEmitter traceCommandEmitter(outFile, threadId);
+        TraceCommandEmitter traceCommandEmitter(outFile, threadId, &pool);
 
         // Read buffer-id bound to GL_ARRAY_BUFFER locally (to restore when
         // done)
@@ -1176,8 +284,10 @@ public:
                         os::abort();
                     }
 
-                    // Emit glBufferSubData(GL_ARRAY_BUFFER, 0, len, data);
-                    traceCommandEmitter.emitBufferSubData(GL_ARRAY_BUFFER, 0, buffLength, data);
+                    // Emit glBufferSubData(GL_ARRAY_BUFFER, 0, len, data), with runs of repeated bytes filled in
+                    // by glCopyBufferSubData, or a copy from a client-side buffer with the same contents
+                    const bool canMap = !immutable_storage || (storage_bits & GL_MAP_WRITE_BIT);
+                    traceCommandEmitter.emitSparseBufferContents(GL_ARRAY_BUFFER, buffLength, data, canMap);
                 }
                 _glUnmapBuffer(GL_ARRAY_BUFFER);
                 if (pre_mapped)
@@ -1215,8 +325,8 @@ bool checkError(const std::string &msg)
 class TextureSaver
 {
 public:
-    TextureSaver(retracer::Context& retracerContext, common::OutFile& outFile, int threadId, unsigned int flags)
-        : mRetracerContext(retracerContext), mOutFile(outFile), mThreadId(threadId), mScratchBuff(), mFlags(flags)
+    TextureSaver(retracer::Context& retracerContext, common::OutFile& outFile, int threadId, unsigned int flags, PayloadPool& pool)
+        : mRetracerContext(retracerContext), mOutFile(outFile), mThreadId(threadId), mScratchBuff(), mFlags(flags), mPool(pool)
     {
         TexTypeInfo info2d("2D", GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D, TraceCommandEmitter::Tex2D);
         TexTypeInfo info2dArray("2D_Array", GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BINDING_2D_ARRAY, TraceCommandEmitter::Tex3D);
@@ -1241,7 +351,7 @@ public:
     {
         checkError("TextureSaver::run begin");
 
-        TraceCommandEmitter traceCommandEmitter(mOutFile, mThreadId);
+        TraceCommandEmitter traceCommandEmitter(mOutFile, mThreadId, &mPool);
 
         const auto textures = mRetracerContext.getTextureMap().GetCopy();
         const auto revTextures = mRetracerContext.getTextureRevMap().GetCopy();
@@ -1974,19 +1084,38 @@ public:
                     default:
                         break;
                     }
-                    traceCommandEmitter.emitTexSubImage(typeInfo.texDimension, // dimension
-                        target,             // target
-                        curMipmapLevel,     // level
-                        0,                  // xoffset
-                        0,                  // yoffset
-                        zoffset,            // zoffset
-                        mipmapSize.width,   // width
-                        mipmapSize.height,  // height
-                        depth,              // depth
-                        readTexFormat,      // format
-                        readTexType,        // type
-                        textureSize,
-                        (const char*) texData.bufferPtr());
+                    // Rows are tightly packed, as both pack and unpack alignment are 1 here
+                    const size_t texelSize = _glClearBufferData_size(readTexFormat, readTexType);
+                    if (texelSize > 0)
+                    {
+                        traceCommandEmitter.emitSparseTexSubImage(typeInfo.texDimension, // dimension
+                            target,             // target
+                            curMipmapLevel,     // level
+                            zoffset,            // zoffset
+                            mipmapSize.width,   // width
+                            mipmapSize.height,  // height
+                            depth,              // depth
+                            readTexFormat,      // format
+                            readTexType,        // type
+                            texelSize,
+                            (const char*) texData.bufferPtr());
+                    }
+                    else
+                    {
+                        traceCommandEmitter.emitTexSubImage(typeInfo.texDimension, // dimension
+                            target,             // target
+                            curMipmapLevel,     // level
+                            0,                  // xoffset
+                            0,                  // yoffset
+                            zoffset,            // zoffset
+                            mipmapSize.width,   // width
+                            mipmapSize.height,  // height
+                            depth,              // depth
+                            readTexFormat,      // format
+                            readTexType,        // type
+                            textureSize,
+                            (const char*) texData.bufferPtr());
+                    }
                 }
                 else
                 {
@@ -2031,6 +1160,7 @@ private:
     int mThreadId;
     ScratchBuffer mScratchBuff;
     unsigned int mFlags;
+    PayloadPool& mPool;
 };
 
 class DefaultFboSaver
@@ -3561,18 +2691,33 @@ static void saveData(common::OutFile &out, unsigned int flags, unsigned int repe
     _glMemoryBarrier(GL_ALL_BARRIER_BITS);
     _glFinish();
 
+    // Buffers and textures with the same contents share them through client-side buffers
+    RetraceAndTrim::PayloadPool pool;
+
     // Save buffers
     {
-    RetraceAndTrim::BufferSaver::run(retracer.getCurrentContext(), out, retracer.getCurTid(), flags);
+    RetraceAndTrim::BufferSaver::run(retracer.getCurrentContext(), out, retracer.getCurTid(), flags, pool);
     }
 
     // Save texture
     if (flags & FASTFORWARD_RESTORE_TEXTURES)
     {
-        RetraceAndTrim::TextureSaver ts(retracer.getCurrentContext(), out, retracer.getCurTid(), flags);
+        RetraceAndTrim::TextureSaver ts(retracer.getCurrentContext(), out, retracer.getCurTid(), flags, pool);
         ts.run();
     }
 
+    // The restored objects have their contents now
+    RetraceAndTrim::TraceCommandEmitter(out, retracer.getCurTid(), &pool).emitDeletePooledBuffers();
+    const RetraceAndTrim::PayloadPool::Stats& poolStats = pool.stats();
+    DBG_LOG("Restored %u payloads of %llu bytes, %u of them shared, saving %llu bytes\n", poolStats.payloads,
+            (unsigned long long)poolStats.bytes, poolStats.reused, (unsigned long long)poolStats.savedBytes);
+    ffJson["sharedPayloads"] = poolStats.reused;
+    ffJson["sharedPayloadBytes"] = (Json::Value::UInt64)poolStats.savedBytes;
+    DBG_LOG("Restored %u runs of repeated bytes (%llu bytes) with fill calls, using %s scan kernels\n", poolStats.fills,
+            (unsigned long long)poolStats.filledBytes, RetraceAndTrim::fillScanSimdName());
+    ffJson["filledRuns"] = poolStats.fills;
+    ffJson["filledBytes"] = (Json::Value::UInt64)poolStats.filledBytes;
+
     if (flags & FASTFORWARD_RESTORE_DEFAUTL_FBO)
     {
         RetraceAndTrim::DefaultFboSaver fbo0(retracer.getCurrentContext(), out, retracer.getCurTid(), repeat, dpy, surface);
@@ -0,0 +1,143 @@
+#include "fastforwarder/fill_scan.hpp"
+
+#include <algorithm>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FILL_SCAN_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FILL_SCAN_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace RetraceAndTrim
+{
+
+// Outside of runs, findFillRuns only looks for the start of a new run every this many bytes.
+// A run is therefore found up to STEP - 1 bytes after it really starts.
+static const size_t STEP = 16;
+
+static size_t scalarMatchLength(const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t i = 0;
+    while (i < size && a[i] == b[i])
+    {
+        i++;
+    }
+    return i;
+}
+
+#if FILL_SCAN_X86
+
+static size_t sse2MatchLength(const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t i = 0;
+    // 64 bytes per iteration while they match, which is the common case inside a run
+    for (; i + 64 <= size; i += 64)
+    {
+        const __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        const __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)), _mm_loadu_si128((const __m128i *)(b + i + 16)));
+        const __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)), _mm_loadu_si128((const __m128i *)(b + i + 32)));
+        const __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)), _mm_loadu_si128((const __m128i *)(b + i + 48)));
+        const __m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if (_mm_movemask_epi8(all) != 0xffff)
+        {
+            break;
+        }
+    }
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        const unsigned mask = _mm_movemask_epi8(eq);
+        if (mask != 0xffff)
+        {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+    return i + scalarMatchLength(a + i, b + i, size - i);
+}
+
+#elif FILL_SCAN_NEON
+
+static size_t neonMatchLength(const unsigned char *a, const unsigned char *b, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        const uint8x16_t e0 = vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        const uint8x16_t e1 = vceqq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+        const uint64x2_t all = vreinterpretq_u64_u8(vandq_u8(e0, e1));
+        if ((vgetq_lane_u64(all, 0) & vgetq_lane_u64(all, 1)) != ~(uint64_t)0)
+        {
+            break;
+        }
+    }
+    // The mismatch is somewhere in the next 32 bytes, or the end is near
+    return i + scalarMatchLength(a + i, b + i, size - i);
+}
+
+#endif
+
+const char *fillScanSimdName()
+{
+#if FILL_SCAN_X86
+    return "sse2";
+#elif FILL_SCAN_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+size_t matchLength(const unsigned char *a, const unsigned char *b, size_t size, FillScanKernel kernel)
+{
+    if (kernel == FILL_SCAN_SCALAR)
+    {
+        return scalarMatchLength(a, b, size);
+    }
+#if FILL_SCAN_X86
+    return sse2MatchLength(a, b, size);
+#elif FILL_SCAN_NEON
+    return neonMatchLength(a, b, size);
+#else
+    return scalarMatchLength(a, b, size);
+#endif
+}
+
+bool isRepeating(const unsigned char *data, size_t size, size_t period, FillScanKernel kernel)
+{
+    if (size <= period)
+    {
+        return true;
+    }
+    // Comparing the data with itself shifted by one period checks every repetition at once
+    return matchLength(data + period, data, size - period, kernel) == size - period;
+}
+
+std::vector<FillRun> findFillRuns(const unsigned char *data, size_t size, size_t period, size_t minSize, FillScanKernel kernel)
+{
+    std::vector<FillRun> runs;
+    if (period == 0)
+    {
+        return runs;
+    }
+    // data[i, i + n) equals data[i - period, i + n - period), so data[i - period, i + n) repeats its first period bytes
+    size_t i = period;
+    while (i < size)
+    {
+        const size_t n = matchLength(data + i, data + i - period, size - i, kernel);
+        if (n + period >= minSize)
+        {
+            runs.push_back({ i - period, n + period });
+            i += n + period;
+        }
+        else
+        {
+            i += std::max(n + 1, STEP);
+        }
+    }
+    return runs;
+}
+
+}
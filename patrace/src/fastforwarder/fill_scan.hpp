@@ -0,0 +1,44 @@
+#ifndef _FASTFORWARDER_FILL_SCAN_HPP_
+#define _FASTFORWARDER_FILL_SCAN_HPP_
+
+#include <stddef.h>
+#include <vector>
+
+// Finds the parts of buffer and texture contents that repeat a short pattern (zero-filled
+// buffers, cleared render targets, padding), so that the fastforwarder can restore them
+// with a few small calls instead of embedding every byte in the trace.
+
+namespace RetraceAndTrim
+{
+
+enum FillScanKernel
+{
+    FILL_SCAN_SCALAR, // one byte at a time, the reference for the others
+    FILL_SCAN_SIMD,   // best instruction set available (SSE2 or NEON)
+};
+
+/// Name of the instruction set used by FILL_SCAN_SIMD, e.g. "sse2" or "scalar"
+const char *fillScanSimdName();
+
+/// Number of leading bytes that a and b have in common, at most size. The two may overlap.
+size_t matchLength(const unsigned char *a, const unsigned char *b, size_t size, FillScanKernel kernel = FILL_SCAN_SIMD);
+
+/// True if data is its first period bytes repeated, e.g. a row of identical texels.
+/// The last repetition may be cut short.
+bool isRepeating(const unsigned char *data, size_t size, size_t period, FillScanKernel kernel = FILL_SCAN_SIMD);
+
+/// A range that repeats its first period bytes
+struct FillRun
+{
+    size_t offset;
+    size_t size;
+};
+
+/// The ranges of at least minSize bytes that repeat a pattern of period bytes, in order
+/// and without overlaps. A pattern that repeats with a shorter period that divides period
+/// is found as well, so period 16 finds runs of equal bytes, shorts, ints and vec4s.
+std::vector<FillRun> findFillRuns(const unsigned char *data, size_t size, size_t period, size_t minSize, FillScanKernel kernel = FILL_SCAN_SIMD);
+
+}
+
+#endif
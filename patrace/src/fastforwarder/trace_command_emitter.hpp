@@ -0,0 +1,1305 @@
+#ifndef _FASTFORWARDER_TRACE_COMMAND_EMITTER_HPP_
+#define _FASTFORWARDER_TRACE_COMMAND_EMITTER_HPP_
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common/api_info.hpp"
+#include "common/content_hash.hpp"
+#include "common/file_format.hpp"
+#include "common/os.hpp"
+#include "common/out_file.hpp"
+#include "fastforwarder/fill_scan.hpp"
+
+#include "../../thirdparty/opengl-registry/api/GLES3/gl31.h"
+
+namespace RetraceAndTrim
+{
+class ScratchBuffer
+{
+public:
+    ScratchBuffer(size_t initialCapacity = 0)
+        : mVector()
+    {
+        resizeToFit(initialCapacity);
+    }
+
+    // Only use the returned ptr after making sure the buffer is large enough
+    char* bufferPtr()
+    {
+        return mVector.data();
+    }
+
+    // Pointers returned from bufferPtr() previously
+    // are invalid after calling this!
+    void resizeToFit(size_t len)
+    {
+        mVector.reserve(len);
+    }
+
+private:
+    // Noncopyable
+    ScratchBuffer(const ScratchBuffer&);
+    ScratchBuffer& operator=(const ScratchBuffer&);
+    std::vector<char> mVector;
+};
+
+/// Remembers the contents of the buffers and textures restored into one output trace,
+/// so that contents that were restored before are not embedded in the trace again.
+/// Many objects hold identical contents (cleared render targets, zero-filled buffers,
+/// duplicated atlases). The first time some contents are seen, they are written out in
+/// full as usual. The second time, they are also put into a client-side buffer, which
+/// this and all later restorations of the same contents refer to.
+///
+/// Contents are identified by two 64-bit hashes with different seeds and their size.
+class PayloadPool
+{
+public:
+    /// Smaller payloads are cheaper to write out than to refer to
+    static const size_t MIN_SIZE = 4096;
+    /// Client-side buffer names given out by the tracer count up from 1, so these do not clash
+    static const unsigned FIRST_NAME = 0xf0000000u;
+
+    enum Result
+    {
+        NEW,    ///< Not seen before, write it out in full
+        DEFINE, ///< Seen once before, write it to client-side buffer name and refer to it
+        REUSE   ///< Already in client-side buffer name, refer to it
+    };
+
+    struct Stats
+    {
+        unsigned payloads = 0;
+        unsigned reused = 0;
+        uint64_t bytes = 0;
+        uint64_t savedBytes = 0;
+        unsigned fills = 0;       // runs of repeated bytes restored by a few small calls
+        uint64_t filledBytes = 0; // bytes restored that way, not included in bytes
+    };
+
+    PayloadPool() : mNextName(FIRST_NAME) {}
+
+    Result lookup(int threadId, const void* data, size_t size, unsigned& name)
+    {
+        mStats.payloads++;
+        mStats.bytes += size;
+        return find(threadId, data, size, false, name);
+    }
+
+    /// Like lookup(), for contents that are worth a client-side buffer the first time they
+    /// are seen, such as the fill patterns that restore constant regions. Never returns NEW.
+    Result share(int threadId, const void* data, size_t size, unsigned& name)
+    {
+        return find(threadId, data, size, true, name);
+    }
+
+    void countFill(size_t size)
+    {
+        mStats.fills++;
+        mStats.filledBytes += size;
+    }
+
+    /// Client-side buffers handed out so far, with their thread
+    const std::vector<std::pair<int, unsigned>>& names() const { return mNames; }
+    const Stats& stats() const { return mStats; }
+
+private:
+    Result find(int threadId, const void* data, size_t size, bool always, unsigned& name)
+    {
+        const Key key = { common::ContentHash::hash(data, size), common::ContentHash::hash(data, size, size), size, threadId };
+        auto it = mEntries.find(key);
+        if (it == mEntries.end())
+        {
+            if (!always)
+            {
+                mEntries.emplace(key, 0);
+                return NEW;
+            }
+            it = mEntries.emplace(key, 0).first;
+        }
+        else if (!always)
+        {
+            mStats.reused++;
+        }
+        if (it->second == 0)
+        {
+            it->second = mNextName++;
+            mNames.emplace_back(threadId, it->second);
+            name = it->second;
+            return DEFINE;
+        }
+        if (!always)
+        {
+            mStats.savedBytes += size;
+        }
+        name = it->second;
+        return REUSE;
+    }
+
+    struct Key
+    {
+        uint64_t hash;
+        uint64_t hash2;
+        size_t size;
+        int threadId;
+        bool operator==(const Key& k) const { return hash == k.hash && hash2 == k.hash2 && size == k.size && threadId == k.threadId; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const { return k.hash; }
+    };
+
+    std::unordered_map<Key, unsigned, KeyHash> mEntries; // to client-side buffer name, 0 if none yet
+    std::vector<std::pair<int, unsigned>> mNames;
+    unsigned mNextName;
+    Stats mStats;
+};
+
+// NOTE: This emits commands in the _V4_ trace file format!
+class TraceCommandEmitter
+{
+public:
+    enum TexDimension{
+        Tex2D,
+        Tex3D
+    };
+    /// With a pool, restored contents that were written before refer to a client-side buffer instead
+    TraceCommandEmitter(common::OutFile& outFile, int threadId, PayloadPool* pool = nullptr)
+        : mScratchBuff(0)
+        , mOutFile(outFile)
+        , mThreadId(threadId)
+        , mPool(pool)
+        // NOTE: getId checks that the ids are valid, and aborts if not.
+        , mGlGenBuffersId(getId("glGenBuffers"))
+        , mGlDeleteBuffersId(getId("glDeleteBuffers"))
+        , mGlBufferDataId(getId("glBufferData"))
+        , mGlBufferSubDataId(getId("glBufferSubData"))
+        , mGlBindBufferId(getId("glBindBuffer"))
+        , mGlMapBufferRangeId(getId("glMapBufferRange"))
+        , mGlUnmapBufferId(getId("glUnmapBuffer"))
+        , mGlBindVertexArrayId(getId("glBindVertexArray"))
+        , mGlVertexAttribPointerId(getId("glVertexAttribPointer"))
+        , mGlVertexAttribIPointerId(getId("glVertexAttribIPointer"))
+        , mGlEnableVertexAttribArrayId(getId("glEnableVertexAttribArray"))
+        , mGlDisableVertexAttribArrayId(getId("glDisableVertexAttribArray"))
+        , mGlBindFramebufferId(getId("glBindFramebuffer"))
+        , mGlGenTexturesId(getId("glGenTextures"))
+        , mGlDeleteTexturesId(getId("glDeleteTextures"))
+        , mGlTexImage2DId(getId("glTexImage2D"))
+        , mGlTexSubImage2DId(getId("glTexSubImage2D"))
+        , mGlTexSubImage3DId(getId("glTexSubImage3D"))
+        , mGlActiveTextureId(getId("glActiveTexture"))
+        , mGlBindTextureId(getId("glBindTexture"))
+        , mGlTexParameteriId(getId("glTexParameteri"))
+        , mGlTexParameterfId(getId("glTexParameterf"))
+        , mGlPixelStoreiId(getId("glPixelStorei"))
+        , mGlCreateShaderId(getId("glCreateShader"))
+        , mGlShaderSourceId(getId("glShaderSource"))
+        , mGlCompileShaderId(getId("glCompileShader"))
+        , mGlCreateProgramId(getId("glCreateProgram"))
+        , mGlAttachSahderId(getId("glAttachShader"))
+        , mGlLinkProgramId(getId("glLinkProgram"))
+        , mGlUseProgramId(getId("glUseProgram"))
+        , mGlDeleteShaderId(getId("glDeleteShader"))
+        , mGlDeleteProgramId(getId("glDeleteProgram"))
+        , mGlBindSamplerId(getId("glBindSampler"))
+        , mGlEnable(getId("glEnable"))
+        , mGlDisable(getId("glDisable"))
+        , mGlClear(getId("glClear"))
+        , mGlClearColor(getId("glClearColor"))
+        , mGlViewportId(getId("glViewport"))
+        , mGlColorMaskId(getId("glColorMask"))
+        , mGlDrawElements(getId("glDrawElements"))
+        , mGlFrontFace(getId("glFrontFace"))
+        , mEglSwapBuffers(getId("eglSwapBuffers"))
+        , mGlCreateClientSideBufferId(getId("glCreateClientSideBuffer"))
+        , mGlDeleteClientSideBufferId(getId("glDeleteClientSideBuffer"))
+        , mGlClientSideBufferDataId(getId("glClientSideBufferData"))
+        , mGlCopyClientSideBufferId(getId("glCopyClientSideBuffer"))
+        , mGlCopyBufferSubDataId(getId("glCopyBufferSubData"))
+    {}
+
+    void emitDisable(GLenum cap)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int));
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlDisable);
+        dest = common::WriteFixed<int>(dest, cap); // enum
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitEnable(GLenum cap)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int));
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlEnable);
+        dest = common::WriteFixed<int>(dest, cap); // enum
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitClear(GLbitfield mask)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int));
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlClear);
+        dest = common::WriteFixed<int>(dest, mask);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLfloat) * 4);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlClearColor);
+        dest = common::WriteFixed<float>(dest, red);
+        dest = common::WriteFixed<float>(dest, green);
+        dest = common::WriteFixed<float>(dest, blue);
+        dest = common::WriteFixed<float>(dest, alpha);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitBufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum usage)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 3 + size + 32);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* tmpBuf = bufStart;
+
+        // Make room for BCall_vlen at start of buffer
+        tmpBuf += sizeof(common::BCall_vlen);
+
+        tmpBuf = common::WriteFixed<int>(tmpBuf, target); // enum
+        tmpBuf = common::WriteFixed<int>(tmpBuf, size); // literal
+        tmpBuf = common::Write1DArray<char>(tmpBuf, (unsigned int)size, (const char*)data); // blob
+        tmpBuf = common::WriteFixed<int>(tmpBuf, usage); // enum
+
+        // Write BCall_vlen to bufStart
+        int toNext = tmpBuf - bufStart;
+        writeBCall_vlen(bufStart, mGlBufferDataId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 3 + size + 32);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* tmpBuf = bufStart;
+
+        // Make room for BCall_vlen at start of buffer
+        tmpBuf += sizeof(common::BCall_vlen);
+
+        tmpBuf = common::WriteFixed<int>(tmpBuf, target); // enum
+        tmpBuf = common::WriteFixed<int>(tmpBuf, offset); // literal
+        tmpBuf = common::WriteFixed<int>(tmpBuf, size); // literal
+        tmpBuf = common::Write1DArray<char>(tmpBuf, (unsigned int)size, (const char*)data); // blob
+
+        // Write BCall_vlen to bufStart
+        int toNext = tmpBuf - bufStart;
+        writeBCall_vlen(bufStart, mGlBufferSubDataId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    /// Restores the contents of the buffer bound to target, like emitBufferSubData(target, 0, size, data).
+    /// If the contents were restored before and canMap is set, they are copied from a client-side buffer
+    /// through a write mapping instead.
+    void emitBufferContents(GLenum target, GLsizeiptr size, const GLvoid* data, bool canMap)
+    {
+        const unsigned csb = canMap ? clientSideBufferFor(data, size) : 0;
+        if (csb == 0)
+        {
+            emitBufferSubData(target, 0, size, data);
+            return;
+        }
+        emitMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT, nullptr);
+        emitCopyClientSideBuffer(target, csb);
+        emitUnmapBuffer(target);
+    }
+
+    /// Like emitBufferContents(), but runs of repeated bytes are written once and then doubled
+    /// with glCopyBufferSubData within the buffer, and only the bytes between them are written out.
+    void emitSparseBufferContents(GLenum target, GLsizeiptr size, const GLvoid* data, bool canMap)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        const std::vector<FillRun> runs = findFillRuns(bytes, size, FILL_PERIOD, FILL_MIN_SIZE);
+        if (runs.empty())
+        {
+            emitBufferContents(target, size, data, canMap);
+            return;
+        }
+        size_t pos = 0;
+        for (const FillRun& run : runs)
+        {
+            if (run.offset > pos)
+            {
+                emitBufferSubData(target, pos, run.offset - pos, bytes + pos);
+            }
+            // The run repeats its first FILL_PERIOD bytes, so it can be copied onto itself in growing steps
+            const size_t seed = run.size < FILL_SEED_SIZE ? run.size : FILL_SEED_SIZE;
+            emitBufferSubData(target, run.offset, seed, bytes + run.offset);
+            for (size_t done = seed; done < run.size; done *= 2)
+            {
+                emitCopyBufferSubData(target, target, run.offset, run.offset + done, std::min(done, run.size - done));
+            }
+            if (mPool) mPool->countFill(run.size);
+            pos = run.offset + run.size;
+        }
+        if (pos < (size_t)size)
+        {
+            emitBufferSubData(target, pos, size - pos, bytes + pos);
+        }
+    }
+
+    void emitCopyBufferSubData(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 5);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlCopyBufferSubDataId);
+        dest = common::WriteFixed<int>(dest, readTarget); // enum
+        dest = common::WriteFixed<int>(dest, writeTarget); // enum
+        dest = common::WriteFixed<int>(dest, readOffset); // literal
+        dest = common::WriteFixed<int>(dest, writeOffset); // literal
+        dest = common::WriteFixed<int>(dest, size); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitCreateClientSideBuffer(GLuint name)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint));
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+        dest = writeBCall(dest, mGlCreateClientSideBufferId);
+        dest = common::WriteFixed<unsigned int>(dest, name); // result
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitDeleteClientSideBuffer(GLuint name)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint));
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+        dest = writeBCall(dest, mGlDeleteClientSideBufferId);
+        dest = common::WriteFixed<unsigned int>(dest, name);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitClientSideBufferData(GLuint name, GLsizei size, const GLvoid* data)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 3 + size + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<unsigned int>(dest, name); // literal
+        dest = common::WriteFixed<int>(dest, size); // literal
+        dest = common::Write1DArray<char>(dest, (unsigned int)size, (const char*)data); // blob
+
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlClientSideBufferDataId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitCopyClientSideBuffer(GLenum target, GLuint name)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+        dest = writeBCall(dest, mGlCopyClientSideBufferId);
+        dest = common::WriteFixed<int>(dest, target); // enum
+        dest = common::WriteFixed<unsigned int>(dest, name); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    /// Deletes the client-side buffers the pool made for this thread, once the contents are restored
+    void emitDeletePooledBuffers()
+    {
+        if (!mPool) return;
+        for (const auto& pair : mPool->names())
+        {
+            if (pair.first == mThreadId)
+            {
+                emitDeleteClientSideBuffer(pair.second);
+            }
+        }
+    }
+
+    void emitTexSubImage(TexDimension dimension, GLenum target, GLint level,
+                         GLint xoffset, GLint yoffset, GLint zoffset,
+                         GLsizei width, GLsizei height, GLsizei depth,
+                         GLenum format, GLenum type, unsigned int textureSize, const char* data)
+    {
+        // Called before taking the scratch buffer, as it may emit calls itself
+        const unsigned csb = clientSideBufferFor(data, textureSize);
+        writeTexSubImage(dimension, target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, textureSize, data, csb);
+    }
+
+    /// Like emitTexSubImage() for a whole image (or one layer) of tightly packed rows. Bands of
+    /// rows that hold a single texel value are restored from a client-side buffer with a few of
+    /// those rows, and only the other rows are written out.
+    void emitSparseTexSubImage(TexDimension dimension, GLenum target, GLint level, GLint zoffset,
+                               GLsizei width, GLsizei height, GLsizei depth,
+                               GLenum format, GLenum type, unsigned int texelSize, const char* data)
+    {
+        const size_t rowSize = (size_t)width * texelSize;
+        if (!mPool)
+        {
+            // The fill rows would have to be written out each time
+            emitTexSubImage(dimension, target, level, 0, 0, zoffset, width, height, depth, format, type, height * rowSize, data);
+            return;
+        }
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        // Bands smaller than this are cheaper to write out with their neighbours
+        const GLsizei minRows = std::max<GLsizei>(1, (FILL_MIN_SIZE + rowSize - 1) / rowSize);
+        GLsizei dirtyStart = 0;
+        GLsizei y = 0;
+        while (y < height)
+        {
+            const unsigned char* row = bytes + y * rowSize;
+            if (!isRepeating(row, rowSize, texelSize))
+            {
+                y++;
+                continue;
+            }
+            GLsizei end = y + 1;
+            while (end < height && matchLength(bytes + end * rowSize, row, rowSize) == rowSize)
+            {
+                end++;
+            }
+            if (end - y >= minRows)
+            {
+                if (y > dirtyStart)
+                {
+                    emitTexSubImage(dimension, target, level, 0, dirtyStart, zoffset, width, y - dirtyStart, depth,
+                                    format, type, (y - dirtyStart) * rowSize, data + dirtyStart * rowSize);
+                }
+                emitFillRows(dimension, target, level, y, zoffset, width, end - y, depth, format, type, rowSize, data + y * rowSize);
+                dirtyStart = end;
+            }
+            y = end;
+        }
+        if (dirtyStart < height)
+        {
+            emitTexSubImage(dimension, target, level, 0, dirtyStart, zoffset, width, height - dirtyStart, depth,
+                            format, type, (height - dirtyStart) * rowSize, data + dirtyStart * rowSize);
+        }
+    }
+
+    void emitPixelStorei(GLenum pname, GLint param)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlPixelStoreiId);
+        dest = common::WriteFixed<int>(dest, pname); // enum
+        dest = common::WriteFixed<unsigned int>(dest, param); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitTexParameteri(unsigned int target, GLenum pname, unsigned int param)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 3 + 32);
+
+        char* bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlTexParameteriId);
+        dest = common::WriteFixed<int>(dest, target); // enum
+        dest = common::WriteFixed<int>(dest, pname); // enum
+        dest = common::WriteFixed<int>(dest, param); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitTexParameterf(unsigned int target, GLenum pname, float param)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 3);
+
+        char* bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlTexParameterfId);
+        dest = common::WriteFixed<int>(dest, target); // enum
+        dest = common::WriteFixed<int>(dest, pname); // enum
+        dest = common::WriteFixed<float>(dest, param); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitBindTexture(GLenum target, GLuint tex)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlBindTextureId);
+        dest = common::WriteFixed<int>(dest, target); // enum
+        dest = common::WriteFixed<unsigned int>(dest, tex); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitBindFramebuffer(GLenum target, GLint id)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2 + 32);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlBindFramebufferId);
+        dest = common::WriteFixed<int>(dest, (int) target); // enum
+        dest = common::WriteFixed<unsigned int>(dest, id); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitBindBuffer(GLenum target, GLint id)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2 + 32);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+        dest = writeBCall(dest, mGlBindBufferId);
+        dest = common::WriteFixed<int>(dest, (int) target); // enum
+        dest = common::WriteFixed<unsigned int>(dest, id); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitCreateShader(GLenum type, GLuint shader)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) * 2 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+        dest = writeBCall(dest, mGlCreateShaderId);
+        dest = common::WriteFixed(dest, (int)type);
+        dest = common::WriteFixed(dest, shader);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitShaderSource(GLuint shader, GLsizei count, const GLchar **string, const GLint *length)
+    {
+        GLsizei size;
+
+        size = sizeof(common::BCall_vlen) + sizeof(GLuint) + sizeof(GLsizei) + 32;
+        size += count * sizeof(GLuint) + sizeof(GLuint) + 4;
+
+        if (length != NULL)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                if (length[i])
+                {
+                    size += length[i] + 5;
+                }
+            }
+            size += sizeof(GLuint) + count * sizeof(GLint) + 4;
+        }
+        else
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                if (string[i])
+                {
+                    size += strlen(string[i]) + 5;
+                }
+            }
+        }
+        mScratchBuff.resizeToFit(size);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<unsigned int>(dest, shader);        // literal
+        dest = common::WriteFixed<int>(dest, count);                  // literal
+        dest = common::WriteStringArray(dest, count, string);         // string array
+        dest = common::Write1DArray<int>(dest, count, (int *)length); // array
+
+        // Write BCall_vlen to bufStart
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlShaderSourceId, toNext);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitCompileShader(GLuint shader)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlCompileShaderId);
+        dest = common::WriteFixed<unsigned int>(dest, shader);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitCreateProgram(GLuint program)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlCreateProgramId);
+        dest = common::WriteFixed<unsigned int>(dest, program);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitAttachShader(GLuint program, GLuint shader)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) * 2 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlAttachSahderId);
+        dest = common::WriteFixed<unsigned int>(dest, program);
+        dest = common::WriteFixed<unsigned int>(dest, shader);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitLinkProgram(GLuint program)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlLinkProgramId);
+        dest = common::WriteFixed<unsigned int>(dest, program);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitUseProgram(GLuint program)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlUseProgramId);
+        dest = common::WriteFixed<unsigned int>(dest, program);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitDeleteShader(GLuint shader)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlDeleteShaderId);
+        dest = common::WriteFixed<unsigned int>(dest, shader);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitDeleteProgram(GLuint program)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlDeleteProgramId);
+        dest = common::WriteFixed<unsigned int>(dest, program);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitActiveTexture(GLenum target)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlActiveTextureId);
+        dest = common::WriteFixed<int>(dest, target);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitGenTextures(GLsizei n, GLuint *textures)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * n + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<int>(dest, n);                                      // literal
+        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)textures); // array
+
+        // Write BCall_vlen to bufStart
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlGenTexturesId, toNext);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitTexImage2D(GLenum target,
+                        GLint level,
+                        GLint internalformat,
+                        GLsizei width,
+                        GLsizei height,
+                        GLint border,
+                        GLenum format,
+                        GLenum type,
+                        const GLvoid *pixels,
+                        GLsizei size)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLint) * 10 + size + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        // Written last (need to know toNext)
+        dest += sizeof(common::BCall_vlen);
+
+        dest = common::WriteFixed<int>(dest, target);         // enum
+        dest = common::WriteFixed<int>(dest, level);          // literal
+        dest = common::WriteFixed<int>(dest, internalformat); // enum
+        dest = common::WriteFixed<int>(dest, width);          // literal
+        dest = common::WriteFixed<int>(dest, height);         // literal
+        dest = common::WriteFixed<int>(dest, border);         // literal
+        dest = common::WriteFixed<int>(dest, format);         // enum
+        dest = common::WriteFixed<int>(dest, type);           // enum
+        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BlobType);
+        dest = common::Write1DArray<char>(dest, size, (const char *)pixels);
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlTexImage2DId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitGenBuffers(GLsizei n, GLuint *buffer)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * (n + 2) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+
+        dest = common::WriteFixed<int>(dest, n);
+        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)buffer);
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlGenBuffersId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitBindVertexArray(GLuint array)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlBindVertexArrayId);
+        dest = common::WriteFixed<unsigned int>(dest, array);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitVertexAttibPointer(GLuint index,
+                                GLint size,
+                                GLenum type,
+                                GLboolean normalized,
+                                GLsizei stride,
+                                const GLvoid *pointer)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * 6 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<unsigned int>(dest, index);                                             // literal
+        dest = common::WriteFixed<int>(dest, size);                                                       // literal
+        dest = common::WriteFixed<int>(dest, type);                                                       // enum
+        dest = common::WriteFixed<unsigned char>(dest, normalized);                                       // literal
+        dest = common::WriteFixed<int>(dest, stride);                                                     // literal
+        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // IS Simple Memory Offset
+        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)pointer);                                // opaque -> ptr
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlVertexAttribPointerId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitEnableVertexAttribArray(GLuint index)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) + 4);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlEnableVertexAttribArrayId);
+        dest = common::WriteFixed<unsigned int>(dest, index);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLint) * 4 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlViewportId);
+        dest = common::WriteFixed<int>(dest, x);      // literal
+        dest = common::WriteFixed<int>(dest, y);      // literal
+        dest = common::WriteFixed<int>(dest, width);  // literal
+        dest = common::WriteFixed<int>(dest, height); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(unsigned char) * 4 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlColorMaskId);
+        dest = common::WriteFixed<unsigned char>(dest, red);   // literal
+        dest = common::WriteFixed<unsigned char>(dest, green); // literal
+        dest = common::WriteFixed<unsigned char>(dest, blue);  // literal
+        dest = common::WriteFixed<unsigned char>(dest, alpha); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 3 + sizeof(unsigned int) * 2 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<int>(dest, mode);                                                       // enum
+        dest = common::WriteFixed<int>(dest, count);                                                      // literal
+        dest = common::WriteFixed<int>(dest, type);                                                       // enum
+        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // ISN'T *BLOB*
+        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)indices);                                // opaque -> ptr
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlDrawElements, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitFrontFace(GLenum mode)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(int) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlFrontFace);
+        dest = common::WriteFixed<int>(dest, mode); // enum
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitDeleteTextures(GLsizei n, const GLuint *textures)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * (n + 2) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<int>(dest, n);                                      // literal
+        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)textures); // array
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlDeleteTexturesId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitVertexAttribIPointer(GLuint index,
+                                  GLint size,
+                                  GLenum type,
+                                  GLsizei stride,
+                                  const GLvoid *pointer)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 5 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<unsigned int>(dest, index);                                             // literal
+        dest = common::WriteFixed<int>(dest, size);                                                       // literal
+        dest = common::WriteFixed<int>(dest, type);                                                       // enum
+        dest = common::WriteFixed<int>(dest, stride);                                                     // literal
+        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // IS Simple Memory Offset
+        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)pointer);                                // opaque -> ptr
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlVertexAttribIPointerId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitGlDisableVertexAttribArray(GLuint index)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(unsigned int) + 4);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlDisableVertexAttribArrayId);
+        dest = common::WriteFixed<unsigned int>(dest, index); // literal
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitDeleteBuffers(GLsizei n, const GLuint *buffers)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(GLuint) * (n + 2) + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<int>(dest, n);                                     // literal
+        dest = common::Write1DArray<unsigned int>(dest, n, (unsigned int *)buffers); // array
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlDeleteBuffersId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitBindSampler(GLuint unit, GLuint sampler)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLuint) * 2 + 4);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlBindSamplerId);
+        dest = common::WriteFixed<unsigned int>(dest, unit);
+        dest = common::WriteFixed<unsigned int>(dest, sampler);
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitSwapBuffers(GLint dpy, GLint surface)
+    {
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(GLint) * 3 + 4);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mEglSwapBuffers);
+        dest = common::WriteFixed<GLint>(dest, dpy);  // dpy
+        dest = common::WriteFixed<GLint>(dest, surface);   // eglSurface
+        dest = common::WriteFixed<int>(dest, 1); //result
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+    void emitMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access, GLvoid *result)
+    {
+        DBG_LOG("emitMapBufferRange\n");
+        mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int)*3 + sizeof(unsigned int)*3 + 32);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest += sizeof(common::BCall_vlen);
+        dest = common::WriteFixed<int>(dest, target); // enum
+        dest = common::WriteFixed<int>(dest, offset); // literal
+        dest = common::WriteFixed<int>(dest, length); // literal
+        dest = common::WriteFixed<unsigned int>(dest, access); // literal
+        dest = common::WriteFixed<unsigned int>(dest, common::Opaque_Type_TM::BufferObjectReferenceType); // IS Simple Memory Offset
+        dest = common::WriteFixed<unsigned int>(dest, (uintptr_t)result);
+
+        int toNext = dest - bufStart;
+        writeBCall_vlen(bufStart, mGlMapBufferRangeId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    void emitUnmapBuffer(GLenum target)
+    {
+        DBG_LOG("emitUnmapBuffer\n");
+        mScratchBuff.resizeToFit(sizeof(common::BCall) + sizeof(unsigned int) + sizeof(unsigned char) + 4);
+
+        char *const bufStart = mScratchBuff.bufferPtr();
+        char *dest = bufStart;
+
+        dest = writeBCall(dest, mGlUnmapBufferId);
+        dest = common::WriteFixed<int>(dest, target); // enum
+        dest = common::WriteFixed<unsigned char>(dest, 1); // result
+
+        mOutFile.Write(bufStart, dest - bufStart);
+    }
+
+private:
+    ScratchBuffer mScratchBuff;
+    common::OutFile& mOutFile;
+    int mThreadId;
+    PayloadPool* mPool;
+    int mGlGenBuffersId;
+    int mGlDeleteBuffersId;
+    int mGlBufferDataId;
+    int mGlBufferSubDataId;
+    int mGlBindBufferId;
+    int mGlMapBufferRangeId;
+    int mGlUnmapBufferId;
+    int mGlBindVertexArrayId;
+    int mGlVertexAttribPointerId;
+    int mGlVertexAttribIPointerId;
+    int mGlEnableVertexAttribArrayId;
+    int mGlDisableVertexAttribArrayId;
+    int mGlBindFramebufferId;
+    int mGlGenTexturesId;
+    int mGlDeleteTexturesId;
+    int mGlTexImage2DId;
+    int mGlTexSubImage2DId;
+    int mGlTexSubImage3DId;
+    int mGlActiveTextureId;
+    int mGlBindTextureId;
+    int mGlTexParameteriId;
+    int mGlTexParameterfId;
+    int mGlPixelStoreiId;
+    int mGlCreateShaderId;
+    int mGlShaderSourceId;
+    int mGlCompileShaderId;
+    int mGlCreateProgramId;
+    int mGlAttachSahderId;
+    int mGlLinkProgramId;
+    int mGlUseProgramId;
+    int mGlDeleteShaderId;
+    int mGlDeleteProgramId;
+    int mGlBindSamplerId;
+    int mGlEnable;
+    int mGlDisable;
+    int mGlClear;
+    int mGlClearColor;
+    int mGlViewportId;
+    int mGlColorMaskId;
+    int mGlDrawElements;
+    int mGlFrontFace;
+    int mEglSwapBuffers;
+    int mGlCreateClientSideBufferId;
+    int mGlDeleteClientSideBufferId;
+    int mGlClientSideBufferDataId;
+    int mGlCopyClientSideBufferId;
+    int mGlCopyBufferSubDataId;
+
+    // Writes a glTexSubImage call with the texels in client-side buffer csb, or in data if csb is 0
+    void writeTexSubImage(TexDimension dimension, GLenum target, GLint level,
+                          GLint xoffset, GLint yoffset, GLint zoffset,
+                          GLsizei width, GLsizei height, GLsizei depth,
+                          GLenum format, GLenum type, unsigned int textureSize, const char* data, unsigned csb)
+    {
+        if (dimension == Tex2D)
+            mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 9 + textureSize + 32);
+        else if (dimension == Tex3D)
+            mScratchBuff.resizeToFit(sizeof(common::BCall_vlen) + sizeof(int) * 11 + textureSize + 32);
+
+        char* const bufStart = mScratchBuff.bufferPtr();
+        char* dest = bufStart;
+
+        // Written last (need to know toNext)
+        dest += sizeof(common::BCall_vlen);
+
+        dest = common::WriteFixed<int>(dest, target); // enum target
+        dest = common::WriteFixed<int>(dest, level); // literal level
+        dest = common::WriteFixed<int>(dest, xoffset); // literal xoffset
+        dest = common::WriteFixed<int>(dest, yoffset); // literal yoffset
+        if (dimension == Tex3D)
+            dest = common::WriteFixed<int>(dest, zoffset); // literal zoffset
+        dest = common::WriteFixed<unsigned int>(dest, width); // literal width
+        dest = common::WriteFixed<unsigned int>(dest, height); // literal height
+        if (dimension == Tex3D)
+            dest = common::WriteFixed<unsigned int>(dest, depth); // literal depth
+        dest = common::WriteFixed<int>(dest, format); // enum format
+        dest = common::WriteFixed<int>(dest, type); // enum type
+        if (csb)
+        {
+            dest = common::WriteFixed<unsigned int>(dest, common::ClientSideBufferObjectReferenceType);
+            dest = common::WriteFixed<unsigned int>(dest, csb);
+            dest = common::WriteFixed<unsigned int>(dest, 0); // offset
+        }
+        else
+        {
+            dest = common::WriteFixed<unsigned int>(dest, common::BlobType);
+            dest = common::Write1DArray<char>(dest, textureSize, data);
+        }
+
+        // NOTE: written to bufStart, not dest
+        int toNext = dest - bufStart;
+        if (dimension == Tex2D)
+            writeBCall_vlen(bufStart, mGlTexSubImage2DId, toNext);
+        else if (dimension == Tex3D)
+            writeBCall_vlen(bufStart, mGlTexSubImage3DId, toNext);
+
+        mOutFile.Write(bufStart, toNext);
+    }
+
+    // Runs of repeated bytes in buffers are looked for with this pattern size, which finds
+    // repeated bytes, shorts, ints and vec4s
+    static const size_t FILL_PERIOD = 16;
+    // Shorter runs are written out with the bytes around them
+    static const size_t FILL_MIN_SIZE = PayloadPool::MIN_SIZE;
+    // Bytes of a buffer run written out before doubling them, a multiple of FILL_PERIOD
+    static const size_t FILL_SEED_SIZE = 256;
+    // Size of the client-side buffers that restore bands of texture rows with a single texel value
+    static const size_t FILL_ROWS_SIZE = 64 * 1024;
+
+    // Restores a band of rows that all equal the row at data, from a client-side buffer holding
+    // as many copies of that row as fit in FILL_ROWS_SIZE
+    void emitFillRows(TexDimension dimension, GLenum target, GLint level, GLint yoffset, GLint zoffset,
+                      GLsizei width, GLsizei rows, GLsizei depth, GLenum format, GLenum type,
+                      size_t rowSize, const char* data)
+    {
+        const GLsizei step = std::min<GLsizei>(rows, std::max<size_t>(1, FILL_ROWS_SIZE / rowSize));
+        std::vector<char> fill(step * rowSize);
+        for (GLsizei i = 0; i < step; i++)
+        {
+            memcpy(fill.data() + i * rowSize, data, rowSize);
+        }
+        unsigned csb = 0;
+        if (mPool->share(mThreadId, fill.data(), fill.size(), csb) == PayloadPool::DEFINE)
+        {
+            emitCreateClientSideBuffer(csb);
+            emitClientSideBufferData(csb, fill.size(), fill.data());
+        }
+        mPool->countFill(rows * rowSize);
+        for (GLsizei y = 0; y < rows; y += step)
+        {
+            const GLsizei height = std::min(step, rows - y);
+            writeTexSubImage(dimension, target, level, 0, yoffset + y, zoffset, width, height, depth,
+                             format, type, height * rowSize, fill.data(), csb);
+        }
+    }
+
+    // Returns the client-side buffer to refer to for these contents, or 0 if they should be written out in full
+    unsigned clientSideBufferFor(const void* data, size_t size)
+    {
+        if (!mPool || size < PayloadPool::MIN_SIZE)
+        {
+            return 0;
+        }
+        unsigned name = 0;
+        switch (mPool->lookup(mThreadId, data, size, name))
+        {
+        case PayloadPool::NEW:
+            return 0;
+        case PayloadPool::DEFINE:
+            emitCreateClientSideBuffer(name);
+            emitClientSideBufferData(name, size, data);
+            return name;
+        case PayloadPool::REUSE:
+            return name;
+        }
+        return 0;
+    }
+
+    int getId(const char* name)
+    {
+        int id = common::gApiInfo.NameToId(name);
+
+        if (id == 0)
+        {
+            DBG_LOG("Error: couldn't get sigbook-id for function %s", name);
+            os::abort();
+        }
+
+        return id;
+    }
+
+    char* writeBCall(char* dest, int funcId)
+    {
+        common::BCall bcall;
+        bcall.funcId = funcId;
+        bcall.tid = mThreadId;
+        bcall.reserved = 0;
+        bcall.errNo = 0;
+        bcall.source = 1;
+
+        unsigned int bcallSize = sizeof(bcall);
+        memcpy(dest, &bcall, bcallSize);
+
+        return dest + bcallSize;
+    }
+
+    char* writeBCall_vlen(char* dest, int funcId, int toNext)
+    {
+        common::BCall_vlen bcv;
+        bcv.funcId = funcId;
+        bcv.tid = mThreadId;
+        bcv.reserved = 0;
+        bcv.errNo = 0;
+        bcv.toNext = toNext;
+        bcv.source = 1;
+
+        unsigned int bcallSize = sizeof(bcv);
+        memcpy(dest, &bcv, bcallSize);
+
+        return dest + bcallSize;
+    }
+};
+
+}
+
+#endif
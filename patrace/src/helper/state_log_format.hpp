@@ -0,0 +1,112 @@
+#ifndef STATE_LOG_FORMAT_HPP
+#define STATE_LOG_FORMAT_HPP
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// Binary state log format. The file starts with a StateLogFileHeader and is
+// followed by a stream of StateLogRecords, each one immediately followed by
+// payloadSize bytes of payload.
+//
+// The first time a function id is seen a STATE_LOG_FUNCTION_NAME record is
+// written with the function name as payload, so that the log can be converted
+// back to text without knowing which API version produced it.
+// A STATE_LOG_FUNCTION record corresponds to one "@F:" line in the text log,
+// and a STATE_LOG_STATE record carries a chunk of the text log verbatim.
+//
+// Use the statelog_to_txt tool to convert to the text format.
+
+namespace statelog
+{
+
+const char MAGIC[4] = { 'P', 'A', 'S', 'L' };
+const uint32_t VERSION = 1;
+
+enum RecordType
+{
+    STATE_LOG_FUNCTION_NAME = 1,
+    STATE_LOG_FUNCTION = 2,
+    STATE_LOG_STATE = 3,
+};
+
+struct StateLogFileHeader
+{
+    char magic[4];
+    uint32_t version;
+};
+
+struct StateLogRecord
+{
+    uint8_t type;
+    uint8_t tid;
+    uint16_t funcId;
+    uint32_t payloadSize;
+    uint32_t count; // per thread call count of this function
+    uint32_t callNo;
+    uint32_t drawNo;
+    uint32_t frameNo;
+};
+
+static_assert(sizeof(StateLogFileHeader) == 8, "Unexpected state log header size");
+static_assert(sizeof(StateLogRecord) == 24, "Unexpected state log record size");
+
+inline bool readFully(FILE *fp, void *data, size_t size)
+{
+    return size == 0 || fread(data, size, 1, fp) == 1;
+}
+
+/// Writes a binary state log as the text log that the same calls give in text mode.
+/// Returns false and sets error if in is not a binary state log that can be read.
+inline bool convertToText(FILE *in, FILE *out, std::string& error)
+{
+    StateLogFileHeader header;
+    if (!readFully(in, &header, sizeof(header)) || memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0)
+    {
+        error = "Not a binary state log";
+        return false;
+    }
+    if (header.version > VERSION)
+    {
+        error = "Unsupported binary state log version " + std::to_string(header.version) + " (max supported is " + std::to_string(VERSION) + ")";
+        return false;
+    }
+
+    std::vector<std::string> names(UINT16_MAX + 1);
+    std::vector<char> payload;
+    StateLogRecord record;
+    while (readFully(in, &record, sizeof(record)))
+    {
+        payload.resize(record.payloadSize);
+        if (!readFully(in, payload.data(), payload.size()))
+        {
+            error = "Truncated binary state log";
+            return false;
+        }
+
+        switch (record.type)
+        {
+        case STATE_LOG_FUNCTION_NAME:
+            names[record.funcId].assign(payload.begin(), payload.end());
+            break;
+        case STATE_LOG_FUNCTION:
+            fprintf(out, "@F: [%u] %s %u call=%u draw=%u frame=%u\n", (unsigned)record.tid, names[record.funcId].c_str(),
+                    record.count, record.callNo, record.drawNo, record.frameNo);
+            break;
+        case STATE_LOG_STATE:
+            fwrite(payload.data(), 1, payload.size(), out);
+            break;
+        default:
+            error = "Unknown record type " + std::to_string((unsigned)record.type);
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef STATE_LOG_WRITER_HPP
+#define STATE_LOG_WRITER_HPP
+
+#include "helper/state_log_format.hpp"
+#include "common/os.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/// The file StateLogger writes, either as text or in the binary format of
+/// helper/state_log_format.hpp. Knows nothing about GL, so that both modes can
+/// be checked against each other without a context.
+class StateLogWriter
+{
+public:
+    StateLogWriter()
+        : mBinary(false)
+    {
+    }
+
+    ~StateLogWriter()
+    {
+        close();
+    }
+
+    /// Truncates the file. Returns false if it cannot be opened.
+    bool open(const std::string& fileName, bool binary)
+    {
+        close();
+        mBinary = binary;
+        if (!mBinary)
+        {
+            mLog.open(fileName.c_str(), std::ofstream::out | std::ofstream::trunc);
+            return mLog.is_open();
+        }
+        FILE* fp = fopen(fileName.c_str(), "wb");
+        if (!fp)
+        {
+            return false;
+        }
+        mBinaryWriter.reset(new BinaryWriter(fp));
+        statelog::StateLogFileHeader header;
+        memcpy(header.magic, statelog::MAGIC, sizeof(header.magic));
+        header.version = statelog::VERSION;
+        mBinaryWriter->append(&header, sizeof(header));
+        return true;
+    }
+
+    /// Waits for the binary log to be written
+    void close()
+    {
+        mBinaryWriter.reset();
+        if (mLog.is_open())
+        {
+            mLog.close();
+        }
+        mFunctionNameWritten.clear();
+    }
+
+    void flush()
+    {
+        if (mBinaryWriter)
+        {
+            mBinaryWriter->submit();
+        }
+        else
+        {
+            mLog.flush();
+        }
+    }
+
+    bool isOpen() const
+    {
+        return mBinaryWriter || mLog.is_open();
+    }
+
+    /// An "@F:" line, count is the per thread call count of the function
+    void function(unsigned char tid, unsigned short funcId, const char* functionName, unsigned count, unsigned callNo, unsigned drawNo, unsigned frameNo)
+    {
+        if (!mBinary)
+        {
+            mLog << "@F: [" << static_cast<int>(tid) << "] " << functionName << " " << count << " call=" << callNo << " draw=" << drawNo << " frame=" << frameNo << '\n';
+            return;
+        }
+
+        if (funcId >= mFunctionNameWritten.size())
+        {
+            mFunctionNameWritten.resize(funcId + 1, false);
+        }
+        if (!mFunctionNameWritten[funcId])
+        {
+            statelog::StateLogRecord record = {};
+            record.type = statelog::STATE_LOG_FUNCTION_NAME;
+            record.funcId = funcId;
+            record.payloadSize = strlen(functionName);
+            mBinaryWriter->append(&record, sizeof(record));
+            mBinaryWriter->append(functionName, record.payloadSize);
+            mFunctionNameWritten[funcId] = true;
+        }
+
+        statelog::StateLogRecord record;
+        record.type = statelog::STATE_LOG_FUNCTION;
+        record.tid = tid;
+        record.funcId = funcId;
+        record.payloadSize = 0;
+        record.count = count;
+        record.callNo = callNo;
+        record.drawNo = drawNo;
+        record.frameNo = frameNo;
+        mBinaryWriter->append(&record, sizeof(record));
+    }
+
+    /// Text of a state dump, which always follows an "@F:" line
+    void state(const std::string& text)
+    {
+        if (mBinary)
+        {
+            statelog::StateLogRecord record = {};
+            record.type = statelog::STATE_LOG_STATE;
+            record.payloadSize = text.size();
+            mBinaryWriter->append(&record, sizeof(record));
+            mBinaryWriter->append(text.data(), text.size());
+        }
+        else
+        {
+            mLog << text << std::flush;
+        }
+    }
+
+private:
+    /// Writes the binary state log from a background thread. Data is appended into
+    /// a fixed pool of blocks; the calling thread only blocks if the writer thread
+    /// falls behind by the whole pool.
+    class BinaryWriter
+    {
+    public:
+        BinaryWriter(FILE* fp)
+            : mFile(fp)
+            , mBlocks(NUM_BLOCKS)
+            , mDone(false)
+        {
+            for (auto& block : mBlocks)
+            {
+                block.reserve(BLOCK_SIZE);
+                mFree.push_back(&block);
+            }
+            mCurrent = mFree.front();
+            mFree.pop_front();
+            mThread = std::thread(&BinaryWriter::run, this);
+        }
+
+        ~BinaryWriter()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                if (!mCurrent->empty())
+                {
+                    mFull.push_back(mCurrent);
+                }
+                mDone = true;
+            }
+            mCond.notify_all();
+            mThread.join();
+            fclose(mFile);
+        }
+
+        void append(const void* data, size_t size)
+        {
+            const char* src = static_cast<const char*>(data);
+            while (size > 0)
+            {
+                const size_t n = std::min(size, BLOCK_SIZE - mCurrent->size());
+                mCurrent->insert(mCurrent->end(), src, src + n);
+                src += n;
+                size -= n;
+                if (mCurrent->size() == BLOCK_SIZE)
+                {
+                    submit();
+                }
+            }
+        }
+
+        void submit()
+        {
+            if (mCurrent->empty())
+            {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(mMutex);
+            mFull.push_back(mCurrent);
+            mCond.notify_all();
+            mCond.wait(lock, [this]{ return !mFree.empty(); });
+            mCurrent = mFree.front();
+            mFree.pop_front();
+        }
+
+    private:
+        static const size_t BLOCK_SIZE = 1024 * 1024;
+        static const size_t NUM_BLOCKS = 8;
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while (true)
+            {
+                mCond.wait(lock, [this]{ return mDone || !mFull.empty(); });
+                if (mFull.empty())
+                {
+                    break; // done, and everything written
+                }
+                std::vector<char>* block = mFull.front();
+                mFull.pop_front();
+                lock.unlock();
+                if (fwrite(block->data(), 1, block->size(), mFile) != block->size())
+                {
+                    DBG_LOG("Failed to write binary state log: %s\n", strerror(errno));
+                }
+                block->clear();
+                lock.lock();
+                mFree.push_back(block);
+                mCond.notify_all();
+            }
+            fflush(mFile);
+        }
+
+        FILE* mFile;
+        std::vector<std::vector<char>> mBlocks;
+        std::vector<char>* mCurrent;
+        std::deque<std::vector<char>*> mFree;
+        std::deque<std::vector<char>*> mFull;
+        std::mutex mMutex;
+        std::condition_variable mCond;
+        bool mDone;
+        std::thread mThread;
+    };
+
+    bool mBinary;
+    std::ofstream mLog;
+    std::unique_ptr<BinaryWriter> mBinaryWriter;
+    // Function ids whose name has been written to the binary log
+    std::vector<bool> mFunctionNameWritten;
+};
+
+#endif
@@ -22,6 +22,9 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 
 /// Set this to >= 0 and a call range to only state log dump particular calls
 const long first_call = -1;
@@ -1191,56 +1194,76 @@ void memory(std::ostream& o, GLenum elementType, int realStride, int elementSize
 
 StateLogger::StateLogger()
     : mPerThreadCallCount(16)
-    , mLogOpen(false)
-    , mLog()
+    , mBinary(false)
 {
 }
 
-void StateLogger::open(const std::string& fileName)
+StateLogger::~StateLogger()
+{
+    close();
+}
+
+void StateLogger::open(const std::string& fileName, bool binary)
 {
     mFileName = fileName;
+    mBinary = binary;
 }
 
 void StateLogger::close()
 {
-    if (!mLogOpen)
+    if (!mWriter.isOpen())
     {
         return;
     }
-    mLog.close();
+    mWriter.close();
     for (auto it = mPerThreadCallCount.begin(); it != mPerThreadCallCount.end(); ++it)
     {
         it->clear();
     }
 }
 
+void StateLogger::flush()
+{
+    mWriter.flush();
+}
+
 void StateLogger::checkIfOpen()
 {
-    if (!mLogOpen) {
+    if (!mWriter.isOpen()) {
         DBG_LOG("State logging started. The state log file name is : %s\n", mFileName.c_str());
-        mLog.open(mFileName.c_str(), std::ofstream::out | std::ofstream::trunc);
-        mLogOpen = true;
+        if (!mWriter.open(mFileName, mBinary))
+        {
+            DBG_LOG("Failed to open %s: %s\n", mFileName.c_str(), strerror(errno));
+            os::abort();
+        }
     }
 }
 
-void StateLogger::logFunction(unsigned char tid, const std::string& functionName, unsigned callNo, unsigned drawNo)
+void StateLogger::write(const std::string& text)
+{
+    checkIfOpen();
+    mWriter.state(text);
+}
+
+void StateLogger::logFunction(unsigned char tid, unsigned short funcId, const char* functionName, unsigned callNo, unsigned drawNo)
 {
     if (!call_in_range())
     {
         return; // not the call we want
     }
 
-    FunctionCountMap_t& funcMap = mPerThreadCallCount[tid];
-    FunctionCountMap_t::iterator it = funcMap.find(functionName);
-
-    // If function not found
-    if (it == funcMap.end())
+    if (tid >= mPerThreadCallCount.size())
     {
-        funcMap[functionName] = 0;
+        mPerThreadCallCount.resize(tid + 1);
+    }
+    std::vector<unsigned>& funcCounts = mPerThreadCallCount[tid];
+    if (funcId >= funcCounts.size())
+    {
+        funcCounts.resize(funcId + 1, 0);
     }
 
-    int& callCount = funcMap[functionName];
-    int frameNo = frameNumber;
+    const unsigned callCount = funcCounts[funcId]++;
+    unsigned frameNo = frameNumber;
 
     if (!PRINT_CALLNO) // creates noise for retracer <-> tracer state comparisons
     {
@@ -1250,7 +1273,7 @@ void StateLogger::logFunction(unsigned char tid, const std::string& functionName
     }
 
     checkIfOpen();
-    mLog << "@F: [" << static_cast<int>(tid) << "] " << functionName << " " << callCount++ << " call=" << callNo << " draw=" << drawNo << " frame=" << frameNo << std::endl;
+    mWriter.function(tid, funcId, functionName, callCount, callNo, drawNo, frameNo);
 }
 
 void StateLogger::_logState(std::stringstream& ss, unsigned char tid, GLsizei instancecount, const IndexList_t& indices, uint64_t flags)
@@ -1576,8 +1599,7 @@ void StateLogger::_logState(std::stringstream& ss, unsigned char tid, GLsizei in
     }
 #endif
     // Write to log file
-    checkIfOpen();
-    mLog << ss.str() << std::flush;
+    write(ss.str());
 }
 
 void StateLogger::logState(unsigned char tid, GLint first, GLsizei count, GLsizei instancecount)
@@ -1714,8 +1736,7 @@ void StateLogger::logCompute(unsigned char tid, GLuint x, GLuint y, GLuint z)
     dumpGenericBufferInfo(tid, GL_ATOMIC_COUNTER_BUFFER, program, acb_active, ss, "AT");
 
     // Write to log file
-    checkIfOpen();
-    mLog << ss.str() << std::flush;
+    write(ss.str());
 }
 
 void StateLogger::logState(unsigned char tid, GLsizei count, GLenum indexType, const GLvoid* indices, GLsizei instancecount)
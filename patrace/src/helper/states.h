@@ -2,12 +2,14 @@
 #define STATES_H
 #include "dispatch/eglimports.hpp"
 #include "dispatch/eglproc_auto.hpp"
+#include "helper/state_log_writer.hpp"
 
 #include <ostream>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -22,8 +24,6 @@ namespace Json
 /// ugly global for higher performance
 extern bool stateLoggingEnabled;
 
-typedef std::map<std::string, int> FunctionCountMap_t;
-
 const char* bufferName(GLenum target);
 GLint getBoundBuffer(GLenum target);
 GLint getCurrentProgram();
@@ -36,7 +36,8 @@ class StateLogger
 {
 public:
     StateLogger();
-    void logFunction(unsigned char tid, const std::string& functionName, unsigned callNo, unsigned drawNo);
+    ~StateLogger();
+    void logFunction(unsigned char tid, unsigned short funcId, const char* functionName, unsigned callNo, unsigned drawNo);
     void logState(unsigned char tid, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instancecount);
     void logState(unsigned char tid, GLint first, GLsizei count, GLsizei instancecount);
     void logState(unsigned char tid);
@@ -44,18 +45,22 @@ public:
     void logDrawArraysIndirect(unsigned char tid, const void *indirect, int count);
     void logComputeIndirect(unsigned char tid, GLintptr offset);
     void logCompute(unsigned char tid, GLuint x, GLuint y, GLuint z);
-    void open(const std::string& fileName);
+    /// If binary is set, the log is written in the format described in
+    /// helper/state_log_format.hpp by a background thread. Convert it to
+    /// text with the statelog_to_txt tool.
+    void open(const std::string& fileName, bool binary = false);
     void close();
-    void flush() { mLog.flush(); }
+    void flush();
 
 private:
     void checkIfOpen();
+    void write(const std::string& text);
     void _logState(std::stringstream& ss, unsigned char tid, GLsizei instancecount, const IndexList_t& indices, uint64_t flags);
-    // Function call count
-    std::vector<FunctionCountMap_t> mPerThreadCallCount;
-    bool mLogOpen;
+    // Function call count, per thread and indexed by function id
+    std::vector<std::vector<unsigned>> mPerThreadCallCount;
+    bool mBinary;
     std::string mFileName;
-    std::ofstream mLog;
+    StateLogWriter mWriter;
 };
 
 struct VertexArrayInfo
@@ -0,0 +1,65 @@
+#ifndef _RETRACER_FRAME_PACER_HPP_
+#define _RETRACER_FRAME_PACER_HPP_
+
+#include <stdint.h>
+
+namespace retracer {
+
+/// Paces replay by the paTimestamp calls of a trace (-pace), so that frames are presented
+/// at the times they were presented while tracing, instead of as fast as possible.
+///
+/// Frames are scheduled relative to the first paced frame, so that the time lost to sleeps
+/// that run late is made up by the next frames. When replay falls behind the schedule by
+/// more than maxLag, for instance in a frame that compiles shaders which were compiled
+/// before tracing started, the schedule starts over from that frame instead of letting the
+/// following frames run as fast as possible to catch up.
+class FramePacer
+{
+public:
+    explicit FramePacer(int64_t maxLag = 100000000) : mMaxLag(maxLag) {}
+
+    /// Called after the swap of every frame, with the trace timestamp of the swap and the
+    /// current replay time, both in nanoseconds. Returns the nanoseconds to wait before
+    /// the next frame.
+    int64_t frameDone(uint64_t traceTime, int64_t replayTime)
+    {
+        if (!mStarted || traceTime <= mLastTraceTime)
+        {
+            // First frame, a frame without a timestamp of its own, or the trace looped
+            restart(traceTime, replayTime);
+            return 0;
+        }
+        mLastTraceTime = traceTime;
+        const int64_t wait = mReplayStart + (int64_t)(traceTime - mTraceStart) - replayTime;
+        if (wait < -mMaxLag)
+        {
+            mResyncs++;
+            restart(traceTime, replayTime);
+            return 0;
+        }
+        return (wait > 0) ? wait : 0;
+    }
+
+    /// Number of times replay fell too far behind and the schedule started over
+    unsigned resyncs() const { return mResyncs; }
+
+private:
+    void restart(uint64_t traceTime, int64_t replayTime)
+    {
+        mStarted = true;
+        mTraceStart = traceTime;
+        mLastTraceTime = traceTime;
+        mReplayStart = replayTime;
+    }
+
+    int64_t mMaxLag;
+    bool mStarted = false;
+    uint64_t mTraceStart = 0;
+    uint64_t mLastTraceTime = 0;
+    int64_t mReplayStart = 0;
+    unsigned mResyncs = 0;
+};
+
+}
+
+#endif
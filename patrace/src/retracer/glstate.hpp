@@ -8,13 +8,15 @@
 // Forward declarations
 namespace image {
     class Image;
+    struct PngOptions;
 }
 struct Texture;
 
 namespace glstate {
 
 image::Image* getDrawBufferImage(int attachment=0, int _width=0, int _height=0, GLenum format=GL_RGBA, GLenum type=GL_UNSIGNED_BYTE, int bytes_per_pixel=4, int channel = 4);
-std::vector<std::string> dumpTexture(Texture& tex, unsigned int callNo, GLfloat* vertices, int face=-1, GLuint* cm_indices=0); // face=-1 if not cube map
+// face=-1 if not cube map, png=0 writes with image::defaultPngOptions()
+std::vector<std::string> dumpTexture(Texture& tex, unsigned int callNo, GLfloat* vertices, int face=-1, GLuint* cm_indices=0, const image::PngOptions* png=0);
 GLint getMaxColorAttachments();
 GLint getMaxDrawBuffers();
 GLint getColorAttachment(GLint drawBuffer);
@@ -441,7 +441,7 @@ image::Image* getDrawBufferImage(int attachment, int _width, int _height, GLenum
     return image;
 }
 
-std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfloat* vertices, int face, GLuint* cm_indices)
+std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfloat* vertices, int face, GLuint* cm_indices, const image::PngOptions* png)
 {
     // Using a simple frag shader, dump the attached texture
 #define STRINGIZE(x) #x
@@ -829,7 +829,7 @@ std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfl
             fileName << "cube_" << cube_faces[face] << ".png";
             bytes_per_pixel = 4;
             image = getDrawBufferImage(GL_COLOR_ATTACHMENT0, texture.width, texture.height, pixel_format, out_type, bytes_per_pixel);
-            image->writePNG(fileName.str().c_str());
+            image->writePNG(fileName.str().c_str(), png ? *png : image::defaultPngOptions());
         }
 
         delete image;
@@ -877,7 +877,7 @@ std::vector<std::string> dumpTexture(Texture& texture, unsigned int callNo, GLfl
                 fileName << ".png";
                 bytes_per_pixel = 4;
                 image = getDrawBufferImage(GL_COLOR_ATTACHMENT0, texture.width, texture.height, pixel_format, out_type, bytes_per_pixel);
-                image->writePNG(fileName.str().c_str());
+                image->writePNG(fileName.str().c_str(), png ? *png : image::defaultPngOptions());
             }
 
             delete image;
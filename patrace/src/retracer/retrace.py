@@ -831,7 +831,7 @@ class Retracer(object):
             print('    gRetracer.IncCurDrawId();')
         if is_draw_array or is_draw_elements or func.name in stdapi.dispatch_compute_names:
             print('    if (unlikely(stateLoggingEnabled)) {')
-            print('        gRetracer.getStateLogger().logFunction(gRetracer.getCurTid(), "' + func.name + '", gRetracer.GetCurCallId(), gRetracer.GetCurDrawId());')
+            print('        gRetracer.getStateLogger().logFunction(gRetracer.getCurTid(), %d, "%s", gRetracer.GetCurCallId(), gRetracer.GetCurDrawId());' % (func.id, func.name))
             instance_count = 'instancecount' if func.name in stdapi.draw_instanced_function_names else '0'
         if func.name == 'glDrawElementsIndirect':
             print('        gRetracer.getStateLogger().logDrawElementsIndirect(gRetracer.getCurTid(), type, indirect, 1);')
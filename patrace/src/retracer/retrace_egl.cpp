@@ -844,9 +844,9 @@ PUBLIC void retrace_eglMakeCurrent(char* src)
             MD5Digest version_md5(version);
             std::string version_md5_str = version_md5.text();
 
-            if (gRetracer.shaderCacheVersionMD5.size() == 0)
-                gRetracer.shaderCacheVersionMD5 = version_md5_str;
-            if (gRetracer.shaderCacheVersionMD5 != version_md5_str)
+            if (gRetracer.shaderCacheIndex.version.size() == 0)
+                gRetracer.shaderCacheIndex.version = version_md5_str;
+            if (gRetracer.shaderCacheIndex.version != version_md5_str)
                 gRetracer.reportAndAbort("Shader cache does not match current ddk version. Remove the existing one.");
 
             only_once_ever = false;
@@ -28,11 +28,15 @@ usage(const char *argv0) {
         "  -tid THREADID the function calls invoked by thread <THREADID> will be retraced\n"
         "  -s CALL_SET take snapshot for the calls in the specific call set. Please try to post process the captured snapshot with imagemagick to turn off alpha value if it shows black.\n"
         "  -snapshotprefix PREFIX Prepend this label to every snapshot. Useful for automation.\n"
+        "  -snapshotpng OPTIONS PNG encoding of snapshots, a comma separated list of level=0-9, filter=none|sub|up|avg|paeth|all, strategy=default|filtered|huffman|rle|fixed, threads=N (0 for all cores, the default), or the presets store, fast and small\n"
         "  -step use F1-F4 to step forward frame by frame, F5-F8 to step forward draw call by draw call (not supported on all platforms)\n"
         "  -ores W H override the resolution of the final onscreen rendering (FBOs used in earlier renderpasses are not affected!)\n"
         "  -msaa SAMPLES enable multi sample anti alias for the final framebuffer\n"
         "  -overrideMSAA SAMPLES override any existing MSAA setting for intermediate framebuffers with MSAA\n"
         "  -preload START STOP preload the trace file frames from START to STOP. START must be greater than zero.\n"
+        "  -preloadhugepages back the preloaded frames by huge pages\n"
+        "  -preloadlock lock the preloaded frames in memory\n"
+        "  -preloadcache save the preloaded frames next to the trace file and reuse them on the next run with the same frame range\n"
         "  -all run all calls even those with no side-effects. This is useful for CPU load measurements.\n"
         "  -framerange FRAME_START FRAME_END start fps timer at frame start (inclusive), stop timer and playback before frame end (exclusive).\n"
         "  -loop TIMES repeat the preloaded frames at least the given number of times\n"
@@ -48,6 +52,7 @@ usage(const char *argv0) {
         "  -singleframe Draw only one frame for each buffer swap (offscreen only)\n"
         "  -debug output debug messages\n"
         "  -debugfull output all of the current invoked gl functions, with callNo, frameNo and skipped or discarded information\n"
+        "  -statelogbinary Write state logs in binary format, convert them to text with statelog_to_txt\n"
         "  -infojson Dump the header of the trace file in json format, then exit\n"
         "  -callstats Used with -framerange to output call statistics to callstats.csv on disk, including the calling number and running time\n"
         "  -overrideEGL Red Green Blue Alpha Depth Stencil, example: overrideEGL 5 6 5 0 16 8, for 16 bit color and 16 bit depth and 8 bit stencil\n"
@@ -60,6 +65,8 @@ usage(const char *argv0) {
         "  -perfperapi Enable perf instrumentation per GLES API entrypoint\n"
         "  -perfperapiOutDir DIR Set output directory for perf per API instrumentation, defaults to ./perfperapi\n"
 #endif
+        "  -framebudget USECONDS Frame time budget used for the frame time statistics in the results, default 16667 (60 fps)\n"
+        "  -frametimescsv Add the time of every measured frame to the results, as CSV\n"
         "  -instrumentation-delay USECONDS Delay in microseconds that the retracer should sleep for after each present call in the measurement range.\n"
         "  -skipfence START-END,START-END... Skip some fence waits calls (eglClientWaitSync, eglWaitSync, eglClientWaitSyncKHR, eglWaitSyncKHR, glWaitSync, glClientWaitSync) when within any of the given (comma separated list of) ranges. All ranges include the start frame and the end frame,\n"
         "  -flush Before starting running the defined measurement range, make sure we flush all pending driver work\n"
@@ -82,6 +89,7 @@ usage(const char *argv0) {
         "  -singlesurface SURFACE Render all surfaces except the given one to pbuffer render targets instead\n"
         "  -flushonswap Call explicit flush before every call to swap the backbuffer\n"
         "  -fpslimit FPS Limit the fps of replaying\n"
+        "  -pace Replay frames with the timing they had when traced, needs a trace made with timestamping\n"
         "  -cpumask Set explicit CPU mask (written as a string of ones and zeroes)\n"
         "  -libEGL PATH Set path to libEGL.so\n"
         "  -libGLESv1 PATH Set path to libGLESv1_CM.so\n"
@@ -185,6 +193,8 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             mOptions.mPerfStop = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-fpslimit")) {
             mOptions.mFixedFps = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-pace")) {
+            mOptions.mPace = true;
         } else if (!strcmp(arg, "-perf")) {
             mOptions.mPerfStart = readValidValue(argv[++i]);
             mOptions.mPerfStop = readValidValue(argv[++i]);
@@ -204,6 +214,10 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             mOptions.mSnapshotFrameNames = true;
         } else if (!strcmp(arg, "-snapshotprefix")) {
             mOptions.mSnapshotPrefix = argv[++i];
+        } else if (!strcmp(arg, "-snapshotpng")) {
+            if (!image::parsePngOptions(argv[++i], mOptions.mSnapshotPng)) {
+                return false;
+            }
         } else if (!strcmp(arg, "-forceanisolevel")) {
             mOptions.mForceAnisotropicLevel = readValidValue(argv[++i]);
         } else if (!strcmp(arg, "-step")) {
@@ -227,6 +241,16 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             }
         } else if (!strcmp(arg, "-instrumentation-delay")) {
             mOptions.mInstrumentationDelay = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-framebudget")) {
+            mOptions.mFrameBudget = readValidValue(argv[++i]);
+        } else if (!strcmp(arg, "-frametimescsv")) {
+            mOptions.mFrameTimesCsv = true;
+        } else if (!strcmp(arg, "-preloadhugepages")) {
+            mOptions.mPreloadHugePages = true;
+        } else if (!strcmp(arg, "-preloadlock")) {
+            mOptions.mPreloadLock = true;
+        } else if (!strcmp(arg, "-preloadcache")) {
+            mOptions.mPreloadCache = true;
         } else if (!strcmp(arg, "-all")) {
             mOptions.mRunAll = true;
         } else if (!strcmp(arg, "-preload")) {
@@ -253,6 +277,8 @@ bool ParseCommandLine(int argc, char** argv, RetraceOptions& mOptions)
             mOptions.mDebug = 2;
         } else if (!strcmp(arg, "-statelog")) {
             mOptions.mStateLogging = true;
+        } else if (!strcmp(arg, "-statelogbinary")) {
+            mOptions.mStateLogBinary = true;
         } else if (!strcmp(arg, "-noscreen")) {
             mOptions.mPbufferRendering = true;
         } else if (!strcmp(arg, "-singlesurface")) {
@@ -4,6 +4,7 @@
 #include <vector>
 #include "retracer/eglconfiginfo.hpp"
 #include "common/trace_callset.hpp"
+#include "common/image.hpp"
 #include "json/writer.h"
 #include "json/reader.h"
 
@@ -26,7 +27,9 @@ struct RetraceOptions
           mOnscreenConfig(0, 0, 0, 0, 0, 0, -1, 0)
         , mOffscreenConfig(0, 0, 0, 0, 0, 0, -1, 0)
         , mOverrideConfig(-1, -1, -1, -1, -1, -1, -1, -1)
-    {}
+    {
+        mSnapshotPng.threads = 0;
+    }
 
     ~RetraceOptions()
     {
@@ -40,6 +43,9 @@ struct RetraceOptions
     bool                mDoOverrideWinSize = false;
     bool                mDoOverrideResolution = false;
     bool                mPreload = false;
+    bool                mPreloadHugePages = false;
+    bool                mPreloadLock = false;
+    bool                mPreloadCache = false;
     bool                mStepMode = false;
     // Only for ANGLE save blob cache use
     bool                mSaveBlobCache = false;
@@ -50,6 +56,7 @@ struct RetraceOptions
     int                 mLoopTimes = 0;
     int                 mLoopSeconds = 0;
     int                 mFixedFps = 0;
+    bool                mPace = false; // replay frames at the times of the paTimestamp calls of their swaps
 
     int                 mWindowWidth = 0;
     int                 mWindowHeight = 0;
@@ -60,10 +67,14 @@ struct RetraceOptions
 
     std::string         mSnapshotPrefix;
     common::CallSet*    mSnapshotCallSet = nullptr;
+    // Encoding of snapshots and framebuffer dumps. Large snapshots are compressed on all
+    // cores, to keep the time spent on the replay thread short.
+    image::PngOptions   mSnapshotPng;
     bool                mUploadSnapshots = false;
     bool                mFailOnShaderError = false;
     int                 mDebug = 0;
     bool                mStateLogging = false;
+    bool                mStateLogBinary = false;
 
     EglConfigInfo mOnscreenConfig;
     EglConfigInfo mOffscreenConfig;
@@ -140,6 +151,8 @@ struct RetraceOptions
     common::CallSet*    mScriptCallSet = nullptr;
     std::string         mPatchPath;
     unsigned int        mInstrumentationDelay = 0;
+    int                 mFrameBudget = 16667; // microseconds
+    bool                mFrameTimesCsv = false;
     bool                mSkipFence = false;
     std::vector<std::pair<unsigned int, unsigned int>> mSkipFenceRanges;
 private:
@@ -354,7 +354,14 @@ bool Retracer::OpenTraceFile(const char* filename)
     }
 
     mFileFormatVersion = mFile.getHeaderVersion();
-    mStateLogger.open(std::string(filename) + ".retracelog");
+    if (mOptions.mStateLogBinary)
+    {
+        mStateLogger.open(std::string(filename) + ".retracelog.bin", true);
+    }
+    else
+    {
+        mStateLogger.open(std::string(filename) + ".retracelog");
+    }
     loadRetraceOptionsFromHeader();
     mFinish.store(false);
 
@@ -448,6 +455,8 @@ void Retracer::loadRetraceOptionsFromHeader()
     if (mOptions.mMultiThread) DBG_LOG("Enabling multiple thread option\n");
     if (jsHeader.isMember("translucentSurface")) mOptions.mTranslucentSurface = jsHeader.get("translucentSurface", false).asBool();
     if (jsHeader.get("translucentSurface", false).asBool()) DBG_LOG("Enabling translucentSurface option from Json header\n");
+    Context::denseObjectIds = jsHeader.get("denseObjectIds", false).asBool();
+    if (Context::denseObjectIds) DBG_LOG("Object names are densified, using array lookups only\n");
     if (jsHeader.isMember("skipfence")) {
         std::vector<std::pair<unsigned int, unsigned int>> ranges;
         for (const auto& ranges_itr : jsHeader["skipfence"])
@@ -654,7 +663,7 @@ void Retracer::StepShot(unsigned int callNo, unsigned int frameNo, const char *f
 #endif
                 filenameToBeUsed = ss.str();
 
-                if (src->writePNG(filenameToBeUsed.c_str()))
+                if (src->writePNG(filenameToBeUsed.c_str(), mOptions.mSnapshotPng))
                 {
                     DBG_LOG("Dump bound framebuffer to %s\n", filenameToBeUsed.c_str());
                 }
@@ -745,7 +754,7 @@ void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const cha
                 filenameToBeUsed = ss.str();
             }
 
-            if (src->writePNG(filenameToBeUsed.c_str()))
+            if (src->writePNG(filenameToBeUsed.c_str(), mOptions.mSnapshotPng))
             {
                 DBG_LOG("Snapshot (frame %d, call %d) : %s\n", frameNo, callNo, filenameToBeUsed.c_str());
 
@@ -809,7 +818,7 @@ void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const cha
             filenameToBeUsed = ss.str();
         }
 
-        if (src->writePNG(filenameToBeUsed.c_str()))
+        if (src->writePNG(filenameToBeUsed.c_str(), mOptions.mSnapshotPng))
         {
             DBG_LOG("Snapshot (frame %d, call %d) : %s\n", frameNo, callNo, filenameToBeUsed.c_str());
 
@@ -834,7 +843,7 @@ void Retracer::TakeSnapshot(unsigned int callNo, unsigned int frameNo, const cha
                             1.0f, 0.0f };
     for (std::vector<Texture>::iterator it = textures.begin(); it != textures.end(); ++it)
     {
-        dumpTexture(*it, callNo, &vertices[0]);
+        dumpTexture(*it, callNo, &vertices[0], -1, 0, &mOptions.mSnapshotPng);
     }
 
     dumpUniformBuffers(callNo);
@@ -1142,6 +1151,11 @@ void Retracer::RetraceThread(const int threadidx, const int our_tid)
             TakeSnapshot(mFile.curCallNo - 1, mCurFrameNo);
         }
 
+        if (mCurCall.funcId == mTimestampId && mOptions.mPace)
+        {
+            common::ReadFixed<uint64_t>(src, mLastTimestamp); // written in front of the call it belongs to
+        }
+
         if (fptr)
         {
             r.total++;
@@ -1334,6 +1348,7 @@ void Retracer::Retrace()
             DeleteShaderCacheFile();
     }
 
+    mFile.setPreloadOptions(mOptions.mPreloadHugePages, mOptions.mPreloadLock, mOptions.mPreloadCache);
     mFile.setFrameRange(mOptions.mBeginMeasureFrame, mOptions.mEndMeasureFrame, mOptions.mMultiThread ? -1 : mOptions.mRetraceTid, mOptions.mPreload, mOptions.mLoopTimes != 0);
 
     mInitTime = os::getTime();
@@ -1361,6 +1376,17 @@ void Retracer::Retrace()
     syncvals[mFile.NameToExId("eglWaitSyncKHR")] = true;
     syncvals[mFile.NameToExId("glWaitSync")] = true;
     syncvals[mFile.NameToExId("glClientWaitSync")] = true;
+    mTimestampId = mFile.NameToExId("paTimestamp");
+    if (mOptions.mPace && !mFile.getJSONHeader().get("timestamping", false).asBool())
+    {
+        DBG_LOG("Trace was made without timestamping, replaying without pacing\n");
+        mOptions.mPace = false;
+    }
+    else if (mOptions.mPace && mOptions.mFixedFps != 0)
+    {
+        DBG_LOG("Pacing by the trace timestamps, ignoring the fps limit\n");
+        mOptions.mFixedFps = 0;
+    }
 
     if (mOptions.mScriptCallSet && mOptions.mScriptCallSet->contains(0, "eglSwapBuffers") && mOptions.mScriptPath.size() > 0)
     {
@@ -1400,6 +1426,11 @@ void Retracer::Retrace()
     }
 
     // When we get here, we're all done
+    if (shaderCacheIndex.migrated())
+    {
+        SaveShaderCacheIndex(); // store the programs found by their old keys under the new ones
+    }
+
     if (mOptions.mForceOffscreen)
     {
         forceRenderMosaicToScreen();
@@ -1464,12 +1495,27 @@ void Retracer::StartMeasuring()
         mHWCPipeHandler->hwcpipe_init(mOptions.mPerfmonOut);
     }
     mRollbackCallNo = mFile.curCallNo;
+    mFrameTimes.reserve(frameTimesCapacity());
     DBG_LOG("================== Start timer (Frame: %u) ==================\n", mCurFrameNo);
     mTimerBeginTime = mLoopBeginTime = os::getTime();
     mTimerBeginTimeMono = os::getTimeType(CLOCK_MONOTONIC);
     mTimerBeginTimeMonoRaw = os::getTimeType(CLOCK_MONOTONIC_RAW);
     mTimerBeginTimeBoot = os::getTimeType(CLOCK_BOOTTIME);
     mEndFrameTime = mTimerBeginTime;
+    mFrameTimes.begin(mTimerBeginTime);
+}
+
+size_t Retracer::frameTimesCapacity() const
+{
+    // Enough for the whole measured range and all loops, but never more than 8MB of timestamps.
+    // When looping for a given time the number of loops is unknown, so use the upper limit then.
+    const size_t maxFrames = 1024 * 1024;
+    if (mOptions.mLoopSeconds > 0 || mOptions.mEndMeasureFrame == INT32_MAX)
+    {
+        return maxFrames;
+    }
+    const size_t frames = (size_t)(mOptions.mEndMeasureFrame - mOptions.mBeginMeasureFrame) * (std::max(0, mOptions.mLoopTimes) + 1);
+    return std::min(frames, maxFrames);
 }
 
 void Retracer::SaveBuffersMaps()
@@ -1480,6 +1526,7 @@ void Retracer::SaveBuffersMaps()
         mBufferMapCheckpoint.insert(pair.first);
     }
 
+    // Client-side buffers share their memory with the checkpoint until modified
     mCSBCheckpoint = mCSBuffers;
 }
 
@@ -1532,6 +1579,7 @@ void Retracer::OnNewFrame()
         // Per frame measurement
         if (mCurFrameNo > mOptions.mBeginMeasureFrame && mCurFrameNo <= mOptions.mEndMeasureFrame)
         {
+            mFrameTimes.record(os::getTime());
             if (mOptions.mInstrumentationDelay > 0) {
                 usleep(mOptions.mInstrumentationDelay);
             }
@@ -1542,7 +1590,15 @@ void Retracer::OnNewFrame()
             if (mOptions.mPerfmon) mHWCPipeHandler->sample_counters();
 #endif
         }
-        if (mOptions.mFixedFps != 0) //Limited fps replay mode
+        if (mOptions.mPace) // replay with the frame timing of the trace
+        {
+            const int64_t wait = mFramePacer.frameDone(mLastTimestamp, os::getTimeType(CLOCK_MONOTONIC));
+            if (wait > 0)
+            {
+                usleep(wait / 1000);
+            }
+        }
+        else if (mOptions.mFixedFps != 0) //Limited fps replay mode
         {
             int64_t curr_time;
             double duration = getDuration(mFixedFpsOldTime, &curr_time);
@@ -1751,6 +1807,7 @@ void Retracer::saveResult(Json::Value& result)
 
     if(mTimerBeginTime != 0) {
         if (mLegacyTime < 0) DBG_LOG("FPS requird is too high! \n");
+        if (mFramePacer.resyncs() > 0) DBG_LOG("Replay fell behind the trace timing %u times\n", mFramePacer.resyncs());
         const float fps = ((double)numOfFrames * std::max(1, mLoopTimes)) / duration;
         const float loopDuration = getDuration(mLoopBeginTime, &endTime);
         const float loopFps = ((double)numOfFrames) / loopDuration;
@@ -1768,6 +1825,12 @@ void Retracer::saveResult(Json::Value& result)
 
     result["loopFPS"] = Json::arrayValue;
     for (const auto fps : mLoopResults) result["loopFPS"].append(fps);
+    result["frame_times"] = mFrameTimes.summary(os::timeFrequency, mOptions.mFrameBudget);
+    if (mFrameTimes.dropped() > 0) DBG_LOG("Frame times: storage full, %u frames not recorded\n", (unsigned)mFrameTimes.dropped());
+    if (mOptions.mFrameTimesCsv)
+    {
+        result["frame_times_csv"] = mFrameTimes.csv(os::timeFrequency, mOptions.mBeginMeasureFrame, mOptions.mEndMeasureFrame - mOptions.mBeginMeasureFrame);
+    }
     result["time"] = duration;
     result["frames"] = numOfFrames;
     result["init_time"] = ((double)mInitTime) / os::timeFrequency;
@@ -1854,6 +1917,7 @@ void Retracer::saveResult(Json::Value& result)
         reportAndAbort("Error writing result file!");
     }
     mLoopResults.clear();
+    mFrameTimes.clear();
     TraceExecutor::clearResult();
 
     if (mOptions.mDebug)
@@ -1977,7 +2041,12 @@ void post_glShaderSource(GLuint shader, GLuint originalShaderName, GLsizei count
             if (length) cat += std::string(string[i], length[i]);
             else cat += string[i];
         }
-        gRetracer.getCurrentContext().setShaderSource(shader, cat);
+        Context& context = gRetracer.getCurrentContext();
+        context.setShaderKey(shader, ShaderCacheIndex::shaderKey(cat));
+        if (gRetracer.shaderCacheIndex.hasLegacyEntries())
+        {
+            context.setShaderSource(shader, cat); // to find programs by their old keys
+        }
     }
 }
 
@@ -2043,6 +2112,16 @@ void LoadCacheFromFile(std::map<std::vector<uint8_t>, std::vector<uint8_t>>& gAp
     }
 }
 
+void SaveShaderCacheIndex()
+{
+    const std::string ipath = gRetracer.mOptions.mShaderCacheFile + ".idx";
+    std::string error;
+    if (!gRetracer.shaderCacheIndex.save(ipath, error))
+    {
+        gRetracer.reportAndAbort("%s", error.c_str());
+    }
+}
+
 void OpenShaderCacheFile()
 {
         const std::string bpath = gRetracer.mOptions.mShaderCacheFile + ".bin";
@@ -2053,88 +2132,79 @@ void OpenShaderCacheFile()
         }
 
         const std::string ipath = gRetracer.mOptions.mShaderCacheFile + ".idx";
-        FILE *idx = fopen(ipath.c_str(), "rb");
-        if (idx)
+        std::string error;
+        if (!gRetracer.shaderCacheIndex.load(ipath, error))
         {
-            std::vector<char> ver_md5;
-            ver_md5.resize(MD5Digest::DIGEST_LEN * 2);
-            int r = fread(ver_md5.data(), ver_md5.size(), 1, idx);
-            if (r != 1)
+            gRetracer.reportAndAbort("%s", error.c_str());
+        }
+        for (const uint64_t offset : gRetracer.shaderCacheIndex.offsets())
+        {
+            GLenum binaryFormat = GL_NONE;
+            uint32_t size = 0;
+
+            if (fseek(gRetracer.shaderCacheFile, offset, SEEK_SET) != 0)
             {
-                gRetracer.reportAndAbort("Failed to read shader cache version: %s", ipath.c_str(), strerror(ferror(idx)));
+                gRetracer.reportAndAbort("Could not seek to desired cache item at %" PRIu64, offset);
             }
-            gRetracer.shaderCacheVersionMD5 = std::string(ver_md5.data(), ver_md5.size());
-
-            uint32_t size = 0;
-            r = fread(&size, sizeof(size), 1, idx);
-            if (r != 1)
+            if (fread(&binaryFormat, sizeof(binaryFormat), 1, gRetracer.shaderCacheFile) != 1 || fread(&size, sizeof(size), 1, gRetracer.shaderCacheFile) != 1)
             {
-                gRetracer.reportAndAbort("Failed to read shader cache index size: %s", ipath.c_str(), strerror(ferror(idx)));
+                gRetracer.reportAndAbort("Failed to read data from cache at %" PRIu64 ": %s", offset, strerror(ferror(gRetracer.shaderCacheFile)));
             }
-            for (unsigned i = 0; i < size; i++)
+            if (binaryFormat == GL_NONE || size == 0)
             {
-                std::vector<char> md5;
-                uint64_t offset = 0;
-                std::string md5_str;
-                md5.resize(MD5Digest::DIGEST_LEN * 2);
-                r = fread(md5.data(), md5.size(), 1, idx);
-                r += fread(&offset, sizeof(offset), 1, idx);
-                if (r != 2)
-                {
-                    gRetracer.reportAndAbort("Failed to read shader cache index: %s", ipath.c_str(), strerror(ferror(idx)));
-                }
-                md5_str = std::string(md5.data(), md5.size());
-                gRetracer.shaderCacheIndex[md5_str] = offset;
-
-                if (offset == UINT64_MAX) continue;  // skipped shadercacheIndex
-
-                GLenum binaryFormat = GL_NONE;
-                uint32_t size = 0;
-
-                if (fseek(gRetracer.shaderCacheFile, offset, SEEK_SET) != 0)
-                {
-                    gRetracer.reportAndAbort("Could not seek to desired cache item at %ld", offset);
-                }
-                if (fread(&binaryFormat, sizeof(binaryFormat), 1, gRetracer.shaderCacheFile) != 1 || fread(&size, sizeof(size), 1, gRetracer.shaderCacheFile) != 1)
-                {
-                    gRetracer.reportAndAbort("Failed to read data from cache at %ld as %s: %s", offset, md5_str.c_str(), strerror(ferror(gRetracer.shaderCacheFile)));
-                }
-                if (binaryFormat == GL_NONE || size == 0)
-                {
-                    gRetracer.reportAndAbort("Invalid cache metadata at %ld for %s", offset, md5_str.c_str());
-                }
+                gRetracer.reportAndAbort("Invalid cache metadata at %" PRIu64, offset);
+            }
 
-                gRetracer.shaderCache[md5_str].format = binaryFormat;
-                gRetracer.shaderCache[md5_str].buffer.resize(size);
-                if (fread(gRetracer.shaderCache[md5_str].buffer.data(), gRetracer.shaderCache[md5_str].buffer.size(), 1, gRetracer.shaderCacheFile) != 1)
-                {
-                    gRetracer.reportAndAbort("Failed to read %d bytes of data from cache as %s: %s", size, md5_str.c_str(), strerror(ferror(gRetracer.shaderCacheFile)));
-                }
+            Retracer::ProgramCache& cache = gRetracer.shaderCache[offset];
+            cache.format = binaryFormat;
+            cache.buffer.resize(size);
+            if (fread(cache.buffer.data(), cache.buffer.size(), 1, gRetracer.shaderCacheFile) != 1)
+            {
+                gRetracer.reportAndAbort("Failed to read %d bytes of data from cache at %" PRIu64 ": %s", size, offset, strerror(ferror(gRetracer.shaderCacheFile)));
             }
-            fclose(idx);
-            DBG_LOG("Found shader cache index file, loaded %d cache entries\n", (int)size);
+        }
+        if (gRetracer.shaderCacheIndex.size() > 0)
+        {
+            DBG_LOG("Found shader cache index file, loaded %d cache entries%s\n", (int)gRetracer.shaderCacheIndex.size(),
+                    gRetracer.shaderCacheIndex.hasLegacyEntries() ? " (old index format, will be updated)" : "");
         }
 }
 
-bool load_from_shadercache(GLuint program, GLuint originalProgramName, int status)
+// Key of a program in the shader cache, combined from the keys post_glShaderSource() made for its shaders
+static uint64_t shadercache_program_key(GLuint program)
 {
-    assert(gRetracer.mOptions.mShaderCacheLoad);
+    std::vector<uint64_t> keys;
+    for (const GLuint shader_id : gRetracer.getCurrentContext().getShaderIDs(program))
+    {
+        keys.push_back(gRetracer.getCurrentContext().getShaderKey(shader_id));
+    }
+    return ShaderCacheIndex::programKey(keys);
+}
 
-    // check this particular shader
+// Key of a program in index files of the old format, which needs all its sources
+static std::string shadercache_legacy_key(GLuint program)
+{
     std::vector<std::string> shaders;
     for (const GLuint shader_id : gRetracer.getCurrentContext().getShaderIDs(program))
     {
         shaders.push_back(gRetracer.getCurrentContext().getShaderSource(shader_id));
     }
+    return ShaderCacheIndex::legacyKey(shaders);
+}
 
-    MD5Digest cached_md5(shaders);
-    const std::string md5 = cached_md5.text();
-    if (gRetracer.shaderCacheIndex.count(md5) == 0)
+bool load_from_shadercache(GLuint program, GLuint originalProgramName, int status)
+{
+    assert(gRetracer.mOptions.mShaderCacheLoad);
+
+    // check this particular shader
+    const uint64_t key = shadercache_program_key(program);
+    uint64_t offset = 0;
+    if (!gRetracer.shaderCacheIndex.findOrMigrate(key, [program]() { return shadercache_legacy_key(program); }, offset))
     {
-        gRetracer.reportAndAbort("Could not find shader %s in cache!", md5.c_str());
+        gRetracer.reportAndAbort("Could not find shader %016" PRIx64 " in cache!", key);
     }
 
-    if (gRetracer.shaderCacheIndex[md5] == UINT64_MAX)
+    if (offset == ShaderCacheIndex::SKIPPED)
     {
         if (gRetracer.mOptions.mDebug)
         {
@@ -2142,29 +2212,27 @@ bool load_from_shadercache(GLuint program, GLuint originalProgramName, int statu
         }
         return false;
     }
+    const Retracer::ProgramCache& cache = gRetracer.shaderCache.at(offset);
     _glGetError(); // clear
-    _glProgramBinary(program, gRetracer.shaderCache[md5].format, gRetracer.shaderCache[md5].buffer.data(), gRetracer.shaderCache[md5].buffer.size());
+    _glProgramBinary(program, cache.format, cache.buffer.data(), cache.buffer.size());
     GLenum err = _glGetError();
     if (err != GL_NO_ERROR)
     {
-        gRetracer.reportAndAbort("Failed to upload shader %s from cache for program %u(retraceProgram %u)!", md5.c_str(), originalProgramName, program);
+        gRetracer.reportAndAbort("Failed to upload shader %016" PRIx64 " from cache for program %u(retraceProgram %u)!", key, originalProgramName, program);
     }
     if (gRetracer.mOptions.mDebug)
     {
-        DBG_LOG("Loaded program %u from cache as %s.\n", originalProgramName, md5.c_str());
+        DBG_LOG("Loaded program %u from cache as %016" PRIx64 ".\n", originalProgramName, key);
     }
     return true;
 }
 
 static void save_shadercache(GLuint program, GLuint originalProgramName, bool bSkipShadercache)
 {
-    std::vector<std::string> shaders;
-    for (const GLuint shader_id : gRetracer.getCurrentContext().getShaderIDs(program))
-    {
-        shaders.push_back(gRetracer.getCurrentContext().getShaderSource(shader_id));
-    }
-    MD5Digest cached_md5(shaders);
-    if (gRetracer.shaderCacheIndex.count(cached_md5.text()) == 0)
+    const uint64_t key = shadercache_program_key(program);
+    uint64_t cached = 0;
+    // Programs of an old index are already in the cache file, and only move to their new key
+    if (!gRetracer.shaderCacheIndex.findOrMigrate(key, [program]() { return shadercache_legacy_key(program); }, cached))
     {
         if (!bSkipShadercache)
         {
@@ -2188,41 +2256,18 @@ static void save_shadercache(GLuint program, GLuint originalProgramName, bool bS
             }
             fclose(fp);
 
-            gRetracer.shaderCacheIndex[cached_md5.text()] = offset;
+            gRetracer.shaderCacheIndex.add(key, offset);
             if (gRetracer.mOptions.mDebug)
             {
-                DBG_LOG("Saving program %u(retraceProgram %u) to shader cache as %s{.idx|.bin} with offset=%ld size=%ld md5=%s\n", originalProgramName, program, gRetracer.mOptions.mShaderCacheFile.c_str(), offset, (long)size, cached_md5.text().c_str());
+                DBG_LOG("Saving program %u(retraceProgram %u) to shader cache as %s{.idx|.bin} with offset=%ld size=%ld key=%016" PRIx64 "\n", originalProgramName, program, gRetracer.mOptions.mShaderCacheFile.c_str(), offset, (long)size, key);
             }
         }
         else
         {
-            gRetracer.shaderCacheIndex[cached_md5.text()] = UINT64_MAX;
+            gRetracer.shaderCacheIndex.add(key, ShaderCacheIndex::SKIPPED);
         }
         // Overwrite index on disk
-        const std::string ipath = gRetracer.mOptions.mShaderCacheFile + ".idx";
-        FILE *fp = fopen(ipath.c_str(), "wb");
-        if (!fp)
-        {
-            gRetracer.reportAndAbort("Failed to open index file %s for writing: %s", ipath.c_str(), strerror(errno));
-        }
-        if (fwrite(gRetracer.shaderCacheVersionMD5.c_str(), gRetracer.shaderCacheVersionMD5.size(), 1, fp ) != 1)
-        {
-            gRetracer.reportAndAbort("Failed to write ddk version MD5 (%s) to shader cache index: %s", gRetracer.shaderCacheVersionMD5.c_str(), strerror(ferror(fp)));
-        }
-
-        uint32_t entries = gRetracer.shaderCacheIndex.size();
-        if (fwrite(&entries, sizeof(entries), 1, fp) != 1)
-        {
-            gRetracer.reportAndAbort("Failed to write size of data to shader cache index: %s", strerror(ferror(fp)));
-        }
-        for (const auto &pair : gRetracer.shaderCacheIndex)
-        {
-            if (fwrite(pair.first.c_str(), pair.first.size(), 1, fp) != 1 || fwrite(&pair.second, sizeof(pair.second), 1, fp) != 1)
-            {
-                gRetracer.reportAndAbort("Failed to write data to shader cache index: %s", strerror(ferror(fp)));
-            }
-        }
-        fclose(fp);
+        SaveShaderCacheIndex();
     }
 }
 
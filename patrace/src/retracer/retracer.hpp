@@ -3,6 +3,8 @@
 
 #include "retracer/retrace_options.hpp"
 #include "retracer/state.hpp"
+#include "retracer/frame_pacer.hpp"
+#include "retracer/shader_cache_index.hpp"
 #include "retracer/texture.hpp"
 #include "helper/states.h"
 #include "graphic_buffer/GraphicBuffer.hpp"
@@ -13,6 +15,7 @@
 #include "common/os.hpp"
 #include "common/os_time.hpp"
 #include "common/memory.hpp"
+#include "common/frame_times.hpp"
 #ifndef _WIN32
 #include "common/memoryinfo.hpp"
 #endif
@@ -80,6 +83,7 @@ public:
     void OnFrameComplete();
     void OnNewFrame();
     void StartMeasuring();
+    size_t frameTimesCapacity() const;
     void SaveBuffersMaps();
     void LoadBuffersMaps();
 
@@ -141,9 +145,8 @@ public:
         std::vector<char> buffer;
     };
     FILE *shaderCacheFile = NULL;
-    std::string shaderCacheVersionMD5;
-    std::map<std::string, uint64_t> shaderCacheIndex; // md5 of shader source to offset of cache file
-    std::unordered_map<std::string, ProgramCache> shaderCache; // md5 of shader source to cache struct in mem
+    ShaderCacheIndex shaderCacheIndex;
+    std::unordered_map<uint64_t, ProgramCache> shaderCache; // offset in cache file to cache struct in mem
     int64_t frameBudget = INT64_MAX;
     int64_t drawBudget = INT64_MAX;
 
@@ -191,6 +194,10 @@ private:
     double mMaxDuration = 0;
     int64_t mFixedFpsOldTime = 0;
     double mLegacyTime = 0;
+    //For paced replay
+    FramePacer mFramePacer;
+    unsigned short mTimestampId = 0;
+    uint64_t mLastTimestamp = 0; // value of the last paTimestamp call
 
     StateLogger mStateLogger;
     common::HeaderVersion mFileFormatVersion = common::INVALID_VERSION;
@@ -200,6 +207,7 @@ private:
 
     int mLoopTimes = 0;
     std::vector<float> mLoopResults;
+    common::FrameTimes mFrameTimes;
     int64_t mLoopBeginTime = 0;
 
     unsigned mCurDrawNo = 0;
@@ -274,6 +282,7 @@ void post_glLinkProgram(GLuint shader, GLuint originalShaderName, int status);
 void post_glCompileShader(GLuint program, GLuint originalProgramName);
 void post_glShaderSource(GLuint shader, GLuint originalshaderName, GLsizei count, const GLchar **string, const GLint *length);
 void OpenShaderCacheFile();
+void SaveShaderCacheIndex();
 void DeleteShaderCacheFile();
 void SaveCacheToFile(std::map<std::vector<uint8_t>, std::vector<uint8_t>>& gApplicationCache);
 void LoadCacheFromFile(std::map<std::vector<uint8_t>, std::vector<uint8_t>>& gApplicationCache);
@@ -0,0 +1,203 @@
+#ifndef _RETRACER_SHADER_CACHE_INDEX_HPP_
+#define _RETRACER_SHADER_CACHE_INDEX_HPP_
+
+#include "common/content_hash.hpp"
+#include "common/memory.hpp"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace retracer {
+
+/// Index of the program binaries in a shader cache (the .idx file next to the .bin file
+/// of -savecache and -loadcache). Programs are found by a key combined from content hashes
+/// of their shaders, which are computed once per glShaderSource.
+///
+/// Index files from before were keyed by the MD5 of all the sources of a program. They are
+/// still read, and their entries move over to the new keys as programs are looked up.
+class ShaderCacheIndex
+{
+public:
+    /// Offset of programs that are not in the cache file because they failed to link
+    static const uint64_t SKIPPED = UINT64_MAX;
+
+    static uint64_t shaderKey(const std::string& source)
+    {
+        return common::ContentHash::hash(source);
+    }
+
+    /// Key of a program from the keys of its shaders, in the order they were attached
+    static uint64_t programKey(const std::vector<uint64_t>& shaderKeys)
+    {
+        uint64_t key = shaderKeys.size();
+        for (const uint64_t shaderKey : shaderKeys)
+        {
+            key = common::ContentHash::combine(key, shaderKey);
+        }
+        return key;
+    }
+
+    /// Key of a program in old index files
+    static std::string legacyKey(const std::vector<std::string>& sources)
+    {
+        return common::MD5Digest(sources).text();
+    }
+
+    /// Returns false and sets error if the file exists but cannot be read. A missing file
+    /// gives an empty index.
+    bool load(const std::string& path, std::string& error)
+    {
+        clear();
+        FILE *fp = fopen(path.c_str(), "rb");
+        if (!fp) return true;
+        const bool ok = read(fp);
+        if (!ok) error = "Failed to read shader cache index " + path;
+        fclose(fp);
+        return ok;
+    }
+
+    /// Writes the index in the current format, including entries of an old index that have not moved yet
+    bool save(const std::string& path, std::string& error)
+    {
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (!fp)
+        {
+            error = "Failed to open shader cache index " + path + " for writing: " + strerror(errno);
+            return false;
+        }
+        const uint32_t entries = mEntries.size();
+        const uint32_t legacyEntries = mLegacyEntries.size();
+        bool ok = fwrite(magic(), MAGIC_LEN, 1, fp) == 1 && writeVersion(fp) && fwrite(&entries, sizeof(entries), 1, fp) == 1;
+        for (auto it = mEntries.begin(); ok && it != mEntries.end(); ++it)
+        {
+            ok = fwrite(&it->first, sizeof(it->first), 1, fp) == 1 && fwrite(&it->second, sizeof(it->second), 1, fp) == 1;
+        }
+        ok = ok && fwrite(&legacyEntries, sizeof(legacyEntries), 1, fp) == 1;
+        for (auto it = mLegacyEntries.begin(); ok && it != mLegacyEntries.end(); ++it)
+        {
+            ok = fwrite(it->first.data(), it->first.size(), 1, fp) == 1 && fwrite(&it->second, sizeof(it->second), 1, fp) == 1;
+        }
+        if (!ok) error = "Failed to write shader cache index " + path + ": " + strerror(ferror(fp));
+        fclose(fp);
+        mMigrated = false;
+        return ok;
+    }
+
+    bool find(uint64_t key, uint64_t& offset) const
+    {
+        const auto it = mEntries.find(key);
+        if (it == mEntries.end()) return false;
+        offset = it->second;
+        return true;
+    }
+
+    /// Finds a program of an old index by its old key, and files it under the new key
+    bool migrate(uint64_t key, const std::string& legacy, uint64_t& offset)
+    {
+        const auto it = mLegacyEntries.find(legacy);
+        if (it == mLegacyEntries.end()) return false;
+        offset = it->second;
+        mEntries[key] = offset;
+        mLegacyEntries.erase(it);
+        mMigrated = true;
+        return true;
+    }
+
+    /// Finds a program by its key, or else by its old key, which is moved over to the new one.
+    /// legacy() makes the old key, and is only called if the index has old entries, since that
+    /// needs all the sources of the program.
+    template <class LegacyKey>
+    bool findOrMigrate(uint64_t key, LegacyKey legacy, uint64_t& offset)
+    {
+        return find(key, offset) || (hasLegacyEntries() && migrate(key, legacy(), offset));
+    }
+
+    void add(uint64_t key, uint64_t offset) { mEntries[key] = offset; }
+
+    /// Offsets of all cached programs in the cache file
+    std::vector<uint64_t> offsets() const
+    {
+        std::vector<uint64_t> result;
+        for (const auto& pair : mEntries) if (pair.second != SKIPPED) result.push_back(pair.second);
+        for (const auto& pair : mLegacyEntries) if (pair.second != SKIPPED) result.push_back(pair.second);
+        return result;
+    }
+
+    size_t size() const { return mEntries.size() + mLegacyEntries.size(); }
+    /// Whether some lookups need the old keys, and so the shader sources
+    bool hasLegacyEntries() const { return !mLegacyEntries.empty(); }
+    /// Whether entries moved to new keys since the index was loaded or saved
+    bool migrated() const { return mMigrated; }
+
+    void clear()
+    {
+        version.clear();
+        mEntries.clear();
+        mLegacyEntries.clear();
+        mMigrated = false;
+    }
+
+    /// MD5 text of the GL_VERSION string the cached binaries were made with
+    std::string version;
+
+private:
+    // Start of index files in the current format
+    static const char *magic() { return "PASCIDX2"; }
+    static const size_t MAGIC_LEN = 8;
+    static const size_t TEXT_LEN = common::MD5Digest::DIGEST_LEN * 2;
+
+    bool read(FILE *fp)
+    {
+        char start[MAGIC_LEN];
+        if (fread(start, MAGIC_LEN, 1, fp) != 1) return false;
+        const bool legacy = memcmp(start, magic(), MAGIC_LEN) != 0;
+        if (legacy)
+        {
+            // Old index files start with the version MD5 right away
+            rewind(fp);
+        }
+        if (!readText(fp, version)) return false;
+        uint32_t entries = 0;
+        if (fread(&entries, sizeof(entries), 1, fp) != 1) return false;
+        for (uint32_t i = 0; !legacy && i < entries; i++)
+        {
+            uint64_t key = 0;
+            uint64_t offset = 0;
+            if (fread(&key, sizeof(key), 1, fp) != 1 || fread(&offset, sizeof(offset), 1, fp) != 1) return false;
+            mEntries[key] = offset;
+        }
+        if (!legacy && fread(&entries, sizeof(entries), 1, fp) != 1) return false;
+        for (uint32_t i = 0; i < entries; i++)
+        {
+            std::string key;
+            uint64_t offset = 0;
+            if (!readText(fp, key) || fread(&offset, sizeof(offset), 1, fp) != 1) return false;
+            mLegacyEntries[key] = offset;
+        }
+        return true;
+    }
+
+    static bool readText(FILE *fp, std::string& text)
+    {
+        text.resize(TEXT_LEN);
+        return fread(&text[0], TEXT_LEN, 1, fp) == 1;
+    }
+
+    bool writeVersion(FILE *fp) const
+    {
+        return version.size() == TEXT_LEN && fwrite(version.data(), version.size(), 1, fp) == 1;
+    }
+
+    std::unordered_map<uint64_t, uint64_t> mEntries; // program key to offset in the cache file
+    std::unordered_map<std::string, uint64_t> mLegacyEntries; // MD5 of the program sources to offset
+    bool mMigrated = false;
+};
+
+}
+
+#endif
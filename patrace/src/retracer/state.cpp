@@ -27,6 +27,8 @@ void deleteUnique(std::unordered_map<K, V>& map)
     toBeDeleted.clear();
 }
 
+bool Context::denseObjectIds = false;
+
 StateMgr::StateMgr()
  : mThreadArr(PATRACE_THREAD_LIMIT)
  , mSingleSurface(0)
@@ -168,6 +168,21 @@ public:
         _feedback_map.LValue(0) = 0;
         _graphicbuffer_map.LValue(0) = 0;
 
+        if (denseObjectIds)
+        {
+            _texture_map.setDenseKeys();
+            _buffer_map.setDenseKeys();
+            _program_map.setDenseKeys();
+            _shader_map.setDenseKeys();
+            _renderbuffer_map.setDenseKeys();
+            _sampler_map.setDenseKeys();
+            _query_map.setDenseKeys();
+            _framebuffer_map.setDenseKeys();
+            _array_map.setDenseKeys();
+            _feedback_map.setDenseKeys();
+            _pipeline_map.setDenseKeys();
+        }
+
         if (shareContext != NULL)
         {
             shareContext->retain();
@@ -217,6 +232,10 @@ public:
 
     hmap<unsigned int>& getGraphicBufferMap();
 
+    // Set from the trace header when object names have been renumbered by the
+    // densify_ids tool. Only affects contexts created after it is set.
+    static bool denseObjectIds;
+
     Profile _profile;
 
     hmap<unsigned int> _list_map;
@@ -259,10 +278,24 @@ public:
         if (_shareContext) _shareContext->setShaderSource(shader, source);
         else mShaderSources[shader] = source;
     }
+    inline uint64_t getShaderKey(GLuint shader) const
+    {
+        if (_shareContext) return _shareContext->getShaderKey(shader);
+        else return mShaderKeys.at(shader);
+    }
+    inline void setShaderKey(GLuint shader, uint64_t key)
+    {
+        if (_shareContext) _shareContext->setShaderKey(shader, key);
+        else mShaderKeys[shader] = key;
+    }
     inline void deleteShader(GLuint shader)
     {
         if (_shareContext) _shareContext->deleteShader(shader);
-        else mShaderSources.erase(shader);
+        else
+        {
+            mShaderSources.erase(shader);
+            mShaderKeys.erase(shader);
+        }
     }
 
     inline const std::vector<GLuint>& getShaderIDs(GLuint program) const
@@ -284,6 +317,7 @@ public:
 private:
     Context* _shareContext;
     std::unordered_map<GLuint, std::string> mShaderSources; // shader id to string; shared
+    std::unordered_map<GLuint, uint64_t> mShaderKeys; // shader id to shader cache key of its source; shared
     std::unordered_map<GLuint, std::vector<GLuint>> mProgramShaders; // program id to list of shader ids; shared
     int refcnt;
     hmap<unsigned int> _texture_map; // shared
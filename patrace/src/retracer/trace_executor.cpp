@@ -55,6 +55,7 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     {
         options.mFixedFps = value["fpslimit"].asInt();
     }
+    options.mPace = value.get("pace", options.mPace).asBool();
 
     if (value.get("finishBeforeSwap", false).asBool())
     {
@@ -182,10 +183,17 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     options.mPerfEvent = value.get("perfevent", "").asString();
     options.mPerfCmd = value.get("perfcmd", "").asString();
     options.mPreload = value.get("preload", false).asBool();
+    options.mPreloadHugePages = value.get("preloadHugePages", false).asBool();
+    options.mPreloadLock = value.get("preloadLock", false).asBool();
+    options.mPreloadCache = value.get("preloadCache", false).asBool();
     options.mRunAll = value.get("runAllCalls", false).asBool();
 
     // Values needed by CLI and GUI
     options.mSnapshotPrefix = value.get("snapshotPrefix", "").asString();
+    if (value.isMember("snapshotPng") && !image::parsePngOptions(value.get("snapshotPng", "").asString(), options.mSnapshotPng))
+    {
+        gRetracer.reportAndAbort("Invalid snapshotPng: %s", value.get("snapshotPng", "").asString().c_str());
+    }
 
     if (options.mSnapshotPrefix.compare("*") == 0)
     {
@@ -223,6 +231,7 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
 
     options.mStateLogging = value.get("statelog", false).asBool();
     stateLoggingEnabled = value.get("drawlog", false).asBool();
+    options.mStateLogBinary = value.get("statelogBinary", false).asBool();
     options.mDebug = (int)value.get("debug", false).asBool();
     if (options.mDebug)
     {
@@ -354,6 +363,8 @@ void TraceExecutor::overrideDefaultsWithJson(Json::Value &value)
     if (value.isMember("loadBlobCache") && value.isMember("saveBlobCache")) gRetracer.reportAndAbort("loadBlobCache and saveBlobCache cannot be used at the same time in the JSON input!");
 
     options.mInstrumentationDelay = value.get("instrumentationDelay", 0).asUInt();
+    options.mFrameBudget = value.get("frameBudget", 16667).asInt();
+    options.mFrameTimesCsv = value.get("frameTimesCsv", false).asBool();
 
     if (value.isMember("skipfence"))
     {
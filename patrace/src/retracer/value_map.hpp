@@ -48,16 +48,19 @@ template <class T>
 class hmap {
 private:
     static const unsigned int KEY_LIMIT = 10*1024;
+    // limit with setDenseKeys(), which keeps the array at most 16M entries
+    static const unsigned int DENSE_KEY_LIMIT = 4*1024*1024;
     // map for small keys (< KEY_LIMIT)
     T *mpData;
     // map for large keys (>= KEY_LIMIT)
     std::unordered_map<T, T> mMap;
 
     unsigned int mSize;
+    unsigned int mKeyLimit;
     T mNull;
 
 public:
-    hmap():mpData(NULL), mSize(0)
+    hmap():mpData(NULL), mSize(0), mKeyLimit(KEY_LIMIT)
     {
         resize(128);
         mNull = 0;
@@ -68,6 +71,13 @@ public:
         delete [] mpData;
     }
 
+    // Keys are known to be compact (see the densify_ids tool), so keep them in the
+    // array up to a much larger limit. Larger keys still go to the map.
+    void setDenseKeys()
+    {
+        mKeyLimit = DENSE_KEY_LIMIT;
+    }
+
     std::unordered_map<T, T> GetCopy()
     {
         std::unordered_map<T, T> newMap = mMap;
@@ -85,7 +95,7 @@ public:
 
     inline T& LValue(const T& key)
     {
-        if (key < KEY_LIMIT) {
+        if (key < mKeyLimit) {
             if (((unsigned int)key) >= mSize)
                 resize(key);
             return mpData[key];
@@ -100,7 +110,7 @@ public:
 
     inline const T& RValue(const T& key) const
     {
-        if (key < KEY_LIMIT) {
+        if (key < mKeyLimit) {
             if (((unsigned int)key) >= mSize)
                 return mNull;
             return mpData[key];
@@ -122,7 +132,7 @@ public:
         if (sz < mSize)
             return;
 
-        int newSz = 1;
+        size_t newSz = 1;
         for (; sz ; sz>>=1, newSz<<=1)
             ;
 
@@ -141,7 +151,11 @@ public:
 // The logic in this map is specific for <attribute location> and <uniform location>.
 class locationmap {
 private:
+    static const unsigned int KEY_LIMIT = 64*1024;
+    // map for small keys (< KEY_LIMIT)
     int *mpData;
+    // map for large and negative keys, which some drivers return
+    std::unordered_map<int, int> mMap;
     unsigned int mSize;
 
 public:
@@ -156,6 +170,7 @@ public:
         mpData = new int[mSize];
         for (unsigned int i = 0; i < mSize; ++i)
             mpData[i] = b.mpData[i];
+        mMap = b.mMap;
     }
 
     ~locationmap()
@@ -171,22 +186,37 @@ public:
         mpData = new int[mSize];
         for (unsigned int i = 0; i < mSize; ++i)
             mpData[i] = b.mpData[i];
+        mMap = b.mMap;
 
         return *this;
     }
 
     inline int& LValue(const int& key)
     {
-        if (((unsigned int)key) >= mSize)
-            resize((unsigned int)key);
-        return mpData[key];
+        if (((unsigned int)key) < KEY_LIMIT) {
+            if (((unsigned int)key) >= mSize)
+                resize((unsigned int)key);
+            return mpData[key];
+        }
+        const auto it = mMap.find(key);
+        if (it == mMap.end())
+        {
+            return mMap.insert(std::pair<int, int>(key, key)).first->second;
+        }
+        return it->second;
     }
 
     inline const int& RValue(const int& key) const
     {
-        if (((unsigned int)key) >= mSize)
+        if (((unsigned int)key) < KEY_LIMIT) {
+            if (((unsigned int)key) >= mSize)
+                return key;
+            return mpData[key];
+        }
+        const auto it = mMap.find(key);
+        if (it == mMap.end())
             return key;
-        return mpData[key];
+        return it->second;
     }
 
     void resize(unsigned int sz)
@@ -194,7 +224,7 @@ public:
         if (sz < mSize)
             return;
 
-        int newSz = 1;
+        size_t newSz = 1;
         for (; sz ; sz>>=1, newSz<<=1)
             ;
 
@@ -203,7 +233,7 @@ public:
         int *newData = new int[newSz];
         if (mpData)
             memcpy(newData, mpData, mSize*sizeof(int));
-        for (int i = mSize; i < newSz; ++i)
+        for (size_t i = mSize; i < newSz; ++i)
             newData[i] = i;
         delete [] mpData;
         mpData = newData;
@@ -19,6 +19,7 @@
 #include <sys/types.h>
 
 #include "tool/parse_interface_retracing.hpp"
+#include "tool/timestamp_analysis.hpp"
 
 #include "json/writer.h"
 #include "common/in_file.hpp"
@@ -51,6 +52,7 @@ static std::map<int, double> heavinesses;
 static std::string iname;
 static int ipriority = -1;
 static bool write_usage = false;
+static std::string shader_cache_filename;
 
 /// Helper to prune empty lists from a JSON object
 static void prune(Json::Value& v)
@@ -233,6 +235,10 @@ static void printHelp()
         "  -iname <name> Pass this name to the result JSON\n"
         "  -iprio <p>    Pass this priority value to the result JSON\n"
         "  -txu          Write out a texture usage file that maps draw calls to textures used\n"
+        "  -sc <file>    Load shader analysis results from this file, and save them back when done\n"
+        "For traces made with timestamping, application CPU time per frame and per function, and the\n"
+        "idle gaps between frames, are added to the JSON and written to <basename>_frame_timing.csv\n"
+        "and <basename>_call_timing.csv.\n"
         "Options for per frame output:\n"
         "  -Z            Write out used shaders to disk\n"
         "  -j            Write out renderpass JSON data for selected frames\n"
@@ -463,6 +469,7 @@ public:
     int faceculled = 0;
     int indexed = 0;
     int calls = 0; // actually "executed" calls
+    TimestampAnalysis timing; // application CPU time from the paTimestamp calls
     long drawcalls = 0;
     std::vector<int> calls_per_frame;
     GLuint highestColorAttachment = 0;
@@ -605,6 +612,15 @@ static bool callback(ParseInterfaceBase& input, common::CallTM *call, void *cust
     }
     dumpstream << call->ToStr(false) << std::endl;
 
+    if (call->mCallName == "paTimestamp")
+    {
+        az->timing.timestamp(call->mArgs[0]->GetAsUInt64());
+    }
+    else
+    {
+        az->timing.call(call->mCallName, call->mCallName.compare(0, 14, "eglSwapBuffers") == 0);
+    }
+
     if (call->mCallName == "eglCreateWindowSurface" || call->mCallName == "eglCreateWindowSurface2"
         || call->mCallName == "eglCreatePbufferSurface" || call->mCallName == "eglCreatePixmapSurface")
     {
@@ -1551,6 +1567,11 @@ void AnalyzeTrace::analyze(ParseInterfaceBase& input)
     }
     // Dump out callstats CSV
     write_callstats(input, dump_csv_filename.empty() ? "trace" : dump_csv_filename);
+    // Application CPU time per frame and per function, for traces made with timestamping
+    if (!timing.empty())
+    {
+        timing.writeCSV(dump_csv_filename.empty() ? "trace" : dump_csv_filename);
+    }
 
     input.cleanup(); // last since this can crash sometimes
 }
@@ -1821,6 +1842,10 @@ Json::Value AnalyzeTrace::trace_json(ParseInterfaceBase& input)
         result["depthfuncs"].append(texEnum(pair.first));
     }
     result["gl_version"] = ((float)input.highest_gles_version) / 10.0;
+    if (!timing.empty())
+    {
+        result["timing"] = timing.json();
+    }
     for (const auto& c : input.contexts)
     {
         Json::Value v = json_base(c);
@@ -2057,6 +2082,14 @@ Json::Value AnalyzeTrace::trace_json(ParseInterfaceBase& input)
         v["count"] = s.second;
         result["shaders"].append(v);
     }
+    const GLSLCache::Stats& glsl_stats = input.glsl_cache.stats();
+    result["shader_analysis"] = Json::Value();
+    result["shader_analysis"]["lookups"] = glsl_stats.lookups;
+    result["shader_analysis"]["hits"] = glsl_stats.hits;
+    result["shader_analysis"]["hit_rate"] = glsl_stats.lookups ? (double)glsl_stats.hits / glsl_stats.lookups : 0.0;
+    result["shader_analysis"]["loaded"] = glsl_stats.loaded;
+    result["shader_analysis"]["analysis_ms"] = glsl_stats.analysis_ms;
+    result["shader_analysis"]["saved_ms"] = glsl_stats.saved_ms;
     addMapToJson(result, "texture_formats", tex_formats);
     addMapToJson(result, "texture_sizes", tex_sizes);
     addMapToJson(result, "texture_types", texturetypes);
@@ -2497,6 +2530,11 @@ int main(int argc, char **argv)
             dump_csv_filename = argv[argIndex + 1];
             argIndex++;
         }
+        else if (arg == "-sc" && argIndex + 1 < argc)
+        {
+            shader_cache_filename = argv[argIndex + 1];
+            argIndex++;
+        }
         else
         {
             std::cerr << "Error: Unknown option " << arg << std::endl;
@@ -2522,6 +2560,10 @@ int main(int argc, char **argv)
     inputFile.ff_startframe = startframe;
     inputFile.ff_endframe = lastframe;
     if (multithread) inputFile.forceMultithread();
+    if (!shader_cache_filename.empty())
+    {
+        inputFile.glsl_cache.load(shader_cache_filename);
+    }
     if (!inputFile.open(source_trace_filename))
     {
         std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
@@ -2530,5 +2572,9 @@ int main(int argc, char **argv)
     AnalyzeTrace antr;
     antr.analyze(inputFile);
     inputFile.close();
+    if (!shader_cache_filename.empty() && !inputFile.glsl_cache.save(shader_cache_filename))
+    {
+        std::cerr << "Failed to save shader analysis cache: " << shader_cache_filename << std::endl;
+    }
     return 0;
 }
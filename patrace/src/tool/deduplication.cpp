@@ -0,0 +1,771 @@
+#include <utility>
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <GLES3/gl31.h>
+#include <GLES3/gl32.h>
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#include <array>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include "tool/deduplication.hpp"
+#include "common/file_format.hpp"
+#include "common/raw_call_reader.hpp"
+#include "common/os.hpp"
+
+// What the deduplicator needs to know about a function, looked up by funcId
+enum DedupCall : unsigned char
+{
+    CALL_OTHER = 0,
+    CALL_USEPROGRAM,
+    CALL_MAKECURRENT,
+    CALL_BINDBUFFER,
+    CALL_VERTEXATTRIBDIVISOR,
+    CALL_ENABLEVERTEXATTRIB,
+    CALL_DISABLEVERTEXATTRIB,
+    CALL_ENABLE,
+    CALL_DISABLE,
+    CALL_SCISSOR,
+    CALL_DEPTHFUNC,
+    CALL_BLENDFUNC,
+    CALL_VERTEXATTRIBPOINTER,
+    CALL_BLENDCOLOR,
+    CALL_ACTIVETEXTURE,
+    CALL_BINDTEXTURE,
+    CALL_BINDSAMPLER,
+    CALL_UNIFORM1F,
+    CALL_UNIFORM1FV,
+    CALL_UNIFORM2F,
+    CALL_UNIFORM2FV,
+    CALL_UNIFORM3F,
+    CALL_UNIFORM3FV,
+    CALL_GETERROR,
+    CALL_SWAP,
+    CALL_MAPBUFFERRANGE,
+    CALL_FLUSHMAPPEDBUFFERRANGE,
+    CALL_COPYCLIENTSIDEBUFFER,
+    CALL_UNMAPBUFFER,
+    CALL_CLIENTSIDEBUFFERCHANGE,
+    CALL_RENDER,
+};
+
+static const std::pair<const char*, DedupCall> dedupCalls[] =
+{
+    { "glUseProgram", CALL_USEPROGRAM },
+    { "eglMakeCurrent", CALL_MAKECURRENT },
+    { "glBindBuffer", CALL_BINDBUFFER },
+    { "glVertexAttribDivisor", CALL_VERTEXATTRIBDIVISOR },
+    { "glEnableVertexAttribArray", CALL_ENABLEVERTEXATTRIB },
+    { "glDisableVertexAttribArray", CALL_DISABLEVERTEXATTRIB },
+    { "glEnable", CALL_ENABLE },
+    { "glDisable", CALL_DISABLE },
+    { "glScissor", CALL_SCISSOR },
+    { "glDepthFunc", CALL_DEPTHFUNC },
+    { "glBlendFunc", CALL_BLENDFUNC },
+    { "glVertexAttribPointer", CALL_VERTEXATTRIBPOINTER },
+    { "glBlendColor", CALL_BLENDCOLOR },
+    { "glActiveTexture", CALL_ACTIVETEXTURE },
+    { "glBindTexture", CALL_BINDTEXTURE },
+    { "glBindSampler", CALL_BINDSAMPLER },
+    { "glUniform1f", CALL_UNIFORM1F },
+    { "glUniform1fv", CALL_UNIFORM1FV },
+    { "glUniform2f", CALL_UNIFORM2F },
+    { "glUniform2fv", CALL_UNIFORM2FV },
+    { "glUniform3f", CALL_UNIFORM3F },
+    { "glUniform3fv", CALL_UNIFORM3FV },
+    { "eglGetError", CALL_GETERROR },
+    { "eglSwapBuffers", CALL_SWAP },
+    { "eglSwapBuffersWithDamageKHR", CALL_SWAP },
+    { "eglSwapBuffersWithDamageEXT", CALL_SWAP },
+    { "glMapBufferRange", CALL_MAPBUFFERRANGE },
+    { "glFlushMappedBufferRange", CALL_FLUSHMAPPEDBUFFERRANGE },
+    { "glCopyClientSideBuffer", CALL_COPYCLIENTSIDEBUFFER },
+    { "glUnmapBuffer", CALL_UNMAPBUFFER },
+    { "glClientSideBufferData", CALL_CLIENTSIDEBUFFERCHANGE },
+    { "glPatchClientSideBuffer", CALL_CLIENTSIDEBUFFERCHANGE },
+    { "glClientSideBufferSubData", CALL_CLIENTSIDEBUFFERCHANGE },
+    { "glDiscardFramebufferEXT", CALL_RENDER },
+    { "glClear", CALL_RENDER },
+    { "glClearBufferfi", CALL_RENDER },
+    { "glClearBufferfv", CALL_RENDER }, // + glDraw*
+};
+
+static std::vector<DedupCall> classifyCalls(const common::InFile& inputFile)
+{
+    const std::vector<std::string>& names = inputFile.getFuncNames();
+    std::unordered_map<std::string, DedupCall> byName(std::begin(dedupCalls), std::end(dedupCalls));
+    std::vector<DedupCall> kinds(names.size(), CALL_OTHER);
+    for (unsigned id = 0; id < names.size(); id++)
+    {
+        const auto it = byName.find(names[id]);
+        if (it != byName.end()) kinds[id] = it->second;
+        else if (names[id].compare(0, 6, "glDraw") == 0) kinds[id] = CALL_RENDER;
+    }
+    return kinds;
+}
+
+/// Read the next fixed size argument straight from the call data
+template<typename T>
+static inline T nextArg(char*& src)
+{
+    T value;
+    src = common::ReadFixed(src, value);
+    return value;
+}
+
+static inline uint32_t floatBits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+/// Tracked values in a flat array, indexed by a small dense index.
+/// Indices beyond the limit are never tracked, so such calls are always kept.
+template<typename T, unsigned LIMIT = 65536>
+class Slots
+{
+public:
+    const T* find(unsigned index) const
+    {
+        return (index < mValues.size() && mSet[index]) ? &mValues[index] : nullptr;
+    }
+    void set(unsigned index, const T& value)
+    {
+        if (index >= LIMIT) return;
+        if (index >= mValues.size())
+        {
+            mValues.resize(index + 1);
+            mSet.resize(index + 1, 0);
+        }
+        mValues[index] = value;
+        mSet[index] = 1;
+    }
+    bool is(unsigned index, const T& value) const
+    {
+        const T* v = find(index);
+        return v && *v == value;
+    }
+    void clear()
+    {
+        std::fill(mSet.begin(), mSet.end(), 0);
+    }
+
+private:
+    std::vector<T> mValues;
+    std::vector<unsigned char> mSet;
+};
+
+/// Dense indices for the GL enums used as keys (buffer and texture targets, capabilities).
+/// Enums below 0x10000, which is nearly all of them, are looked up in a flat table.
+class EnumSlots
+{
+public:
+    unsigned operator()(GLenum value)
+    {
+        if (value < SMALL_ENUMS)
+        {
+            unsigned& slot = mSmall[value];
+            if (slot == 0) slot = ++mCount;
+            return slot - 1;
+        }
+        const auto it = mLarge.find(value);
+        if (it != mLarge.end()) return it->second;
+        return mLarge[value] = mCount++;
+    }
+
+private:
+    static const unsigned SMALL_ENUMS = 0x10000;
+    std::vector<unsigned> mSmall = std::vector<unsigned>(SMALL_ENUMS, 0);
+    std::unordered_map<GLenum, unsigned> mLarge;
+    unsigned mCount = 0;
+};
+
+static const unsigned MAX_TEXTURE_UNITS = 256;
+
+/// Everything tracked for one EGL context
+struct ContextState
+{
+    bool hasProgram = false;
+    GLuint program = 0;
+    bool hasSurface = false;
+    int surface = 0;
+    unsigned textureUnit = 0;
+    Slots<GLuint> buffers; // by target
+    std::vector<Slots<GLuint>> textures; // by texture unit, then target
+    Slots<GLuint, MAX_TEXTURE_UNITS> samplers; // by texture unit
+    Slots<unsigned char> enabled; // by capability, 1 if enabled
+    Slots<uint32_t> uniform1f; // by location
+    Slots<std::array<uint32_t, 2>> uniform2f;
+    Slots<std::array<uint32_t, 3>> uniform3f;
+    Slots<std::string, 256> vertexattrib; // raw arguments, by attribute index
+    Slots<unsigned char, 256> enablevertex;
+    Slots<GLuint, 256> vertexdivisor;
+    std::unordered_map<GLuint, int> mappedbuffers_flushbit; // buffer -> bit
+    std::tuple<GLint, GLint, GLsizei, GLsizei> scissor = std::make_tuple(-1, -1, -1, -1);
+    std::tuple<GLenum, GLenum> blendfunc = std::make_tuple(GL_NONE, GL_NONE);
+    GLenum depthfunc = GL_NONE;
+    std::array<uint32_t, 4> blendcolor = {{ 0, 0, 0, 0 }};
+    std::pair<int, int> csbdedup_possible = std::make_pair(-1, -1);
+};
+
+class Deduplicator
+{
+public:
+    Deduplicator(common::InFile& input, common::OutFile& output, const DedupOptions& options)
+        : mInput(input), mOutput(output), mOptions(options), mReader(input)
+    {
+        mContexts.resize(1); // index 0 collects calls made without a current context
+        mEnableId = input.NameToExId("glEnable");
+    }
+
+    void run();
+
+    DedupResult result;
+
+private:
+    /// Copy the current call unchanged
+    inline void writeout()
+    {
+        result.written++;
+        if (mOptions.onlyCount || mOptions.patch) return;
+        mReader.copyTo(mOutput);
+    }
+
+    void dedup(int &stat)
+    {
+        if (mOptions.patch && !mOptions.replace)
+        {
+            common::patchfile_remove(*mOptions.patch, mCallNo);
+        }
+        else if (mOptions.replace && !mOptions.onlyCount)
+        {
+            common::CallTM enable("glEnable");
+            enable.mCallNo = mCallNo;
+            enable.mTid = mTid;
+            enable.mArgs.push_back(new common::ValueTM((GLenum)GL_INVALID_INDEX));
+            if (mOptions.patch)
+            {
+                common::patchfile_replace(*mOptions.patch, enable);
+            }
+            else
+            {
+                if (mEnableId == 0)
+                {
+                    DBG_LOG("glEnable is missing from the function list of the trace, cannot use --replace\n");
+                    exit(1);
+                }
+                enable.Serialize(mOutput, mEnableId, true);
+                result.written++;
+            }
+        }
+        result.removed++;
+        stat++;
+    }
+
+    ContextState& makeCurrent(int context)
+    {
+        unsigned index = 0;
+        if (context != (int)(intptr_t)EGL_NO_CONTEXT)
+        {
+            const auto it = mContextIndex.find(context);
+            if (it != mContextIndex.end())
+            {
+                index = it->second;
+            }
+            else
+            {
+                index = mContextIndex[context] = mContexts.size();
+                mContexts.emplace_back();
+            }
+        }
+        mCurrent[mTid] = index;
+        return mContexts[index];
+    }
+
+    common::InFile& mInput;
+    common::OutFile& mOutput;
+    const DedupOptions& mOptions;
+    common::RawCallReader mReader;
+    unsigned short mEnableId = 0;
+
+    // The call being processed
+    unsigned mCallNo = 0;
+    unsigned mTid = 0;
+
+    std::vector<ContextState> mContexts;
+    std::unordered_map<int, unsigned> mContextIndex; // EGLContext -> index into mContexts
+    std::array<unsigned, 256> mCurrent = {}; // tid -> index of current context
+    std::array<bool, 256> mMadeCurrent = {}; // tid -> has called eglMakeCurrent
+    EnumSlots mEnums;
+};
+
+void Deduplicator::run()
+{
+    const int flags = mOptions.flags;
+    FILE *fp = mOptions.log;
+    const std::vector<DedupCall> kinds = classifyCalls(mInput);
+    const Json::Value header = mInput.getJSONHeader();
+    const unsigned defaultTid = header["defaultTid"].asUInt();
+    const bool onlyDefault = !header.get("multiThread", false).asBool();
+    int frames = 0;
+
+    std::pair<int, int> vertexattrs;
+    std::pair<int, int> bindbuffers;
+    std::pair<int, int> enables; // includes disables
+    std::pair<int, int> scissordupes;
+    std::pair<int, int> blendcols;
+    std::pair<int, int> bindtexs;
+    std::pair<int, int> bindsamps;
+    std::pair<int, int> uniforms;
+    std::pair<int, int> depthfuncs;
+    std::pair<int, int> blendfuncs;
+    std::pair<int, int> useprograms;
+    std::pair<int, int> makecurr;
+    std::pair<int, int> csb;
+    std::pair<int, int> customcsv;
+    int makecurr_harmless = 0;
+    int last_swap = 0;
+    int remove_until = -1;
+    auto next_csv_range = mOptions.csvRanges.begin();
+
+    // Go through entire trace file
+    while (mReader.next())
+    {
+        const DedupCall kind = kinds[mReader.funcId()];
+        mCallNo = mReader.callNo();
+        mTid = mReader.tid();
+        char *src = mReader.args();
+
+        int surface = 0;
+        const unsigned previous_context = mCurrent[mTid];
+        if (kind == CALL_MAKECURRENT)
+        {
+            nextArg<int>(src); // dpy
+            surface = nextArg<int>(src);
+            const int readsurface = nextArg<int>(src);
+            assert(readsurface == surface);
+            (void)readsurface;
+            makeCurrent(nextArg<int>(src));
+        }
+        else if (kind == CALL_SWAP && (!onlyDefault || mTid == defaultTid))
+        {
+            frames++;
+        }
+        ContextState& ctx = mContexts[mCurrent[mTid]];
+
+        if (mOptions.lastFrame != -1 && frames >= mOptions.lastFrame)
+        {
+            writeout();
+            continue;
+        }
+
+        while (next_csv_range != mOptions.csvRanges.end() && next_csv_range->first < (int)mCallNo) ++next_csv_range;
+        if (next_csv_range != mOptions.csvRanges.end() && next_csv_range->first == (int)mCallNo) { assert(remove_until == -1); remove_until = next_csv_range->second; }
+        if ((int)mCallNo == remove_until) remove_until = -1;
+        if (remove_until != -1 && kind == CALL_RENDER) { dedup(customcsv.first); continue; }
+
+        switch (kind)
+        {
+        case CALL_USEPROGRAM:
+        {
+            useprograms.second++;
+            const GLuint id = nextArg<GLuint>(src);
+            if (!ctx.hasProgram)
+            {
+                ctx.hasProgram = true;
+                ctx.program = id;
+                writeout();
+            }
+            else if (id != ctx.program || id == 0 || !(flags & DEDUP_PROGRAMS))
+            {
+                ctx.uniform1f.clear();
+                ctx.uniform2f.clear();
+                ctx.uniform3f.clear();
+                ctx.vertexattrib.clear();
+                ctx.enablevertex.clear();
+                ctx.vertexdivisor.clear();
+                ctx.program = id;
+                writeout();
+            }
+            else
+            {
+                dedup(useprograms.first);
+            }
+            ctx.csbdedup_possible = std::make_pair(-1, -1);
+            break;
+        }
+        case CALL_MAKECURRENT:
+            makecurr.second++;
+            if (!mMadeCurrent[mTid] || !ctx.hasSurface)
+            {
+                writeout();
+            }
+            else if (mCurrent[mTid] == previous_context && ctx.surface == surface && (flags & DEDUP_MAKECURRENT))
+            {
+                dedup(makecurr.first);
+                if (last_swap == (int)mCallNo - 1 || frames == 0) makecurr_harmless++;
+            }
+            else
+            {
+                writeout();
+            }
+            mMadeCurrent[mTid] = true;
+            ctx.hasSurface = true;
+            ctx.surface = surface;
+            break;
+        case CALL_BINDBUFFER:
+        {
+            if (!(flags & (DEDUP_BUFFERS | DEDUP_CSB))) { writeout(); break; }
+            bindbuffers.second++;
+            const GLenum target = nextArg<GLenum>(src);
+            const GLuint id = nextArg<GLuint>(src);
+            if ((int)target == ctx.csbdedup_possible.second) ctx.csbdedup_possible = std::make_pair(-1, -1);
+            const unsigned slot = mEnums(target);
+            if (!ctx.buffers.is(slot, id))
+            {
+                writeout();
+                ctx.buffers.set(slot, id);
+            }
+            else if (flags & DEDUP_BUFFERS) dedup(bindbuffers.first);
+            else writeout();
+            break;
+        }
+        case CALL_VERTEXATTRIBDIVISOR:
+        {
+            if (!(flags & DEDUP_VERTEXATTRIB)) { writeout(); break; }
+            enables.second++;
+            const GLuint index = nextArg<GLuint>(src);
+            const GLuint divisor = nextArg<GLuint>(src);
+            if (ctx.vertexdivisor.is(index, divisor)) dedup(enables.first);
+            else writeout();
+            ctx.vertexdivisor.set(index, divisor);
+            break;
+        }
+        case CALL_ENABLEVERTEXATTRIB:
+        case CALL_DISABLEVERTEXATTRIB:
+        {
+            if (!(flags & DEDUP_VERTEXATTRIB)) { writeout(); break; }
+            enables.second++;
+            const GLuint index = nextArg<GLuint>(src);
+            const unsigned char enable = (kind == CALL_ENABLEVERTEXATTRIB);
+            if (ctx.enablevertex.is(index, enable)) dedup(enables.first);
+            else writeout();
+            ctx.enablevertex.set(index, enable);
+            break;
+        }
+        case CALL_ENABLE:
+        case CALL_DISABLE:
+        {
+            if (!(flags & DEDUP_ENABLE)) { writeout(); break; }
+            enables.second++;
+            const unsigned slot = mEnums(nextArg<GLenum>(src));
+            const unsigned char enable = (kind == CALL_ENABLE);
+            if (!ctx.enabled.is(slot, enable))
+            {
+                writeout();
+                ctx.enabled.set(slot, enable);
+            }
+            else dedup(enables.first);
+            break;
+        }
+        case CALL_SCISSOR:
+        {
+            if (!(flags & DEDUP_SCISSORS)) { writeout(); break; }
+            scissordupes.second++;
+            const GLint x = nextArg<GLint>(src);
+            const GLint y = nextArg<GLint>(src);
+            const GLsizei width = nextArg<GLsizei>(src);
+            const GLsizei height = nextArg<GLsizei>(src);
+            const auto val = std::make_tuple(x, y, width, height);
+            if (ctx.scissor != val)
+            {
+                writeout();
+                ctx.scissor = val;
+            }
+            else dedup(scissordupes.first);
+            break;
+        }
+        case CALL_DEPTHFUNC:
+        {
+            if (!(flags & DEDUP_DEPTHFUNC)) { writeout(); break; }
+            depthfuncs.second++;
+            const GLenum func = nextArg<GLenum>(src);
+            if (ctx.depthfunc != func)
+            {
+                writeout();
+                ctx.depthfunc = func;
+            }
+            else dedup(depthfuncs.first);
+            break;
+        }
+        case CALL_BLENDFUNC:
+        {
+            if (!(flags & DEDUP_BLENDFUNC)) { writeout(); break; }
+            blendfuncs.second++;
+            const GLenum sfactor = nextArg<GLenum>(src);
+            const GLenum dfactor = nextArg<GLenum>(src);
+            const auto val = std::make_tuple(sfactor, dfactor);
+            if (ctx.blendfunc != val)
+            {
+                writeout();
+                ctx.blendfunc = val;
+            }
+            else dedup(blendfuncs.first);
+            break;
+        }
+        case CALL_VERTEXATTRIBPOINTER:
+        {
+            if (!(flags & DEDUP_VERTEXATTRIB)) { writeout(); break; }
+            vertexattrs.second++;
+            char *args = src;
+            const GLuint index = nextArg<GLuint>(src);
+            // Compare all the arguments as they are stored, so that client side
+            // pointers only match if they point to the same buffer and offset
+            const std::string val(args, mReader.data() + mReader.size() - args);
+            if (!ctx.vertexattrib.is(index, val))
+            {
+                writeout();
+                ctx.vertexattrib.set(index, val);
+            }
+            else dedup(vertexattrs.first);
+            break;
+        }
+        case CALL_BLENDCOLOR:
+        {
+            if (!(flags & DEDUP_BLENDFUNC)) { writeout(); break; }
+            blendcols.second++;
+            std::array<uint32_t, 4> val;
+            for (uint32_t& c : val) c = floatBits(nextArg<GLfloat>(src));
+            if (ctx.blendcolor != val)
+            {
+                writeout();
+                ctx.blendcolor = val;
+            }
+            else dedup(blendcols.first);
+            break;
+        }
+        case CALL_ACTIVETEXTURE:
+            ctx.textureUnit = nextArg<GLenum>(src) - GL_TEXTURE0;
+            writeout();
+            break;
+        case CALL_BINDTEXTURE:
+        {
+            if (!(flags & DEDUP_TEXTURES)) { writeout(); break; }
+            bindtexs.second++;
+            const unsigned slot = mEnums(nextArg<GLenum>(src));
+            const GLuint id = nextArg<GLuint>(src);
+            if (ctx.textureUnit >= MAX_TEXTURE_UNITS)
+            {
+                writeout();
+                break;
+            }
+            if (ctx.textureUnit >= ctx.textures.size()) ctx.textures.resize(ctx.textureUnit + 1);
+            Slots<GLuint>& unit = ctx.textures[ctx.textureUnit];
+            if (!unit.is(slot, id))
+            {
+                writeout();
+                unit.set(slot, id);
+                ctx.samplers.clear();
+            }
+            else dedup(bindtexs.first);
+            break;
+        }
+        case CALL_BINDSAMPLER:
+        {
+            if (!(flags & DEDUP_TEXTURES)) { writeout(); break; }
+            bindsamps.second++;
+            const GLuint unit = nextArg<GLuint>(src);
+            const GLuint id = nextArg<GLuint>(src);
+            if (!ctx.samplers.is(unit, id))
+            {
+                writeout();
+                ctx.samplers.set(unit, id);
+            }
+            else dedup(bindsamps.first);
+            break;
+        }
+        case CALL_UNIFORM1F:
+        case CALL_UNIFORM1FV:
+        {
+            if (!(flags & DEDUP_UNIFORMS)) { writeout(); break; }
+            uniforms.second++;
+            const GLuint location = nextArg<GLint>(src);
+            GLsizei count = 1;
+            uint32_t v1 = 0;
+            if (kind == CALL_UNIFORM1F)
+            {
+                v1 = floatBits(nextArg<GLfloat>(src));
+            }
+            else
+            {
+                count = nextArg<GLsizei>(src);
+                common::Array<float> value;
+                common::Read1DArray(src, value);
+                if (value.cnt < 1) count = 0;
+                else v1 = floatBits(value.v[0]);
+            }
+            if (count != 1 || !ctx.uniform1f.is(location, v1))
+            {
+                writeout();
+                ctx.uniform1f.set(location, v1);
+            }
+            else dedup(uniforms.first);
+            break;
+        }
+        case CALL_UNIFORM2F:
+        case CALL_UNIFORM2FV:
+        {
+            if (!(flags & DEDUP_UNIFORMS)) { writeout(); break; }
+            uniforms.second++;
+            const GLuint location = nextArg<GLint>(src);
+            GLsizei count = 1;
+            std::array<uint32_t, 2> val = {{ 0, 0 }};
+            if (kind == CALL_UNIFORM2F)
+            {
+                for (uint32_t& v : val) v = floatBits(nextArg<GLfloat>(src));
+            }
+            else
+            {
+                count = nextArg<GLsizei>(src);
+                common::Array<float> value;
+                common::Read1DArray(src, value);
+                if (value.cnt < 2) count = 0;
+                else for (unsigned i = 0; i < 2; i++) val[i] = floatBits(value.v[i]);
+            }
+            if (count != 1 || !ctx.uniform2f.is(location, val))
+            {
+                writeout();
+                ctx.uniform2f.set(location, val);
+            }
+            else dedup(uniforms.first);
+            break;
+        }
+        case CALL_UNIFORM3F:
+        case CALL_UNIFORM3FV:
+        {
+            if (!(flags & DEDUP_UNIFORMS)) { writeout(); break; }
+            uniforms.second++;
+            const GLuint location = nextArg<GLint>(src);
+            GLsizei count = 1;
+            std::array<uint32_t, 3> val = {{ 0, 0, 0 }};
+            if (kind == CALL_UNIFORM3F)
+            {
+                for (uint32_t& v : val) v = floatBits(nextArg<GLfloat>(src));
+            }
+            else
+            {
+                count = nextArg<GLsizei>(src);
+                common::Array<float> value;
+                common::Read1DArray(src, value);
+                if (value.cnt < 3) count = 0;
+                else for (unsigned i = 0; i < 3; i++) val[i] = floatBits(value.v[i]);
+            }
+            if (count != 1 || !ctx.uniform3f.is(location, val))
+            {
+                writeout();
+                ctx.uniform3f.set(location, val);
+            }
+            else dedup(uniforms.first);
+            break;
+        }
+        case CALL_GETERROR:
+            writeout();
+            if (last_swap == (int)mCallNo - 1) last_swap++; // pretend this call doesn't exist for purposes of checking if we just swapped
+            break;
+        case CALL_SWAP:
+            writeout();
+            if (frames == mOptions.endFrame) // terminate here?
+            {
+                if (mOptions.verbose) DBG_LOG("Ending!\n");
+                goto done;
+            }
+            if (mOptions.verbose) DBG_LOG("Frame %d / %d\n", frames, mOptions.endFrame); // log (slow) progress
+            last_swap = mCallNo;
+            break;
+        case CALL_MAPBUFFERRANGE:
+        {
+            if (!(flags & DEDUP_CSB)) { writeout(); break; }
+            const GLenum target = nextArg<GLenum>(src);
+            nextArg<int>(src); // offset
+            nextArg<int>(src); // length
+            const GLuint access = nextArg<GLuint>(src);
+            const GLuint *cur_buf = ctx.buffers.find(mEnums(target));
+            ctx.mappedbuffers_flushbit[cur_buf ? *cur_buf : 0] = (access & GL_MAP_FLUSH_EXPLICIT_BIT_EXT) ? 0 : -1;
+            writeout();
+            break;
+        }
+        case CALL_FLUSHMAPPEDBUFFERRANGE:
+        {
+            if (!(flags & DEDUP_CSB)) { writeout(); break; }
+            const GLuint *cur_buf = ctx.buffers.find(mEnums(nextArg<GLenum>(src)));
+            int& flushbit = ctx.mappedbuffers_flushbit[cur_buf ? *cur_buf : 0];
+            if (flushbit == 0) flushbit = 1;
+            writeout();
+            break;
+        }
+        case CALL_COPYCLIENTSIDEBUFFER:
+        {
+            if (!(flags & DEDUP_CSB)) { writeout(); break; }
+            csb.second++;
+            const GLenum target = nextArg<GLenum>(src);
+            const GLuint name = nextArg<GLuint>(src);
+            const GLuint *cur_buf = ctx.buffers.find(mEnums(target));
+            const auto flushbit = ctx.mappedbuffers_flushbit.find(cur_buf ? *cur_buf : 0);
+            if (ctx.csbdedup_possible == std::make_pair((int)name, (int)target) || (flushbit != ctx.mappedbuffers_flushbit.end() && flushbit->second == 1))
+            {
+                dedup(csb.first);
+                break;
+            }
+            ctx.csbdedup_possible = std::make_pair((int)name, (int)target);
+            writeout();
+            break;
+        }
+        case CALL_UNMAPBUFFER:
+        {
+            if (!(flags & DEDUP_CSB)) { writeout(); break; }
+            const GLenum target = nextArg<GLenum>(src);
+            const GLuint *cur_buf = ctx.buffers.find(mEnums(target));
+            if ((int)target == ctx.csbdedup_possible.second) ctx.csbdedup_possible = std::make_pair(-1, -1);
+            ctx.mappedbuffers_flushbit[cur_buf ? *cur_buf : 0] = -1;
+            writeout();
+            break;
+        }
+        case CALL_CLIENTSIDEBUFFERCHANGE:
+            if (flags & DEDUP_CSB) ctx.csbdedup_possible = std::make_pair(-1, -1);
+            writeout();
+            break;
+        default:
+            writeout();
+            break;
+        }
+    }
+done:
+    fprintf(fp, "Removed %d / %d calls (%d%%)\n", result.removed, result.written, result.written ? result.removed * 100 / result.written : 0);
+    if (useprograms.first) fprintf(fp, "Removed %d / %d glUseProgram calls (%d%%)\n", useprograms.first, useprograms.second, useprograms.first * 100 / useprograms.second);
+    if (vertexattrs.first) fprintf(fp, "Removed %d / %d vertex attr calls (%d%%)\n", vertexattrs.first, vertexattrs.second, vertexattrs.first * 100 / vertexattrs.second);
+    if (bindbuffers.first) fprintf(fp, "Removed %d / %d bindbuffer calls (%d%%)\n", bindbuffers.first, bindbuffers.second, bindbuffers.first * 100 / bindbuffers.second);
+    if (enables.first) fprintf(fp, "Removed %d / %d enable/disable calls (%d%%)\n", enables.first, enables.second, enables.first * 100 / enables.second);
+    if (scissordupes.first) fprintf(fp, "Removed %d / %d scissor calls (%d%%)\n", scissordupes.first, scissordupes.second, scissordupes.first * 100 / scissordupes.second);
+    if (blendcols.first) fprintf(fp, "Removed %d / %d blendcol calls (%d%%)\n", blendcols.first, blendcols.second, blendcols.first * 100 / blendcols.second);
+    if (bindtexs.first) fprintf(fp, "Removed %d / %d bindtexture calls (%d%%)\n", bindtexs.first, bindtexs.second, bindtexs.first * 100 / bindtexs.second);
+    if (bindsamps.first) fprintf(fp, "Removed %d / %d bindsampler calls (%d%%)\n", bindsamps.first, bindsamps.second, bindsamps.first * 100 / bindsamps.second);
+    if (uniforms.first) fprintf(fp, "Removed %d / %d relevant uniform calls (%d%%)\n", uniforms.first, uniforms.second, uniforms.first * 100 / uniforms.second);
+    if (depthfuncs.first) fprintf(fp, "Removed %d / %d depth func calls (%d%%)\n", depthfuncs.first, depthfuncs.second, depthfuncs.first * 100 / depthfuncs.second);
+    if (blendfuncs.first) fprintf(fp, "Removed %d / %d blend func calls (%d%%)\n", blendfuncs.first, blendfuncs.second, blendfuncs.first * 100 / blendfuncs.second);
+    if (makecurr.first) fprintf(fp, "Removed %d / %d makecurrent calls (%d%%, at least %d were harmless on Mali)\n", makecurr.first, makecurr.second, makecurr.first * 100 / makecurr.second, makecurr_harmless);
+    if (csb.first) fprintf(fp, "Removed %d / %d glCopyClientSideBuffer func calls (%d%%)\n", csb.first, csb.second, csb.first * 100 / csb.second);
+    if (customcsv.first) fprintf(fp, "Removed %d / %d func calls from custom CSV (%d%%)\n", customcsv.first, result.written, customcsv.first * 100 / result.written);
+}
+
+
+void deduplicate(common::InFile& input, common::OutFile& output, const DedupOptions& options, DedupResult *result)
+{
+    Deduplicator deduplicator(input, output, options);
+    deduplicator.run();
+    if (result) *result = deduplicator.result;
+}
@@ -0,0 +1,54 @@
+#ifndef _TOOL_DEDUPLICATION_HPP_
+#define _TOOL_DEDUPLICATION_HPP_
+
+#include <stdio.h>
+#include <map>
+
+#include "common/in_file_mt.hpp"
+#include "common/out_file.hpp"
+#include "common/trace_model.hpp"
+
+// Removes calls that set state to what it already is, used by deduplicator.
+//
+// The trace is streamed once. Calls that are neither removed nor changed are copied
+// as raw bytes, and the output keeps the function list of the input. Only the
+// arguments of calls we track are decoded, straight from the call data. Tracked state
+// lives in flat arrays per context, indexed by funcId, dense enum index, location or
+// unit, and each thread has its own current context. Traces older than
+// HEADER_VERSION_4 are re-encoded call by call instead of copied.
+
+#define DEDUP_BUFFERS 1
+#define DEDUP_UNIFORMS 2
+#define DEDUP_TEXTURES 4
+#define DEDUP_SCISSORS 8
+#define DEDUP_BLENDFUNC 16
+#define DEDUP_ENABLE 32
+#define DEDUP_DEPTHFUNC 64
+#define DEDUP_VERTEXATTRIB 128
+#define DEDUP_MAKECURRENT 256
+#define DEDUP_PROGRAMS 512
+#define DEDUP_CSB 1024
+
+struct DedupOptions
+{
+    int flags = 0;                   // DEDUP_* bits
+    int endFrame = -1;               // terminate the trace at the swap of this frame, -1 for none
+    int lastFrame = -1;              // copy the trace unchanged from this frame on, -1 for none
+    bool replace = false;            // replace removed calls with glEnable(GL_INVALID_INDEX)
+    bool onlyCount = false;          // only count, write nothing
+    bool verbose = false;
+    std::map<int, int> csvRanges;    // draw calls to remove, start inclusive, end exclusive
+    common::patchfile *patch = nullptr; // write the changes to this patch file instead
+    FILE *log = stdout;              // where the statistics are printed
+};
+
+struct DedupResult
+{
+    int removed = 0;
+    int written = 0;  // calls kept or replaced
+};
+
+/// The output must be opened with the sigbook of the input and have its header written
+void deduplicate(common::InFile& input, common::OutFile& output, const DedupOptions& options, DedupResult *result = nullptr);
+
+#endif
@@ -0,0 +1,404 @@
+// Rewrite a trace so that object names (textures, buffers, programs, ...) are
+// renumbered into compact per-type ranges starting from 1. The retracer can then
+// look up object names by plain array indexing (see hmap::setDenseKeys), for
+// traces with up to 4M objects of a type.
+//
+// Each object type gets its own injective renumbering, with 0 kept as 0, so the
+// pattern of which calls refer to the same object is unchanged. Only handles that
+// the retracer remaps are touched. Uniform locations and uniform block indices are
+// left alone, since they are resolved against the driver's program at replay time.
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <GLES3/gl32.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/in_file_mt.hpp"
+#include "common/out_file.hpp"
+#include "common/parse_api.hpp"
+#include "common/trace_model.hpp"
+#include "tool/config.hpp"
+#include "tool/utils.hpp"
+
+enum ObjectType
+{
+    OBJ_TEXTURE,
+    OBJ_BUFFER,
+    OBJ_PROGRAM,
+    OBJ_SHADER,
+    OBJ_FRAMEBUFFER,
+    OBJ_RENDERBUFFER,
+    OBJ_SAMPLER,
+    OBJ_QUERY,
+    OBJ_ARRAY,
+    OBJ_FEEDBACK,
+    OBJ_PIPELINE,
+    OBJ_COUNT,
+    OBJ_NONE = -1
+};
+
+// Same names as the handle types in the API specs
+static const char *objectTypeNames[OBJ_COUNT] =
+{
+    "texture", "buffer", "program", "shader", "framebuffer", "renderbuffer", "sampler", "query", "array", "feedback", "pipeline"
+};
+
+static int objectTypeFromHandle(const char *handle)
+{
+    for (int i = 0; i < OBJ_COUNT; i++)
+    {
+        if (strcmp(handle, objectTypeNames[i]) == 0) return i;
+    }
+    return OBJ_NONE;
+}
+
+// Mirrors lookUpPolymorphic() in the retracer
+static int objectTypeFromImageTarget(GLenum target)
+{
+    return (target == GL_RENDERBUFFER) ? OBJ_RENDERBUFFER : OBJ_TEXTURE;
+}
+
+// Mirrors lookUpPolymorphic2() and lookUpPolymorphic3() in the retracer
+static int objectTypeFromIdentifier(GLenum identifier)
+{
+    switch (identifier)
+    {
+    case GL_BUFFER_OBJECT_EXT: case GL_BUFFER: return OBJ_BUFFER;
+    case GL_SHADER_OBJECT_EXT: case GL_SHADER: return OBJ_SHADER;
+    case GL_PROGRAM_OBJECT_EXT: case GL_PROGRAM: return OBJ_PROGRAM;
+    case GL_VERTEX_ARRAY_OBJECT_EXT: case GL_VERTEX_ARRAY: return OBJ_ARRAY;
+    case GL_QUERY_OBJECT_EXT: case GL_QUERY: return OBJ_QUERY;
+    case GL_PROGRAM_PIPELINE_OBJECT_EXT: case GL_PROGRAM_PIPELINE: return OBJ_PIPELINE;
+    case GL_TEXTURE: return OBJ_TEXTURE;
+    case GL_FRAMEBUFFER: return OBJ_FRAMEBUFFER;
+    case GL_RENDERBUFFER: return OBJ_RENDERBUFFER;
+    case GL_SAMPLER: return OBJ_SAMPLER;
+    case GL_TRANSFORM_FEEDBACK: return OBJ_FEEDBACK;
+    default: return OBJ_NONE;
+    }
+}
+
+struct HandleSlot
+{
+    common::ValueTM *value;
+    int type;
+};
+
+// Collect all values in a call that hold object names of the types we renumber
+static void collectHandles(common::ValueTM *value, int type, std::vector<HandleSlot>& slots)
+{
+    if (type == OBJ_NONE) return;
+    switch (value->mType)
+    {
+    case common::Array_Type:
+        for (unsigned i = 0; i < value->mArrayLen; i++) collectHandles(&value->mArray[i], type, slots);
+        break;
+    case common::Pointer_Type:
+        if (value->mPointer) collectHandles(value->mPointer, type, slots);
+        break;
+    case common::Uint_Type:
+    case common::Int_Type:
+        slots.push_back({ value, type });
+        break;
+    default:
+        break;
+    }
+}
+
+static void collectHandles(common::CallTM *call, std::vector<HandleSlot>& slots)
+{
+    slots.clear();
+    const std::string& name = call->mCallName;
+    if (name == "glCopyImageSubData" || name == "glCopyImageSubDataEXT" || name == "glCopyImageSubDataOES")
+    {
+        collectHandles(call->mArgs[0], objectTypeFromImageTarget(call->mArgs[1]->GetAsUInt()), slots);
+        collectHandles(call->mArgs[6], objectTypeFromImageTarget(call->mArgs[7]->GetAsUInt()), slots);
+        return;
+    }
+    else if (name == "glLabelObjectEXT" || name == "glGetObjectLabelEXT" || name == "glObjectLabel" || name == "glGetObjectLabel"
+             || name == "glObjectLabelKHR" || name == "glGetObjectLabelKHR")
+    {
+        collectHandles(call->mArgs[1], objectTypeFromIdentifier(call->mArgs[0]->GetAsUInt()), slots);
+        return;
+    }
+    else if (name == "eglCreateImageKHR")
+    {
+        // Only GL texture sources are remapped by the retracer
+        if (call->mArgs[2]->GetAsUInt() == EGL_GL_TEXTURE_2D_KHR) collectHandles(call->mArgs[3], OBJ_TEXTURE, slots);
+        return;
+    }
+
+    const auto it = common::handle_args.find(name);
+    if (it == common::handle_args.end()) return;
+    for (const common::HandleArg& arg : it->second)
+    {
+        common::ValueTM *value = (arg.index == -1) ? &call->mRet : call->mArgs.at(arg.index);
+        collectHandles(value, objectTypeFromHandle(arg.handle), slots);
+    }
+}
+
+static unsigned getName(const HandleSlot& slot)
+{
+    return (slot.value->mType == common::Uint_Type) ? slot.value->mUint : (unsigned)slot.value->mInt;
+}
+
+static void setName(const HandleSlot& slot, unsigned name)
+{
+    if (slot.value->mType == common::Uint_Type) slot.value->mUint = name;
+    else slot.value->mInt = (int)name;
+}
+
+class Renumbering
+{
+public:
+    unsigned remap(int type, unsigned name)
+    {
+        if (name == 0) return 0;
+        auto& map = mMaps[type];
+        const auto it = map.find(name);
+        if (it != map.end()) return it->second;
+        const unsigned dense = map.size() + 1;
+        map[name] = dense;
+        if (name > mMaxName[type]) mMaxName[type] = name;
+        return dense;
+    }
+
+    unsigned count(int type) const { return mMaps[type].size(); }
+    unsigned maxName(int type) const { return mMaxName[type]; }
+
+private:
+    std::unordered_map<unsigned, unsigned> mMaps[OBJ_COUNT];
+    unsigned mMaxName[OBJ_COUNT] = {};
+};
+
+// Checks that names in two traces map one-to-one, per object type
+class Bijection
+{
+public:
+    bool check(int type, unsigned a, unsigned b)
+    {
+        const auto fwd = mForward[type].emplace(a, b);
+        const auto rev = mReverse[type].emplace(b, a);
+        return fwd.first->second == b && rev.first->second == a;
+    }
+
+private:
+    std::unordered_map<unsigned, unsigned> mForward[OBJ_COUNT];
+    std::unordered_map<unsigned, unsigned> mReverse[OBJ_COUNT];
+};
+
+static void printHelp()
+{
+    std::cout <<
+        "Usage : densify_ids [OPTIONS] source.pat target.pat\n"
+        "Renumber object names into compact per-type ranges, so that the retracer never falls back to hash lookups.\n"
+        "Options:\n"
+        "  -c            Do not write anything, instead check that target.pat is a valid renumbering of source.pat\n"
+        "  -h            Print help\n"
+        "  -v            Print version\n"
+        ;
+}
+
+static void printVersion()
+{
+    std::cout << PATRACE_VERSION << std::endl;
+}
+
+static void writeout(common::OutFile &outputFile, common::CallTM *call)
+{
+    call->Serialize(outputFile);
+}
+
+static common::CallTM* next_call(common::InFile& inputFile)
+{
+    void *fptr = nullptr;
+    char *src = nullptr;
+    common::BCall_vlen call;
+    if (!inputFile.GetNextCall(fptr, call, src))
+    {
+        return nullptr;
+    }
+    return new common::CallTM(inputFile, inputFile.curCallNo, call);
+}
+
+static int densify(const std::string& source_trace_filename, const std::string& target_trace_filename)
+{
+    common::InFile inputFile;
+    if (!inputFile.Open(source_trace_filename.c_str()))
+    {
+        std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
+        return 1;
+    }
+    common::OutFile outputFile;
+    if (!outputFile.Open(target_trace_filename.c_str()))
+    {
+        std::cerr << "Failed to open for writing: " << target_trace_filename << std::endl;
+        return 1;
+    }
+
+    Renumbering renumbering;
+    std::vector<HandleSlot> slots;
+    common::CallTM *call = nullptr;
+    while ((call = next_call(inputFile)))
+    {
+        collectHandles(call, slots);
+        for (const HandleSlot& slot : slots)
+        {
+            setName(slot, renumbering.remap(slot.type, getName(slot)));
+        }
+        writeout(outputFile, call);
+        delete call;
+    }
+
+    Json::Value header = inputFile.getJSONHeader();
+    Json::Value info;
+    for (int i = 0; i < OBJ_COUNT; i++)
+    {
+        if (renumbering.count(i) == 0) continue;
+        info[objectTypeNames[i]]["count"] = renumbering.count(i);
+        info[objectTypeNames[i]]["maxOriginalName"] = renumbering.maxName(i);
+        printf("%-13s %8u objects, largest original name %u\n", objectTypeNames[i], renumbering.count(i), renumbering.maxName(i));
+    }
+    header["denseObjectIds"] = true;
+    addConversionEntry(header, "densify_ids", source_trace_filename, info);
+    Json::FastWriter writer;
+    const std::string json_header = writer.write(header);
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+    outputFile.Close();
+    inputFile.Close();
+    return 0;
+}
+
+static int check(const std::string& source_trace_filename, const std::string& target_trace_filename)
+{
+    common::InFile sourceFile;
+    common::InFile targetFile;
+    if (!sourceFile.Open(source_trace_filename.c_str()))
+    {
+        std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
+        return 1;
+    }
+    if (!targetFile.Open(target_trace_filename.c_str()))
+    {
+        std::cerr << "Failed to open for reading: " << target_trace_filename << std::endl;
+        return 1;
+    }
+
+    std::vector<char> sourceBuffer;
+    std::vector<char> targetBuffer;
+    Bijection bijection;
+    std::vector<HandleSlot> sourceSlots;
+    std::vector<HandleSlot> targetSlots;
+    int errors = 0;
+    while (errors < 10)
+    {
+        common::CallTM *source = next_call(sourceFile);
+        common::CallTM *target = next_call(targetFile);
+        if (!source || !target)
+        {
+            if (source || target)
+            {
+                printf("Traces have different number of calls\n");
+                errors++;
+            }
+            delete source;
+            delete target;
+            break;
+        }
+
+        collectHandles(source, sourceSlots);
+        collectHandles(target, targetSlots);
+        bool ok = (sourceSlots.size() == targetSlots.size());
+        for (unsigned i = 0; ok && i < sourceSlots.size(); i++)
+        {
+            ok = sourceSlots[i].type == targetSlots[i].type
+                 && bijection.check(sourceSlots[i].type, getName(sourceSlots[i]), getName(targetSlots[i]))
+                 && (getName(sourceSlots[i]) == 0) == (getName(targetSlots[i]) == 0);
+            // Everything apart from the object names must be identical
+            setName(sourceSlots[i], getName(targetSlots[i]));
+        }
+        if (ok)
+        {
+            sourceBuffer.resize(std::max(sourceBuffer.size(), source->SerializedSizeBound()));
+            targetBuffer.resize(std::max(targetBuffer.size(), target->SerializedSizeBound()));
+            const size_t sourceSize = source->Serialize(sourceBuffer.data()) - sourceBuffer.data();
+            const size_t targetSize = target->Serialize(targetBuffer.data()) - targetBuffer.data();
+            ok = sourceSize == targetSize && memcmp(sourceBuffer.data(), targetBuffer.data(), sourceSize) == 0;
+        }
+        if (!ok)
+        {
+            printf("Mismatch in call %u: %s\n", source->mCallNo, source->mCallName.c_str());
+            errors++;
+        }
+        delete source;
+        delete target;
+    }
+
+    sourceFile.Close();
+    targetFile.Close();
+    if (errors)
+    {
+        printf("FAILED: %s is not a renumbering of %s\n", target_trace_filename.c_str(), source_trace_filename.c_str());
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool checkOnly = false;
+    int argIndex = 1;
+    for (; argIndex < argc; ++argIndex)
+    {
+        std::string arg = argv[argIndex];
+
+        if (arg[0] != '-')
+        {
+            break;
+        }
+        else if (arg == "-c")
+        {
+            checkOnly = true;
+        }
+        else if (arg == "-h")
+        {
+            printHelp();
+            return 0;
+        }
+        else if (arg == "-v")
+        {
+            printVersion();
+            return 0;
+        }
+        else
+        {
+            std::cerr << "Error: Unknown option " << arg << std::endl;
+            printHelp();
+            return 1;
+        }
+    }
+
+    if (argIndex + 2 > argc)
+    {
+        printHelp();
+        return 1;
+    }
+    const std::string source_trace_filename = argv[argIndex++];
+    const std::string target_trace_filename = argv[argIndex++];
+
+    if (checkOnly)
+    {
+        return check(source_trace_filename, target_trace_filename);
+    }
+    return densify(source_trace_filename, target_trace_filename);
+}
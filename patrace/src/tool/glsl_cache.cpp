@@ -0,0 +1,183 @@
+#include "glsl_cache.h"
+
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <string.h>
+
+#include "common/content_hash.hpp"
+#include "common/os.hpp"
+#include "json/reader.h"
+#include "json/writer.h"
+
+/// Increase when the layout of the cache file changes, or when a change to GLSLParser
+/// gives different results for the same source, so that old cache files are ignored.
+static const int GLSL_CACHE_FORMAT = 1;
+
+const GLSLAnalysis& GLSLCache::analyze(const std::string& source, int shaderType)
+{
+    mStats.lookups++;
+    const Key key = { common::ContentHash::hash(source), source.size(), shaderType };
+    auto it = mEntries.find(key);
+    if (it != mEntries.end())
+    {
+        mStats.hits++;
+        mStats.saved_ms += it->second.cost_ms;
+        return it->second;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    GLSLAnalysis a;
+    GLSLParser parser;
+    const std::string stripped = parser.strip_comments(source);
+    a.shader = parser.preprocessor(stripped, shaderType);
+    a.compressed = parser.compressed(a.shader);
+    a.repr = parser.parse(a.shader);
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    a.cost_ms = elapsed.count();
+    mStats.analysis_ms += a.cost_ms;
+    return mEntries.emplace(key, std::move(a)).first->second;
+}
+
+// Keywords are stored by name, so that the file does not depend on the enum values
+
+static Json::Value keywordToJson(Keyword k)
+{
+    return lookup_get_string(k);
+}
+
+static Keyword keywordFromJson(const Json::Value& v)
+{
+    return lookup_get(v.asString()).keyword;
+}
+
+static Json::Value variableToJson(const GLSLRepresentation::Variable& var)
+{
+    Json::Value v;
+    v["precision"] = keywordToJson(var.precision);
+    v["type"] = keywordToJson(var.type);
+    v["storage"] = keywordToJson(var.storage);
+    v["name"] = var.name;
+    v["size"] = var.size;
+    v["dimensions"] = var.dimensions;
+    v["qualifiers"] = Json::arrayValue;
+    for (Keyword q : var.qualifiers)
+    {
+        v["qualifiers"].append(keywordToJson(q));
+    }
+    v["layout"] = var.layout;
+    v["members"] = Json::arrayValue;
+    for (const GLSLRepresentation::Variable& m : var.members)
+    {
+        v["members"].append(variableToJson(m));
+    }
+    v["binding"] = var.binding;
+    return v;
+}
+
+static GLSLRepresentation::Variable variableFromJson(const Json::Value& v)
+{
+    GLSLRepresentation::Variable var;
+    var.precision = keywordFromJson(v["precision"]);
+    var.type = keywordFromJson(v["type"]);
+    var.storage = keywordFromJson(v["storage"]);
+    var.name = v["name"].asString();
+    var.size = v["size"].asInt();
+    var.dimensions = v["dimensions"].asString();
+    for (const Json::Value& q : v["qualifiers"])
+    {
+        var.qualifiers.push_back(keywordFromJson(q));
+    }
+    var.layout = v["layout"].asString();
+    for (const Json::Value& m : v["members"])
+    {
+        var.members.push_back(variableFromJson(m));
+    }
+    var.binding = v["binding"].asInt();
+    return var;
+}
+
+bool GLSLCache::save(const std::string& filename) const
+{
+    Json::Value root;
+    root["format"] = GLSL_CACHE_FORMAT;
+    root["entries"] = Json::arrayValue;
+    for (const auto& pair : mEntries)
+    {
+        const GLSLAnalysis& a = pair.second;
+        Json::Value e;
+        e["hash"] = (Json::Value::UInt64)pair.first.hash;
+        e["size"] = (Json::Value::UInt64)pair.first.size;
+        e["shader_type"] = pair.first.shaderType;
+        e["cost_ms"] = a.cost_ms;
+        e["code"] = a.shader.code;
+        e["extensions"] = Json::arrayValue;
+        for (const std::string& ext : a.shader.extensions)
+        {
+            e["extensions"].append(ext);
+        }
+        e["version"] = a.shader.version;
+        e["optimize_off_pragma"] = a.shader.contains_optimize_off_pragma;
+        e["debug_on_pragma"] = a.shader.contains_debug_on_pragma;
+        e["invariant_all_pragma"] = a.shader.contains_invariant_all_pragma;
+        e["compressed"] = a.compressed;
+        e["invariants"] = a.repr.contains_invariants;
+        e["global"] = variableToJson(a.repr.global);
+        root["entries"].append(e);
+    }
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out)
+    {
+        DBG_LOG("Could not open %s for writing: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    Json::FastWriter writer;
+    out << writer.write(root);
+    return out.good();
+}
+
+bool GLSLCache::load(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(in, root))
+    {
+        DBG_LOG("Failed to parse shader analysis cache %s: %s\n", filename.c_str(), reader.getFormattedErrorMessages().c_str());
+        return false;
+    }
+    if (root["format"].asInt() != GLSL_CACHE_FORMAT)
+    {
+        DBG_LOG("Ignoring shader analysis cache %s of format %d, expected %d\n", filename.c_str(), root["format"].asInt(), GLSL_CACHE_FORMAT);
+        return false;
+    }
+    for (const Json::Value& e : root["entries"])
+    {
+        const Key key = { e["hash"].asUInt64(), e["size"].asUInt64(), e["shader_type"].asInt() };
+        GLSLAnalysis a;
+        a.cost_ms = e["cost_ms"].asDouble();
+        a.shader.shaderType = key.shaderType;
+        a.shader.code = e["code"].asString();
+        for (const Json::Value& ext : e["extensions"])
+        {
+            a.shader.extensions.push_back(ext.asString());
+        }
+        a.shader.version = e["version"].asInt();
+        a.shader.contains_optimize_off_pragma = e["optimize_off_pragma"].asBool();
+        a.shader.contains_debug_on_pragma = e["debug_on_pragma"].asBool();
+        a.shader.contains_invariant_all_pragma = e["invariant_all_pragma"].asBool();
+        a.compressed = e["compressed"].asString();
+        a.repr.contains_invariants = e["invariants"].asBool();
+        a.repr.global = variableFromJson(e["global"]);
+        if (mEntries.emplace(key, std::move(a)).second)
+        {
+            mStats.loaded++;
+        }
+    }
+    return true;
+}
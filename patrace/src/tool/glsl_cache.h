@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include "glsl_parser.h"
+
+/// Everything the analysis tools need from running a shader source through GLSLParser
+struct GLSLAnalysis
+{
+    GLSLShader shader; // preprocessed
+    std::string compressed;
+    GLSLRepresentation repr;
+    double cost_ms = 0.0; // time it took to analyse
+};
+
+/// Remembers the analysis of each shader source by content, since traces often upload
+/// the same sources many times (for each context, after re-creating shaders, when the
+/// application loops). Can be saved to and loaded from disk, so that analysing the same
+/// trace or game build again skips the GLSL work.
+///
+/// Sources are identified by a 64-bit content hash, their length and the shader type.
+class GLSLCache
+{
+public:
+    struct Stats
+    {
+        unsigned lookups = 0;
+        unsigned hits = 0;
+        unsigned loaded = 0;      // entries read from disk
+        double analysis_ms = 0.0; // spent analysing sources not in the cache
+        double saved_ms = 0.0;    // what analysing the cache hits took originally
+    };
+
+    /// Returns the analysis of source, running the GLSL pipeline only if it is not
+    /// cached yet. The reference is valid until the cache is destroyed.
+    const GLSLAnalysis& analyze(const std::string& source, int shaderType);
+
+    /// Adds the entries of a file written by save(). Returns false if it could not be
+    /// read or has a different format.
+    bool load(const std::string& filename);
+    bool save(const std::string& filename) const;
+
+    const Stats& stats() const { return mStats; }
+    size_t size() const { return mEntries.size(); }
+
+private:
+    struct Key
+    {
+        uint64_t hash;
+        uint64_t size;
+        int shaderType;
+        bool operator==(const Key& k) const { return hash == k.hash && size == k.size && shaderType == k.shaderType; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const { return k.hash; }
+    };
+
+    std::unordered_map<Key, GLSLAnalysis, KeyHash> mEntries;
+    Stats mStats;
+};
@@ -9,7 +9,6 @@
 
 // TBD:
 // * support UTF-8
-// * could be _a lot_ more efficient if I used c++14 string views, but probably don't care about performance here
 // * parse any binding values of samplers (and other inputs)
 
 #include "glsl_parser.h"
@@ -24,11 +23,20 @@
 #define ASSERT(_stmt, _line, ...) do { if (!(_stmt)) { fprintf(stderr, "input=\"%s\" lineno=%d line=\"%s\"\n", mShaderName.c_str(), mLineNo, _line); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); assert(false); } } while(0)
 #define ELOG(...) do { fprintf(stderr, __VA_ARGS__); fprintf(stderr, " (filename=%s, line=%d)\n", mShaderName.c_str(), mLineNo); } while(0)
 
+static const char* start_special = ";|&()!=+-*/%<>&^|<>|&!*/%<><>^~:,{}[]??++--.\n";
+static const char* second_special= " |&  =======<>=====      <>          : + -   "; // valid combinations, space means valid alone
+static const char* third_special = "            ==                               ";
+
+struct SpecialStart
+{
+    bool table[256] = {};
+    SpecialStart() { for (unsigned i = 0; start_special[i] != '\0'; i++) table[(unsigned char)start_special[i]] = true; }
+};
+static const SpecialStart special_start;
+
 static inline int is_special(char curr, char next, char next2)
 {
-    static const char* start_special = ";|&()!=+-*/%<>&^|<>|&!*/%<><>^~:,{}[]??++--.\n";
-    static const char* second_special= " |&  =======<>=====      <>          : + -   "; // valid combinations, space means valid alone
-    static const char* third_special = "            ==                               ";
+    if (!special_start.table[(unsigned char)curr]) return 0; // most characters of a shader
     for (unsigned i = 0; start_special[i] != '\0'; i++)
     {
         if (start_special[i] == curr && second_special[i] == next && next != ' ' && third_special[i] == next2 && next2 != ' ') return 3;
@@ -68,25 +76,26 @@ struct Token
     Token() {}
 };
 
-static Token scan_token(std::string& line, unsigned start = 0)
+/// Scans the token at pos in s and moves pos past it. Nothing is copied except the token
+/// and its leading whitespace, so scanning a whole shader this way is linear in its length.
+static Token next_token(const std::string& s, size_t& pos)
 {
-    std::string whitespace;
-    Token::tokentype type = Token::IDENTIFIER;
-    const size_t length = line.size();
-    if (length == 0)
+    const size_t length = s.size();
+    if (pos >= length)
     {
-        line = "";
+        pos = length;
         return { "", Token::EMPTY, { Keyword::None, KeywordType::None }, "" };
     }
-    while (start < length && line[start] != '\0' && (line[start] == '\t' || line[start] == ' '))
+    Token::tokentype type = Token::IDENTIFIER;
+    size_t start = pos;
+    while (start < length && (s[start] == '\t' || s[start] == ' '))
     {
-        whitespace += line[start]; // store whitespace
         start++; // skip whitespace
     }
     size_t end = start;
-    while (end < length && line[end] != '\0' && line[end] != '\t' && line[end] != ' ')
+    while (end < length && s[end] != '\0' && s[end] != '\t' && s[end] != ' ')
     {
-        const int special = is_special(line[end], (length - end > 0) ? line[end + 1] : ' ', (length - end > 1) ? line[end + 2] : ' ');
+        const int special = is_special(s[end], s[end + 1], (length - end > 1) ? s[end + 2] : ' ');
         if (special && end == start) {
             end += special;    // got something
             type = Token::OPERATOR;
@@ -97,14 +106,29 @@ static Token scan_token(std::string& line, unsigned start = 0)
         }
         end++;
     }
-    std::string ret = line.substr(start, end - start); // non-inclusive for end
-    KeywordDefinition k = lookup_get(ret);
-    if (k.keyword != Keyword::None)
+    Token ret;
+    ret.str.assign(s, start, end - start); // non-inclusive for end
+    ret.whitespace.assign(s, pos, start - pos);
+    const KeywordDefinition k = lookup_get(ret.str);
+    ret.type = (k.keyword != Keyword::None) ? Token::KEYWORD : type;
+    ret.keyword = k.keyword;
+    ret.keywordType = k.type;
+    pos = end;
+    return ret;
+}
+
+/// Scans the token at start and removes everything up to its end from line. Use
+/// next_token() instead when scanning more than a few tokens.
+static Token scan_token(std::string& line, unsigned start = 0)
+{
+    if (line.size() == 0)
     {
-        type = Token::KEYWORD;
+        return { "", Token::EMPTY, { Keyword::None, KeywordType::None }, "" };
     }
-    line = line.substr(end);
-    return { ret, type, k, whitespace };
+    size_t pos = start;
+    Token ret = next_token(line, pos);
+    line.erase(0, pos);
+    return ret;
 }
 
 static std::string scan_rest(std::string& line, unsigned start = 0)
@@ -120,21 +144,23 @@ static std::string scan_rest(std::string& line, unsigned start = 0)
 
 static std::string macro_expansion(const std::string& orig, const std::unordered_map<std::string, Define>& defines);
 
-static std::string replace_macro(std::string& s, const Define& define, const std::unordered_map<std::string, Define>& defines)
+/// Expands the macro whose name was scanned from s just before pos. For a macro function,
+/// pos is moved past its parameters.
+static std::string replace_macro(const std::string& s, size_t& pos, const Define& define, const std::unordered_map<std::string, Define>& defines)
 {
     if (define.params.size() == 0) // easy! (simple macro)
     {
         return define.value;
     }
-    else if (s.size() == 0 || s[0] == '\n' || s[0] == '\0')
+    else if (pos >= s.size() || s[pos] == '\n' || s[pos] == '\0')
     {
-        return s;
+        return s.substr(pos);
     }
     else // harder (macro function)
     {
         std::vector<std::string> replacements;
-        // cannot use scan_token() below, since input does not follow token rules
-        const char* start = strchr(s.c_str(), '(');
+        // cannot use next_token() below, since input does not follow token rules
+        const char* start = strchr(s.c_str() + pos, '(');
         assert(start);
         unsigned i = 0;
         const char* next = start;
@@ -158,12 +184,12 @@ repeat:
             i++;
         }
         while (next && *next != ')');
-        s = std::string(++next); // consume parameters in input, let callee keep remains
+        pos = ++next - s.c_str(); // consume parameters in input, let callee keep remains
         assert(i == define.params.size()); // we found same number of parameters
         // Ok, now replace
         std::string ret;
-        std::string repl = define.value;
-        Token curr = scan_token(repl);
+        size_t repl = 0;
+        Token curr = next_token(define.value, repl);
         ret += curr.whitespace;
         while (curr.str.size())
         {
@@ -183,7 +209,7 @@ repeat:
             {
                 ret += macro_expansion(curr.str, defines);// + " ";
             }
-            curr = scan_token(repl);
+            curr = next_token(define.value, repl);
             ret += curr.whitespace;
         }
         return ret;
@@ -194,18 +220,17 @@ repeat:
 static std::string macro_expansion(const std::string& orig, const std::unordered_map<std::string, Define>& defines)
 {
     std::string r;
-    std::string s = orig;
-    Token prev;
-    while (s.size())
+    size_t pos = 0;
+    while (pos < orig.size())
     {
-        Token curr = scan_token(s);
-        if (defines.count(curr.str) > 0)
+        Token curr = next_token(orig, pos);
+        const auto it = defines.find(curr.str);
+        if (it != defines.end())
         {
-            const Define& d = defines.at(curr.str);
-            curr.str = replace_macro(s, d, defines);
+            curr.str = replace_macro(orig, pos, it->second, defines);
         }
-        r += curr.whitespace + curr.str;
-        prev = curr;
+        r += curr.whitespace;
+        r += curr.str;
     }
     return r;
 }
@@ -281,12 +306,12 @@ bool GLSLParser::resolve_conditionals(const std::unordered_map<std::string, Defi
     ///
     std::vector<std::string> ops;
     std::vector<std::string> vals;
-    std::string tmpstr = expr;
+    size_t pos = 0;
     bool was_defined = false; // was previous directive a 'defined'? if so, do not macro expand!
     int was_unary = 0;
     bool may_be_unary = true;
     do {
-        Token token = scan_token(tmpstr);
+        Token token = next_token(expr, pos);
 
         char *end = nullptr;
         long value = strtol(token.str.c_str(), &end, 10);
@@ -369,12 +394,12 @@ bool GLSLParser::resolve_conditionals(const std::unordered_map<std::string, Defi
                 if (d.params.size() > 0) // macro function
                 {
                     std::string t = token.str;
-                    token = scan_token(tmpstr, 0);
+                    token = next_token(expr, pos);
                     ASSERT(token.str == "(", expr.c_str(), "Function without parenthesis begin");
                     t += token.str;
                     while (token.str.size() && token.str != ")")
                     {
-                        token = scan_token(tmpstr, 0);
+                        token = next_token(expr, pos);
                         t += token.str;
                     }
                     ASSERT(token.str == ")", expr.c_str(), "Function without parenthesis end");
@@ -395,7 +420,7 @@ bool GLSLParser::resolve_conditionals(const std::unordered_map<std::string, Defi
                 was_unary--;
             }
         }
-    } while (tmpstr.size());
+    } while (pos < expr.size());
     while (ops.size() > 0)
     {
         vals.push_back(ops.back());
@@ -473,7 +498,7 @@ bool GLSLParser::resolve_conditionals(const std::unordered_map<std::string, Defi
 
 // Implements GLSL spec 3.10 step 9. Steps 4, 6 and 7 must have
 // been done previously. Steps 5 and 8 are to be skipped.
-GLSLShader GLSLParser::preprocessor(std::string shader, int shaderType)
+GLSLShader GLSLParser::preprocessor(const std::string& shader, int shaderType)
 {
     GLSLShader ret;
     ret.shaderType = shaderType;
@@ -487,12 +512,17 @@ GLSLShader GLSLParser::preprocessor(std::string shader, int shaderType)
     defines["GL_EXT_primitive_bounding_box"] = { "1" };
     defines["GL_OES_shader_io_blocks"] = { "1" };
     defines["GL_EXT_shader_non_constant_global_initializers"] = { "1" };
-    std::istringstream lines(shader);
+    ret.code.reserve(shader.size());
     std::string orig_line;
     std::vector<int> nested; // 1 - true, 0 - false, -1 - false but has been true
     mLineNo = 1;
-    while (std::getline(lines, orig_line))
+    size_t next_line = 0;
+    while (next_line < shader.size())
     {
+        size_t eol = shader.find('\n', next_line);
+        if (eol == std::string::npos) eol = shader.size();
+        orig_line.assign(shader, next_line, eol - next_line);
+        next_line = eol + 1;
         int i = 0;
         std::string line = orig_line;
         while (line[i] != '\0' && (line[i] == '\t' || line[i] == ' ')) i++; // skip whitespace
@@ -762,6 +792,7 @@ std::string GLSLParser::inline_includes(const std::string& s)
 std::string GLSLParser::strip_comments(const std::string& s)
 {
     std::string r;
+    r.reserve(s.size());
     char prev = '\0';
     bool inside = false;
     bool prev_star = false;
@@ -842,19 +873,24 @@ void GLSLParser::self_test()
     {
         const std::unordered_map<std::string, Define> om{{"mix2", {" mix((a),(b),(t))", {"a", "b", "t"}}}};
         std::string s = "mix2(c1.rgb,(c*upper) + ((1.0-c)*lower),opacity)";
-        std::string r = replace_macro(s, om.at("mix2"), om);
+        size_t pos = 4;
+        std::string r = replace_macro(s, pos, om.at("mix2"), om);
         assert(r == " mix((c1.rgb),((c*upper) + ((1.0-c)*lower)),(opacity))");
-        std::string s2 = "mix2(texcolor.rgb,overlayBlend3(texcolor.rgb, texoverlay.rgb*vec3(0.5,0.5,0.5), overlayweights.r),overlaymask.r)";
-        r = replace_macro(s2, om.at("mix2"), om);
+        assert(pos == s.size());
+        std::string s2 = "mix2(texcolor.rgb,overlayBlend3(texcolor.rgb, texoverlay.rgb*vec3(0.5,0.5,0.5), overlayweights.r),overlaymask.r) * 2.0";
+        pos = 4;
+        r = replace_macro(s2, pos, om.at("mix2"), om);
         assert(r == " mix((texcolor.rgb),(overlayBlend3(texcolor.rgb, texoverlay.rgb*vec3(0.5,0.5,0.5), overlayweights.r)),(overlaymask.r))");
+        assert(s2.compare(pos, std::string::npos, " * 2.0") == 0);
     }
 
     const std::unordered_map<std::string, Define> om1{{"float2", {"vec2"}}};
     const char* v1 = " Square(float2 A)";
     std::string i1 = v1;
     Define d1{"vec2"};
-    std::string r1 = replace_macro(i1, d1, om1);
-    assert(i1 == v1);
+    size_t p1 = 0;
+    std::string r1 = replace_macro(i1, p1, d1, om1);
+    assert(p1 == 0);
     assert(r1 == "vec2");
 
     v1 = "float2 Square(float2 A)";
@@ -905,6 +941,23 @@ void GLSLParser::self_test()
     assert(t.str == "." && t.type == Token::OPERATOR);
     t = scan_token(s);
     assert(t.str == "0" && t.type == Token::IDENTIFIER);
+    s = "\tresult /= 255.0;";
+    size_t pos = 0;
+    t = next_token(s, pos);
+    assert(t.str == "result" && t.whitespace == "\t" && pos == 7);
+    t = next_token(s, pos);
+    assert(t.str == "/=" && t.type == Token::OPERATOR && t.whitespace == " " && pos == 10);
+    while (pos < s.size()) t = next_token(s, pos);
+    assert(t.str == ";" && t.type == Token::OPERATOR && pos == s.size());
+    t = next_token(s, pos);
+    assert(t.type == Token::EMPTY && pos == s.size());
+    s = "uniform highp  vec4 color;";
+    pos = 0;
+    t = next_token(s, pos);
+    assert(t.str == "uniform" && t.type == Token::KEYWORD && t.keyword == Keyword::Uniform);
+    t = next_token(s, pos);
+    t = next_token(s, pos);
+    assert(t.str == "vec4" && t.keywordType == KeywordType::Type && t.whitespace == "  ");
 
     const std::unordered_map<std::string, Define> oop{{"GL_ES", {"1"}},{"GL_FRAGMENT_PRECISION_HIGH", {"1"}},{"TRUEDEF",{"1"}},{"FALSEDEF",{"0"}}, {"LIGHTING", {"1"}}, {"MAX_BONE_WEIGHTS", {"2"}}};
     assert(resolve_conditionals(oop, "(COLOR_MULTIPLY_SOURCE >= COLOR_MULTIPLY_SOURCE_MASK_TEXTURE_RED) && (COLOR_MULTIPLY_SOURCE <= COLOR_MULTIPLY_SOURCE_MASK_TEXTURE_ALPHA)", GL_FRAGMENT_SHADER) == true);
@@ -989,15 +1042,16 @@ void GLSLParser::self_test()
     mDebug = was_debug;
 }
 
-std::string GLSLParser::compressed(GLSLShader shader)
+std::string GLSLParser::compressed(const GLSLShader& shader)
 {
     std::string r;
-    std::string feed = shader.code;
+    const std::string& feed = shader.code;
+    size_t pos = 0;
     Token prev;
     int line = 0;
-    while (feed.size())
+    while (pos < feed.size())
     {
-        Token curr = scan_token(feed);
+        Token curr = next_token(feed, pos);
         if ((curr.type == Token::IDENTIFIER || curr.type == Token::KEYWORD)
                 && curr.str != "=" && prev.str != "=" && curr.str != "."
                 && (prev.type == Token::IDENTIFIER || prev.type == Token::KEYWORD)) r += " "; // mandatory space
@@ -1008,8 +1062,8 @@ std::string GLSLParser::compressed(GLSLShader shader)
                 continue;
             }
         }
-        prev = curr;
         r += curr.str;
+        prev = std::move(curr);
     }
     return r;
 }
@@ -1018,7 +1072,8 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
 {
     GLSLRepresentation ret;
     mLineNo = 1;
-    std::string feed = shader.code;
+    const std::string& feed = shader.code;
+    size_t pos = 0;
     int block_depth = 0;
     /// Keep track of structure type definitions. Structures without a type name are immediately parsed
     std::unordered_map<std::string, GLSLRepresentation::Variable> structs; // type name : struct definitions
@@ -1055,9 +1110,9 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
     enum class Termination { None, StructScope, InterfaceScope, StructMember };
     Termination do_terminate = Termination::None;
     std::string struct_name; // definitions never nested
-    while (feed.size())
+    while (pos < feed.size())
     {
-        Token curr = scan_token(feed);
+        Token curr = next_token(feed, pos);
         if (curr.str == "\n")
         {
             mLineNo++;
@@ -1102,7 +1157,7 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
                 {
                     structs[struct_name] = nesting.back();
                 }
-                curr = scan_token(feed); // we will get either a name or a ';'
+                curr = next_token(feed, pos); // we will get either a name or a ';'
 
                 if (curr.str != ";") // delay termination (could be an array eg)
                 {
@@ -1126,7 +1181,7 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
             }
             else
             {
-                ASSERT(block_depth > 0, feed.c_str(), "Too many scopes ending!");
+                ASSERT(block_depth > 0, feed.c_str() + pos, "Too many scopes ending!");
                 block_depth--;
             }
         }
@@ -1263,7 +1318,7 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
             {
             case Keyword::Struct:
             {
-                Token type_name = scan_token(feed); // either name or {
+                Token type_name = next_token(feed, pos); // either name or {
                 in_struct = true;
                 if (type_name.str != "{") // named struct
                 {
@@ -1308,9 +1363,9 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
                 break;
             case Keyword::Precision: // changing default precision on global scope
             {
-                Token precision = scan_token(feed);
-                Token type = scan_token(feed);
-                Token semicolon = scan_token(feed);
+                Token precision = next_token(feed, pos);
+                Token type = next_token(feed, pos);
+                Token semicolon = next_token(feed, pos);
                 ASSERT(semicolon.str == ";", semicolon.str.c_str(), "Semicolon expected in default precision");
                 default_precision[type.keyword] = precision.keyword;
                 break;
@@ -1321,9 +1376,9 @@ GLSLRepresentation GLSLParser::parse(const GLSLShader& shader)
                 var.layout = curr.str;
                 while (curr.str != ")")
                 {
-                    curr = scan_token(feed);
+                    curr = next_token(feed, pos);
                     var.layout += curr.str;
-                    ASSERT(curr.type != Token::EMPTY, feed.c_str(), "Layout qualifier not terminated with right parenthesis!");
+                    ASSERT(curr.type != Token::EMPTY, feed.c_str() + pos, "Layout qualifier not terminated with right parenthesis!");
                 }
                 break;
             }
@@ -1371,10 +1426,10 @@ void GLSLShader::upgrade_to_glsl310()
 {
     std::string target;
     bool must_add_fragout = false;
-    std::string s = code;
-    while (s.size())
+    size_t pos = 0;
+    while (pos < code.size())
     {
-        Token t = scan_token(s);
+        Token t = next_token(code, pos);
         if (t.str == "varying")
         {
             target += t.whitespace;
@@ -0,0 +1,365 @@
+#include "tool/image_diff.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <stdlib.h>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_DIFF_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IMAGE_DIFF_NEON 1
+#include <arm_neon.h>
+#endif
+
+/// Adds the errors of a run of pixels to stats. Only the first compared channels of each pixel count.
+typedef void (*RowFunction)(const unsigned char *a, const unsigned char *b, int pixels, int channels, int compared, ImageDiffTile& stats);
+
+static void scalarRow(const unsigned char *a, const unsigned char *b, int pixels, int channels, int compared, ImageDiffTile& stats)
+{
+    for (int x = 0; x < pixels; ++x, a += channels, b += channels)
+    {
+        unsigned pixelError = 0;
+        for (int c = 0; c < compared; ++c)
+        {
+            const unsigned error = (a[c] > b[c]) ? a[c] - b[c] : b[c] - a[c];
+            stats.squaredError += error * error;
+            pixelError = std::max(pixelError, error);
+        }
+        stats.maxError = std::max(stats.maxError, pixelError);
+        stats.differentPixels += (pixelError != 0);
+    }
+}
+
+// The vector kernels sum the squared errors in 32 bit lanes. Each lane grows by at most
+// 2 * 2 * 255^2 per step, so they are moved to 64 bit lanes every FLUSH_STEPS steps.
+static const int FLUSH_STEPS = 4096;
+
+#if IMAGE_DIFF_X86
+
+static inline unsigned sse2MaxByte(__m128i v)
+{
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+    return _mm_cvtsi128_si32(v) & 0xff;
+}
+
+static inline uint64_t sse2Sum64(__m128i v)
+{
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+static inline __m128i sse2Widen32(__m128i v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_add_epi64(_mm_unpacklo_epi32(v, zero), _mm_unpackhi_epi32(v, zero));
+}
+
+static void sse2Row(const unsigned char *a, const unsigned char *b, int pixels, int channels, int compared, ImageDiffTile& stats)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32(compared == 4 ? -1 : 0x00ffffff);
+    __m128i maxError = zero;
+    __m128i squared = zero;
+    __m128i equal = zero;
+    const int vectorPixels = pixels & ~0x3;
+    int x = 0;
+    while (x < vectorPixels)
+    {
+        const int end = std::min(vectorPixels, x + FLUSH_STEPS * 4);
+        __m128i sum = zero;
+        __m128i same = zero;
+        for (; x < end; x += 4)
+        {
+            const __m128i va = _mm_loadu_si128((const __m128i *)(a + x * 4));
+            const __m128i vb = _mm_loadu_si128((const __m128i *)(b + x * 4));
+            const __m128i d = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)), mask);
+            maxError = _mm_max_epu8(maxError, d);
+            const __m128i lo = _mm_unpacklo_epi8(d, zero);
+            const __m128i hi = _mm_unpackhi_epi8(d, zero);
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            // -1 for every pixel without error
+            same = _mm_sub_epi32(same, _mm_cmpeq_epi32(d, zero));
+        }
+        squared = _mm_add_epi64(squared, sse2Widen32(sum));
+        equal = _mm_add_epi64(equal, sse2Widen32(same));
+    }
+    stats.squaredError += sse2Sum64(squared);
+    stats.differentPixels += vectorPixels - sse2Sum64(equal);
+    stats.maxError = std::max(stats.maxError, sse2MaxByte(maxError));
+    scalarRow(a + x * 4, b + x * 4, pixels - x, channels, compared, stats);
+}
+
+__attribute__((target("avx2")))
+static void avx2Row(const unsigned char *a, const unsigned char *b, int pixels, int channels, int compared, ImageDiffTile& stats)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32(compared == 4 ? -1 : 0x00ffffff);
+    __m256i maxError = zero;
+    __m256i squared = zero;
+    __m256i equal = zero;
+    const int vectorPixels = pixels & ~0x7;
+    int x = 0;
+    while (x < vectorPixels)
+    {
+        const int end = std::min(vectorPixels, x + FLUSH_STEPS * 8);
+        __m256i sum = zero;
+        __m256i same = zero;
+        for (; x < end; x += 8)
+        {
+            const __m256i va = _mm256_loadu_si256((const __m256i *)(a + x * 4));
+            const __m256i vb = _mm256_loadu_si256((const __m256i *)(b + x * 4));
+            const __m256i d = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va)), mask);
+            maxError = _mm256_max_epu8(maxError, d);
+            const __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            const __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+            same = _mm256_sub_epi32(same, _mm256_cmpeq_epi32(d, zero));
+        }
+        squared = _mm256_add_epi64(squared, _mm256_add_epi64(_mm256_unpacklo_epi32(sum, zero), _mm256_unpackhi_epi32(sum, zero)));
+        equal = _mm256_add_epi64(equal, _mm256_add_epi64(_mm256_unpacklo_epi32(same, zero), _mm256_unpackhi_epi32(same, zero)));
+    }
+    const __m128i squared128 = _mm_add_epi64(_mm256_castsi256_si128(squared), _mm256_extracti128_si256(squared, 1));
+    const __m128i equal128 = _mm_add_epi64(_mm256_castsi256_si128(equal), _mm256_extracti128_si256(equal, 1));
+    const __m128i max128 = _mm_max_epu8(_mm256_castsi256_si128(maxError), _mm256_extracti128_si256(maxError, 1));
+    stats.squaredError += sse2Sum64(squared128);
+    stats.differentPixels += vectorPixels - sse2Sum64(equal128);
+    stats.maxError = std::max(stats.maxError, sse2MaxByte(max128));
+    sse2Row(a + x * 4, b + x * 4, pixels - x, channels, compared, stats);
+}
+
+#elif IMAGE_DIFF_NEON
+
+static void neonRow(const unsigned char *a, const unsigned char *b, int pixels, int channels, int compared, ImageDiffTile& stats)
+{
+    const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(compared == 4 ? 0xffffffff : 0x00ffffff));
+    const uint32x4_t zero = vdupq_n_u32(0);
+    uint8x16_t maxError = vdupq_n_u8(0);
+    uint64x2_t squared = vdupq_n_u64(0);
+    uint64x2_t equal = vdupq_n_u64(0);
+    const int vectorPixels = pixels & ~0x3;
+    int x = 0;
+    while (x < vectorPixels)
+    {
+        const int end = std::min(vectorPixels, x + FLUSH_STEPS * 4);
+        uint32x4_t sum = zero;
+        uint32x4_t same = zero;
+        for (; x < end; x += 4)
+        {
+            const uint8x16_t d = vandq_u8(vabdq_u8(vld1q_u8(a + x * 4), vld1q_u8(b + x * 4)), mask);
+            maxError = vmaxq_u8(maxError, d);
+            sum = vpadalq_u16(sum, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+            sum = vpadalq_u16(sum, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+            // all ones, i.e. -1, for every pixel without error
+            same = vsubq_u32(same, vceqq_u32(vreinterpretq_u32_u8(d), zero));
+        }
+        squared = vpadalq_u32(squared, sum);
+        equal = vpadalq_u32(equal, same);
+    }
+    uint8_t maxLanes[16];
+    vst1q_u8(maxLanes, maxError);
+    stats.squaredError += vgetq_lane_u64(squared, 0) + vgetq_lane_u64(squared, 1);
+    stats.differentPixels += vectorPixels - (vgetq_lane_u64(equal, 0) + vgetq_lane_u64(equal, 1));
+    stats.maxError = std::max(stats.maxError, (unsigned)*std::max_element(maxLanes, maxLanes + 16));
+    scalarRow(a + x * 4, b + x * 4, pixels - x, channels, compared, stats);
+}
+
+#endif
+
+const char *imageDiffSimdName()
+{
+#if IMAGE_DIFF_X86
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#elif IMAGE_DIFF_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+static RowFunction simdRow()
+{
+#if IMAGE_DIFF_X86
+    return __builtin_cpu_supports("avx2") ? avx2Row : sse2Row;
+#elif IMAGE_DIFF_NEON
+    return neonRow;
+#else
+    return scalarRow;
+#endif
+}
+
+double ImageDiffResult::mse() const
+{
+    return samples ? (double)squaredError / samples : 0.0;
+}
+
+double ImageDiffResult::psnr() const
+{
+    if (squaredError == 0)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    return 10.0 * log10(255.0 * 255.0 / mse());
+}
+
+// Number of channels that are compared
+static int comparedChannels(const image::Image& image, const ImageDiffOptions& options)
+{
+    const bool hasAlpha = image.channels == 2 || image.channels == 4;
+    return (hasAlpha && !options.alpha) ? image.channels - 1 : image.channels;
+}
+
+static void diffTileRows(RowFunction row, const image::Image& a, const image::Image& b, int compared, ImageDiffResult& result, int first, int last)
+{
+    const int channels = a.channels;
+    for (int ty = first; ty < last; ++ty)
+    {
+        ImageDiffTile *tiles = &result.tiles[(size_t)ty * result.tilesX];
+        const unsigned yEnd = std::min(result.height, (unsigned)(ty + 1) * result.tileSize);
+        for (unsigned y = (unsigned)ty * result.tileSize; y < yEnd; ++y)
+        {
+            const unsigned char *rowA = a.start() + (ptrdiff_t)y * a.stride();
+            const unsigned char *rowB = b.start() + (ptrdiff_t)y * b.stride();
+            for (int tx = 0; tx < result.tilesX; ++tx)
+            {
+                const unsigned x = (unsigned)tx * result.tileSize;
+                const int pixels = std::min((unsigned)result.tileSize, result.width - x);
+                row(rowA + (size_t)x * channels, rowB + (size_t)x * channels, pixels, channels, compared, tiles[tx]);
+            }
+        }
+    }
+}
+
+// Images smaller than this are not worth starting threads for
+static const int MIN_PIXELS_PER_THREAD = 256 * 1024;
+
+bool diffImages(const image::Image& a, const image::Image& b, const ImageDiffOptions& options, ImageDiffResult& result)
+{
+    if (a.width != b.width || a.height != b.height || a.channels != b.channels)
+    {
+        return false;
+    }
+
+    result = ImageDiffResult();
+    result.width = a.width;
+    result.height = a.height;
+    result.tileSize = (options.tileSize > 0) ? options.tileSize : std::max(1u, std::max(a.width, a.height));
+    result.tilesX = (a.width + result.tileSize - 1) / result.tileSize;
+    result.tilesY = (a.height + result.tileSize - 1) / result.tileSize;
+    result.tiles.resize((size_t)result.tilesX * result.tilesY);
+
+    const int compared = comparedChannels(a, options);
+    const RowFunction row = (options.kernel == IMAGE_DIFF_KERNEL_SIMD && a.channels == 4) ? simdRow() : scalarRow;
+
+    int threads = options.threads;
+    if (threads <= 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max(1, std::min({threads, result.tilesY, (int)((long long)a.width * a.height / MIN_PIXELS_PER_THREAD)}));
+
+    // Every thread takes a band of tile rows, so that no two threads write the same tile
+    const int band = (result.tilesY + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (int first = band; first < result.tilesY; first += band)
+    {
+        workers.emplace_back(diffTileRows, row, std::cref(a), std::cref(b), compared, std::ref(result), first, std::min(first + band, result.tilesY));
+    }
+    diffTileRows(row, a, b, compared, result, 0, std::min(band, result.tilesY));
+    for (std::thread &t : workers)
+    {
+        t.join();
+    }
+
+    for (const ImageDiffTile& tile : result.tiles)
+    {
+        result.squaredError += tile.squaredError;
+        result.differentPixels += tile.differentPixels;
+        result.maxError = std::max(result.maxError, tile.maxError);
+    }
+    result.samples = (uint64_t)a.width * a.height * compared;
+    return true;
+}
+
+image::Image *diffImage(const image::Image& a, const image::Image& b, const ImageDiffOptions& options, int gain)
+{
+    if (a.width != b.width || a.height != b.height || a.channels != b.channels)
+    {
+        return NULL;
+    }
+
+    const int channels = a.channels;
+    const int compared = comparedChannels(a, options);
+    image::Image *diff = new image::Image(a.width, a.height, 4);
+    unsigned char *out = diff->pixels;
+    for (unsigned y = 0; y < a.height; ++y)
+    {
+        const unsigned char *rowA = a.start() + (ptrdiff_t)y * a.stride();
+        const unsigned char *rowB = b.start() + (ptrdiff_t)y * b.stride();
+        for (unsigned x = 0; x < a.width; ++x, rowA += channels, rowB += channels, out += 4)
+        {
+            int error = 0;
+            for (int c = 0; c < compared; ++c)
+            {
+                error = std::max(error, abs(rowA[c] - rowB[c]));
+            }
+            const unsigned char value = std::min(255, error * gain);
+            out[0] = out[1] = out[2] = value;
+            out[3] = 255;
+        }
+    }
+    return diff;
+}
+
+// Colour of a tile: black for no error, then from dark blue over red to yellow
+static void heatColour(unsigned maxError, unsigned char *rgba)
+{
+    // Any error at all should stand out from the tiles without
+    const int level = maxError ? 64 + (int)maxError * 191 / 255 : 0;
+    if (level < 128)
+    {
+        rgba[0] = 0;
+        rgba[1] = 0;
+        rgba[2] = level * 2;
+    }
+    else if (level < 192)
+    {
+        rgba[0] = (level - 128) * 4;
+        rgba[1] = 0;
+        rgba[2] = 255 - (level - 128) * 4;
+    }
+    else
+    {
+        rgba[0] = 255;
+        rgba[1] = std::min(255, (level - 192) * 4);
+        rgba[2] = 0;
+    }
+    rgba[3] = 255;
+}
+
+image::Image *heatmapImage(const ImageDiffResult& result)
+{
+    image::Image *heatmap = new image::Image(result.width, result.height, 4);
+    std::vector<unsigned char> colours(result.tiles.size() * 4);
+    for (size_t i = 0; i < result.tiles.size(); ++i)
+    {
+        heatColour(result.tiles[i].maxError, &colours[i * 4]);
+    }
+    unsigned char *out = heatmap->pixels;
+    for (unsigned y = 0; y < result.height; ++y)
+    {
+        const unsigned char *row = colours.data() + (size_t)(y / result.tileSize) * result.tilesX * 4;
+        for (unsigned x = 0; x < result.width; ++x, out += 4)
+        {
+            const unsigned char *colour = row + (x / result.tileSize) * 4;
+            std::copy(colour, colour + 4, out);
+        }
+    }
+    return heatmap;
+}
@@ -0,0 +1,69 @@
+#ifndef _TOOL_IMAGE_DIFF_HPP_
+#define _TOOL_IMAGE_DIFF_HPP_
+
+// Per pixel comparison of two 8 bit images of the same size, used by imgdiff.
+//
+// The error of a sample is the absolute difference of the two values. Errors are
+// summed over the whole image (for the MSE and PSNR), and over square tiles, so
+// that the regions that changed can be found without looking at every pixel.
+// Alpha is left out unless asked for, as most snapshots do not care about it.
+
+#include "common/image.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+enum ImageDiffKernel
+{
+    IMAGE_DIFF_KERNEL_SCALAR, // one sample at a time, any number of channels
+    IMAGE_DIFF_KERNEL_SIMD,   // best instruction set available (SSE2/AVX2 or NEON), RGBA only
+};
+
+/// Name of the instruction set used by IMAGE_DIFF_KERNEL_SIMD, e.g. "avx2" or "scalar"
+const char *imageDiffSimdName();
+
+struct ImageDiffOptions
+{
+    bool alpha = false;   // also compare the last channel of RGBA and gray+alpha images
+    int tileSize = 32;    // width and height of the tiles of ImageDiffResult::tiles
+    int threads = 0;      // 0 uses all cores for large images
+    ImageDiffKernel kernel = IMAGE_DIFF_KERNEL_SIMD;
+};
+
+struct ImageDiffTile
+{
+    uint64_t squaredError = 0;
+    uint64_t differentPixels = 0;
+    unsigned maxError = 0;
+};
+
+struct ImageDiffResult
+{
+    unsigned width = 0;
+    unsigned height = 0;
+    int tileSize = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<ImageDiffTile> tiles; // tilesX * tilesY, row by row from the top
+
+    uint64_t squaredError = 0;
+    uint64_t samples = 0;          // number of values compared
+    uint64_t differentPixels = 0;  // pixels with at least one compared value that differs
+    unsigned maxError = 0;
+
+    double mse() const;
+    /// Peak signal to noise ratio in dB, infinite for identical images
+    double psnr() const;
+};
+
+/// Compare two images. Returns false if they do not have the same size and channels.
+bool diffImages(const image::Image& a, const image::Image& b, const ImageDiffOptions& options, ImageDiffResult& result);
+
+/// RGBA image of the largest error of the compared values of each pixel, multiplied by gain
+image::Image *diffImage(const image::Image& a, const image::Image& b, const ImageDiffOptions& options, int gain = 8);
+
+/// RGBA image of the size of the compared images, with every tile coloured by its largest
+/// error, from black (identical) over blue and red to yellow (an error of 255)
+image::Image *heatmapImage(const ImageDiffResult& result);
+
+#endif
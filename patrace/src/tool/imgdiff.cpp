@@ -0,0 +1,436 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "json/writer.h"
+
+#include "common/image.hpp"
+#include "tool/config.hpp"
+#include "tool/image_diff.hpp"
+
+static void printHelp()
+{
+    std::cout <<
+        "Usage : imgdiff [OPTIONS] <reference> <result>\n"
+        "Compares the snapshots of two runs. <reference> and <result> are either both directories,\n"
+        "in which case every PNG file of <reference> is compared to the file of the same name in\n"
+        "<result>, or both text files with one PNG file name per line, compared line by line.\n"
+        "Options:\n"
+        "  -j <threads> number of threads, 0 for all cores (default)\n"
+        "  -tile <size> width and height of the tiles errors are summed over (default 32)\n"
+        "  -tolerance <error> largest error of a value for the images to still count as equal (default 0)\n"
+        "  -alpha compare the alpha channel too\n"
+        "  -json <file> write the results as JSON\n"
+        "  -csv <file> write the results as CSV\n"
+        "  -diff <directory> write <name>_diff.png and <name>_heatmap.png for every image that differs\n"
+        "  -h print help\n"
+        "  -v print version\n"
+        "Returns 0 if all images are equal, 1 otherwise.\n"
+        ;
+}
+
+static void printVersion()
+{
+    std::cout << PATRACE_VERSION << std::endl;
+}
+
+struct ImagePair
+{
+    std::string name;
+    std::string reference;
+    std::string result;
+
+    enum Status { EQUAL, DIFFERENT, MISSING, UNREADABLE, SIZE_MISMATCH } status = MISSING;
+    ImageDiffResult diff;
+    int worstTile = -1;
+};
+
+static const char *statusName(ImagePair::Status status)
+{
+    switch (status)
+    {
+    case ImagePair::EQUAL: return "equal";
+    case ImagePair::DIFFERENT: return "different";
+    case ImagePair::MISSING: return "missing";
+    case ImagePair::UNREADABLE: return "unreadable";
+    case ImagePair::SIZE_MISMATCH: return "size mismatch";
+    }
+    return "";
+}
+
+static bool isDirectory(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool fileExists(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+static std::string baseName(const std::string& path)
+{
+    const size_t slash = path.find_last_of('/');
+    return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+static std::string stem(const std::string& name)
+{
+    const size_t dot = name.find_last_of('.');
+    return (dot == std::string::npos) ? name : name.substr(0, dot);
+}
+
+static bool listDirectory(const std::string& reference, const std::string& result, std::vector<ImagePair>& pairs)
+{
+    DIR *dir = opendir(reference.c_str());
+    if (!dir)
+    {
+        printf("Error: Failed to open directory %s\n", reference.c_str());
+        return false;
+    }
+    std::vector<std::string> names;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        const std::string name = ent->d_name;
+        if (name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".png") == 0)
+        {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const std::string& name : names)
+    {
+        ImagePair pair;
+        pair.name = name;
+        pair.reference = reference + "/" + name;
+        pair.result = result + "/" + name;
+        pairs.push_back(pair);
+    }
+    return true;
+}
+
+static bool readList(const std::string& filename, std::vector<std::string>& files)
+{
+    std::ifstream list(filename);
+    if (!list)
+    {
+        printf("Error: Failed to open %s\n", filename.c_str());
+        return false;
+    }
+    std::string line;
+    while (std::getline(list, line))
+    {
+        if (!line.empty())
+        {
+            files.push_back(line);
+        }
+    }
+    return true;
+}
+
+static bool listFiles(const std::string& reference, const std::string& result, std::vector<ImagePair>& pairs)
+{
+    std::vector<std::string> referenceFiles;
+    std::vector<std::string> resultFiles;
+    if (!readList(reference, referenceFiles) || !readList(result, resultFiles))
+    {
+        return false;
+    }
+    if (referenceFiles.size() != resultFiles.size())
+    {
+        printf("Warning: %s lists %u files, but %s lists %u\n", reference.c_str(), (unsigned)referenceFiles.size(), result.c_str(), (unsigned)resultFiles.size());
+    }
+    for (size_t i = 0; i < referenceFiles.size(); ++i)
+    {
+        ImagePair pair;
+        pair.name = baseName(referenceFiles[i]);
+        pair.reference = referenceFiles[i];
+        pair.result = (i < resultFiles.size()) ? resultFiles[i] : "";
+        pairs.push_back(pair);
+    }
+    return true;
+}
+
+static void compare(ImagePair& pair, const ImageDiffOptions& options, int tolerance, const std::string& diffDir)
+{
+    if (pair.result.empty() || !fileExists(pair.result) || !fileExists(pair.reference))
+    {
+        pair.status = ImagePair::MISSING;
+        return;
+    }
+    std::unique_ptr<image::Image> reference(image::readPNG(pair.reference.c_str()));
+    std::unique_ptr<image::Image> result(image::readPNG(pair.result.c_str()));
+    if (!reference || !result)
+    {
+        pair.status = ImagePair::UNREADABLE;
+        return;
+    }
+    if (!diffImages(*reference, *result, options, pair.diff))
+    {
+        pair.status = ImagePair::SIZE_MISMATCH;
+        return;
+    }
+    for (size_t i = 0; i < pair.diff.tiles.size(); ++i)
+    {
+        if (pair.worstTile < 0 || pair.diff.tiles[i].squaredError > pair.diff.tiles[pair.worstTile].squaredError)
+        {
+            pair.worstTile = i;
+        }
+    }
+    pair.status = ((int)pair.diff.maxError > tolerance) ? ImagePair::DIFFERENT : ImagePair::EQUAL;
+
+    if (pair.status == ImagePair::DIFFERENT && !diffDir.empty())
+    {
+        const std::string prefix = diffDir + "/" + stem(pair.name);
+        std::unique_ptr<image::Image> diff(diffImage(*reference, *result, options));
+        std::unique_ptr<image::Image> heatmap(heatmapImage(pair.diff));
+        if (!diff->writePNG((prefix + "_diff.png").c_str()) || !heatmap->writePNG((prefix + "_heatmap.png").c_str()))
+        {
+            printf("Warning: Failed to write the difference images of %s to %s\n", pair.name.c_str(), diffDir.c_str());
+        }
+    }
+}
+
+static Json::Value toJson(const ImagePair& pair)
+{
+    Json::Value v;
+    v["name"] = pair.name;
+    v["reference"] = pair.reference;
+    v["result"] = pair.result;
+    v["status"] = statusName(pair.status);
+    if (pair.status == ImagePair::EQUAL || pair.status == ImagePair::DIFFERENT)
+    {
+        const ImageDiffResult& diff = pair.diff;
+        v["width"] = diff.width;
+        v["height"] = diff.height;
+        // JSON has no infinity: identical images have a null PSNR
+        v["psnr"] = std::isinf(diff.psnr()) ? Json::Value() : Json::Value(diff.psnr());
+        v["mse"] = diff.mse();
+        v["max_error"] = diff.maxError;
+        v["different_pixels"] = (Json::Value::UInt64)diff.differentPixels;
+        v["tile_size"] = diff.tileSize;
+        v["tiles_x"] = diff.tilesX;
+        v["tiles_y"] = diff.tilesY;
+        Json::Value tiles = Json::arrayValue;
+        for (const ImageDiffTile& tile : diff.tiles)
+        {
+            tiles.append(tile.maxError);
+        }
+        v["tile_max_error"] = tiles;
+    }
+    return v;
+}
+
+static bool writeJson(const std::vector<ImagePair>& pairs, const ImageDiffOptions& options, int tolerance, const std::string& filename)
+{
+    Json::Value result;
+    result["simd"] = (options.kernel == IMAGE_DIFF_KERNEL_SIMD) ? imageDiffSimdName() : "scalar";
+    result["alpha"] = options.alpha;
+    result["tolerance"] = tolerance;
+    result["images"] = Json::arrayValue;
+    for (const ImagePair& pair : pairs)
+    {
+        result["images"].append(toJson(pair));
+    }
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "   ";
+    std::ofstream outputFileStream(filename);
+    if (!outputFileStream)
+    {
+        return false;
+    }
+    std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+    writer->write(result, &outputFileStream);
+    return true;
+}
+
+static bool writeCsv(const std::vector<ImagePair>& pairs, const std::string& filename)
+{
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (!fp)
+    {
+        return false;
+    }
+    fprintf(fp, "name,status,width,height,psnr,mse,max_error,different_pixels,worst_tile_x,worst_tile_y\n");
+    for (const ImagePair& pair : pairs)
+    {
+        fprintf(fp, "%s,%s", pair.name.c_str(), statusName(pair.status));
+        if (pair.status == ImagePair::EQUAL || pair.status == ImagePair::DIFFERENT)
+        {
+            const ImageDiffResult& diff = pair.diff;
+            const int tile = std::max(pair.worstTile, 0);
+            fprintf(fp, ",%u,%u,%.4f,%.6f,%u,%llu,%d,%d", diff.width, diff.height, diff.psnr(), diff.mse(), diff.maxError,
+                    (unsigned long long)diff.differentPixels, tile % std::max(diff.tilesX, 1), tile / std::max(diff.tilesX, 1));
+        }
+        else
+        {
+            fprintf(fp, ",,,,,,,,");
+        }
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    ImageDiffOptions options;
+    int threads = 0;
+    int tolerance = 0;
+    std::string jsonFile;
+    std::string csvFile;
+    std::string diffDir;
+    std::vector<std::string> paths;
+
+    for (int argIndex = 1; argIndex < argc; ++argIndex)
+    {
+        const char *arg = argv[argIndex];
+        const bool hasValue = argIndex + 1 < argc;
+
+        if (!strcmp(arg, "-h"))
+        {
+            printHelp();
+            return 1;
+        }
+        else if (!strcmp(arg, "-v"))
+        {
+            printVersion();
+            return 0;
+        }
+        else if (!strcmp(arg, "-j") && hasValue)
+        {
+            threads = atoi(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-tile") && hasValue)
+        {
+            options.tileSize = atoi(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-tolerance") && hasValue)
+        {
+            tolerance = atoi(argv[++argIndex]);
+        }
+        else if (!strcmp(arg, "-alpha"))
+        {
+            options.alpha = true;
+        }
+        else if (!strcmp(arg, "-json") && hasValue)
+        {
+            jsonFile = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-csv") && hasValue)
+        {
+            csvFile = argv[++argIndex];
+        }
+        else if (!strcmp(arg, "-diff") && hasValue)
+        {
+            diffDir = argv[++argIndex];
+        }
+        else if (arg[0] != '-')
+        {
+            paths.push_back(arg);
+        }
+        else
+        {
+            printf("Error: Unknow option %s\n", arg);
+            printHelp();
+            return 1;
+        }
+    }
+
+    if (paths.size() != 2)
+    {
+        printf("Error: A reference and a result are required.\n");
+        printHelp();
+        return 1;
+    }
+
+    std::vector<ImagePair> pairs;
+    const bool directories = isDirectory(paths[0]);
+    if (directories != isDirectory(paths[1]))
+    {
+        printf("Error: %s and %s must both be directories or both be lists of files\n", paths[0].c_str(), paths[1].c_str());
+        return 1;
+    }
+    if (!(directories ? listDirectory(paths[0], paths[1], pairs) : listFiles(paths[0], paths[1], pairs)))
+    {
+        return 1;
+    }
+    if (!diffDir.empty() && !isDirectory(diffDir))
+    {
+        printf("Error: %s is not a directory\n", diffDir.c_str());
+        return 1;
+    }
+
+    // Images are decoded and compared on worker threads, one pair at a time each. With
+    // fewer pairs than threads, the comparison of every image uses the threads left over.
+    if (threads <= 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const int workers = std::max(1, std::min(threads, (int)pairs.size()));
+    options.threads = std::max(1, threads / workers);
+
+    std::atomic<size_t> next(0);
+    auto work = [&]()
+    {
+        for (size_t i = next++; i < pairs.size(); i = next++)
+        {
+            compare(pairs[i], options, tolerance, diffDir);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < workers; ++i)
+    {
+        pool.emplace_back(work);
+    }
+    work();
+    for (std::thread &t : pool)
+    {
+        t.join();
+    }
+
+    int failed = 0;
+    for (const ImagePair& pair : pairs)
+    {
+        if (pair.status == ImagePair::EQUAL || pair.status == ImagePair::DIFFERENT)
+        {
+            printf("%-40s %-10s psnr %8.3f max error %3u different pixels %llu\n", pair.name.c_str(), statusName(pair.status),
+                   pair.diff.psnr(), pair.diff.maxError, (unsigned long long)pair.diff.differentPixels);
+        }
+        else
+        {
+            printf("%-40s %s\n", pair.name.c_str(), statusName(pair.status));
+        }
+        failed += (pair.status != ImagePair::EQUAL);
+    }
+    printf("%d of %u images differ or could not be compared\n", failed, (unsigned)pairs.size());
+
+    if (!jsonFile.empty() && !writeJson(pairs, options, tolerance, jsonFile))
+    {
+        printf("Error: Failed to write %s\n", jsonFile.c_str());
+        return 1;
+    }
+    if (!csvFile.empty() && !writeCsv(pairs, csvFile))
+    {
+        printf("Error: Failed to write %s\n", csvFile.c_str());
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
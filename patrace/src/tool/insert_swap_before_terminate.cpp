@@ -37,11 +37,7 @@ static unsigned _curCallIndexInFrame = 0;
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call, bool injected = false)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest, -1, injected);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile, -1, injected);
 }
 
 static common::CallTM* next_call(common::TraceFileTM &_fileTM)
@@ -168,11 +168,7 @@ bool ParseInterface::open(const std::string& input, const std::string& output)
 
 void ParseInterface::writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
 static void unbind_renderbuffers_if(StateTracker::Context& context, const int fb_index, bool renderBuffer, GLuint id)
@@ -426,6 +422,55 @@ void ParseInterfaceBase::check_enum(const std::string& callname, GLenum value)
     }
 }
 
+void ParseInterfaceBase::create_context(int id, int display, int share)
+{
+    context_remapping[id] = contexts.size(); // generate id<->idx table
+    if (share && context_remapping.count(share) > 0)
+    {
+        int share_idx = UNBOUND;
+        int share_id = share;
+        // Find root context, since sharing can be transitive
+        do {
+            share_idx = context_remapping.at(share_id);
+            share_id = contexts.at(share_idx).share_context;
+        } while (share_id != 0);
+        contexts.emplace_back(id, display, contexts.size(), share, &contexts.at(share_idx));
+    } else {
+        contexts.emplace_back(id, display, contexts.size());
+    }
+}
+
+void ParseInterfaceBase::make_current_context(int tid, int context)
+{
+    if (context == (int64_t)EGL_NO_CONTEXT)
+    {
+        current_context[tid] = UNBOUND;
+        context_index = UNBOUND;
+    }
+    else if (context_remapping.count(context) > 0)
+    {
+        context_index = context_remapping.at(context);
+        current_context[tid] = context_index;
+        contexts[context_index].swaps.insert(frames);
+    }
+}
+
+void ParseInterfaceBase::create_shader(GLuint id, GLenum type)
+{
+    StateTracker::Shader& s = contexts[context_index].shaders.add(id);
+    s.shader_type = type;
+}
+
+void ParseInterfaceBase::delete_shader(GLuint id)
+{
+    // "DeleteShader will silently ignore the value zero". Also, some content assumes it will also
+    // ignore invalid values, even though the standard does not guarantee this.
+    if (id != 0)
+    {
+        contexts[context_index].shaders.remove(id);
+    }
+}
+
 void ParseInterfaceBase::interpret_call(common::CallTM *call)
 {
     // Check versions and extensions used
@@ -461,17 +506,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
             abort();
         }
 
-        if (context == (int64_t)EGL_NO_CONTEXT)
-        {
-            current_context[call->mTid] = UNBOUND;
-            context_index = UNBOUND;
-        }
-        else if (context_remapping.count(context) > 0)
-        {
-            context_index = context_remapping.at(context);
-            current_context[call->mTid] = context_index;
-            contexts[context_index].swaps.insert(frames);
-        }
+        make_current_context(call->mTid, context);
 
         if (surface == (int64_t)EGL_NO_SURFACE)
         {
@@ -500,20 +535,7 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         int mret = call->mRet.GetAsInt();
         int display = call->mArgs[0]->GetAsInt();
         int share = call->mArgs[2]->GetAsInt();
-        context_remapping[mret] = contexts.size(); // generate id<->idx table
-        if (share && context_remapping.count(share) > 0)
-        {
-            int share_idx = UNBOUND;
-            int share_id = share;
-            // Find root context, since sharing can be transitive
-            do {
-                share_idx = context_remapping.at(share_id);
-                share_id = contexts.at(share_idx).share_context;
-            } while (share_id != 0);
-            contexts.emplace_back(mret, display, contexts.size(), share, &contexts.at(share_idx));
-        } else {
-            contexts.emplace_back(mret, display, contexts.size());
-        }
+        create_context(mret, display, share);
     }
     else if (call->mCallName == "eglGetConfigAttrib")
     {
@@ -1942,18 +1964,12 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
     {
         GLuint id = call->mRet.GetAsUInt();
         GLenum type = call->mArgs[0]->GetAsInt();
-        StateTracker::Shader& s = contexts[context_index].shaders.add(id);
-        s.shader_type = type;
+        create_shader(id, type);
     }
     else if (call->mCallName == "glDeleteShader")
     {
         GLuint id = call->mArgs[0]->GetAsUInt();
-        // "DeleteShader will silently ignore the value zero". Also, some content assumes it will also
-        // ignore invalid values, even though the standard does not guarantee this.
-        if (id != 0)
-        {
-            contexts[context_index].shaders.remove(id);
-        }
+        delete_shader(id);
     }
     else if (call->mCallName == "glLinkProgram" || call->mCallName == "glLinkProgram2")
     {
@@ -2000,17 +2016,16 @@ void ParseInterfaceBase::interpret_call(common::CallTM *call)
         StateTracker::Shader& s = contexts[context_index].shaders[target_shader_index];
         s.source_code = code; // original shader
         s.call = call->mCallNo;
-        GLSLParser parser;
-        std::string stripped = parser.strip_comments(code);
-        GLSLShader sh = parser.preprocessor(stripped, s.shader_type);
+        const GLSLAnalysis& analysis = glsl_cache.analyze(code, s.shader_type);
+        const GLSLShader& sh = analysis.shader;
         if (sh.version / 10 > highest_gles_version && highest_gles_version > 10)
         {
             DBG_LOG("The use of shader in call %d increases GLES version from %d to %d\n", (int)call->mCallNo, (int)highest_gles_version, (int)sh.version / 10);
             highest_gles_version = sh.version / 10;
         }
-        s.source_compressed = parser.compressed(sh);
+        s.source_compressed = analysis.compressed;
         s.source_preprocessed = sh.code;
-        GLSLRepresentation repr = parser.parse(sh);
+        const GLSLRepresentation& repr = analysis.repr;
         s.contains_invariants = repr.contains_invariants;
         s.contains_optimize_off_pragma = sh.contains_optimize_off_pragma;
         s.contains_debug_on_pragma = sh.contains_debug_on_pragma;
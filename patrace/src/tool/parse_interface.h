@@ -23,6 +23,7 @@
 #include "common/os.hpp"
 #include "eglstate/context.hpp"
 #include "tool/config.hpp"
+#include "tool/glsl_cache.h"
 #include "base/base.hpp"
 
 /// Large negative index number to encourage crashing if used improperly.
@@ -752,6 +753,11 @@ public:
     void setRenderpassJSON(bool value) { mRenderpassJSON = value; }
     void setDebug(bool debug) { mDebug = debug; }
     void interpret_call(common::CallTM *call);
+    // Parts of interpret_call, for tools that follow only the calls that they need
+    void create_context(int id, int display, int share);
+    void make_current_context(int tid, int context);
+    void create_shader(GLuint id, GLenum type);
+    void delete_shader(GLuint id);
     void check_enum(const std::string& callname, GLenum value);
 
     std::deque<StateTracker::Context> contexts; // using deque to avoid moving contents around in memory, invalidating pointers
@@ -790,6 +796,8 @@ public:
     };
     std::map<std::string, callstat> callstats;
 
+    GLSLCache glsl_cache; // analysis of each shader source uploaded so far
+
 private:
     bool find_duplicate_clears(const StateTracker::FillState& f, const StateTracker::Attachment& at, GLenum type, StateTracker::Framebuffer& fbo, const std::string& call);
     void setEglConfig(StateTracker::EglConfig& config, int attribute, int value);
@@ -827,7 +835,7 @@ public:
     virtual void writeout(common::OutFile &outputFile, common::CallTM *call);
 
     common::InFile inputFile;
-    common::OutFile outputFile = "trace";
+    common::OutFile outputFile{"trace"};
     common::CallTM *mCall = nullptr;
 
 private:
@@ -76,11 +76,7 @@ void makeProgress(int counter, int total, bool forcePrint)
 
 void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
 void GlesFilePath::setId()
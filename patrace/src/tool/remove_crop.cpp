@@ -5,6 +5,9 @@
 #include <set>
 #include <unordered_map>
 #include "base/base.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/parse_api.hpp"
+#include "common/raw_call_reader.hpp"
 #include "common/trace_model.hpp"
 #include "common/out_file.hpp"
 #include "tool/config.hpp"
@@ -26,15 +29,6 @@ static void printHelp(const char *argv0)
          << "  -h    Print help\n";
 }
 
-static void writeout(common::OutFile &outputFile, common::CallTM *call, int overrideFuncID)
-{
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer, overrideFuncID);
-    outputFile.Write(buffer, dest-buffer);
-}
-
 map<int, string> AndroidImageCropAttribToNameMap;
 
 void makeMap()
@@ -133,27 +127,21 @@ int main(int argc, char **argv)
     string source_name = argv[argIndex++];
     string target_name = argv[argIndex++];
 
-    common::TraceFileTM source_file;
+    common::InFile source_file;
+    common::gApiInfo.RegisterEntries(common::parse_callbacks);
     if (!source_file.Open(source_name.c_str()))
     {
         PAT_DEBUG_LOG("Failed to open pat file %s for extracting.\n", source_name.c_str());
         return 1;
     }
-    Json::Value json_value = source_file.mpInFileRA->getJSONHeader();
+    Json::Value json_value = source_file.getJSONHeader();
     Json::FastWriter header_writer;
     const std::string json_header = header_writer.write(json_value);
 
-    vector<string> sigbook;
-    unordered_map<string, unsigned int> NameToId;
-    source_file.mpInFileRA->copySigBook(sigbook);
-    for (vector<string>::size_type i = 0; i < sigbook.size(); ++i) {
-        NameToId[sigbook[i]] = i;
-    }
-
     /**********************************************************************/
 
     common::OutFile target_file;
-    if (!target_file.Open(target_name.c_str(), true, &sigbook))
+    if (!target_file.Open(target_name.c_str(), true, &source_file.getFuncNames()))
     {
         PAT_DEBUG_LOG("Failed to open pat file %s merging to.\n", target_name.c_str());
         return 1;
@@ -161,21 +149,19 @@ int main(int argc, char **argv)
     target_file.mHeader.jsonLength = json_header.size();
     target_file.WriteHeader(json_header.c_str(), json_header.size());
 
-    common::CallTM *call = NULL;
-    while ((call = source_file.NextCall())) {
-        auto iter = NameToId.find(call->mCallName);
-        int oldFuncId = -1;
-        if (iter != NameToId.end()) {
-            oldFuncId = iter->second;
+    // Only eglCreateImageKHR is changed, everything else is copied as it is
+    const unsigned short createImageId = source_file.NameToExId("eglCreateImageKHR");
+    common::RawCallReader reader(source_file);
+    while (reader.next()) {
+        if (reader.funcId() == createImageId) {
+            common::CallTM *call = reader.decode();
+            process_eglCreateImageKHR(call);
+            reader.write(target_file, *call);
+            delete call;
         }
         else {
-            PAT_DEBUG_LOG("Cannot find function (%s), %s, %d\n", call->mCallName.c_str(), iter->first.c_str(), iter->second);
-        }
-
-        if (call->mCallName == "eglCreateImageKHR") {
-            process_eglCreateImageKHR(call);
+            reader.copyTo(target_file);
         }
-        writeout(target_file, call, oldFuncId);
     }
 
     source_file.Close();
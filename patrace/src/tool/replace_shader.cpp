@@ -39,11 +39,7 @@ static void printVersion()
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
 int main(int argc, char **argv)
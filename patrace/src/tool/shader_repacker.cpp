@@ -44,11 +44,7 @@ static void printVersion()
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile);
 }
 
 static std::string shader_filename(const StateTracker::Shader &shader, int context_index, int program_index)
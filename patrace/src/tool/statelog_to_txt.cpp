@@ -0,0 +1,91 @@
+// Convert a binary state log (see helper/state_log_format.hpp) into the text
+// state log format, so that logs from both modes can be diffed.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "helper/state_log_format.hpp"
+
+using namespace statelog;
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "Usage: %s <binary state log> [<text state log>]\n"
+        "Convert a binary state log into the text format. Writes to stdout if no output file is given.\n"
+        "\n"
+        "  -h            print help\n"
+        "  -v            print version\n"
+        , argv0);
+}
+
+int main(int argc, char **argv)
+{
+    int argIndex = 1;
+    for (; argIndex < argc; ++argIndex)
+    {
+        const char *arg = argv[argIndex];
+
+        if (arg[0] != '-')
+        {
+            break;
+        }
+        else if (!strcmp(arg, "-h"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (!strcmp(arg, "-v"))
+        {
+            printf("Binary state log version: %u\n", VERSION);
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", arg);
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argIndex + 1 != argc && argIndex + 2 != argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[argIndex], "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", argv[argIndex], strerror(errno));
+        return 1;
+    }
+    FILE *out = stdout;
+    if (argIndex + 2 == argc)
+    {
+        out = fopen(argv[argIndex + 1], "wb");
+        if (!out)
+        {
+            fprintf(stderr, "Failed to open %s: %s\n", argv[argIndex + 1], strerror(errno));
+            return 1;
+        }
+    }
+
+    std::string error;
+    const bool ok = convertToText(in, out, error);
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to convert %s: %s\n", argv[argIndex], error.c_str());
+    }
+
+    fclose(in);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return ok ? 0 : 1;
+}
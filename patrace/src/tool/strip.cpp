@@ -4,11 +4,12 @@
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
 
-#include "common/in_file.hpp"
+#include "common/in_file_mt.hpp"
 #include "common/file_format.hpp"
 #include "common/out_file.hpp"
 #include "common/api_info.hpp"
 #include "common/parse_api.hpp"
+#include "common/raw_call_reader.hpp"
 #include "common/trace_model.hpp"
 #include "common/os.hpp"
 #include "eglstate/context.hpp"
@@ -32,36 +33,6 @@ static void printVersion()
     std::cout << PATRACE_VERSION << std::endl;
 }
 
-static common::FrameTM* _curFrame = NULL;
-static unsigned _curFrameIndex = 0;
-static unsigned _curCallIndexInFrame = 0;
-
-static void writeout(common::OutFile &outputFile, common::CallTM *call)
-{
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-    char *dest = buffer;
-    dest = call->Serialize(dest);
-    outputFile.Write(buffer, dest-buffer);
-}
-
-static common::CallTM* next_call(common::TraceFileTM &_fileTM)
-{
-    if (_curCallIndexInFrame >= _curFrame->GetLoadedCallCount())
-    {
-        _curFrameIndex++;
-        if (_curFrameIndex >= _fileTM.mFrames.size())
-            return NULL;
-        if (_curFrame) _curFrame->UnloadCalls();
-        _curFrame = _fileTM.mFrames[_curFrameIndex];
-        _curFrame->LoadCalls(_fileTM.mpInFileRA);
-        _curCallIndexInFrame = 0;
-    }
-    common::CallTM *call = _curFrame->mCalls[_curCallIndexInFrame];
-    _curCallIndexInFrame++;
-    return call;
-}
-
 int main(int argc, char **argv)
 {
     int argIndex = 1;
@@ -99,24 +70,23 @@ int main(int argc, char **argv)
     const char* source_trace_filename = argv[argIndex++];
     const char* target_trace_filename = argv[argIndex++];
 
-    common::TraceFileTM inputFile;
+    common::InFile inputFile;
     common::gApiInfo.RegisterEntries(common::parse_callbacks);
     if (!inputFile.Open(source_trace_filename))
     {
         PAT_DEBUG_LOG("Failed to open for reading: %s\n", source_trace_filename);
         return 1;
     }
-    _curFrame = inputFile.mFrames[0];
-    _curFrame->LoadCalls(inputFile.mpInFileRA);
 
+    // Surviving calls are copied as they are, so keep the function ids of the input
     common::OutFile outputFile;
-    if (!outputFile.Open(target_trace_filename))
+    if (!outputFile.Open(target_trace_filename, true, &inputFile.getFuncNames()))
     {
         PAT_DEBUG_LOG("Failed to open for writing: %s\n", target_trace_filename);
         return 1;
     }
 
-    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
+    Json::Value header = inputFile.getJSONHeader();
     Json::Value info;
     info["thread_removed"] = badtid;
     addConversionEntry(header, "strip", source_trace_filename, info);
@@ -125,13 +95,13 @@ int main(int argc, char **argv)
     outputFile.mHeader.jsonLength = json_header.size();
     outputFile.WriteHeader(json_header.c_str(), json_header.size());
 
-    common::CallTM *call = NULL;
+    common::RawCallReader reader(inputFile);
     int removed = 0;
-    while ((call = next_call(inputFile)))
+    while (reader.next())
     {
-        if ((int)call->mTid != badtid)
+        if ((int)reader.tid() != badtid)
         {
-            writeout(outputFile, call);
+            reader.copyTo(outputFile);
         }
         else
         {
@@ -0,0 +1,926 @@
+#include "tool/thread_flattener.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <string.h>
+#include <EGL/egl.h>
+
+#include "common/api_info.hpp"
+#include "common/bounded_queue.hpp"
+#include "common/file_format.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/out_file.hpp"
+#include "common/os.hpp"
+#include "common/parse_api.hpp"
+#include "common/trace_model.hpp"
+#include "tool/utils.hpp"
+#include "json/writer.h"
+
+namespace {
+
+const unsigned int CSB_THREAD_REMAP_BASE = 10000000;
+const unsigned int MAX_THREAD_IDX = 428;
+/// Segments split ahead of the merge
+const size_t QUEUE_SEGMENTS = 4;
+
+enum FlattenCall : unsigned char
+{
+    FLATTEN_COPY,
+    FLATTEN_MAKECURRENT,
+    FLATTEN_SYNC,    // dropped
+    FLATTEN_CSB,     // may refer to a client side buffer
+};
+
+/// What the flattener needs to know about each function of the input, by its id there
+struct CallInfo
+{
+    FlattenCall kind = FLATTEN_COPY;
+    unsigned short outputId = 0;  // 0 if this build does not know the function
+    bool egl = false;
+    bool needsContext = false;
+    bool waits = false;           // the calls queued so far must be written first
+};
+
+/// The argument of a function that holds the name of a client side buffer
+struct CsbArg
+{
+    int index;    // -1 for the return value
+    bool opaque;  // holds one only if it is a ClientSideBufferObjectReferenceType
+};
+
+const std::map<std::string, CsbArg> csbArgs = {
+    { "glCreateClientSideBuffer", { -1, false } },
+    { "glDeleteClientSideBuffer", { 0, false } },
+    { "glClientSideBufferData", { 0, false } },
+    { "glClientSideBufferSubData", { 0, false } },
+    { "glCopyClientSideBuffer", { 1, false } },
+    { "glObjectPtrLabelKHR", { 0, true } },
+    { "glObjectPtrLabel", { 0, true } },
+    { "glDrawArraysIndirect", { 1, true } },
+    { "glMapBufferOES", { 1, true } },
+    { "glNormalPointer", { 2, true } },
+    { "glPointSizePointerOES", { 2, true } },
+    { "glDrawElementsIndirect", { 2, true } },
+    { "glDrawElements", { 3, true } },
+    { "glTexCoordPointer", { 3, true } },
+    { "glVertexPointer", { 3, true } },
+    { "glMatrixIndexPointerOES", { 3, true } },
+    { "glWeightPointerOES", { 3, true } },
+    { "glDrawElementsBaseVertex", { 3, true } },
+    { "glDrawElementsInstancedBaseVertex", { 3, true } },
+    { "glDrawElementsBaseVertexOES", { 3, true } },
+    { "glDrawElementsInstancedBaseVertexOES", { 3, true } },
+    { "glDrawElementsBaseVertexEXT", { 3, true } },
+    { "glDrawElementsInstancedBaseVertexEXT", { 3, true } },
+    { "glDrawElementsInstancedBaseInstanceEXT", { 3, true } },
+    { "glDrawElementsInstancedBaseVertexBaseInstanceEXT", { 3, true } },
+    { "glDrawElementsInstanced", { 3, true } },
+    { "glMapBufferRange", { 3, true } },
+    { "glColorPointer", { 3, true } },
+    { "glVertexAttribIPointer", { 4, true } },
+    { "glVertexAttribPointer", { 5, true } },
+    { "glDrawRangeElementsBaseVertex", { 5, true } },
+    { "glDrawRangeElementsBaseVertexOES", { 5, true } },
+    { "glDrawRangeElementsBaseVertexEXT", { 5, true } },
+    { "glDrawRangeElements", { 5, true } },
+};
+
+const std::unordered_set<std::string> syncFuncs = {
+    "glGetSynciv",
+    "glFenceSync",
+    "glDeleteSync",
+    "glWaitSync",
+    "glClientWaitSync",
+    "glIsSync",
+    "eglTerminate", // to make sure eglTerminate gets called last
+    "eglReleaseThread",
+};
+
+struct ThreadState
+{
+    int display = -1;
+    int draw = -1;
+    int read = -1;
+    int context = -1;
+};
+
+/// A call as read from the input
+struct RawCall
+{
+    common::BCall_vlen header;
+    unsigned callNo;
+    unsigned thread;   // index in the header's thread list
+    uint32_t offset;   // of the arguments in Stream::input
+    uint32_t size;     // of the arguments
+    bool newRun;       // another thread made a call since the previous call in the stream
+};
+
+/// Something that the merge checks in trace order: an eglMakeCurrent, or an error
+struct Event
+{
+    unsigned callNo;
+    int display;
+    const char *error;
+};
+
+/// The calls of one thread in one segment, or of all threads when flattening in sequence
+struct Stream
+{
+    std::vector<char> input;
+    std::vector<RawCall> calls;
+
+    // Filled in by the worker
+    std::vector<char> output;
+    std::vector<Event> events;
+    ThreadState initial;
+    int written = 0;
+    int skipped = 0;
+    bool injected = false;
+};
+
+struct Segment
+{
+    unsigned frame = 0;
+    std::vector<Stream> streams;  // by thread index
+    bool last = false;            // marks the end of the trace, holds no calls
+};
+
+typedef std::shared_ptr<Segment> SegmentPtr;
+typedef common::BoundedQueue<SegmentPtr> SegmentQueue;
+
+/// Turns input calls into output calls. Used from several workers at once.
+class CallWriter
+{
+public:
+    CallWriter(const common::InFile& file, const std::vector<CallInfo>& infos, bool reindex)
+        : mFile(file), mInfos(infos), mReindex(reindex), mDecodeAll(file.getHeaderVersion() < common::HEADER_VERSION_4) {}
+
+    /// Returns an error message, or nullptr
+    const char *write(std::vector<char>& out, const RawCall& call, char *args) const
+    {
+        const CallInfo& info = mInfos[call.header.funcId];
+        if (!mDecodeAll && (info.kind != FLATTEN_CSB || !mReindex))
+        {
+            common::BCall_vlen header = call.header;
+            header.funcId = info.outputId;
+            header.tid = 0;
+            header.errNo = 0;
+            header.reserved = 0;
+            const size_t headerSize = (mFile.mExIdToLen[call.header.funcId] == 0) ? sizeof(common::BCall_vlen) : sizeof(common::BCall);
+            const size_t offset = out.size();
+            out.resize(offset + headerSize + call.size);
+            memcpy(out.data() + offset, &header, headerSize);
+            memcpy(out.data() + offset + headerSize, args, call.size);
+            return nullptr;
+        }
+
+        common::CallTM decoded(mFile, call.callNo, call.header, args);
+        if (mReindex && info.kind == FLATTEN_CSB)
+        {
+            if (const char *error = remap(decoded, call.thread))
+            {
+                return error;
+            }
+        }
+        decoded.mTid = 0;
+        const size_t offset = out.size();
+        out.resize(offset + decoded.SerializedSizeBound());
+        char *end = decoded.Serialize(out.data() + offset);
+        out.resize(end - out.data());
+        return nullptr;
+    }
+
+    void writeMakeCurrent(std::vector<char>& out, const ThreadState& state) const
+    {
+        common::CallTM makeCurrent("eglMakeCurrent");
+        makeCurrent.mArgs.push_back(new common::ValueTM(state.display));
+        makeCurrent.mArgs.push_back(new common::ValueTM(state.draw));
+        makeCurrent.mArgs.push_back(new common::ValueTM(state.read));
+        makeCurrent.mArgs.push_back(new common::ValueTM(state.context));
+        makeCurrent.mRet = common::ValueTM((int)EGL_TRUE);
+        const size_t offset = out.size();
+        out.resize(offset + makeCurrent.SerializedSizeBound());
+        char *end = makeCurrent.Serialize(out.data() + offset, -1, true);
+        out.resize(end - out.data());
+    }
+
+    /// Checks that a call can be flattened at all, before it is written
+    const char *check(const RawCall& call) const
+    {
+        if (mReindex && call.thread > MAX_THREAD_IDX)
+        {
+            return "ERROR: The thread index is bigger than max number!";
+        }
+        return nullptr;
+    }
+
+private:
+    static const char *remapName(unsigned thread, unsigned& name)
+    {
+        if (name >= CSB_THREAD_REMAP_BASE)
+        {
+            return "ERROR: The ClientSideBuffer index is bigger than max number!";
+        }
+        if (name != 0)
+        {
+            name += thread * CSB_THREAD_REMAP_BASE;
+        }
+        return nullptr;
+    }
+
+    static const char *remap(common::CallTM& call, unsigned thread)
+    {
+        const CsbArg& arg = csbArgs.at(call.mCallName);
+        if (arg.index < 0)
+        {
+            unsigned name = call.mRet.GetAsUInt();
+            const char *error = remapName(thread, name);
+            call.mRet.SetAsUInt(name);
+            return error;
+        }
+        common::ValueTM *value = call.mArgs[arg.index];
+        if (!arg.opaque)
+        {
+            unsigned name = value->GetAsUInt();
+            const char *error = remapName(thread, name);
+            value->SetAsUInt(name);
+            return error;
+        }
+        if (value->IsClientSideBufferReference())
+        {
+            return remapName(thread, value->mOpaqueIns->mClientSideBufferName);
+        }
+        return nullptr;
+    }
+
+    const common::InFile& mFile;
+    const std::vector<CallInfo>& mInfos;
+    const bool mReindex;
+    const bool mDecodeAll;  // older traces encode some calls differently from what we write
+};
+
+/// Tracks the context of a thread. Returns false at calls that cannot be flattened.
+bool trackContext(const RawCall& call, const CallInfo& info, const char *args, ThreadState& state, std::vector<Event>& events)
+{
+    if (info.kind == FLATTEN_MAKECURRENT)
+    {
+        int values[4];
+        memcpy(values, args, sizeof(values));
+        state.display = values[0];
+        state.draw = values[1];
+        state.read = values[2];
+        state.context = values[3];
+        events.push_back({ call.callNo, state.display, nullptr });
+    }
+    else if (!info.egl && state.display == -1) // sanity check
+    {
+        events.push_back({ call.callNo, -1, "ERROR: Bad display -- eglMakeCurrent() not called before GL calls!" });
+        return false;
+    }
+    return true;
+}
+
+/// Reads the input on its own thread and cuts it into segments
+class TraceSplitter
+{
+public:
+    TraceSplitter(const FlattenOptions& options) : mOptions(options) {}
+
+    ~TraceSplitter()
+    {
+        if (mThread.joinable()) mThread.join();
+    }
+
+    bool open(const std::string& name)
+    {
+        if (!mFile.Open(name.c_str()))
+        {
+            return false;
+        }
+        mInfos.resize(mFile.mExIdToName.size());
+        for (unsigned id = 1; id < mFile.mExIdToName.size(); ++id)
+        {
+            const std::string& func = mFile.mExIdToName[id];
+            if (func.empty())
+            {
+                continue;
+            }
+            CallInfo& info = mInfos[id];
+            info.outputId = common::gApiInfo.NameToId(func.c_str());
+            if (func == "eglMakeCurrent") info.kind = FLATTEN_MAKECURRENT;
+            else if (syncFuncs.count(func)) info.kind = FLATTEN_SYNC;
+            else if (csbArgs.count(func)) info.kind = FLATTEN_CSB;
+            info.egl = (func[0] == 'e');
+            info.needsContext = callNeedsContext(func);
+            info.waits = (func == "glWaitSync" || func == "glFinish" || func == "glClientWaitSync");
+        }
+        return true;
+    }
+
+    /// Assigns thread indices in the order of the header
+    void addThread(unsigned tid)
+    {
+        mThreadIndex[tid] = mThreads.size();
+        mThreads.push_back(tid);
+    }
+
+    void start(const std::vector<SegmentQueue*>& outputs)
+    {
+        mOutputs = outputs;
+        mThread = std::thread(&TraceSplitter::run, this);
+    }
+
+    /// Stop reading soon. A last segment is still sent.
+    void stop() { mStop = true; }
+
+    void join()
+    {
+        if (mThread.joinable()) mThread.join();
+    }
+
+    common::InFile mFile;
+    std::vector<CallInfo> mInfos;
+    unsigned mFrames = 0;
+    unsigned mUnknown = 0;  // calls this build does not know, dropped
+
+private:
+    void run();
+    void push(SegmentPtr segment);
+    void logCall(const common::BCall_vlen& call, unsigned callNo, char *src);
+
+    const FlattenOptions& mOptions;
+    std::map<unsigned, unsigned> mThreadIndex;  // because thread IDs may be discontinuous
+    std::vector<unsigned> mThreads;
+    std::vector<SegmentQueue*> mOutputs;
+    std::atomic<bool> mStop { false };
+    std::thread mThread;
+};
+
+void TraceSplitter::push(SegmentPtr segment)
+{
+    for (SegmentQueue *queue : mOutputs)
+    {
+        queue->push(segment);
+    }
+}
+
+void TraceSplitter::logCall(const common::BCall_vlen& call, unsigned callNo, char *src)
+{
+    const std::string func = mFile.ExIdToName(call.funcId);
+    if (func != "eglCreateWindowSurface" && func != "eglCreateWindowSurface2" && func != "eglCreatePbufferSurface"
+        && func != "eglCreatePixmapSurface" && func != "eglCreateContext" && func != "eglDestroyContext"
+        && (mOptions.inSequence || func != "eglDestroySurface"))
+    {
+        return;
+    }
+    common::CallTM decoded(mFile, callNo, call, src);
+    if (func == "eglCreateContext")
+    {
+        DBG_LOG("[t%u] Creating context %d at %u\n", call.tid, decoded.mRet.GetAsInt(), callNo);
+    }
+    else if (func == "eglDestroyContext")
+    {
+        DBG_LOG("[t%u] Destroying context %d at %u\n", call.tid, decoded.mArgs[1]->GetAsInt(), callNo);
+    }
+    else if (func == "eglDestroySurface")
+    {
+        DBG_LOG("[t%u] Destroying surface %d at %u\n", call.tid, decoded.mArgs[1]->GetAsInt(), callNo);
+    }
+    else
+    {
+        DBG_LOG("[t%u] Creating surface %d at %u\n", call.tid, decoded.mRet.GetAsInt(), callNo);
+    }
+}
+
+void TraceSplitter::run()
+{
+    // Frames end as in TraceFileTM: at swaps of the default thread, or of any thread in
+    // multithreaded traces, that are not on pbuffer surfaces
+    const unsigned short swapIds[] = {
+        mFile.NameToExId("eglSwapBuffers"),
+        mFile.NameToExId("eglSwapBuffersWithDamageKHR"),
+        mFile.NameToExId("eglSwapBuffersWithDamageEXT"),
+    };
+    const unsigned short createPbufferId = mFile.NameToExId("eglCreatePbufferSurface");
+    const unsigned short destroySurfaceId = mFile.NameToExId("eglDestroySurface");
+    const unsigned defaultTid = mFile.getDefaultThreadID();
+    const bool multithread = mFile.getMultithread();
+    std::unordered_set<int> pbufferSurfaces;
+
+    SegmentPtr segment(new Segment);
+    unsigned callNo = 0;
+    unsigned frameCalls = 0;  // calls read in the current frame
+    unsigned queued = 0;      // calls in the current segment that will be written
+    int previousTid = -1;
+    bool newRun = false;
+
+    void *fptr = nullptr;
+    common::BCall_vlen call;
+    char *src = nullptr;
+    while (!mStop && mFile.GetNextCall(fptr, call, src))
+    {
+        const unsigned no = callNo++;
+        frameCalls++;
+
+        bool frameEnd = false;
+        if ((call.tid == defaultTid || multithread) && call.funcId != 0
+            && std::find(std::begin(swapIds), std::end(swapIds), call.funcId) != std::end(swapIds))
+        {
+            frameEnd = (pbufferSurfaces.count(mFile.getDpySurface(src)) == 0);
+        }
+        if (call.funcId == createPbufferId)
+        {
+            pbufferSurfaces.insert(mFile.getCreatePbufferSurfaceRet(src));
+        }
+        else if (call.funcId == destroySurfaceId)
+        {
+            pbufferSurfaces.erase(mFile.getDpySurface(src));
+        }
+
+        if ((int)call.tid != previousTid)
+        {
+            newRun = true;
+            previousTid = call.tid;
+        }
+        if (mThreadIndex.count(call.tid) == 0)
+        {
+            DBG_LOG("WARNING: Header JSON did not include all threads! Missed tid %u!\n", call.tid);
+            addThread(call.tid);
+        }
+
+        const CallInfo& info = mInfos[call.funcId];
+        bool flush = frameEnd;
+        if (!mOptions.onlyThreads.empty() && mOptions.onlyThreads.count(call.tid) == 0 && strcmp(mFile.ExIdToName(call.funcId), "eglInitialize") != 0)
+        {
+            // not flattened
+        }
+        else if (info.outputId == 0)
+        {
+            if (mUnknown++ == 0) DBG_LOG("Skipping %s, which this build does not know\n", mFile.ExIdToName(call.funcId));
+        }
+        else
+        {
+            const unsigned thread = mThreadIndex.at(call.tid);
+            const unsigned headerSize = (mFile.mExIdToLen[call.funcId] == 0) ? sizeof(common::BCall_vlen) : sizeof(common::BCall);
+            if (segment->streams.size() < mThreads.size())
+            {
+                segment->streams.resize(mThreads.size());
+            }
+            Stream& stream = segment->streams[mOptions.inSequence ? 0 : thread];
+            RawCall raw;
+            raw.header = call;
+            raw.callNo = no;
+            raw.thread = thread;
+            raw.offset = stream.input.size();
+            raw.size = call.toNext - headerSize;
+            raw.newRun = newRun;
+            newRun = false;
+            stream.input.insert(stream.input.end(), src, src + raw.size);
+            stream.calls.push_back(raw);
+
+            if (mOptions.debug)
+            {
+                logCall(call, no, src);
+            }
+            if (info.waits)
+            {
+                DBG_LOG("[t%u] %s is forcing writeout of %u calls at frame %u, call %u\n", call.tid, mFile.ExIdToName(call.funcId), queued, mFrames, no);
+                flush = flush || !mOptions.inSequence;
+            }
+            if (info.kind != FLATTEN_SYNC)
+            {
+                queued++;
+            }
+        }
+
+        if (flush)
+        {
+            segment->frame = mFrames;
+            push(segment);
+            segment.reset(new Segment);
+            queued = 0;
+        }
+        if (frameEnd)
+        {
+            mFrames++;
+            frameCalls = 0;
+        }
+    }
+
+    segment->frame = mFrames;
+    if (frameCalls > 0)
+    {
+        mFrames++;
+    }
+    push(segment);
+    SegmentPtr last(new Segment);
+    last->last = true;
+    push(last);
+}
+
+/// Tracks contexts and writes the calls of the threads whose index modulo the number of
+/// workers is the number of this worker
+class Worker
+{
+public:
+    Worker(unsigned number, unsigned count, const CallWriter& writer, const std::vector<CallInfo>& infos)
+        : mNumber(number), mCount(count), mWriter(writer), mInfos(infos), mInput(QUEUE_SEGMENTS), mDone(QUEUE_SEGMENTS) {}
+
+    ~Worker()
+    {
+        if (mThread.joinable()) mThread.join();
+    }
+
+    void start()
+    {
+        mThread = std::thread(&Worker::run, this);
+    }
+
+    SegmentQueue& input() { return mInput; }
+    SegmentQueue& done() { return mDone; }
+
+private:
+    void run()
+    {
+        while (true)
+        {
+            SegmentPtr segment = mInput.pop();
+            for (unsigned thread = mNumber; thread < segment->streams.size(); thread += mCount)
+            {
+                if (mStates.size() <= thread)
+                {
+                    mStates.resize(thread + 1);
+                }
+                process(segment->streams[thread], mStates[thread]);
+            }
+            mDone.push(segment);
+            if (segment->last)
+            {
+                return;
+            }
+        }
+    }
+
+    void process(Stream& stream, ThreadState& state)
+    {
+        // The context the thread had at the start of the segment, restored in front of
+        // the first call that needs it
+        stream.initial = state;
+        bool current = false;
+        for (const RawCall& call : stream.calls)
+        {
+            const CallInfo& info = mInfos[call.header.funcId];
+            char *args = stream.input.data() + call.offset;
+            if (const char *error = mWriter.check(call))
+            {
+                stream.events.push_back({ call.callNo, -1, error });
+                return;
+            }
+            if (!trackContext(call, info, args, state, stream.events))
+            {
+                return;
+            }
+            if (info.kind == FLATTEN_SYNC)
+            {
+                stream.skipped++;
+                continue;
+            }
+            if (!current && info.kind == FLATTEN_MAKECURRENT)
+            {
+                // Special case. The app supplied eglMakeCurrent takes priority.
+                current = true;
+            }
+            else if (info.needsContext && !current)
+            {
+                // Do not put it in front of EGL calls that do not need it, since
+                // they may break, eg eglInitialize.
+                if (stream.initial.display == -1)
+                {
+                    DBG_LOG("  Warning: eglMakeCurrent(%d,%d,%d,%d) at %u - invalid display\n",
+                            stream.initial.display, stream.initial.draw, stream.initial.read, stream.initial.context, call.callNo);
+                }
+                mWriter.writeMakeCurrent(stream.output, stream.initial);
+                stream.injected = true;
+                current = true;
+            }
+            if (const char *error = mWriter.write(stream.output, call, args))
+            {
+                stream.events.push_back({ call.callNo, -1, error });
+                return;
+            }
+            stream.written++;
+        }
+    }
+
+    const unsigned mNumber;
+    const unsigned mCount;
+    const CallWriter& mWriter;
+    const std::vector<CallInfo>& mInfos;
+    std::vector<ThreadState> mStates;  // by thread index
+    SegmentQueue mInput;
+    SegmentQueue mDone;
+    std::thread mThread;
+};
+
+/// Writes calls that are already in the output format, keeping each call within one chunk
+void writeCalls(common::OutFile& out, const std::vector<char>& calls)
+{
+    const char *src = calls.data();
+    const char *end = src + calls.size();
+    while (src < end)
+    {
+        const common::BCall *call = (const common::BCall*)src;
+        size_t len = common::gApiInfo.IdToLenArr[call->funcId];
+        if (len == 0)
+        {
+            len = ((const common::BCall_vlen*)src)->toNext;
+        }
+        memcpy(out.Scratch(), src, len);
+        out.Progress(len);
+        src += len;
+    }
+}
+
+/// Checks the events of the trace in order
+class DisplayChecker
+{
+public:
+    bool apply(const Event& event)
+    {
+        if (event.error)
+        {
+            DBG_LOG("%s\n", event.error);
+            return false;
+        }
+        if (event.display == -1)
+        {
+            DBG_LOG("ERROR: Bad display stored!\n");
+            return false;
+        }
+        if (event.display != mDisplay && mDisplay != -1)
+        {
+            DBG_LOG("ERROR: More than one display not supported yet!\n");
+            return false;
+        }
+        mDisplay = event.display;
+        return true;
+    }
+
+    int display() const { return mDisplay; }
+
+private:
+    int mDisplay = -1;
+};
+
+}
+
+bool flattenThreads(const std::string& input, const std::string& output, const FlattenOptions& options, FlattenResult *result)
+{
+    FlattenResult local;
+    FlattenResult& r = result ? *result : local;
+    r = FlattenResult();
+
+    common::gApiInfo.RegisterEntries(common::parse_callbacks);
+    TraceSplitter splitter(options);
+    if (!splitter.open(input))
+    {
+        DBG_LOG("Failed to open for reading: %s\n", input.c_str());
+        return false;
+    }
+
+    Json::Value header = splitter.mFile.getJSONHeader();
+    const Json::Value threadArray = header["threads"];
+    if (threadArray.size() == 0)
+    {
+        DBG_LOG("Bad number of threads: %d\n", threadArray.size());
+        return false;
+    }
+    for (unsigned i = 0; i < threadArray.size(); i++)
+    {
+        const unsigned tid = threadArray[i]["id"].asUInt();
+        if (options.debug) DBG_LOG("remapping tid %u => idx %u\n", tid, i);
+        splitter.addThread(tid);
+    }
+    Json::Value newThreadArray = Json::Value(Json::arrayValue);
+    for (auto a : threadArray) // only use defaultTid's thread info
+    {
+        if (a["id"] == header["defaultTid"])
+        {
+            if (options.debug) DBG_LOG("  found thread %d - appending\n", a["id"].asInt());
+            a["id"] = 0;
+            newThreadArray.append(a);
+        }
+    }
+    header["defaultTid"] = 0;
+    if (options.forceSingleWindow)
+    {
+        header["forceSingleWindow"] = true;
+    }
+    header["threads"] = newThreadArray;
+
+    common::OutFile outputFile;
+    if (!outputFile.Open(output.c_str()))
+    {
+        DBG_LOG("Failed to open for writing: %s\n", output.c_str());
+        return false;
+    }
+    outputFile.CompressInBackground();
+
+    const CallWriter writer(splitter.mFile, splitter.mInfos, options.reindexClientSideBuffers);
+    const bool inRange = (options.lastFrame != -1);
+    DisplayChecker checker;
+    bool ok = true;
+    int previousInjected = -1;
+
+    if (options.inSequence)
+    {
+        // Everything in the first stream of each segment, in trace order
+        SegmentQueue queue(QUEUE_SEGMENTS);
+        splitter.start({ &queue });
+        std::vector<ThreadState> states(threadArray.size());
+        std::vector<char> out;
+        bool current = false;
+        for (SegmentPtr segment = queue.pop(); !segment->last; segment = queue.pop())
+        {
+            if (!ok || segment->streams.empty())
+            {
+                continue;
+            }
+            Stream& stream = segment->streams[0];
+            std::vector<Event> events;
+            out.clear();
+            for (const RawCall& call : stream.calls)
+            {
+                const CallInfo& info = splitter.mInfos[call.header.funcId];
+                char *args = stream.input.data() + call.offset;
+                if (call.newRun)
+                {
+                    current = false;
+                }
+                if (states.size() <= call.thread)
+                {
+                    states.resize(call.thread + 1);
+                }
+                ThreadState& state = states[call.thread];
+                events.clear();
+                if (const char *error = writer.check(call))
+                {
+                    events.push_back({ call.callNo, -1, error });
+                }
+                else
+                {
+                    trackContext(call, info, args, state, events);
+                }
+                if (!std::all_of(events.begin(), events.end(), [&checker](const Event& e) { return checker.apply(e); }))
+                {
+                    ok = false;
+                    break;
+                }
+                if (info.kind == FLATTEN_SYNC)
+                {
+                    r.skipped++;
+                }
+                if (!current && info.kind == FLATTEN_MAKECURRENT)
+                {
+                    // Special case. The app supplied eglMakeCurrent takes priority.
+                    current = true;
+                }
+                else if (info.needsContext && !current && state.display != -1)
+                {
+                    writer.writeMakeCurrent(out, state);
+                    current = true;
+                    r.injected++;
+                    if (inRange && (int)segment->frame >= options.firstFrame && (int)segment->frame <= options.lastFrame)
+                    {
+                        r.injectedInRange++;
+                    }
+                }
+                if (const char *error = writer.write(out, call, args))
+                {
+                    checker.apply({ call.callNo, -1, error });
+                    ok = false;
+                    break;
+                }
+            }
+            writeCalls(outputFile, out);
+            if (!ok)
+            {
+                splitter.stop();
+            }
+        }
+    }
+    else
+    {
+        unsigned count = options.workers ? options.workers : std::thread::hardware_concurrency();
+        count = std::max(1u, std::min(count, threadArray.size()));
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<SegmentQueue*> inputs;
+        for (unsigned i = 0; i < count; i++)
+        {
+            workers.emplace_back(new Worker(i, count, writer, splitter.mInfos));
+            inputs.push_back(&workers.back()->input());
+            workers.back()->start();
+        }
+        splitter.start(inputs);
+
+        std::vector<Event> events;
+        while (true)
+        {
+            SegmentPtr segment;
+            for (auto& worker : workers)
+            {
+                segment = worker->done().pop();
+            }
+            if (segment->last)
+            {
+                break;
+            }
+            if (!ok)
+            {
+                continue;
+            }
+
+            // Resolve the checks of all threads in trace order
+            events.clear();
+            for (const Stream& stream : segment->streams)
+            {
+                events.insert(events.end(), stream.events.begin(), stream.events.end());
+            }
+            std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.callNo < b.callNo; });
+            if (!std::all_of(events.begin(), events.end(), [&checker](const Event& e) { return checker.apply(e); }))
+            {
+                ok = false;
+                splitter.stop();
+                continue;
+            }
+
+            if (options.debug) DBG_LOG("-- writeout frame %u! %u threads --\n", segment->frame, (unsigned)segment->streams.size());
+            bool anyInjected = false;
+            for (const Stream& stream : segment->streams)
+            {
+                r.skipped += stream.skipped;
+                if (stream.written == 0)
+                {
+                    continue;
+                }
+                if (options.debug) DBG_LOG("  writing (%d calls)[s=%d,c=%d] tid=%u\n", stream.written, stream.initial.read, stream.initial.context, stream.calls[0].header.tid);
+                if (stream.injected)
+                {
+                    anyInjected = true;
+                    r.injected++;
+                    if (inRange && (int)segment->frame >= options.firstFrame && (int)segment->frame <= options.lastFrame)
+                    {
+                        r.injectedInRange++;
+                    }
+                }
+                writeCalls(outputFile, stream.output);
+            }
+
+            // Keep track of non-injected franges. If we had a number of frames without injections, track those.
+            // Ignore such ranges with less than 100 frames.
+            if (anyInjected && previousInjected != -1 && static_cast<int>(segment->frame) - previousInjected > 100)
+            {
+                r.nonInjectedRanges.push_back(std::make_pair(previousInjected, static_cast<int>(segment->frame) - 1));
+            }
+            if (anyInjected)
+            {
+                previousInjected = segment->frame;
+            }
+        }
+    }
+    splitter.join();
+    r.frames = splitter.mFrames;
+    if (!ok)
+    {
+        return false;
+    }
+
+    common::CallTM eglTerminate("eglTerminate");
+    eglTerminate.mArgs.push_back(new common::ValueTM(checker.display()));
+    eglTerminate.mRet = common::ValueTM((int)EGL_TRUE);
+    eglTerminate.Serialize(outputFile);
+
+    previousInjected = std::max(0, previousInjected);
+    if (static_cast<int>(r.frames) - previousInjected > 100)
+    {
+        r.nonInjectedRanges.push_back(std::make_pair(previousInjected, static_cast<int>(r.frames) - 1));
+    }
+
+    Json::Value info;
+    if (options.forceSingleWindow) info["addForceSingleWindow"] = true;
+    if (inRange) info["framerange"] = std::to_string(options.firstFrame) + "-" + std::to_string(options.lastFrame);
+    if (options.inSequence) info["insequence"] = true;
+    info["injected_total"] = r.injected;
+    if (inRange) info["injected_eglMakeCurrent_in_framerange"] = r.injectedInRange;
+    addConversionEntry(header, "flatten_threads", input, info);
+    Json::FastWriter jsonWriter;
+    const std::string json_header = jsonWriter.write(header);
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+    outputFile.Close();
+    return true;
+}
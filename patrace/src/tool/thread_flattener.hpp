@@ -0,0 +1,49 @@
+#ifndef _TOOL_THREAD_FLATTENER_HPP_
+#define _TOOL_THREAD_FLATTENER_HPP_
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Rewrites a multi-threaded trace into a single-threaded one, used by flatten_threads.
+//
+// The calls are cut into segments at the end of each frame and at calls that wait for
+// other threads (glFinish, glWaitSync, glClientWaitSync). Within a segment, the calls of
+// each thread are written together, threads in the order they appear in the header.
+// An eglMakeCurrent that restores the context a thread had at the start of the segment
+// is injected in front of its first call that needs one, unless the thread makes a
+// context current itself. Sync calls are dropped, and client side buffers are renamed
+// so that names from different threads do not collide.
+//
+// A reader thread decompresses the trace and splits each segment by thread. A pool of
+// workers then tracks the contexts of the threads and writes their calls, each thread
+// always on the same worker, and the calling thread merges the results in order.
+// Calls are copied as raw bytes unless they refer to a client side buffer.
+
+struct FlattenOptions
+{
+    bool reindexClientSideBuffers = true;
+    bool forceSingleWindow = false;  // added to the header
+    bool inSequence = false;         // keep the original call order, for verification only
+    bool debug = false;
+    std::set<unsigned> onlyThreads;  // flatten only these thread ids, all if empty
+    int firstFrame = 0;              // frame range to count injections in, none if lastFrame is -1
+    int lastFrame = -1;
+    unsigned workers = 0;            // 0 for one per core
+};
+
+struct FlattenResult
+{
+    int skipped = 0;            // sync calls dropped
+    int injected = 0;           // eglMakeCurrent calls added
+    int injectedInRange = 0;    // of those, inside the frame range of the options
+    unsigned frames = 0;
+    /// Ranges of at least 100 frames without injections
+    std::vector<std::pair<int, int>> nonInjectedRanges;
+};
+
+/// Returns false if a file could not be opened or the trace cannot be flattened
+bool flattenThreads(const std::string& input, const std::string& output, const FlattenOptions& options, FlattenResult *result = nullptr);
+
+#endif
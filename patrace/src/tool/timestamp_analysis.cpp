@@ -0,0 +1,159 @@
+#include "tool/timestamp_analysis.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "common/os.hpp"
+
+static double ms(uint64_t ns)
+{
+    return (double)ns / 1000000.0;
+}
+
+void TimestampAnalysis::timestamp(uint64_t time)
+{
+    if (mTimestamps++ == 0)
+    {
+        mFirst = time;
+        mLast = time;
+    }
+    mPending = true;
+    mPendingTime = time;
+}
+
+void TimestampAnalysis::call(const std::string& name, bool swap)
+{
+    if (mPending)
+    {
+        mPending = false;
+        if (!mFrameStarted)
+        {
+            mFrame = TimestampFrame();
+            mFrame.frame = mSwaps;
+            mFrame.start = mLast - mFirst;
+            mFrameStarted = true;
+        }
+        // The clock is monotonic, but traces merged or edited by hand need not be
+        const uint64_t delta = (mPendingTime > mLast) ? mPendingTime - mLast : 0;
+        TimestampCallStats& stats = mCalls[name];
+        stats.count++;
+        stats.total += delta;
+        stats.max = std::max(stats.max, delta);
+        if (mFrame.calls == 0 && mFrameAfterSwap)
+        {
+            mFrame.gap = delta;
+        }
+        mFrame.calls++;
+        mLast = std::max(mLast, mPendingTime);
+    }
+
+    if (swap)
+    {
+        if (mFrameStarted)
+        {
+            mFrame.duration = mLast - mFirst - mFrame.start;
+            mFrames.push_back(mFrame);
+        }
+        mSwaps++;
+        mFrameStarted = false;
+        mFrameAfterSwap = mTimestamps > 0;
+        if (mFrameAfterSwap)
+        {
+            // Start the next frame here, so that the gap before its first timestamp counts
+            mFrame = TimestampFrame();
+            mFrame.frame = mSwaps;
+            mFrame.start = mLast - mFirst;
+            mFrameStarted = true;
+        }
+    }
+}
+
+std::vector<TimestampCallStats> TimestampAnalysis::calls() const
+{
+    std::vector<TimestampCallStats> result;
+    for (const auto& pair : mCalls)
+    {
+        result.push_back(pair.second);
+        result.back().name = pair.first;
+    }
+    std::stable_sort(result.begin(), result.end(), [](const TimestampCallStats& a, const TimestampCallStats& b) { return a.total > b.total; });
+    return result;
+}
+
+Json::Value TimestampAnalysis::json(unsigned topCalls) const
+{
+    Json::Value result;
+    result["timestamps"] = (Json::Value::UInt64)mTimestamps;
+    result["duration_ms"] = ms(duration());
+    result["frames"] = (Json::Value::UInt64)mFrames.size();
+    if (!mFrames.empty())
+    {
+        std::vector<uint64_t> durations;
+        uint64_t total = 0;
+        uint64_t gaps = 0;
+        uint64_t maxGap = 0;
+        for (const TimestampFrame& f : mFrames)
+        {
+            durations.push_back(f.duration);
+            total += f.duration;
+            gaps += f.gap;
+            maxGap = std::max(maxGap, f.gap);
+        }
+        std::sort(durations.begin(), durations.end());
+        result["frame_ms"]["average"] = ms(total) / mFrames.size();
+        result["frame_ms"]["median"] = ms(durations[durations.size() / 2]);
+        result["frame_ms"]["min"] = ms(durations.front());
+        result["frame_ms"]["max"] = ms(durations.back());
+        result["gap_ms"]["average"] = ms(gaps) / mFrames.size();
+        result["gap_ms"]["max"] = ms(maxGap);
+        result["gap_ms"]["percent"] = total ? 100.0 * gaps / total : 0.0;
+    }
+    result["functions"] = Json::arrayValue;
+    const std::vector<TimestampCallStats> stats = calls();
+    for (unsigned i = 0; i < stats.size() && i < topCalls; i++)
+    {
+        Json::Value v;
+        v["name"] = stats[i].name;
+        v["count"] = (Json::Value::UInt64)stats[i].count;
+        v["total_ms"] = ms(stats[i].total);
+        v["max_ms"] = ms(stats[i].max);
+        v["percent"] = duration() ? 100.0 * stats[i].total / duration() : 0.0;
+        result["functions"].append(v);
+    }
+    return result;
+}
+
+bool TimestampAnalysis::writeCSV(const std::string& basename) const
+{
+    std::string filename = basename + "_frame_timing.csv";
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (!fp)
+    {
+        DBG_LOG("Could not open %s for writing: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(fp, "Frame,Start (ms),Duration (ms),Gap (ms),Busy (ms),Calls\n");
+    for (const TimestampFrame& f : mFrames)
+    {
+        fprintf(fp, "%u,%.3f,%.3f,%.3f,%.3f,%u\n", f.frame, ms(f.start), ms(f.duration), ms(f.gap), ms(f.duration - f.gap), f.calls);
+    }
+    fclose(fp);
+
+    filename = basename + "_call_timing.csv";
+    fp = fopen(filename.c_str(), "w");
+    if (!fp)
+    {
+        DBG_LOG("Could not open %s for writing: %s\n", filename.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(fp, "Function,Count,Total (ms),Average (us),Max (us),%% of time\n");
+    for (const TimestampCallStats& s : calls())
+    {
+        fprintf(fp, "%s,%lu,%.3f,%.3f,%.3f,%f\n", s.name.c_str(), (unsigned long)s.count, ms(s.total), (double)s.total / s.count / 1000.0,
+                (double)s.max / 1000.0, duration() ? 100.0 * s.total / duration() : 0.0);
+    }
+    fclose(fp);
+    return true;
+}
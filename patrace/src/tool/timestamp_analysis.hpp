@@ -0,0 +1,81 @@
+#ifndef _TOOL_TIMESTAMP_ANALYSIS_HPP_
+#define _TOOL_TIMESTAMP_ANALYSIS_HPP_
+
+// Application side CPU time from the paTimestamp calls of traces made with timestamping.
+//
+// The tracer puts a paTimestamp call in front of every call that has side effects, holding
+// the time (CLOCK_MONOTONIC, in nanoseconds) at which that call returned to the application.
+// The time from one timestamp to the next is what the application spent in its own code plus
+// the time of the next timestamped call, and is attributed to that call. Calls without side
+// effects, such as glGet*, have no timestamp of their own, so their time ends up with the next
+// call that has one. Timestamps of all threads are taken from the same clock, so calls made
+// on several threads at once are attributed in the order they were written to the trace.
+//
+// A frame runs from the return of one swap to the return of the next one (frame 0 from the
+// first timestamp). Its gap is the time from the swap at its start to the return of its first
+// timestamped call, which is mostly time the application spent outside of the graphics API,
+// such as waiting for input or simulating the next frame. Calls after the last swap do not
+// make a frame.
+
+#include "json/value.h"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct TimestampFrame
+{
+    unsigned frame = 0;
+    uint64_t start = 0;     // nanoseconds from the first timestamp of the trace
+    uint64_t duration = 0;  // nanoseconds from the swap before to the swap that ends the frame
+    uint64_t gap = 0;       // nanoseconds from the swap before to the first timestamped call
+    unsigned calls = 0;     // timestamped calls, including the swap
+};
+
+struct TimestampCallStats
+{
+    std::string name;
+    uint64_t count = 0; // timestamped calls
+    uint64_t total = 0; // nanoseconds
+    uint64_t max = 0;
+};
+
+class TimestampAnalysis
+{
+public:
+    /// A paTimestamp call, with its value
+    void timestamp(uint64_t time);
+    /// Any other call, in trace order
+    void call(const std::string& name, bool swap);
+
+    /// Whether the trace had any timestamps at all
+    bool empty() const { return mTimestamps == 0; }
+    uint64_t timestamps() const { return mTimestamps; }
+    /// Nanoseconds from the first to the last timestamp
+    uint64_t duration() const { return mLast - mFirst; }
+
+    const std::vector<TimestampFrame>& frames() const { return mFrames; }
+    /// Per function statistics, the most expensive function first
+    std::vector<TimestampCallStats> calls() const;
+
+    /// Summary of the frame times and gaps, and the most expensive functions
+    Json::Value json(unsigned topCalls = 20) const;
+    /// Writes <basename>_frame_timing.csv and <basename>_call_timing.csv, returns false if a file cannot be written
+    bool writeCSV(const std::string& basename) const;
+
+private:
+    uint64_t mTimestamps = 0;
+    uint64_t mFirst = 0;
+    uint64_t mLast = 0;
+    bool mPending = false; // a timestamp that belongs to the next call
+    uint64_t mPendingTime = 0;
+    uint64_t mSwaps = 0;
+    bool mFrameStarted = false;
+    bool mFrameAfterSwap = false; // the gap of the current frame can be measured
+    TimestampFrame mFrame;
+    std::vector<TimestampFrame> mFrames;
+    std::map<std::string, TimestampCallStats> mCalls;
+};
+
+#endif
@@ -133,8 +133,11 @@ static bool callback(ParseInterfaceBase& input, common::CallTM *call, void *fpp)
     if (colours && call->mCallName == "glInsertEventMarkerEXT") mark = YEL;
     if (colours && call->mCallName == "eglMakeCurrent") mark = CYN;
     const char *reset = (colours) ? RESET : "";
-    if (!bare) fprintf(fp, "[t%d, f%d, c%d] %d : %s%s%s%s%s\n", call->mTid, input.frames, input.context_index, call->mCallNo, injected, reset, mark, call->ToStr(false).c_str(), reset);
-    else fprintf(fp, "%s%s%s%s%s\n", injected, reset, mark, call->ToStr(false).c_str(), reset);
+    static std::string line; // reused to avoid an allocation per call
+    line.clear();
+    call->ToStr(line, false);
+    if (!bare) fprintf(fp, "[t%d, f%d, c%d] %d : %s%s%s%s%s\n", call->mTid, input.frames, input.context_index, call->mCallNo, injected, reset, mark, line.c_str(), reset);
+    else fprintf(fp, "%s%s%s%s%s\n", injected, reset, mark, line.c_str(), reset);
     if (verbose)
     {
         const int context_index = input.context_index;
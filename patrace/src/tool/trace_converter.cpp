@@ -0,0 +1,837 @@
+#include "tool/trace_converter.hpp"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+#include <GLES3/gl31.h>
+#include <GLES3/gl32.h>
+#include <fstream>
+#include <iostream>
+#include <limits.h>
+#include <memory>
+#include <string.h>
+#include <thread>
+
+#include "tool/parse_interface.h"
+
+#include "common/bounded_queue.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/file_format.hpp"
+#include "common/api_info.hpp"
+#include "common/trace_model.hpp"
+#include "common/gl_utility.hpp"
+#include "common/os.hpp"
+#include "tool/utils.hpp"
+#include "json/reader.h"
+#include "json/writer.h"
+
+// Set for the duration of convertTrace
+static ConvertOptions options;
+static common::patchfile pf;
+static std::set<std::pair<int, int>> used_shaders; // context index + shader index
+
+/// What the converter may do with a call, by function id in ApiInfo
+enum CallKind : unsigned char
+{
+    CALL_OTHER,
+    CALL_SHADER,          // takes a shader name as its first argument
+    CALL_DELETE_SHADER,
+    CALL_CREATE_SHADER,
+    CALL_ATTACH_SHADER,
+    CALL_CLIENT_WAIT_SYNC,
+    CALL_SYNC,            // other calls removed by --removesync
+    CALL_GENERATE_MIPMAP,
+    CALL_BUFFER_DATA,
+    CALL_GET_ERROR,
+    CALL_TIMESTAMP,
+    CALL_TEXTURE,         // texture storage and uploads
+    CALL_CREATE_CONTEXT,
+    CALL_MAKE_CURRENT,
+    CALL_SWAP,
+};
+static std::vector<CallKind> call_kinds;
+
+static void classify_calls()
+{
+    call_kinds.assign(common::gApiInfo.MaxSigId + 1, CALL_OTHER);
+    const auto set = [](CallKind kind, std::initializer_list<const char*> names)
+    {
+        for (const char* name : names)
+        {
+            const unsigned short id = common::gApiInfo.NameToId(name);
+            if (id) call_kinds[id] = kind;
+        }
+    };
+    set(CALL_SHADER, { "glShaderSource", "glCompileShader", "glGetShaderiv", "glIsShader", "glGetShaderSource", "glGetShaderInfoLog" });
+    set(CALL_DELETE_SHADER, { "glDeleteShader" });
+    set(CALL_CREATE_SHADER, { "glCreateShader" });
+    set(CALL_ATTACH_SHADER, { "glAttachShader" });
+    set(CALL_CLIENT_WAIT_SYNC, { "glClientWaitSync" });
+    set(CALL_SYNC, { "glDeleteSync", "glFenceSync", "glGetSynciv", "glIsSync", "glWaitSync", "eglGetSyncAttribKHR", "eglDestroySyncKHR",
+                     "eglCreateSyncKHR", "eglClientWaitSyncKHR" });
+    set(CALL_GENERATE_MIPMAP, { "glGenerateMipmap" });
+    set(CALL_BUFFER_DATA, { "glBufferData" });
+    set(CALL_GET_ERROR, { "eglGetError", "glGetError" });
+    set(CALL_TIMESTAMP, { "paTimestamp" });
+    set(CALL_TEXTURE, { "glTexStorage3D", "glTexStorage2D", "glTexStorage1D", "glTexStorage3DEXT", "glTexStorage2DEXT", "glTexStorage1DEXT",
+                        "glTexImage3D", "glTexImage2D", "glTexImage1D", "glTexImage3DOES", "glCompressedTexImage3D", "glCompressedTexImage2D",
+                        "glCompressedTexImage1D", "glTexSubImage1D", "glTexSubImage2D", "glTexSubImage3D", "glCompressedTexSubImage2D",
+                        "glCompressedTexSubImage3D" });
+    set(CALL_CREATE_CONTEXT, { "eglCreateContext" });
+    set(CALL_MAKE_CURRENT, { "eglMakeCurrent" });
+    for (unsigned id = 1; id <= common::gApiInfo.MaxSigId; ++id)
+    {
+        const char* name = common::gApiInfo.IdToNameArr[id];
+        if (name && strncmp(name, "eglSwapBuffers", 14) == 0) call_kinds[id] = CALL_SWAP;
+    }
+}
+
+static void writeout(common::OutFile &outputFile, common::CallTM *call, bool injected = false)
+{
+    if (options.patch || options.onlyCount) return;
+    call->Serialize(outputFile, -1, injected);
+}
+
+static void addout(common::OutFile &outputFile, common::CallTM *call, common::CallTM* provoking)
+{
+    assert(call->mCallId != 0);
+    call->mTid = provoking->mTid;
+    call->mCallNo = provoking->mCallNo;
+    if (options.patch)
+    {
+        common::patchfile_insert_before(pf, *call);
+        return;
+    }
+    if (options.onlyCount) return;
+    call->Serialize(outputFile, -1, true);
+}
+
+static void removeout(common::OutFile &outputFile, common::CallTM *call)
+{
+    if (options.patch)
+    {
+        common::patchfile_remove(pf, call->mCallNo);
+        return;
+    }
+}
+
+static common::CallTM* checksum_call(int call_no)
+{
+    const ConvertChecksum& sum = options.checksums.at(call_no);
+    common::CallTM *newcall = new common::CallTM("glAssertFramebuffer_ARM");
+    newcall->mArgs.push_back(new common::ValueTM((GLenum)GL_DRAW_FRAMEBUFFER));
+    newcall->mArgs.push_back(new common::ValueTM((GLint)sum.attachment));
+    newcall->mArgs.push_back(new common::ValueTM(sum.md5));
+    return newcall;
+}
+
+/// Follows contexts and shaders with the code of ParseInterface, which is all that removing unused
+/// shaders needs. Only the calls that create or delete them, or change the current context, have
+/// to be decoded and fed to update(), so that the rest of the trace can be skipped over.
+class ShaderTracker : public ParseInterfaceBase
+{
+public:
+    ShaderTracker(unsigned tid, bool onlyDefault)
+    {
+        defaultTid = tid;
+        only_default = onlyDefault;
+    }
+
+    // Calls are fed by the caller
+    virtual bool open(const std::string& input, const std::string& output = std::string()) override { return false; }
+    virtual void close() override {}
+    virtual common::CallTM* next_call() override { return nullptr; }
+    virtual void loop(Callback c, void *data) override {}
+    virtual void cleanup() override {}
+
+    /// Whether ParseInterface looks at the calls of this thread
+    bool tracks(unsigned tid) const { return !only_default || tid == defaultTid; }
+
+    static bool interested(CallKind kind) { return kind == CALL_CREATE_CONTEXT || kind == CALL_MAKE_CURRENT || kind == CALL_CREATE_SHADER || kind == CALL_DELETE_SHADER; }
+
+    /// Updates the state with a call of a kind that interested() returned true for
+    void update(CallKind kind, const common::CallTM& call)
+    {
+        context_index = current(call.mTid); // as ParseInterface::next_call() does
+        switch (kind)
+        {
+        case CALL_CREATE_CONTEXT: create_context(call.mRet.GetAsInt(), call.mArgs[0]->GetAsInt(), call.mArgs[2]->GetAsInt()); break;
+        case CALL_MAKE_CURRENT: make_current_context(call.mTid, call.mArgs[3]->GetAsInt()); break;
+        case CALL_CREATE_SHADER: if (context_index != UNBOUND) create_shader(call.mRet.GetAsUInt(), call.mArgs[0]->GetAsUInt()); break;
+        case CALL_DELETE_SHADER: if (context_index != UNBOUND) delete_shader(call.mArgs[0]->GetAsUInt()); break;
+        default: break;
+        }
+    }
+
+    /// Context index current on thread tid, or UNBOUND
+    int current(unsigned tid) const
+    {
+        const auto it = current_context.find(tid);
+        return it != current_context.end() ? it->second : UNBOUND;
+    }
+};
+
+/// Index of the shader that a call of the given kind refers to, as ParseInterface has it after
+/// the call, or UNBOUND. glDeleteShader has already taken the name out of the remapping table by
+/// then, so look for the last shader that had it instead.
+static int shader_index(const StateTracker::Context& context, CallKind kind, GLuint id)
+{
+    if (kind == CALL_DELETE_SHADER)
+    {
+        for (int i = context.shaders.ssize() - 1; i >= 0; i--)
+        {
+            if (context.shaders.at(i).id == id) return i;
+        }
+        return UNBOUND;
+    }
+    return context.shaders.contains(id) ? context.shaders.remap(id) : UNBOUND;
+}
+
+/// Kind of each function in the trace, by its id in the trace
+static std::vector<CallKind> input_call_kinds(const common::InFile& file)
+{
+    std::vector<CallKind> kinds(file.mExIdToName.size(), CALL_OTHER);
+    for (unsigned id = 1; id < file.mExIdToName.size(); ++id)
+    {
+        if (!file.mExIdToName[id].empty())
+        {
+            kinds[id] = call_kinds[common::gApiInfo.NameToId(file.mExIdToName[id].c_str())];
+        }
+    }
+    return kinds;
+}
+
+/// ParseInterface looks only at the default thread, unless the trace says it is multithreaded
+static bool only_default_thread(const Json::Value& header)
+{
+    return !header.get("multiThread", false).asBool();
+}
+
+/// Increase when the scan results change meaning, so that old cache files are ignored
+static const int SCAN_CACHE_FORMAT = 1;
+
+static std::string scan_cache_key(const common::InFile& file)
+{
+    unsigned char key[16];
+    file.fileKey(key);
+    char hex[33];
+    for (int i = 0; i < 16; i++) snprintf(hex + 2 * i, 3, "%02x", key[i]);
+    return hex;
+}
+
+static bool load_scan_cache(const std::string& filename, const std::string& key)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) return false;
+    Json::Value root;
+    Json::Reader reader;
+    if (!reader.parse(in, root) || root["format"].asInt() != SCAN_CACHE_FORMAT || root["key"].asString() != key)
+    {
+        DBG_LOG("Scan results in %s do not match the trace - ignoring them\n", filename.c_str());
+        return false;
+    }
+    for (const Json::Value& v : root["used_shaders"])
+    {
+        used_shaders.insert(std::make_pair(v[0].asInt(), v[1].asInt()));
+    }
+    DBG_LOG("Loaded %d used shaders from %s\n", (int)used_shaders.size(), filename.c_str());
+    return true;
+}
+
+static void save_scan_cache(const std::string& filename, const std::string& key)
+{
+    Json::Value root;
+    root["format"] = SCAN_CACHE_FORMAT;
+    root["key"] = key;
+    root["used_shaders"] = Json::arrayValue;
+    for (const auto& s : used_shaders)
+    {
+        Json::Value v(Json::arrayValue);
+        v.append(s.first);
+        v.append(s.second);
+        root["used_shaders"].append(v);
+    }
+    std::ofstream out(filename, std::ios::binary);
+    Json::FastWriter writer;
+    out << writer.write(root);
+    if (!out) DBG_LOG("Could not save scan results to %s\n", filename.c_str());
+}
+
+/// Finds the shaders that are attached to a program, for --shaders. Only the calls that
+/// ShaderTracker needs and glAttachShader are decoded.
+static bool prepass(const std::string& source_trace_filename)
+{
+    common::InFile file;
+    if (!file.Open(source_trace_filename.c_str()))
+    {
+        std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
+        return false;
+    }
+    const std::string cache_filename = source_trace_filename + ".converter_scan.json";
+    const std::string key = scan_cache_key(file);
+    if (options.useScanCache && load_scan_cache(cache_filename, key))
+    {
+        return true;
+    }
+
+    const Json::Value header = file.getJSONHeader();
+    ShaderTracker tracker(header["defaultTid"].asUInt(), only_default_thread(header));
+    const std::vector<CallKind> kinds = input_call_kinds(file);
+    void *fptr = nullptr;
+    char *src = nullptr;
+    common::BCall_vlen call;
+    while (file.GetNextCall(fptr, call, src))
+    {
+        const CallKind kind = kinds[call.funcId];
+        if ((!ShaderTracker::interested(kind) && kind != CALL_ATTACH_SHADER) || !tracker.tracks(call.tid))
+        {
+            continue;
+        }
+        const common::CallTM c(file, file.curCallNo, call);
+        if (kind == CALL_ATTACH_SHADER)
+        {
+            const int context = tracker.current(c.mTid);
+            if (context == UNBOUND) continue;
+            used_shaders.insert(std::make_pair(context, shader_index(tracker.contexts[context], CALL_SHADER, c.mArgs[1]->GetAsUInt())));
+        }
+        else
+        {
+            tracker.update(kind, c);
+        }
+    }
+
+    if (options.useScanCache)
+    {
+        save_scan_cache(cache_filename, key);
+    }
+    return true;
+}
+
+static void write_header(common::OutFile& outputFile, Json::Value header, const std::string& source_trace_filename, int count)
+{
+    Json::Value info;
+    info["count"] = count;
+    if (options.waitsync) info["waitsync"] = true;
+    if (options.removeSync) info["removesync"] = true;
+    if (options.unusedMipmaps.size() > 0) info["remove_unused_mipmaps"] = true;
+    if (options.unusedTextures.size() > 0) info["remove_unused_textures"] = true;
+    if (options.uninitTextures.size() > 0) info["remove_uninitialized_textures"] = true;
+    if (options.endFrame != -1) info["endframe"] = options.endFrame;
+    if (options.lastFrame != -1) info["lastframe"] = options.lastFrame;
+    if (options.removeTimestamps)
+    {
+        header.removeMember("timestamping");
+        header.removeMember("first_timestamp");
+        info["remove_timestamps"] = true;
+    }
+    addConversionEntry(header, "converter", source_trace_filename, info);
+    Json::FastWriter writer;
+    const std::string json_header = writer.write(header);
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+}
+
+/// Converts with all the state that ParseInterface tracks, which removing unused textures and
+/// buffers needs, and which patch files need since they are written through it
+static int converter(ParseInterface& input, const std::string& source_trace_filename, common::OutFile& outputFile)
+{
+    common::CallTM *call = nullptr;
+    int count = 0;
+    Json::Value header = input.header;
+
+    // Go through entire trace file
+    while ((call = input.next_call()))
+    {
+        if (options.lastFrame != -1 && input.frames >= options.lastFrame)
+        {
+            writeout(outputFile, call);
+            continue;
+        }
+
+        if (options.checksums.size() > 0 && options.checksums.count(call->mCallNo) > 0)
+        {
+            std::unique_ptr<common::CallTM> newcall(checksum_call(call->mCallNo));
+            addout(outputFile, newcall.get(), call);
+            count++;
+        }
+
+        const CallKind kind = call_kinds[call->mCallId];
+        if (options.removeUnusedShaders && (kind == CALL_SHADER || kind == CALL_DELETE_SHADER || kind == CALL_CREATE_SHADER))
+        {
+            const GLuint shader_id = (kind == CALL_CREATE_SHADER) ? call->mRet.GetAsUInt() : call->mArgs[0]->GetAsUInt();
+            const int index = shader_index(input.contexts[input.context_index], kind, shader_id);
+            if (used_shaders.count(std::make_pair(input.context_index, index)) == 0) { count++; continue; }
+        }
+
+        if (kind == CALL_CLIENT_WAIT_SYNC)
+        {
+            const uint64_t timeout = call->mArgs[2]->GetAsUInt64();
+            if (timeout == 0 && options.waitsync)
+            {
+                call->mArgs[2]->mUint64 = UINT64_MAX;
+                count++;
+            }
+            if (!options.removeSync) writeout(outputFile, call);
+            else { removeout(outputFile, call); count++; }
+        }
+        else if (kind == CALL_SYNC && options.removeSync) { removeout(outputFile, call); count++; }
+        else if (kind == CALL_GENERATE_MIPMAP && options.unusedMipmaps.count(call->mCallNo) > 0) { removeout(outputFile, call); count++; }
+        else if (kind == CALL_BUFFER_DATA)
+        {
+            const GLenum target = call->mArgs[0]->GetAsUInt();
+            const StateTracker::VertexArrayObject& vao = input.contexts[input.context_index].vaos.at(input.contexts[input.context_index].vao_index);
+            if (vao.boundBufferIds.count(target) == 0 || vao.boundBufferIds.at(target).count(0) == 0)
+            {
+                printf("%d : no bound buffer!\n", (int)call->mCallNo);
+                abort();
+            }
+            const GLuint id = vao.boundBufferIds.at(target).at(0).buffer;
+            if (id == 0)
+            {
+                writeout(outputFile, call);
+                continue;
+            }
+            if (!input.contexts[input.context_index].buffers.contains(id))
+            {
+                printf("%d : buffer %d not tracked!\n", (int)call->mCallNo, (int)id);
+                abort();
+            }
+            const int buffer_index = input.contexts[input.context_index].buffers.remap(id);
+            if (options.unusedBuffers.count(std::make_pair(input.context_index, buffer_index)) == 0)
+            {
+                writeout(outputFile, call);
+            } // else skip it
+            else
+            {
+                count++;
+                removeout(outputFile, call);
+            }
+        }
+        else if (kind == CALL_GET_ERROR && options.removeErrors)
+        {
+            // don't output it
+            count++;
+            removeout(outputFile, call);
+        }
+        else if (options.removeTimestamps && kind == CALL_TIMESTAMP)
+        {
+            count++; // don't output it
+            removeout(outputFile, call);
+        }
+        else if (kind == CALL_TEXTURE)
+        {
+            const GLenum target = interpret_texture_target(call->mArgs[0]->GetAsUInt());
+            const GLuint unit = input.contexts[input.context_index].activeTextureUnit;
+            const GLuint tex_id = input.contexts[input.context_index].textureUnits[unit][target];
+            assert(tex_id != 0);
+            const int target_texture_index = input.contexts[input.context_index].textures.remap(tex_id);
+            if (input.contexts[input.context_index].textures.contains(tex_id) && tex_id != 0)
+            {
+                if (options.unusedTextures.count(std::make_pair(input.context_index, target_texture_index)) > 0)
+                {
+                    count++;
+                    removeout(outputFile, call);
+                    continue;
+                }
+            }
+            writeout(outputFile, call);
+            if (call->mCallName == "glTexImage2D" && options.uninitTextures.count(std::make_pair(input.context_index, target_texture_index)) > 0)
+            {
+                const GLint level = call->mArgs[1]->GetAsUInt();
+                //const GLint internalFormat = call->mArgs[2]->GetAsUInt();
+                const GLsizei width = call->mArgs[3]->GetAsUInt();
+                const GLsizei height = call->mArgs[4]->GetAsUInt();
+                //GLint border = call->mArgs[5]->GetAsUInt();
+                const GLenum format = call->mArgs[6]->GetAsUInt();
+                const GLenum type = call->mArgs[7]->GetAsUInt();
+                common::CallTM c("glTexSubImage2D");
+                c.mArgs.push_back(new common::ValueTM(target));
+                c.mArgs.push_back(new common::ValueTM(level)); // level
+                c.mArgs.push_back(new common::ValueTM(0)); // xoffset
+                c.mArgs.push_back(new common::ValueTM(0)); // yoffset
+                c.mArgs.push_back(new common::ValueTM(width));
+                c.mArgs.push_back(new common::ValueTM(height));
+                c.mArgs.push_back(new common::ValueTM(format));
+                c.mArgs.push_back(new common::ValueTM(type));
+                const unsigned tsize = width * height * 4 * 4; // max size
+                std::vector<char> zeroes(tsize);
+                c.mArgs.push_back(common::CreateBlobOpaqueValue(tsize, zeroes.data()));
+                addout(outputFile, &c, call);
+                count++;
+            }
+            else if ((call->mCallName == "glTexStorage3D" || call->mCallName == "glTexImage3D") && options.uninitTextures.count(std::make_pair(input.context_index, target_texture_index)) > 0)
+            {
+                printf("Support for removing unused 3D textures not implemented yet!\n");
+                assert(false); // TBD
+            }
+            else if ((call->mCallName == "glTexStorage2DMultisample" || call->mCallName == "glTexStorage2D") && options.uninitTextures.count(std::make_pair(input.context_index, target_texture_index)) > 0)
+            {
+                const GLsizei levels = call->mArgs[1]->GetAsUInt();
+                const GLenum format = call->mArgs[2]->GetAsUInt();
+                const GLsizei width = call->mArgs[3]->GetAsUInt();
+                const GLsizei height = call->mArgs[4]->GetAsUInt();
+                if (isCompressedFormat(format))
+                {
+                    for (int i = 0; i < levels; i++)
+                    {
+                        const GLsizei w = width / (i + 1);
+                        const GLsizei h = height / (i + 1);
+                        common::CallTM c("glCompressedTexSubImage2D");
+                        c.mArgs.push_back(new common::ValueTM(target));
+                        c.mArgs.push_back(new common::ValueTM(i)); // level
+                        c.mArgs.push_back(new common::ValueTM(0)); // xoffset
+                        c.mArgs.push_back(new common::ValueTM(0)); // yoffset
+                        c.mArgs.push_back(new common::ValueTM(w));
+                        c.mArgs.push_back(new common::ValueTM(h));
+                        c.mArgs.push_back(new common::ValueTM(format));
+                        const unsigned tsize = w * h * 4 * 4; // max size
+                        c.mArgs.push_back(new common::ValueTM(tsize)); // image size
+                        std::vector<char> zeroes(tsize);
+                        c.mArgs.push_back(common::CreateBlobOpaqueValue(tsize, zeroes.data()));
+                        addout(outputFile, &c, call);
+                    }
+                }
+                else // uncompressed
+                {
+                    for (int i = 0; i < levels; i++)
+                    {
+                        const GLsizei w = width / (i + 1);
+                        const GLsizei h = height / (i + 1);
+                        common::CallTM c("glTexSubImage2D");
+                        c.mArgs.push_back(new common::ValueTM(target));
+                        c.mArgs.push_back(new common::ValueTM(i)); // level
+                        c.mArgs.push_back(new common::ValueTM(0)); // xoffset
+                        c.mArgs.push_back(new common::ValueTM(0)); // yoffset
+                        c.mArgs.push_back(new common::ValueTM(w));
+                        c.mArgs.push_back(new common::ValueTM(h));
+                        c.mArgs.push_back(new common::ValueTM(sized_to_unsized_format(format)));
+                        c.mArgs.push_back(new common::ValueTM(sized_to_unsized_type(format)));
+                        const unsigned tsize = w * h * 4 * 4; // max size
+                        std::vector<char> zeroes(tsize);
+                        c.mArgs.push_back(common::CreateBlobOpaqueValue(tsize, zeroes.data()));
+                        addout(outputFile, &c, call);
+                    }
+                }
+                count++;
+            }
+        }
+        else
+        {
+            writeout(outputFile, call);
+        }
+    }
+    input.close();
+    if (!options.onlyCount && !options.patch)
+    {
+        write_header(outputFile, header, source_trace_filename, count);
+    }
+    return count;
+}
+
+/// A reader hands over its calls once a batch holds this much data
+static const size_t BATCH_BYTES = 4 * 1024 * 1024;
+/// Batches decompressed ahead of the conversion
+static const size_t QUEUE_BATCHES = 4;
+
+/// Raw calls in trace order, with function ids already changed to those in ApiInfo
+struct CallBatch
+{
+    struct Call
+    {
+        uint32_t offset; // of the call in data, header included
+        uint32_t size;
+        uint32_t callNo;
+        int frame;       // frames counted by ParseInterface after this call
+        int context;     // for shader calls, the context and shader index as ParseInterface has them
+        int shader;
+    };
+
+    std::vector<char> data;
+    std::vector<Call> calls;
+    bool last = false;
+};
+
+/// Decompresses the trace on its own thread, and finds out everything about the calls that
+/// the conversion needs to know from earlier calls, so that converting a call depends on
+/// nothing but the call itself
+class TraceReader
+{
+public:
+    TraceReader() : mBatch(new CallBatch), mQueue(QUEUE_BATCHES) {}
+
+    ~TraceReader()
+    {
+        if (mThread.joinable()) mThread.join();
+    }
+
+    bool open(const std::string& name)
+    {
+        if (!mFile.Open(name.c_str()))
+        {
+            return false;
+        }
+        mKinds = input_call_kinds(mFile);
+        mOutputId.assign(mFile.mExIdToName.size(), 0);
+        for (unsigned id = 1; id < mFile.mExIdToName.size(); ++id)
+        {
+            if (!mFile.mExIdToName[id].empty())
+            {
+                mOutputId[id] = common::gApiInfo.NameToId(mFile.mExIdToName[id].c_str());
+            }
+        }
+        const Json::Value header = mFile.getJSONHeader();
+        mTracker.reset(new ShaderTracker(header["defaultTid"].asUInt(), only_default_thread(header)));
+        return true;
+    }
+
+    /// Older traces encode some texture calls differently from what OutFile writes
+    bool isCurrentFormat() const { return mFile.getHeaderVersion() >= common::HEADER_VERSION_4; }
+
+    void start()
+    {
+        mThread = std::thread(&TraceReader::run, this);
+    }
+
+    /// Move to the next call. Returns false at the end of the trace.
+    bool advance()
+    {
+        mIndex++;
+        while (mIndex >= mBatch->calls.size())
+        {
+            if (mBatch->last) return false;
+            mBatch = mQueue.pop();
+            mIndex = 0;
+        }
+        return true;
+    }
+
+    const CallBatch::Call& current() const { return mBatch->calls[mIndex]; }
+    char *currentData() const { return mBatch->data.data() + current().offset; }
+
+    common::InFile mFile;
+    unsigned mSkipped = 0;
+
+private:
+    void run();
+
+    std::vector<CallKind> mKinds;
+    std::vector<unsigned short> mOutputId;
+    std::unique_ptr<ShaderTracker> mTracker;
+    std::unique_ptr<CallBatch> mBatch;
+    size_t mIndex = 0;
+    common::BoundedQueue<std::unique_ptr<CallBatch>> mQueue;
+    std::thread mThread;
+};
+
+void TraceReader::run()
+{
+    std::unique_ptr<CallBatch> batch(new CallBatch);
+    batch->data.reserve(BATCH_BYTES);
+    int frames = 0;
+
+    void *fptr = nullptr;
+    common::BCall_vlen call;
+    char *src = nullptr;
+    while (mFile.GetNextCall(fptr, call, src))
+    {
+        const unsigned short id = mOutputId[call.funcId];
+        if (id == 0)
+        {
+            if (mSkipped++ == 0) DBG_LOG("Skipping %s, which this build does not know\n", mFile.ExIdToName(call.funcId));
+            continue;
+        }
+        const CallKind kind = mKinds[call.funcId];
+        CallBatch::Call c;
+        c.callNo = mFile.curCallNo;
+        c.context = UNBOUND;
+        c.shader = UNBOUND;
+        if (mTracker->tracks(call.tid))
+        {
+            if (kind == CALL_SWAP)
+            {
+                frames++;
+            }
+            else if (options.removeUnusedShaders && (ShaderTracker::interested(kind) || kind == CALL_SHADER))
+            {
+                // ParseInterface looks at calls after updating its state with them, so do the same
+                const common::CallTM tm(mFile, mFile.curCallNo, call);
+                c.context = mTracker->current(call.tid);
+                if (ShaderTracker::interested(kind)) mTracker->update(kind, tm);
+                if (c.context != UNBOUND && kind != CALL_CREATE_CONTEXT && kind != CALL_MAKE_CURRENT)
+                {
+                    const GLuint id = (kind == CALL_CREATE_SHADER) ? tm.mRet.GetAsUInt() : tm.mArgs[0]->GetAsUInt();
+                    c.shader = shader_index(mTracker->contexts[c.context], kind, id);
+                }
+            }
+        }
+        c.frame = frames;
+        const unsigned headerSize = (mFile.mExIdToLen[call.funcId] == 0) ? sizeof(common::BCall_vlen) : sizeof(common::BCall);
+        const char *data = src - headerSize;
+        c.offset = batch->data.size();
+        c.size = call.toNext;
+        batch->data.insert(batch->data.end(), data, data + c.size);
+        ((common::BCall*)(batch->data.data() + c.offset))->funcId = id;
+        batch->calls.push_back(c);
+
+        if (batch->data.size() >= BATCH_BYTES)
+        {
+            mQueue.push(std::move(batch));
+            batch.reset(new CallBatch);
+            batch->data.reserve(BATCH_BYTES);
+        }
+    }
+    batch->last = true;
+    mQueue.push(std::move(batch));
+}
+
+/// Converts calls as they are in the trace file, for everything except what converter() is
+/// needed for. Decompression runs on the thread of the reader, and compression on the thread
+/// of the output file, so that this thread only has to decide what happens to each call.
+static int convert_raw(TraceReader& reader, const std::string& source_trace_filename, common::OutFile& outputFile)
+{
+    int count = 0;
+    const bool write = !options.onlyCount;
+    reader.start();
+    while (reader.advance())
+    {
+        const CallBatch::Call& c = reader.current();
+        char *data = reader.currentData();
+        const common::BCall *call = (const common::BCall*)data;
+        if (options.lastFrame == -1 || c.frame < options.lastFrame)
+        {
+            if (options.checksums.size() > 0 && options.checksums.count(c.callNo) > 0)
+            {
+                std::unique_ptr<common::CallTM> newcall(checksum_call(c.callNo));
+                newcall->mTid = call->tid;
+                newcall->mCallNo = c.callNo;
+                if (write) newcall->Serialize(outputFile, -1, true);
+                count++;
+            }
+
+            bool keep = true;
+            const CallKind kind = call_kinds[call->funcId];
+            if (options.removeUnusedShaders && (kind == CALL_SHADER || kind == CALL_DELETE_SHADER || kind == CALL_CREATE_SHADER)
+                && c.context != UNBOUND && used_shaders.count(std::make_pair(c.context, c.shader)) == 0)
+            {
+                count++;
+                continue;
+            }
+            switch (kind)
+            {
+            case CALL_CLIENT_WAIT_SYNC:
+                if (options.waitsync)
+                {
+                    // glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+                    char *timeout = data + sizeof(common::BCall) + sizeof(uint64_t) + sizeof(uint32_t);
+                    uint64_t value = 0;
+                    memcpy(&value, timeout, sizeof(value));
+                    if (value == 0)
+                    {
+                        value = UINT64_MAX;
+                        memcpy(timeout, &value, sizeof(value));
+                        count++;
+                    }
+                }
+                keep = !options.removeSync;
+                break;
+            case CALL_SYNC: keep = !options.removeSync; break;
+            case CALL_GENERATE_MIPMAP: keep = options.unusedMipmaps.count(c.callNo) == 0; break;
+            case CALL_GET_ERROR: keep = !options.removeErrors; break;
+            case CALL_TIMESTAMP: keep = !options.removeTimestamps; break;
+            default: break;
+            }
+            if (!keep)
+            {
+                count++;
+                continue;
+            }
+        }
+        if (write)
+        {
+            memcpy(outputFile.Scratch(), data, c.size);
+            outputFile.Progress(c.size);
+        }
+    }
+    if (reader.mSkipped > 0) DBG_LOG("Skipped %u calls that this build does not know\n", reader.mSkipped);
+    if (write)
+    {
+        write_header(outputFile, reader.mFile.getJSONHeader(), source_trace_filename, count);
+    }
+    return count;
+}
+
+
+bool convertTrace(const std::string& source_trace_filename, const std::string& target_trace_filename, const ConvertOptions& convertOptions, ConvertResult *result)
+{
+    options = convertOptions;
+    used_shaders.clear();
+    classify_calls();
+    if (options.removeUnusedShaders && !prepass(source_trace_filename))
+    {
+        return false;
+    }
+
+    // Unused textures and buffers are found by what is bound when they are uploaded to
+    const bool needs_state = options.patch || options.unusedTextures.size() > 0 || options.unusedBuffers.size() > 0 || options.uninitTextures.size() > 0;
+    common::OutFile outputFile;
+    if (!needs_state && !options.decode)
+    {
+        TraceReader reader;
+        if (!reader.open(source_trace_filename))
+        {
+            std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
+            return false;
+        }
+        if (reader.isCurrentFormat())
+        {
+            if (!options.onlyCount)
+            {
+                if (!outputFile.Open(target_trace_filename.c_str()))
+                {
+                    std::cerr << "Failed to open for writing: " << target_trace_filename << std::endl;
+                    return false;
+                }
+                outputFile.CompressInBackground();
+            }
+            const int count = convert_raw(reader, source_trace_filename, outputFile);
+            if (!options.onlyCount) outputFile.Close();
+            if (result)
+            {
+                result->changed = count;
+                result->raw = true;
+            }
+            return true;
+        }
+    }
+
+    ParseInterface input(true);
+    input.setQuickMode(true);
+    input.setScreenshots(false);
+    if (!input.open(source_trace_filename))
+    {
+        std::cerr << "Failed to open for reading: " << source_trace_filename << std::endl;
+        return false;
+    }
+    if (options.patch)
+    {
+        pf = common::patchfile_open(input.inputFile, target_trace_filename.c_str());
+        DBG_LOG("Opened patchfile %s\n", target_trace_filename.c_str());
+    }
+    else if (!options.onlyCount)
+    {
+        if (!outputFile.Open(target_trace_filename.c_str()))
+        {
+            std::cerr << "Failed to open for writing: " << target_trace_filename << std::endl;
+            return false;
+        }
+        outputFile.CompressInBackground();
+    }
+    const int count = converter(input, source_trace_filename, outputFile);
+    if (!options.onlyCount && !options.patch) outputFile.Close();
+    if (options.patch) common::patchfile_close(pf);
+    if (result)
+    {
+        result->changed = count;
+        result->raw = false;
+    }
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef _TOOL_TRACE_CONVERTER_HPP_
+#define _TOOL_TRACE_CONVERTER_HPP_
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// All kinds of misc changes to a trace, used by converter.
+//
+// Changes that only need to look at each call by itself are done on the raw calls, with
+// decompression and compression on threads of their own. Removing unused shaders also needs
+// the context and shader indices of ParseInterface, which are followed with its code while
+// reading, decoding only the calls that change them. Everything that needs more state, patch
+// files, and traces older than HEADER_VERSION_4 are converted through ParseInterface.
+
+struct ConvertChecksum
+{
+    std::string md5;
+    int attachment;
+};
+
+struct ConvertOptions
+{
+    bool waitsync = false;             // add a non-zero timeout to glClientWaitSync and glWaitSync calls
+    bool removeSync = false;
+    bool removeTimestamps = false;
+    bool removeErrors = false;         // glGetError and eglGetError
+    bool removeUnusedShaders = false;
+    bool useScanCache = false;         // keep what removing unused shaders finds out in a file next to the trace
+    bool onlyCount = false;            // only count, write nothing
+    bool patch = false;                // write the changes to a patch file instead
+    bool decode = false;               // convert through ParseInterface even where raw calls would do, for verification only
+    int endFrame = -1;                 // only recorded in the header
+    int lastFrame = -1;                // copy the trace unchanged from this frame on, -1 for none
+    std::set<int> unusedMipmaps;       // call numbers
+    std::set<std::pair<int, int>> unusedTextures; // context index + texture index
+    std::set<std::pair<int, int>> unusedBuffers;  // context index + buffer index
+    std::set<std::pair<int, int>> uninitTextures; // context index + texture index
+    std::unordered_map<int, ConvertChecksum> checksums; // call number -> checksum to add before it
+};
+
+struct ConvertResult
+{
+    int changed = 0; // calls removed, changed or added
+    bool raw = false; // converted on the raw calls
+};
+
+/// Converts input into output, which is a patch file with options.patch and not used with
+/// options.onlyCount. ApiInfo must have its entries registered. Not reentrant. Returns false
+/// if a file could not be opened.
+bool convertTrace(const std::string& input, const std::string& output, const ConvertOptions& options, ConvertResult *result = nullptr);
+
+#endif
@@ -328,15 +328,10 @@ public:
 
     virtual bool write(CallInterface *call)
     {
-        const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-        static char buffer[WRITE_BUF_LEN];
-
         PATCall *pCall = dynamic_cast<PATCall*>(call);
         if (pCall)
         {
-            char *dest = buffer;
-            dest = pCall->_call->Serialize(dest);
-            _outfile->Write(buffer, dest-buffer);
+            pCall->_call->Serialize(*_outfile);
         }
 
         return true;
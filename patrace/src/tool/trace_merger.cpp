@@ -0,0 +1,574 @@
+#include "tool/trace_merger.hpp"
+
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <set>
+#include <thread>
+#include <string.h>
+
+#include "common/api_info.hpp"
+#include "common/bounded_queue.hpp"
+#include "common/file_format.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/out_file.hpp"
+#include "common/os.hpp"
+#include "common/trace_model.hpp"
+#include "tool/utils.hpp"
+#include "json/writer.h"
+
+namespace {
+
+/// A reader hands over its calls once a batch holds this much data
+const size_t BATCH_BYTES = 1024 * 1024;
+/// Batches decoded ahead of the merge, per input
+const size_t QUEUE_BATCHES = 4;
+
+/// Raw calls of one input trace, in trace order
+struct CallBatch
+{
+    struct Call
+    {
+        uint64_t timestamp;    // last paTimestamp seen before this call
+        common::BCall header;  // funcId is already the id in the output
+        uint32_t offset;       // of the arguments in data
+        uint32_t size;         // of the arguments
+    };
+
+    std::vector<char> data;
+    std::vector<Call> calls;
+    bool last = false;
+};
+
+/// Reads one input trace on its own thread
+class TraceReader
+{
+public:
+    TraceReader() : mBatch(new CallBatch), mQueue(QUEUE_BATCHES) {}
+
+    ~TraceReader()
+    {
+        if (mThread.joinable()) mThread.join();
+    }
+
+    bool open(const std::string& name)
+    {
+        if (!mFile.Open(name.c_str()))
+        {
+            return false;
+        }
+        // Input function ids to output function ids
+        mOutputId.assign(mFile.mExIdToName.size(), 0);
+        for (unsigned id = 1; id < mFile.mExIdToName.size(); ++id)
+        {
+            if (!mFile.mExIdToName[id].empty())
+            {
+                mOutputId[id] = common::gApiInfo.NameToId(mFile.mExIdToName[id].c_str());
+            }
+        }
+        return true;
+    }
+
+    void start()
+    {
+        mThread = std::thread(&TraceReader::run, this);
+    }
+
+    void join()
+    {
+        if (mThread.joinable()) mThread.join();
+    }
+
+    /// Move to the next call. Returns false at the end of the trace.
+    bool advance()
+    {
+        mIndex++;
+        while (mIndex >= mBatch->calls.size())
+        {
+            if (mBatch->last) return false;
+            mBatch = mQueue.pop();
+            mIndex = 0;
+        }
+        return true;
+    }
+
+    const CallBatch::Call& current() const { return mBatch->calls[mIndex]; }
+    char *currentArgs() const { return mBatch->data.data() + current().offset; }
+
+    common::InFile mFile;
+    unsigned mTimestamps = 0;
+    unsigned mSkipped = 0;
+
+private:
+    void run();
+
+    std::vector<unsigned short> mOutputId;
+    std::unique_ptr<CallBatch> mBatch;
+    size_t mIndex = 0;
+    common::BoundedQueue<std::unique_ptr<CallBatch>> mQueue;
+    std::thread mThread;
+};
+
+void TraceReader::run()
+{
+    const unsigned short timestampId = mFile.NameToExId("paTimestamp");
+    // Traces older than HEADER_VERSION_4 encode some texture calls differently
+    const bool currentFormat = mFile.getHeaderVersion() >= common::HEADER_VERSION_4;
+    std::vector<char> reencoded;
+    uint64_t timestamp = 0;
+    std::unique_ptr<CallBatch> batch(new CallBatch);
+    batch->data.reserve(BATCH_BYTES);
+
+    void *fptr = nullptr;
+    common::BCall_vlen call;
+    char *src = nullptr;
+    while (mFile.GetNextCall(fptr, call, src))
+    {
+        if (call.funcId == timestampId)
+        {
+            common::ReadFixed<uint64_t>(src, timestamp);
+            mTimestamps++;
+            continue;
+        }
+        const unsigned short id = mOutputId[call.funcId];
+        if (id == 0)
+        {
+            if (mSkipped++ == 0) DBG_LOG("Skipping %s, which this build does not know\n", mFile.ExIdToName(call.funcId));
+            continue;
+        }
+        CallBatch::Call c;
+        c.timestamp = timestamp;
+        c.header = call;
+        c.header.funcId = id;
+        c.offset = batch->data.size();
+        if (currentFormat)
+        {
+            const unsigned headerSize = (mFile.mExIdToLen[call.funcId] == 0) ? sizeof(common::BCall_vlen) : sizeof(common::BCall);
+            c.size = call.toNext - headerSize;
+            batch->data.insert(batch->data.end(), src, src + c.size);
+        }
+        else
+        {
+            // Re-encode the arguments as OutFile writes them
+            const common::CallTM decoded(mFile, mFile.curCallNo, call, src);
+            reencoded.resize(decoded.SerializedSizeBound());
+            char *end = decoded.Serialize(reencoded.data(), id);
+            const unsigned headerSize = (common::gApiInfo.IdToLenArr[id] == 0) ? sizeof(common::BCall_vlen) : sizeof(common::BCall);
+            c.size = end - reencoded.data() - headerSize;
+            batch->data.insert(batch->data.end(), reencoded.data() + headerSize, end);
+        }
+        batch->calls.push_back(c);
+
+        if (batch->data.size() >= BATCH_BYTES)
+        {
+            mQueue.push(std::move(batch));
+            batch.reset(new CallBatch);
+            batch->data.reserve(BATCH_BYTES);
+        }
+    }
+    batch->last = true;
+    mQueue.push(std::move(batch));
+}
+
+/// Gives the objects created by each trace names that are unique in the merged trace
+class NameMap
+{
+public:
+    unsigned create(int trace, unsigned name)
+    {
+        unsigned merged = name;
+        while (mNames.count(merged) != 0)
+        {
+            merged++;
+        }
+        mNames[merged] = { trace, name };
+        mMerged[{ trace, name }] = merged;
+        return merged;
+    }
+
+    /// Zero for names the trace has not created
+    unsigned lookup(int trace, unsigned name) const
+    {
+        const auto it = mMerged.find({ trace, name });
+        return (it != mMerged.end()) ? it->second : 0;
+    }
+
+    void destroy(unsigned merged)
+    {
+        const auto it = mNames.find(merged);
+        if (it != mNames.end())
+        {
+            mMerged.erase(it->second);
+            mNames.erase(it);
+        }
+    }
+
+private:
+    std::map<unsigned, std::pair<int, unsigned>> mNames;  // merged name -> trace, original name
+    std::map<std::pair<int, unsigned>, unsigned> mMerged; // trace, original name -> merged name
+};
+
+enum MergeCall : unsigned char
+{
+    MERGE_COPY,
+    MERGE_CREATEWINDOWSURFACE,
+    MERGE_CREATEPBUFFERSURFACE,
+    MERGE_USESURFACE,
+    MERGE_DESTROYSURFACE,
+    MERGE_CREATECONTEXT,
+    MERGE_DESTROYCONTEXT,
+    MERGE_GETCURRENTCONTEXT,
+    MERGE_MAKECURRENT,
+    MERGE_CREATEIMAGE,
+    MERGE_USEIMAGE,
+    MERGE_DESTROYIMAGE,
+    MERGE_CREATESYNC,
+    MERGE_DESTROYSYNC,
+};
+
+const std::pair<const char*, MergeCall> mergeCalls[] =
+{
+    { "eglCreateWindowSurface2", MERGE_CREATEWINDOWSURFACE },
+    { "eglCreatePbufferSurface", MERGE_CREATEPBUFFERSURFACE },
+    { "eglQuerySurface", MERGE_USESURFACE },
+    { "eglSwapBuffers", MERGE_USESURFACE },
+    { "eglDestroySurface", MERGE_DESTROYSURFACE },
+    { "eglCreateContext", MERGE_CREATECONTEXT },
+    { "eglDestroyContext", MERGE_DESTROYCONTEXT },
+    { "eglGetCurrentContext", MERGE_GETCURRENTCONTEXT },
+    { "eglMakeCurrent", MERGE_MAKECURRENT },
+    { "eglCreateImageKHR", MERGE_CREATEIMAGE },
+    { "eglCreateImage", MERGE_CREATEIMAGE },
+    { "glEGLImageTargetTexture2DOES", MERGE_USEIMAGE },
+    { "eglDestroyImageKHR", MERGE_DESTROYIMAGE },
+    { "eglDestroyImage", MERGE_DESTROYIMAGE },
+    { "eglCreateSyncKHR", MERGE_CREATESYNC },
+    { "eglDestroySyncKHR", MERGE_DESTROYSYNC },
+};
+
+/// The 32 bit argument at the given index, counting 32 bit words
+inline uint32_t& argAt(char *args, unsigned index)
+{
+    return *(uint32_t*)(args + index * sizeof(uint32_t));
+}
+
+/// The 32 bit argument following the array at the given index, and 'skip' further 32 bit arguments
+inline uint32_t& argAfterArray(char *args, unsigned index, unsigned skip)
+{
+    common::Array<char> array;
+    char *src = common::Read1DArray(args + index * sizeof(uint32_t), array);
+    return argAt(src, skip);
+}
+
+class Merger
+{
+public:
+    Merger()
+    {
+        mKind.assign(common::gApiInfo.MaxSigId + 1, MERGE_COPY);
+        for (const auto& entry : mergeCalls)
+        {
+            const unsigned short id = common::gApiInfo.NameToId(entry.first);
+            if (id) mKind[id] = entry.second;
+        }
+    }
+
+    void run(std::vector<std::unique_ptr<TraceReader>>& readers, common::OutFile& out);
+
+    unsigned mCallCount = 0;
+
+private:
+    void rename(int trace, MergeCall kind, char *args);
+    unsigned char threadId(int trace, unsigned char tid);
+
+    std::vector<unsigned char> mKind;
+    NameMap mSurfaces;
+    NameMap mContexts;
+    NameMap mImages;
+    NameMap mSyncs;
+    std::vector<std::array<short, 256>> mThreadIds; // per trace, -1 if not seen yet
+    int mThreadCount = 0;
+};
+
+void Merger::rename(int trace, MergeCall kind, char *args)
+{
+    switch (kind)
+    {
+    case MERGE_CREATEWINDOWSURFACE:
+    {
+        // eglCreateWindowSurface2(dpy, config, win, attrib_list, x, y, width, height) -> surface
+        uint32_t& surface = argAfterArray(args, 3, 4);
+        surface = mSurfaces.create(trace, surface);
+        // The window only needs to be different for every surface
+        argAt(args, 2) = surface;
+        break;
+    }
+    case MERGE_CREATEPBUFFERSURFACE:
+    {
+        // eglCreatePbufferSurface(dpy, config, attrib_list) -> surface
+        uint32_t& surface = argAfterArray(args, 2, 0);
+        surface = mSurfaces.create(trace, surface);
+        break;
+    }
+    case MERGE_USESURFACE:
+        argAt(args, 1) = mSurfaces.lookup(trace, argAt(args, 1));
+        break;
+    case MERGE_DESTROYSURFACE:
+        argAt(args, 1) = mSurfaces.lookup(trace, argAt(args, 1));
+        mSurfaces.destroy(argAt(args, 1));
+        break;
+    case MERGE_CREATECONTEXT:
+    {
+        // eglCreateContext(dpy, config, share_context, attrib_list) -> context
+        argAt(args, 2) = mContexts.lookup(trace, argAt(args, 2));
+        uint32_t& context = argAfterArray(args, 3, 0);
+        context = mContexts.create(trace, context);
+        break;
+    }
+    case MERGE_DESTROYCONTEXT:
+        argAt(args, 1) = mContexts.lookup(trace, argAt(args, 1));
+        mContexts.destroy(argAt(args, 1));
+        break;
+    case MERGE_GETCURRENTCONTEXT:
+        argAt(args, 0) = mContexts.lookup(trace, argAt(args, 0));
+        break;
+    case MERGE_MAKECURRENT:
+        // eglMakeCurrent(dpy, draw, read, context)
+        argAt(args, 1) = mSurfaces.lookup(trace, argAt(args, 1));
+        argAt(args, 2) = mSurfaces.lookup(trace, argAt(args, 2));
+        argAt(args, 3) = mContexts.lookup(trace, argAt(args, 3));
+        break;
+    case MERGE_CREATEIMAGE:
+    {
+        // eglCreateImage(dpy, context, target, buffer, attrib_list) -> image
+        argAt(args, 1) = mContexts.lookup(trace, argAt(args, 1));
+        uint32_t& image = argAfterArray(args, 4, 0);
+        image = mImages.create(trace, image);
+        break;
+    }
+    case MERGE_USEIMAGE:
+        argAt(args, 1) = mImages.lookup(trace, argAt(args, 1));
+        break;
+    case MERGE_DESTROYIMAGE:
+        argAt(args, 1) = mImages.lookup(trace, argAt(args, 1));
+        mImages.destroy(argAt(args, 1));
+        break;
+    case MERGE_CREATESYNC:
+    {
+        // eglCreateSyncKHR(dpy, type, attrib_list) -> sync
+        uint32_t& sync = argAfterArray(args, 2, 0);
+        sync = mSyncs.create(trace, sync);
+        break;
+    }
+    case MERGE_DESTROYSYNC:
+        argAt(args, 1) = mSyncs.lookup(trace, argAt(args, 1));
+        mSyncs.destroy(argAt(args, 1));
+        break;
+    case MERGE_COPY:
+        break;
+    }
+}
+
+unsigned char Merger::threadId(int trace, unsigned char tid)
+{
+    short& id = mThreadIds[trace][tid];
+    if (id < 0)
+    {
+        if (mThreadCount > 255)
+        {
+            DBG_LOG("Too many threads in the merged traces\n");
+            os::abort();
+        }
+        id = mThreadCount++;
+    }
+    return id;
+}
+
+void Merger::run(std::vector<std::unique_ptr<TraceReader>>& readers, common::OutFile& out)
+{
+    std::array<short, 256> unseen;
+    unseen.fill(-1);
+    mThreadIds.assign(readers.size(), unseen);
+
+    // Lowest timestamp first, then lowest trace index
+    typedef std::pair<uint64_t, unsigned> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (unsigned i = 0; i < readers.size(); ++i)
+    {
+        if (readers[i]->advance()) heads.push({ readers[i]->current().timestamp, i });
+        else DBG_LOG("trace index %d ends.\n", i);
+    }
+
+    while (!heads.empty())
+    {
+        const unsigned trace = heads.top().second;
+        heads.pop();
+        TraceReader& reader = *readers[trace];
+        bool more;
+        // Keep taking calls from this trace for as long as it stays first
+        do
+        {
+            const CallBatch::Call& call = reader.current();
+            char *args = reader.currentArgs();
+            const MergeCall kind = (MergeCall)mKind[call.header.funcId];
+            if (kind != MERGE_COPY)
+            {
+                rename(trace, kind, args);
+            }
+
+            char *dest = out.Scratch();
+            const int len = common::gApiInfo.IdToLenArr[call.header.funcId];
+            if (len == 0)
+            {
+                common::BCall_vlen header(call.header);
+                header.tid = threadId(trace, call.header.tid);
+                header.toNext = sizeof(common::BCall_vlen) + call.size;
+                memcpy(dest, &header, sizeof(header));
+                memcpy(dest + sizeof(header), args, call.size);
+                out.Progress(header.toNext);
+            }
+            else
+            {
+                common::BCall header(call.header);
+                header.tid = threadId(trace, call.header.tid);
+                memcpy(dest, &header, sizeof(header));
+                memcpy(dest + sizeof(header), args, std::min<size_t>(call.size, len - sizeof(header)));
+                out.Progress(len);
+            }
+            mCallCount++;
+
+            more = reader.advance();
+        } while (more && (heads.empty() || Head(reader.current().timestamp, trace) < heads.top()));
+
+        if (more) heads.push({ reader.current().timestamp, trace });
+        else DBG_LOG("trace index %d ends.\n", trace);
+    }
+}
+
+void addJsonArrayEntry(Json::Value &rootArray, Json::Value &nextArray)
+{
+    for (Json::ArrayIndex i = 0; i < nextArray.size(); i++)
+    {
+        Json::Value value = nextArray[i];
+        rootArray.append(value);
+    }
+}
+
+Json::Value mergeHeaders(const std::vector<std::unique_ptr<TraceReader>>& readers, const std::vector<std::string>& inputs, unsigned callCount)
+{
+    // TODO: After merging, it would update index item for context, surfaces, tid for thread in json header.
+    Json::Value jsonRoot = readers[0]->mFile.getJSONHeader();
+    jsonRoot["timestamping"] = false;
+    jsonRoot["callCnt"] = callCount;
+    for (uint32_t i = 1; i < readers.size(); i++)
+    {
+        Json::Value next = readers[i]->mFile.getJSONHeader();
+        jsonRoot["frameCnt"] = jsonRoot["frameCnt"].asInt() + next["frameCnt"].asInt();
+        jsonRoot["glesVersion"] = (jsonRoot["glesVersion"].asInt()>next["glesVersion"].asInt())?jsonRoot["glesVersion"].asInt():next["glesVersion"].asInt();   // here, the glesVersion in json header is set and required from API. save the max?
+
+        jsonRoot["trace_date"] = jsonRoot["trace_date"].asString() + ", " + next["trace_date"].asString();
+        jsonRoot["tracer"] = jsonRoot["tracer"].asString() + ", " + next["tracer"].asString();
+        jsonRoot["tracer_extensions"] = jsonRoot.get("tracer_extensions", "").asString() + ", " + next.get("tracer_extensions", "").asString();
+
+        jsonRoot["capture_device_renderer"] = jsonRoot["capture_device_renderer"].asString() + ", " + next["capture_device_renderer"].asString();
+        jsonRoot["capture_device_shading_language_version"] = jsonRoot["capture_device_shading_language_version"].asString() + ", " + next["capture_device_shading_language_version"].asString();
+        jsonRoot["capture_device_vendor"] = jsonRoot["capture_device_vendor"].asString() + ", " + next["capture_device_vendor"].asString();
+        jsonRoot["capture_device_version"] = jsonRoot["capture_device_version"].asString() + ", " + next["capture_device_version"].asString();
+
+        // Merge extension lists
+        std::set<std::string> extensionsSet;
+        std::string extension;
+        std::string delimiter = " ";
+        std::string s = jsonRoot["capture_device_extensions"].asString();
+        size_t pos_start = 0, pos_end, delim_len = delimiter.length();
+        // create set for jsonRoot
+        while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos)
+        {
+            extension = s.substr(pos_start, pos_end - pos_start);
+            pos_start = pos_end + delim_len;
+            extensionsSet.insert(extension);
+        }
+        pos_start = 0;
+        pos_end = delim_len = delimiter.length();
+        s = next["capture_device_extensions"].asString();
+        // insert&append new extentions
+        while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos)
+        {
+            extension = s.substr(pos_start, pos_end - pos_start);
+            pos_start = pos_end + delim_len;
+            if (extensionsSet.count(extension) == 0)
+            {
+                extensionsSet.insert(extension);
+                jsonRoot["capture_device_extensions"] = jsonRoot["capture_device_extensions"].asString() + extension + delimiter;
+            }
+        }
+
+        addJsonArrayEntry(jsonRoot["contexts"], next["contexts"]);
+        addJsonArrayEntry(jsonRoot["surfaces"], next["surfaces"]);
+        addJsonArrayEntry(jsonRoot["texCompress"], next["texCompress"]);
+        addJsonArrayEntry(jsonRoot["threads"], next["threads"]);
+    }
+    Json::Value info;
+    info["command_type"] = "merge trace";
+    addConversionEntry2(jsonRoot, "merge_trace", inputs, info);
+    return jsonRoot;
+}
+
+}
+
+bool mergeTraces(const std::vector<std::string>& inputs, const std::string& output, MergeResult *result)
+{
+    std::vector<std::unique_ptr<TraceReader>> readers;
+    for (const std::string& name : inputs)
+    {
+        readers.emplace_back(new TraceReader);
+        if (!readers.back()->open(name))
+        {
+            DBG_LOG("Failed to open for reading: %s\n", name.c_str());
+            return false;
+        }
+    }
+
+    common::OutFile outputFile;
+    if (!outputFile.Open(output.c_str()))
+    {
+        DBG_LOG("Failed to open for writing: %s\n", output.c_str());
+        return false;
+    }
+
+    for (auto& reader : readers)
+    {
+        reader->start();
+    }
+    Merger merger;
+    merger.run(readers, outputFile);
+    for (auto& reader : readers)
+    {
+        reader->join();
+    }
+
+    Json::FastWriter writer;
+    const std::string json_header = writer.write(mergeHeaders(readers, inputs, merger.mCallCount));
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+    outputFile.Close();
+    for (auto& reader : readers)
+    {
+        reader->mFile.Close();
+    }
+
+    if (result)
+    {
+        result->calls = merger.mCallCount;
+        result->timestamps = 0;
+        result->skipped = 0;
+        for (const auto& reader : readers)
+        {
+            result->timestamps += reader->mTimestamps;
+            result->skipped += reader->mSkipped;
+        }
+    }
+    return true;
+}
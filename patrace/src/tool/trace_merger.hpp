@@ -0,0 +1,31 @@
+#ifndef _TOOL_TRACE_MERGER_HPP_
+#define _TOOL_TRACE_MERGER_HPP_
+
+#include <string>
+#include <vector>
+
+// Merges several traces into one, used by merge_trace.
+//
+// Calls are interleaved by the paTimestamp calls recorded in each trace. The next
+// call always comes from the trace with the lowest last seen timestamp, and the
+// trace given first wins ties. The paTimestamp calls themselves are dropped.
+//
+// EGL surfaces, contexts, images and syncs are renamed so that names from
+// different traces do not collide, and thread ids are renumbered in order of
+// first appearance. All other calls are copied unchanged, except that the calls of
+// traces older than HEADER_VERSION_4 are re-encoded in the current format.
+//
+// Each input is read and decompressed on its own thread, which hands batches of
+// raw calls to the merging thread through a bounded queue.
+
+struct MergeResult
+{
+    unsigned calls = 0;      // calls written
+    unsigned timestamps = 0; // paTimestamp calls dropped
+    unsigned skipped = 0;    // calls unknown to this build, dropped
+};
+
+/// Returns false if any file could not be opened
+bool mergeTraces(const std::vector<std::string>& inputs, const std::string& output, MergeResult *result = nullptr);
+
+#endif
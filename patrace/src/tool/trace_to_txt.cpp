@@ -141,6 +141,7 @@ int main(int argc, const char* argv[])
     common::TraceFileTM inputFile(CALL_BATCH_SIZE);
     inputFile.Open(filename, false);
     int drawCallNum = 0;
+    std::string line;
 
     for (common::CallTM* curCall = inputFile.NextCall(); curCall != nullptr; curCall = inputFile.NextCall())
     {
@@ -170,7 +171,9 @@ int main(int argc, const char* argv[])
             fprintf(fp, " [d:%d]", drawCallNum++);
         }
         const char *injected = curCall->mInjected ? "INJECTED " : "";
-        fprintf(fp, " %d : %s%s\n", curCall->mCallNo, injected, curCall->ToStr(false).c_str());
+        line.clear();
+        curCall->ToStr(line, false);
+        fprintf(fp, " %d : %s%s\n", curCall->mCallNo, injected, line.c_str());
     }
 
     fclose(fp);
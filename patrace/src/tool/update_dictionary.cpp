@@ -4,13 +4,13 @@
 // Makes trace files look like they have been created with a very old tracer by optimizing their sigbooks.
 //
 
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <list>
 #include <vector>
-#include <map>
+#include <string>
+#include <unordered_map>
 #include <stdbool.h>
 
 #include <snappy.h>
@@ -76,6 +76,102 @@ bool read_compressed_length(unsigned *length, FILE *in)
 	return true;
 }
 
+/// Call size of functions in the sigbook that this build does not know
+static const uint32_t UNKNOWN_FUNCTION = UINT32_MAX;
+
+/// Reads and decompresses the next chunk into out. Returns false at the end of the file.
+bool read_chunk(FILE *in, std::vector<char>& compressed, std::vector<char>& out)
+{
+	uint32_t compressed_length = 0;
+	if (!read_compressed_length(&compressed_length, in))
+	{
+		return false;
+	}
+	compressed.resize(compressed_length);
+	myread(compressed.data(), compressed_length, in, "reading chunk");
+	size_t size = 0;
+	if (snappy::GetUncompressedLength(compressed.data(), compressed.size(), &size) == false)
+	{
+		printf("Error checking chunk size\n");
+		abort();
+	}
+	out.resize(size);
+	if (snappy::RawUncompress(compressed.data(), compressed.size(), out.data()) == false)
+	{
+		printf("Error decompressing chunk\n");
+		abort();
+	}
+	return true;
+}
+
+/// Reads the sigbook at the start of the first chunk, and looks up the size of the calls of each function in it.
+char *read_sigbook(char *src, uint32_t& mMaxSigId, std::vector<std::string>& stored_sigbook, std::vector<uint32_t>& call_sizes)
+{
+	uint32_t sigbookToNext = 0;
+	src = common::ReadFixed(src, sigbookToNext); // should be zero -- looks unimplemented
+	src = common::ReadFixed(src, mMaxSigId);
+	stored_sigbook.resize(mMaxSigId + 1);
+	call_sizes.resize(mMaxSigId + 1, UNKNOWN_FUNCTION);
+	for (unsigned id = 1; id <= mMaxSigId; ++id)
+	{
+		uint32_t notused = 0;
+		src = common::ReadFixed(src, notused); // should be identical to id, but never checked or used, alas
+		char *str = nullptr;
+		src = common::ReadString(src, str);
+		if (str)
+		{
+			stored_sigbook[id] = std::string(str);
+		}
+	}
+
+	// File Ids may be different from code Ids, so go by name
+	std::unordered_map<std::string, unsigned> internal;
+	for (unsigned i = 0; i <= common::ApiInfo::MaxSigId; i++)
+	{
+		if (common::ApiInfo::IdToNameArr[i])
+		{
+			internal.emplace(common::ApiInfo::IdToNameArr[i], i);
+		}
+	}
+	for (unsigned id = 1; id <= mMaxSigId; ++id)
+	{
+		const auto it = internal.find(stored_sigbook[id]);
+		if (it != internal.end())
+		{
+			call_sizes[id] = common::ApiInfo::IdToLenArr[it->second];
+		}
+	}
+	return src;
+}
+
+/// Size of the call at src. For some reason we decided to make the design of our file format a lot more complicated to
+/// save 4 bytes each call...
+uint32_t next_call_size(const char *src, const char *end, uint32_t mMaxSigId, const std::vector<uint32_t>& call_sizes)
+{
+	const common::BCall *call = (const common::BCall*)src;
+	if (call->funcId == 0 || call->funcId > mMaxSigId)
+	{
+		printf("Error: Function Id %u out of range\n", (unsigned)call->funcId);
+		exit(1);
+	}
+	uint32_t call_size = call_sizes[call->funcId];
+	if (call_size == UNKNOWN_FUNCTION)
+	{
+		printf("Error: Function Id %u is not known to this build\n", (unsigned)call->funcId);
+		exit(1);
+	}
+	else if (call_size == 0) // vlen type
+	{
+		call_size = ((const common::BCall_vlen*)src)->toNext;
+	}
+	if (call_size < sizeof(common::BCall) || call_size > (size_t)(end - src))
+	{
+		printf("Error: Bad call size %u for function Id %u\n", (unsigned)call_size, (unsigned)call->funcId);
+		exit(1);
+	}
+	return call_size;
+}
+
 int main(int argc, char **argv)
 {
 	if (argc != 3)
@@ -134,126 +230,51 @@ int main(int argc, char **argv)
 		fseek(ra, jsonFileEnd, SEEK_SET);
 	}
 
-	// Find size of uncompressed data buffer -- parsing everything twice, which is wildly inefficient but don't care
-	uint32_t compressed_length = 0;
-	size_t size = 0;
-	size_t start_pos = ftell(in);
-	size_t uncompressed_length = 0;
+	// First pass: find out which functions are actually used, one chunk at a time
+	const long calls_pos = ftell(in);
 	std::vector<char> buffer_compressed;
-	for (;;)
-	{
-		// Read chunk length
-		if (!read_compressed_length(&compressed_length, in))
-		{
-			printf("Done reading first round\n");
-			break;
-		}
-		buffer_compressed.resize(compressed_length);
-		myread(buffer_compressed.data(), compressed_length, in, "reading chunk pass 1");
-		if (snappy::GetUncompressedLength(buffer_compressed.data(), buffer_compressed.size(), &size) == false)
-		{
-			printf("Error checking chunk size (pass 1)\n");
-			abort();
-		}
-		uncompressed_length += size;
-	}
-	fseek(in, start_pos, SEEK_SET);
-
-	// Read rest of file into memory
-	std::vector<char> big_buffer;
-	big_buffer.resize(uncompressed_length);
-	size_t big_counter = 0;
-	for (;;)
+	std::vector<char> chunk;
+	uint32_t mMaxSigId = 0;
+	std::vector<std::string> stored_sigbook; // file Id to name
+	std::vector<uint32_t> call_sizes; // file Id to size of its calls, zero for vlen calls, which may be different for each call
+	std::vector<uint16_t> map_old_to_new; // file Id to optimized set of functions, zero when unused
+	std::vector<uint16_t> map_new_to_old; // optimized Id to file Id
+	size_t calls_offset = 0; // where the calls start in the first chunk
+	bool first = true;
+	while (read_chunk(in, buffer_compressed, chunk))
 	{
-		// Read chunk length
-		if (!read_compressed_length(&compressed_length, in))
-		{
-			printf("Done reading second round\n");
-			break;
-		}
-		buffer_compressed.resize(compressed_length);
-		myread(buffer_compressed.data(), compressed_length, in, "reading chunk pass 2");
-		if (snappy::GetUncompressedLength(buffer_compressed.data(), buffer_compressed.size(), &size) == false)
+		mywrite(chunk.data(), chunk.size(), ra);
+		char *src = chunk.data();
+		if (first)
 		{
-			printf("Error checking chunk size (pass 2)\n");
-			abort();
+			src = read_sigbook(src, mMaxSigId, stored_sigbook, call_sizes);
+			map_old_to_new.resize(mMaxSigId + 1, 0);
+			map_new_to_old.resize(4, 0); // we just skip the first 4 for some unknown reason
+			calls_offset = src - chunk.data();
+			first = false;
 		}
-		if (snappy::RawUncompress(buffer_compressed.data(), buffer_compressed.size(), &big_buffer.data()[big_counter]) == false)
+		const char *end = chunk.data() + chunk.size();
+		while (src < end)
 		{
-			printf("Error decompressing chunk (pass 2)\n");
-			abort();
+			const uint32_t call_size = next_call_size(src, end, mMaxSigId, call_sizes);
+			const unsigned short funcId = ((common::BCall*)src)->funcId;
+			if (map_old_to_new[funcId] == 0) // we haven't seen this call before
+			{
+				map_old_to_new[funcId] = map_new_to_old.size();
+				map_new_to_old.push_back(funcId);
+			}
+			src += call_size;
 		}
-		mywrite(&big_buffer.data()[big_counter], size, ra);
-		big_counter += size;
 	}
+	printf("Done reading first round\n");
 	if (ra)
 	{
 		fclose(ra);
 	}
-
-	// Read sigbook
-	uint32_t mMaxSigId = 0;
-	uint32_t sigbookToNext = 0;
-	std::map<unsigned, std::string> stored_sigbook;
-	std::map<int, int> map_old_to_new; // maps file Id to optimized set of functions
-	std::map<int, int> map_new_to_old; // maps optimized Id to file Id
-	std::map<int, int> map_old_to_internal; // maps file Id to code Ids, which may be different
-	char *src = big_buffer.data();
-	src = common::ReadFixed(src, sigbookToNext); // should be zero -- looks unimplemented
-	src = common::ReadFixed(src, mMaxSigId);
-	for (unsigned id = 1; id <= mMaxSigId; ++id)
+	if (first)
 	{
-		uint32_t notused = 0;
-		src = common::ReadFixed(src, notused); // should be identical to id, but never checked or used, alas
-		char *str = nullptr;
-		src = common::ReadString(src, str);
-		if (str)
-		{
-			stored_sigbook[id] = std::string(str);
-		}
-	}
-
-	// Create file Id to code Id mapping (should usually be identity)
-	for (const auto& pair : stored_sigbook)
-	{
-		for (unsigned i = 0; i <= common::ApiInfo::MaxSigId; i++)
-		{
-			if (common::ApiInfo::IdToNameArr[i] && pair.second == common::ApiInfo::IdToNameArr[i])
-			{
-				map_old_to_internal[pair.first] = i;
-				break;
-			}
-		}
-	}
-
-	// Parse file contents, figure out what's actually used
-	char *calls_start = src;
-	while ((size_t)(src - big_buffer.data()) < uncompressed_length)
-	{
-		common::BCall *call = (common::BCall*)src;
-		assert(call->funcId > 0);
-		assert(call->funcId <= mMaxSigId);
-		unsigned internalId = map_old_to_internal[call->funcId];
-		assert(internalId > 0);
-		// now comes the fun part... for some reason we decided to make the design of our file format a lot more complicated to save 4 bytes each call...
-		uint32_t call_size = common::ApiInfo::IdToLenArr[internalId];
-		if (call_size == 0) // vlen type
-		{
-			common::BCall_vlen *vcall = (common::BCall_vlen*)src;
-			call_size = vcall->toNext;
-			//printf("function vlen %s : size=%lu - %u\n", common::ApiInfo::IdToNameArr[internalId], (unsigned long)call_size, (unsigned)sizeof(common::BCall_vlen));
-		}
-		else // fixed size
-		{
-			//printf("function fixed %s : size=%lu - %u\n", common::ApiInfo::IdToNameArr[internalId], (unsigned long)call_size, (unsigned)sizeof(common::BCall));
-		}
-		src += call_size;
-		if (map_old_to_new.count(call->funcId) == 0) // we haven't seen this call before
-		{
-			int newid = map_old_to_new.size() + 4; // we just skip the first 4 for some unknown reason
-			map_old_to_new[call->funcId] = newid;
-			map_new_to_old[newid] = call->funcId;
-		}
+		printf("Error: No sigbook in trace file\n");
+		exit(1);
 	}
 
 	// Now finally - write everything out again!
@@ -261,12 +282,11 @@ int main(int argc, char **argv)
 	out.Open(argv[2], false);
 	out.WriteHeader(jsondata.data(), jsonLength, true);
 
-	std::vector<char> scratch(70*1024*1024); // why, it works for the tracer!!
 	// Write new sigbook
-	char *dest = scratch.data();
+	char *dest = out.Scratch();
 	uint32_t* toNext = (uint32_t*)dest;
 	dest = common::WriteFixed<uint32_t>(dest, 0); // leave open slot
-	dest = common::WriteFixed<uint32_t>(dest, (uint32_t)map_old_to_new.size() + 4 - 1); // index of last, not size
+	dest = common::WriteFixed<uint32_t>(dest, (uint32_t)map_new_to_old.size() - 1); // index of last, not size
 	// write some noise in the beginning... 3 reserved entries (for unknown reasons)
 	dest = common::WriteFixed<uint32_t>(dest, 1);
 	dest = common::WriteString(dest, "");
@@ -274,43 +294,36 @@ int main(int argc, char **argv)
 	dest = common::WriteString(dest, "");
 	dest = common::WriteFixed<uint32_t>(dest, 3);
 	dest = common::WriteString(dest, "");
-	for (uint32_t id = 4; id < map_old_to_new.size() + 4; id++)
+	for (uint32_t id = 4; id < map_new_to_old.size(); id++)
 	{
 		dest = common::WriteFixed<uint32_t>(dest, id);
 		dest = common::WriteString(dest, stored_sigbook[map_new_to_old[id]].c_str());
 	}
-	*toNext = dest - scratch.data(); // set size of block
-	out.Write(scratch.data(), dest - scratch.data());
-	// Write new calls
-	src = calls_start; // iterate over this memory, again
-	while ((size_t)(src - big_buffer.data()) < uncompressed_length)
+	*toNext = dest - out.Scratch(); // set size of block
+	out.Progress(dest - out.Scratch());
+
+	// Second pass: give the calls their new Ids in place and write out each chunk as a whole
+	fseek(in, calls_pos, SEEK_SET);
+	first = true;
+	while (read_chunk(in, buffer_compressed, chunk))
 	{
-		dest = scratch.data();
-		common::BCall *call = (common::BCall*)src;
-		unsigned internalId = map_old_to_internal[call->funcId];
-		unsigned newId = map_old_to_new[call->funcId];
-		uint32_t call_size = common::ApiInfo::IdToLenArr[internalId];
-		if (call_size == 0) // vlen type
+		char *src = chunk.data();
+		if (first)
 		{
-			common::BCall_vlen *vcall = (common::BCall_vlen*)src;
-			call_size = vcall->toNext;
-			common::BCall_vlen *destcall = (common::BCall_vlen*)dest;
-			*destcall = *vcall;
-			destcall->funcId = newId;
-			dest += sizeof(*destcall);
-			memcpy(dest, src + sizeof(*destcall), call_size - sizeof(*destcall)); // copy parameters - hopefully not bigger than 70mb!!
+			src += calls_offset;
+			first = false;
 		}
-		else // fixed size
+		char *const begin = src;
+		const char *end = chunk.data() + chunk.size();
+		while (src < end)
 		{
-			common::BCall *destcall = (common::BCall*)dest;
-			*destcall = *call;
-			destcall->funcId = newId;
-			dest += sizeof(*destcall);
-			memcpy(dest, src + sizeof(*destcall), call_size - sizeof(*destcall)); // copy parameters - hopefully not bigger than 70mb!!
+			common::BCall *call = (common::BCall*)src;
+			src += call_sizes[call->funcId] ? call_sizes[call->funcId] : ((common::BCall_vlen*)src)->toNext;
+			call->funcId = map_old_to_new[call->funcId];
 		}
-		src += call_size;
-		out.Write(scratch.data(), call_size);
+		out.Write(begin, src - begin);
 	}
+	printf("Done reading second round\n");
 	out.Close();
 
 	return 0;
@@ -98,11 +98,7 @@ common::OutFile tmpFile;
 
 static void writeout(common::OutFile &outputFile, common::CallTM *call, bool injected = false)
 {
-    const unsigned int WRITE_BUF_LEN = 150*1024*1024;
-    static char buffer[WRITE_BUF_LEN];
-
-    char *dest = call->Serialize(buffer, -1, injected);
-    outputFile.Write(buffer, dest-buffer);
+    call->Serialize(outputFile, -1, injected);
 }
 
 int parse_args(int argc, char **argv) {
@@ -0,0 +1,428 @@
+#include "tool/yuv_convert.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define YUV_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Fixed point coefficients: the formulas scaled by 1000
+static const int Y_R = 299, Y_G = 587, Y_B = 114;
+static const int U_R = -169, U_G = -331, U_B = 500;
+static const int V_R = 500, V_G = -419, V_B = -81;
+static const int UV_BIAS = 128 * 1000;
+
+// floor(n / 1000) for 0 <= n < 2^18, which covers every weighted sum above.
+// n / 8 fits in 15 bits, and is divided by 125 with a 16x16 bit multiply-high.
+static const int DIV125_MUL = 33555;
+static const int DIV125_SHIFT = 6;
+
+static inline unsigned char fixedDiv1000(int n)
+{
+    return (unsigned char)((((unsigned)(n >> 3) * DIV125_MUL) >> 16) >> DIV125_SHIFT);
+}
+
+/// Converts one row. u and v point to the chroma row, and are only written when chroma is set.
+/// cStep is the distance between two chroma samples: 1 for planar, 2 for interleaved.
+typedef void (*RowFunction)(const unsigned char *rgba, unsigned char *y, unsigned char *u, unsigned char *v, int cStep, int width, bool chroma);
+
+static inline void scalarPixels(const unsigned char *rgba, unsigned char *y, unsigned char *u, unsigned char *v, int cStep, int begin, int width, bool chroma)
+{
+    for (int x = begin; x < width; ++x)
+    {
+        const int r = rgba[x * 4];
+        const int g = rgba[x * 4 + 1];
+        const int b = rgba[x * 4 + 2];
+        y[x] = fixedDiv1000(Y_R * r + Y_G * g + Y_B * b);
+        if (chroma && (x & 0x1) == 0)
+        {
+            u[(x / 2) * cStep] = fixedDiv1000(U_R * r + U_G * g + U_B * b + UV_BIAS);
+            v[(x / 2) * cStep] = fixedDiv1000(V_R * r + V_G * g + V_B * b + UV_BIAS);
+        }
+    }
+}
+
+static void scalarRow(const unsigned char *rgba, unsigned char *y, unsigned char *u, unsigned char *v, int cStep, int width, bool chroma)
+{
+    scalarPixels(rgba, y, u, v, cStep, 0, width, chroma);
+}
+
+#if YUV_X86
+
+// Weighted sums of 4 RGBA pixels, divided by 8, as 32 bit integers
+static inline __m128i sse2Sum4(__m128i px, __m128i coef, __m128i bias)
+{
+    const __m128i zero = _mm_setzero_si128();
+    // [r*cr + g*cg, b*cb] for each pixel
+    const __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef));
+    const __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef));
+    const __m128i sum = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                      _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+    return _mm_srli_epi32(_mm_add_epi32(sum, bias), 3);
+}
+
+static inline __m128i sse2Div125(__m128i x)
+{
+    return _mm_srli_epi16(_mm_mulhi_epu16(x, _mm_set1_epi16((short)DIV125_MUL)), DIV125_SHIFT);
+}
+
+// One weighted value for each of 16 RGBA pixels
+static inline __m128i sse2Weigh16(const unsigned char *rgba, __m128i coef, __m128i bias)
+{
+    const __m128i s0 = sse2Sum4(_mm_loadu_si128((const __m128i *)rgba), coef, bias);
+    const __m128i s1 = sse2Sum4(_mm_loadu_si128((const __m128i *)(rgba + 16)), coef, bias);
+    const __m128i s2 = sse2Sum4(_mm_loadu_si128((const __m128i *)(rgba + 32)), coef, bias);
+    const __m128i s3 = sse2Sum4(_mm_loadu_si128((const __m128i *)(rgba + 48)), coef, bias);
+    return _mm_packus_epi16(sse2Div125(_mm_packs_epi32(s0, s1)), sse2Div125(_mm_packs_epi32(s2, s3)));
+}
+
+// Even bytes in the low 8 bytes
+static inline __m128i sse2Even(__m128i x)
+{
+    x = _mm_and_si128(x, _mm_set1_epi16(0xff));
+    return _mm_packus_epi16(x, x);
+}
+
+static void sse2Row(const unsigned char *rgba, unsigned char *y, unsigned char *u, unsigned char *v, int cStep, int width, bool chroma)
+{
+    const __m128i yCoef = _mm_setr_epi16(Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0);
+    const __m128i uCoef = _mm_setr_epi16(U_R, U_G, U_B, 0, U_R, U_G, U_B, 0);
+    const __m128i vCoef = _mm_setr_epi16(V_R, V_G, V_B, 0, V_R, V_G, V_B, 0);
+    const __m128i yBias = _mm_setzero_si128();
+    const __m128i uvBias = _mm_set1_epi32(UV_BIAS);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const unsigned char *p = rgba + x * 4;
+        _mm_storeu_si128((__m128i *)(y + x), sse2Weigh16(p, yCoef, yBias));
+        if (chroma)
+        {
+            const __m128i cu = sse2Even(sse2Weigh16(p, uCoef, uvBias));
+            const __m128i cv = sse2Even(sse2Weigh16(p, vCoef, uvBias));
+            if (cStep == 1)
+            {
+                _mm_storel_epi64((__m128i *)(u + x / 2), cu);
+                _mm_storel_epi64((__m128i *)(v + x / 2), cv);
+            }
+            else
+            {
+                _mm_storeu_si128((__m128i *)(u + x), _mm_unpacklo_epi8(cu, cv));
+            }
+        }
+    }
+    scalarPixels(rgba, y, u, v, cStep, x, width, chroma);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i avx2Sum8(__m256i px, __m256i coef, __m256i bias)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256 lo = _mm256_castsi256_ps(_mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef));
+    const __m256 hi = _mm256_castsi256_ps(_mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef));
+    const __m256i sum = _mm256_add_epi32(_mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                         _mm256_castps_si256(_mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+    return _mm256_srli_epi32(_mm256_add_epi32(sum, bias), 3);
+}
+
+AVX2 static inline __m256i avx2Div125(__m256i x)
+{
+    return _mm256_srli_epi16(_mm256_mulhi_epu16(x, _mm256_set1_epi16((short)DIV125_MUL)), DIV125_SHIFT);
+}
+
+AVX2 static inline __m256i avx2Weigh32(const unsigned char *rgba, __m256i coef, __m256i bias)
+{
+    const __m256i s0 = avx2Sum8(_mm256_loadu_si256((const __m256i *)rgba), coef, bias);
+    const __m256i s1 = avx2Sum8(_mm256_loadu_si256((const __m256i *)(rgba + 32)), coef, bias);
+    const __m256i s2 = avx2Sum8(_mm256_loadu_si256((const __m256i *)(rgba + 64)), coef, bias);
+    const __m256i s3 = avx2Sum8(_mm256_loadu_si256((const __m256i *)(rgba + 96)), coef, bias);
+    const __m256i packed = _mm256_packus_epi16(avx2Div125(_mm256_packs_epi32(s0, s1)), avx2Div125(_mm256_packs_epi32(s2, s3)));
+    // Packing works within 128 bit lanes, so groups of 4 pixels end up in the order 0 2 4 6 1 3 5 7
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+AVX2 static inline __m128i avx2Even(__m256i x)
+{
+    x = _mm256_and_si256(x, _mm256_set1_epi16(0xff));
+    x = _mm256_packus_epi16(x, x);
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+AVX2 static void avx2Row(const unsigned char *rgba, unsigned char *y, unsigned char *u, unsigned char *v, int cStep, int width, bool chroma)
+{
+    const __m256i yCoef = _mm256_setr_epi16(Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0, Y_R, Y_G, Y_B, 0);
+    const __m256i uCoef = _mm256_setr_epi16(U_R, U_G, U_B, 0, U_R, U_G, U_B, 0, U_R, U_G, U_B, 0, U_R, U_G, U_B, 0);
+    const __m256i vCoef = _mm256_setr_epi16(V_R, V_G, V_B, 0, V_R, V_G, V_B, 0, V_R, V_G, V_B, 0, V_R, V_G, V_B, 0);
+    const __m256i yBias = _mm256_setzero_si256();
+    const __m256i uvBias = _mm256_set1_epi32(UV_BIAS);
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        const unsigned char *p = rgba + x * 4;
+        _mm256_storeu_si256((__m256i *)(y + x), avx2Weigh32(p, yCoef, yBias));
+        if (chroma)
+        {
+            const __m128i cu = avx2Even(avx2Weigh32(p, uCoef, uvBias));
+            const __m128i cv = avx2Even(avx2Weigh32(p, vCoef, uvBias));
+            if (cStep == 1)
+            {
+                _mm_storeu_si128((__m128i *)(u + x / 2), cu);
+                _mm_storeu_si128((__m128i *)(v + x / 2), cv);
+            }
+            else
+            {
+                _mm_storeu_si128((__m128i *)(u + x), _mm_unpacklo_epi8(cu, cv));
+                _mm_storeu_si128((__m128i *)(u + x + 16), _mm_unpackhi_epi8(cu, cv));
+            }
+        }
+    }
+    sse2Row(rgba + x * 4, y + x, u + (x / 2) * cStep, v + (x / 2) * cStep, cStep, width - x, chroma);
+}
+
+#undef AVX2
+
+#elif YUV_NEON
+
+// One weighted value for each of 8 pixels
+static inline uint8x8_t neonWeigh8(uint16x8_t r, uint16x8_t g, uint16x8_t b, int16_t cr, int16_t cg, int16_t cb, int32_t bias)
+{
+    const int16x8_t rs = vreinterpretq_s16_u16(r);
+    const int16x8_t gs = vreinterpretq_s16_u16(g);
+    const int16x8_t bs = vreinterpretq_s16_u16(b);
+    int32x4_t lo = vdupq_n_s32(bias);
+    lo = vmlal_n_s16(lo, vget_low_s16(rs), cr);
+    lo = vmlal_n_s16(lo, vget_low_s16(gs), cg);
+    lo = vmlal_n_s16(lo, vget_low_s16(bs), cb);
+    int32x4_t hi = vdupq_n_s32(bias);
+    hi = vmlal_n_s16(hi, vget_high_s16(rs), cr);
+    hi = vmlal_n_s16(hi, vget_high_s16(gs), cg);
+    hi = vmlal_n_s16(hi, vget_high_s16(bs), cb);
+    const uint16x4_t lo8 = vreinterpret_u16_s16(vmovn_s32(vshrq_n_s32(lo, 3)));
+    const uint16x4_t hi8 = vreinterpret_u16_s16(vmovn_s32(vshrq_n_s32(hi, 3)));
+    const uint16x8_t q = vcombine_u16(vshrn_n_u32(vmull_n_u16(lo8, DIV125_MUL), 16), vshrn_n_u32(vmull_n_u16(hi8, DIV125_MUL), 16));
+    return vmovn_u16(vshrq_n_u16(q, DIV125_SHIFT));
+}
+
+static void neonRow(const unsigned char *rgba, unsigned char *y, unsigned char *u, unsigned char *v, int cStep, int width, bool chroma)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16x4_t px = vld4q_u8(rgba + x * 4);
+        const uint16x8_t rl = vmovl_u8(vget_low_u8(px.val[0])), rh = vmovl_u8(vget_high_u8(px.val[0]));
+        const uint16x8_t gl = vmovl_u8(vget_low_u8(px.val[1])), gh = vmovl_u8(vget_high_u8(px.val[1]));
+        const uint16x8_t bl = vmovl_u8(vget_low_u8(px.val[2])), bh = vmovl_u8(vget_high_u8(px.val[2]));
+        vst1q_u8(y + x, vcombine_u8(neonWeigh8(rl, gl, bl, Y_R, Y_G, Y_B, 0), neonWeigh8(rh, gh, bh, Y_R, Y_G, Y_B, 0)));
+        if (chroma)
+        {
+            const uint8x16_t cu = vcombine_u8(neonWeigh8(rl, gl, bl, U_R, U_G, U_B, UV_BIAS), neonWeigh8(rh, gh, bh, U_R, U_G, U_B, UV_BIAS));
+            const uint8x16_t cv = vcombine_u8(neonWeigh8(rl, gl, bl, V_R, V_G, V_B, UV_BIAS), neonWeigh8(rh, gh, bh, V_R, V_G, V_B, UV_BIAS));
+            uint8x8x2_t even;
+            even.val[0] = vget_low_u8(vuzpq_u8(cu, cu).val[0]);
+            even.val[1] = vget_low_u8(vuzpq_u8(cv, cv).val[0]);
+            if (cStep == 1)
+            {
+                vst1_u8(u + x / 2, even.val[0]);
+                vst1_u8(v + x / 2, even.val[1]);
+            }
+            else
+            {
+                vst2_u8(u + x, even);
+            }
+        }
+    }
+    scalarPixels(rgba, y, u, v, cStep, x, width, chroma);
+}
+
+#endif
+
+const char *yuvSimdName()
+{
+#if YUV_X86
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#elif YUV_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+static RowFunction simdRow()
+{
+#if YUV_X86
+    return __builtin_cpu_supports("avx2") ? avx2Row : sse2Row;
+#elif YUV_NEON
+    return neonRow;
+#else
+    return scalarRow;
+#endif
+}
+
+// The original conversion loops, kept as reference for the fixed point kernels
+
+static int referenceYV12(const unsigned char *rgba, unsigned char *yv12, int width, int height)
+{
+    int y_stride = (width + 15) / 16 * 16;
+    int y_height= height;
+    int y_size = y_stride * y_height;
+    int c_stride = (y_stride / 2 + 15) / 16 * 16;
+    int c_size = c_stride * y_height / 2;
+    int yuv_size = y_size + c_size * 2;
+
+    for (int i = 0; i < y_stride * y_height; ++i) {
+        int y_x = i % y_stride;
+        if (y_x >= width)
+            continue;
+        int y_y = i / y_stride;
+
+        int r = rgba[(y_y * width + y_x) * 4];
+        int g = rgba[(y_y * width + y_x) * 4 + 1];
+        int b = rgba[(y_y * width + y_x) * 4 + 2];
+        int y = 0.299 * r + 0.587 * g + 0.114 * b;
+        yv12[y_y * y_stride + y_x] = std::min(std::max(y, 0), 255);
+        if (((y_x & 0x1) == 0) && ((y_y & 0x1) == 0)) {
+            int u = -0.169 * r - 0.331 * g + 0.500 * b + 128;
+            int v =  0.500 * r - 0.419 * g - 0.081 * b + 128;
+            int u_x = y_x / 2;
+            int u_y = y_y / 2;
+            yv12[y_size + u_y * c_stride + u_x] = std::min(std::max(v, 0), 255);
+            yv12[y_size + c_size + u_y * c_stride + u_x] = std::min(std::max(u, 0), 255);
+        }
+    }
+
+    return yuv_size;
+}
+
+static int referenceNV12(const unsigned char *rgba, unsigned char *nv12, int width, int height)
+{
+    int y_stride = (width + 15) / 16 * 16;
+    int y_height= height;
+    int y_size = y_stride * y_height;
+    int c_stride = y_stride;
+    int c_size = c_stride * y_height / 2;
+    int yuv_size = y_size + c_size;
+
+    for (int i = 0; i < y_stride * y_height; ++i) {
+        int y_x = i % y_stride;
+        if (y_x >= width)
+            continue;
+        int y_y = i / y_stride;
+
+        int r = rgba[(y_y * width + y_x) * 4];
+        int g = rgba[(y_y * width + y_x) * 4 + 1];
+        int b = rgba[(y_y * width + y_x) * 4 + 2];
+        int y = 0.299 * r + 0.587 * g + 0.114 * b;
+        nv12[y_y * y_stride + y_x] = std::min(std::max(y, 0), 255);
+        if (((y_x & 0x1) == 0) && ((y_y & 0x1) == 0)) {
+            int u = -0.169 * r - 0.331 * g + 0.500 * b + 128;
+            int v =  0.500 * r - 0.419 * g - 0.081 * b + 128;
+            int u_x = y_x / 2;
+            int u_y = y_y / 2;
+            nv12[y_size + u_y * c_stride + u_x * 2] = std::min(std::max(u, 0), 255);
+            nv12[y_size + u_y * c_stride + u_x * 2 + 1] = std::min(std::max(v, 0), 255);
+        }
+    }
+
+    return yuv_size;
+}
+
+struct YuvLayout
+{
+    unsigned char *y;
+    unsigned char *u;
+    unsigned char *v;
+    int yStride;
+    int cStride;
+    int cStep;
+};
+
+static void convertRows(RowFunction row, const unsigned char *rgba, const YuvLayout& layout, int width, int first, int last)
+{
+    for (int i = first; i < last; ++i)
+    {
+        const int c = (i / 2) * layout.cStride;
+        row(rgba + (size_t)i * width * 4, layout.y + (size_t)i * layout.yStride, layout.u + c, layout.v + c, layout.cStep, width, (i & 0x1) == 0);
+    }
+}
+
+// Images smaller than this are not worth starting threads for
+static const int MIN_PIXELS_PER_THREAD = 128 * 1024;
+
+static void convert(RowFunction row, const unsigned char *rgba, const YuvLayout& layout, int width, int height, int threads)
+{
+    if (threads <= 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max(1, std::min(threads, (int)((long long)width * height / MIN_PIXELS_PER_THREAD)));
+
+    // With an odd height, the chroma of the last row overlaps the next plane. Convert it
+    // last, so that the output is the same as converting the rows in order.
+    const int rows = height & ~0x1;
+    if (threads == 1)
+    {
+        convertRows(row, rgba, layout, width, 0, height);
+        return;
+    }
+
+    // Bands have an even number of rows, so that each chroma row is written by one thread
+    const int band = ((rows + threads - 1) / threads + 1) & ~0x1;
+    std::vector<std::thread> workers;
+    for (int first = band; first < rows; first += band)
+    {
+        workers.emplace_back(convertRows, row, rgba, std::cref(layout), width, first, std::min(first + band, rows));
+    }
+    convertRows(row, rgba, layout, width, 0, std::min(band, rows));
+    for (std::thread &t : workers)
+    {
+        t.join();
+    }
+    convertRows(row, rgba, layout, width, rows, height);
+}
+
+int yv12Size(int width, int height)
+{
+    const int y_stride = (width + 15) / 16 * 16;
+    const int c_stride = (y_stride / 2 + 15) / 16 * 16;
+    return y_stride * height + c_stride * height / 2 * 2;
+}
+
+int nv12Size(int width, int height)
+{
+    const int y_stride = (width + 15) / 16 * 16;
+    return y_stride * height + y_stride * height / 2;
+}
+
+int rgbaToYV12(const unsigned char *rgba, unsigned char *yv12, int width, int height, YuvKernel kernel, int threads)
+{
+    if (kernel == YUV_KERNEL_REFERENCE)
+    {
+        return referenceYV12(rgba, yv12, width, height);
+    }
+    const int y_stride = (width + 15) / 16 * 16;
+    const int c_stride = (y_stride / 2 + 15) / 16 * 16;
+    const int y_size = y_stride * height;
+    const int c_size = c_stride * height / 2;
+    const YuvLayout layout = { yv12, yv12 + y_size + c_size, yv12 + y_size, y_stride, c_stride, 1 };
+    convert(kernel == YUV_KERNEL_SIMD ? simdRow() : scalarRow, rgba, layout, width, height, threads);
+    return yv12Size(width, height);
+}
+
+int rgbaToNV12(const unsigned char *rgba, unsigned char *nv12, int width, int height, YuvKernel kernel, int threads)
+{
+    if (kernel == YUV_KERNEL_REFERENCE)
+    {
+        return referenceNV12(rgba, nv12, width, height);
+    }
+    const int y_stride = (width + 15) / 16 * 16;
+    const int y_size = y_stride * height;
+    const YuvLayout layout = { nv12, nv12 + y_size, nv12 + y_size + 1, y_stride, y_stride, 2 };
+    convert(kernel == YUV_KERNEL_SIMD ? simdRow() : scalarRow, rgba, layout, width, height, threads);
+    return nv12Size(width, height);
+}
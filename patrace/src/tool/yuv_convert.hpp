@@ -0,0 +1,39 @@
+#ifndef _TOOL_YUV_CONVERT_HPP_
+#define _TOOL_YUV_CONVERT_HPP_
+
+// RGBA8 to YV12 / NV12 conversion, used by rgba_to_yuv.
+//
+// y =  0.299r + 0.587g + 0.114b
+// u = -0.169r - 0.331g + 0.500b + 128
+// v =  0.500r - 0.419g - 0.081b + 128
+//
+// Chroma is taken from the top-left pixel of every 2x2 block. The luma stride is
+// the width aligned to 16. YV12 stores the V plane before the U plane, each with
+// its own stride aligned to 16. NV12 stores interleaved U,V with the luma stride.
+// Padding bytes at the end of each row are not written.
+//
+// The fast kernels evaluate the formulas exactly in fixed point. The original
+// floating point code (the *Reference functions) can round the result down by one
+// when the exact value is an integer, so the two differ by at most 1, for about
+// 0.02% of all RGB values.
+
+enum YuvKernel
+{
+    YUV_KERNEL_REFERENCE, // original floating point loop
+    YUV_KERNEL_SCALAR,    // fixed point, one pixel at a time
+    YUV_KERNEL_SIMD,      // fixed point, best instruction set available (SSE2/AVX2 or NEON)
+};
+
+/// Name of the instruction set used by YUV_KERNEL_SIMD, e.g. "avx2" or "scalar"
+const char *yuvSimdName();
+
+/// Size in bytes of the converted image
+int yv12Size(int width, int height);
+int nv12Size(int width, int height);
+
+/// Convert one image. threads = 0 uses all cores for large images.
+/// Returns the size of the converted image.
+int rgbaToYV12(const unsigned char *rgba, unsigned char *yv12, int width, int height, YuvKernel kernel = YUV_KERNEL_SIMD, int threads = 0);
+int rgbaToNV12(const unsigned char *rgba, unsigned char *nv12, int width, int height, YuvKernel kernel = YUV_KERNEL_SIMD, int threads = 0);
+
+#endif
@@ -0,0 +1,252 @@
+#include "call_recorder.hpp"
+
+#include <common/out_file.hpp>
+#include <common/os.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <string.h>
+#include <sys/mman.h>
+#include <utility>
+#include <vector>
+
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
+
+namespace
+{
+
+/// Units a thread can have waiting for the merger thread
+const uint32_t RING_SIZE = 4096;
+/// A thread starts over at the beginning of its scratch memory once it has used this
+/// much, after the merger thread has written out all its units
+const size_t RESET_BYTES = 8 * 1024 * 1024;
+
+}
+
+struct CallRecorder::ThreadBuffer
+{
+    struct Unit
+    {
+        uint64_t seq;
+        const char* begin;
+        size_t size;
+    };
+
+    ThreadBuffer()
+    {
+        // Same trick as OutFile: address space is cheap, only touched pages use memory
+        base = (char*)mmap(nullptr, SNAPPY_MAX_SIZE, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            DBG_LOG("Failed to allocate scratch memory for a recording thread: %s\n", strerror(errno));
+            os::abort();
+        }
+        cursor = base;
+    }
+
+    ~ThreadBuffer()
+    {
+        munmap(base, SNAPPY_MAX_SIZE);
+    }
+
+    char* base;
+    char* cursor;                   // owner thread only
+    Unit units[RING_SIZE];
+    std::atomic<uint32_t> head{0};  // units committed, written by the owner thread
+    std::atomic<uint32_t> tail{0};  // units written out, written by the merger thread
+};
+
+CallRecorder::CallRecorder(common::OutFile* out)
+    : mOut(out)
+    , mThreadCount(0)
+    , mNextSeq(0)
+    , mSleeping(false)
+    , mWrittenSeq(0)
+    , mStop(false)
+{
+    for (std::atomic<ThreadBuffer*>& buffer : mBuffers)
+    {
+        buffer.store(nullptr, std::memory_order_relaxed);
+    }
+    mThread = std::thread(&CallRecorder::Run, this);
+}
+
+CallRecorder::~CallRecorder()
+{
+    mStop = true;
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mWake.notify_one();
+    }
+    mThread.join();
+    for (std::atomic<ThreadBuffer*>& buffer : mBuffers)
+    {
+        delete buffer.load();
+    }
+}
+
+CallRecorder::ThreadBuffer* CallRecorder::Buffer(unsigned thread)
+{
+    ThreadBuffer* buffer = mBuffers[thread].load(std::memory_order_acquire);
+    if (buffer == nullptr)
+    {
+        // Only the owner thread gets here for this index
+        buffer = new ThreadBuffer;
+        mBuffers[thread].store(buffer, std::memory_order_release);
+        unsigned count = mThreadCount.load();
+        while (count < thread + 1 && !mThreadCount.compare_exchange_weak(count, thread + 1))
+        {
+        }
+    }
+    return buffer;
+}
+
+char* CallRecorder::Scratch(unsigned thread)
+{
+    ThreadBuffer* buffer = Buffer(thread);
+    const size_t used = buffer->cursor - buffer->base;
+    if (used > RESET_BYTES)
+    {
+        // The merger thread reads the old units from this memory until it has written them
+        while (buffer->tail.load(std::memory_order_acquire) != buffer->head.load(std::memory_order_relaxed))
+        {
+            std::this_thread::yield();
+        }
+        // Keep the first part hot, give back what a large call used beyond it
+        madvise(buffer->base + RESET_BYTES, used - RESET_BYTES, MADV_FREE);
+        buffer->cursor = buffer->base;
+    }
+    return buffer->cursor;
+}
+
+void CallRecorder::Commit(unsigned thread, const char* end)
+{
+    ThreadBuffer* buffer = mBuffers[thread].load(std::memory_order_relaxed);
+    const uint32_t head = buffer->head.load(std::memory_order_relaxed);
+    while (head - buffer->tail.load(std::memory_order_acquire) >= RING_SIZE)
+    {
+        std::this_thread::yield();
+    }
+
+    ThreadBuffer::Unit& unit = buffer->units[head % RING_SIZE];
+    unit.seq = mNextSeq.fetch_add(1);
+    unit.begin = buffer->cursor;
+    unit.size = end - buffer->cursor;
+    buffer->head.store(head + 1, std::memory_order_release);
+    buffer->cursor += unit.size;
+
+    if (mSleeping.load())
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mWake.notify_one();
+    }
+}
+
+std::unique_lock<std::mutex> CallRecorder::LockFile()
+{
+    const uint64_t target = mNextSeq.load();
+    {
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        mWake.notify_one();
+        mWritten.wait(lock, [&]{ return mWrittenSeq.load() >= target; });
+    }
+    return std::unique_lock<std::mutex>(mFileMutex);
+}
+
+// Writes out units for as long as the next one in sequence is available. Returns false
+// if nothing could be written.
+bool CallRecorder::WriteOut()
+{
+    typedef std::pair<uint64_t, unsigned> Head; // sequence number of the oldest unit, thread
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    const unsigned threads = mThreadCount.load(std::memory_order_acquire);
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        ThreadBuffer* buffer = mBuffers[t].load(std::memory_order_acquire);
+        if (buffer)
+        {
+            const uint32_t tail = buffer->tail.load(std::memory_order_relaxed);
+            if (tail != buffer->head.load(std::memory_order_acquire))
+            {
+                heads.push(Head(buffer->units[tail % RING_SIZE].seq, t));
+            }
+        }
+    }
+
+    uint64_t next = mWrittenSeq.load(std::memory_order_relaxed);
+    const uint64_t first = next;
+    {
+        std::lock_guard<std::mutex> lock(mFileMutex);
+        // Each thread commits in sequence order, so the next unit is always the oldest
+        // unit of some thread. If it is not there yet, it is being committed right now.
+        while (!heads.empty() && heads.top().first == next)
+        {
+            const unsigned t = heads.top().second;
+            heads.pop();
+            ThreadBuffer* buffer = mBuffers[t].load(std::memory_order_relaxed);
+            uint32_t tail = buffer->tail.load(std::memory_order_relaxed);
+            const uint32_t head = buffer->head.load(std::memory_order_acquire);
+            // Stay with this thread for as long as it has the next unit
+            do
+            {
+                const ThreadBuffer::Unit& unit = buffer->units[tail % RING_SIZE];
+                memcpy(mOut->Scratch(), unit.begin, unit.size);
+                mOut->Progress(unit.size);
+                tail++;
+                next++;
+            } while (tail != head && buffer->units[tail % RING_SIZE].seq == next);
+            buffer->tail.store(tail, std::memory_order_release);
+
+            if (tail != head)
+            {
+                heads.push(Head(buffer->units[tail % RING_SIZE].seq, t));
+            }
+        }
+    }
+
+    if (next == first)
+    {
+        return false;
+    }
+    mWrittenSeq.store(next);
+    {
+        std::lock_guard<std::mutex> lock(mWakeMutex);
+        mWritten.notify_all();
+    }
+    return true;
+}
+
+void CallRecorder::Run()
+{
+    while (true)
+    {
+        if (WriteOut())
+        {
+            continue;
+        }
+
+        const uint64_t committed = mNextSeq.load();
+        if (committed != mWrittenSeq.load())
+        {
+            // A unit has its sequence number but is not queued yet
+            std::this_thread::yield();
+            continue;
+        }
+        if (mStop)
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        mSleeping = true;
+        if (mNextSeq.load() == mWrittenSeq.load() && !mStop)
+        {
+            mWake.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        mSleeping = false;
+    }
+}
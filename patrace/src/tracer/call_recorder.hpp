@@ -0,0 +1,72 @@
+#if !defined(_CALL_RECORDER_HPP_)
+#define _CALL_RECORDER_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+namespace common
+{
+class OutFile;
+}
+
+// Lets several threads record calls at the same time without a shared lock.
+//
+// Each thread encodes its calls into its own scratch memory and commits them. A commit
+// takes the next number from a global sequence and queues the calls to the merger thread.
+// The merger thread copies committed calls into the OutFile in sequence order, so the
+// file has the same order as if all threads had written it under one lock. Compressing
+// and writing the file also happens on the merger thread.
+//
+// Threads are identified by a small index (the trace thread id). Scratch() and Commit()
+// for an index must only be called from one thread at a time. Everything else is thread
+// safe. The OutFile must not be touched directly while the recorder exists, except under
+// LockFile().
+class CallRecorder
+{
+public:
+    static const unsigned MAX_THREADS = 256;
+
+    explicit CallRecorder(common::OutFile* out);
+    /// Writes out everything committed and stops the merger thread
+    ~CallRecorder();
+
+    /// Scratch memory for the next calls of this thread. Like OutFile::Scratch(), there is
+    /// no need to check for overruns.
+    char* Scratch(unsigned thread);
+
+    /// Queues the calls written to [Scratch(thread), end) as one unit
+    void Commit(unsigned thread, const char* end);
+
+    /// Waits until everything committed so far is in the OutFile, and keeps the merger
+    /// thread away from it while the returned lock is held
+    std::unique_lock<std::mutex> LockFile();
+
+    /// Units committed so far
+    uint64_t Committed() const { return mNextSeq.load(std::memory_order_relaxed); }
+
+private:
+    struct ThreadBuffer;
+
+    ThreadBuffer* Buffer(unsigned thread);
+    void Run();
+    bool WriteOut();
+
+    common::OutFile* mOut;
+    std::atomic<ThreadBuffer*> mBuffers[MAX_THREADS];
+    std::atomic<unsigned> mThreadCount;
+    std::atomic<uint64_t> mNextSeq;
+
+    std::mutex mFileMutex;       // held by the merger thread while it writes
+    std::mutex mWakeMutex;
+    std::condition_variable mWake;     // merger thread: new units
+    std::condition_variable mWritten;  // LockFile(): units written
+    std::atomic<bool> mSleeping;
+    std::atomic<uint64_t> mWrittenSeq; // all units before this are in the OutFile
+    std::atomic<bool> mStop;
+    std::thread mThread;
+};
+
+#endif // !defined(_CALL_RECORDER_HPP_)
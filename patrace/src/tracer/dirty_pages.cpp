@@ -0,0 +1,400 @@
+#include "dirty_pages.hpp"
+
+#include <common/os.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+
+const unsigned BITMAP_WORDS = DIRTY_PAGES_MAX_REGION_PAGES / 64;
+const uint64_t PAGEMAP_SOFT_DIRTY = 1ull << 55;
+
+// The signal handler only reads begin/end and sets bits, everything else is protected
+// by gMutex. A free slot has begin == 0.
+struct Region
+{
+    std::atomic<uintptr_t> begin; // first page
+    std::atomic<uintptr_t> end;   // end of the last page
+    std::atomic<uint64_t> dirty[BITMAP_WORDS];
+
+    DirtyPagesMode mode;
+    uintptr_t base;               // the region as given to track()
+    size_t length;
+};
+
+// Static so that the signal handler never sees memory being allocated or freed
+Region gRegions[DIRTY_PAGES_MAX_REGIONS];
+std::mutex gMutex;
+uintptr_t gPageSize = 0;
+bool gHandlerInstalled = false;
+struct sigaction gPreviousAction;
+int gPagemapFd = -1;
+int gClearRefsFd = -1;
+
+// Whether the region tracks the page, and if so the index of the page in it
+bool pageIndex(const Region& r, uintptr_t page, uintptr_t& index)
+{
+    const uintptr_t begin = r.begin.load(std::memory_order_acquire);
+    if (begin == 0 || page < begin || page >= r.end.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+    index = (page - begin) / gPageSize;
+    return true;
+}
+
+void segvHandler(int sig, siginfo_t *info, void *context)
+{
+    if (info->si_code == SEGV_ACCERR)
+    {
+        const uintptr_t page = (uintptr_t)info->si_addr & ~(gPageSize - 1);
+        bool tracked = false;
+        uintptr_t index;
+        for (const Region& r : gRegions)
+        {
+            tracked = tracked || pageIndex(r, page, index);
+        }
+        // Unprotect before marking the page dirty. The other way around, dirtyPagesCollect()
+        // could protect the page and take the bit in between, and the page would be left
+        // writable without its bit set, so that later writes to it were lost.
+        if (tracked && mprotect((void*)page, gPageSize, PROT_READ | PROT_WRITE) == 0)
+        {
+            for (Region& r : gRegions)
+            {
+                if (pageIndex(r, page, index))
+                {
+                    r.dirty[index / 64].fetch_or(1ull << (index % 64), std::memory_order_relaxed);
+                }
+            }
+            return;
+        }
+    }
+
+    // Not ours
+    if (gPreviousAction.sa_flags & SA_SIGINFO)
+    {
+        gPreviousAction.sa_sigaction(sig, info, context);
+    }
+    else if (gPreviousAction.sa_handler == SIG_DFL || gPreviousAction.sa_handler == SIG_IGN)
+    {
+        // Let the faulting instruction run again with the default action
+        signal(sig, SIG_DFL);
+    }
+    else
+    {
+        gPreviousAction.sa_handler(sig);
+    }
+}
+
+void initPageSize()
+{
+    if (gPageSize == 0)
+    {
+        gPageSize = sysconf(_SC_PAGESIZE);
+    }
+}
+
+bool installHandler()
+{
+    if (gHandlerInstalled)
+    {
+        return true;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = segvHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &gPreviousAction) != 0)
+    {
+        DBG_LOG("Failed to install the SIGSEGV handler for buffer write tracking: %s\n", strerror(errno));
+        return false;
+    }
+    gHandlerInstalled = true;
+    return true;
+}
+
+bool openSoftDirty()
+{
+    if (gPagemapFd < 0)
+    {
+        gPagemapFd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    }
+    if (gClearRefsFd < 0)
+    {
+        gClearRefsFd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    }
+    return gPagemapFd >= 0 && gClearRefsFd >= 0;
+}
+
+bool clearSoftDirty()
+{
+    return pwrite(gClearRefsFd, "4", 1, 0) == 1;
+}
+
+// Moves the soft-dirty bits of every soft-dirty region into its bitmap. Must be done
+// for all of them before the bits are cleared.
+void readSoftDirty()
+{
+    uint64_t entries[512];
+    for (Region& r : gRegions)
+    {
+        const uintptr_t begin = r.begin.load(std::memory_order_relaxed);
+        if (begin == 0 || r.mode != DIRTY_PAGES_SOFTDIRTY)
+        {
+            continue;
+        }
+        const uintptr_t pages = (r.end.load(std::memory_order_relaxed) - begin) / gPageSize;
+        for (uintptr_t first = 0; first < pages; first += 512)
+        {
+            const uintptr_t count = std::min<uintptr_t>(512, pages - first);
+            const off_t offset = (begin / gPageSize + first) * sizeof(uint64_t);
+            if (pread(gPagemapFd, entries, count * sizeof(uint64_t), offset) != (ssize_t)(count * sizeof(uint64_t)))
+            {
+                // Report everything rather than lose writes
+                memset(entries, 0xff, sizeof(entries));
+            }
+            for (uintptr_t i = 0; i < count; ++i)
+            {
+                if (entries[i] & PAGEMAP_SOFT_DIRTY)
+                {
+                    const uintptr_t index = first + i;
+                    r.dirty[index / 64].fetch_or(1ull << (index % 64), std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+}
+
+void protect(uintptr_t begin, uintptr_t end, int prot)
+{
+    if (begin < end && mprotect((void*)begin, end - begin, prot) != 0)
+    {
+        DBG_LOG("mprotect(%p, %zu) failed: %s\n", (void*)begin, (size_t)(end - begin), strerror(errno));
+    }
+}
+
+}
+
+DirtyPagesMode dirtyPagesModeFromString(const char *name)
+{
+    if (strcmp(name, "mprotect") == 0)
+    {
+        return DIRTY_PAGES_MPROTECT;
+    }
+    else if (strcmp(name, "softdirty") == 0)
+    {
+        return DIRTY_PAGES_SOFTDIRTY;
+    }
+    else if (strcmp(name, "none") != 0)
+    {
+        DBG_LOG("Unknown buffer write tracking mode %s, not tracking\n", name);
+    }
+    return DIRTY_PAGES_NONE;
+}
+
+bool dirtyPagesSupported(DirtyPagesMode mode)
+{
+    std::lock_guard<std::mutex> lock(gMutex);
+    initPageSize();
+    if (mode == DIRTY_PAGES_MPROTECT)
+    {
+        return installHandler();
+    }
+    else if (mode != DIRTY_PAGES_SOFTDIRTY || !openSoftDirty())
+    {
+        return false;
+    }
+
+    // The files exist without CONFIG_MEM_SOFT_DIRTY, so see if a write shows up
+    volatile char *page = (volatile char*)mmap(nullptr, gPageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED)
+    {
+        return false;
+    }
+    page[0] = 1;
+    readSoftDirty();
+    bool supported = clearSoftDirty();
+    uint64_t entry = 0;
+    const off_t offset = ((uintptr_t)page / gPageSize) * sizeof(entry);
+    supported = supported && pread(gPagemapFd, &entry, sizeof(entry), offset) == sizeof(entry) && !(entry & PAGEMAP_SOFT_DIRTY);
+    page[0] = 2;
+    supported = supported && pread(gPagemapFd, &entry, sizeof(entry), offset) == sizeof(entry) && (entry & PAGEMAP_SOFT_DIRTY);
+    munmap((void*)page, gPageSize);
+    return supported;
+}
+
+int dirtyPagesTrack(DirtyPagesMode mode, void *base, size_t length)
+{
+    if (mode == DIRTY_PAGES_NONE || base == nullptr || length == 0)
+    {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(gMutex);
+    initPageSize();
+    const uintptr_t begin = (uintptr_t)base & ~(gPageSize - 1);
+    const uintptr_t end = ((uintptr_t)base + length + gPageSize - 1) & ~(gPageSize - 1);
+    const uintptr_t pages = (end - begin) / gPageSize;
+    if (pages > DIRTY_PAGES_MAX_REGION_PAGES)
+    {
+        return -1;
+    }
+    if (mode == DIRTY_PAGES_MPROTECT ? !installHandler() : !openSoftDirty())
+    {
+        return -1;
+    }
+
+    int handle = -1;
+    for (unsigned i = 0; i < DIRTY_PAGES_MAX_REGIONS && handle < 0; ++i)
+    {
+        if (gRegions[i].begin.load(std::memory_order_relaxed) == 0)
+        {
+            handle = i;
+        }
+    }
+    if (handle < 0)
+    {
+        return -1;
+    }
+
+    Region& r = gRegions[handle];
+    for (unsigned i = 0; i < (pages + 63) / 64; ++i)
+    {
+        r.dirty[i].store(0, std::memory_order_relaxed);
+    }
+    r.mode = mode;
+    r.base = (uintptr_t)base;
+    r.length = length;
+
+    if (mode == DIRTY_PAGES_SOFTDIRTY)
+    {
+        // Keep what the other regions have collected so far
+        readSoftDirty();
+        if (!clearSoftDirty())
+        {
+            return -1;
+        }
+        r.end.store(end, std::memory_order_relaxed);
+        r.begin.store(begin, std::memory_order_release);
+    }
+    else
+    {
+        // Publish first, so that a write between mprotect() and the store is not lost
+        r.end.store(end, std::memory_order_relaxed);
+        r.begin.store(begin, std::memory_order_release);
+        if (mprotect((void*)begin, end - begin, PROT_READ) != 0)
+        {
+            DBG_LOG("mprotect(%p, %zu) failed, not tracking writes: %s\n", (void*)begin, (size_t)(end - begin), strerror(errno));
+            r.begin.store(0, std::memory_order_release);
+            return -1;
+        }
+    }
+    return handle;
+}
+
+std::vector<DirtyRange> dirtyPagesCollect(int handle)
+{
+    std::vector<DirtyRange> ranges;
+    if (handle < 0 || handle >= (int)DIRTY_PAGES_MAX_REGIONS)
+    {
+        return ranges;
+    }
+
+    std::lock_guard<std::mutex> lock(gMutex);
+    Region& r = gRegions[handle];
+    const uintptr_t begin = r.begin.load(std::memory_order_relaxed);
+    const uintptr_t end = r.end.load(std::memory_order_relaxed);
+    if (begin == 0)
+    {
+        return ranges;
+    }
+
+    // Start recording again before taking the bits, so that nothing written after this
+    // point can be lost
+    if (r.mode == DIRTY_PAGES_SOFTDIRTY)
+    {
+        readSoftDirty();
+        clearSoftDirty();
+    }
+    else
+    {
+        protect(begin, end, PROT_READ);
+    }
+
+    const uintptr_t pages = (end - begin) / gPageSize;
+    const uintptr_t regionEnd = r.base + r.length;
+    for (unsigned w = 0; w < (pages + 63) / 64; ++w)
+    {
+        uint64_t bits = r.dirty[w].exchange(0, std::memory_order_relaxed);
+        while (bits)
+        {
+            const unsigned bit = __builtin_ctzll(bits);
+            bits &= bits - 1;
+            const uintptr_t page = begin + (w * 64 + bit) * gPageSize;
+            const uintptr_t from = std::max(page, r.base);
+            const uintptr_t to = std::min(page + gPageSize, regionEnd);
+            if (!ranges.empty() && ranges.back().offset + ranges.back().length == from - r.base)
+            {
+                ranges.back().length += to - from;
+            }
+            else
+            {
+                ranges.push_back({ from - r.base, to - from });
+            }
+        }
+    }
+    return ranges;
+}
+
+void dirtyPagesUntrack(int handle)
+{
+    if (handle < 0 || handle >= (int)DIRTY_PAGES_MAX_REGIONS)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(gMutex);
+    Region& r = gRegions[handle];
+    const uintptr_t begin = r.begin.load(std::memory_order_relaxed);
+    const uintptr_t end = r.end.load(std::memory_order_relaxed);
+    if (begin == 0)
+    {
+        return;
+    }
+    r.begin.store(0, std::memory_order_release);
+
+    if (r.mode == DIRTY_PAGES_MPROTECT)
+    {
+        // Pages shared with other regions stay protected for them
+        std::vector<std::pair<uintptr_t, uintptr_t>> shared;
+        for (Region& other : gRegions)
+        {
+            const uintptr_t otherBegin = other.begin.load(std::memory_order_relaxed);
+            const uintptr_t otherEnd = other.end.load(std::memory_order_relaxed);
+            if (otherBegin != 0 && other.mode == DIRTY_PAGES_MPROTECT && otherBegin < end && otherEnd > begin)
+            {
+                shared.push_back(std::make_pair(std::max(begin, otherBegin), std::min(end, otherEnd)));
+            }
+        }
+        std::sort(shared.begin(), shared.end());
+        uintptr_t from = begin;
+        for (const auto& s : shared)
+        {
+            protect(from, s.first, PROT_READ | PROT_WRITE);
+            from = std::max(from, s.second);
+        }
+        protect(from, end, PROT_READ | PROT_WRITE);
+    }
+}
@@ -0,0 +1,58 @@
+#if !defined(_DIRTY_PAGES_HPP_)
+#define _DIRTY_PAGES_HPP_
+
+#include <stddef.h>
+#include <vector>
+
+// Finds out which pages of a memory region have been written to, so that only those
+// need to be saved into the trace. Used for mapped buffers.
+//
+// DIRTY_PAGES_MPROTECT write-protects the region and records each page from a SIGSEGV
+// handler on its first write, then makes the page writable again. Faults outside the
+// tracked regions are passed on to the previous handler. System calls that write into
+// a protected region (e.g. read()) fail with EFAULT instead of faulting.
+//
+// DIRTY_PAGES_SOFTDIRTY uses the soft-dirty bits in /proc/self/pagemap (Linux 3.11+,
+// CONFIG_MEM_SOFT_DIRTY). Clearing the bits is process wide, so every collect() scans
+// all soft-dirty regions first. Writes done by other threads while the bits are being
+// cleared can be missed. Does not work for memory that the driver maps with VM_PFNMAP.
+//
+// Both work at OS page granularity, and a page shared by two regions is reported for
+// both. At most DIRTY_PAGES_MAX_REGIONS regions of up to DIRTY_PAGES_MAX_REGION_PAGES
+// pages can be tracked at the same time; track() returns -1 beyond that.
+
+enum DirtyPagesMode
+{
+    DIRTY_PAGES_NONE,
+    DIRTY_PAGES_MPROTECT,
+    DIRTY_PAGES_SOFTDIRTY,
+};
+
+static const unsigned DIRTY_PAGES_MAX_REGIONS = 64;
+static const unsigned DIRTY_PAGES_MAX_REGION_PAGES = 64 * 1024;
+
+struct DirtyRange
+{
+    size_t offset; // from the start of the region
+    size_t length;
+};
+
+/// Parses "none", "mprotect" or "softdirty"
+DirtyPagesMode dirtyPagesModeFromString(const char *name);
+
+/// Whether the mode works on this system
+bool dirtyPagesSupported(DirtyPagesMode mode);
+
+/// Starts tracking writes to [base, base + length). Returns a handle, or -1 if the region
+/// can not be tracked.
+int dirtyPagesTrack(DirtyPagesMode mode, void *base, size_t length);
+
+/// Returns the ranges written to since track() or the previous collect(), clipped to the
+/// region, and starts recording again. Copy the data after calling this; later writes are
+/// reported by the next call.
+std::vector<DirtyRange> dirtyPagesCollect(int handle);
+
+/// Stops tracking. The region is writable again afterwards.
+void dirtyPagesUntrack(int handle);
+
+#endif // !defined(_DIRTY_PAGES_HPP_)
@@ -5,6 +5,7 @@
 #include <tracer/interactivecmd.hpp>
 #include <tracer/glstate.hpp>
 #include <tracer/config.hpp>
+#include <tracer/dirty_pages.hpp>
 
 #include <helper/eglsize.hpp>
 #include <helper/eglstring.hpp>
@@ -89,7 +90,7 @@ const std::string& get_extension_string()
 
 static void callback(unsigned int source, unsigned int type, unsigned int id, unsigned int severity, int length, const char* message, const void* userParam)
 {
-    DBG_LOG("%s::%s::%s (call=%u): %s\n", cbsource(source), cbtype(type), cbseverity(severity), gTraceOut->callNo, message);
+    DBG_LOG("%s::%s::%s (call=%u): %s\n", cbsource(source), cbtype(type), cbseverity(severity), gTraceOut->callNo.load(), message);
 }
 
 static MyEGLAttribArray GetBestConfigPerThread()
@@ -154,6 +155,7 @@ BinAndMeta::BinAndMeta()
     traceFile = new OutFile;
     if (tracerParams.Timestamping) traceFile->Open(binName.str(), true, NULL, true);
     else traceFile->Open(binName.str());
+    if (tracerParams.PerThreadRecording) recorder = new CallRecorder(traceFile);
 
     // Reset per thread counters
     timesEGLConfigIdUsed.clear();
@@ -162,6 +164,8 @@ BinAndMeta::BinAndMeta()
 
 BinAndMeta::~BinAndMeta()
 {
+    delete recorder; // writes out the remaining calls
+    recorder = nullptr;
     writeHeader(true);
     traceFile->Close();
 }
@@ -308,6 +312,8 @@ void BinAndMeta::writeHeader(bool cleanExit)
     // Now that we have all header data written to JSON, write it to reserved header-area
     if (0 != jsonData.length())
     {
+        std::unique_lock<std::mutex> fileLock;
+        if (recorder) fileLock = recorder->LockFile();
         traceFile->WriteHeader(jsonData.c_str(), jsonData.length(), !tracerParams.FlushTraceFileEveryFrame);
     }
     else
@@ -436,6 +442,14 @@ TraceContext::~TraceContext()
         return;
     }
     gCtxMap.erase(it);
+
+    for (auto& mapping : bufferToClientPointerMap)
+    {
+        if (mapping.second.dirtyPages >= 0)
+        {
+            dirtyPagesUntrack(mapping.second.dirtyPages);
+        }
+    }
 }
 
 TraceSurface* GetCurTraceSurface(unsigned char tid)
@@ -524,26 +538,129 @@ void after_glBindAttribLocation(unsigned char tid, GLuint program, GLuint index)
     it->second |= (0x1 << index);
 }
 
+static DirtyPagesMode bufferWriteTracking()
+{
+    static const DirtyPagesMode mode = dirtyPagesModeFromString(tracerParams.BufferWriteTracking.c_str());
+    return mode;
+}
+
+static void stopWriteTracking(TraceContext* ctx, BufferRangeData& data)
+{
+    if (data.dirtyPages >= 0)
+    {
+        dirtyPagesUntrack(data.dirtyPages);
+        data.dirtyPages = -1;
+        if (data.access & GL_MAP_PERSISTENT_BIT_EXT)
+        {
+            ctx->trackedPersistentMappings--;
+        }
+    }
+}
+
+static void _glBindBuffer_fake(GLenum target, GLuint buffer)
+{
+    unsigned char tid = GetThreadId();
+    std::lock_guard<std::recursive_mutex> guard(gTraceOut->callMutex);
+    char* dest = gTraceOut->Start();
+    BCall *pCall = (BCall*)dest;
+    pCall->funcId = glBindBuffer_id;
+    pCall->tid = tid; pCall->reserved = 0; pCall->source = 1;
+    dest += sizeof(*pCall);
+
+    dest = WriteFixed<int>(dest, target); // enum
+    dest = WriteFixed<unsigned int>(dest, buffer); // literal
+    pCall->errNo = GetCallErrorNo("glBindBuffer", tid);
+    gTraceOut->WriteBuf(dest);
+    gTraceOut->callNo++;
+}
+
+// Saves the given ranges of a mapping as a glPatchClientSideBuffer call on target
+static void _glPatchWrittenPages(GLenum target, const BufferRangeData& data, const std::vector<DirtyRange>& ranges)
+{
+    size_t size = sizeof(CSBPatchList);
+    for (const DirtyRange& range : ranges)
+    {
+        size += sizeof(CSBPatch) + range.length;
+    }
+    std::vector<unsigned char> patches(size);
+    unsigned char* ptr = patches.data();
+    CSBPatchList list;
+    list.count = ranges.size();
+    memcpy(ptr, &list, sizeof(list));
+    ptr += sizeof(list);
+    for (const DirtyRange& range : ranges)
+    {
+        CSBPatch patch;
+        patch.offset = range.offset;
+        patch.length = range.length;
+        memcpy(ptr, &patch, sizeof(patch));
+        ptr += sizeof(patch);
+        memcpy(ptr, static_cast<const unsigned char*>(data.base) + range.offset, range.length);
+        ptr += range.length;
+    }
+    _glPatchClientSideBuffer(target, size, patches.data());
+}
+
+// Saves the pages of a tracked mapping written to since it was mapped or last saved.
+// Returns false without saving anything if more than threshold of the mapping was
+// written to, in which case the caller should copy all of it instead.
+static bool saveWrittenPages(GLenum target, BufferRangeData& data, float threshold)
+{
+    const std::vector<DirtyRange> ranges = dirtyPagesCollect(data.dirtyPages);
+    size_t written = 0;
+    for (const DirtyRange& range : ranges)
+    {
+        written += range.length;
+    }
+    if (written == 0)
+    {
+        return true;
+    }
+    if (written > data.length * threshold)
+    {
+        return false;
+    }
+    _glPatchWrittenPages(target, data, ranges);
+    return true;
+}
+
 void after_glMapBufferRange(GLenum target, GLsizeiptr length, GLbitfield access, GLvoid* base)
 {
     BufferRangeData data;
     data.length = length;
     data.base = base;
     data.access = access;
+    data.target = target;
 
     unsigned char tid = GetThreadId();
+    TraceContext* ctx = GetCurTraceContext(tid);
     GLuint currentlyBoundBuffer = getBoundBuffer(target);
     if (currentlyBoundBuffer == 0)
     {
         DBG_LOG("No buffer currently bound to target %s for glMapBufferRange!\n", bufferName(target));
     }
 
-    GetCurTraceContext(tid)->bufferToClientPointerMap[currentlyBoundBuffer] = data;
+    BufferRangeData& mapping = ctx->bufferToClientPointerMap[currentlyBoundBuffer];
+    stopWriteTracking(ctx, mapping);
+    mapping = data;
 
-    if (data.access == GL_WRITE_ONLY)
+    // glMapBuffer passes GL_WRITE_ONLY, which is not a bitfield
+    const bool write = (access == GL_WRITE_ONLY) || (access & GL_MAP_WRITE_BIT);
+    const bool persistent = (access != GL_WRITE_ONLY) && (access & GL_MAP_PERSISTENT_BIT_EXT);
+    const bool explicitFlush = (access != GL_WRITE_ONLY) && (access & GL_MAP_FLUSH_EXPLICIT_BIT);
+    if (base && write && (persistent || !explicitFlush))
     {
-        std::vector<unsigned char>& contents = GetCurTraceContext(tid)->bufferToClientPointerMap[currentlyBoundBuffer].contents;
-        BufferInitializedSet_t &bufInitSet = GetCurTraceContext(tid)->bufferInitializedSet;
+        mapping.dirtyPages = dirtyPagesTrack(bufferWriteTracking(), base, length);
+        if (mapping.dirtyPages >= 0 && persistent)
+        {
+            ctx->trackedPersistentMappings++;
+        }
+    }
+
+    if (data.access == GL_WRITE_ONLY && mapping.dirtyPages < 0)
+    {
+        std::vector<unsigned char>& contents = mapping.contents;
+        BufferInitializedSet_t &bufInitSet = ctx->bufferInitializedSet;
         if (bufInitSet.find(currentlyBoundBuffer) != bufInitSet.end())
         {
             unsigned char* bufdata = static_cast<unsigned char*>(base);
@@ -555,12 +672,14 @@ void after_glMapBufferRange(GLenum target, GLsizeiptr length, GLbitfield access,
         }
     }
 
-    if (data.access & GL_MAP_PERSISTENT_BIT_EXT)
+    if (persistent && mapping.dirtyPages < 0)
     {
         DBG_LOG("WARNING! GL_MAP_PERSISTENT_BIT is set to parameter 'access' of glMapBufferRange(). \n");
         DBG_LOG("It may cause the trace to work abnormal.\n");
         DBG_LOG("Suggest adding a parameter to /data/apitrace/tracerparams.cfg to disable the GL_EXT_buffer_storage extension:\n");
         DBG_LOG("    echo \"DisableBufferStorage true\" >> /data/apitrace/tracerparams.cfg\n");
+        DBG_LOG("or to track writes to the mapping:\n");
+        DBG_LOG("    echo \"BufferWriteTracking mprotect\" >> /data/apitrace/tracerparams.cfg\n");
     }
 }
 
@@ -575,6 +694,13 @@ void pre_glFlushMappedBufferRange(GLenum target, GLintptr offset, GLsizeiptr len
     {
         BufferRangeData& data = it->second;
 
+        if (data.dirtyPages >= 0)
+        {
+            // Everything written so far, which includes the flushed range
+            saveWrittenPages(target, data, 1.0f);
+            return;
+        }
+
         bool created = false;
         void* offsettedPointer = static_cast<char*>(data.base) + offset;
         ClientSideBufferObjectName name = _getOrCreateClientSideBuffer(offsettedPointer, length, created);
@@ -589,6 +715,57 @@ void pre_glFlushMappedBufferRange(GLenum target, GLintptr offset, GLsizeiptr len
     }
 }
 
+// Persistent mappings can be written to at any time while the buffer is used, so save
+// what was written before every draw or dispatch call
+void pre_glDraw(unsigned char tid)
+{
+    TraceContext* ctx = GetCurTraceContext(tid);
+    if (ctx == NULL || ctx->trackedPersistentMappings == 0)
+    {
+        return;
+    }
+
+    for (auto& it : ctx->bufferToClientPointerMap)
+    {
+        BufferRangeData& data = it.second;
+        if (data.dirtyPages < 0 || !(data.access & GL_MAP_PERSISTENT_BIT_EXT))
+        {
+            continue;
+        }
+        const std::vector<DirtyRange> ranges = dirtyPagesCollect(data.dirtyPages);
+        if (ranges.empty())
+        {
+            continue;
+        }
+
+        // The buffer does not have to be bound while it is mapped
+        const GLuint bound = getBoundBuffer(data.target);
+        if (bound != it.first)
+        {
+            _glBindBuffer_fake(data.target, it.first);
+        }
+        _glPatchWrittenPages(data.target, data, ranges);
+        if (bound != it.first)
+        {
+            _glBindBuffer_fake(data.target, bound);
+        }
+    }
+}
+
+void pre_glDeleteBuffers(unsigned char tid, GLsizei n, const GLuint *buffers)
+{
+    TraceContext* ctx = GetCurTraceContext(tid);
+    for (GLsizei i = 0; i < n; ++i)
+    {
+        BufferToClientPointerMap_t::iterator it = ctx->bufferToClientPointerMap.find(buffers[i]);
+        if (it != ctx->bufferToClientPointerMap.end())
+        {
+            // Deleting a buffer unmaps it
+            stopWriteTracking(ctx, it->second);
+        }
+    }
+}
+
 static const unsigned int CSB_PATCH_MIN_BUFFER_SIZE = 0x8000; // 32kB
 static const unsigned int CSB_PATCH_PAGE_SIZE = 0x400; // 1kB
 static const float CSB_PATCH_UP_THRESHOLD = 0.8;
@@ -676,7 +853,12 @@ void pre_glUnmapBuffer(GLenum target)
             bool hasPatch = false;
 
             BufferInitializedSet_t &bufInitSet = GetCurTraceContext(tid)->bufferInitializedSet;
-            if (data.access == GL_WRITE_ONLY && bufInitSet.find(currentlyBoundBuffer) != bufInitSet.end())
+            if (data.dirtyPages >= 0)
+            {
+                // Only the pages written to since mapping, or since the last draw call
+                hasPatch = saveWrittenPages(target, data, CSB_PATCH_UP_THRESHOLD);
+            }
+            else if (data.access == GL_WRITE_ONLY && bufInitSet.find(currentlyBoundBuffer) != bufInitSet.end())
             {
                 hasPatch = genCSBPatchList(target, data.contents.data(), data.base, data.length);
             }
@@ -685,7 +867,8 @@ void pre_glUnmapBuffer(GLenum target)
             {
                 bool created = false;
 
-                if(!(data.access & GL_MAP_FLUSH_EXPLICIT_BIT))
+                // GL_WRITE_ONLY from glMapBuffer shares bits with GL_MAP_FLUSH_EXPLICIT_BIT
+                if (data.access == GL_WRITE_ONLY || !(data.access & GL_MAP_FLUSH_EXPLICIT_BIT))
                 {
                     ClientSideBufferObjectName name = _getOrCreateClientSideBuffer(data.base, data.length, created);
                     if (created)
@@ -697,6 +880,7 @@ void pre_glUnmapBuffer(GLenum target)
                 }
             }
         }
+        stopWriteTracking(GetCurTraceContext(tid), data);
     }
     if (GetCurTraceContext(tid)->isFullMapping)
     {
@@ -849,7 +1033,7 @@ static bool TakeSnapshot(int frNoOverride = -1)
     image::Image *src = glstate::getDrawBufferImage();
     if (src == NULL)
     {
-        DBG_LOG("Failed to take snapshot for frame %u, call no: %u\n", gTraceOut->frameNo, gTraceOut->callNo);
+        DBG_LOG("Failed to take snapshot for frame %u, call no: %u\n", gTraceOut->frameNo, gTraceOut->callNo.load());
         return false;
     }
 
@@ -865,7 +1049,7 @@ static bool TakeSnapshot(int frNoOverride = -1)
     } else {
         frNo = gTraceOut->frameNo;
     }
-    sprintf(filename, "%sf%05u_c%010u.png", snapPath, frNo, gTraceOut->callNo);
+    sprintf(filename, "%sf%05u_c%010u.png", snapPath, frNo, gTraceOut->callNo.load());
 
     if (src->writePNG(filename))
         DBG_LOG("Snapshot : %s\n", filename);
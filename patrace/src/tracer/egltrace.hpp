@@ -3,6 +3,7 @@
 
 #include <tracer/tracerparams.hpp>
 #include "tracer/path.hpp"
+#include "tracer/call_recorder.hpp"
 
 #include <dispatch/eglproc_auto.hpp>
 
@@ -13,6 +14,7 @@
 #include "common/memory.hpp"
 #include "helper/states.h"
 
+#include <atomic>
 #include <mutex>
 #include <map>
 #include <unordered_map>
@@ -24,6 +26,8 @@
 
 extern bool isUsingPBO;
 
+unsigned char GetThreadId();
+
 class BinAndMeta {
 public:
 
@@ -37,6 +41,17 @@ public:
         traceFile->Progress(len);
     }
 
+    inline char* scratch()
+    {
+        return recorder ? recorder->Scratch(GetThreadId()) : traceFile->Scratch();
+    }
+
+    inline void commit(const char* end)
+    {
+        if (recorder) recorder->Commit(GetThreadId(), end);
+        else write(end - traceFile->Scratch());
+    }
+
     void saveExtensions();
     void saveAllEGLConfigs(EGLDisplay dpy);
     void updateWinSurfSize(EGLint width, EGLint height);
@@ -65,6 +80,8 @@ public:
     CaptureInfo captureInfo;
 
     common::OutFile* traceFile = nullptr;
+    /// Writes calls into traceFile if tracerParams.PerThreadRecording is set
+    CallRecorder* recorder = nullptr;
 };
 
 class TraceOut {
@@ -76,7 +93,7 @@ public:
     const static int WRITE_BUF_LEN = (150*1024*1024);
     std::recursive_mutex callMutex;
 
-    unsigned callNo = 0;
+    std::atomic<unsigned> callNo{0};
     unsigned frameNo = 0;
     bool snapDraw = false;
     long long mFrameBegTime = 0;
@@ -89,27 +106,63 @@ public:
         if (mpBinAndMeta == NULL)
         {
             mpBinAndMeta = new BinAndMeta();
-            mStateLogger.open(mpBinAndMeta->getFileName() + ".tracelog");
+            if (tracerParams.StateLogBinary)
+            {
+                mStateLogger.open(mpBinAndMeta->getFileName() + ".tracelog.bin", true);
+            }
+            else
+            {
+                mStateLogger.open(mpBinAndMeta->getFileName() + ".tracelog");
+            }
+            mRecording = (mpBinAndMeta->recorder != nullptr);
         }
-        return mpBinAndMeta->traceFile->Scratch();
+        return mpBinAndMeta->scratch();
     }
 
     inline void WriteBuf(const char *endPointer)
     {
-        mpBinAndMeta->write(endPointer - mpBinAndMeta->traceFile->Scratch());
+        mpBinAndMeta->commit(endPointer);
     }
 
     inline void WriteVlen(const char *end)
     {
-        const char* start = mpBinAndMeta->traceFile->Scratch();
-        common::BCall_vlen *pCall = (common::BCall_vlen*)start;
-        const size_t count = end - start;
-        pCall->toNext = count;
-        mpBinAndMeta->write(count);
+        common::BCall_vlen *pCall = (common::BCall_vlen*)mpBinAndMeta->scratch();
+        pCall->toNext = end - (const char*)pCall;
+        mpBinAndMeta->commit(end);
+    }
+
+    /// Called around recording a call that only writes to the trace. Takes callMutex,
+    /// unless each thread records on its own, and returns whether it did.
+    inline bool BeginCall()
+    {
+        if (mRecording)
+        {
+            mActiveCalls++;
+            if (mRecording)
+            {
+                return false;
+            }
+            mActiveCalls--;
+        }
+        callMutex.lock();
+        return true;
+    }
+
+    inline void EndCall(bool locked)
+    {
+        if (locked) callMutex.unlock();
+        else mActiveCalls--;
     }
 
     void Close()
     {
+        std::lock_guard<std::recursive_mutex> guard(callMutex);
+        // Wait for the calls that are recorded without the lock
+        mRecording = false;
+        while (mActiveCalls > 0)
+        {
+            std::this_thread::yield();
+        }
         if (mpBinAndMeta)
         {
             mpBinAndMeta->callCnt = callNo;
@@ -127,6 +180,8 @@ public:
 
 private:
     StateLogger mStateLogger;
+    std::atomic<bool> mRecording{false};
+    std::atomic<int> mActiveCalls{0};
 };
 
 extern TraceOut* gTraceOut;
@@ -138,6 +193,9 @@ struct BufferRangeData
     void* base;
     GLbitfield access;
     std::vector<unsigned char> contents;
+    GLenum target = 0;
+    /// Handle from dirtyPagesTrack(), or -1 if writes to the mapping are not tracked
+    int dirtyPages = -1;
 };
 
 typedef std::unordered_map<GLuint, BufferRangeData> BufferToClientPointerMap_t;
@@ -154,6 +212,8 @@ struct TraceContext
     bool isEglDestroyContextInvoked = false;
     /// Whether the currently mapped buffer is the whole buffer or just a range
     bool isFullMapping = false;
+    /// Number of persistent mappings with tracked writes, saved before each draw call
+    unsigned int trackedPersistentMappings = 0;
     GLenum lastGlError = GL_NO_ERROR;
     EGLContext mEGLCtx;
     EGLint mEGLConfigId;
@@ -208,7 +268,6 @@ struct TraceThread {
 
 extern std::vector<TraceThread> gTraceThread;
 
-unsigned char GetThreadId();
 void UpdateTimesEGLConfigUsed(int threadid);
 TraceContext* GetCurTraceContext(unsigned char tid);
 TraceSurface* GetCurTraceSurface(unsigned char tid);
@@ -218,10 +277,12 @@ void after_glMapBufferRange(GLenum target, GLsizeiptr length, GLbitfield access,
 void after_glCreateProgram(unsigned char tid, GLuint program);
 void pre_glFlushMappedBufferRange(GLenum target, GLintptr offset, GLsizeiptr length);
 void pre_glUnmapBuffer(GLenum target);
+void pre_glDeleteBuffers(unsigned char tid, GLsizei n, const GLuint *buffers);
 void after_glUnmapBuffer(GLenum target);
 bool pre_glLinkProgram(unsigned char tid, unsigned int program);
 GLuint replace_glCreateShaderProgramv(unsigned char tid, GLenum type, GLsizei count, const GLchar * const * strings);
 void after_glDeleteProgram(unsigned char tid, GLuint program);
+void pre_glDraw(unsigned char tid);
 void after_glDraw();
 void after_glLinkProgram(unsigned int program);
 
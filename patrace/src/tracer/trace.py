@@ -1,6 +1,10 @@
 from __future__ import print_function
 import os
 import sys
+try:
+    from StringIO import StringIO
+except ImportError:
+    from io import StringIO
 
 sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..'))
 
@@ -355,6 +359,26 @@ class UserArrays:
         self.cleanup(uppercase_name)
 
 class Tracer:
+    def captureOutput(self, method, *args):
+        orig_stdout = sys.stdout
+        sys.stdout = StringIO()
+        try:
+            method(*args)
+            return sys.stdout.getvalue()
+        finally:
+            sys.stdout = orig_stdout
+
+    # Calls without after-hooks only write to the trace, so they can skip callMutex when
+    # threads record on their own (see TraceOut::BeginCall)
+    def traceFunctionBodyAndAfter(self, func, mark_as_injected = False):
+        after = self.captureOutput(self.traceFunctionBody_after, func)
+        self.traceFunctionBody(func, mark_as_injected, locked = bool(after))
+        sys.stdout.write(after)
+        if after:
+            print('    gTraceOut->callMutex.unlock();')
+        else:
+            print('    gTraceOut->EndCall(_locked);')
+
     def traceFunctionInject(self, func):
         print(func.prototype('inject_' + func.name))
         print('{')
@@ -362,8 +386,7 @@ class Tracer:
         if func.type is not stdapi.Void:
             print('    %s _result;' % func.type)
         self.traceFunctionBody_pre(func)
-        self.traceFunctionBody(func, True)
-        self.traceFunctionBody_after(func)
+        self.traceFunctionBodyAndAfter(func, True)
         if func.type is not stdapi.Void:
             print('    return _result;')
         print('}')
@@ -380,8 +403,7 @@ class Tracer:
             print('    %s _result;' % func.type)
 
         self.traceFunctionBody_pre(func)
-        self.traceFunctionBody(func)
-        self.traceFunctionBody_after(func)
+        self.traceFunctionBodyAndAfter(func)
 
         if func.type is not stdapi.Void:
             print('    return _result;')
@@ -411,7 +433,7 @@ class Tracer:
         print('}')
         print()
 
-    def traceFunctionBody(self, func, mark_as_injected = False):
+    def traceFunctionBody(self, func, mark_as_injected = False, locked = True):
         global gIdToLength
 
         self.invokeFunction(func)
@@ -466,7 +488,10 @@ class Tracer:
             print('    {')
             print('        params[bufSize - 1] = 2; // the list is always sorted in descending order, and 2 is always the minimum possible')
             print('    }')
-        print('    gTraceOut->callMutex.lock();')
+        if locked:
+            print('    gTraceOut->callMutex.lock();')
+        else:
+            print('    const bool _locked = gTraceOut->BeginCall();')
         print('    char* dest = gTraceOut->Start();')
         if func.sideeffects:
             print('    if (tracerParams.Timestamping) dest = inject_timestamp(tid, dest);')
@@ -774,9 +799,11 @@ class Tracer:
             print('        GLuint _count = _%s_count(%s);' % (func.name, arg_names))
             print('        _trace_user_arrays(_count, %s);' % instance_count)
             print('    }')
+        if func.name in stdapi.draw_function_names or func.name in stdapi.dispatch_compute_names:
+            print('    pre_glDraw(tid);')
         if func.name in stdapi.draw_function_names or func.name == 'glDispatchCompute':
             print('    if (unlikely(stateLoggingEnabled)) {')
-            print('        gTraceOut->getStateLogger().logFunction(tid, "' + func.name + '", gTraceOut->callNo, 0);')
+            print('        gTraceOut->getStateLogger().logFunction(tid, %d, "%s", gTraceOut->callNo, 0);' % (func.id, func.name))
 
         if func.name in stdapi.draw_array_function_names:
             if func.name not in stdapi.draw_indirect_function_names:
@@ -836,6 +863,7 @@ class Tracer:
             print('        if (it != bufInitSet.end())')
             print('            bufInitSet.erase(it);')
             print('    }')
+            print('    pre_glDeleteBuffers(tid, n, buffers);')
             print()
         if func.name == 'glMapBufferRange':
             print('    GLbitfield readAccess = access & ~GL_MAP_INVALIDATE_RANGE_BIT & ~GL_MAP_INVALIDATE_BUFFER_BIT;')
@@ -916,8 +944,6 @@ class Tracer:
         if func.name in post_functions:
             print('    after_%s(%s);' % (func.name, params))
 
-        print('    gTraceOut->callMutex.unlock();')
-
 class TypeLengthVisitor(stdapi.Visitor):
     def __init__(self):
         self.len = 'variable'
@@ -53,6 +53,9 @@ TracerParams::TracerParams()
         if (DisableErrorReporting) DBG_LOG("DisableErrorReporting: true\n");
         if (StateDumpAfterSnapshot) DBG_LOG("StateDumpAfterSnapshot: true\n");
         if (StateDumpAfterDrawCall) DBG_LOG("StateDumpAfterDrawCall: true\n");
+        if (StateLogBinary) DBG_LOG("StateLogBinary: true\n");
+        if (BufferWriteTracking != "none") DBG_LOG("BufferWriteTracking: %s\n", BufferWriteTracking.c_str());
+        if (PerThreadRecording) DBG_LOG("PerThreadRecording: true\n");
         if (FilterSupportedExtension) {
             DBG_LOG("%sFilterSupportedExtension true%s\n",redOnBlack, resetColor);
             for (unsigned int i = 0; i < SupportedExtensions.size(); ++i) {
@@ -142,6 +145,8 @@ void TracerParams::LoadParams()
         } else if (strParamName.compare("StateDumpAfterDrawCall") == 0) {
             StateDumpAfterDrawCall = (strParamValue.compare("true") == 0);
             stateLoggingEnabled = StateDumpAfterDrawCall;
+        } else if (strParamName.compare("StateLogBinary") == 0) {
+            StateLogBinary = (strParamValue.compare("true") == 0);
         } else if (strParamName.compare("DisableBufferStorage") == 0) {
             DisableBufferStorage = (strParamValue.compare("true") == 0);
         } else if (strParamName.compare("RendererName") == 0) {
@@ -154,6 +159,10 @@ void TracerParams::LoadParams()
             Support2xMSAA = (strParamValue.compare("true") == 0);
         } else if(strParamName.compare("Timestamping") == 0) {
             Timestamping = (strParamValue.compare("true") == 0);
+        } else if(strParamName.compare("BufferWriteTracking") == 0) {
+            BufferWriteTracking = strParamValue;
+        } else if(strParamName.compare("PerThreadRecording") == 0) {
+            PerThreadRecording = (strParamValue.compare("true") == 0);
         } else if (strParamName.compare("SupportedExtension") == 0) {
             SupportedExtensions.push_back(strParamValue);
             if (SupportedExtensionsString.length() != 0)
@@ -19,6 +19,7 @@ public:
     bool FlushTraceFileEveryFrame = true;           // Save trace file for each completed frame. Slower but safer.
     bool StateDumpAfterSnapshot = false;            // Debugging
     bool StateDumpAfterDrawCall = false;            // Debugging
+    bool StateLogBinary = false;                    // Write state logs in binary format (see statelog_to_txt)
     int UniformBufferOffsetAlignment = 256;         // Enforce an alignment that works crossplatform
     int ShaderStorageBufferOffsetAlignment = 256;   // As above
     int MaximumAnisotropicFiltering = 0;            // Anisotropic support. Must also add GL_EXT_texture_filter_anisotropic to SupportedExtensions
@@ -29,6 +30,8 @@ public:
     bool CloseTraceFileByTerminate = false;         // close current trace and create new on when calling  eglTerminate
     bool Timestamping = false;                      // Inject a timestamp into the command stream for each call with sideeffects
     bool Support2xMSAA = false;                     // Pretend to support 2x MSAA even if the underlying system does not
+    std::string BufferWriteTracking = "none";       // Save only the pages written to in mapped buffers: none, mprotect or softdirty (see dirty_pages.hpp)
+    bool PerThreadRecording = false;                // Let threads record calls without a shared lock (see call_recorder.hpp)
 
     std::string _tmp_extensions;
 
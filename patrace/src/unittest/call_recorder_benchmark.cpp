@@ -0,0 +1,88 @@
+// Measures how fast several threads can record calls, comparing the shared lock used
+// by the tracer (one recursive mutex around the OutFile scratch buffer) with the per
+// thread buffers of CallRecorder (see tracer/call_recorder.hpp).
+// CPU only, no GL context is needed.
+
+#include "tracer/call_recorder.hpp"
+#include "common/out_file.hpp"
+#include "common/os_time.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace common;
+
+static const char *TRACE_NAME = "call_recorder_benchmark.pat";
+
+// The size of a typical small call, e.g. glUniform4f
+static char* writeCall(char *dest, unsigned thread, uint32_t index)
+{
+    BCall *call = (BCall*)dest;
+    call->funcId = 1;
+    call->tid = thread;
+    call->errNo = 0;
+    call->source = 0;
+    call->reserved = 0;
+    dest += sizeof(BCall);
+    const uint32_t args[5] = { thread, index, index, index, index };
+    memcpy(dest, args, sizeof(args));
+    return dest + sizeof(args);
+}
+
+template<typename Record>
+static void run(const char *label, unsigned threadCount, unsigned calls, Record record)
+{
+    const long long begin = os::getTime();
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (unsigned i = 0; i < calls; ++i)
+            {
+                record(t, i);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    const long long end = os::getTime();
+    const double seconds = (double)(end - begin) / os::timeFrequency;
+    printf("%-16s %3u thread(s) %9.2f M calls/s\n", label, threadCount, (double)threadCount * calls / seconds / 1000000.0);
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned calls = (argc > 1) ? atoi(argv[1]) : 1000000;
+    const unsigned maxThreads = (argc > 2) ? atoi(argv[2]) : std::max(4u, 2 * std::thread::hardware_concurrency());
+    printf("%u calls per thread, %u cores\n", calls, std::thread::hardware_concurrency());
+
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        {
+            OutFile out(TRACE_NAME);
+            std::recursive_mutex mutex;
+            run("shared lock", threads, calls, [&](unsigned t, unsigned i) {
+                std::lock_guard<std::recursive_mutex> lock(mutex);
+                char *dest = writeCall(out.Scratch(), t, i);
+                out.Progress(dest - out.Scratch());
+            });
+        }
+        {
+            OutFile out(TRACE_NAME);
+            CallRecorder recorder(&out);
+            run("per thread", threads, calls, [&](unsigned t, unsigned i) {
+                recorder.Commit(t, writeCall(recorder.Scratch(t), t, i));
+            });
+        }
+    }
+    unlink(TRACE_NAME);
+    return 0;
+}
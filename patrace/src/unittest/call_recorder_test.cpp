@@ -0,0 +1,189 @@
+#include "call_recorder_test.hpp"
+#include "tracer/call_recorder.hpp"
+#include "common/api_info.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/out_file.hpp"
+
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace common;
+
+static const char *TRACE_NAME = "call_recorder_test.pat";
+static const uint32_t NO_TOKEN = 0xffffffff;
+
+// glDrawArrays(thread, index, token) as the tracer would encode it
+static char* writeDraw(char *dest, unsigned thread, uint32_t index, uint32_t token)
+{
+    BCall *call = (BCall*)dest;
+    call->funcId = gApiInfo.NameToId("glDrawArrays");
+    call->tid = thread;
+    call->errNo = 0;
+    call->source = 0;
+    call->reserved = 0;
+    dest += sizeof(BCall);
+    const uint32_t args[3] = { thread, index, token };
+    memcpy(dest, args, sizeof(args));
+    return dest + sizeof(args);
+}
+
+// glBufferData(thread, size, data, index) with the data filled with the index, padded
+// to 4 bytes like Write1DArray() does
+static char* writeBufferData(char *dest, unsigned thread, uint32_t index, uint32_t size)
+{
+    BCall_vlen *call = (BCall_vlen*)dest;
+    call->funcId = gApiInfo.NameToId("glBufferData");
+    call->tid = thread;
+    call->errNo = 0;
+    call->source = 0;
+    call->reserved = 0;
+    char *start = dest;
+    dest += sizeof(BCall_vlen);
+    const uint32_t args[3] = { thread, size, size };
+    memcpy(dest, args, sizeof(args));
+    dest += sizeof(args);
+    const uint32_t padded = (size + 3) & ~3;
+    memset(dest, index & 0xff, padded);
+    dest += padded;
+    memcpy(dest, &index, sizeof(index));
+    dest += sizeof(index);
+    call->toNext = dest - start;
+    return dest;
+}
+
+// Every thread records its own calls. A token is passed from thread to thread, and each
+// thread records a call with the token before handing it on, so those calls must come
+// out in token order. Every largeEvery calls, a glBufferData call with largeSize bytes
+// is added.
+static void record(unsigned threadCount, unsigned calls, unsigned tokens, unsigned largeEvery = 0, unsigned largeSize = 0)
+{
+    OutFile out;
+    CPPUNIT_ASSERT(out.Open(TRACE_NAME));
+    uint64_t committed = 0;
+    {
+        CallRecorder recorder(&out);
+        std::atomic<unsigned> token(0);
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                uint32_t index = 0;
+                for (unsigned i = 0; i < calls; ++i)
+                {
+                    char *dest = recorder.Scratch(t);
+                    if (largeEvery && i % largeEvery == 0)
+                    {
+                        dest = writeBufferData(dest, t, index++, largeSize);
+                    }
+                    dest = writeDraw(dest, t, index++, NO_TOKEN);
+                    recorder.Commit(t, dest);
+
+                    const unsigned current = token.load();
+                    if (current < tokens && current % threadCount == t)
+                    {
+                        recorder.Commit(t, writeDraw(recorder.Scratch(t), t, index++, current));
+                        token.store(current + 1);
+                    }
+                }
+                // Hand on the remaining tokens
+                while (token.load() < tokens)
+                {
+                    const unsigned current = token.load();
+                    if (current % threadCount == t)
+                    {
+                        recorder.Commit(t, writeDraw(recorder.Scratch(t), t, index++, current));
+                        token.store(current + 1);
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        // Waiting for the file in the middle of recording
+        for (int i = 0; i < 10; ++i)
+        {
+            std::unique_lock<std::mutex> lock = recorder.LockFile();
+        }
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+        committed = recorder.Committed();
+    }
+    const std::string header = "{\"defaultTid\":0,\"glesVersion\":3,\"callCnt\":" + std::to_string(committed) + ",\"frameCnt\":0,\"threads\":[]}";
+    out.WriteHeader(header.c_str(), header.size(), false);
+    out.Close();
+
+    InFile in;
+    CPPUNIT_ASSERT(in.Open(TRACE_NAME));
+    std::vector<uint32_t> next(threadCount, 0);
+    uint32_t nextToken = 0;
+    uint64_t count = 0;
+    void *fptr = nullptr;
+    BCall_vlen call;
+    char *src = nullptr;
+    while (in.GetNextCall(fptr, call, src))
+    {
+        const uint32_t *args = (const uint32_t*)src;
+        const uint32_t thread = args[0];
+        CPPUNIT_ASSERT(thread < threadCount && call.tid == thread);
+        if (strcmp(in.ExIdToName(call.funcId), "glBufferData") == 0)
+        {
+            CPPUNIT_ASSERT(args[1] == largeSize);
+            const uint32_t index = args[3 + (largeSize + 3) / 4];
+            CPPUNIT_ASSERT((unsigned char)src[12] == (index & 0xff) && (unsigned char)src[11 + largeSize] == (index & 0xff));
+            CPPUNIT_ASSERT(index == next[thread]++);
+            continue;
+        }
+        CPPUNIT_ASSERT(strcmp(in.ExIdToName(call.funcId), "glDrawArrays") == 0);
+        // Every thread in its own order
+        CPPUNIT_ASSERT(args[1] == next[thread]++);
+        // Handed on tokens in global order
+        if (args[2] != NO_TOKEN)
+        {
+            CPPUNIT_ASSERT(args[2] == nextToken++);
+        }
+        count++;
+    }
+    in.Close();
+    CPPUNIT_ASSERT(nextToken == tokens);
+    CPPUNIT_ASSERT(count == (uint64_t)threadCount * calls + tokens);
+    CPPUNIT_ASSERT(committed == (uint64_t)threadCount * calls + tokens);
+    unlink(TRACE_NAME);
+}
+
+CallRecorderTest::CallRecorderTest()
+{
+}
+
+void CallRecorderTest::setUp()
+{
+}
+
+void CallRecorderTest::tearDown()
+{
+}
+
+void CallRecorderTest::testOneThread()
+{
+    record(1, 1000, 10);
+}
+
+// More units than fit in the queue of a thread, and more data than one reset interval
+void CallRecorderTest::testManyThreads()
+{
+    record(4, 50000, 1000);
+    record(16, 20000, 5000);
+    record(64, 2000, 1000);
+}
+
+void CallRecorderTest::testLargeCalls()
+{
+    record(4, 200, 100, 20, 3 * 1024 * 1024 + 3);
+}
@@ -0,0 +1,27 @@
+#ifndef _INCLUDE_CALL_RECORDER_TEST_
+#define _INCLUDE_CALL_RECORDER_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class CallRecorderTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CallRecorderTest);
+
+    CPPUNIT_TEST(testOneThread);
+    CPPUNIT_TEST(testManyThreads);
+    CPPUNIT_TEST(testLargeCalls);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    CallRecorderTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testOneThread();
+    void testManyThreads();
+    void testLargeCalls();
+};
+
+#endif
@@ -0,0 +1,106 @@
+// Measures CallTM::ToStr(), which totxt, trace_to_txt and the python bindings use
+// for every call they print, on a mix of calls typical for a frame. CPU only.
+
+#include "common/trace_model.hpp"
+#include "common/os_time.hpp"
+
+#include <GLES3/gl32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static ValueTM* floatValue(float v)
+{
+    ValueTM *value = new ValueTM;
+    value->mType = Float_Type;
+    value->mFloat = v;
+    return value;
+}
+
+static ValueTM* floatArrayValue(const std::vector<float>& v)
+{
+    ValueTM *value = new ValueTM;
+    value->mType = Array_Type;
+    value->mEleType = Float_Type;
+    value->mArrayLen = 0;
+    value->mArray = NULL;
+    value->ResizeArray(v.size());
+    for (unsigned i = 0; i < v.size(); i++)
+    {
+        value->mArray[i].mType = Float_Type;
+        value->mArray[i].mFloat = v[i];
+    }
+    return value;
+}
+
+static CallTM* makeCall(const char *name, std::vector<ValueTM*> args)
+{
+    CallTM *call = new CallTM(name);
+    const char *names[] = { "a", "b", "c", "d", "e", "f" };
+    for (unsigned i = 0; i < args.size(); i++)
+    {
+        args[i]->mName = names[i];
+        call->mArgs.push_back(args[i]);
+    }
+    return call;
+}
+
+static std::vector<std::unique_ptr<CallTM>> makeFrame()
+{
+    std::vector<std::unique_ptr<CallTM>> calls;
+    calls.emplace_back(makeCall("glClear", { CreateUInt32Value(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT) }));
+    for (int d = 0; d < 100; d++)
+    {
+        calls.emplace_back(makeCall("glBlendFuncSeparate", { CreateEnumValue(GL_SRC_ALPHA), CreateEnumValue(GL_ONE_MINUS_SRC_ALPHA), CreateEnumValue(GL_ONE), CreateEnumValue(GL_ZERO) }));
+        calls.emplace_back(makeCall("glEnable", { CreateEnumValue(GL_DEPTH_TEST) }));
+        calls.emplace_back(makeCall("glActiveTexture", { CreateEnumValue(GL_TEXTURE0 + d % 8) }));
+        calls.emplace_back(makeCall("glBindTexture", { CreateEnumValue(GL_TEXTURE_2D), CreateUInt32Value(d) }));
+        calls.emplace_back(makeCall("glTexParameteri", { CreateEnumValue(GL_TEXTURE_2D), CreateEnumValue(GL_TEXTURE_MIN_FILTER), CreateInt32Value(GL_LINEAR_MIPMAP_LINEAR) }));
+        calls.emplace_back(makeCall("glTexParameterf", { CreateEnumValue(GL_TEXTURE_2D), CreateEnumValue(GL_TEXTURE_MAX_LOD), floatValue(1000.0f) }));
+        calls.emplace_back(makeCall("glUseProgram", { CreateUInt32Value(d) }));
+        calls.emplace_back(makeCall("glUniform4f", { CreateInt32Value(d), floatValue(0.1f * d), floatValue(1.0f), floatValue(-2.5f), floatValue(0.0f) }));
+        calls.emplace_back(makeCall("glUniform4fv", { CreateInt32Value(d), CreateInt32Value(2), floatArrayValue({ 1.f, 2.5f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.125f }) }));
+        calls.emplace_back(makeCall("glBindBuffer", { CreateEnumValue(GL_ARRAY_BUFFER), CreateUInt32Value(d) }));
+        calls.emplace_back(makeCall("glVertexAttribPointer", { CreateUInt32Value(0), CreateInt32Value(3), CreateEnumValue(GL_FLOAT), CreateUInt8Value(0), CreateInt32Value(12), CreateBufferReferenceOpaqueValue(d * 16) }));
+        calls.emplace_back(makeCall("glDrawElements", { CreateEnumValue(GL_TRIANGLES), CreateInt32Value(36), CreateEnumValue(GL_UNSIGNED_SHORT), CreateBufferReferenceOpaqueValue(0) }));
+    }
+    calls.emplace_back(makeCall("eglSwapBuffers", { CreateInt32Value(1), CreateInt32Value(1) }));
+    return calls;
+}
+
+int main(int argc, char **argv)
+{
+    const int repeats = (argc > 1) ? atoi(argv[1]) : 200;
+    const std::vector<std::unique_ptr<CallTM>> calls = makeFrame();
+    size_t chars = 0;
+
+    long long begin = os::getTime();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (const auto& call : calls)
+        {
+            chars += call->ToStr(false).size();
+        }
+    }
+    double seconds = (double)(os::getTime() - begin) / os::timeFrequency;
+    const double count = (double)calls.size() * repeats;
+    printf("ToStr() returning strings: %7.1f ns/call (%.1f chars/call)\n", seconds * 1e9 / count, (double)chars / count);
+
+    std::string line;
+    begin = os::getTime();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (const auto& call : calls)
+        {
+            line.clear();
+            call->ToStr(line, false);
+        }
+    }
+    seconds = (double)(os::getTime() - begin) / os::timeFrequency;
+    printf("ToStr() into one buffer:   %7.1f ns/call\n", seconds * 1e9 / count);
+    return 0;
+}
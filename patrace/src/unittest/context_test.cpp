@@ -2,15 +2,18 @@
 #include <GLES/gl.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <GLES3/gl3.h>
 
 #include "context_test.hpp"
 #include "eglstate/context.hpp"
+#include "common/trace_model.hpp"
 //#include "eglstate/fbo.hpp"
 //#include "eglstate/render_target.hpp"
 //#include "eglstate/frame.hpp"
 //#include "eglstate/vbo.hpp"
 
 using namespace pat;
+using namespace common;
 
 ContextTest::ContextTest()
 {
@@ -50,6 +53,85 @@ void ContextTest::testEnumString()
 
     CPPUNIT_ASSERT(EnumString(GL_TEXTURE_COORD_ARRAY));
     CPPUNIT_ASSERT(strcmp(EnumString(GL_TEXTURE_COORD_ARRAY), "GL_TEXTURE_COORD_ARRAY") == 0);
+
+    // Function flags worked out up front give the same names as the function name
+    const unsigned int blendFlags = EnumFunctionFlags("glBlendFuncSeparate");
+    CPPUNIT_ASSERT_EQUAL((unsigned int)ENUM_FUNCTION_BLEND, blendFlags);
+    CPPUNIT_ASSERT(strcmp(EnumString(GL_ONE, blendFlags), "GL_ONE") == 0);
+    CPPUNIT_ASSERT(strcmp(EnumString(GL_ZERO, blendFlags), "GL_ZERO") == 0);
+    CPPUNIT_ASSERT(strcmp(EnumString(GL_POINTS, EnumFunctionFlags("glDrawElements")), "GL_POINTS") == 0);
+    CPPUNIT_ASSERT(strcmp(EnumString(GL_NONE, EnumFunctionFlags("glTexParameteri")), "GL_NONE") == 0);
+    CPPUNIT_ASSERT(strcmp(EnumString(GL_INVALID_ENUM, EnumFunctionFlags("glGetError")), "GL_NO_ERROR") == 0);
+    CPPUNIT_ASSERT(strcmp(EnumString(EGL_SUCCESS, EnumFunctionFlags("eglGetError")), "EGL_SUCCESS") == 0);
+    CPPUNIT_ASSERT(EnumString(0x12345678) == NULL);
+}
+
+static ValueTM* namedValue(const char *name, ValueTM *value)
+{
+    value->mName = name;
+    return value;
+}
+
+static ValueTM* floatValue(const char *name, float f)
+{
+    ValueTM *value = new ValueTM;
+    value->mType = Float_Type;
+    value->mFloat = f;
+    return namedValue(name, value);
+}
+
+static std::string callString(const char *name, const std::vector<ValueTM*>& args, bool isAbbreviate = false)
+{
+    CallTM call(name);
+    call.mArgs = args;
+    const std::string str = call.ToStr(isAbbreviate);
+    // Printing a call again gives the same text
+    CPPUNIT_ASSERT_EQUAL(str, call.ToStr(isAbbreviate));
+    return str;
+}
+
+// The expected strings are what CallTM::ToStr() printed before it formatted into a buffer
+void ContextTest::testCallToStr()
+{
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glClear(mask=0x4500=(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT))"),
+        callString("glClear", { namedValue("mask", CreateUInt32Value(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT)) }));
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glClear(mask=0x101=(GL_DEPTH_BUFFER_BIT | 0x1))"),
+        callString("glClear", { namedValue("mask", CreateUInt32Value(GL_DEPTH_BUFFER_BIT | 0x1)) }));
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glClear(mask=0x4500=(GL_COLOR_BUFFER_BIT...)"),
+        callString("glClear", { namedValue("mask", CreateUInt32Value(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT)) }, true));
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glClear(mask=0x0=())"),
+        callString("glClear", { namedValue("mask", CreateUInt32Value(0)) }));
+
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glUniform4f(location=3, v0=0.1, v1=1, v2=-2.5, v3=1e-10)"),
+        callString("glUniform4f", { namedValue("location", CreateInt32Value(3)), floatValue("v0", 0.1f), floatValue("v1", 1.0f), floatValue("v2", -2.5f), floatValue("v3", 1e-10f) }));
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glClearColor(red=0, green=1.23457e+08, blue=0.333333, alpha=1)"),
+        callString("glClearColor", { floatValue("red", 0.0f), floatValue("green", 123456789.0f), floatValue("blue", 0.333333f), floatValue("alpha", 1.0f) }));
+
+    ValueTM *length = new ValueTM;
+    length->mType = Unused_Pointer_Type;
+    length->mUnusedPointer = NULL;
+    ValueTM *binary = new ValueTM;
+    binary->mType = Unused_Pointer_Type;
+    binary->mUnusedPointer = (void*)0x1234;
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glGetProgramBinary(program=7, bufSize=0, length=0, binaryFormat=0x0, binary=0x1234)"),
+        callString("glGetProgramBinary", { namedValue("program", CreateUInt32Value(7)), namedValue("bufSize", CreateInt32Value(0)), namedValue("length", length), namedValue("binaryFormat", CreateEnumValue(GL_NONE)), namedValue("binary", binary) }));
+
+    // A value of more than 64 characters
+    ValueTM *pointer = new ValueTM;
+    pointer->mType = Opaque_Type;
+    pointer->mOpaqueType = ClientSideBufferObjectReferenceType;
+    pointer->mOpaqueIns = new ValueTM;
+    pointer->mOpaqueIns->mClientSideBufferName = 4294967295u;
+    pointer->mOpaqueIns->mClientSideBufferOffset = 4294967295u;
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glVertexAttribPointer(index=0, size=3, type=GL_FLOAT, normalized=0, stride=12, pointer=common::ClientSideBufferObjectReferenceType(4294967295, 4294967295))"),
+        callString("glVertexAttribPointer", { namedValue("index", CreateUInt32Value(0)), namedValue("size", CreateInt32Value(3)), namedValue("type", CreateEnumValue(GL_FLOAT)), namedValue("normalized", CreateUInt8Value(0)), namedValue("stride", CreateInt32Value(12)), namedValue("pointer", pointer) }));
+
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glTexParameteri(target=GL_TEXTURE_2D, pname=GL_TEXTURE_MIN_FILTER, param=GL_LINEAR_MIPMAP_LINEAR)"),
+        callString("glTexParameteri", { namedValue("target", CreateEnumValue(GL_TEXTURE_2D)), namedValue("pname", CreateEnumValue(GL_TEXTURE_MIN_FILTER)), namedValue("param", CreateInt32Value(GL_LINEAR_MIPMAP_LINEAR)) }));
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glTexParameteri(target=GL_TEXTURE_2D, pname=GL_TEXTURE_MAX_LEVEL, param=4)"),
+        callString("glTexParameteri", { namedValue("target", CreateEnumValue(GL_TEXTURE_2D)), namedValue("pname", CreateEnumValue(GL_TEXTURE_MAX_LEVEL)), namedValue("param", CreateInt32Value(4)) }));
+    CPPUNIT_ASSERT_EQUAL(std::string("ret=void glTexParameterf(target=GL_TEXTURE_2D, pname=GL_TEXTURE_MAG_FILTER, param=GL_LINEAR)"),
+        callString("glTexParameterf", { namedValue("target", CreateEnumValue(GL_TEXTURE_2D)), namedValue("pname", CreateEnumValue(GL_TEXTURE_MAG_FILTER)), floatValue("param", GL_LINEAR) }));
 }
 
 void ContextTest::testShader()
@@ -11,6 +11,7 @@ class ContextTest : public CPPUNIT_NS::TestFixture
     //CPPUNIT_TEST(testVBO);
 
     CPPUNIT_TEST(testEnumString);
+    CPPUNIT_TEST(testCallToStr);
     CPPUNIT_TEST(testInitialState);
     CPPUNIT_TEST(testShader);
     CPPUNIT_TEST(testTexturObject);
@@ -25,6 +26,7 @@ public:
     virtual void tearDown();
 
     void testEnumString();
+    void testCallToStr();
     void testInitialState();
     void testShader();
     void testTexturObject();
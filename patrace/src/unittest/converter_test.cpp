@@ -0,0 +1,147 @@
+#include "converter_test.hpp"
+#include "tool/trace_converter.hpp"
+#include "common/file_format.hpp"
+#include "common/parse_api.hpp"
+#include "synthetic_trace.hpp"
+
+#include <GLES3/gl3.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static const char *INPUT_NAME = "converter_test.pat";
+static const char *RAW_NAME = "converter_test_raw.pat";
+static const char *DECODE_NAME = "converter_test_decode.pat";
+
+// A call of the input, and whether converting removes it
+struct ConverterCall : TestCall
+{
+    ConverterCall(const char *callName, const std::vector<uint32_t>& callArgs, bool removed)
+     : removed(removed)
+    {
+        name = callName;
+        args = callArgs;
+    }
+
+    bool removed; // by removing unused shaders and glGetError
+};
+
+// Contexts A, B sharing with A, C sharing with B, and D on its own, with shaders created,
+// compiled and deleted in them, some of which are attached to a program
+static std::vector<ConverterCall> syntheticCalls()
+{
+    std::vector<ConverterCall> calls;
+    calls.push_back({ "eglCreateContext", { 1, 1, 0, 0, 10 }, false });
+    calls.push_back({ "eglCreateContext", { 1, 1, 10, 0, 11 }, false });
+    calls.push_back({ "eglCreateContext", { 1, 1, 11, 0, 12 }, false });
+    calls.push_back({ "eglCreateContext", { 1, 1, 0, 0, 13 }, false });
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 10, 1 }, false });
+    calls.push_back({ "glCreateShader", { GL_VERTEX_SHADER, 1 }, true });
+    calls.push_back({ "glCompileShader", { 1 }, true });
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 12, 1 }, false });
+    calls.push_back({ "glCreateProgram", { 20 }, false });
+    calls.push_back({ "glCreateShader", { GL_VERTEX_SHADER, 2 }, false }); // second shader of the share group
+    calls.push_back({ "glCompileShader", { 2 }, false });
+    calls.push_back({ "glCreateShader", { GL_FRAGMENT_SHADER, 3 }, true });
+    calls.push_back({ "glCompileShader", { 3 }, true });
+    calls.push_back({ "glDeleteShader", { 3 }, true });
+    calls.push_back({ "glCreateShader", { GL_FRAGMENT_SHADER, 3 }, false }); // same name, another shader
+    calls.push_back({ "glCompileShader", { 3 }, false });
+    calls.push_back({ "glAttachShader", { 20, 2 }, false });
+    calls.push_back({ "glAttachShader", { 20, 3 }, false });
+    calls.push_back({ "glGetError", { 0 }, true });
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 13, 1 }, false });
+    calls.push_back({ "glCreateShader", { GL_VERTEX_SHADER, 2 }, true }); // first shader of its share group
+    calls.push_back({ "glCompileShader", { 2 }, true });
+    calls.push_back({ "glDeleteShader", { 2 }, true });
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 12, 1 }, false });
+    calls.push_back({ "glDeleteShader", { 2 }, false });
+    calls.push_back({ "glDeleteShader", { 3 }, false });
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 10, 1 }, false });
+    calls.push_back({ "glDeleteShader", { 1 }, true });
+    return calls;
+}
+
+static void writeTrace(const std::vector<ConverterCall>& calls)
+{
+    SyntheticTraceWriter out;
+    CPPUNIT_ASSERT(out.open(INPUT_NAME));
+    for (const ConverterCall& c : calls)
+    {
+        CPPUNIT_ASSERT(out.write(c));
+    }
+    out.close(0);
+}
+
+static std::vector<TestCall> expectedCalls(const std::vector<ConverterCall>& calls)
+{
+    std::vector<TestCall> expected;
+    for (const ConverterCall& c : calls)
+    {
+        if (!c.removed) expected.push_back(c);
+    }
+    return expected;
+}
+
+static std::vector<TestCall> convert(const char *output, bool decode, ConvertResult& result)
+{
+    ConvertOptions options;
+    options.removeUnusedShaders = true;
+    options.removeErrors = true;
+    options.decode = decode;
+    CPPUNIT_ASSERT(convertTrace(INPUT_NAME, output, options, &result));
+    std::vector<TestCall> calls;
+    CPPUNIT_ASSERT(readSyntheticTrace(output, calls));
+    return calls;
+}
+
+ConverterTest::ConverterTest()
+{
+}
+
+void ConverterTest::setUp()
+{
+    gApiInfo.RegisterEntries(parse_callbacks);
+}
+
+void ConverterTest::tearDown()
+{
+    unlink(INPUT_NAME);
+    unlink(RAW_NAME);
+    unlink(DECODE_NAME);
+}
+
+// Converting the raw calls finds the same shaders as converting through ParseInterface
+void ConverterTest::testRemoveUnusedShaders()
+{
+    const std::vector<ConverterCall> calls = syntheticCalls();
+    writeTrace(calls);
+    ConvertResult raw;
+    const std::vector<TestCall> rawOutput = convert(RAW_NAME, false, raw);
+    ConvertResult decode;
+    const std::vector<TestCall> decodeOutput = convert(DECODE_NAME, true, decode);
+
+    const std::vector<TestCall> expected = expectedCalls(calls);
+    CPPUNIT_ASSERT(raw.raw);
+    CPPUNIT_ASSERT(!decode.raw);
+    CPPUNIT_ASSERT(rawOutput == decodeOutput);
+    CPPUNIT_ASSERT(rawOutput == expected);
+    CPPUNIT_ASSERT(raw.changed == (int)(calls.size() - expected.size()));
+    CPPUNIT_ASSERT(decode.changed == raw.changed);
+}
+
+// Traces older than HEADER_VERSION_4 are converted through ParseInterface
+void ConverterTest::testOldFormat()
+{
+    const std::vector<ConverterCall> calls = syntheticCalls();
+    writeTrace(calls);
+    CPPUNIT_ASSERT(setSyntheticTraceVersion(INPUT_NAME, HEADER_VERSION_3));
+    ConvertResult result;
+    const std::vector<TestCall> output = convert(RAW_NAME, false, result);
+
+    const std::vector<TestCall> expected = expectedCalls(calls);
+    CPPUNIT_ASSERT(!result.raw);
+    CPPUNIT_ASSERT(output == expected);
+}
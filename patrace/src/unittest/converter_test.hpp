@@ -0,0 +1,25 @@
+#ifndef _INCLUDE_CONVERTER_TEST_
+#define _INCLUDE_CONVERTER_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ConverterTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(ConverterTest);
+
+    CPPUNIT_TEST(testRemoveUnusedShaders);
+    CPPUNIT_TEST(testOldFormat);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    ConverterTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testRemoveUnusedShaders();
+    void testOldFormat();
+};
+
+#endif
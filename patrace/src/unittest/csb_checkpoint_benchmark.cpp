@@ -0,0 +1,62 @@
+// Measures how long the retracer's client-side buffer checkpoint and restore take for
+// looped replay (see Retracer::SaveBuffersMaps and Retracer::LoadBuffersMaps).
+// CPU only, no GL context is needed.
+
+#include "common/memory.hpp"
+#include "common/os_time.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace common;
+
+static double msec(long long begin, long long end)
+{
+    return (double)(end - begin) * 1000.0 / os::timeFrequency;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned objects = (argc > 1) ? atoi(argv[1]) : 4096;
+    const unsigned object_size = (argc > 2) ? atoi(argv[2]) : 64 * 1024;
+    const unsigned modified_per_loop = (argc > 3) ? atoi(argv[3]) : 16;
+    const int loops = 10;
+
+    std::vector<char> data(object_size, 0x5a);
+    ClientSideBufferObjectSet live;
+    for (unsigned name = 1; name <= objects; ++name)
+    {
+        live.object_data(0, name, object_size, data.data(), true);
+    }
+    printf("%u objects of %u bytes (%.1f MB), %u modified per loop\n", objects, object_size,
+           (double)live.total_size() / (1024.0 * 1024.0), modified_per_loop);
+
+    ClientSideBufferObjectSet checkpoint;
+    long long begin = os::getTime();
+    checkpoint = live;
+    long long end = os::getTime();
+    printf("checkpoint: %.3f ms\n", msec(begin, end));
+
+    double modify_total = 0.0;
+    double restore_total = 0.0;
+    for (int loop = 0; loop < loops; ++loop)
+    {
+        begin = os::getTime();
+        for (unsigned i = 0; i < modified_per_loop && i < objects; ++i)
+        {
+            live.object_subdata(0, 1 + (i * 7919) % objects, 0, 4, "loop");
+        }
+        end = os::getTime();
+        modify_total += msec(begin, end);
+
+        begin = os::getTime();
+        live.clear();
+        live = checkpoint;
+        end = os::getTime();
+        restore_total += msec(begin, end);
+    }
+    printf("modify (copy-on-write): %.3f ms per loop\n", modify_total / loops);
+    printf("restore: %.3f ms per loop\n", restore_total / loops);
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include "deduplication_test.hpp"
+#include "tool/deduplication.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/out_file.hpp"
+#include "common/parse_api.hpp"
+#include "synthetic_trace.hpp"
+#include "json/writer.h"
+
+#include <GLES3/gl3.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static const char *INPUT_NAME = "deduplication_test.pat";
+static const char *OUTPUT_NAME = "deduplication_test_out.pat";
+
+// A call of the input, and whether deduplicating removes it
+struct DedupCall : TestCall
+{
+    DedupCall(const char *callName, const std::vector<uint32_t>& callArgs, bool duplicate)
+     : duplicate(duplicate)
+    {
+        name = callName;
+        args = callArgs;
+    }
+
+    bool duplicate; // removed with all DEDUP_* flags set
+};
+
+static uint32_t floatBits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// Two contexts made current on one thread, state set twice in a row, and a texture
+// upload whose encoding differs between HEADER_VERSION_3 and HEADER_VERSION_4
+static std::vector<DedupCall> syntheticCalls(bool oldFormat)
+{
+    std::vector<DedupCall> calls;
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 3, 1 }, false });
+    calls.push_back({ "glUseProgram", { 5 }, false });
+    calls.push_back({ "glUseProgram", { 5 }, true });
+    calls.push_back({ "glBindBuffer", { GL_ARRAY_BUFFER, 7 }, false });
+    calls.push_back({ "glBindBuffer", { GL_ARRAY_BUFFER, 7 }, true });
+    calls.push_back({ "glBindBuffer", { GL_ELEMENT_ARRAY_BUFFER, 7 }, false });
+    calls.push_back({ "glEnable", { GL_BLEND }, false });
+    calls.push_back({ "glEnable", { GL_BLEND }, true });
+    calls.push_back({ "glDisable", { GL_BLEND }, false });
+    calls.push_back({ "glDisable", { GL_BLEND }, true });
+    calls.push_back({ "glScissor", { 0, 0, 64, 64 }, false });
+    calls.push_back({ "glScissor", { 0, 0, 64, 64 }, true });
+    calls.push_back({ "glScissor", { 0, 0, 32, 64 }, false });
+    calls.push_back({ "glActiveTexture", { GL_TEXTURE0 }, false });
+    calls.push_back({ "glBindTexture", { GL_TEXTURE_2D, 9 }, false });
+    calls.push_back({ "glBindTexture", { GL_TEXTURE_2D, 9 }, true });
+    if (oldFormat) calls.push_back({ "glTexImage2D", { GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, 4, 0xff336699 }, false });
+    else calls.push_back({ "glTexImage2D", { GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, BlobType, 4, 0xff336699 }, false });
+    calls.push_back({ "glActiveTexture", { GL_TEXTURE1 }, false });
+    calls.push_back({ "glBindTexture", { GL_TEXTURE_2D, 9 }, false });
+    calls.push_back({ "glUniform1f", { 0, floatBits(1.0f) }, false });
+    calls.push_back({ "glUniform1f", { 0, floatBits(1.0f) }, true });
+    calls.push_back({ "glUniform1f", { 0, floatBits(2.0f) }, false });
+    calls.push_back({ "glDrawArrays", { GL_TRIANGLES, 0, 3 }, false });
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 3, 1 }, true });
+    calls.push_back({ "eglMakeCurrent", { 1, 2, 2, 4, 1 }, false });
+    calls.push_back({ "glUseProgram", { 5 }, false });
+    calls.push_back({ "glEnable", { GL_BLEND }, false });
+    calls.push_back({ "glDrawArrays", { GL_TRIANGLES, 0, 3 }, false });
+    calls.push_back({ "eglSwapBuffers", { 1, 2, 1 }, false });
+    return calls;
+}
+
+static void writeTrace(const std::vector<DedupCall>& calls, bool oldFormat)
+{
+    SyntheticTraceWriter out;
+    CPPUNIT_ASSERT(out.open(INPUT_NAME));
+    for (const DedupCall& c : calls)
+    {
+        CPPUNIT_ASSERT(out.write(c));
+    }
+    out.close(1);
+
+    if (oldFormat)
+    {
+        // The calls that differ in the old format are written as such above
+        CPPUNIT_ASSERT(setSyntheticTraceVersion(INPUT_NAME, HEADER_VERSION_3));
+    }
+}
+
+static std::vector<TestCall> expectedCalls(const std::vector<DedupCall>& calls)
+{
+    std::vector<TestCall> expected;
+    for (const DedupCall& c : calls)
+    {
+        if (!c.duplicate) expected.push_back(c);
+    }
+    return expected;
+}
+
+// Deduplicates the input into the output as the deduplicator does, and returns the calls of the output
+static std::vector<TestCall> deduplicateTrace(const DedupOptions& options, DedupResult& result)
+{
+    InFile input;
+    CPPUNIT_ASSERT(input.Open(INPUT_NAME));
+    OutFile output;
+    CPPUNIT_ASSERT(output.Open(OUTPUT_NAME, true, &input.getFuncNames()));
+    Json::FastWriter writer;
+    const std::string header = writer.write(input.getJSONHeader());
+    output.WriteHeader(header.c_str(), header.size(), false);
+    deduplicate(input, output, options, &result);
+    input.Close();
+    output.Close();
+    std::vector<TestCall> calls;
+    CPPUNIT_ASSERT(readSyntheticTrace(OUTPUT_NAME, calls));
+    return calls;
+}
+
+DeduplicationTest::DeduplicationTest()
+{
+}
+
+void DeduplicationTest::setUp()
+{
+    gApiInfo.RegisterEntries(parse_callbacks);
+}
+
+void DeduplicationTest::tearDown()
+{
+    unlink(INPUT_NAME);
+    unlink(OUTPUT_NAME);
+}
+
+void DeduplicationTest::testRemove()
+{
+    const std::vector<DedupCall> calls = syntheticCalls(false);
+    writeTrace(calls, false);
+    DedupOptions options;
+    options.flags = INT32_MAX;
+    options.log = fopen("/dev/null", "w");
+    DedupResult result;
+    const std::vector<TestCall> output = deduplicateTrace(options, result);
+    fclose(options.log);
+
+    const std::vector<TestCall> expected = expectedCalls(calls);
+    CPPUNIT_ASSERT(output == expected);
+    CPPUNIT_ASSERT(result.written == (int)expected.size());
+    CPPUNIT_ASSERT(result.removed == (int)(calls.size() - expected.size()));
+}
+
+void DeduplicationTest::testReplace()
+{
+    const std::vector<DedupCall> calls = syntheticCalls(false);
+    writeTrace(calls, false);
+    DedupOptions options;
+    options.flags = INT32_MAX;
+    options.replace = true;
+    options.log = fopen("/dev/null", "w");
+    DedupResult result;
+    const std::vector<TestCall> output = deduplicateTrace(options, result);
+    fclose(options.log);
+
+    std::vector<TestCall> expected(calls.begin(), calls.end());
+    for (size_t i = 0; i < calls.size(); ++i)
+    {
+        if (!calls[i].duplicate) continue;
+        expected[i].name = "glEnable";
+        expected[i].args = { GL_INVALID_INDEX };
+        expected[i].injected = true;
+    }
+    CPPUNIT_ASSERT(output == expected);
+    CPPUNIT_ASSERT(result.written == (int)calls.size());
+}
+
+// Only the kinds of calls asked for are removed
+void DeduplicationTest::testNothingToDo()
+{
+    const std::vector<DedupCall> calls = syntheticCalls(false);
+    writeTrace(calls, false);
+    DedupOptions options;
+    options.flags = DEDUP_DEPTHFUNC | DEDUP_VERTEXATTRIB;
+    options.log = fopen("/dev/null", "w");
+    DedupResult result;
+    const std::vector<TestCall> output = deduplicateTrace(options, result);
+    fclose(options.log);
+
+    CPPUNIT_ASSERT(output == std::vector<TestCall>(calls.begin(), calls.end()));
+    CPPUNIT_ASSERT(result.removed == 0);
+}
+
+// Calls of traces older than HEADER_VERSION_4 are re-encoded, not copied
+void DeduplicationTest::testOldFormat()
+{
+    writeTrace(syntheticCalls(true), true);
+    DedupOptions options;
+    options.flags = INT32_MAX;
+    options.log = fopen("/dev/null", "w");
+    DedupResult result;
+    const std::vector<TestCall> output = deduplicateTrace(options, result);
+    fclose(options.log);
+
+    const std::vector<TestCall> expected = expectedCalls(syntheticCalls(false));
+    CPPUNIT_ASSERT(output == expected);
+}
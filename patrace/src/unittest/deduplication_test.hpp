@@ -0,0 +1,29 @@
+#ifndef _INCLUDE_DEDUPLICATION_TEST_
+#define _INCLUDE_DEDUPLICATION_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class DeduplicationTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(DeduplicationTest);
+
+    CPPUNIT_TEST(testRemove);
+    CPPUNIT_TEST(testReplace);
+    CPPUNIT_TEST(testNothingToDo);
+    CPPUNIT_TEST(testOldFormat);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    DeduplicationTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testRemove();
+    void testReplace();
+    void testNothingToDo();
+    void testOldFormat();
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "dirty_pages_test.hpp"
+#include "tracer/dirty_pages.hpp"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Plain anonymous memory standing in for a mapped GL buffer
+struct FakeMapping
+{
+    FakeMapping(size_t pages) : size(pages * sysconf(_SC_PAGESIZE))
+    {
+        data = (unsigned char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        CPPUNIT_ASSERT(data != MAP_FAILED);
+    }
+    ~FakeMapping()
+    {
+        munmap(data, size);
+    }
+    size_t size;
+    unsigned char *data;
+};
+
+static const size_t PAGE = sysconf(_SC_PAGESIZE);
+
+static bool sameRanges(const std::vector<DirtyRange>& ranges, const std::vector<DirtyRange>& expected)
+{
+    if (ranges.size() != expected.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (ranges[i].offset != expected[i].offset || ranges[i].length != expected[i].length)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void checkWrites(DirtyPagesMode mode)
+{
+    FakeMapping buffer(16);
+    const int handle = dirtyPagesTrack(mode, buffer.data, buffer.size);
+    CPPUNIT_ASSERT(handle >= 0);
+    CPPUNIT_ASSERT(dirtyPagesCollect(handle).empty());
+
+    // Reading is free
+    unsigned sum = 0;
+    for (size_t i = 0; i < buffer.size; i += 64)
+    {
+        sum += buffer.data[i];
+    }
+    CPPUNIT_ASSERT(sum == 0);
+    CPPUNIT_ASSERT(dirtyPagesCollect(handle).empty());
+
+    // Neighbouring pages are merged
+    buffer.data[1 * PAGE] = 1;
+    buffer.data[2 * PAGE + 100] = 2;
+    buffer.data[3 * PAGE - 1] = 3;
+    buffer.data[7 * PAGE + 5] = 4;
+    buffer.data[15 * PAGE + PAGE - 1] = 5;
+    CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(handle), { { 1 * PAGE, 2 * PAGE }, { 7 * PAGE, PAGE }, { 15 * PAGE, PAGE } }));
+
+    // Collecting starts over
+    CPPUNIT_ASSERT(dirtyPagesCollect(handle).empty());
+    buffer.data[2 * PAGE] = 6;
+    buffer.data[2 * PAGE + 1] = 7;
+    CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(handle), { { 2 * PAGE, PAGE } }));
+    CPPUNIT_ASSERT(buffer.data[2 * PAGE] == 6 && buffer.data[2 * PAGE + 1] == 7 && buffer.data[7 * PAGE + 5] == 4);
+
+    memset(buffer.data, 0xab, buffer.size);
+    CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(handle), { { 0, buffer.size } }));
+
+    dirtyPagesUntrack(handle);
+    CPPUNIT_ASSERT(dirtyPagesCollect(handle).empty());
+    memset(buffer.data, 0, buffer.size);
+}
+
+DirtyPagesTest::DirtyPagesTest()
+{
+}
+
+void DirtyPagesTest::setUp()
+{
+}
+
+void DirtyPagesTest::tearDown()
+{
+}
+
+void DirtyPagesTest::testMprotect()
+{
+    CPPUNIT_ASSERT(dirtyPagesSupported(DIRTY_PAGES_MPROTECT));
+    checkWrites(DIRTY_PAGES_MPROTECT);
+
+    // Too large, or nothing to track
+    FakeMapping buffer(1);
+    CPPUNIT_ASSERT(dirtyPagesTrack(DIRTY_PAGES_MPROTECT, buffer.data, (DIRTY_PAGES_MAX_REGION_PAGES + 1) * PAGE) == -1);
+    CPPUNIT_ASSERT(dirtyPagesTrack(DIRTY_PAGES_MPROTECT, buffer.data, 0) == -1);
+    CPPUNIT_ASSERT(dirtyPagesTrack(DIRTY_PAGES_NONE, buffer.data, PAGE) == -1);
+
+    // All slots in use
+    std::vector<int> handles;
+    for (unsigned i = 0; i < DIRTY_PAGES_MAX_REGIONS; ++i)
+    {
+        handles.push_back(dirtyPagesTrack(DIRTY_PAGES_MPROTECT, buffer.data + i, 1));
+        CPPUNIT_ASSERT(handles.back() >= 0);
+    }
+    CPPUNIT_ASSERT(dirtyPagesTrack(DIRTY_PAGES_MPROTECT, buffer.data, 1) == -1);
+    buffer.data[10] = 1;
+    for (unsigned i = 0; i < DIRTY_PAGES_MAX_REGIONS; ++i)
+    {
+        CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(handles[i]), { { 0, 1 } }));
+        dirtyPagesUntrack(handles[i]);
+    }
+    buffer.data[10] = 2;
+}
+
+// Ranges are clipped to the region, and a page shared by two regions is reported for
+// both, even after one of them is no longer tracked
+void DirtyPagesTest::testUnalignedRegions()
+{
+    FakeMapping buffer(8);
+    const size_t split = 3 * PAGE + 50;
+    const int first = dirtyPagesTrack(DIRTY_PAGES_MPROTECT, buffer.data + 100, split - 100);
+    const int second = dirtyPagesTrack(DIRTY_PAGES_MPROTECT, buffer.data + split, 6 * PAGE - split);
+    CPPUNIT_ASSERT(first >= 0 && second >= 0);
+
+    buffer.data[3 * PAGE + 10] = 1;
+    CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(first), { { 3 * PAGE - 100, 50 } }));
+    CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(second), { { 0, PAGE - 50 } }));
+
+    buffer.data[0] = 2;
+    buffer.data[7 * PAGE] = 3;
+    buffer.data[150] = 4;
+    CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(first), { { 0, PAGE - 100 } }));
+    CPPUNIT_ASSERT(dirtyPagesCollect(second).empty());
+
+    dirtyPagesUntrack(first);
+    buffer.data[3 * PAGE + 60] = 5;
+    buffer.data[PAGE] = 6;
+    CPPUNIT_ASSERT(sameRanges(dirtyPagesCollect(second), { { 0, PAGE - 50 } }));
+    dirtyPagesUntrack(second);
+    buffer.data[3 * PAGE + 60] = 7;
+}
+
+// Writers on other threads while the region is collected and copied, like the tracer
+// does before each draw call: the copy must end up identical
+void DirtyPagesTest::testThreads()
+{
+    const size_t pages = 256;
+    FakeMapping buffer(pages);
+    std::vector<unsigned char> copy(buffer.size, 0);
+    const int handle = dirtyPagesTrack(DIRTY_PAGES_MPROTECT, buffer.data, buffer.size);
+    CPPUNIT_ASSERT(handle >= 0);
+
+    auto update = [&]() {
+        for (const DirtyRange& range : dirtyPagesCollect(handle))
+        {
+            memcpy(copy.data() + range.offset, buffer.data + range.offset, range.length);
+        }
+    };
+
+    const unsigned threadCount = 4;
+    std::atomic<unsigned> running(threadCount);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            unsigned state = t + 1;
+            for (unsigned i = 0; i < 50000; ++i)
+            {
+                state = state * 1103515245 + 12345;
+                const size_t page = (state >> 8) % (pages / threadCount) * threadCount + t;
+                volatile unsigned char *p = buffer.data + page * PAGE + (state >> 24) * 16;
+                *p = *p + 1;
+            }
+            running--;
+        });
+    }
+    while (running > 0)
+    {
+        update();
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    update();
+    CPPUNIT_ASSERT(memcmp(copy.data(), buffer.data, buffer.size) == 0);
+    CPPUNIT_ASSERT(dirtyPagesCollect(handle).empty());
+    dirtyPagesUntrack(handle);
+}
+
+void DirtyPagesTest::testSoftDirty()
+{
+    if (!dirtyPagesSupported(DIRTY_PAGES_SOFTDIRTY))
+    {
+        printf("Soft-dirty bits not supported by this kernel, skipping\n");
+        return;
+    }
+    checkWrites(DIRTY_PAGES_SOFTDIRTY);
+}
@@ -0,0 +1,29 @@
+#ifndef _INCLUDE_DIRTY_PAGES_TEST_
+#define _INCLUDE_DIRTY_PAGES_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class DirtyPagesTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(DirtyPagesTest);
+
+    CPPUNIT_TEST(testMprotect);
+    CPPUNIT_TEST(testUnalignedRegions);
+    CPPUNIT_TEST(testThreads);
+    CPPUNIT_TEST(testSoftDirty);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    DirtyPagesTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testMprotect();
+    void testUnalignedRegions();
+    void testThreads();
+    void testSoftDirty();
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "fill_scan_test.hpp"
+#include "fastforwarder/fill_scan.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace RetraceAndTrim;
+
+typedef std::vector<unsigned char> Bytes;
+
+static Bytes randomBytes(size_t size)
+{
+    Bytes b(size);
+    for (unsigned char &c : b)
+    {
+        c = rand() & 0xff;
+    }
+    return b;
+}
+
+// Fills [offset, offset + size) with the pattern repeated, the last copy cut short
+static void fill(Bytes& b, size_t offset, size_t size, const Bytes& pattern)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        b[offset + i] = pattern[i % pattern.size()];
+    }
+}
+
+FillScanTest::FillScanTest()
+{
+}
+
+void FillScanTest::setUp()
+{
+    srand(1234);
+}
+
+void FillScanTest::tearDown()
+{
+}
+
+void FillScanTest::testMatchLength()
+{
+    // Every mismatch position, at every alignment, around the block sizes of the kernels
+    const Bytes a = randomBytes(300);
+    for (size_t offset = 0; offset < 16; ++offset)
+    {
+        for (size_t size = 0; size < 200; ++size)
+        {
+            for (size_t mismatch = 0; mismatch <= size; ++mismatch)
+            {
+                Bytes b(a);
+                if (mismatch < size)
+                {
+                    b[offset + mismatch] ^= 1 << (mismatch % 8);
+                }
+                const size_t scalar = matchLength(a.data() + offset, b.data() + offset, size, FILL_SCAN_SCALAR);
+                const size_t simd = matchLength(a.data() + offset, b.data() + offset, size, FILL_SCAN_SIMD);
+                CPPUNIT_ASSERT(scalar == mismatch);
+                CPPUNIT_ASSERT(simd == mismatch);
+            }
+        }
+    }
+
+    // Overlapping ranges, as used to check for repetitions
+    Bytes zeros(5000, 0);
+    CPPUNIT_ASSERT(matchLength(zeros.data() + 4, zeros.data(), zeros.size() - 4) == zeros.size() - 4);
+    zeros[4321] = 7;
+    CPPUNIT_ASSERT(matchLength(zeros.data() + 4, zeros.data(), zeros.size() - 4) == 4321 - 4);
+}
+
+void FillScanTest::testIsRepeating()
+{
+    // Texel sizes of the common formats, including RGB ones that do not divide 16
+    for (size_t period : { 1, 2, 3, 4, 6, 8, 12, 16 })
+    {
+        const Bytes texel = randomBytes(period);
+        for (size_t size : { (size_t)1, period, period * 5 + 1, (size_t)1024, (size_t)4096 * 3 })
+        {
+            Bytes row(size);
+            fill(row, 0, size, texel);
+            CPPUNIT_ASSERT(isRepeating(row.data(), size, period, FILL_SCAN_SCALAR));
+            CPPUNIT_ASSERT(isRepeating(row.data(), size, period, FILL_SCAN_SIMD));
+
+            // One different byte anywhere after the first texel breaks it
+            for (size_t pos : { period, size / 2, size - 1 })
+            {
+                if (pos < period || pos >= size)
+                {
+                    continue;
+                }
+                Bytes dirty(row);
+                dirty[pos] ^= 0x80;
+                CPPUNIT_ASSERT(!isRepeating(dirty.data(), size, period, FILL_SCAN_SCALAR));
+                CPPUNIT_ASSERT(!isRepeating(dirty.data(), size, period, FILL_SCAN_SIMD));
+            }
+        }
+    }
+}
+
+void FillScanTest::testFindFillRuns()
+{
+    const size_t minSize = 4096;
+    struct Expected
+    {
+        size_t offset;
+        size_t size;
+        Bytes pattern;
+    };
+    // Mostly empty buffer: random data around zeros, a repeated vec4, repeated bytes and a run too short to count
+    Bytes data = randomBytes(200000);
+    const std::vector<Expected> expected = {
+        { 0, 10000, Bytes(1, 0) },
+        { 10003, 50000, randomBytes(16) },
+        { 70001, 4100, Bytes(1, 0xff) },
+        { 80000, 100000, Bytes(4, 0) },
+        { 190000, 10000, randomBytes(8) },
+    };
+    for (const Expected& e : expected)
+    {
+        fill(data, e.offset, e.size, e.pattern);
+    }
+    fill(data, 185000, minSize - 100, Bytes(1, 0));
+
+    const std::vector<FillRun> scalar = findFillRuns(data.data(), data.size(), 16, minSize, FILL_SCAN_SCALAR);
+    const std::vector<FillRun> simd = findFillRuns(data.data(), data.size(), 16, minSize, FILL_SCAN_SIMD);
+    CPPUNIT_ASSERT(scalar.size() == expected.size());
+    CPPUNIT_ASSERT(simd.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        CPPUNIT_ASSERT(simd[i].offset == scalar[i].offset && simd[i].size == scalar[i].size);
+        // Runs are found at most 15 bytes late, and may take in a few random bytes that happen to match
+        const FillRun& run = simd[i];
+        CPPUNIT_ASSERT(run.offset >= expected[i].offset && run.offset < expected[i].offset + 16);
+        CPPUNIT_ASSERT(run.offset + run.size >= expected[i].offset + expected[i].size);
+        CPPUNIT_ASSERT(run.offset + run.size < expected[i].offset + expected[i].size + 16);
+        CPPUNIT_ASSERT(isRepeating(data.data() + run.offset, run.size, 16, FILL_SCAN_SCALAR));
+        if (i > 0)
+        {
+            CPPUNIT_ASSERT(simd[i - 1].offset + simd[i - 1].size <= run.offset);
+        }
+    }
+
+    // Nothing in random data, everything in a buffer of zeros
+    const Bytes random = randomBytes(100000);
+    CPPUNIT_ASSERT(findFillRuns(random.data(), random.size(), 16, minSize).empty());
+    const Bytes zeros(100003, 0);
+    const std::vector<FillRun> all = findFillRuns(zeros.data(), zeros.size(), 16, minSize);
+    CPPUNIT_ASSERT(all.size() == 1 && all[0].offset == 0 && all[0].size == zeros.size());
+}
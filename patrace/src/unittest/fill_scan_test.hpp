@@ -0,0 +1,27 @@
+#ifndef _INCLUDE_FILL_SCAN_TEST_
+#define _INCLUDE_FILL_SCAN_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class FillScanTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(FillScanTest);
+
+    CPPUNIT_TEST(testMatchLength);
+    CPPUNIT_TEST(testIsRepeating);
+    CPPUNIT_TEST(testFindFillRuns);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    FillScanTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testMatchLength();
+    void testIsRepeating();
+    void testFindFillRuns();
+};
+
+#endif
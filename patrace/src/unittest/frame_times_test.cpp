@@ -0,0 +1,133 @@
+#include "frame_times_test.hpp"
+#include "common/frame_times.hpp"
+
+using namespace common;
+
+// Synthetic timestamps in microseconds
+static const int64_t frequency = 1000000;
+
+static void recordFrames(FrameTimes& times, const std::vector<int64_t>& frameTimes)
+{
+    int64_t now = 5000000;
+    times.begin(now);
+    for (const int64_t t : frameTimes)
+    {
+        now += t;
+        times.record(now);
+    }
+}
+
+FrameTimesTest::FrameTimesTest()
+{
+}
+
+void FrameTimesTest::setUp()
+{
+}
+
+void FrameTimesTest::tearDown()
+{
+}
+
+void FrameTimesTest::testPercentiles()
+{
+    // Frame times 1..100 ms, in shuffled order
+    std::vector<int64_t> frameTimes;
+    for (int i = 0; i < 100; i++)
+    {
+        frameTimes.push_back(((i * 37) % 100 + 1) * 1000);
+    }
+    FrameTimes times;
+    times.reserve(100);
+    recordFrames(times, frameTimes);
+
+    const Json::Value summary = times.summary(frequency, 16667);
+    CPPUNIT_ASSERT(summary["frames"].asUInt() == 100);
+    CPPUNIT_ASSERT(summary["dropped"].asUInt() == 0);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1.0, summary["min_ms"].asDouble(), 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(50.0, summary["p50_ms"].asDouble(), 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(90.0, summary["p90_ms"].asDouble(), 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(95.0, summary["p95_ms"].asDouble(), 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(99.0, summary["p99_ms"].asDouble(), 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(100.0, summary["max_ms"].asDouble(), 1e-9);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(50.5, summary["mean_ms"].asDouble(), 1e-9);
+    CPPUNIT_ASSERT(summary["jank"].asUInt() == 0); // nothing above 100 ms
+}
+
+void FrameTimesTest::testBudgetAndStutters()
+{
+    // 16 ms frames with two hitches: one run of three slow frames, and one single slow frame
+    std::vector<int64_t> frameTimes(20, 16000);
+    frameTimes[5] = 20000;
+    frameTimes[6] = 40000;
+    frameTimes[7] = 20000;
+    frameTimes[15] = 50000;
+    FrameTimes times;
+    times.reserve(20);
+    recordFrames(times, frameTimes);
+
+    const Json::Value summary = times.summary(frequency, 16667);
+    CPPUNIT_ASSERT(summary["over_budget"].asUInt() == 4);
+    CPPUNIT_ASSERT(summary["stutters"].asUInt() == 2);
+    CPPUNIT_ASSERT(summary["longest_stutter"].asUInt() == 3);
+    CPPUNIT_ASSERT(summary["jank"].asUInt() == 2); // 40 and 50 ms are more than twice the 16 ms median
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(16.0, summary["p50_ms"].asDouble(), 1e-9);
+
+    // A more generous budget
+    const Json::Value relaxed = times.summary(frequency, 33333);
+    CPPUNIT_ASSERT(relaxed["over_budget"].asUInt() == 2);
+    CPPUNIT_ASSERT(relaxed["stutters"].asUInt() == 2);
+    CPPUNIT_ASSERT(relaxed["longest_stutter"].asUInt() == 1);
+}
+
+void FrameTimesTest::testHistogram()
+{
+    FrameTimes times;
+    times.reserve(4);
+    recordFrames(times, { 3000, 16000, 16700, 250000 });
+
+    const Json::Value histogram = times.summary(frequency, 16667)["histogram"];
+    CPPUNIT_ASSERT(histogram["frames"].size() == histogram["edges_ms"].size() + 1);
+    unsigned total = 0;
+    for (const auto& count : histogram["frames"]) total += count.asUInt();
+    CPPUNIT_ASSERT(total == 4);
+    CPPUNIT_ASSERT(histogram["frames"][0].asUInt() == 1); // up to 4 ms
+    CPPUNIT_ASSERT(histogram["frames"][3].asUInt() == 2); // 12 to 16.7 ms
+    CPPUNIT_ASSERT(histogram["frames"][histogram["frames"].size() - 1].asUInt() == 1); // over 100 ms
+}
+
+void FrameTimesTest::testFixedStorage()
+{
+    FrameTimes times;
+    CPPUNIT_ASSERT(times.summary(frequency, 16667)["frames"].asUInt() == 0);
+    times.reserve(1000);
+    const int64_t *storage = times.data();
+    times.begin(0);
+    for (int64_t i = 1; i <= 100000; i++)
+    {
+        times.record(i * 16000);
+    }
+    // Recording never grows the storage, it drops the frames that do not fit
+    CPPUNIT_ASSERT(times.data() == storage);
+    CPPUNIT_ASSERT(times.capacity() == 1000);
+    CPPUNIT_ASSERT(times.count() == 1000);
+    CPPUNIT_ASSERT(times.dropped() == 99000);
+    const Json::Value summary = times.summary(frequency, 16667);
+    CPPUNIT_ASSERT(summary["frames"].asUInt() == 1000);
+    CPPUNIT_ASSERT(summary["dropped"].asUInt() == 99000);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(16.0, summary["max_ms"].asDouble(), 1e-9);
+
+    // Starting a new measurement reuses the same storage
+    times.begin(0);
+    CPPUNIT_ASSERT(times.count() == 0 && times.dropped() == 0);
+    CPPUNIT_ASSERT(times.data() == storage);
+}
+
+void FrameTimesTest::testCsv()
+{
+    FrameTimes times;
+    times.reserve(5);
+    recordFrames(times, { 10000, 20000, 30000, 40000, 16500 });
+    // Measured range is frames 10 and 11, looped
+    CPPUNIT_ASSERT(times.csv(frequency, 10, 2) == "frame,ms\n10,10.000\n11,20.000\n10,30.000\n11,40.000\n10,16.500\n");
+}
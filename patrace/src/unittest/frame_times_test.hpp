@@ -0,0 +1,31 @@
+#ifndef _INCLUDE_FRAME_TIMES_TEST_
+#define _INCLUDE_FRAME_TIMES_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class FrameTimesTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(FrameTimesTest);
+
+    CPPUNIT_TEST(testPercentiles);
+    CPPUNIT_TEST(testBudgetAndStutters);
+    CPPUNIT_TEST(testHistogram);
+    CPPUNIT_TEST(testFixedStorage);
+    CPPUNIT_TEST(testCsv);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    FrameTimesTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testPercentiles();
+    void testBudgetAndStutters();
+    void testHistogram();
+    void testFixedStorage();
+    void testCsv();
+};
+
+#endif
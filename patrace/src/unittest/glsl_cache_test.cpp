@@ -0,0 +1,120 @@
+#include "glsl_cache_test.hpp"
+#include "tool/glsl_cache.h"
+
+#include <stdio.h>
+#include <string>
+
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_FRAGMENT_SHADER 0x8B30
+
+static const char *CACHE_NAME = "glsl_cache_test.json";
+
+static const std::string vertexShader =
+    "#version 310 es\n"
+    "#define SCALE 2.0 // comment\n"
+    "layout(std140, binding = 1) uniform Block { highp mat4 mvp; vec4 extra[2]; } block;\n"
+    "in vec4 position;\n"
+    "out mediump vec2 uv;\n"
+    "void main()\n"
+    "{\n"
+    "    uv = position.xy * SCALE;\n"
+    "    gl_Position = block.mvp * position;\n"
+    "}\n";
+
+static const std::string fragmentShader =
+    "#version 300 es\n"
+    "#extension GL_OES_EGL_image_external_essl3 : require\n"
+    "precision mediump float;\n"
+    "uniform sampler2D tex;\n"
+    "in vec2 uv;\n"
+    "out vec4 color;\n"
+    "void main() { color = texture(tex, uv); }\n";
+
+static void compareVariables(const GLSLRepresentation::Variable& a, const GLSLRepresentation::Variable& b)
+{
+    CPPUNIT_ASSERT_EQUAL(a.name, b.name);
+    CPPUNIT_ASSERT(a.precision == b.precision);
+    CPPUNIT_ASSERT(a.type == b.type);
+    CPPUNIT_ASSERT(a.storage == b.storage);
+    CPPUNIT_ASSERT_EQUAL(a.size, b.size);
+    CPPUNIT_ASSERT_EQUAL(a.dimensions, b.dimensions);
+    CPPUNIT_ASSERT(a.qualifiers == b.qualifiers);
+    CPPUNIT_ASSERT_EQUAL(a.layout, b.layout);
+    CPPUNIT_ASSERT_EQUAL(a.binding, b.binding);
+    CPPUNIT_ASSERT_EQUAL(a.members.size(), b.members.size());
+    for (unsigned i = 0; i < a.members.size(); i++)
+    {
+        compareVariables(a.members[i], b.members[i]);
+    }
+}
+
+static void compareAnalysis(const GLSLAnalysis& a, const GLSLAnalysis& b)
+{
+    CPPUNIT_ASSERT_EQUAL(a.shader.code, b.shader.code);
+    CPPUNIT_ASSERT_EQUAL(a.shader.shaderType, b.shader.shaderType);
+    CPPUNIT_ASSERT_EQUAL(a.shader.version, b.shader.version);
+    CPPUNIT_ASSERT(a.shader.extensions == b.shader.extensions);
+    CPPUNIT_ASSERT_EQUAL(a.compressed, b.compressed);
+    CPPUNIT_ASSERT_EQUAL(a.repr.contains_invariants, b.repr.contains_invariants);
+    compareVariables(a.repr.global, b.repr.global);
+}
+
+GLSLCacheTest::GLSLCacheTest()
+{
+}
+
+void GLSLCacheTest::setUp()
+{
+}
+
+void GLSLCacheTest::tearDown()
+{
+    remove(CACHE_NAME);
+}
+
+void GLSLCacheTest::testHits()
+{
+    GLSLCache cache;
+    const GLSLAnalysis& first = cache.analyze(vertexShader, GL_VERTEX_SHADER);
+    CPPUNIT_ASSERT_EQUAL(0u, cache.stats().hits);
+    CPPUNIT_ASSERT(!first.repr.global.members.empty());
+
+    // Same source again, from a new string
+    const GLSLAnalysis& again = cache.analyze(std::string(vertexShader), GL_VERTEX_SHADER);
+    CPPUNIT_ASSERT(&first == &again);
+    CPPUNIT_ASSERT_EQUAL(1u, cache.stats().hits);
+
+    // The shader type is part of the key, and so is every byte of the source
+    cache.analyze(fragmentShader, GL_VERTEX_SHADER);
+    cache.analyze(fragmentShader, GL_FRAGMENT_SHADER);
+    cache.analyze(vertexShader + " ", GL_VERTEX_SHADER);
+    CPPUNIT_ASSERT_EQUAL(1u, cache.stats().hits);
+    CPPUNIT_ASSERT_EQUAL(5u, cache.stats().lookups);
+    CPPUNIT_ASSERT_EQUAL((size_t)4, cache.size());
+
+    // Matches running the parser directly
+    GLSLParser parser;
+    GLSLAnalysis direct;
+    direct.shader = parser.preprocessor(parser.strip_comments(fragmentShader), GL_FRAGMENT_SHADER);
+    direct.compressed = parser.compressed(direct.shader);
+    direct.repr = parser.parse(direct.shader);
+    compareAnalysis(direct, cache.analyze(fragmentShader, GL_FRAGMENT_SHADER));
+}
+
+void GLSLCacheTest::testSaveLoad()
+{
+    GLSLCache cache;
+    const GLSLAnalysis& vs = cache.analyze(vertexShader, GL_VERTEX_SHADER);
+    const GLSLAnalysis& fs = cache.analyze(fragmentShader, GL_FRAGMENT_SHADER);
+    CPPUNIT_ASSERT(cache.save(CACHE_NAME));
+
+    GLSLCache loaded;
+    CPPUNIT_ASSERT(loaded.load(CACHE_NAME));
+    CPPUNIT_ASSERT_EQUAL(2u, loaded.stats().loaded);
+    compareAnalysis(vs, loaded.analyze(vertexShader, GL_VERTEX_SHADER));
+    compareAnalysis(fs, loaded.analyze(fragmentShader, GL_FRAGMENT_SHADER));
+    CPPUNIT_ASSERT_EQUAL(2u, loaded.stats().hits);
+
+    GLSLCache missing;
+    CPPUNIT_ASSERT(!missing.load("does_not_exist.json"));
+}
@@ -0,0 +1,25 @@
+#ifndef _INCLUDE_GLSL_CACHE_TEST_
+#define _INCLUDE_GLSL_CACHE_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class GLSLCacheTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(GLSLCacheTest);
+
+    CPPUNIT_TEST(testHits);
+    CPPUNIT_TEST(testSaveLoad);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    GLSLCacheTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testHits();
+    void testSaveLoad();
+};
+
+#endif
@@ -0,0 +1,81 @@
+// Times the shader analysis pipeline of analyze_trace (strip_comments, preprocessor,
+// compressed, parse) on generated uber-shaders of growing size. The time per KB should
+// stay flat as the shaders grow.
+
+#include "tool/glsl_parser.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#define GL_FRAGMENT_SHADER 0x8B30
+
+// An uber-shader in the style engines generate: feature macros, #if blocks, macro
+// functions, comments, uniform blocks and many small functions
+static std::string generateShader(size_t size)
+{
+    std::string s = "#version 310 es\n"
+                    "// Generated uber-shader\n"
+                    "precision highp float;\n"
+                    "#define FEATURE_A 1\n"
+                    "#define FEATURE_B 0\n"
+                    "#define SCALE 2.0\n"
+                    "#define MADD(a, b, c) ((a) * (b) + (c))\n"
+                    "#define SATURATE(x) clamp(x, 0.0, 1.0)\n"
+                    "struct Light { vec4 position; vec4 color; };\n"
+                    "layout(std140, binding = 0) uniform Lights { Light lights[4]; };\n"
+                    "uniform sampler2D baseTexture;\n"
+                    "in vec2 uv;\n"
+                    "out vec4 fragColor;\n";
+    for (unsigned i = 0; s.size() < size; ++i)
+    {
+        const std::string n = std::to_string(i);
+        s += "/* Function " + n + " of the shader,\n   with a block comment */\n";
+        s += "uniform vec4 param" + n + ";\n";
+        s += "vec4 shade" + n + "(vec4 color, float weight) // weight is in [0, 1]\n{\n";
+        s += "    vec4 result = MADD(color, vec4(weight), param" + n + ");\n";
+        s += "#if FEATURE_A && !FEATURE_B\n";
+        s += "    result.rgb = SATURATE(result.rgb * SCALE);\n";
+        s += "#elif defined(FEATURE_C)\n";
+        s += "    result.rgb = vec3(0.0);\n";
+        s += "#else\n";
+        s += "    result.a = 1.0;\n";
+        s += "#endif\n";
+        s += "    for (int j = 0; j < 4; j++) { result += lights[j].color * texture(baseTexture, uv + vec2(float(j) / 8.0, " + n + ".0)); }\n";
+        s += "    return result;\n}\n";
+    }
+    s += "void main()\n{\n    fragColor = shade0(texture(baseTexture, uv), 0.5);\n}\n";
+    return s;
+}
+
+int main(int argc, char** argv)
+{
+    const int repeats = (argc > 1) ? atoi(argv[1]) : 3;
+
+    GLSLParser parser;
+    parser.self_test();
+
+    for (size_t kb : { 12, 25, 50, 100, 200 })
+    {
+        const std::string shader = generateShader(kb * 1024);
+        double best = 0.0;
+        size_t compressedSize = 0;
+        for (int r = 0; r < repeats; ++r)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const std::string stripped = parser.strip_comments(shader);
+            const GLSLShader preprocessed = parser.preprocessor(stripped, GL_FRAGMENT_SHADER);
+            compressedSize = parser.compressed(preprocessed).size();
+            const GLSLRepresentation repr = parser.parse(preprocessed);
+            (void)repr;
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if (r == 0 || elapsed.count() < best)
+            {
+                best = elapsed.count();
+            }
+        }
+        printf("%4u KB shader: %9.2f ms, %7.3f ms/KB (compressed to %u KB)\n", (unsigned)kb, best, best / kb, (unsigned)(compressedSize / 1024));
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include "image_diff_test.hpp"
+#include "tool/image_diff.hpp"
+#include "common/image.hpp"
+
+#include <cmath>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using image::Image;
+
+static const char *PNG_NAME = "image_diff_test.png";
+
+static std::unique_ptr<Image> randomImage(unsigned width, unsigned height, unsigned channels = 4)
+{
+    std::unique_ptr<Image> image(new Image(width, height, channels));
+    for (unsigned i = 0; i < image->size(); ++i)
+    {
+        image->pixels[i] = rand() & 0xff;
+    }
+    return image;
+}
+
+static std::unique_ptr<Image> copyImage(const Image& source)
+{
+    std::unique_ptr<Image> image(new Image(source.width, source.height, source.channels, source.flipped));
+    memcpy(image->pixels, source.pixels, source.width * source.height * source.channels);
+    return image;
+}
+
+static unsigned char *pixel(Image& image, unsigned x, unsigned y)
+{
+    return image.pixels + (y * image.width + x) * image.channels;
+}
+
+static void checkSame(const ImageDiffResult& a, const ImageDiffResult& b)
+{
+    CPPUNIT_ASSERT_EQUAL(a.squaredError, b.squaredError);
+    CPPUNIT_ASSERT_EQUAL(a.samples, b.samples);
+    CPPUNIT_ASSERT_EQUAL(a.differentPixels, b.differentPixels);
+    CPPUNIT_ASSERT_EQUAL(a.maxError, b.maxError);
+    CPPUNIT_ASSERT_EQUAL(a.tiles.size(), b.tiles.size());
+    for (size_t i = 0; i < a.tiles.size(); ++i)
+    {
+        CPPUNIT_ASSERT_EQUAL(a.tiles[i].squaredError, b.tiles[i].squaredError);
+        CPPUNIT_ASSERT_EQUAL(a.tiles[i].differentPixels, b.tiles[i].differentPixels);
+        CPPUNIT_ASSERT_EQUAL(a.tiles[i].maxError, b.tiles[i].maxError);
+    }
+}
+
+ImageDiffTest::ImageDiffTest()
+{
+}
+
+void ImageDiffTest::setUp()
+{
+    srand(1234);
+}
+
+void ImageDiffTest::tearDown()
+{
+    unlink(PNG_NAME);
+}
+
+void ImageDiffTest::testIdentical()
+{
+    std::unique_ptr<Image> a = randomImage(67, 45);
+    std::unique_ptr<Image> b = copyImage(*a);
+    ImageDiffResult result;
+    CPPUNIT_ASSERT(diffImages(*a, *b, ImageDiffOptions(), result));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0, result.squaredError);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0, result.differentPixels);
+    CPPUNIT_ASSERT_EQUAL(0u, result.maxError);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)67 * 45 * 3, result.samples);
+    CPPUNIT_ASSERT(std::isinf(result.psnr()));
+    CPPUNIT_ASSERT_EQUAL(3, result.tilesX);
+    CPPUNIT_ASSERT_EQUAL(2, result.tilesY);
+    CPPUNIT_ASSERT_EQUAL((size_t)6, result.tiles.size());
+
+    // Images of different sizes cannot be compared
+    std::unique_ptr<Image> c = randomImage(67, 44);
+    CPPUNIT_ASSERT(!diffImages(*a, *c, ImageDiffOptions(), result));
+}
+
+void ImageDiffTest::testKnownDifferences()
+{
+    std::unique_ptr<Image> a = randomImage(100, 70);
+    std::unique_ptr<Image> b = copyImage(*a);
+    pixel(*a, 40, 50)[1] = 100;
+    pixel(*b, 40, 50)[1] = 110;
+    pixel(*a, 99, 69)[0] = 0;
+    pixel(*b, 99, 69)[0] = 255;
+
+    ImageDiffOptions options;
+    options.tileSize = 32;
+    ImageDiffResult result;
+    CPPUNIT_ASSERT(diffImages(*a, *b, options, result));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)(10 * 10 + 255 * 255), result.squaredError);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)2, result.differentPixels);
+    CPPUNIT_ASSERT_EQUAL(255u, result.maxError);
+    const double mse = (10.0 * 10 + 255.0 * 255) / (100 * 70 * 3);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(mse, result.mse(), 1e-12);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(10.0 * log10(255.0 * 255.0 / mse), result.psnr(), 1e-9);
+
+    CPPUNIT_ASSERT_EQUAL(4, result.tilesX);
+    CPPUNIT_ASSERT_EQUAL(3, result.tilesY);
+    for (int i = 0; i < (int)result.tiles.size(); ++i)
+    {
+        const ImageDiffTile& tile = result.tiles[i];
+        if (i == 1 * 4 + 1)
+        {
+            CPPUNIT_ASSERT_EQUAL(10u, tile.maxError);
+            CPPUNIT_ASSERT_EQUAL((uint64_t)100, tile.squaredError);
+            CPPUNIT_ASSERT_EQUAL((uint64_t)1, tile.differentPixels);
+        }
+        else if (i == 2 * 4 + 3)
+        {
+            CPPUNIT_ASSERT_EQUAL(255u, tile.maxError);
+            CPPUNIT_ASSERT_EQUAL((uint64_t)1, tile.differentPixels);
+        }
+        else
+        {
+            CPPUNIT_ASSERT_EQUAL(0u, tile.maxError);
+            CPPUNIT_ASSERT_EQUAL((uint64_t)0, tile.differentPixels);
+        }
+    }
+
+    std::unique_ptr<Image> diff(diffImage(*a, *b, options, 8));
+    CPPUNIT_ASSERT_EQUAL(80, (int)pixel(*diff, 40, 50)[0]);
+    CPPUNIT_ASSERT_EQUAL(255, (int)pixel(*diff, 99, 69)[0]);
+    CPPUNIT_ASSERT_EQUAL(0, (int)pixel(*diff, 0, 0)[0]);
+
+    std::unique_ptr<Image> heatmap(heatmapImage(result));
+    CPPUNIT_ASSERT_EQUAL(100u, heatmap->width);
+    CPPUNIT_ASSERT_EQUAL(70u, heatmap->height);
+    CPPUNIT_ASSERT(memcmp(pixel(*heatmap, 0, 0), "\0\0\0\xff", 4) == 0);
+    CPPUNIT_ASSERT(memcmp(pixel(*heatmap, 33, 33), "\0\0\0\xff", 4) != 0);
+    CPPUNIT_ASSERT(memcmp(pixel(*heatmap, 33, 33), pixel(*heatmap, 63, 63), 4) == 0);
+}
+
+void ImageDiffTest::testAlpha()
+{
+    std::unique_ptr<Image> a = randomImage(20, 10);
+    std::unique_ptr<Image> b = copyImage(*a);
+    pixel(*b, 3, 4)[3] = pixel(*a, 3, 4)[3] ^ 0x1;
+
+    ImageDiffOptions options;
+    ImageDiffResult result;
+    CPPUNIT_ASSERT(diffImages(*a, *b, options, result));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0, result.differentPixels);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)20 * 10 * 3, result.samples);
+
+    options.alpha = true;
+    CPPUNIT_ASSERT(diffImages(*a, *b, options, result));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)1, result.differentPixels);
+    CPPUNIT_ASSERT_EQUAL(1u, result.maxError);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)20 * 10 * 4, result.samples);
+}
+
+void ImageDiffTest::testKernels()
+{
+    // The vector kernels must give the same result as the scalar one, for any row length
+    const unsigned widths[] = { 1, 3, 7, 8, 9, 17, 33, 100, 1001 };
+    for (unsigned width : widths)
+    {
+        const unsigned height = 1 + rand() % 40;
+        std::unique_ptr<Image> a = randomImage(width, height);
+        std::unique_ptr<Image> b = copyImage(*a);
+        for (unsigned i = 0; i < b->size(); ++i)
+        {
+            if (rand() % 4 == 0)
+            {
+                b->pixels[i] = rand() & 0xff;
+            }
+        }
+        for (int tileSize : { 32, 5, 0 })
+        {
+            for (bool alpha : { false, true })
+            {
+                ImageDiffOptions options;
+                options.tileSize = tileSize;
+                options.alpha = alpha;
+                options.threads = 3;
+                options.kernel = IMAGE_DIFF_KERNEL_SCALAR;
+                ImageDiffResult scalar;
+                CPPUNIT_ASSERT(diffImages(*a, *b, options, scalar));
+                options.kernel = IMAGE_DIFF_KERNEL_SIMD;
+                ImageDiffResult simd;
+                CPPUNIT_ASSERT(diffImages(*a, *b, options, simd));
+                checkSame(scalar, simd);
+            }
+        }
+    }
+
+    // Rows long enough to move the partial sums of the vector kernels to 64 bit lanes
+    std::unique_ptr<Image> black(new Image(40000, 2));
+    std::unique_ptr<Image> white(new Image(40000, 2));
+    memset(black->pixels, 0, black->size());
+    memset(white->pixels, 255, white->size());
+    ImageDiffOptions options;
+    options.tileSize = 0;
+    options.alpha = true;
+    ImageDiffResult result;
+    CPPUNIT_ASSERT(diffImages(*black, *white, options, result));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)40000 * 2 * 4 * 255 * 255, result.squaredError);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)40000 * 2, result.differentPixels);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, result.tiles.size());
+}
+
+void ImageDiffTest::testPNGRoundTrip()
+{
+    // readPNG gives RGBA for every kind of PNG
+    for (unsigned channels : { 1u, 2u, 3u, 4u })
+    {
+        std::unique_ptr<Image> source = randomImage(31, 17, channels);
+        CPPUNIT_ASSERT(source->writePNG(PNG_NAME));
+        std::unique_ptr<Image> read(image::readPNG(PNG_NAME));
+        CPPUNIT_ASSERT(read);
+        CPPUNIT_ASSERT_EQUAL(4u, read->channels);
+
+        std::unique_ptr<Image> expected(new Image(31, 17, 4));
+        for (unsigned i = 0; i < 31 * 17; ++i)
+        {
+            const unsigned char *in = source->pixels + i * channels;
+            unsigned char *out = expected->pixels + i * 4;
+            const bool gray = channels < 3;
+            out[0] = in[0];
+            out[1] = gray ? in[0] : in[1];
+            out[2] = gray ? in[0] : in[2];
+            out[3] = (channels == 2 || channels == 4) ? in[channels - 1] : 255;
+        }
+        ImageDiffOptions options;
+        options.alpha = true;
+        ImageDiffResult result;
+        CPPUNIT_ASSERT(diffImages(*expected, *read, options, result));
+        CPPUNIT_ASSERT_EQUAL(0u, result.maxError);
+    }
+}
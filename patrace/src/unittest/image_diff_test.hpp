@@ -0,0 +1,31 @@
+#ifndef _INCLUDE_IMAGE_DIFF_TEST_
+#define _INCLUDE_IMAGE_DIFF_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ImageDiffTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(ImageDiffTest);
+
+    CPPUNIT_TEST(testIdentical);
+    CPPUNIT_TEST(testKnownDifferences);
+    CPPUNIT_TEST(testAlpha);
+    CPPUNIT_TEST(testKernels);
+    CPPUNIT_TEST(testPNGRoundTrip);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    ImageDiffTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testIdentical();
+    void testKnownDifferences();
+    void testAlpha();
+    void testKernels();
+    void testPNGRoundTrip();
+};
+
+#endif
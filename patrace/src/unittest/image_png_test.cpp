@@ -0,0 +1,180 @@
+#include "image_png_test.hpp"
+#include "common/image.hpp"
+
+#include <png.h>
+#include <zlib.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using image::Image;
+using image::PngOptions;
+
+static const char *PNG_NAME = "image_png_test.png";
+
+// Smooth gradients with some noise and flat areas, somewhat like a rendered frame
+static std::unique_ptr<Image> testImage(unsigned width, unsigned height, unsigned channels, bool flipped = false)
+{
+    std::unique_ptr<Image> image(new Image(width, height, channels, flipped));
+    unsigned char *p = image->pixels;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            for (unsigned c = 0; c < channels; ++c)
+            {
+                const bool flat = (x / 64 + y / 64) % 3 == 0;
+                *p++ = flat ? 40 * c : (x * (c + 1) + y * 3 + (rand() & 0x3)) & 0xff;
+            }
+        }
+    }
+    return image;
+}
+
+// readPNG gives RGBA, top row first
+static void checkSame(const Image& written, const Image& read)
+{
+    CPPUNIT_ASSERT_EQUAL(written.width, read.width);
+    CPPUNIT_ASSERT_EQUAL(written.height, read.height);
+    CPPUNIT_ASSERT_EQUAL(4u, read.channels);
+    const unsigned channels = written.channels;
+    for (unsigned y = 0; y < written.height; ++y)
+    {
+        const unsigned char *in = written.start() + (ptrdiff_t)y * written.stride();
+        const unsigned char *out = read.pixels + (size_t)y * read.width * 4;
+        for (unsigned x = 0; x < written.width; ++x, in += channels, out += 4)
+        {
+            const bool gray = channels < 3;
+            const unsigned char expected[4] = { in[0], gray ? in[0] : in[1], gray ? in[0] : in[2],
+                                                (channels == 2 || channels == 4) ? in[channels - 1] : (unsigned char)255 };
+            if (memcmp(expected, out, 4) != 0)
+            {
+                printf("Pixel %u,%u differs\n", x, y);
+                CPPUNIT_ASSERT(false);
+            }
+        }
+    }
+}
+
+static long fileSize(const char *name)
+{
+    FILE *fp = fopen(name, "rb");
+    CPPUNIT_ASSERT(fp);
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static void roundTrip(const Image& image, const PngOptions& options)
+{
+    CPPUNIT_ASSERT(image.writePNG(PNG_NAME, options));
+    std::unique_ptr<Image> read(image::readPNG(PNG_NAME));
+    CPPUNIT_ASSERT(read);
+    checkSame(image, *read);
+}
+
+ImagePngTest::ImagePngTest()
+{
+}
+
+void ImagePngTest::setUp()
+{
+    srand(1234);
+}
+
+void ImagePngTest::tearDown()
+{
+    unlink(PNG_NAME);
+}
+
+void ImagePngTest::testParseOptions()
+{
+    PngOptions options;
+    CPPUNIT_ASSERT(image::parsePngOptions("level=6,filter=paeth,strategy=rle,threads=4", options));
+    CPPUNIT_ASSERT_EQUAL(6, options.level);
+    CPPUNIT_ASSERT_EQUAL(PNG_FILTER_PAETH, options.filters);
+    CPPUNIT_ASSERT_EQUAL((int)Z_RLE, options.strategy);
+    CPPUNIT_ASSERT_EQUAL(4, options.threads);
+
+    // Later items override the presets
+    options = PngOptions();
+    CPPUNIT_ASSERT(image::parsePngOptions("store,threads=0", options));
+    CPPUNIT_ASSERT_EQUAL(0, options.level);
+    CPPUNIT_ASSERT_EQUAL(PNG_FILTER_NONE, options.filters);
+    CPPUNIT_ASSERT_EQUAL(0, options.threads);
+
+    CPPUNIT_ASSERT(!image::parsePngOptions("level=10", options));
+    CPPUNIT_ASSERT(!image::parsePngOptions("filter=best", options));
+    CPPUNIT_ASSERT(!image::parsePngOptions("threads=-1", options));
+    CPPUNIT_ASSERT(!image::parsePngOptions("fast,", options));
+    CPPUNIT_ASSERT(!image::parsePngOptions("", options));
+}
+
+void ImagePngTest::testRoundTrip()
+{
+    // Every filter and preset on the libpng path
+    const char *specs[] = { "level=1", "store", "fast", "small", "filter=none", "filter=sub", "filter=up", "filter=avg", "filter=paeth", "filter=all,strategy=huffman" };
+    for (unsigned channels = 1; channels <= 4; ++channels)
+    {
+        std::unique_ptr<Image> image = testImage(61, 37, channels, channels == 3);
+        for (const char *spec : specs)
+        {
+            PngOptions options;
+            CPPUNIT_ASSERT(image::parsePngOptions(spec, options));
+            roundTrip(*image, options);
+        }
+    }
+}
+
+void ImagePngTest::testStrips()
+{
+    // Large enough to be split in strips, with strips of different heights
+    const char *specs[] = { "threads=3", "store,threads=4", "fast,threads=4", "small,threads=2", "filter=up,threads=3",
+                            "filter=avg,threads=3", "filter=paeth,threads=3", "level=6,strategy=fixed,threads=3" };
+    for (unsigned channels = 1; channels <= 4; ++channels)
+    {
+        std::unique_ptr<Image> image = testImage(777, 1031, channels, channels == 4);
+        for (const char *spec : specs)
+        {
+            PngOptions options;
+            CPPUNIT_ASSERT(image::parsePngOptions(spec, options));
+            roundTrip(*image, options);
+        }
+    }
+
+    // Compressing in strips costs little compared to compressing in one go
+    std::unique_ptr<Image> image = testImage(2048, 1024, 4);
+    PngOptions options;
+    CPPUNIT_ASSERT(image->writePNG(PNG_NAME, options));
+    const long single = fileSize(PNG_NAME);
+    options.threads = 8;
+    CPPUNIT_ASSERT(image->writePNG(PNG_NAME, options));
+    const long strips = fileSize(PNG_NAME);
+    CPPUNIT_ASSERT(strips < single + single / 20);
+}
+
+void ImagePngTest::testBuffer()
+{
+    std::unique_ptr<Image> image = testImage(1200, 900, 4, true);
+    for (int threads : { 1, 4 })
+    {
+        PngOptions options;
+        options.threads = threads;
+        char *buffer = NULL;
+        int size = 0;
+        CPPUNIT_ASSERT(image::writePixelsToBuffer(image->pixels, image->width, image->height, image->channels, image->flipped, &buffer, &size, options));
+        CPPUNIT_ASSERT(buffer);
+        FILE *fp = fopen(PNG_NAME, "wb");
+        CPPUNIT_ASSERT(fp);
+        CPPUNIT_ASSERT(fwrite(buffer, size, 1, fp) == 1);
+        fclose(fp);
+        free(buffer);
+        std::unique_ptr<Image> read(image::readPNG(PNG_NAME));
+        CPPUNIT_ASSERT(read);
+        checkSame(*image, *read);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef _INCLUDE_IMAGE_PNG_TEST_
+#define _INCLUDE_IMAGE_PNG_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ImagePngTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(ImagePngTest);
+
+    CPPUNIT_TEST(testParseOptions);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testStrips);
+    CPPUNIT_TEST(testBuffer);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    ImagePngTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testParseOptions();
+    void testRoundTrip();
+    void testStrips();
+    void testBuffer();
+};
+
+#endif
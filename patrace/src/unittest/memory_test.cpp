@@ -226,3 +226,75 @@ void MemoryTest::testClientSideBufferObjectSet()
     memcpy(BUFFER0, BUFFER1, 16);
     CPPUNIT_ASSERT(mbs.find(0, ClientSideBufferObject(BUFFER0, 16), name) == false);
 }
+
+void MemoryTest::testClientSideBufferCheckpoint()
+{
+    const unsigned char BUFFER0[8] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07};
+    const unsigned char BUFFER1[8] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17};
+    const unsigned char BUFFER2[8] = {0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27};
+    const unsigned char PATCH[2] = {0xAA, 0xBB};
+    const unsigned char BUFFER1_PATCHED[8] = {0x10, 0x11, 0xAA, 0xBB, 0x14, 0x15, 0x16, 0x17};
+
+    // Copies share owned memory until one of them is modified
+    ClientSideBufferObject a(BUFFER0, 8, true);
+    ClientSideBufferObject b(a);
+    CPPUNIT_ASSERT(a.shared() && b.shared());
+    CPPUNIT_ASSERT(a.base_address == b.base_address);
+    b.set_subdata(PATCH, 2, 2);
+    CPPUNIT_ASSERT(!a.shared() && !b.shared());
+    CPPUNIT_ASSERT(a.base_address != b.base_address);
+    CPPUNIT_ASSERT(memcmp(a.base_address, BUFFER0, 8) == 0);
+    CPPUNIT_ASSERT(a.md5_digest() == MD5Digest(BUFFER0, 8));
+    CPPUNIT_ASSERT(b.md5_digest() != a.md5_digest());
+
+    // Checkpoint a set the way the retracer does for looped replay
+    ClientSideBufferObjectSet live;
+    live.object_data(0, 1, 8, BUFFER0, true);
+    live.object_data(0, 2, 8, BUFFER1, true);
+    live.object_data(0, 3, 8, BUFFER2, true);
+    live.object_data(1, 1, 8, BUFFER2, true);
+
+    ClientSideBufferObjectSet checkpoint;
+    checkpoint = live;
+    for (unsigned name = 1; name <= 3; ++name)
+    {
+        CPPUNIT_ASSERT(checkpoint.get_object(0, name)->base_address == live.get_object(0, name)->base_address);
+    }
+
+    // Mutate the live set in every way a loop iteration can
+    live.object_subdata(0, 2, 2, 2, PATCH);
+    live.object_data(0, 3, 8, BUFFER0, true);
+    live.delete_object(0, 1);
+    live.object_data(0, 4, 8, BUFFER1, true);
+    live.object_subdata(1, 1, 0, 2, PATCH);
+
+    CPPUNIT_ASSERT(live.get_object(0, 1) == NULL);
+    CPPUNIT_ASSERT(memcmp(live.get_object(0, 2)->base_address, BUFFER1_PATCHED, 8) == 0);
+    CPPUNIT_ASSERT(memcmp(live.get_object(0, 3)->base_address, BUFFER0, 8) == 0);
+    CPPUNIT_ASSERT(memcmp(checkpoint.get_object(0, 1)->base_address, BUFFER0, 8) == 0);
+    CPPUNIT_ASSERT(memcmp(checkpoint.get_object(0, 2)->base_address, BUFFER1, 8) == 0);
+    CPPUNIT_ASSERT(memcmp(checkpoint.get_object(0, 3)->base_address, BUFFER2, 8) == 0);
+    CPPUNIT_ASSERT(memcmp(checkpoint.get_object(1, 1)->base_address, BUFFER2, 8) == 0);
+    CPPUNIT_ASSERT(checkpoint.get_object(0, 4) == NULL);
+
+    // Roll back twice; the checkpoint must survive modifications made after each restore
+    for (int loop = 0; loop < 2; ++loop)
+    {
+        live.clear();
+        live = checkpoint;
+
+        CPPUNIT_ASSERT(live.get_object(0, 4) == NULL);
+        CPPUNIT_ASSERT(memcmp(live.get_object(0, 1)->base_address, BUFFER0, 8) == 0);
+        CPPUNIT_ASSERT(memcmp(live.get_object(0, 2)->base_address, BUFFER1, 8) == 0);
+        CPPUNIT_ASSERT(memcmp(live.get_object(0, 3)->base_address, BUFFER2, 8) == 0);
+        CPPUNIT_ASSERT(memcmp(live.get_object(1, 1)->base_address, BUFFER2, 8) == 0);
+        CPPUNIT_ASSERT(live.get_object(0, 2)->md5_digest() == MD5Digest(BUFFER1, 8));
+        CPPUNIT_ASSERT(live.total_size() == checkpoint.total_size());
+
+        live.object_subdata(0, 2, 2, 2, PATCH);
+        CPPUNIT_ASSERT(live.get_object(0, 2)->md5_digest() == MD5Digest(BUFFER1_PATCHED, 8));
+        CPPUNIT_ASSERT(checkpoint.get_object(0, 2)->md5_digest() == MD5Digest(BUFFER1, 8));
+        // untouched objects are never duplicated
+        CPPUNIT_ASSERT(live.get_object(0, 1)->base_address == checkpoint.get_object(0, 1)->base_address);
+    }
+}
@@ -11,6 +11,7 @@ class MemoryTest : public CPPUNIT_NS::TestFixture
     CPPUNIT_TEST(testMD5); 
     CPPUNIT_TEST(testDataInitialization);
     CPPUNIT_TEST(testClientSideBufferObjectSet);
+    CPPUNIT_TEST(testClientSideBufferCheckpoint);
 
 	CPPUNIT_TEST_SUITE_END();
 
@@ -24,6 +25,7 @@ public:
     void testMD5();
     void testDataInitialization();
     void testClientSideBufferObjectSet();
+    void testClientSideBufferCheckpoint();
 };
 
 #endif // _INCLUDE_MEMORY_TEST_
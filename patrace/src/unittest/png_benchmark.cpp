@@ -0,0 +1,86 @@
+// Measures writing snapshots with Image::writePNG() for a range of PngOptions, on one
+// thread and in parallel strips, and checks that every file reads back the same.
+// Arguments: [width height [threads [repeats]]]. CPU only.
+
+#include "common/image.hpp"
+#include "common/os_time.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+using image::Image;
+
+// Gradients, flat areas and some noise, somewhat like a rendered frame
+static std::unique_ptr<Image> makeFrame(unsigned width, unsigned height)
+{
+    std::unique_ptr<Image> image(new Image(width, height, 4));
+    unsigned char *p = image->pixels;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x, p += 4)
+        {
+            const bool sky = y < height / 3;
+            const bool box = (x / 128 + y / 96) % 5 == 0;
+            p[0] = sky ? 90 + y * 60 / height : box ? 200 : (x ^ y) & 0x7f;
+            p[1] = sky ? 140 + y * 40 / height : box ? 40 : (x + y + (rand() & 0x7)) & 0xff;
+            p[2] = sky ? 230 : box ? 40 : (x * 3) & 0xff;
+            p[3] = 255;
+        }
+    }
+    return image;
+}
+
+static long fileSize(const char *name)
+{
+    struct stat st;
+    return stat(name, &st) == 0 ? st.st_size : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned width = (argc > 2) ? atoi(argv[1]) : 1920;
+    const unsigned height = (argc > 2) ? atoi(argv[2]) : 1080;
+    const int threads = (argc > 3) ? atoi(argv[3]) : 0;
+    const int repeats = (argc > 4) ? atoi(argv[4]) : 5;
+    const char *name = "png_benchmark.png";
+
+    const std::unique_ptr<Image> frame = makeFrame(width, height);
+    printf("%ux%u RGBA, %d repeats, threads=%d for the parallel runs\n", width, height, repeats, threads);
+    printf("%-36s %10s %12s\n", "options", "ms/image", "bytes");
+
+    const char *specs[] = { "level=1", "store", "fast", "level=6", "small" };
+    bool ok = true;
+    for (const char *spec : specs)
+    {
+        for (bool parallel : { false, true })
+        {
+            image::PngOptions options;
+            image::parsePngOptions(spec, options);
+            options.threads = parallel ? threads : 1;
+
+            const long long begin = os::getTime();
+            for (int r = 0; r < repeats; ++r)
+            {
+                frame->writePNG(name, options);
+            }
+            const double ms = (double)(os::getTime() - begin) * 1000.0 / os::timeFrequency / repeats;
+
+            const std::string label = std::string(spec) + (parallel ? ", parallel" : "");
+            printf("%-36s %10.2f %12ld\n", label.c_str(), ms, fileSize(name));
+
+            std::unique_ptr<Image> read(image::readPNG(name));
+            if (!read || read->width != width || read->height != height || memcmp(read->pixels, frame->pixels, frame->size()) != 0)
+            {
+                printf("FAILED: %s does not read back the same\n", label.c_str());
+                ok = false;
+            }
+        }
+    }
+    unlink(name);
+    return ok ? 0 : 1;
+}
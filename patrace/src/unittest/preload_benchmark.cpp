@@ -0,0 +1,118 @@
+// Measures preloading of a synthetic trace file (see InFile::PreloadFrames), and checks
+// that no page faults happen while iterating over the preloaded frames.
+// CPU only, no GL context is needed.
+
+#include "common/in_file_mt.hpp"
+#include "common/os_time.hpp"
+#include "synthetic_trace.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static double msec(long long begin, long long end)
+{
+    return (double)(end - begin) * 1000.0 / os::timeFrequency;
+}
+
+static long pageFaults()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+static void writeTrace(const std::string& name, int frames, int drawsPerFrame)
+{
+    SyntheticTraceWriter out;
+    if (!out.open(name))
+    {
+        exit(1);
+    }
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (int draw = 0; draw < drawsPerFrame; ++draw)
+        {
+            out.write("glDrawArrays", 0, { 4 /* GL_TRIANGLES */, (uint32_t)draw, 3 * (uint32_t)(frame + 1) });
+        }
+        out.write("eglSwapBuffers", 0, { 1, 1, 1 });
+    }
+    out.close(frames);
+}
+
+// Returns the number of page faults seen while replaying the preloaded frames
+static long run(const char *label, const std::string& name, int begin, int end, bool hugepages, bool persist)
+{
+    InFile file;
+    file.setPreloadOptions(hugepages, false, persist);
+    if (!file.Open(name.c_str()))
+    {
+        fprintf(stderr, "Failed to open %s\n", name.c_str());
+        exit(1);
+    }
+    file.setFrameRange(begin, end, -1, true);
+
+    void *fptr;
+    BCall_vlen call;
+    char *src;
+    const unsigned short swapId = file.NameToExId("eglSwapBuffers");
+    int frame = 0;
+    long long beforeCall = 0;
+    long long preloadTime = 0;
+    long long measureStart = 0;
+    long faultsStart = 0;
+    unsigned checksum = 0;
+    while (true)
+    {
+        if (frame == begin - 1) beforeCall = os::getTime();
+        if (!file.GetNextCall(fptr, call, src)) break;
+        checksum += (unsigned char)src[0] + call.toNext; // touch the call data, like a retracer would
+        if (call.funcId == swapId && ++frame == begin)
+        {
+            // Preloading happens inside the call that completes frame number begin
+            measureStart = os::getTime();
+            preloadTime = measureStart - beforeCall;
+            faultsStart = pageFaults();
+        }
+    }
+    const long faults = pageFaults() - faultsStart;
+    const long long measureEnd = os::getTime();
+    printf("%-24s preload %8.3f ms, replay %8.3f ms, %ld page faults during replay (checksum %u)\n", label,
+           msec(0, preloadTime), msec(measureStart, measureEnd), faults, checksum);
+    file.Close();
+    return faults;
+}
+
+int main(int argc, char **argv)
+{
+    const int frames = (argc > 1) ? atoi(argv[1]) : 4000;
+    const int drawsPerFrame = (argc > 2) ? atoi(argv[2]) : 1000;
+    const std::string name = (argc > 3) ? argv[3] : "preload_benchmark.pat";
+    const int begin = 10;
+    const int end = frames - 10;
+
+    writeTrace(name, frames, drawsPerFrame);
+    const std::string cacheName = name + ".preload_" + std::to_string(begin) + "_" + std::to_string(end);
+    unlink(cacheName.c_str());
+
+    long faults = 0;
+    faults += run("arena", name, begin, end, false, false);
+    faults += run("arena + huge pages", name, begin, end, true, false);
+    faults += run("cache (first run)", name, begin, end, false, true);
+    faults += run("cache (mapped)", name, begin, end, false, true);
+    faults += run("cache (huge pages)", name, begin, end, true, true);
+
+    unlink(cacheName.c_str());
+    unlink(name.c_str());
+    if (faults > 0)
+    {
+        printf("FAILED: page faults during replay of preloaded frames\n");
+        return 1;
+    }
+    return 0;
+}
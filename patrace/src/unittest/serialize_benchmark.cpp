@@ -0,0 +1,112 @@
+// Measures writing CallTM calls to a trace file, as the offline tools do for every call
+// they keep: serializing into a buffer of our own and copying it with OutFile::Write(),
+// against serializing in place with CallTM::Serialize(OutFile&). Both must produce the
+// same file. CPU only.
+
+#include "common/trace_model.hpp"
+#include "common/out_file.hpp"
+#include "common/os_time.hpp"
+
+#include <GLES3/gl32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static CallTM* makeCall(const char *name, std::vector<ValueTM*> args)
+{
+    CallTM *call = new CallTM(name);
+    for (ValueTM *arg : args)
+    {
+        call->mArgs.push_back(arg);
+    }
+    return call;
+}
+
+static std::vector<std::unique_ptr<CallTM>> makeFrame()
+{
+    std::vector<std::unique_ptr<CallTM>> calls;
+    const std::vector<char> data(4096, 'x');
+    calls.emplace_back(makeCall("glClear", { CreateUInt32Value(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT) }));
+    for (int d = 0; d < 100; d++)
+    {
+        calls.emplace_back(makeCall("glBindTexture", { CreateEnumValue(GL_TEXTURE_2D), CreateUInt32Value(d) }));
+        calls.emplace_back(makeCall("glTexParameteri", { CreateEnumValue(GL_TEXTURE_2D), CreateEnumValue(GL_TEXTURE_MIN_FILTER), CreateInt32Value(GL_LINEAR_MIPMAP_LINEAR) }));
+        calls.emplace_back(makeCall("glUseProgram", { CreateUInt32Value(d) }));
+        calls.emplace_back(makeCall("glUniform4fv", { CreateInt32Value(d), CreateInt32Value(1), CreateInt32ArrayValue(nullptr) }));
+        calls.emplace_back(makeCall("glBindBuffer", { CreateEnumValue(GL_ARRAY_BUFFER), CreateUInt32Value(d) }));
+        if (d % 10 == 0)
+        {
+            calls.emplace_back(makeCall("glBufferData", { CreateEnumValue(GL_ARRAY_BUFFER), CreateInt32Value(data.size()), new ValueTM(data.data(), data.size()), CreateEnumValue(GL_STATIC_DRAW) }));
+        }
+        calls.emplace_back(makeCall("glVertexAttribPointer", { CreateUInt32Value(0), CreateInt32Value(3), CreateEnumValue(GL_FLOAT), CreateUInt8Value(0), CreateInt32Value(12), CreateBufferReferenceOpaqueValue(d * 16) }));
+        calls.emplace_back(makeCall("glDrawElements", { CreateEnumValue(GL_TRIANGLES), CreateInt32Value(36), CreateEnumValue(GL_UNSIGNED_SHORT), CreateBufferReferenceOpaqueValue(0) }));
+    }
+    calls.emplace_back(makeCall("eglSwapBuffers", { CreateInt32Value(1), CreateInt32Value(1) }));
+    return calls;
+}
+
+static double run(const char *label, const std::string& name, const std::vector<std::unique_ptr<CallTM>>& calls, int repeats, bool inPlace)
+{
+    OutFile out;
+    out.Open(name.c_str());
+    std::vector<char> buffer;
+    const long long begin = os::getTime();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (const auto& call : calls)
+        {
+            if (inPlace)
+            {
+                call->Serialize(out);
+            }
+            else
+            {
+                buffer.resize(std::max(buffer.size(), call->SerializedSizeBound()));
+                char *dest = call->Serialize(buffer.data());
+                out.Write(buffer.data(), dest - buffer.data());
+            }
+        }
+    }
+    out.Flush();
+    const double seconds = (double)(os::getTime() - begin) / os::timeFrequency;
+    out.Close();
+    printf("%-26s %7.1f ns/call\n", label, seconds * 1e9 / ((double)calls.size() * repeats));
+    return seconds;
+}
+
+static std::string readFile(const std::string& name)
+{
+    std::ifstream file(name, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char **argv)
+{
+    const int repeats = (argc > 1) ? atoi(argv[1]) : 2000;
+    const std::string name = (argc > 2) ? argv[2] : "serialize_benchmark";
+    const std::vector<std::unique_ptr<CallTM>> calls = makeFrame();
+    printf("%d calls\n", (int)calls.size() * repeats);
+
+    const std::string copied = name + "_copied.pat";
+    const std::string inPlace = name + "_in_place.pat";
+    run("Serialize() + Write()", copied, calls, repeats, false);
+    run("Serialize(OutFile&)", inPlace, calls, repeats, true);
+
+    const bool same = readFile(copied) == readFile(inPlace);
+    unlink(copied.c_str());
+    unlink(inPlace.c_str());
+    if (!same)
+    {
+        printf("FAILED: the two ways of writing produced different files\n");
+        return 1;
+    }
+    return 0;
+}
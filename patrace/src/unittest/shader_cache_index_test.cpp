@@ -0,0 +1,181 @@
+#include "shader_cache_index_test.hpp"
+#include "retracer/shader_cache_index.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace retracer;
+
+static const char *INDEX_NAME = "shader_cache_index_test.idx";
+
+static const std::string VERSION = "0123456789ABCDEF0123456789ABCDEF";
+
+static const std::string vertexShader =
+    "#version 300 es\n"
+    "in vec4 position;\n"
+    "void main() { gl_Position = position; }\n";
+
+static const std::string fragmentShader =
+    "#version 300 es\n"
+    "precision mediump float;\n"
+    "out vec4 color;\n"
+    "void main() { color = vec4(1.0); }\n";
+
+// Writes an index file the way the retracer did before the keys were content hashes
+static void writeLegacyIndex(const std::vector<std::pair<std::string, uint64_t>>& entries)
+{
+    FILE *fp = fopen(INDEX_NAME, "wb");
+    CPPUNIT_ASSERT(fp);
+    fwrite(VERSION.data(), VERSION.size(), 1, fp);
+    const uint32_t size = entries.size();
+    fwrite(&size, sizeof(size), 1, fp);
+    for (const auto& entry : entries)
+    {
+        fwrite(entry.first.data(), entry.first.size(), 1, fp);
+        fwrite(&entry.second, sizeof(entry.second), 1, fp);
+    }
+    fclose(fp);
+}
+
+ShaderCacheIndexTest::ShaderCacheIndexTest()
+{
+}
+
+void ShaderCacheIndexTest::setUp()
+{
+}
+
+void ShaderCacheIndexTest::tearDown()
+{
+    remove(INDEX_NAME);
+}
+
+void ShaderCacheIndexTest::testKeyStability()
+{
+    // Keys are stored in cache files, so they must never change for the same sources
+    const uint64_t vs = ShaderCacheIndex::shaderKey(vertexShader);
+    const uint64_t fs = ShaderCacheIndex::shaderKey(fragmentShader);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0xef46db3751d8e999ull, ShaderCacheIndex::shaderKey(""));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0x41124e21d885bfe6ull, vs);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0x66b5426c369740c6ull, fs);
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0xbdec89ba40d0a123ull, ShaderCacheIndex::programKey({ vs, fs }));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)0x8a5dbacd6c9808ebull, ShaderCacheIndex::programKey({ fs, vs }));
+    CPPUNIT_ASSERT(ShaderCacheIndex::programKey({ vs }) != ShaderCacheIndex::programKey({ vs, vs }));
+
+    // The old key is the MD5 of all the sources of the program
+    CPPUNIT_ASSERT_EQUAL(std::string("F430C9A50A982FCFB246D838F4F59B9E"), ShaderCacheIndex::legacyKey({ vertexShader, fragmentShader }));
+}
+
+void ShaderCacheIndexTest::testSaveLoad()
+{
+    const uint64_t program = ShaderCacheIndex::programKey({ ShaderCacheIndex::shaderKey(vertexShader), ShaderCacheIndex::shaderKey(fragmentShader) });
+    ShaderCacheIndex index;
+    index.version = VERSION;
+    index.add(program, 1234);
+    index.add(42, ShaderCacheIndex::SKIPPED);
+    std::string error;
+    CPPUNIT_ASSERT(index.save(INDEX_NAME, error));
+
+    ShaderCacheIndex loaded;
+    CPPUNIT_ASSERT(loaded.load(INDEX_NAME, error));
+    CPPUNIT_ASSERT_EQUAL(VERSION, loaded.version);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, loaded.size());
+    CPPUNIT_ASSERT(!loaded.hasLegacyEntries());
+    uint64_t offset = 0;
+    CPPUNIT_ASSERT(loaded.find(program, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)1234, offset);
+    CPPUNIT_ASSERT(loaded.find(42, offset));
+    CPPUNIT_ASSERT(offset == ShaderCacheIndex::SKIPPED);
+    CPPUNIT_ASSERT(!loaded.find(43, offset));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, loaded.offsets().size());
+
+    // A missing file is an empty cache, a broken one is an error
+    ShaderCacheIndex missing;
+    CPPUNIT_ASSERT(missing.load("does_not_exist.idx", error));
+    CPPUNIT_ASSERT_EQUAL((size_t)0, missing.size());
+    FILE *fp = fopen(INDEX_NAME, "wb");
+    fwrite("PASCIDX2", 8, 1, fp);
+    fclose(fp);
+    CPPUNIT_ASSERT(!missing.load(INDEX_NAME, error));
+    CPPUNIT_ASSERT(!error.empty());
+}
+
+void ShaderCacheIndexTest::testLegacyIndex()
+{
+    const std::string first = ShaderCacheIndex::legacyKey({ vertexShader, fragmentShader });
+    const std::string second = ShaderCacheIndex::legacyKey({ vertexShader, vertexShader });
+    writeLegacyIndex({ { first, 100 }, { second, 200 } });
+
+    ShaderCacheIndex index;
+    std::string error;
+    CPPUNIT_ASSERT(index.load(INDEX_NAME, error));
+    CPPUNIT_ASSERT_EQUAL(VERSION, index.version);
+    CPPUNIT_ASSERT(index.hasLegacyEntries());
+    CPPUNIT_ASSERT_EQUAL((size_t)2, index.size());
+    CPPUNIT_ASSERT_EQUAL((size_t)2, index.offsets().size());
+
+    // A program is found by its old key once, and by the new one from then on
+    const uint64_t key = ShaderCacheIndex::programKey({ ShaderCacheIndex::shaderKey(vertexShader), ShaderCacheIndex::shaderKey(fragmentShader) });
+    uint64_t offset = 0;
+    CPPUNIT_ASSERT(!index.find(key, offset));
+    CPPUNIT_ASSERT(!index.migrate(key, ShaderCacheIndex::legacyKey({ fragmentShader }), offset));
+    CPPUNIT_ASSERT(!index.migrated());
+    CPPUNIT_ASSERT(index.migrate(key, first, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)100, offset);
+    CPPUNIT_ASSERT(index.migrated());
+    CPPUNIT_ASSERT(index.find(key, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)100, offset);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, index.size());
+
+    // Saving keeps what has not moved yet
+    CPPUNIT_ASSERT(index.save(INDEX_NAME, error));
+    CPPUNIT_ASSERT(!index.migrated());
+    ShaderCacheIndex loaded;
+    CPPUNIT_ASSERT(loaded.load(INDEX_NAME, error));
+    CPPUNIT_ASSERT(loaded.find(key, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)100, offset);
+    CPPUNIT_ASSERT(loaded.hasLegacyEntries());
+    const uint64_t other = ShaderCacheIndex::programKey({ ShaderCacheIndex::shaderKey(vertexShader), ShaderCacheIndex::shaderKey(vertexShader) });
+    CPPUNIT_ASSERT(loaded.migrate(other, second, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)200, offset);
+    CPPUNIT_ASSERT(!loaded.hasLegacyEntries());
+}
+
+// Saving a program to a cache with an old index reuses the binary that is already there
+void ShaderCacheIndexTest::testFindOrMigrate()
+{
+    const std::string legacy = ShaderCacheIndex::legacyKey({ vertexShader, fragmentShader });
+    writeLegacyIndex({ { legacy, 100 } });
+    ShaderCacheIndex index;
+    std::string error;
+    CPPUNIT_ASSERT(index.load(INDEX_NAME, error));
+
+    const uint64_t key = ShaderCacheIndex::programKey({ ShaderCacheIndex::shaderKey(vertexShader), ShaderCacheIndex::shaderKey(fragmentShader) });
+    int legacyLookups = 0;
+    auto legacyKey = [&]() { legacyLookups++; return legacy; };
+    uint64_t offset = 0;
+    CPPUNIT_ASSERT(index.findOrMigrate(key, legacyKey, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)100, offset);
+    CPPUNIT_ASSERT_EQUAL(1, legacyLookups);
+    CPPUNIT_ASSERT(index.migrated());
+    CPPUNIT_ASSERT(!index.hasLegacyEntries());
+    CPPUNIT_ASSERT_EQUAL((size_t)1, index.size());
+
+    // From then on the new key is enough, and the old one is not made at all
+    offset = 0;
+    CPPUNIT_ASSERT(index.findOrMigrate(key, legacyKey, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)100, offset);
+    CPPUNIT_ASSERT_EQUAL(1, legacyLookups);
+    const uint64_t other = ShaderCacheIndex::programKey({ ShaderCacheIndex::shaderKey(fragmentShader) });
+    CPPUNIT_ASSERT(!index.findOrMigrate(other, legacyKey, offset));
+    CPPUNIT_ASSERT_EQUAL(1, legacyLookups);
+
+    CPPUNIT_ASSERT(index.save(INDEX_NAME, error));
+    ShaderCacheIndex loaded;
+    CPPUNIT_ASSERT(loaded.load(INDEX_NAME, error));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, loaded.offsets().size());
+    CPPUNIT_ASSERT(loaded.find(key, offset));
+    CPPUNIT_ASSERT_EQUAL((uint64_t)100, offset);
+}
@@ -0,0 +1,29 @@
+#ifndef _INCLUDE_SHADER_CACHE_INDEX_TEST_
+#define _INCLUDE_SHADER_CACHE_INDEX_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ShaderCacheIndexTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(ShaderCacheIndexTest);
+
+    CPPUNIT_TEST(testKeyStability);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST(testLegacyIndex);
+    CPPUNIT_TEST(testFindOrMigrate);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    ShaderCacheIndexTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testKeyStability();
+    void testSaveLoad();
+    void testLegacyIndex();
+    void testFindOrMigrate();
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "state_log_test.hpp"
+#include "helper/state_log_writer.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+static const char *TEXT_NAME = "state_log_test.txt";
+static const char *BINARY_NAME = "state_log_test.bin";
+static const char *CONVERTED_NAME = "state_log_test_converted.txt";
+
+// What StateLogger writes for a few draws on two threads, with a state dump after each
+// function line. One dump is larger than a block of the binary writer.
+static void writeLog(const char *name, bool binary)
+{
+    StateLogWriter writer;
+    CPPUNIT_ASSERT(writer.open(name, binary));
+    for (unsigned i = 0; i < 100; i++)
+    {
+        const unsigned char tid = i % 3 == 0 ? 2 : 0;
+        const unsigned short funcId = (i % 2 == 0) ? 300 : 12;
+        const char *functionName = (funcId == 300) ? "glDrawElements" : "glDrawArrays";
+        writer.function(tid, funcId, functionName, i / 2, 1000 + i, i, i / 10);
+        std::string state = "Program: " + std::to_string(i) + "\nAttributes:\n    0 position vec4\n";
+        if (i == 50)
+        {
+            state.append(3 * 1024 * 1024 / 2, 'x');
+        }
+        writer.state(state);
+        if (i == 70)
+        {
+            writer.flush();
+        }
+    }
+    writer.close();
+    CPPUNIT_ASSERT(!writer.isOpen());
+}
+
+static std::string readFile(const char *name)
+{
+    std::string data;
+    FILE *fp = fopen(name, "rb");
+    CPPUNIT_ASSERT(fp);
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        data.append(buffer, n);
+    }
+    fclose(fp);
+    return data;
+}
+
+StateLogTest::StateLogTest()
+{
+}
+
+void StateLogTest::setUp()
+{
+}
+
+void StateLogTest::tearDown()
+{
+    remove(TEXT_NAME);
+    remove(BINARY_NAME);
+    remove(CONVERTED_NAME);
+}
+
+// A binary log converted to text is the text log of the same calls, byte for byte
+void StateLogTest::testBinaryMatchesText()
+{
+    writeLog(TEXT_NAME, false);
+    writeLog(BINARY_NAME, true);
+
+    FILE *in = fopen(BINARY_NAME, "rb");
+    FILE *out = fopen(CONVERTED_NAME, "wb");
+    CPPUNIT_ASSERT(in && out);
+    std::string error;
+    const bool ok = statelog::convertToText(in, out, error);
+    fclose(in);
+    fclose(out);
+    CPPUNIT_ASSERT(ok);
+    CPPUNIT_ASSERT(error.empty());
+
+    const std::string text = readFile(TEXT_NAME);
+    CPPUNIT_ASSERT(text.size() > 3 * 1024 * 1024 / 2);
+    CPPUNIT_ASSERT(text == readFile(CONVERTED_NAME));
+    CPPUNIT_ASSERT(readFile(BINARY_NAME).size() < text.size());
+}
+
+void StateLogTest::testBrokenLog()
+{
+    std::string error;
+    writeLog(TEXT_NAME, false);
+    FILE *in = fopen(TEXT_NAME, "rb");
+    FILE *out = fopen(CONVERTED_NAME, "wb");
+    CPPUNIT_ASSERT(!statelog::convertToText(in, out, error));
+    CPPUNIT_ASSERT(!error.empty());
+    fclose(in);
+    fclose(out);
+
+    // Cut off in the middle of a record
+    writeLog(BINARY_NAME, true);
+    const std::string binary = readFile(BINARY_NAME);
+    FILE *fp = fopen(BINARY_NAME, "wb");
+    fwrite(binary.data(), binary.size() - 10, 1, fp);
+    fclose(fp);
+    in = fopen(BINARY_NAME, "rb");
+    out = fopen(CONVERTED_NAME, "wb");
+    error.clear();
+    CPPUNIT_ASSERT(!statelog::convertToText(in, out, error));
+    CPPUNIT_ASSERT(!error.empty());
+    fclose(in);
+    fclose(out);
+}
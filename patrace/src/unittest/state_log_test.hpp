@@ -0,0 +1,25 @@
+#ifndef _INCLUDE_STATE_LOG_TEST_
+#define _INCLUDE_STATE_LOG_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class StateLogTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(StateLogTest);
+
+    CPPUNIT_TEST(testBinaryMatchesText);
+    CPPUNIT_TEST(testBrokenLog);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    StateLogTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testBinaryMatchesText();
+    void testBrokenLog();
+};
+
+#endif
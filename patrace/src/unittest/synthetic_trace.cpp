@@ -0,0 +1,126 @@
+#include "synthetic_trace.hpp"
+#include "common/api_info.hpp"
+#include "common/in_file_mt.hpp"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "json/writer.h"
+
+using namespace common;
+
+std::string syntheticTraceHeader(unsigned calls, unsigned frames, const std::vector<unsigned>& threads, const Json::Value& extra)
+{
+    Json::Value header = extra.isObject() ? extra : Json::Value(Json::objectValue);
+    header["defaultTid"] = threads.at(0);
+    header["glesVersion"] = 3;
+    header["callCnt"] = calls;
+    header["frameCnt"] = frames;
+    header["threads"] = Json::arrayValue;
+    for (unsigned tid : threads)
+    {
+        Json::Value thread;
+        thread["id"] = tid;
+        thread["EGLConfig"] = Json::objectValue;
+        thread["winW"] = 64;
+        thread["winH"] = 64;
+        header["threads"].append(thread);
+    }
+    Json::FastWriter writer;
+    return writer.write(header);
+}
+
+bool setSyntheticTraceVersion(const std::string& name, HeaderVersion version)
+{
+    FILE *fp = fopen(name.c_str(), "r+b");
+    if (!fp)
+    {
+        return false;
+    }
+    const unsigned value = version;
+    const bool ok = fseek(fp, offsetof(BHeaderV3, version), SEEK_SET) == 0 && fwrite(&value, sizeof(value), 1, fp) == 1;
+    fclose(fp);
+    return ok;
+}
+
+bool readSyntheticTrace(const std::string& name, const std::function<void(const TestCall&)>& visit, Json::Value *header)
+{
+    InFile in;
+    if (!in.Open(name.c_str()))
+    {
+        return false;
+    }
+    if (header)
+    {
+        *header = in.getJSONHeader();
+    }
+    bool ok = true;
+    void *fptr = nullptr;
+    BCall_vlen call;
+    char *src = nullptr;
+    TestCall c;
+    while (ok && in.GetNextCall(fptr, call, src))
+    {
+        const size_t size = (in.mExIdToLen[call.funcId] == 0) ? call.toNext - sizeof(BCall_vlen) : in.mExIdToLen[call.funcId] - sizeof(BCall);
+        ok = size % sizeof(uint32_t) == 0;
+        c.name = in.ExIdToName(call.funcId);
+        c.args.resize(size / sizeof(uint32_t));
+        memcpy(c.args.data(), src, c.args.size() * sizeof(uint32_t));
+        c.tid = call.tid;
+        c.injected = call.source > 0;
+        c.errNo = call.errNo;
+        if (ok) visit(c);
+    }
+    in.Close();
+    return ok;
+}
+
+bool readSyntheticTrace(const std::string& name, std::vector<TestCall>& calls, Json::Value *header)
+{
+    calls.clear();
+    return readSyntheticTrace(name, [&calls](const TestCall& call) { calls.push_back(call); }, header);
+}
+
+bool SyntheticTraceWriter::open(const std::string& name)
+{
+    mCalls = 0;
+    return mOut.Open(name.c_str(), true, nullptr, true);
+}
+
+bool SyntheticTraceWriter::write(const char *name, unsigned tid, const std::vector<uint32_t>& args)
+{
+    const unsigned short id = gApiInfo.NameToId(name);
+    const unsigned len = gApiInfo.IdToLenArr[id];
+    const size_t size = args.size() * sizeof(uint32_t);
+    char *dest = mOut.Scratch();
+    BCall_vlen call;
+    call.funcId = id;
+    call.tid = tid;
+    if (len == 0)
+    {
+        call.toNext = sizeof(BCall_vlen) + size;
+        memcpy(dest, &call, sizeof(BCall_vlen));
+        memcpy(dest + sizeof(BCall_vlen), args.data(), size);
+        mOut.Progress(call.toNext);
+    }
+    else if (len == sizeof(BCall) + size)
+    {
+        memcpy(dest, &call, sizeof(BCall));
+        memcpy(dest + sizeof(BCall), args.data(), size);
+        mOut.Progress(len);
+    }
+    else
+    {
+        return false;
+    }
+    mCalls++;
+    return true;
+}
+
+void SyntheticTraceWriter::close(unsigned frames, const std::vector<unsigned>& threads, const Json::Value& extra)
+{
+    const std::string header = syntheticTraceHeader(mCalls, frames, threads, extra);
+    mOut.WriteHeader(header.c_str(), header.size(), false);
+    mOut.Close();
+}
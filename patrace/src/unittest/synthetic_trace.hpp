@@ -0,0 +1,64 @@
+#ifndef _INCLUDE_SYNTHETIC_TRACE_
+#define _INCLUDE_SYNTHETIC_TRACE_
+
+// Writes small traces for tests and benchmarks, call by call. All arguments and return
+// values are given as 32 bit values, in the order they are stored in the trace.
+
+#include "common/out_file.hpp"
+#include "json/value.h"
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// A call as it is written to or read back from a synthetic trace
+struct TestCall
+{
+    std::string name;
+    std::vector<uint32_t> args;  // including the return value
+    unsigned tid = 0;
+    bool injected = false;
+    unsigned errNo = 0;          // only set when read back
+
+    bool operator==(const TestCall& other) const
+    {
+        return name == other.name && args == other.args && tid == other.tid && injected == other.injected && errNo == other.errNo;
+    }
+};
+
+/// JSON header of a synthetic trace. The first of threads is the default thread, and the
+/// members of extra, such as "timestamping", are added as they are.
+std::string syntheticTraceHeader(unsigned calls, unsigned frames, const std::vector<unsigned>& threads = { 0 }, const Json::Value& extra = Json::Value());
+
+/// Changes the format version in the header of a trace that has been written, for traces
+/// whose calls were written in the encoding of an older version
+bool setSyntheticTraceVersion(const std::string& name, common::HeaderVersion version);
+
+/// Reads a trace call by call, into visit(), with the arguments split into 32 bit values the
+/// way SyntheticTraceWriter::write() takes them. The JSON header goes into header if given.
+/// Returns false if the file cannot be opened or a call is not made of 32 bit values.
+bool readSyntheticTrace(const std::string& name, const std::function<void(const TestCall&)>& visit, Json::Value *header = nullptr);
+/// Reads all calls of a trace
+bool readSyntheticTrace(const std::string& name, std::vector<TestCall>& calls, Json::Value *header = nullptr);
+
+class SyntheticTraceWriter
+{
+public:
+    /// Returns false if the file cannot be opened
+    bool open(const std::string& name);
+    /// Returns false, and writes nothing, if args do not fill the arguments of a function of fixed size
+    bool write(const char *name, unsigned tid, const std::vector<uint32_t>& args);
+    bool write(const TestCall& call) { return write(call.name.c_str(), call.tid, call.args); }
+    /// Writes the header with syntheticTraceHeader() and closes the file
+    void close(unsigned frames, const std::vector<unsigned>& threads = { 0 }, const Json::Value& extra = Json::Value());
+
+    unsigned calls() const { return mCalls; }
+    common::OutFile& out() { return mOut; }
+
+private:
+    common::OutFile mOut;
+    unsigned mCalls = 0;
+};
+
+#endif
@@ -4,6 +4,22 @@
 #include "context_test.hpp"
 #include "system_test.hpp"
 #include "image_test.hpp"
+#include "frame_times_test.hpp"
+#include "yuv_convert_test.hpp"
+#include "trace_merger_test.hpp"
+#include "dirty_pages_test.hpp"
+#include "call_recorder_test.hpp"
+#include "glsl_cache_test.hpp"
+#include "trace_command_emitter_test.hpp"
+#include "fill_scan_test.hpp"
+#include "thread_flattener_test.hpp"
+#include "shader_cache_index_test.hpp"
+#include "image_diff_test.hpp"
+#include "image_png_test.hpp"
+#include "timestamp_analysis_test.hpp"
+#include "deduplication_test.hpp"
+#include "converter_test.hpp"
+#include "state_log_test.hpp"
 
 #define TEST(name) \
 /* Registers the fixture into the "all tests" registry */ \
@@ -17,3 +33,19 @@ TEST(MemoryTest)
 TEST(ContextTest)
 TEST(SystemTest)
 TEST(ImageTest)
+TEST(FrameTimesTest)
+TEST(YuvConvertTest)
+TEST(TraceMergerTest)
+TEST(DirtyPagesTest)
+TEST(CallRecorderTest)
+TEST(GLSLCacheTest)
+TEST(TraceCommandEmitterTest)
+TEST(FillScanTest)
+TEST(ThreadFlattenerTest)
+TEST(ShaderCacheIndexTest)
+TEST(ImageDiffTest)
+TEST(ImagePngTest)
+TEST(TimestampAnalysisTest)
+TEST(DeduplicationTest)
+TEST(ConverterTest)
+TEST(StateLogTest)
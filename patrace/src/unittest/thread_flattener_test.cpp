@@ -0,0 +1,616 @@
+#include "thread_flattener_test.hpp"
+#include "tool/thread_flattener.hpp"
+#include "tool/utils.hpp"
+#include "common/in_file_mt.hpp"
+#include "common/parse_api.hpp"
+#include "common/trace_model.hpp"
+#include "synthetic_trace.hpp"
+#include "json/writer.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static const uint32_t EGL_TRUE_ = 1;
+static const uint32_t GL_TRIANGLES_ = 0x0004;
+static const uint32_t GL_UNSIGNED_SHORT_ = 0x1403;
+static const uint32_t GL_SYNC_GPU_COMMANDS_COMPLETE_ = 0x9117;
+static const uint32_t GL_ALREADY_SIGNALED_ = 0x911A;
+static const uint32_t CSB_BASE = 10000000;
+
+struct SyntheticTrace
+{
+    std::vector<unsigned> threads;  // as listed in the header, the first is the default thread
+    std::vector<TestCall> calls;
+
+    void add(const char *name, unsigned tid, const std::vector<uint32_t>& args)
+    {
+        calls.push_back({ name, args, tid });
+    }
+};
+
+static void writeTrace(const std::string& name, const SyntheticTrace& trace)
+{
+    SyntheticTraceWriter writer;
+    CPPUNIT_ASSERT(writer.open(name));
+    for (const TestCall& call : trace.calls)
+    {
+        CPPUNIT_ASSERT(writer.write(call));
+    }
+    writer.close(1, trace.threads);
+}
+
+// The flattening of flatten_threads before it was made parallel, kept as the reference
+// that the output of flattenThreads() must match byte for byte. Only the command line
+// handling and the logging are left out.
+namespace reference {
+
+const unsigned int CSB_THREAD_REMAP_BASE = 10000000;
+
+struct thread_state
+{
+    int display = -1;
+    int draw = -1;
+    int read = -1;
+    int context = -1;
+};
+
+static const std::vector<std::string> ignored_funcs = {
+    "glGetSynciv",
+    "glFenceSync",
+    "glDeleteSync",
+    "glWaitSync",
+    "glClientWaitSync",
+    "glIsSync",
+    "eglTerminate", // to make sure eglTerminate gets called last
+    "eglReleaseThread",
+};
+
+static void writeout(OutFile &outputFile, CallTM *call, bool injected)
+{
+    static std::vector<char> buffer(1024 * 1024);
+    char *dest = call->Serialize(buffer.data(), -1, injected);
+    outputFile.Write(buffer.data(), dest - buffer.data());
+}
+
+static unsigned int remap_csb_handle(unsigned int idx, unsigned int name)
+{
+    CPPUNIT_ASSERT(name < CSB_THREAD_REMAP_BASE);
+    return (name == 0) ? 0 : (name + idx * CSB_THREAD_REMAP_BASE);
+}
+
+static void remapArg(unsigned int idx, CallTM *call, unsigned arg)
+{
+    if (call->mArgs[arg]->IsClientSideBufferReference())
+    {
+        const unsigned int name = call->mArgs[arg]->mOpaqueIns->mClientSideBufferName;
+        call->mArgs[arg]->mOpaqueIns->mClientSideBufferName = remap_csb_handle(idx, name);
+    }
+}
+
+static void clientSideBufferRemap(unsigned int idx, CallTM *call)
+{
+    const std::string& name = call->mCallName;
+    if (name == "glCreateClientSideBuffer")
+    {
+        call->mRet.SetAsUInt(remap_csb_handle(idx, call->mRet.GetAsUInt()));
+    }
+    if (name == "glDeleteClientSideBuffer" || name == "glClientSideBufferData" || name == "glClientSideBufferSubData")
+    {
+        call->mArgs[0]->SetAsUInt(remap_csb_handle(idx, call->mArgs[0]->GetAsUInt()));
+    }
+    if (name == "glCopyClientSideBuffer")
+    {
+        call->mArgs[1]->SetAsUInt(remap_csb_handle(idx, call->mArgs[1]->GetAsUInt()));
+    }
+    if (name == "glObjectPtrLabelKHR" || name == "glObjectPtrLabel")
+    {
+        remapArg(idx, call, 0);
+    }
+    if (name == "glDrawArraysIndirect" || name == "glMapBufferOES")
+    {
+        remapArg(idx, call, 1);
+    }
+    if (name == "glNormalPointer" || name == "glPointSizePointerOES" || name == "glDrawElementsIndirect")
+    {
+        remapArg(idx, call, 2);
+    }
+    if (name == "glDrawElements" || name == "glTexCoordPointer" || name == "glVertexPointer" || name == "glMatrixIndexPointerOES" || name == "glWeightPointerOES"
+        || name == "glDrawElementsBaseVertex" || name == "glDrawElementsInstancedBaseVertex" || name == "glDrawElementsBaseVertexOES" || name == "glDrawElementsInstancedBaseVertexOES"
+        || name == "glDrawElementsBaseVertexEXT" || name == "glDrawElementsInstancedBaseVertexEXT" || name == "glDrawElementsInstancedBaseInstanceEXT"
+        || name == "glDrawElementsInstancedBaseVertexBaseInstanceEXT" || name == "glDrawElementsInstanced" || name == "glMapBufferRange" || name == "glColorPointer")
+    {
+        remapArg(idx, call, 3);
+    }
+    if (name == "glVertexAttribIPointer")
+    {
+        remapArg(idx, call, 4);
+    }
+    if (name == "glVertexAttribPointer" || name == "glDrawRangeElementsBaseVertex" || name == "glDrawRangeElementsBaseVertexOES" || name == "glDrawRangeElementsBaseVertexEXT"
+        || name == "glDrawRangeElements")
+    {
+        remapArg(idx, call, 5);
+    }
+}
+
+static void flatten(const std::string& input, const std::string& output, const FlattenOptions& options, FlattenResult& result)
+{
+    TraceFileTM inputFile;
+    gApiInfo.RegisterEntries(parse_callbacks);
+    CPPUNIT_ASSERT(inputFile.Open(input.c_str()));
+    unsigned curFrameIndex = 0;
+    unsigned curCallIndexInFrame = 0;
+    FrameTM *curFrame = inputFile.mFrames[0];
+    curFrame->LoadCalls(inputFile.mpInFileRA);
+    auto next_call = [&]() -> CallTM* {
+        if (curCallIndexInFrame >= curFrame->GetLoadedCallCount())
+        {
+            curFrameIndex++;
+            if (curFrameIndex >= inputFile.mFrames.size())
+                return NULL;
+            curFrame->UnloadCalls();
+            curFrame = inputFile.mFrames[curFrameIndex];
+            curFrame->LoadCalls(inputFile.mpInFileRA);
+            curCallIndexInFrame = 0;
+        }
+        return curFrame->mCalls[curCallIndexInFrame++];
+    };
+
+    OutFile outputFile;
+    CPPUNIT_ASSERT(outputFile.Open(output.c_str()));
+
+    Json::Value info;
+    if (options.forceSingleWindow) info["addForceSingleWindow"] = true;
+    if (options.lastFrame != -1) info["framerange"] = std::to_string(options.firstFrame) + "-" + std::to_string(options.lastFrame);
+    if (options.inSequence) info["insequence"] = true;
+
+    Json::Value header = inputFile.mpInFileRA->getJSONHeader();
+    Json::Value threadArray = header["threads"];
+    unsigned numThreads = threadArray.size();
+    CPPUNIT_ASSERT(numThreads > 0);
+    std::vector<std::list<CallTM*>> calls(numThreads);
+    std::map<unsigned, thread_state> contexts;
+    std::map<unsigned, unsigned> tid_remapping; // because thread IDs may be discontinuous
+    int display = -1;
+    for (unsigned i = 0; i < numThreads; i++)
+    {
+        const unsigned tid = threadArray[i]["id"].asUInt();
+        tid_remapping[tid] = i;
+        contexts[tid] = thread_state();
+    }
+    Json::Value newThreadArray = Json::Value(Json::arrayValue);
+    for (auto &a : threadArray) // only use defaultTid's thread info
+    {
+        if (a["id"] == header["defaultTid"])
+        {
+            a["id"] = 0;
+            newThreadArray.append(a);
+        }
+    }
+    header["defaultTid"] = 0;
+    if (options.forceSingleWindow)
+    {
+        header["forceSingleWindow"] = true;
+    }
+    header["threads"] = newThreadArray;
+
+    auto makeCurrent = [](const thread_state& context, CallTM& call) {
+        call.mArgs.push_back(new ValueTM(context.display));
+        call.mArgs.push_back(new ValueTM(context.draw));
+        call.mArgs.push_back(new ValueTM(context.read));
+        call.mArgs.push_back(new ValueTM(context.context));
+        call.mRet = ValueTM((int)EGL_TRUE_);
+    };
+    auto inRange = [&]() { return options.lastFrame != -1 && (int)curFrameIndex >= options.firstFrame && (int)curFrameIndex <= options.lastFrame; };
+
+    CallTM *call = NULL;
+    std::map<unsigned, thread_state> initial_contexts = contexts;
+    unsigned int previous_tid = 9999;
+    bool injected = false;
+    bool force_out = false;
+    int prev_injected = -1;
+    for (int callNo = 0; (call = next_call()); ++callNo)
+    {
+        const unsigned tid = call->mTid;
+        if (callNo == 0)
+        {
+            previous_tid = tid;
+        }
+        if (tid != previous_tid)
+        {
+            injected = false;
+            previous_tid = tid;
+        }
+        if (tid_remapping.count(tid) == 0)
+        {
+            tid_remapping[tid] = numThreads;
+            initial_contexts[tid] = contexts[tid] = thread_state();
+            numThreads++;
+            calls.resize(numThreads);
+        }
+        const unsigned idx = tid_remapping.at(tid);
+        if (options.onlyThreads.size() > 0 && options.onlyThreads.count(tid) == 0 && call->mCallName != "eglInitialize")
+        {
+            continue;
+        }
+
+        if (options.reindexClientSideBuffers)
+        {
+            clientSideBufferRemap(idx, call);
+        }
+
+        if (call->mCallName == "eglMakeCurrent")
+        {
+            auto &context = contexts[call->mTid];
+            context.display = call->mArgs[0]->GetAsInt();
+            context.draw = call->mArgs[1]->GetAsInt();
+            context.read = call->mArgs[2]->GetAsInt();
+            context.context = call->mArgs[3]->GetAsInt();
+            CPPUNIT_ASSERT(context.display != -1);
+            CPPUNIT_ASSERT(context.display == display || display == -1);
+            display = context.display;
+        }
+        else if (call->mCallName[0] != 'e') // sanity check
+        {
+            CPPUNIT_ASSERT(contexts.at(call->mTid).display != -1);
+        }
+
+        if (call->mCallName == "glWaitSync" || call->mCallName == "glFinish" || call->mCallName == "glClientWaitSync")
+        {
+            force_out = true;
+        }
+
+        if (std::find(ignored_funcs.cbegin(), ignored_funcs.cend(), call->mCallName) == ignored_funcs.cend())
+        {
+            calls[idx].push_back(call);
+        }
+        else
+        {
+            result.skipped++;
+        }
+
+        if (options.inSequence)
+        {
+            const auto &context = contexts.at(call->mTid);
+            if (!injected && call->mCallName == "eglMakeCurrent")
+            {
+                // Special case. The app supplied eglMakeCurrent takes priority.
+                injected = true;
+            }
+            else if (callNeedsContext(call->mCallName) && !injected)
+            {
+                if (context.display != -1)
+                {
+                    CallTM inject("eglMakeCurrent");
+                    makeCurrent(context, inject);
+                    inject.mTid = 0;
+                    injected = true;
+                    result.injected++;
+                    if (inRange()) result.injectedInRange++;
+                    writeout(outputFile, &inject, true);
+                }
+            }
+            call->mTid = 0;
+            writeout(outputFile, call, false);
+        }
+        else if (curCallIndexInFrame >= curFrame->GetLoadedCallCount() || force_out) // flush calls
+        {
+            force_out = false;
+            bool any_injected = false;
+            for (auto &thread : calls)
+            {
+                if (thread.size() == 0)
+                {
+                    continue;
+                }
+                const auto &context = initial_contexts.at(thread.front()->mTid);
+                CallTM inject("eglMakeCurrent");
+                makeCurrent(context, inject);
+                bool threadInjected = false;
+                for (auto &out : thread)
+                {
+                    if (!threadInjected && out->mCallName == "eglMakeCurrent")
+                    {
+                        // Special case. The app supplied eglMakeCurrent takes priority.
+                        threadInjected = true;
+                    }
+                    else if (callNeedsContext(out->mCallName) && !threadInjected)
+                    {
+                        if (inRange()) result.injectedInRange++;
+                        writeout(outputFile, &inject, true);
+                        threadInjected = true;
+                        result.injected++;
+                        any_injected = true;
+                    }
+                    out->mTid = 0;
+                    writeout(outputFile, out, false);
+                }
+                thread.clear();
+            }
+            // The context of the latest eglMakeCurrent before each frame+thread is the
+            // one to restore, until the thread makes another one current itself
+            initial_contexts = contexts;
+
+            if (any_injected && prev_injected != -1 && static_cast<int>(curFrameIndex) - prev_injected > 100)
+            {
+                result.nonInjectedRanges.push_back(std::make_pair(prev_injected, static_cast<int>(curFrameIndex) - 1));
+            }
+            if (any_injected)
+            {
+                prev_injected = curFrameIndex;
+            }
+        }
+    }
+
+    CallTM eglTerminate("eglTerminate");
+    eglTerminate.mArgs.push_back(new ValueTM(display));
+    eglTerminate.mRet = ValueTM((int)EGL_TRUE_);
+    writeout(outputFile, &eglTerminate, false);
+
+    info["injected_total"] = result.injected;
+    if (options.lastFrame != -1)
+    {
+        info["injected_eglMakeCurrent_in_framerange"] = result.injectedInRange;
+    }
+    addConversionEntry(header, "flatten_threads", input, info);
+    Json::FastWriter writer;
+    const std::string json_header = writer.write(header);
+    outputFile.mHeader.jsonLength = json_header.size();
+    outputFile.WriteHeader(json_header.c_str(), json_header.size());
+
+    inputFile.Close();
+    outputFile.Close();
+
+    // Only reported without a frame range
+    prev_injected = std::max(0, prev_injected);
+    if (options.lastFrame == -1 && static_cast<int>(curFrameIndex) - prev_injected > 100)
+    {
+        result.nonInjectedRanges.push_back(std::make_pair(prev_injected, static_cast<int>(curFrameIndex) - 1));
+    }
+}
+
+}
+
+static std::vector<TestCall> flatten(const SyntheticTrace& trace, const FlattenOptions& options, FlattenResult& result)
+{
+    const std::string input = "thread_flattener_test.pat";
+    const std::string output = "thread_flattener_test_flat.pat";
+    writeTrace(input, trace);
+    CPPUNIT_ASSERT(flattenThreads(input, output, options, &result));
+
+    std::vector<TestCall> calls;
+    Json::Value header;
+    CPPUNIT_ASSERT(readSyntheticTrace(output, calls, &header));
+    CPPUNIT_ASSERT(header["defaultTid"].asUInt() == 0);
+    CPPUNIT_ASSERT(header["threads"].size() == 1);
+    for (const TestCall& call : calls)
+    {
+        CPPUNIT_ASSERT(call.errNo == 0);
+    }
+    unlink(input.c_str());
+    unlink(output.c_str());
+    return calls;
+}
+
+// The calls of a trace as the name of the function, followed by the bytes of the call
+// after the function id
+static std::vector<std::string> rawCalls(const std::string& name, Json::Value& header)
+{
+    std::vector<std::string> calls;
+    InFile in;
+    CPPUNIT_ASSERT(in.Open(name.c_str()));
+    header = in.getJSONHeader();
+    void *fptr = nullptr;
+    BCall_vlen call;
+    char *src = nullptr;
+    while (in.GetNextCall(fptr, call, src))
+    {
+        const bool vlen = in.mExIdToLen[call.funcId] == 0;
+        const size_t size = vlen ? call.toNext - sizeof(BCall_vlen) : in.mExIdToLen[call.funcId] - sizeof(BCall);
+        std::string raw = in.ExIdToName(call.funcId);
+        raw.append(1, '\0');
+        raw.append((const char*)&call + sizeof(call.funcId), (vlen ? sizeof(BCall_vlen) : sizeof(BCall)) - sizeof(call.funcId));
+        raw.append(src, size);
+        calls.push_back(raw);
+    }
+    in.Close();
+    return calls;
+}
+
+// Flattens with flattenThreads() and with the reference, and checks that both give the
+// same calls byte for byte, and the same header
+static void checkFlatten(const SyntheticTrace& trace, const FlattenOptions& options)
+{
+    const std::string input = "thread_flattener_test.pat";
+    const std::string output = "thread_flattener_test_flat.pat";
+    const std::string expectedOutput = "thread_flattener_test_reference.pat";
+    writeTrace(input, trace);
+    FlattenResult result;
+    CPPUNIT_ASSERT(flattenThreads(input, output, options, &result));
+    FlattenResult expectedResult;
+    reference::flatten(input, expectedOutput, options, expectedResult);
+
+    Json::Value header;
+    Json::Value expectedHeader;
+    const std::vector<std::string> calls = rawCalls(output, header);
+    const std::vector<std::string> expected = rawCalls(expectedOutput, expectedHeader);
+    CPPUNIT_ASSERT_EQUAL(expected.size(), calls.size());
+    for (size_t i = 0; i < calls.size(); ++i)
+    {
+        CPPUNIT_ASSERT(expected[i] == calls[i]);
+    }
+    // The conversion entries differ only in when they were made
+    CPPUNIT_ASSERT(header["conversions"][0]["info"] == expectedHeader["conversions"][0]["info"]);
+    header.removeMember("conversions");
+    expectedHeader.removeMember("conversions");
+    CPPUNIT_ASSERT(header == expectedHeader);
+
+    CPPUNIT_ASSERT_EQUAL(expectedResult.injected, result.injected);
+    CPPUNIT_ASSERT_EQUAL(expectedResult.injectedInRange, result.injectedInRange);
+    CPPUNIT_ASSERT_EQUAL(expectedResult.skipped, result.skipped);
+    if (options.lastFrame == -1)
+    {
+        CPPUNIT_ASSERT(expectedResult.nonInjectedRanges == result.nonInjectedRanges);
+    }
+
+    for (const std::string& name : { input, input + ".ra", output, expectedOutput })
+    {
+        unlink(name.c_str());
+    }
+}
+
+// Threads listed in an order that differs from their ids, and one thread that the header misses.
+// Each thread makes a context current first, then draws, waits, switches contexts and
+// creates and uses client side buffers at random.
+static SyntheticTrace randomTrace(unsigned seed, int frames)
+{
+    unsigned state = seed;
+    auto random = [&state]() { state = state * 1103515245 + 12345; return (state >> 16) & 0x7fff; };
+
+    SyntheticTrace trace;
+    trace.threads = { 0, 4, 2 };
+    const unsigned tids[] = { 0, 4, 2, 6 };
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        trace.add("eglMakeCurrent", tids[i], { 1, 1 + i, 1 + i, 10 + i, EGL_TRUE_ });
+    }
+    uint32_t buffers = 1;
+    uint32_t syncs = 100;
+    for (int f = 0; f < frames; ++f)
+    {
+        const int calls = 10 + random() % 50;
+        for (int i = 0; i < calls; ++i)
+        {
+            const unsigned tid = tids[random() % 4];
+            switch (random() % 12)
+            {
+            case 0:
+                if (random() % 4 == 0) trace.add("glFinish", tid, {});
+                break;
+            case 1:
+                trace.add("glFenceSync", tid, { GL_SYNC_GPU_COMMANDS_COMPLETE_, 0, syncs, 0 });
+                if (random() % 3 == 0) trace.add("glClientWaitSync", tid, { syncs, 0, 1, 1000, 0, GL_ALREADY_SIGNALED_ });
+                syncs++;
+                break;
+            case 2:
+                if (random() % 2 == 0) trace.add("eglMakeCurrent", tid, { 1, 1 + random() % 4, 1 + random() % 4, 10 + random() % 4, EGL_TRUE_ });
+                break;
+            case 3:
+                trace.add("glCreateClientSideBuffer", tid, { buffers++ });
+                break;
+            case 4:
+                trace.add("glDrawElements", tid, { GL_TRIANGLES_, 3, GL_UNSIGNED_SHORT_, ClientSideBufferObjectReferenceType, random() % buffers, 4 });
+                break;
+            case 5:
+                trace.add("glDrawElements", tid, { GL_TRIANGLES_, 3, GL_UNSIGNED_SHORT_, BufferObjectReferenceType, 16 });
+                break;
+            case 6:
+                // Swaps of other threads do not end frames
+                trace.add("eglSwapBuffers", tid, { 1, tid + 1, EGL_TRUE_ });
+                break;
+            default:
+                trace.add("glDrawArrays", tid, { GL_TRIANGLES_, tid, (uint32_t)i });
+                break;
+            }
+        }
+        trace.add("eglSwapBuffers", 0, { 1, 1, EGL_TRUE_ });
+    }
+    // Calls after the last frame
+    trace.add("glDrawArrays", 4, { GL_TRIANGLES_, 0, 3 });
+    trace.add("glDrawArrays", 0, { GL_TRIANGLES_, 0, 3 });
+    return trace;
+}
+
+ThreadFlattenerTest::ThreadFlattenerTest()
+{
+}
+
+void ThreadFlattenerTest::setUp()
+{
+}
+
+void ThreadFlattenerTest::tearDown()
+{
+}
+
+void ThreadFlattenerTest::testInjection()
+{
+    SyntheticTrace trace;
+    trace.threads = { 0, 5 };
+    trace.add("eglMakeCurrent", 0, { 1, 1, 1, 10, EGL_TRUE_ });
+    trace.add("eglMakeCurrent", 5, { 1, 2, 2, 20, EGL_TRUE_ });
+    trace.add("glDrawArrays", 5, { GL_TRIANGLES_, 0, 1 });
+    trace.add("glDrawArrays", 0, { GL_TRIANGLES_, 0, 2 });
+    trace.add("eglSwapBuffers", 0, { 1, 1, EGL_TRUE_ });
+    trace.add("glDrawArrays", 5, { GL_TRIANGLES_, 0, 3 });
+    trace.add("glFenceSync", 0, { GL_SYNC_GPU_COMMANDS_COMPLETE_, 0, 100, 0 });
+    trace.add("glDrawArrays", 0, { GL_TRIANGLES_, 0, 4 });
+    trace.add("glFinish", 5, {});
+    trace.add("eglMakeCurrent", 0, { 1, 1, 1, 11, EGL_TRUE_ });
+    trace.add("glDrawArrays", 0, { GL_TRIANGLES_, 0, 5 });
+
+    FlattenOptions options;
+    FlattenResult result;
+    const std::vector<TestCall> calls = flatten(trace, options, result);
+    const std::vector<std::pair<std::string, uint32_t>> expected = {
+        // Frame 0, thread 0 and then thread 5
+        { "eglMakeCurrent", 10 }, { "glDrawArrays", 2 }, { "eglSwapBuffers", 1 },
+        { "eglMakeCurrent", 20 }, { "glDrawArrays", 1 },
+        // Up to glFinish, each thread gets its context back, glFenceSync is dropped
+        { "eglMakeCurrent", 10 }, { "glDrawArrays", 4 },
+        { "eglMakeCurrent", 20 }, { "glDrawArrays", 3 }, { "glFinish", 0 },
+        // The thread makes a context current itself
+        { "eglMakeCurrent", 11 }, { "glDrawArrays", 5 },
+        { "eglTerminate", EGL_TRUE_ },
+    };
+    CPPUNIT_ASSERT_EQUAL(expected.size(), calls.size());
+    for (size_t i = 0; i < calls.size(); ++i)
+    {
+        CPPUNIT_ASSERT_EQUAL(expected[i].first, calls[i].name);
+        const uint32_t value = (calls[i].name == "eglMakeCurrent") ? calls[i].args[3] : (calls[i].args.empty() ? 0 : calls[i].args.back());
+        CPPUNIT_ASSERT_EQUAL(expected[i].second, value);
+        CPPUNIT_ASSERT(calls[i].injected == (i == 5 || i == 7));
+    }
+    CPPUNIT_ASSERT_EQUAL(2, result.injected);
+    CPPUNIT_ASSERT_EQUAL(1, result.skipped);
+    CPPUNIT_ASSERT_EQUAL(2u, result.frames);
+
+    checkFlatten(trace, options);
+}
+
+// The same output no matter how many workers the threads are spread over
+void ThreadFlattenerTest::testRandomTraces()
+{
+    for (unsigned seed = 1; seed <= 3; ++seed)
+    {
+        const SyntheticTrace trace = randomTrace(seed, 200);
+        for (unsigned workers : { 1, 2, 4 })
+        {
+            FlattenOptions options;
+            options.workers = workers;
+            checkFlatten(trace, options);
+        }
+        FlattenOptions options;
+        options.firstFrame = 20;
+        options.lastFrame = 120;
+        options.forceSingleWindow = true;
+        checkFlatten(trace, options);
+        options.inSequence = true;
+        checkFlatten(trace, options);
+    }
+}
+
+void ThreadFlattenerTest::testClientSideBuffers()
+{
+    const SyntheticTrace trace = randomTrace(7, 50);
+    FlattenOptions options;
+    checkFlatten(trace, options);
+    options.reindexClientSideBuffers = false;
+    checkFlatten(trace, options);
+}
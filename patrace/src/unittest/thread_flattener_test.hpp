@@ -0,0 +1,27 @@
+#ifndef _INCLUDE_THREAD_FLATTENER_TEST_
+#define _INCLUDE_THREAD_FLATTENER_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ThreadFlattenerTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(ThreadFlattenerTest);
+
+    CPPUNIT_TEST(testInjection);
+    CPPUNIT_TEST(testRandomTraces);
+    CPPUNIT_TEST(testClientSideBuffers);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    ThreadFlattenerTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testInjection();
+    void testRandomTraces();
+    void testClientSideBuffers();
+};
+
+#endif
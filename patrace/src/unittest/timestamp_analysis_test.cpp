@@ -0,0 +1,271 @@
+#include "timestamp_analysis_test.hpp"
+#include "tool/timestamp_analysis.hpp"
+#include "retracer/frame_pacer.hpp"
+#include "synthetic_trace.hpp"
+
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static const char *TRACE_NAME = "timestamp_analysis_test.pat";
+static const uint64_t START = 1000000000ull;
+
+// Times in nanoseconds of a synthetic frame: the idle gap after the swap before it,
+// the time up to the return of each draw call, and the time spent in the swap
+struct SyntheticFrame
+{
+    uint64_t gap;
+    std::vector<uint64_t> draws;
+    uint64_t swap;
+};
+
+static std::vector<SyntheticFrame> randomFrames(unsigned count)
+{
+    unsigned state = 4321;
+    auto random = [&state](unsigned range) { state = state * 1103515245 + 12345; return ((state >> 8) & 0xffffff) % range; };
+    std::vector<SyntheticFrame> frames(count);
+    for (SyntheticFrame& f : frames)
+    {
+        f.gap = 1000000 + random(8000000);
+        f.draws.resize(1 + random(20));
+        for (uint64_t& d : f.draws) d = 20000 + random(500000);
+        f.swap = 100000 + random(16000000);
+    }
+    return frames;
+}
+
+// Writes the frames the way the tracer does with timestamping, with the time a call
+// returned in a paTimestamp call in front of it. glGetError has no timestamp.
+static void writeTrace(const std::vector<SyntheticFrame>& frames)
+{
+    SyntheticTraceWriter out;
+    CPPUNIT_ASSERT(out.open(TRACE_NAME));
+    uint64_t time = START;
+    auto stamp = [&]() { CPPUNIT_ASSERT(out.write("paTimestamp", 0, { (uint32_t)time, (uint32_t)(time >> 32) })); };
+    auto call = [&](const char *name, const std::vector<uint32_t>& args) { CPPUNIT_ASSERT(out.write(name, 0, args)); };
+
+    for (unsigned i = 0; i < frames.size(); i++)
+    {
+        const SyntheticFrame& f = frames[i];
+        if (i > 0) time += f.gap; // the trace starts with the first timestamp
+        stamp();
+        call("glClear", { 0x4000 });
+        for (uint64_t d : f.draws)
+        {
+            time += d;
+            stamp();
+            call("glDrawArrays", { 4, 0, 3 });
+            call("glGetError", { 0 });
+        }
+        time += f.swap;
+        stamp();
+        call("eglSwapBuffers", { 1, 1, 1 });
+    }
+    // Calls after the last swap, which do not make a frame
+    time += 5000000;
+    stamp();
+    call("glClear", { 0x4000 });
+
+    Json::Value extra;
+    extra["timestamping"] = true;
+    out.close(frames.size(), { 0 }, extra);
+}
+
+// Reads the trace back, feeding the analysis as analyze_trace does, and collecting the
+// timestamps of the swaps as the retracer does for -pace
+static void readTrace(TimestampAnalysis& analysis, std::vector<uint64_t>& swaps)
+{
+    uint64_t last = 0;
+    Json::Value header;
+    CPPUNIT_ASSERT(readSyntheticTrace(TRACE_NAME, [&](const TestCall& call)
+    {
+        if (call.name == "paTimestamp")
+        {
+            last = call.args.at(0) | (uint64_t)call.args.at(1) << 32;
+            analysis.timestamp(last);
+            return;
+        }
+        const bool swap = call.name.compare(0, 14, "eglSwapBuffers") == 0;
+        analysis.call(call.name, swap);
+        if (swap) swaps.push_back(last);
+    }, &header));
+    CPPUNIT_ASSERT(header["timestamping"].asBool());
+}
+
+TimestampAnalysisTest::TimestampAnalysisTest()
+{
+}
+
+void TimestampAnalysisTest::setUp()
+{
+}
+
+void TimestampAnalysisTest::tearDown()
+{
+    unlink(TRACE_NAME);
+}
+
+void TimestampAnalysisTest::testFrames()
+{
+    const std::vector<SyntheticFrame> frames = randomFrames(50);
+    writeTrace(frames);
+    TimestampAnalysis analysis;
+    std::vector<uint64_t> swaps;
+    readTrace(analysis, swaps);
+
+    CPPUNIT_ASSERT(!analysis.empty());
+    CPPUNIT_ASSERT(analysis.frames().size() == frames.size());
+    uint64_t start = 0;
+    uint64_t timestamps = 0;
+    for (unsigned i = 0; i < frames.size(); i++)
+    {
+        const SyntheticFrame& f = frames[i];
+        const TimestampFrame& t = analysis.frames()[i];
+        uint64_t duration = (i > 0 ? f.gap : 0) + f.swap;
+        for (uint64_t d : f.draws) duration += d;
+        CPPUNIT_ASSERT(t.frame == i);
+        CPPUNIT_ASSERT(t.start == start);
+        CPPUNIT_ASSERT(t.duration == duration);
+        CPPUNIT_ASSERT(t.gap == (i > 0 ? f.gap : 0)); // nothing is known before the first timestamp
+        CPPUNIT_ASSERT(t.calls == f.draws.size() + 2);
+        CPPUNIT_ASSERT(swaps[i] == START + start + duration);
+        start += duration;
+        timestamps += f.draws.size() + 2;
+    }
+    CPPUNIT_ASSERT(analysis.timestamps() == timestamps + 1);
+    CPPUNIT_ASSERT(analysis.duration() == start + 5000000);
+
+    const Json::Value json = analysis.json();
+    CPPUNIT_ASSERT(json["frames"].asUInt() == frames.size());
+    CPPUNIT_ASSERT(json["frame_ms"]["min"].asDouble() <= json["frame_ms"]["median"].asDouble());
+    CPPUNIT_ASSERT(json["frame_ms"]["median"].asDouble() <= json["frame_ms"]["max"].asDouble());
+    CPPUNIT_ASSERT(json["gap_ms"]["max"].asDouble() < 9.0);
+}
+
+void TimestampAnalysisTest::testCalls()
+{
+    const std::vector<SyntheticFrame> frames = randomFrames(20);
+    writeTrace(frames);
+    TimestampAnalysis analysis;
+    std::vector<uint64_t> swaps;
+    readTrace(analysis, swaps);
+
+    uint64_t clear = 5000000; // the glClear after the last swap
+    uint64_t draws = 0;
+    uint64_t drawCount = 0;
+    uint64_t swap = 0;
+    uint64_t maxSwap = 0;
+    for (unsigned i = 0; i < frames.size(); i++)
+    {
+        if (i > 0) clear += frames[i].gap;
+        for (uint64_t d : frames[i].draws) draws += d;
+        drawCount += frames[i].draws.size();
+        swap += frames[i].swap;
+        maxSwap = std::max(maxSwap, frames[i].swap);
+    }
+
+    // Functions without timestamps of their own are not listed
+    const std::vector<TimestampCallStats> calls = analysis.calls();
+    CPPUNIT_ASSERT(calls.size() == 3);
+    for (unsigned i = 1; i < calls.size(); i++)
+    {
+        CPPUNIT_ASSERT(calls[i - 1].total >= calls[i].total);
+    }
+    uint64_t total = 0;
+    for (const TimestampCallStats& c : calls)
+    {
+        if (c.name == "glClear")
+        {
+            CPPUNIT_ASSERT(c.count == frames.size() + 1);
+            CPPUNIT_ASSERT(c.total == clear);
+        }
+        else if (c.name == "glDrawArrays")
+        {
+            CPPUNIT_ASSERT(c.count == drawCount);
+            CPPUNIT_ASSERT(c.total == draws);
+        }
+        else
+        {
+            CPPUNIT_ASSERT(c.name == "eglSwapBuffers");
+            CPPUNIT_ASSERT(c.count == frames.size());
+            CPPUNIT_ASSERT(c.total == swap);
+            CPPUNIT_ASSERT(c.max == maxSwap);
+        }
+        total += c.total;
+    }
+    // All time between the first and the last timestamp is accounted for
+    CPPUNIT_ASSERT(total == analysis.duration());
+}
+
+// Replay that is faster than the trace is slowed down to the captured frame timing,
+// and sleeps that overrun are made up by the next frame
+void TimestampAnalysisTest::testPacing()
+{
+    const std::vector<SyntheticFrame> frames = randomFrames(100);
+    writeTrace(frames);
+    TimestampAnalysis analysis;
+    std::vector<uint64_t> swaps;
+    readTrace(analysis, swaps);
+
+    unsigned state = 99;
+    auto random = [&state](unsigned range) { state = state * 1103515245 + 12345; return ((state >> 8) & 0xffffff) % range; };
+    retracer::FramePacer pacer;
+    int64_t now = 7000000000ll;
+    std::vector<int64_t> presented;
+    for (unsigned i = 0; i < swaps.size(); i++)
+    {
+        const uint64_t captured = (i > 0) ? swaps[i] - swaps[i - 1] : 0;
+        now += random(captured / 2 + 1); // replaying the frame
+        const int64_t wait = pacer.frameDone(swaps[i], now);
+        CPPUNIT_ASSERT(wait >= 0);
+        now += wait;
+        presented.push_back(now);
+        now += random(200000); // the sleep ran late
+    }
+    CPPUNIT_ASSERT(pacer.resyncs() == 0);
+    for (unsigned i = 1; i < swaps.size(); i++)
+    {
+        CPPUNIT_ASSERT(presented[i] - presented[0] == (int64_t)(swaps[i] - swaps[0]));
+    }
+
+    // Looping back to the start of the trace starts a new schedule
+    const int64_t wait = pacer.frameDone(swaps[0], now);
+    CPPUNIT_ASSERT(wait == 0);
+    CPPUNIT_ASSERT(pacer.frameDone(swaps[1], now) == (int64_t)(swaps[1] - swaps[0]));
+    CPPUNIT_ASSERT(pacer.resyncs() == 0);
+}
+
+// Frames that replay slower than they were traced
+void TimestampAnalysisTest::testPacingFallsBehind()
+{
+    const std::vector<SyntheticFrame> frames = randomFrames(40);
+    writeTrace(frames);
+    TimestampAnalysis analysis;
+    std::vector<uint64_t> swaps;
+    readTrace(analysis, swaps);
+
+    retracer::FramePacer pacer(100000000);
+    int64_t now = 0;
+    std::vector<int64_t> presented;
+    for (unsigned i = 0; i < swaps.size(); i++)
+    {
+        if (i == 10) now += 50000000; // a bit late, made up by the next frames
+        if (i == 20) now += 500000000; // far behind, for instance compiling shaders
+        now += pacer.frameDone(swaps[i], now);
+        presented.push_back(now);
+    }
+    CPPUNIT_ASSERT(pacer.resyncs() == 1);
+    for (unsigned i = 1; i < swaps.size(); i++)
+    {
+        const unsigned base = (i < 20) ? 0 : 20;
+        if (i == 10 || i == 20) continue;
+        if (i > 10 && i < 20 && presented[i] - presented[i - 1] < (int64_t)(swaps[i] - swaps[i - 1])) continue; // catching up
+        CPPUNIT_ASSERT(presented[i] - presented[base] == (int64_t)(swaps[i] - swaps[base]));
+    }
+
+    // Frames without a timestamp of their own are not paced
+    CPPUNIT_ASSERT(pacer.frameDone(swaps.back(), now + 1000) == 0);
+}
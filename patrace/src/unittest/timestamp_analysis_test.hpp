@@ -0,0 +1,29 @@
+#ifndef _INCLUDE_TIMESTAMP_ANALYSIS_TEST_
+#define _INCLUDE_TIMESTAMP_ANALYSIS_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class TimestampAnalysisTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(TimestampAnalysisTest);
+
+    CPPUNIT_TEST(testFrames);
+    CPPUNIT_TEST(testCalls);
+    CPPUNIT_TEST(testPacing);
+    CPPUNIT_TEST(testPacingFallsBehind);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    TimestampAnalysisTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testFrames();
+    void testCalls();
+    void testPacing();
+    void testPacingFallsBehind();
+};
+
+#endif
@@ -0,0 +1,524 @@
+#include "trace_command_emitter_test.hpp"
+#include "fastforwarder/trace_command_emitter.hpp"
+#include "common/in_file_mt.hpp"
+#include "synthetic_trace.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace common;
+using namespace RetraceAndTrim;
+
+TraceCommandEmitterTest::TraceCommandEmitterTest()
+{
+}
+
+void TraceCommandEmitterTest::setUp()
+{
+}
+
+void TraceCommandEmitterTest::tearDown()
+{
+}
+
+typedef std::vector<char> Payload;
+
+static Payload makePayload(size_t size, unsigned seed)
+{
+    Payload p(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        p[i] = (char)((i * 31 + seed * 7) ^ (i >> 8));
+    }
+    return p;
+}
+
+// A restoration as the savers emit it: buffer contents (mappable or not) or a texture level
+struct Restore
+{
+    bool texture;
+    bool canMap;
+    const Payload* payload;
+};
+
+static void emitAll(const std::string& name, const std::vector<Restore>& restores, PayloadPool* pool)
+{
+    OutFile out;
+    CPPUNIT_ASSERT(out.Open(name.c_str()));
+    {
+        TraceCommandEmitter emitter(out, 0, pool);
+        for (const Restore& r : restores)
+        {
+            if (r.texture)
+            {
+                emitter.emitTexSubImage(TraceCommandEmitter::Tex2D, GL_TEXTURE_2D, 0, 0, 0, 0, r.payload->size() / 4, 1, 0,
+                                        GL_RGBA, GL_UNSIGNED_BYTE, r.payload->size(), r.payload->data());
+            }
+            else
+            {
+                emitter.emitBufferContents(GL_ARRAY_BUFFER, r.payload->size(), r.payload->data(), r.canMap);
+            }
+        }
+        emitter.emitDeletePooledBuffers();
+    }
+    const std::string header = syntheticTraceHeader(0, 0);
+    out.WriteHeader(header.c_str(), header.size(), false);
+    out.Close();
+}
+
+static const char* readBlob(char*& src, unsigned& size)
+{
+    src = ReadFixed(src, size);
+    const char* data = src;
+    src += (size + 3) & ~3u;
+    return data;
+}
+
+// Replays the emitted calls on the CPU the way the retracer does, and returns the contents
+// each buffer and texture ended up with, in order. Also counts the calls.
+static std::vector<Payload> replay(const std::string& name, std::map<std::string, int>& counts, unsigned& liveCsbs)
+{
+    std::vector<Payload> restored;
+    std::map<unsigned, Payload> csbs;
+    bool mapped = false;
+
+    InFile in;
+    CPPUNIT_ASSERT(in.Open(name.c_str()));
+    void *fptr = nullptr;
+    BCall_vlen call;
+    char *src = nullptr;
+    while (in.GetNextCall(fptr, call, src))
+    {
+        const std::string func = in.ExIdToName(call.funcId);
+        counts[func]++;
+        char* p = src;
+        uint32_t v = 0;
+        if (func == "glCreateClientSideBuffer")
+        {
+            ReadFixed(p, v);
+            CPPUNIT_ASSERT(csbs.count(v) == 0);
+            csbs[v] = Payload();
+        }
+        else if (func == "glClientSideBufferData")
+        {
+            uint32_t csb = 0;
+            uint32_t size = 0;
+            p = ReadFixed(p, csb);
+            p = ReadFixed(p, size);
+            unsigned len = 0;
+            const char* data = readBlob(p, len);
+            CPPUNIT_ASSERT(len == size && csbs.count(csb) == 1);
+            csbs[csb].assign(data, data + len);
+        }
+        else if (func == "glDeleteClientSideBuffer")
+        {
+            ReadFixed(p, v);
+            CPPUNIT_ASSERT(csbs.erase(v) == 1);
+        }
+        else if (func == "glBufferSubData")
+        {
+            uint32_t target = 0, offset = 0, size = 0;
+            p = ReadFixed(p, target);
+            p = ReadFixed(p, offset);
+            p = ReadFixed(p, size);
+            unsigned len = 0;
+            const char* data = readBlob(p, len);
+            CPPUNIT_ASSERT(target == GL_ARRAY_BUFFER && offset == 0 && len == size);
+            restored.push_back(Payload(data, data + len));
+        }
+        else if (func == "glMapBufferRange")
+        {
+            uint32_t target = 0, offset = 0, length = 0, access = 0;
+            p = ReadFixed(p, target);
+            p = ReadFixed(p, offset);
+            p = ReadFixed(p, length);
+            p = ReadFixed(p, access);
+            CPPUNIT_ASSERT(!mapped && target == GL_ARRAY_BUFFER && offset == 0 && (access & GL_MAP_WRITE_BIT));
+            mapped = true;
+        }
+        else if (func == "glCopyClientSideBuffer")
+        {
+            uint32_t target = 0;
+            p = ReadFixed(p, target);
+            p = ReadFixed(p, v);
+            CPPUNIT_ASSERT(mapped && target == GL_ARRAY_BUFFER && csbs.count(v) == 1);
+            restored.push_back(csbs[v]);
+        }
+        else if (func == "glUnmapBuffer")
+        {
+            CPPUNIT_ASSERT(mapped);
+            mapped = false;
+        }
+        else if (func == "glTexSubImage2D")
+        {
+            uint32_t args[8];
+            for (uint32_t& a : args) p = ReadFixed(p, a);
+            CPPUNIT_ASSERT(args[0] == GL_TEXTURE_2D && args[6] == GL_RGBA && args[7] == GL_UNSIGNED_BYTE);
+            uint32_t type = 0;
+            p = ReadFixed(p, type);
+            if (type == BlobType)
+            {
+                unsigned len = 0;
+                const char* data = readBlob(p, len);
+                CPPUNIT_ASSERT(len == args[4] * 4);
+                restored.push_back(Payload(data, data + len));
+            }
+            else
+            {
+                uint32_t offset = 0;
+                CPPUNIT_ASSERT(type == ClientSideBufferObjectReferenceType);
+                p = ReadFixed(p, v);
+                p = ReadFixed(p, offset);
+                CPPUNIT_ASSERT(csbs.count(v) == 1 && offset == 0);
+                restored.push_back(csbs[v]);
+            }
+        }
+        else
+        {
+            CPPUNIT_FAIL("Unexpected call " + func);
+        }
+    }
+    CPPUNIT_ASSERT(!mapped);
+    liveCsbs = csbs.size();
+    return restored;
+}
+
+static long fileSize(const std::string& name)
+{
+    FILE* fp = fopen(name.c_str(), "rb");
+    CPPUNIT_ASSERT(fp);
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fclose(fp);
+    return size;
+}
+
+static std::vector<Restore> restores(const Payload& atlas, const Payload& zeros, const Payload& small, const Payload& other)
+{
+    return {
+        { true, false, &atlas },
+        { false, true, &zeros },
+        { true, false, &atlas },  // second time, goes into a client-side buffer
+        { false, true, &small },
+        { false, true, &zeros },
+        { true, false, &atlas },  // refers to the same client-side buffer
+        { true, false, &zeros },  // textures and buffers share
+        { false, true, &small },  // too small to share
+        { false, false, &atlas }, // can not be mapped, so written out again
+        { true, false, &other },
+        { false, true, &atlas },
+    };
+}
+
+void TraceCommandEmitterTest::testPayloadsRoundTrip()
+{
+    const Payload atlas = makePayload(64 * 1024, 1);
+    const Payload zeros(32 * 1024, 0);
+    const Payload small = makePayload(PayloadPool::MIN_SIZE - 4, 2);
+    const Payload other = makePayload(64 * 1024, 3);
+    const std::vector<Restore> list = restores(atlas, zeros, small, other);
+
+    const std::string name = "trace_command_emitter_test.pat";
+    PayloadPool pool;
+    emitAll(name, list, &pool);
+
+    std::map<std::string, int> counts;
+    unsigned liveCsbs = 0;
+    const std::vector<Payload> restored = replay(name, counts, liveCsbs);
+    CPPUNIT_ASSERT(restored.size() == list.size());
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        CPPUNIT_ASSERT(restored[i] == *list[i].payload);
+    }
+
+    // One client-side buffer each for atlas and zeros, deleted again at the end
+    CPPUNIT_ASSERT(counts["glCreateClientSideBuffer"] == 2);
+    CPPUNIT_ASSERT(counts["glClientSideBufferData"] == 2);
+    CPPUNIT_ASSERT(counts["glDeleteClientSideBuffer"] == 2);
+    CPPUNIT_ASSERT(liveCsbs == 0);
+    CPPUNIT_ASSERT(counts["glCopyClientSideBuffer"] == 2);
+    CPPUNIT_ASSERT(counts["glBufferSubData"] == 4);
+    CPPUNIT_ASSERT(pool.stats().payloads == 8);
+    CPPUNIT_ASSERT(pool.stats().reused == 5);
+    CPPUNIT_ASSERT(pool.stats().savedBytes == 2 * atlas.size() + zeros.size());
+
+    // The same restorations without sharing make a bigger trace
+    const std::string plain = "trace_command_emitter_test_plain.pat";
+    emitAll(plain, list, nullptr);
+    CPPUNIT_ASSERT(fileSize(name) < fileSize(plain));
+    remove(name.c_str());
+    remove(plain.c_str());
+}
+
+void TraceCommandEmitterTest::testWithoutPool()
+{
+    const Payload atlas = makePayload(64 * 1024, 1);
+    const Payload zeros(32 * 1024, 0);
+    const Payload small = makePayload(100, 2);
+    const Payload other = makePayload(64 * 1024, 3);
+    const std::vector<Restore> list = restores(atlas, zeros, small, other);
+
+    const std::string name = "trace_command_emitter_test_plain.pat";
+    emitAll(name, list, nullptr);
+
+    std::map<std::string, int> counts;
+    unsigned liveCsbs = 0;
+    const std::vector<Payload> restored = replay(name, counts, liveCsbs);
+    CPPUNIT_ASSERT(restored.size() == list.size());
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        CPPUNIT_ASSERT(restored[i] == *list[i].payload);
+    }
+    CPPUNIT_ASSERT(counts["glCreateClientSideBuffer"] == 0);
+    CPPUNIT_ASSERT(counts["glBufferSubData"] == 6);
+    CPPUNIT_ASSERT(counts["glTexSubImage2D"] == 5);
+    remove(name.c_str());
+}
+
+// Replays a trace with one glBindBuffer or glBindTexture before each restoration, and returns
+// the contents each object ended up with. Writes may go to any offset or row, and buffers may be
+// copied onto themselves, so the contents are put together the way the driver would. Also counts
+// the calls, and the bytes of contents in the trace as "blobBytes".
+static std::vector<Payload> replaySparse(const std::string& name, size_t rowSize, std::map<std::string, int>& counts)
+{
+    std::vector<Payload> restored;
+    std::map<unsigned, Payload> csbs;
+
+    InFile in;
+    CPPUNIT_ASSERT(in.Open(name.c_str()));
+    void *fptr = nullptr;
+    BCall_vlen call;
+    char *src = nullptr;
+    while (in.GetNextCall(fptr, call, src))
+    {
+        const std::string func = in.ExIdToName(call.funcId);
+        counts[func]++;
+        char* p = src;
+        uint32_t v = 0;
+        if (func == "glBindBuffer" || func == "glBindTexture")
+        {
+            restored.push_back(Payload());
+        }
+        else if (func == "glCreateClientSideBuffer")
+        {
+            ReadFixed(p, v);
+            csbs[v] = Payload();
+        }
+        else if (func == "glClientSideBufferData")
+        {
+            uint32_t csb = 0;
+            uint32_t size = 0;
+            p = ReadFixed(p, csb);
+            p = ReadFixed(p, size);
+            unsigned len = 0;
+            const char* data = readBlob(p, len);
+            CPPUNIT_ASSERT(csbs.count(csb) == 1);
+            csbs[csb].assign(data, data + len);
+            counts["blobBytes"] += len;
+        }
+        else if (func == "glDeleteClientSideBuffer")
+        {
+            ReadFixed(p, v);
+            CPPUNIT_ASSERT(csbs.erase(v) == 1);
+        }
+        else if (func == "glBufferSubData")
+        {
+            uint32_t target = 0, offset = 0, size = 0;
+            p = ReadFixed(p, target);
+            p = ReadFixed(p, offset);
+            p = ReadFixed(p, size);
+            unsigned len = 0;
+            const char* data = readBlob(p, len);
+            CPPUNIT_ASSERT(!restored.empty() && len == size);
+            counts["blobBytes"] += len;
+            Payload& buffer = restored.back();
+            buffer.resize(std::max<size_t>(buffer.size(), offset + size));
+            memcpy(buffer.data() + offset, data, size);
+        }
+        else if (func == "glMapBufferRange" || func == "glUnmapBuffer")
+        {
+            // Checked by replay()
+        }
+        else if (func == "glCopyClientSideBuffer")
+        {
+            uint32_t target = 0;
+            p = ReadFixed(p, target);
+            p = ReadFixed(p, v);
+            CPPUNIT_ASSERT(!restored.empty() && csbs.count(v) == 1);
+            restored.back() = csbs[v];
+        }
+        else if (func == "glCopyBufferSubData")
+        {
+            uint32_t readTarget = 0, writeTarget = 0, readOffset = 0, writeOffset = 0, size = 0;
+            p = ReadFixed(p, readTarget);
+            p = ReadFixed(p, writeTarget);
+            p = ReadFixed(p, readOffset);
+            p = ReadFixed(p, writeOffset);
+            p = ReadFixed(p, size);
+            // Ranges in the same buffer must not overlap
+            CPPUNIT_ASSERT(readTarget == writeTarget && (readOffset + size <= writeOffset || writeOffset + size <= readOffset));
+            Payload& buffer = restored.back();
+            CPPUNIT_ASSERT(readOffset + size <= buffer.size());
+            buffer.resize(std::max<size_t>(buffer.size(), writeOffset + size));
+            memcpy(buffer.data() + writeOffset, buffer.data() + readOffset, size);
+        }
+        else if (func == "glTexSubImage2D")
+        {
+            uint32_t args[8];
+            for (uint32_t& a : args) p = ReadFixed(p, a);
+            CPPUNIT_ASSERT(args[2] == 0 && args[4] * 4 == rowSize);
+            const size_t size = args[5] * rowSize;
+            uint32_t type = 0;
+            p = ReadFixed(p, type);
+            const char* data = nullptr;
+            if (type == BlobType)
+            {
+                unsigned len = 0;
+                data = readBlob(p, len);
+                CPPUNIT_ASSERT(len == size);
+                counts["blobBytes"] += len;
+            }
+            else
+            {
+                uint32_t offset = 0;
+                CPPUNIT_ASSERT(type == ClientSideBufferObjectReferenceType);
+                p = ReadFixed(p, v);
+                p = ReadFixed(p, offset);
+                CPPUNIT_ASSERT(csbs.count(v) == 1 && offset + size <= csbs[v].size());
+                data = csbs[v].data() + offset;
+            }
+            Payload& image = restored.back();
+            image.resize(std::max<size_t>(image.size(), (args[3] + args[5]) * rowSize));
+            memcpy(image.data() + args[3] * rowSize, data, size);
+        }
+        else
+        {
+            CPPUNIT_FAIL("Unexpected call " + func);
+        }
+    }
+    CPPUNIT_ASSERT(csbs.empty());
+    return restored;
+}
+
+void TraceCommandEmitterTest::testSparseBuffers()
+{
+    // Mostly empty buffers, as engines allocate them up front
+    Payload sparse(1024 * 1024, 0);
+    const Payload vertices = makePayload(10000, 4);
+    memcpy(sparse.data() + 3, vertices.data(), vertices.size());
+    memcpy(sparse.data() + 500000, vertices.data(), 100);
+    memcpy(sparse.data() + sparse.size() - 7, vertices.data(), 7);
+    Payload cleared(256 * 1024 + 12);
+    for (size_t i = 0; i < cleared.size(); ++i)
+    {
+        cleared[i] = (char)(0x40 + i % 16); // one vec4 value
+    }
+    const Payload dense = makePayload(64 * 1024, 5);
+    const std::vector<const Payload*> list = { &sparse, &cleared, &dense, &dense };
+
+    const std::string name = "trace_command_emitter_test_sparse.pat";
+    PayloadPool pool;
+    {
+        OutFile out;
+        CPPUNIT_ASSERT(out.Open(name.c_str()));
+        {
+            TraceCommandEmitter emitter(out, 0, &pool);
+            for (const Payload* payload : list)
+            {
+                emitter.emitBindBuffer(GL_ARRAY_BUFFER, 1);
+                emitter.emitSparseBufferContents(GL_ARRAY_BUFFER, payload->size(), payload->data(), true);
+            }
+            emitter.emitDeletePooledBuffers();
+        }
+        const std::string header = syntheticTraceHeader(0, 0);
+        out.WriteHeader(header.c_str(), header.size(), false);
+        out.Close();
+    }
+
+    std::map<std::string, int> counts;
+    const std::vector<Payload> restored = replaySparse(name, 0, counts);
+    CPPUNIT_ASSERT(restored.size() == list.size());
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        CPPUNIT_ASSERT(restored[i] == *list[i]);
+    }
+    // The dense buffer has no fills, and is shared the second time
+    CPPUNIT_ASSERT(pool.stats().fills == 3);
+    CPPUNIT_ASSERT(pool.stats().filledBytes > sparse.size() - vertices.size() - 200 + cleared.size() - 16);
+    CPPUNIT_ASSERT(counts["glCopyClientSideBuffer"] == 1);
+    // Only the bytes between the fills end up in the trace, not the megabyte of zeros
+    CPPUNIT_ASSERT(counts["blobBytes"] < (int)(2 * dense.size() + vertices.size() + 2048));
+    remove(name.c_str());
+}
+
+void TraceCommandEmitterTest::testSparseTextures()
+{
+    // A 256x256 RGBA8 render target: cleared to one colour, a band of drawn rows, the
+    // colour again and then a different clear colour at the bottom
+    const size_t width = 256;
+    const size_t height = 256;
+    const size_t rowSize = width * 4;
+    Payload image(rowSize * height);
+    const unsigned char colour[4] = { 0x10, 0x20, 0x30, 0xff };
+    const unsigned char black[4] = { 0, 0, 0, 0xff };
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            memcpy(image.data() + y * rowSize + x * 4, y < 200 ? colour : black, 4);
+        }
+    }
+    const Payload drawn = makePayload(rowSize * 20, 6);
+    memcpy(image.data() + 100 * rowSize, drawn.data(), drawn.size());
+    image[3 * rowSize + 17] = 0x55; // a single texel of a short row band that is written out
+    const Payload noise = makePayload(rowSize * 64, 7);
+    Payload empty(rowSize * 300, 0);
+
+    struct Image
+    {
+        const Payload* payload;
+        size_t height;
+    };
+    const std::vector<Image> list = { { &image, height }, { &noise, 64 }, { &image, height }, { &empty, 300 } };
+
+    const std::string name = "trace_command_emitter_test_sparse.pat";
+    PayloadPool pool;
+    {
+        OutFile out;
+        CPPUNIT_ASSERT(out.Open(name.c_str()));
+        {
+            TraceCommandEmitter emitter(out, 0, &pool);
+            for (const Image& i : list)
+            {
+                emitter.emitBindTexture(GL_TEXTURE_2D, 1);
+                emitter.emitSparseTexSubImage(TraceCommandEmitter::Tex2D, GL_TEXTURE_2D, 0, 0, width, i.height, 0,
+                                              GL_RGBA, GL_UNSIGNED_BYTE, 4, i.payload->data());
+            }
+            emitter.emitDeletePooledBuffers();
+        }
+        const std::string header = syntheticTraceHeader(0, 0);
+        out.WriteHeader(header.c_str(), header.size(), false);
+        out.Close();
+    }
+
+    std::map<std::string, int> counts;
+    const std::vector<Payload> restored = replaySparse(name, rowSize, counts);
+    CPPUNIT_ASSERT(restored.size() == list.size());
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        CPPUNIT_ASSERT(restored[i] == *list[i].payload);
+    }
+    // Three fill bands in each copy of image (colour above and below the drawn rows, and black)
+    // and one in empty. The top rows are too few for a band, as one of them is not filled.
+    CPPUNIT_ASSERT(pool.stats().fills == 7);
+    CPPUNIT_ASSERT(pool.stats().filledBytes == (2 * (96 + 80 + 56) + 300) * rowSize);
+    // Fill buffers of 64 rows of colour, 56 rows of black and 64 rows of zeros, and the rows
+    // written out for image, shared the second time
+    CPPUNIT_ASSERT(counts["glCreateClientSideBuffer"] == 5);
+    CPPUNIT_ASSERT(counts["blobBytes"] == (int)(2 * (4 * rowSize + drawn.size()) + noise.size() + (64 + 56 + 64) * rowSize));
+    remove(name.c_str());
+}
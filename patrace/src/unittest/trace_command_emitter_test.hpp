@@ -0,0 +1,29 @@
+#ifndef _INCLUDE_TRACE_COMMAND_EMITTER_TEST_
+#define _INCLUDE_TRACE_COMMAND_EMITTER_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class TraceCommandEmitterTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(TraceCommandEmitterTest);
+
+    CPPUNIT_TEST(testPayloadsRoundTrip);
+    CPPUNIT_TEST(testWithoutPool);
+    CPPUNIT_TEST(testSparseBuffers);
+    CPPUNIT_TEST(testSparseTextures);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    TraceCommandEmitterTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testPayloadsRoundTrip();
+    void testWithoutPool();
+    void testSparseBuffers();
+    void testSparseTextures();
+};
+
+#endif
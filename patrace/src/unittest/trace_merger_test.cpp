@@ -0,0 +1,274 @@
+#include "trace_merger_test.hpp"
+#include "tool/trace_merger.hpp"
+#include "common/file_format.hpp"
+#include "synthetic_trace.hpp"
+
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace common;
+
+static const uint32_t GL_ARRAY_BUFFER_ = 0x8892;
+static const uint32_t GL_STATIC_DRAW_ = 0x88E4;
+static const uint32_t GL_TEXTURE_2D_ = 0x0DE1;
+static const uint32_t GL_RGBA_ = 0x1908;
+static const uint32_t GL_UNSIGNED_BYTE_ = 0x1401;
+
+// A call of a synthetic trace, as it should appear in the merged trace
+struct ExpectedCall
+{
+    std::string name;
+    unsigned trace;
+    unsigned tid;
+    uint64_t timestamp;
+    int draw; // index of glDrawArrays calls, -1 for other calls
+};
+
+struct SyntheticTrace
+{
+    std::vector<ExpectedCall> calls;
+    unsigned timestamps = 0;
+};
+
+static void writeCall(SyntheticTraceWriter& out, SyntheticTrace& trace, unsigned index, uint64_t timestamp, const char *name, unsigned char tid, const std::vector<uint32_t>& args, int draw = -1)
+{
+    CPPUNIT_ASSERT(out.write(name, tid, args));
+    if (strcmp(name, "paTimestamp") == 0)
+    {
+        trace.timestamps++;
+    }
+    else
+    {
+        trace.calls.push_back({ name, index, tid, timestamp, draw });
+    }
+}
+
+// One window surface and context, then draw calls on two threads with randomly spaced
+// timestamps. Every largeEvery draws, a glBufferData call with largeSize bytes is added.
+static SyntheticTrace writeTrace(const std::string& name, unsigned index, int draws, int largeEvery, unsigned largeSize)
+{
+    SyntheticTrace trace;
+    unsigned state = 1234 + index;
+    auto random = [&state]() { state = state * 1103515245 + 12345; return (state >> 16) & 0x7fff; };
+
+    SyntheticTraceWriter out;
+    CPPUNIT_ASSERT(out.open(name));
+    uint64_t timestamp = 1000 + random() % 100;
+    auto stamp = [&]() { writeCall(out, trace, index, timestamp, "paTimestamp", 0, { (uint32_t)timestamp, (uint32_t)(timestamp >> 32) }); };
+
+    stamp();
+    // eglCreateWindowSurface2(dpy, config, win, attrib_list, x, y, width, height) -> surface
+    writeCall(out, trace, index, timestamp, "eglCreateWindowSurface2", 0, { 1, 1, 1, 0, 0, 0, 64, 64, 1 });
+    // eglCreateContext(dpy, config, share_context, attrib_list) -> context
+    writeCall(out, trace, index, timestamp, "eglCreateContext", 0, { 1, 1, 0, 0, 1 });
+    writeCall(out, trace, index, timestamp, "eglMakeCurrent", 0, { 1, 1, 1, 1, 1 });
+    std::vector<uint32_t> bufferData(largeSize / sizeof(uint32_t) + 4, index);
+    bufferData[0] = GL_ARRAY_BUFFER_;
+    bufferData[1] = largeSize;
+    bufferData[2] = largeSize;
+    bufferData.back() = GL_STATIC_DRAW_;
+    for (int i = 0; i < draws; ++i)
+    {
+        if (random() % 4 == 0)
+        {
+            timestamp += random() % 50;
+            stamp();
+        }
+        if (largeEvery && i % largeEvery == 0)
+        {
+            writeCall(out, trace, index, timestamp, "glBufferData", 0, bufferData);
+        }
+        writeCall(out, trace, index, timestamp, "glDrawArrays", (i % 3 == 0) ? 1 : 0, { 4, index, (uint32_t)i }, i);
+    }
+    writeCall(out, trace, index, timestamp, "eglSwapBuffers", 0, { 1, 1, 1 });
+
+    out.close(1);
+    return trace;
+}
+
+// Straightforward version of the merge order: the call with the lowest timestamp,
+// from the first trace on ties
+static std::vector<ExpectedCall> expectedOrder(const std::vector<SyntheticTrace>& traces)
+{
+    std::vector<ExpectedCall> result;
+    std::vector<size_t> next(traces.size(), 0);
+    while (true)
+    {
+        int best = -1;
+        for (unsigned t = 0; t < traces.size(); ++t)
+        {
+            if (next[t] < traces[t].calls.size() && (best < 0 || traces[t].calls[next[t]].timestamp < traces[best].calls[next[best]].timestamp))
+            {
+                best = t;
+            }
+        }
+        if (best < 0)
+        {
+            return result;
+        }
+        result.push_back(traces[best].calls[next[best]++]);
+    }
+}
+
+static void checkMerge(unsigned traceCount, int draws, int largeEvery = 0, unsigned largeSize = 0)
+{
+    std::vector<std::string> names;
+    std::vector<SyntheticTrace> traces;
+    unsigned timestamps = 0;
+    for (unsigned t = 0; t < traceCount; ++t)
+    {
+        names.push_back("trace_merger_test_" + std::to_string(t) + ".pat");
+        traces.push_back(writeTrace(names.back(), t, draws, largeEvery, largeSize));
+        timestamps += traces.back().timestamps;
+    }
+    const std::string merged = "trace_merger_test_merged.pat";
+    MergeResult result;
+    CPPUNIT_ASSERT(mergeTraces(names, merged, &result));
+
+    const std::vector<ExpectedCall> expected = expectedOrder(traces);
+    CPPUNIT_ASSERT(result.calls == expected.size());
+    CPPUNIT_ASSERT(result.timestamps == timestamps);
+    CPPUNIT_ASSERT(result.skipped == 0);
+
+    std::map<std::pair<unsigned, unsigned>, unsigned> tids;
+    std::set<unsigned> usedTids;
+    std::vector<uint32_t> surfaces(traceCount, 0);
+    std::vector<uint32_t> contexts(traceCount, 0);
+    size_t i = 0;
+    Json::Value header;
+    CPPUNIT_ASSERT(readSyntheticTrace(merged, [&](const TestCall& call)
+    {
+        CPPUNIT_ASSERT(i < expected.size());
+        const ExpectedCall& e = expected[i++];
+        CPPUNIT_ASSERT(e.name == call.name);
+        const uint32_t *args = call.args.data();
+
+        // Every thread of every input gets its own thread in the output
+        const auto thread = std::make_pair(e.trace, e.tid);
+        if (tids.count(thread) == 0)
+        {
+            CPPUNIT_ASSERT(usedTids.insert(call.tid).second);
+            tids[thread] = call.tid;
+        }
+        CPPUNIT_ASSERT(tids[thread] == call.tid);
+
+        if (e.draw >= 0)
+        {
+            CPPUNIT_ASSERT(args[1] == e.trace && args[2] == (uint32_t)e.draw);
+        }
+        else if (e.name == "eglCreateWindowSurface2")
+        {
+            surfaces[e.trace] = args[8];
+            CPPUNIT_ASSERT(args[2] == args[8]);
+        }
+        else if (e.name == "eglCreateContext")
+        {
+            contexts[e.trace] = args[4];
+        }
+        else if (e.name == "eglMakeCurrent")
+        {
+            CPPUNIT_ASSERT(args[1] == surfaces[e.trace] && args[2] == surfaces[e.trace]);
+            CPPUNIT_ASSERT(args[3] == contexts[e.trace]);
+        }
+        else if (e.name == "eglSwapBuffers")
+        {
+            CPPUNIT_ASSERT(args[1] == surfaces[e.trace]);
+        }
+        else if (e.name == "glBufferData")
+        {
+            CPPUNIT_ASSERT(args[1] == largeSize && args[2] == largeSize);
+            CPPUNIT_ASSERT(args[3] == e.trace && args[2 + largeSize / sizeof(uint32_t)] == e.trace);
+            CPPUNIT_ASSERT(args[3 + largeSize / sizeof(uint32_t)] == GL_STATIC_DRAW_);
+        }
+    }, &header));
+    CPPUNIT_ASSERT(i == expected.size());
+    CPPUNIT_ASSERT(header["callCnt"].asUInt() == expected.size());
+    CPPUNIT_ASSERT(header["frameCnt"].asUInt() == traceCount);
+
+    // Names created by different traces do not collide
+    CPPUNIT_ASSERT(std::set<uint32_t>(surfaces.begin(), surfaces.end()).size() == traceCount);
+    CPPUNIT_ASSERT(std::set<uint32_t>(contexts.begin(), contexts.end()).size() == traceCount);
+
+    for (const std::string& name : names)
+    {
+        unlink(name.c_str());
+    }
+    unlink(merged.c_str());
+}
+
+TraceMergerTest::TraceMergerTest()
+{
+}
+
+void TraceMergerTest::setUp()
+{
+}
+
+void TraceMergerTest::tearDown()
+{
+}
+
+void TraceMergerTest::testTwoTraces()
+{
+    checkMerge(2, 2000);
+}
+
+// Enough calls that every input is handed over in several batches
+void TraceMergerTest::testManyTraces()
+{
+    checkMerge(1, 1000);
+    checkMerge(3, 20000);
+    checkMerge(8, 70000);
+}
+
+// Calls larger than a batch
+void TraceMergerTest::testLargeCalls()
+{
+    checkMerge(3, 1000, 50, 1536 * 1024);
+}
+
+// Calls of traces older than HEADER_VERSION_4 are re-encoded, not copied
+void TraceMergerTest::testOldFormat()
+{
+    const std::vector<std::string> names = { "trace_merger_test_0.pat", "trace_merger_test_1.pat" };
+    const std::vector<uint32_t> texImage = { GL_TEXTURE_2D_, 0, GL_RGBA_, 1, 1, 0, GL_RGBA_, GL_UNSIGNED_BYTE_ };
+    std::vector<uint32_t> current = texImage;
+    current.insert(current.end(), { BlobType, 4, 0xff336699 });
+    std::vector<uint32_t> old = texImage;
+    old.insert(old.end(), { 4, 0xff336699 });
+    for (unsigned t = 0; t < names.size(); ++t)
+    {
+        SyntheticTraceWriter out;
+        CPPUNIT_ASSERT(out.open(names[t]));
+        CPPUNIT_ASSERT(out.write("paTimestamp", 0, { 1000 + t, 0 }));
+        CPPUNIT_ASSERT(out.write("glTexImage2D", 0, (t == 0) ? current : old));
+        CPPUNIT_ASSERT(out.write("glDrawArrays", 0, { 4, t, 0 }));
+        out.close(0);
+    }
+    CPPUNIT_ASSERT(setSyntheticTraceVersion(names[1], HEADER_VERSION_3));
+    const std::string merged = "trace_merger_test_merged.pat";
+    MergeResult result;
+    CPPUNIT_ASSERT(mergeTraces(names, merged, &result));
+    CPPUNIT_ASSERT(result.calls == 4);
+
+    std::vector<TestCall> calls;
+    CPPUNIT_ASSERT(readSyntheticTrace(merged, calls));
+    unsigned texImages = 0;
+    for (const TestCall& call : calls)
+    {
+        if (call.name != "glTexImage2D") continue;
+        CPPUNIT_ASSERT(call.args == current);
+        texImages++;
+    }
+    CPPUNIT_ASSERT(texImages == 2);
+
+    for (const std::string& name : names)
+    {
+        unlink(name.c_str());
+    }
+    unlink(merged.c_str());
+}
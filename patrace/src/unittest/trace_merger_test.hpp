@@ -0,0 +1,29 @@
+#ifndef _INCLUDE_TRACE_MERGER_TEST_
+#define _INCLUDE_TRACE_MERGER_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class TraceMergerTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(TraceMergerTest);
+
+    CPPUNIT_TEST(testTwoTraces);
+    CPPUNIT_TEST(testManyTraces);
+    CPPUNIT_TEST(testLargeCalls);
+    CPPUNIT_TEST(testOldFormat);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    TraceMergerTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testTwoTraces();
+    void testManyTraces();
+    void testLargeCalls();
+    void testOldFormat();
+};
+
+#endif
@@ -0,0 +1,54 @@
+// Measures the RGBA to YV12/NV12 conversion used by rgba_to_yuv (see tool/yuv_convert.hpp),
+// and reports the throughput of each kernel in megapixels per second.
+// CPU only, no GL context is needed.
+
+#include "tool/yuv_convert.hpp"
+#include "common/os_time.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+typedef int (*ConvertFunction)(const unsigned char *rgba, unsigned char *yuv, int width, int height, YuvKernel kernel, int threads);
+
+static void run(const char *label, ConvertFunction convert, const std::vector<unsigned char>& rgba, std::vector<unsigned char>& yuv,
+                int width, int height, YuvKernel kernel, int threads, int repeats)
+{
+    const long long begin = os::getTime();
+    for (int i = 0; i < repeats; ++i)
+    {
+        convert(rgba.data(), yuv.data(), width, height, kernel, threads);
+    }
+    const long long end = os::getTime();
+    const double seconds = (double)(end - begin) / os::timeFrequency;
+    const double megapixels = (double)width * height * repeats / 1000000.0;
+    printf("%-28s %3d thread(s) %9.3f ms/image %9.1f MP/s\n", label, threads, seconds * 1000.0 / repeats, megapixels / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    const int width = (argc > 1) ? atoi(argv[1]) : 1920;
+    const int height = (argc > 2) ? atoi(argv[2]) : 1080;
+    const int repeats = (argc > 3) ? atoi(argv[3]) : 20;
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<unsigned char> rgba((size_t)width * height * 4);
+    for (unsigned char &c : rgba)
+    {
+        c = rand() & 0xff;
+    }
+    std::vector<unsigned char> yuv(yv12Size(width, height) + 2 * ((width + 15) / 16 * 16));
+    printf("%dx%d, %d repeats, SIMD kernel: %s\n", width, height, repeats, yuvSimdName());
+
+    run("YV12 reference (float)", rgbaToYV12, rgba, yuv, width, height, YUV_KERNEL_REFERENCE, 1, repeats);
+    run("YV12 fixed point scalar", rgbaToYV12, rgba, yuv, width, height, YUV_KERNEL_SCALAR, 1, repeats);
+    run("YV12 fixed point SIMD", rgbaToYV12, rgba, yuv, width, height, YUV_KERNEL_SIMD, 1, repeats);
+    run("YV12 fixed point SIMD", rgbaToYV12, rgba, yuv, width, height, YUV_KERNEL_SIMD, cores, repeats);
+    run("NV12 reference (float)", rgbaToNV12, rgba, yuv, width, height, YUV_KERNEL_REFERENCE, 1, repeats);
+    run("NV12 fixed point scalar", rgbaToNV12, rgba, yuv, width, height, YUV_KERNEL_SCALAR, 1, repeats);
+    run("NV12 fixed point SIMD", rgbaToNV12, rgba, yuv, width, height, YUV_KERNEL_SIMD, 1, repeats);
+    run("NV12 fixed point SIMD", rgbaToNV12, rgba, yuv, width, height, YUV_KERNEL_SIMD, cores, repeats);
+    return 0;
+}
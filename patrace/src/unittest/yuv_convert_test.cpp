@@ -0,0 +1,134 @@
+#include "yuv_convert_test.hpp"
+#include "tool/yuv_convert.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+typedef int (*ConvertFunction)(const unsigned char *rgba, unsigned char *yuv, int width, int height, YuvKernel kernel, int threads);
+
+// With an odd height, the last chroma row is written past the end of the image
+static std::vector<unsigned char> outputBuffer(int width, int height)
+{
+    return std::vector<unsigned char>(yv12Size(width, height) + 2 * ((width + 15) / 16 * 16), 0xcd);
+}
+
+static std::vector<unsigned char> randomImage(int width, int height)
+{
+    std::vector<unsigned char> rgba(width * height * 4);
+    for (unsigned char &c : rgba)
+    {
+        c = rand() & 0xff;
+    }
+    return rgba;
+}
+
+// Returns the number of bytes that differ, and checks that no byte differs by more than 1
+static int compareToReference(const std::vector<unsigned char>& result, const std::vector<unsigned char>& reference)
+{
+    CPPUNIT_ASSERT(result.size() == reference.size());
+    int differences = 0;
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        const int diff = abs((int)result[i] - (int)reference[i]);
+        CPPUNIT_ASSERT(diff <= 1);
+        differences += diff;
+    }
+    return differences;
+}
+
+YuvConvertTest::YuvConvertTest()
+{
+}
+
+void YuvConvertTest::setUp()
+{
+    srand(1234);
+}
+
+void YuvConvertTest::tearDown()
+{
+}
+
+void YuvConvertTest::testAllColours()
+{
+    // Every RGB value once, checked against the formulas evaluated exactly
+    const int width = 4096;
+    const int height = 4096;
+    std::vector<unsigned char> rgba(width * height * 4);
+    for (int i = 0; i < width * height; ++i)
+    {
+        rgba[i * 4] = i & 0xff;
+        rgba[i * 4 + 1] = (i >> 8) & 0xff;
+        rgba[i * 4 + 2] = i >> 16;
+        rgba[i * 4 + 3] = 0xff;
+    }
+    std::vector<unsigned char> reference = outputBuffer(width, height);
+    rgbaToNV12(rgba.data(), reference.data(), width, height, YUV_KERNEL_REFERENCE, 1);
+
+    for (YuvKernel kernel : { YUV_KERNEL_SCALAR, YUV_KERNEL_SIMD })
+    {
+        std::vector<unsigned char> nv12 = outputBuffer(width, height);
+        CPPUNIT_ASSERT(rgbaToNV12(rgba.data(), nv12.data(), width, height, kernel, 0) == width * height * 3 / 2);
+        for (int i = 0; i < width * height; ++i)
+        {
+            const int r = rgba[i * 4], g = rgba[i * 4 + 1], b = rgba[i * 4 + 2];
+            const int x = i % width, y = i / width;
+            CPPUNIT_ASSERT(nv12[i] == (299 * r + 587 * g + 114 * b) / 1000);
+            if ((x & 0x1) == 0 && (y & 0x1) == 0)
+            {
+                const int c = width * height + (y / 2) * width + x;
+                CPPUNIT_ASSERT(nv12[c] == (-169 * r - 331 * g + 500 * b + 128000) / 1000);
+                CPPUNIT_ASSERT(nv12[c + 1] == (500 * r - 419 * g - 81 * b + 128000) / 1000);
+            }
+        }
+        // The floating point reference only rounds down exact integers
+        const int differences = compareToReference(nv12, reference);
+        CPPUNIT_ASSERT(differences < width * height / 1000);
+    }
+}
+
+void YuvConvertTest::testRandomImages()
+{
+    const int sizes[][2] = { { 1, 1 }, { 2, 2 }, { 3, 5 }, { 15, 7 }, { 16, 16 }, { 17, 3 }, { 31, 9 }, { 33, 33 },
+                             { 64, 2 }, { 100, 75 }, { 127, 128 }, { 640, 361 } };
+    for (ConvertFunction convert : { rgbaToYV12, rgbaToNV12 })
+    {
+        for (const auto& size : sizes)
+        {
+            const int width = size[0], height = size[1];
+            const std::vector<unsigned char> rgba = randomImage(width, height);
+            std::vector<unsigned char> reference = outputBuffer(width, height);
+            std::vector<unsigned char> scalar = outputBuffer(width, height);
+            std::vector<unsigned char> simd = outputBuffer(width, height);
+            const int size0 = convert(rgba.data(), reference.data(), width, height, YUV_KERNEL_REFERENCE, 1);
+            CPPUNIT_ASSERT(convert(rgba.data(), scalar.data(), width, height, YUV_KERNEL_SCALAR, 1) == size0);
+            CPPUNIT_ASSERT(convert(rgba.data(), simd.data(), width, height, YUV_KERNEL_SIMD, 1) == size0);
+            CPPUNIT_ASSERT(scalar == simd);
+            compareToReference(simd, reference);
+        }
+    }
+}
+
+void YuvConvertTest::testThreads()
+{
+    // Large enough to be split between threads, with an odd height so that the last
+    // chroma row overlaps the next plane
+    const int width = 1283;
+    const int height = 1001;
+    const std::vector<unsigned char> rgba = randomImage(width, height);
+    for (ConvertFunction convert : { rgbaToYV12, rgbaToNV12 })
+    {
+        std::vector<unsigned char> single = outputBuffer(width, height);
+        convert(rgba.data(), single.data(), width, height, YUV_KERNEL_SIMD, 1);
+        for (int threads : { 2, 3, 8, 0 })
+        {
+            std::vector<unsigned char> multi = outputBuffer(width, height);
+            convert(rgba.data(), multi.data(), width, height, YUV_KERNEL_SIMD, threads);
+            CPPUNIT_ASSERT(multi == single);
+        }
+        std::vector<unsigned char> reference = outputBuffer(width, height);
+        convert(rgba.data(), reference.data(), width, height, YUV_KERNEL_REFERENCE, 1);
+        compareToReference(single, reference);
+    }
+}
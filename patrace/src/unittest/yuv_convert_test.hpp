@@ -0,0 +1,27 @@
+#ifndef _INCLUDE_YUV_CONVERT_TEST_
+#define _INCLUDE_YUV_CONVERT_TEST_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class YuvConvertTest : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE(YuvConvertTest);
+
+    CPPUNIT_TEST(testAllColours);
+    CPPUNIT_TEST(testRandomImages);
+    CPPUNIT_TEST(testThreads);
+
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+    YuvConvertTest();
+
+    virtual void setUp();
+    virtual void tearDown();
+
+    void testAllColours();
+    void testRandomImages();
+    void testThreads();
+};
+
+#endif